@@ -1111,9 +1111,13 @@ static VC_CONTAINER_STATUS_T avi_reader_read( VC_CONTAINER_T *p_ctx,
          p_state->extra_chunk_data_offs += len;
       }
 
-      /* Now try to read data into buffer */
+      /* Now try to read data into buffer. Borrowing is only possible when
+       * the packet doesn't start with extra data. */
       len = MIN(buffer_size, p_state->chunk_data_left);
-      READ_BYTES(p_ctx, data, len);
+      if (!size)
+         READ_PACKET_BYTES(p_ctx, p_packet, flags, len);
+      else
+         READ_BYTES(p_ctx, data, len);
       size += len;
       p_state->chunk_data_left -= len;
       p_packet->size = size;
@@ -304,6 +304,17 @@ typedef struct VC_CONTAINER_PACKET_T
 
 } VC_CONTAINER_PACKET_T;
 
+/** Structure describing a data packet read with \ref VC_CONTAINER_READ_FLAG_BORROW.
+ * This extends \ref VC_CONTAINER_PACKET_T (which is left unchanged so the ABI is kept) and
+ * must be what the packet passed to \ref vc_container_read points to when using that flag. */
+typedef struct VC_CONTAINER_PACKET_BORROW_T
+{
+   VC_CONTAINER_PACKET_T packet; /**< The packet itself. This must be the first field */
+   void *token;                  /**< Set when the data was borrowed from the i/o instead of
+                                      being copied */
+
+} VC_CONTAINER_PACKET_BORROW_T;
+
 /** \name Container Packet Flags
  * The following flags describe properties of the data packet */
 /* @{ */
@@ -472,6 +483,8 @@ VC_CONTAINER_T *vc_container_open_writer( const char *psz_uri, VC_CONTAINER_STAT
 
 /** Closes an instance of a container reader / writer.
  * This will free all the resources associated with the context.
+ * A reader which still has data lent out (see \ref VC_CONTAINER_READ_FLAG_BORROW) isn't
+ * closed and VC_CONTAINER_ERROR_NOT_READY is returned instead.
  *
  * \param  context   Pointer to the context of the instance to close
  * \return           the status of the operation
@@ -489,6 +502,8 @@ typedef uint32_t VC_CONTAINER_READ_FLAGS_T;
 #define VC_CONTAINER_READ_FLAG_SKIP   2
 /** Force the container to read data from the specified track */
 #define VC_CONTAINER_READ_FLAG_FORCE_TRACK 4
+/** Allow the container to return a pointer to the data in place instead of copying it */
+#define VC_CONTAINER_READ_FLAG_BORROW 8
 /* @} */
 
 /** Reads a data packet from a container reader.
@@ -504,6 +519,15 @@ typedef uint32_t VC_CONTAINER_READ_FLAGS_T;
  * \ref VC_CONTAINER_READ_FLAG_SKIP will instruct the reader to skip the next packet. In this case
  * it isn't necessary for the caller to pass a pointer to a \ref VC_CONTAINER_PACKET_T structure
  * unless the \ref VC_CONTAINER_READ_FLAG_INFO is also given.\n
+ * \ref VC_CONTAINER_READ_FLAG_BORROW will allow the reader to avoid copying the data when it is
+ * already available contiguously in memory (e.g. when the i/o is memory mapped). In this case
+ * the data pointer of the packet is replaced with a pointer to the data in place and the
+ * token field of the packet is set. The packet must then be the packet field of a
+ * \ref VC_CONTAINER_PACKET_BORROW_T structure. The data is read-only and stays valid until the
+ * token is given back with \ref vc_container_release_borrowed. The caller still needs to provide
+ * a buffer (and to set the data pointer again before each read) since the reader falls back to
+ * copying the data whenever it can't be borrowed, in which case the token is set to NULL.
+ * Borrowing is not available when the data needs to be packetized or decrypted.\n
  * A combination of all these flags can be used.
  *
  * \param  context   Pointer to the context of the reader to use
@@ -515,6 +539,15 @@ typedef uint32_t VC_CONTAINER_READ_FLAGS_T;
 VC_CONTAINER_STATUS_T vc_container_read( VC_CONTAINER_T *context,
    VC_CONTAINER_PACKET_T *packet, VC_CONTAINER_READ_FLAGS_T flags );
 
+/** Gives back the data of a packet which was read with \ref VC_CONTAINER_READ_FLAG_BORROW.
+ * This can be called from any thread, but all the borrowed data must have been given back
+ * before the container is closed.
+ *
+ * \param  context  Pointer to the context of the reader which returned the data
+ * \param  token    Token returned in the token field of the \ref VC_CONTAINER_PACKET_BORROW_T
+ */
+void vc_container_release_borrowed( VC_CONTAINER_T *context, void *token );
+
 /** Writes a data packet to a container writer.
  *
  * \param  context   Pointer to the context of the writer to use
@@ -597,6 +630,24 @@ typedef struct VC_CONTAINER_WRITE_STATS_T
    /** This logs the length of time that we wait for a flush command to complete. */
    VC_CONTAINER_STATS_T flush;
 } VC_CONTAINER_WRITE_STATS_T;
+
+/** This type represents the statistics of the read-ahead done by the io layer
+ * (see VC_CONTAINER_CONTROL_IO_SET_READ_AHEAD). */
+typedef struct VC_CONTAINER_READ_AHEAD_STATS_T
+{
+   /** Number of reads which were served from data already read ahead */
+   uint32_t hits;
+   /** Number of reads which had to wait for data being read ahead */
+   uint32_t stalls;
+   /** Number of reads which had to go to the i/o directly */
+   uint32_t misses;
+   /** Total time in microseconds spent waiting for data being read ahead */
+   uint64_t stall_time;
+   /** Number of bytes read ahead */
+   uint64_t bytes_read;
+   /** Number of bytes read ahead which were thrown away because of a seek */
+   uint64_t bytes_discarded;
+} VC_CONTAINER_READ_AHEAD_STATS_T;
    
 
 /** Control operations which can be done on containers. */
@@ -717,6 +768,34 @@ typedef enum
     *   arg2= VC_CONTAINER_FOURCC_T: codec variant to output */
    VC_CONTAINER_CONTROL_TRACK_PACKETIZE,
 
+   /** Make a writer produce a fragmented file, where the samples are written out in
+    * self-contained fragments of (at least) the given duration instead of being indexed
+    * in a single header when the writer is closed. Fragments start on a keyframe.
+    * This must be done before the header is written (see VC_CONTAINER_CONTROL_TRACK_ADD_DONE).\n
+    * Arguments:\n
+    *   arg1= int64_t: fragment duration in microseconds, 0 to disable fragmentation */
+   VC_CONTAINER_CONTROL_SET_FRAGMENT_DURATION,
+
+   /** Enable reading ahead in the background. A thread keeps a number of areas ahead of the
+    * read position filled in while the stream is being read sequentially, so the reader
+    * doesn't have to wait for the storage. This is only available on seekable streams opened
+    * for reading which go through the io cache (e.g. local files or http).\n
+    * Arguments:\n
+    *   arg1= unsigned int: number of areas to read ahead, 0 to disable read-ahead\n
+    *   arg2= unsigned int: size of each area in bytes, 0 for the default size */
+   VC_CONTAINER_CONTROL_IO_SET_READ_AHEAD,
+
+   /** Collects the read-ahead statistics.\n
+    * Arguments:\n
+    *   arg1= VC_CONTAINER_READ_AHEAD_STATS_T *: */
+   VC_CONTAINER_CONTROL_IO_GET_READ_AHEAD_STATS,
+
+   /** Tell the i/o how the stream is going to be accessed, so it can tune the
+    * read-ahead done by the underlying storage.\n
+    * Arguments:\n
+    *   arg1= int: non-zero for sequential access, zero for random access */
+   VC_CONTAINER_CONTROL_IO_HINT_SEQUENTIAL,
+
    /** Private user extensions must be above this number */
    VC_CONTAINER_CONTROL_USER_EXTENSIONS = 0x1000
 
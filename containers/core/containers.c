@@ -184,6 +184,10 @@ VC_CONTAINER_STATUS_T vc_container_close( VC_CONTAINER_T *p_ctx )
    if(!p_ctx)
       return VC_CONTAINER_ERROR_INVALID_ARGUMENT;
 
+   /* The data lent out by the i/o has to be given back first */
+   if(p_ctx->priv->io && vc_container_io_borrowed(p_ctx->priv->io))
+      return VC_CONTAINER_ERROR_NOT_READY;
+
    for(i = 0; i < p_ctx->tracks_num; i++)
       if(p_ctx->tracks[i]->priv->packetizer)
          vc_packetizer_close(p_ctx->tracks[i]->priv->packetizer);
@@ -205,10 +209,31 @@ static VC_CONTAINER_STATUS_T container_read_packet( VC_CONTAINER_T *p_ctx,
    VC_CONTAINER_PACKET_T *p_packet, uint32_t flags )
 {
    VC_CONTAINER_STATUS_T status;
+   VC_CONTAINER_PACKET_BORROW_T *borrow = 0;
+   uint8_t *data = p_packet ? p_packet->data : 0;
+
+   /* The drm filter decrypts the data in place so it can't be borrowed */
+   if(p_ctx->priv->drm_filter)
+      flags &= ~VC_CONTAINER_READ_FLAG_BORROW;
+   if(p_packet && (flags & VC_CONTAINER_READ_FLAG_BORROW))
+      borrow = (VC_CONTAINER_PACKET_BORROW_T *)p_packet;
 
    while(1)
    {
+      /* Borrowing replaces the data pointer so always start from the caller's buffer */
+      if(borrow)
+      {
+         p_packet->data = data;
+         borrow->token = 0;
+      }
+
       status = p_ctx->priv->pf_read(p_ctx, p_packet, flags);
+      if(status != VC_CONTAINER_SUCCESS && borrow && borrow->token)
+      {
+         vc_container_release_borrowed(p_ctx, borrow->token);
+         borrow->token = 0;
+         p_packet->data = data;
+      }
       if(status == VC_CONTAINER_ERROR_CONTINUE)
          continue;
 
@@ -226,6 +251,8 @@ static VC_CONTAINER_STATUS_T container_read_packet( VC_CONTAINER_T *p_ctx,
       {
          if(flags & VC_CONTAINER_READ_FLAG_INFO)
             status = p_ctx->priv->pf_read(p_ctx, p_packet, VC_CONTAINER_READ_FLAG_SKIP);
+         else if(borrow)
+            vc_container_release_borrowed(p_ctx, borrow->token);
          if(status == VC_CONTAINER_SUCCESS || status == VC_CONTAINER_ERROR_CONTINUE)
             continue;
       }
@@ -259,9 +286,15 @@ VC_CONTAINER_STATUS_T vc_container_read( VC_CONTAINER_T *p_ctx, VC_CONTAINER_PAC
       (!p_packet || p_packet->track >= p_ctx->tracks_num || !p_ctx->tracks[p_packet->track]->is_enabled))
       return VC_CONTAINER_ERROR_INVALID_ARGUMENT;
 
-   /* Always having a packet structure to work with simplifies things */
+   /* Always having a packet structure to work with simplifies things. The
+    * internal one can't take borrowed data. */
    if(!p_packet)
+   {
       p_packet = &p_ctx->priv->packetizer_packet;
+      flags &= ~VC_CONTAINER_READ_FLAG_BORROW;
+   }
+   else if(flags & VC_CONTAINER_READ_FLAG_BORROW)
+      ((VC_CONTAINER_PACKET_BORROW_T *)p_packet)->token = 0;
 
    /* Simple/Fast case first */
    if(!p_ctx->priv->packetizing)
@@ -340,6 +373,13 @@ VC_CONTAINER_STATUS_T vc_container_read( VC_CONTAINER_T *p_ctx, VC_CONTAINER_PAC
    return VC_CONTAINER_SUCCESS;
 }
 
+/*****************************************************************************/
+void vc_container_release_borrowed( VC_CONTAINER_T *p_ctx, void *token )
+{
+   if(token)
+      vc_container_io_release(p_ctx->priv->io, token);
+}
+
 /*****************************************************************************/
 VC_CONTAINER_STATUS_T vc_container_write( VC_CONTAINER_T *p_ctx, VC_CONTAINER_PACKET_T *p_packet )
 {
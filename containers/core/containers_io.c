@@ -78,13 +78,20 @@ typedef struct VC_CONTAINER_IO_PRIVATE_T
 
    int64_t actual_offset;
 
+   VC_CONTAINER_IO_MODE_T mode;
+
    struct VC_CONTAINER_IO_ASYNC_T *async_io;
+   struct VC_CONTAINER_IO_READ_AHEAD_T *read_ahead;
+
+   unsigned int borrowed; /**< Blocks of data lent out, can be given back from any thread */
 
 } VC_CONTAINER_IO_PRIVATE_T;
 
 /*****************************************************************************/
 VC_CONTAINER_STATUS_T vc_container_io_file_open( VC_CONTAINER_IO_T *p_ctx, const char *uri,
                                                  VC_CONTAINER_IO_MODE_T mode );
+VC_CONTAINER_STATUS_T vc_container_io_mmap_open( VC_CONTAINER_IO_T *p_ctx, const char *uri,
+                                                 VC_CONTAINER_IO_MODE_T mode );
 VC_CONTAINER_STATUS_T vc_container_io_null_open( VC_CONTAINER_IO_T *p_ctx, const char *uri,
                                                  VC_CONTAINER_IO_MODE_T mode );
 VC_CONTAINER_STATUS_T vc_container_io_net_open( VC_CONTAINER_IO_T *p_ctx, const char *uri,
@@ -103,6 +110,8 @@ static VC_CONTAINER_STATUS_T vc_container_io_cache_seek( VC_CONTAINER_IO_T *p_ct
    VC_CONTAINER_IO_PRIVATE_CACHE_T *cache, int64_t offset );
 static size_t vc_container_io_cache_refill( VC_CONTAINER_IO_T *p_ctx,
    VC_CONTAINER_IO_PRIVATE_CACHE_T *cache );
+static size_t vc_container_io_read_at( VC_CONTAINER_IO_T *p_ctx, int64_t offset,
+   uint8_t *buffer, size_t size );
 static size_t vc_container_io_cache_flush( VC_CONTAINER_IO_T *p_ctx,
    VC_CONTAINER_IO_PRIVATE_CACHE_T *cache, int complete );
 
@@ -114,6 +123,15 @@ static VC_CONTAINER_STATUS_T async_io_wait_complete( struct VC_CONTAINER_IO_ASYN
 static void async_io_stats_initialise( struct VC_CONTAINER_IO_ASYNC_T *ctx, int enable );
 static void async_io_stats_get( struct VC_CONTAINER_IO_ASYNC_T *ctx, VC_CONTAINER_WRITE_STATS_T *stats );
 
+static struct VC_CONTAINER_IO_READ_AHEAD_T *read_ahead_start( VC_CONTAINER_IO_T *io,
+   unsigned int num_areas, size_t area_size, VC_CONTAINER_STATUS_T *status );
+static void read_ahead_stop( struct VC_CONTAINER_IO_READ_AHEAD_T *ctx );
+static size_t read_ahead_read( struct VC_CONTAINER_IO_READ_AHEAD_T *ctx, int64_t offset,
+   uint8_t *buffer, size_t size );
+static void read_ahead_io_lock( struct VC_CONTAINER_IO_READ_AHEAD_T *ctx, int lock );
+static void read_ahead_stats_get( struct VC_CONTAINER_IO_READ_AHEAD_T *ctx,
+   VC_CONTAINER_READ_AHEAD_STATS_T *stats );
+
 /*****************************************************************************/
 static VC_CONTAINER_IO_T *vc_container_io_open_core( const char *uri, VC_CONTAINER_IO_MODE_T mode,
                                                      VC_CONTAINER_IO_CAPABILITIES_T capabilities,
@@ -137,6 +155,7 @@ static VC_CONTAINER_IO_T *vc_container_io_open_core( const char *uri, VC_CONTAIN
    p_ctx->uri_parts = vc_uri_create();
    if(!p_ctx->uri_parts) { status = VC_CONTAINER_ERROR_OUT_OF_MEMORY; goto error; }
    vc_uri_parse(p_ctx->uri_parts, uri);
+   private->mode = mode;
 
    if (b_open)
    {
@@ -147,6 +166,7 @@ static VC_CONTAINER_IO_T *vc_container_io_open_core( const char *uri, VC_CONTAIN
 #ifdef ENABLE_CONTAINER_IO_HTTP
       if(status) status = vc_container_io_http_open(p_ctx, uri, mode);
 #endif
+      if(status) status = vc_container_io_mmap_open(p_ctx, uri, mode);
       if(status) status = vc_container_io_file_open(p_ctx, uri, mode);
       if(status != VC_CONTAINER_SUCCESS) goto error;
 
@@ -236,12 +256,19 @@ VC_CONTAINER_STATUS_T vc_container_io_close( VC_CONTAINER_IO_T *p_ctx )
    {
       if(p_ctx->priv)
       {
+         /* The module can't go away while some of its data is still lent out */
+         if(vc_container_io_borrowed(p_ctx))
+            return VC_CONTAINER_ERROR_NOT_READY;
+
          if(p_ctx->priv->caches_num)
          {
             if(p_ctx->priv->caches.dirty)
                vc_container_io_cache_flush( p_ctx, &p_ctx->priv->caches, 1 );
          }
          
+         if(p_ctx->priv->read_ahead)
+            read_ahead_stop( p_ctx->priv->read_ahead );
+
          if(p_ctx->priv->async_io)
             async_io_stop( p_ctx->priv->async_io );
          else if(p_ctx->priv->caches_num)
@@ -273,6 +300,18 @@ size_t vc_container_io_peek(VC_CONTAINER_IO_T *p_ctx, void *buffer, size_t size)
       return ret;
    }
 
+   if(p_ctx->pf_map)
+   {
+      /* Copy straight from the mapping, no need to move the read position */
+      size_t bytes = size;
+      const uint8_t *data = p_ctx->pf_map(p_ctx, p_ctx->offset, &bytes);
+      if(data && bytes == size)
+      {
+         memcpy(buffer, data, size);
+         return size;
+      }
+   }
+
    if (p_ctx->capabilities & VC_CONTAINER_IO_CAPS_CANT_SEEK)
       return 0;
 
@@ -298,6 +337,44 @@ size_t vc_container_io_read(VC_CONTAINER_IO_T *p_ctx, void *buffer, size_t size)
    return ret;
 }
 
+/*****************************************************************************/
+size_t vc_container_io_read_borrow(VC_CONTAINER_IO_T *p_ctx, uint8_t **data, size_t size, void **token)
+{
+   uint8_t *borrowed = 0;
+
+   /* Data sitting in the cache gets overwritten on the next refill so only the module
+    * itself can lend data */
+   if(token && size && !p_ctx->priv->cache && p_ctx->pf_borrow)
+      borrowed = p_ctx->pf_borrow(p_ctx, size, token);
+   if(!borrowed)
+   {
+      if(token) *token = 0;
+      return vc_container_io_read(p_ctx, *data, size);
+   }
+
+   *data = borrowed;
+   __atomic_add_fetch(&p_ctx->priv->borrowed, 1, __ATOMIC_RELAXED);
+   p_ctx->priv->actual_offset += size;
+   p_ctx->offset += size;
+   return size;
+}
+
+/*****************************************************************************/
+void vc_container_io_release(VC_CONTAINER_IO_T *p_ctx, void *token)
+{
+   if(!token || !p_ctx->pf_release)
+      return;
+
+   p_ctx->pf_release(p_ctx, token);
+   __atomic_sub_fetch(&p_ctx->priv->borrowed, 1, __ATOMIC_RELEASE);
+}
+
+/*****************************************************************************/
+unsigned int vc_container_io_borrowed(VC_CONTAINER_IO_T *p_ctx)
+{
+   return __atomic_load_n(&p_ctx->priv->borrowed, __ATOMIC_ACQUIRE);
+}
+
 /*****************************************************************************/
 size_t vc_container_io_write(VC_CONTAINER_IO_T *p_ctx, const void *buffer, size_t size)
 {
@@ -402,12 +479,42 @@ static VC_CONTAINER_STATUS_T io_seek_not_seekable(VC_CONTAINER_IO_T *p_ctx, int6
 VC_CONTAINER_STATUS_T vc_container_io_control_list(VC_CONTAINER_IO_T *context, VC_CONTAINER_CONTROL_T operation, va_list args)
 {
    VC_CONTAINER_STATUS_T status = VC_CONTAINER_ERROR_UNSUPPORTED_OPERATION;
+   struct VC_CONTAINER_IO_READ_AHEAD_T *read_ahead = context->priv->read_ahead;
 
    if (context->pf_control)
+   {
+      if(read_ahead) read_ahead_io_lock(read_ahead, 1);
       status = context->pf_control(context, operation, args);
+      if(read_ahead) read_ahead_io_lock(read_ahead, 0);
+   }
 
    /* Option to add generic I/O control here */
 
+   if(operation == VC_CONTAINER_CONTROL_IO_SET_READ_AHEAD)
+   {
+      unsigned int num_areas = va_arg(args, unsigned int);
+      unsigned int area_size = va_arg(args, unsigned int);
+
+      /* Read-ahead goes through the main cache and needs to be able to seek */
+      if(context->priv->mode != VC_CONTAINER_IO_MODE_READ || !context->priv->caches_num ||
+         (context->capabilities & VC_CONTAINER_IO_CAPS_CANT_SEEK))
+         return VC_CONTAINER_ERROR_UNSUPPORTED_OPERATION;
+
+      if(read_ahead)
+         read_ahead_stop(read_ahead);
+      context->priv->read_ahead = 0;
+
+      status = VC_CONTAINER_SUCCESS;
+      if(num_areas)
+         context->priv->read_ahead = read_ahead_start(context, num_areas, area_size, &status);
+   }
+
+   if(operation == VC_CONTAINER_CONTROL_IO_GET_READ_AHEAD_STATS && read_ahead)
+   {
+      status = VC_CONTAINER_SUCCESS;
+      read_ahead_stats_get(read_ahead, va_arg(args, VC_CONTAINER_READ_AHEAD_STATS_T *));
+   }
+
    if(operation == VC_CONTAINER_CONTROL_IO_FLUSH && context->priv->cache)
    {
       status = VC_CONTAINER_SUCCESS;
@@ -492,10 +599,9 @@ size_t vc_container_io_cache(VC_CONTAINER_IO_T *p_ctx, size_t size)
    /* Read the rest of the cache directly from the stream */
    if(cache->mem_size > cache->size)
    {
-      size_t ret = cache->io->pf_read(cache->io, cache->buffer + cache->size,
-                                      cache->mem_size - cache->size);
+      size_t ret = vc_container_io_read_at(cache->io, cache->offset + cache->size,
+                                           cache->buffer + cache->size, cache->mem_size - cache->size);
       cache->size += ret;
-      cache->io->priv->actual_offset = cache->offset + cache->size;
    }
 
    status = vc_container_io_seek(p_ctx, cache->end);
@@ -509,23 +615,38 @@ size_t vc_container_io_cache(VC_CONTAINER_IO_T *p_ctx, size_t size)
 }
 
 /*****************************************************************************/
-static size_t vc_container_io_cache_refill( VC_CONTAINER_IO_T *p_ctx,
-   VC_CONTAINER_IO_PRIVATE_CACHE_T *cache )
+static size_t vc_container_io_read_at( VC_CONTAINER_IO_T *p_ctx, int64_t offset,
+   uint8_t *buffer, size_t size )
 {
-   size_t ret = vc_container_io_cache_flush( p_ctx, cache, 1 );
+   size_t ret;
 
-   if(ret) return 0; /* TODO what should we do there ? */
+   /* The read-ahead thread owns the i/o module while it is running */
+   if(p_ctx->priv->read_ahead)
+      return read_ahead_read( p_ctx->priv->read_ahead, offset, buffer, size );
 
-   if(p_ctx->priv->actual_offset != cache->offset)
+   if(p_ctx->priv->actual_offset != offset)
    {
-      if(cache->io->pf_seek(cache->io, cache->offset) != VC_CONTAINER_SUCCESS)
+      if(p_ctx->pf_seek(p_ctx, offset) != VC_CONTAINER_SUCCESS)
          return 0;
    }
 
-   ret = cache->io->pf_read(cache->io, cache->buffer, cache->buffer_end - cache->buffer);
+   ret = p_ctx->pf_read(p_ctx, buffer, size);
+   p_ctx->priv->actual_offset = offset + ret;
+   return ret;
+}
+
+/*****************************************************************************/
+static size_t vc_container_io_cache_refill( VC_CONTAINER_IO_T *p_ctx,
+   VC_CONTAINER_IO_PRIVATE_CACHE_T *cache )
+{
+   size_t ret = vc_container_io_cache_flush( p_ctx, cache, 1 );
+
+   if(ret) return 0; /* TODO what should we do there ? */
+
+   ret = vc_container_io_read_at(cache->io, cache->offset, cache->buffer,
+                                 cache->buffer_end - cache->buffer);
    cache->size = ret;
    cache->position = 0;
-   cache->io->priv->actual_offset = cache->offset + ret;
    return ret;
 }
 
@@ -537,16 +658,9 @@ static size_t vc_container_io_cache_refill_bypass( VC_CONTAINER_IO_T *p_ctx,
 
    if(ret) return 0; /* TODO what should we do there ? */
 
-   if(p_ctx->priv->actual_offset != cache->offset)
-   {
-      if(cache->io->pf_seek(cache->io, cache->offset) != VC_CONTAINER_SUCCESS)
-         return 0;
-   }
-
-   ret = cache->io->pf_read(cache->io, buffer, size);
+   ret = vc_container_io_read_at(cache->io, cache->offset, buffer, size);
    cache->size = cache->position = 0;
    cache->offset += ret;
-   cache->io->priv->actual_offset = cache->offset;
    return ret;
 }
 
@@ -676,16 +790,12 @@ static VC_CONTAINER_STATUS_T vc_container_io_cache_seek(VC_CONTAINER_IO_T *p_ctx
       offset >= cache->offset - (int64_t)shift && offset < cache->offset)
    {
       /* We need to refill the partial bit of the cache that we didn't take care of last time */
-      status = cache->io->pf_seek(cache->io, cache->offset - shift);
-      if(status != VC_CONTAINER_SUCCESS) return status;
+      ret = vc_container_io_read_at(cache->io, cache->offset - shift, cache->buffer - shift, shift);
+      if(ret != shift) return VC_CONTAINER_ERROR_FAILED;
       cache->offset -= shift;
       cache->buffer -= shift;
-
-      ret = cache->io->pf_read(cache->io, cache->buffer, shift);
-      vc_container_assert(ret == shift); /* FIXME: ret must = shift */
       cache->size += shift;
       cache->position = offset - cache->offset;
-      cache->io->priv->actual_offset = cache->offset + ret;
       return VC_CONTAINER_SUCCESS;
    }
 
@@ -694,8 +804,12 @@ static VC_CONTAINER_STATUS_T vc_container_io_cache_seek(VC_CONTAINER_IO_T *p_ctx
 
    if(p_ctx->priv->async_io) async_io_wait_complete( p_ctx->priv->async_io, cache, 1 );
 
-   status = cache->io->pf_seek(cache->io, offset);
-   if(status != VC_CONTAINER_SUCCESS) return status;
+   /* With read-ahead the i/o only gets moved when data needs to be read from it */
+   if(!p_ctx->priv->read_ahead)
+   {
+      status = cache->io->pf_seek(cache->io, offset);
+      if(status != VC_CONTAINER_SUCCESS) return status;
+   }
 
    vc_container_io_cache_flush( p_ctx, cache, 1 );
 
@@ -1086,3 +1200,389 @@ static void async_io_stats_get( struct VC_CONTAINER_IO_ASYNC_T *ctx, VC_CONTAINE
 
 
 #endif
+
+/*****************************************************************************
+ * Read-ahead.
+ * This is here to hide the latency of the storage from the reader by having
+ * a thread keep a few areas ahead of the read position filled in while the
+ * stream is being read sequentially. When the thread is behind, the reader
+ * fills the next area itself. Random reads go straight to the i/o, as they
+ * would without read-ahead.
+ *****************************************************************************/
+#include "vcos.h"
+
+#define READ_AHEAD_MAX_AREAS 8
+#define READ_AHEAD_DEFAULT_AREA_SIZE (256*1024)
+
+typedef enum
+{
+   READ_AHEAD_AREA_EMPTY = 0,
+   READ_AHEAD_AREA_FILLING,
+   READ_AHEAD_AREA_READY
+} READ_AHEAD_AREA_STATE_T;
+
+typedef struct READ_AHEAD_AREA_T
+{
+   READ_AHEAD_AREA_STATE_T state;
+   unsigned int generation; /**< Read-ahead generation the data belongs to */
+   int64_t offset;          /**< Offset of the data in the stream */
+   size_t size;             /**< Size of the valid data */
+   uint8_t *mem;
+
+} READ_AHEAD_AREA_T;
+
+typedef struct VC_CONTAINER_IO_READ_AHEAD_T
+{
+   VC_CONTAINER_IO_T *io;
+   VCOS_THREAD_T thread;
+   VCOS_MUTEX_T lock;         /**< Protects the areas and the read-ahead state */
+   VCOS_MUTEX_T io_lock;      /**< Serialises the accesses to the i/o module */
+   VCOS_EVENT_T wake_event;   /**< Signalled when there might be an area to fill */
+   VCOS_EVENT_T filled_event; /**< Signalled each time an area has been filled */
+   int quit;
+
+   unsigned int num_areas;
+   size_t area_size;
+   READ_AHEAD_AREA_T areas[READ_AHEAD_MAX_AREAS];
+
+   unsigned int generation; /**< Bumped to discard all the data read ahead so far */
+   bool sequential;         /**< Whether the stream is currently read sequentially */
+   int64_t next;            /**< Offset of the next area to read ahead */
+   int64_t end;             /**< Where the last read ahead hit the end of the stream (-1 if not) */
+   int64_t last_end;        /**< End of the last read */
+
+   int64_t position;        /**< Position of the i/o module (-1 if unknown), protected by io_lock */
+   VC_CONTAINER_IO_T shadow; /**< Copy of the i/o used to access the module, protected by io_lock */
+
+   VC_CONTAINER_READ_AHEAD_STATS_T stats;
+
+} VC_CONTAINER_IO_READ_AHEAD_T;
+
+/*****************************************************************************/
+static size_t read_ahead_io_read( VC_CONTAINER_IO_READ_AHEAD_T *ctx, int64_t offset,
+   uint8_t *buffer, size_t size, VC_CONTAINER_STATUS_T *status )
+{
+   VC_CONTAINER_IO_T *io = &ctx->shadow;
+   size_t ret = 0;
+
+   /* The module is given our own copy of the i/o so the status it sets doesn't
+    * touch the one the reader is looking at */
+   vcos_mutex_lock(&ctx->io_lock);
+   io->status = VC_CONTAINER_SUCCESS;
+   if(ctx->position == offset || io->pf_seek(io, offset) == VC_CONTAINER_SUCCESS)
+   {
+      ret = io->pf_read(io, buffer, size);
+      ctx->position = offset + ret;
+   }
+   else
+      ctx->position = -1;
+   *status = io->status;
+   if(io->size > ctx->io->size) ctx->io->size = io->size; /* The stream has grown */
+   vcos_mutex_unlock(&ctx->io_lock);
+   return ret;
+}
+
+/*****************************************************************************/
+static void read_ahead_fill( VC_CONTAINER_IO_READ_AHEAD_T *ctx, READ_AHEAD_AREA_T *area,
+   int64_t offset )
+{
+   VC_CONTAINER_STATUS_T status;
+   size_t size;
+
+   /* Called with the lock held */
+   area->state = READ_AHEAD_AREA_FILLING;
+   area->generation = ctx->generation;
+   area->offset = offset;
+   area->size = 0;
+   if(ctx->next < offset + (int64_t)ctx->area_size)
+      ctx->next = offset + ctx->area_size;
+   vcos_mutex_unlock(&ctx->lock);
+
+   /* Hitting the end of the stream here must not be visible to the reader until it
+    * gets there itself, in which case it will read from the i/o directly */
+   size = read_ahead_io_read(ctx, area->offset, area->mem, ctx->area_size, &status);
+
+   vcos_mutex_lock(&ctx->lock);
+   area->size = size;
+   if(area->generation != ctx->generation)
+   {
+      area->state = READ_AHEAD_AREA_EMPTY;
+      ctx->stats.bytes_discarded += size;
+   }
+   else
+   {
+      area->state = READ_AHEAD_AREA_READY;
+      if(size < ctx->area_size) ctx->end = area->offset + size;
+   }
+   ctx->stats.bytes_read += size;
+   vcos_event_signal(&ctx->filled_event);
+}
+
+/*****************************************************************************/
+static void *read_ahead_thread( void *arg )
+{
+   VC_CONTAINER_IO_READ_AHEAD_T *ctx = arg;
+   READ_AHEAD_AREA_T *area;
+   unsigned int i;
+
+   vcos_mutex_lock(&ctx->lock);
+   while(!ctx->quit)
+   {
+      /* Find an area to fill */
+      area = 0;
+      if(ctx->sequential && (ctx->end < 0 || ctx->next < ctx->end))
+         for(i = 0; i < ctx->num_areas && !area; i++)
+            if(ctx->areas[i].state == READ_AHEAD_AREA_EMPTY)
+               area = &ctx->areas[i];
+
+      if(!area)
+      {
+         vcos_mutex_unlock(&ctx->lock);
+         vcos_event_wait(&ctx->wake_event);
+         vcos_mutex_lock(&ctx->lock);
+         continue;
+      }
+
+      read_ahead_fill(ctx, area, ctx->next);
+   }
+   vcos_mutex_unlock(&ctx->lock);
+
+   return NULL;
+}
+
+/*****************************************************************************/
+static READ_AHEAD_AREA_T *read_ahead_find_area( VC_CONTAINER_IO_READ_AHEAD_T *ctx, int64_t offset )
+{
+   unsigned int i;
+
+   for(i = 0; i < ctx->num_areas; i++)
+   {
+      READ_AHEAD_AREA_T *area = &ctx->areas[i];
+      size_t size = area->state == READ_AHEAD_AREA_FILLING ? ctx->area_size : area->size;
+
+      if(area->state != READ_AHEAD_AREA_EMPTY && area->generation == ctx->generation &&
+         offset >= area->offset && offset < area->offset + (int64_t)size)
+         return area;
+   }
+   return 0;
+}
+
+/*****************************************************************************/
+static void read_ahead_discard( VC_CONTAINER_IO_READ_AHEAD_T *ctx )
+{
+   unsigned int i;
+
+   /* Areas being filled get discarded once they're done */
+   ctx->generation++;
+   for(i = 0; i < ctx->num_areas; i++)
+   {
+      if(ctx->areas[i].state != READ_AHEAD_AREA_READY)
+         continue;
+      ctx->stats.bytes_discarded += ctx->areas[i].size;
+      ctx->areas[i].state = READ_AHEAD_AREA_EMPTY;
+   }
+   ctx->end = -1;
+}
+
+/*****************************************************************************/
+static size_t read_ahead_read( VC_CONTAINER_IO_READ_AHEAD_T *ctx, int64_t offset,
+   uint8_t *buffer, size_t size )
+{
+   VC_CONTAINER_STATUS_T status;
+   READ_AHEAD_AREA_T *area;
+   bool stalled = false, missed = false, sequential;
+   size_t read = 0, bytes;
+   unsigned int i;
+
+   vcos_mutex_lock(&ctx->lock);
+
+   /* Copy whatever has been read ahead */
+   while(read < size)
+   {
+      int64_t position = offset + read;
+
+      area = read_ahead_find_area(ctx, position);
+      if(area && area->state == READ_AHEAD_AREA_FILLING)
+      {
+         uint32_t time = vcos_getmicrosecs();
+         while(area->state == READ_AHEAD_AREA_FILLING)
+         {
+            vcos_mutex_unlock(&ctx->lock);
+            vcos_event_wait(&ctx->filled_event);
+            vcos_mutex_lock(&ctx->lock);
+         }
+         ctx->stats.stall_time += vcos_getmicrosecs() - time;
+         stalled = true;
+         continue;
+      }
+
+      if(area)
+      {
+         bytes = MIN(size - read, (size_t)(area->offset + area->size - position));
+         memcpy(buffer + read, area->mem + (position - area->offset), bytes);
+         read += bytes;
+         continue;
+      }
+
+      if(missed || (ctx->end >= 0 && position >= ctx->end))
+         break;
+      missed = true;
+
+      /* This wasn't read ahead. Either a sequential run is starting, in which case
+       * the thread can start reading ahead, or the stream is being accessed randomly and
+       * whatever was read ahead is of no use. */
+      sequential = read || offset == ctx->last_end;
+      if(!sequential)
+         read_ahead_discard(ctx);
+
+      if(sequential != ctx->sequential)
+      {
+         /* Let the storage know too (this takes the io lock) */
+         ctx->sequential = sequential;
+         vcos_mutex_unlock(&ctx->lock);
+         vc_container_io_control(ctx->io, VC_CONTAINER_CONTROL_IO_HINT_SEQUENTIAL, (int)sequential);
+         vcos_mutex_lock(&ctx->lock);
+      }
+      if(!sequential)
+         break;
+
+      /* Don't wait for the thread to catch up, fill an area ourselves. This also
+       * keeps the thread reading ahead of us rather than behind. */
+      for(i = 0; i < ctx->num_areas; i++)
+         if(ctx->areas[i].state == READ_AHEAD_AREA_EMPTY)
+            break;
+      if(i == ctx->num_areas)
+         break;
+      read_ahead_fill(ctx, &ctx->areas[i], position);
+   }
+
+   if(read < size)
+   {
+      vcos_mutex_unlock(&ctx->lock);
+      read += read_ahead_io_read(ctx, offset + read, buffer + read, size - read, &status);
+      if(status != VC_CONTAINER_SUCCESS) ctx->io->status = status;
+      vcos_mutex_lock(&ctx->lock);
+      if(ctx->end >= 0 && offset + (int64_t)read > ctx->end)
+         ctx->end = -1; /* The stream has grown */
+      if(ctx->next < offset + (int64_t)read)
+         ctx->next = offset + (int64_t)read;
+   }
+
+   if(missed)
+      ctx->stats.misses++;
+   else if(stalled)
+      ctx->stats.stalls++;
+   else
+      ctx->stats.hits++;
+
+   ctx->last_end = offset + read;
+
+   /* Recycle the areas which have been consumed */
+   for(i = 0; i < ctx->num_areas; i++)
+      if(ctx->areas[i].state == READ_AHEAD_AREA_READY &&
+         ctx->areas[i].offset + (int64_t)ctx->areas[i].size <= ctx->last_end)
+         ctx->areas[i].state = READ_AHEAD_AREA_EMPTY;
+
+   vcos_mutex_unlock(&ctx->lock);
+   vcos_event_signal(&ctx->wake_event);
+   return read;
+}
+
+/*****************************************************************************/
+static void read_ahead_io_lock( VC_CONTAINER_IO_READ_AHEAD_T *ctx, int lock )
+{
+   if(lock) vcos_mutex_lock(&ctx->io_lock);
+   else vcos_mutex_unlock(&ctx->io_lock);
+}
+
+/*****************************************************************************/
+static void read_ahead_stats_get( VC_CONTAINER_IO_READ_AHEAD_T *ctx,
+   VC_CONTAINER_READ_AHEAD_STATS_T *stats )
+{
+   vcos_mutex_lock(&ctx->lock);
+   *stats = ctx->stats;
+   vcos_mutex_unlock(&ctx->lock);
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_IO_READ_AHEAD_T *read_ahead_start( VC_CONTAINER_IO_T *io,
+   unsigned int num_areas, size_t area_size, VC_CONTAINER_STATUS_T *status )
+{
+   VC_CONTAINER_IO_READ_AHEAD_T *ctx;
+
+   if(num_areas > READ_AHEAD_MAX_AREAS) num_areas = READ_AHEAD_MAX_AREAS;
+   if(!area_size) area_size = READ_AHEAD_DEFAULT_AREA_SIZE;
+
+   /* Allocate our context */
+   ctx = malloc(sizeof(*ctx));
+   if(!ctx) goto error;
+   memset(ctx, 0, sizeof(*ctx));
+   ctx->io = io;
+   ctx->shadow = *io;
+   ctx->area_size = area_size;
+   ctx->position = io->priv->actual_offset;
+   ctx->last_end = io->priv->actual_offset;
+   ctx->next = io->priv->actual_offset;
+   ctx->end = -1;
+
+   for(ctx->num_areas = 0; ctx->num_areas < num_areas; ctx->num_areas++)
+   {
+      ctx->areas[ctx->num_areas].mem = malloc(area_size);
+      if(!ctx->areas[ctx->num_areas].mem)
+         break;
+   }
+   if(!ctx->num_areas)
+      goto error_areas;
+
+   if(vcos_mutex_create(&ctx->lock, "read_ahead_lock") != VCOS_SUCCESS)
+      goto error_areas;
+   if(vcos_mutex_create(&ctx->io_lock, "read_ahead_io_lock") != VCOS_SUCCESS)
+      goto error_io_lock;
+   if(vcos_event_create(&ctx->wake_event, "read_ahead_wake_event") != VCOS_SUCCESS)
+      goto error_wake_event;
+   if(vcos_event_create(&ctx->filled_event, "read_ahead_filled_event") != VCOS_SUCCESS)
+      goto error_filled_event;
+
+   if(vcos_thread_create(&ctx->thread, "read_ahead", NULL, read_ahead_thread, ctx) != VCOS_SUCCESS)
+      goto error_thread;
+
+   if(status) *status = VC_CONTAINER_SUCCESS;
+   return ctx;
+
+ error_thread:
+   vcos_event_delete(&ctx->filled_event);
+ error_filled_event:
+   vcos_event_delete(&ctx->wake_event);
+ error_wake_event:
+   vcos_mutex_delete(&ctx->io_lock);
+ error_io_lock:
+   vcos_mutex_delete(&ctx->lock);
+ error_areas:
+   while(ctx->num_areas > 0)
+      free(ctx->areas[--ctx->num_areas].mem);
+   free(ctx);
+ error:
+   if(status) *status = VC_CONTAINER_ERROR_OUT_OF_RESOURCES;
+   return 0;
+}
+
+/*****************************************************************************/
+static void read_ahead_stop( VC_CONTAINER_IO_READ_AHEAD_T *ctx )
+{
+   vcos_mutex_lock(&ctx->lock);
+   ctx->quit = 1;
+   vcos_mutex_unlock(&ctx->lock);
+   vcos_event_signal(&ctx->wake_event);
+   vcos_thread_join(&ctx->thread, NULL);
+
+   /* Hand the i/o back to the core */
+   ctx->io->priv->actual_offset = ctx->position;
+
+   vcos_event_delete(&ctx->filled_event);
+   vcos_event_delete(&ctx->wake_event);
+   vcos_mutex_delete(&ctx->io_lock);
+   vcos_mutex_delete(&ctx->lock);
+   while(ctx->num_areas > 0)
+      free(ctx->areas[--ctx->num_areas].mem);
+   free(ctx);
+}
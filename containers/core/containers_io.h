@@ -58,6 +58,8 @@ typedef uint32_t VC_CONTAINER_IO_CAPABILITIES_T;
 #define VC_CONTAINER_IO_CAPS_SEEK_SLOW    0x2
 /** The I/O doesn't provide any caching of the data */
 #define VC_CONTAINER_IO_CAPS_NO_CACHING   0x4
+/** The I/O maps the stream in memory and can give direct access to its data */
+#define VC_CONTAINER_IO_CAPS_MEMORY_MAPPED 0x8
 /* @} */
 
 /** Container Input / Output Context.
@@ -121,6 +123,25 @@ struct VC_CONTAINER_IO_T
    VC_CONTAINER_STATUS_T (*pf_control)(struct VC_CONTAINER_IO_T *io, 
                                        VC_CONTAINER_CONTROL_T operation, va_list args);
 
+   /** \private
+    * Function pointer to get direct access to the data of a memory mapped container io
+    * module (optional). Returns a pointer to the data at the given offset and updates
+    * size with the number of bytes available there, which can be less than requested.
+    * The pointer is only valid until the next call into the module. */
+   const uint8_t *(*pf_map)(struct VC_CONTAINER_IO_T *io, int64_t offset, size_t *size);
+
+   /** \private
+    * Function pointer to borrow data at the current position of a memory mapped container
+    * io module (optional). Returns a pointer to the data and moves the read position past
+    * it, or NULL if the data isn't all available at once. The pointer stays valid until the
+    * token is given back with pf_release and must be treated as read-only. */
+   uint8_t *(*pf_borrow)(struct VC_CONTAINER_IO_T *io, size_t size, void **token);
+
+   /** \private
+    * Function pointer to give back data borrowed with pf_borrow. This can be called from
+    * any thread. */
+   void (*pf_release)(struct VC_CONTAINER_IO_T *io, void *token);
+
 };
 
 /** Opens an i/o stream pointed to by a URI.
@@ -151,8 +172,10 @@ VC_CONTAINER_IO_T *vc_container_io_create( const char *uri, VC_CONTAINER_IO_MODE
                                            VC_CONTAINER_STATUS_T *p_status );
 
 /** Closes an instance of a container i/o module.
+ * The instance isn't closed while some of its data is still borrowed.
  * \param  context     Pointer to the VC_CONTAINER_IO_T context of the instance to close
- * \return             VC_CONTAINER_SUCCESS on success.
+ * \return             VC_CONTAINER_SUCCESS on success, VC_CONTAINER_ERROR_NOT_READY if
+ *                     some borrowed data hasn't been given back yet.
  */
 VC_CONTAINER_STATUS_T vc_container_io_close( VC_CONTAINER_IO_T *context );
 
@@ -172,6 +195,34 @@ size_t vc_container_io_peek(VC_CONTAINER_IO_T *context, void *buffer, size_t siz
  */
 size_t vc_container_io_read(VC_CONTAINER_IO_T *context, void *buffer, size_t size);
 
+/** Read data from an i/o stream, or borrow it when the i/o allows it.
+ * When token is not NULL and the i/o can give access to the data in place, the data is not
+ * copied. Instead *data is replaced with a pointer to the data and *token is set to a value
+ * which must be given back with \ref vc_container_io_release once the data isn't needed
+ * anymore. Otherwise the data is read into *data as with \ref vc_container_io_read and
+ * *token is set to NULL.
+ * \param  context     Pointer to the VC_CONTAINER_IO_T instance to use
+ * \param  data        Pointer to the buffer to read into, updated if the data is borrowed
+ * \param  size        Size of the data to read
+ * \param  token       Returns the token for the borrowed data (NULL if borrowing isn't wanted)
+ * \return             The size of the data read or borrowed
+ */
+size_t vc_container_io_read_borrow(VC_CONTAINER_IO_T *context, uint8_t **data, size_t size, void **token);
+
+/** Give back data borrowed with \ref vc_container_io_read_borrow.
+ * This can be called from any thread.
+ * \param  context     Pointer to the VC_CONTAINER_IO_T instance to use
+ * \param  token       Token returned when the data was borrowed
+ */
+void vc_container_io_release(VC_CONTAINER_IO_T *context, void *token);
+
+/** Get the number of blocks of data borrowed from an i/o stream which haven't been
+ * given back yet.
+ * \param  context     Pointer to the VC_CONTAINER_IO_T instance to use
+ * \return             The number of blocks of data still borrowed
+ */
+unsigned int vc_container_io_borrowed(VC_CONTAINER_IO_T *context);
+
 /** Skip data in an i/o stream without reading it.
  * \param  context     Pointer to the VC_CONTAINER_IO_T instance to use
  * \param  size        Number of bytes to skip
@@ -555,6 +555,13 @@ STATIC_INLINE VC_CONTAINER_STATUS_T vc_container_io_write_le_uint64(VC_CONTAINER
 #define SKIP_BYTES(ctx, size) vc_container_io_skip((ctx)->priv->io, (size_t)(size))
 #define SEEK(ctx, off) vc_container_io_seek((ctx)->priv->io, (int64_t)(off))
 #define CACHE_BYTES(ctx, size) vc_container_io_cache((ctx)->priv->io, (size_t)(size))
+/** Macro which reads the data of a packet, or borrows it from the stream when the read
+ * flags allow it (in which case the data pointer of the packet is replaced and the packet
+ * is part of a VC_CONTAINER_PACKET_BORROW_T) */
+#define READ_PACKET_BYTES(ctx, packet, flags, size) \
+   vc_container_io_read_borrow((ctx)->priv->io, &(packet)->data, (size_t)(size), \
+      ((flags) & VC_CONTAINER_READ_FLAG_BORROW) ? \
+         &((VC_CONTAINER_PACKET_BORROW_T *)(packet))->token : 0)
 
 #define _SKIP_GUID(ctx) vc_container_io_skip((ctx)->priv->io, 16)
 #define _SKIP_U8(ctx)  (vc_container_io_skip((ctx)->priv->io, 1) != 1)
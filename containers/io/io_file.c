@@ -29,6 +29,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string.h>
 #include <stdio.h>
 #include <limits.h>
+#include <sys/types.h>
+#ifndef _VIDEOCORE
+#include <fcntl.h>
+#endif
 
 #include "containers/containers.h"
 #include "containers/core/containers_common.h"
@@ -80,17 +84,16 @@ static VC_CONTAINER_STATUS_T io_file_seek(VC_CONTAINER_IO_T *p_ctx, int64_t offs
    VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
    int ret;
 
-   //FIXME: large file support
 #ifdef _VIDEOCORE
    extern int fseek64(FILE *fp, int64_t offset, int whence);
    ret = fseek64(p_ctx->module->stream, offset, SEEK_SET);
 #else
-   if (offset > (int64_t)UINT_MAX)
+   if (offset != (int64_t)(off_t)offset)
    {
       p_ctx->status = VC_CONTAINER_ERROR_EOS;
       return VC_CONTAINER_ERROR_EOS;
    }
-   ret = fseek(p_ctx->module->stream, (long)offset, SEEK_SET);
+   ret = fseeko(p_ctx->module->stream, (off_t)offset, SEEK_SET);
 #endif   
    if(ret)
    {
@@ -102,6 +105,33 @@ static VC_CONTAINER_STATUS_T io_file_seek(VC_CONTAINER_IO_T *p_ctx, int64_t offs
    return status;
 }
 
+/*****************************************************************************/
+static void io_file_advise(VC_CONTAINER_IO_T *p_ctx, int sequential)
+{
+#if !defined(_VIDEOCORE) && defined(POSIX_FADV_SEQUENTIAL)
+   /* Tune the read-ahead done by the kernel */
+   posix_fadvise(fileno(p_ctx->module->stream), 0, 0,
+                 sequential ? POSIX_FADV_SEQUENTIAL : POSIX_FADV_RANDOM);
+#else
+   VC_CONTAINER_PARAM_UNUSED(p_ctx);
+   VC_CONTAINER_PARAM_UNUSED(sequential);
+#endif
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T io_file_control(VC_CONTAINER_IO_T *p_ctx,
+   VC_CONTAINER_CONTROL_T operation, va_list args)
+{
+   switch(operation)
+   {
+   case VC_CONTAINER_CONTROL_IO_HINT_SEQUENTIAL:
+      io_file_advise(p_ctx, va_arg(args, int));
+      return VC_CONTAINER_SUCCESS;
+   default:
+      return VC_CONTAINER_ERROR_UNSUPPORTED_OPERATION;
+   }
+}
+
 /*****************************************************************************/
 VC_CONTAINER_STATUS_T vc_container_io_file_open( VC_CONTAINER_IO_T *p_ctx,
    const char *unused, VC_CONTAINER_IO_MODE_T mode )
@@ -132,6 +162,7 @@ VC_CONTAINER_STATUS_T vc_container_io_file_open( VC_CONTAINER_IO_T *p_ctx,
    p_ctx->pf_read = io_file_read;
    p_ctx->pf_write = io_file_write;
    p_ctx->pf_seek = io_file_seek;
+   p_ctx->pf_control = io_file_control;
 
    if(mode == VC_CONTAINER_IO_MODE_WRITE)
    {
@@ -139,10 +170,18 @@ VC_CONTAINER_STATUS_T vc_container_io_file_open( VC_CONTAINER_IO_T *p_ctx,
    }
    else
    {
+#ifdef _VIDEOCORE
       //FIXME: large file support, platform-specific file size
       fseek(p_ctx->module->stream, 0, SEEK_END);
       p_ctx->size = ftell(p_ctx->module->stream);
       fseek(p_ctx->module->stream, 0, SEEK_SET);
+#else
+      fseeko(p_ctx->module->stream, 0, SEEK_END);
+      p_ctx->size = ftello(p_ctx->module->stream);
+      fseeko(p_ctx->module->stream, 0, SEEK_SET);
+#endif
+      /* Most containers are read from start to end */
+      io_file_advise(p_ctx, 1);
    }
 
    p_ctx->capabilities = VC_CONTAINER_IO_CAPS_NO_CACHING;
@@ -0,0 +1,384 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "vcos.h"
+
+#include "containers/containers.h"
+#include "containers/core/containers_common.h"
+#include "containers/core/containers_io.h"
+#include "containers/core/containers_uri.h"
+
+/** Size of the window of the file which is mapped at any one time. The whole
+ * file is mapped when the address space is large enough. */
+#ifndef IO_MMAP_WINDOW_SIZE
+# if SIZE_MAX > 0xffffffffu
+#  define IO_MMAP_WINDOW_SIZE ((int64_t)1 << 40)
+# else
+#  define IO_MMAP_WINDOW_SIZE ((int64_t)64 << 20)
+# endif
+#endif
+/** Amount of data ahead of the read position that the kernel is asked to
+ * prefetch */
+#define IO_MMAP_READ_AHEAD (2*1024*1024)
+
+/** Mapped window of the file. A window which still has data lent out when the
+ * file gets remapped is kept alive until the last of it is given back. */
+typedef struct IO_MMAP_WINDOW_T
+{
+   uint8_t *map;
+   int64_t offset;      /**< Offset of the window in the file */
+   size_t size;         /**< Size of the window */
+   unsigned int refs;   /**< Number of borrowed blocks of data pointing into the window */
+
+} IO_MMAP_WINDOW_T;
+
+typedef struct VC_CONTAINER_IO_MODULE_T
+{
+   int fd;
+   int64_t file_size;   /**< Size of the file when last checked */
+   int64_t position;    /**< Current position in the file */
+
+   IO_MMAP_WINDOW_T *window; /**< Current window */
+   int64_t advised_start; /**< Area of the file the kernel was asked to prefetch */
+   int64_t advised_end;
+   long page_size;
+
+   VCOS_MUTEX_T lock;   /**< Protects the reference counts of the windows */
+
+} VC_CONTAINER_IO_MODULE_T;
+
+VC_CONTAINER_STATUS_T vc_container_io_mmap_open( VC_CONTAINER_IO_T *, const char *,
+   VC_CONTAINER_IO_MODE_T );
+
+/*****************************************************************************/
+static void io_mmap_window_delete( IO_MMAP_WINDOW_T *window )
+{
+   munmap(window->map, window->size);
+   free(window);
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T io_mmap_close( VC_CONTAINER_IO_T *p_ctx )
+{
+   VC_CONTAINER_IO_MODULE_T *module = p_ctx->module;
+   /* The core doesn't close the i/o while some of its data is still borrowed, so no
+    * other window than the current one is left and nothing points into it */
+   vcos_assert(!module->window || !module->window->refs);
+   if(module->window) io_mmap_window_delete(module->window);
+   vcos_mutex_delete(&module->lock);
+   close(module->fd);
+   free(module);
+   return VC_CONTAINER_SUCCESS;
+}
+
+/*****************************************************************************/
+static void io_mmap_update_size( VC_CONTAINER_IO_T *p_ctx )
+{
+   VC_CONTAINER_IO_MODULE_T *module = p_ctx->module;
+   struct stat st;
+
+   /* The file might still be growing (e.g. it is being recorded) */
+   if(fstat(module->fd, &st) || st.st_size <= module->file_size)
+      return;
+
+   module->file_size = st.st_size;
+   p_ctx->size = st.st_size;
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T io_mmap_map_window( VC_CONTAINER_IO_T *p_ctx,
+   int64_t offset, size_t size )
+{
+   VC_CONTAINER_IO_MODULE_T *module = p_ctx->module;
+   IO_MMAP_WINDOW_T *window;
+   int64_t start, end;
+   void *map;
+
+   /* Retire the current window, unless some of its data is still lent out in
+    * which case the last borrower will delete it */
+   vcos_mutex_lock(&module->lock);
+   window = module->window;
+   module->window = 0;
+   if(window && !window->refs)
+      io_mmap_window_delete(window);
+   vcos_mutex_unlock(&module->lock);
+
+   /* Start the window a bit before the requested offset so that seeking
+    * backwards a little doesn't need a new mapping */
+   start = offset & ~(int64_t)(module->page_size - 1);
+   if(offset + (int64_t)size - start < IO_MMAP_WINDOW_SIZE / 2 &&
+      start >= IO_MMAP_WINDOW_SIZE / 8)
+      start = (start - IO_MMAP_WINDOW_SIZE / 8) & ~(int64_t)(module->page_size - 1);
+
+   end = MIN(module->file_size, start + IO_MMAP_WINDOW_SIZE);
+   if(end <= start) return VC_CONTAINER_ERROR_EOS;
+
+   window = malloc(sizeof(*window));
+   if(!window) return VC_CONTAINER_ERROR_OUT_OF_MEMORY;
+
+   map = mmap(0, (size_t)(end - start), PROT_READ, MAP_SHARED, module->fd, (off_t)start);
+   if(map == MAP_FAILED)
+   {
+      free(window);
+      return VC_CONTAINER_ERROR_FAILED;
+   }
+
+   posix_madvise(map, (size_t)(end - start), POSIX_MADV_SEQUENTIAL);
+   window->map = map;
+   window->offset = start;
+   window->size = (size_t)(end - start);
+   window->refs = 0;
+
+   vcos_mutex_lock(&module->lock);
+   module->window = window;
+   vcos_mutex_unlock(&module->lock);
+   return VC_CONTAINER_SUCCESS;
+}
+
+/*****************************************************************************/
+static const uint8_t *io_mmap_map( VC_CONTAINER_IO_T *p_ctx, int64_t offset, size_t *size )
+{
+   VC_CONTAINER_IO_MODULE_T *module = p_ctx->module;
+   IO_MMAP_WINDOW_T *window = module->window;
+   int64_t map_end = window ? window->offset + (int64_t)window->size : 0;
+   int64_t end = offset + (int64_t)*size;
+
+   if(offset < 0) { *size = 0; return 0; }
+
+   if(end > module->file_size)
+      io_mmap_update_size(p_ctx);
+   if(end > module->file_size)
+      end = module->file_size;
+   if(end <= offset) { *size = 0; return 0; }
+
+   /* Move the window if it doesn't hold the requested data */
+   if(!window || offset < window->offset || end > map_end)
+   {
+      if(io_mmap_map_window(p_ctx, offset, (size_t)(end - offset)) != VC_CONTAINER_SUCCESS)
+      {
+         *size = 0;
+         return 0;
+      }
+      window = module->window;
+      map_end = window->offset + (int64_t)window->size;
+   }
+
+   *size = (size_t)(MIN(end, map_end) - offset);
+   return window->map + (offset - window->offset);
+}
+
+/*****************************************************************************/
+static void io_mmap_read_ahead( VC_CONTAINER_IO_T *p_ctx )
+{
+   VC_CONTAINER_IO_MODULE_T *module = p_ctx->module;
+   IO_MMAP_WINDOW_T *window = module->window;
+   int64_t map_end = window->offset + (int64_t)window->size;
+   int64_t position = module->position & ~(int64_t)(module->page_size - 1);
+   int64_t start, end;
+
+   /* Moving around inside the area already asked for doesn't need anything
+    * new. We only ask for more once half of the last request has been
+    * consumed, or when the position jumps outside of that area. */
+   if(position >= module->advised_start &&
+      module->position + IO_MMAP_READ_AHEAD / 2 < module->advised_end)
+      return;
+
+   end = module->position + IO_MMAP_READ_AHEAD;
+   if(position >= module->advised_start && position <= module->advised_end)
+   {
+      /* Extend the area forwards */
+      start = module->advised_end;
+   }
+   else if(position < module->advised_start && end >= module->advised_start)
+   {
+      /* Extend the area backwards, the rest of it is already on its way */
+      start = position;
+      end = module->advised_start;
+      module->advised_start = position;
+   }
+   else
+   {
+      /* Somewhere else entirely */
+      start = position;
+      module->advised_start = position;
+      module->advised_end = position;
+   }
+   /* We can only give advice about what is currently mapped */
+   start = MAX(start, window->offset);
+   end = MIN(end, map_end);
+   if(end > module->advised_end) module->advised_end = end;
+   if(end <= start)
+      return;
+
+   posix_madvise(window->map + (start - window->offset), (size_t)(end - start),
+                 POSIX_MADV_WILLNEED);
+}
+
+/*****************************************************************************/
+static size_t io_mmap_read(VC_CONTAINER_IO_T *p_ctx, void *buffer, size_t size)
+{
+   VC_CONTAINER_IO_MODULE_T *module = p_ctx->module;
+   size_t read = 0;
+
+   while(read < size)
+   {
+      size_t bytes = size - read;
+      const uint8_t *data = io_mmap_map(p_ctx, module->position, &bytes);
+      if(!data) break;
+
+      memcpy((uint8_t *)buffer + read, data, bytes);
+      module->position += bytes;
+      read += bytes;
+   }
+
+   if(read != size)
+      p_ctx->status = module->position >= module->file_size ?
+         VC_CONTAINER_ERROR_EOS : VC_CONTAINER_ERROR_FAILED;
+   else if(module->window)
+      io_mmap_read_ahead(p_ctx);
+
+   return read;
+}
+
+/*****************************************************************************/
+static uint8_t *io_mmap_borrow(VC_CONTAINER_IO_T *p_ctx, size_t size, void **token)
+{
+   VC_CONTAINER_IO_MODULE_T *module = p_ctx->module;
+   IO_MMAP_WINDOW_T *window;
+   size_t bytes = size;
+   uint8_t *data;
+
+   /* Data straddling the end of the window (or of the file) gets copied instead */
+   if(!io_mmap_map(p_ctx, module->position, &bytes) || bytes != size)
+      return 0;
+
+   window = module->window;
+   data = window->map + (module->position - window->offset);
+
+   vcos_mutex_lock(&module->lock);
+   window->refs++;
+   vcos_mutex_unlock(&module->lock);
+
+   *token = window;
+   module->position += size;
+   io_mmap_read_ahead(p_ctx);
+   return data;
+}
+
+/*****************************************************************************/
+static void io_mmap_release(VC_CONTAINER_IO_T *p_ctx, void *token)
+{
+   VC_CONTAINER_IO_MODULE_T *module = p_ctx->module;
+   IO_MMAP_WINDOW_T *window = token;
+
+   vcos_mutex_lock(&module->lock);
+   if(!--window->refs && window != module->window)
+      io_mmap_window_delete(window);
+   vcos_mutex_unlock(&module->lock);
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T io_mmap_seek(VC_CONTAINER_IO_T *p_ctx, int64_t offset)
+{
+   VC_CONTAINER_IO_MODULE_T *module = p_ctx->module;
+
+   if(offset < 0)
+   {
+      p_ctx->status = VC_CONTAINER_ERROR_FAILED;
+      return p_ctx->status;
+   }
+
+   /* Like fseek, seeking past the end is allowed and reads will fail */
+   module->position = offset;
+   p_ctx->status = VC_CONTAINER_SUCCESS;
+   return VC_CONTAINER_SUCCESS;
+}
+
+/*****************************************************************************/
+VC_CONTAINER_STATUS_T vc_container_io_mmap_open( VC_CONTAINER_IO_T *p_ctx,
+   const char *unused, VC_CONTAINER_IO_MODE_T mode )
+{
+   VC_CONTAINER_IO_MODULE_T *module = 0;
+   const char *path = vc_uri_path(p_ctx->uri_parts);
+   struct stat st;
+   int fd;
+   VC_CONTAINER_PARAM_UNUSED(unused);
+
+   /* Check the URI */
+   if (!vc_uri_scheme(p_ctx->uri_parts) ||
+       strcasecmp(vc_uri_scheme(p_ctx->uri_parts), "mmap"))
+      return VC_CONTAINER_ERROR_FORMAT_NOT_SUPPORTED;
+
+   /* Writing goes through the file module */
+   if(mode != VC_CONTAINER_IO_MODE_READ || !path)
+      return VC_CONTAINER_ERROR_FORMAT_NOT_SUPPORTED;
+
+   fd = open(path, O_RDONLY);
+   if(fd < 0) return VC_CONTAINER_ERROR_URI_NOT_FOUND;
+   if(fstat(fd, &st) || !S_ISREG(st.st_mode))
+   {
+      close(fd);
+      return VC_CONTAINER_ERROR_URI_NOT_FOUND;
+   }
+
+   module = malloc( sizeof(*module) );
+   if(!module) { close(fd); return VC_CONTAINER_ERROR_OUT_OF_MEMORY; }
+   memset(module, 0, sizeof(*module));
+
+   if(vcos_mutex_create(&module->lock, "io_mmap") != VCOS_SUCCESS)
+   {
+      free(module);
+      close(fd);
+      return VC_CONTAINER_ERROR_OUT_OF_RESOURCES;
+   }
+
+   module->fd = fd;
+   module->file_size = st.st_size;
+   module->page_size = sysconf(_SC_PAGESIZE);
+   if(module->page_size <= 0) module->page_size = 4096;
+
+   p_ctx->module = module;
+   p_ctx->pf_close = io_mmap_close;
+   p_ctx->pf_read = io_mmap_read;
+   p_ctx->pf_seek = io_mmap_seek;
+   p_ctx->pf_map = io_mmap_map;
+   p_ctx->pf_borrow = io_mmap_borrow;
+   p_ctx->pf_release = io_mmap_release;
+
+   p_ctx->size = st.st_size;
+   /* The mapping acts as the cache, so no extra copy is needed */
+   p_ctx->capabilities = VC_CONTAINER_IO_CAPS_MEMORY_MAPPED;
+   return VC_CONTAINER_SUCCESS;
+}
@@ -1979,8 +1979,10 @@ static VC_CONTAINER_STATUS_T mkv_read_next_frame_header(VC_CONTAINER_T *p_ctx,
 }
 
 static VC_CONTAINER_STATUS_T mkv_read_frame_data(VC_CONTAINER_T *p_ctx,
-      MKV_READER_STATE_T *state, uint8_t *p_data, uint32_t *pi_length)
+      MKV_READER_STATE_T *state, VC_CONTAINER_PACKET_T *p_packet, uint32_t flags,
+      uint32_t *pi_length)
 {
+   uint8_t *p_data = p_packet ? p_packet->data : 0;
    uint64_t size;
    uint32_t header_size;
 
@@ -2015,7 +2017,11 @@ static VC_CONTAINER_STATUS_T mkv_read_frame_data(VC_CONTAINER_T *p_ctx,
       size -= header_size;
    }
 
-   size = READ_BYTES(p_ctx, p_data + header_size, size);
+   /* Data can only be borrowed when there is no header to insert */
+   if(!header_size)
+      size = READ_PACKET_BYTES(p_ctx, p_packet, flags, size);
+   else
+      size = READ_BYTES(p_ctx, p_data + header_size, size);
    state->levels[state->level].data_offset += size;
    *pi_length = size + header_size;
 
@@ -2055,13 +2061,13 @@ static VC_CONTAINER_STATUS_T mkv_reader_read(VC_CONTAINER_T *p_ctx,
    if(track >= p_ctx->tracks_num || !p_ctx->tracks[track]->is_enabled)
    {
       /* Skip frame */
-      status = mkv_read_frame_data(p_ctx, state, 0, &data_size);
+      status = mkv_read_frame_data(p_ctx, state, 0, 0, &data_size);
       if (status != VC_CONTAINER_SUCCESS) return status;
       return VC_CONTAINER_ERROR_CONTINUE;
    }
 
    if((flags & VC_CONTAINER_READ_FLAG_SKIP) && !(flags & VC_CONTAINER_READ_FLAG_INFO)) /* Skip packet */
-      return mkv_read_frame_data(p_ctx, state, 0, &data_size);
+      return mkv_read_frame_data(p_ctx, state, 0, 0, &data_size);
 
    p_packet->dts = p_packet->pts = state->pts;
    p_packet->flags = 0;
@@ -2072,13 +2078,13 @@ static VC_CONTAINER_STATUS_T mkv_reader_read(VC_CONTAINER_T *p_ctx,
    p_packet->track = track;
 
    if(flags & VC_CONTAINER_READ_FLAG_SKIP)
-      return mkv_read_frame_data(p_ctx, state, 0, &data_size );
+      return mkv_read_frame_data(p_ctx, state, 0, 0, &data_size );
    else if(flags & VC_CONTAINER_READ_FLAG_INFO)
       return VC_CONTAINER_SUCCESS;
 
    /* Read the frame data */
    buffer_size = p_packet->buffer_size;
-   status = mkv_read_frame_data(p_ctx, state, p_packet->data, &buffer_size);
+   status = mkv_read_frame_data(p_ctx, state, p_packet, flags, &buffer_size);
    if(status != VC_CONTAINER_SUCCESS)
    {
       /* FIXME */
@@ -2207,7 +2213,7 @@ static VC_CONTAINER_STATUS_T mkv_reader_seek(VC_CONTAINER_T *p_ctx,
          state->pts >= time_offset) break;
 
       /* Skip frame */
-      status = mkv_read_frame_data(p_ctx, state, 0, &data_size);
+      status = mkv_read_frame_data(p_ctx, state, 0, 0, &data_size);
    }
 
    return VC_CONTAINER_SUCCESS;
@@ -73,6 +73,14 @@ typedef enum {
    MP4_BOX_TYPE_DAWP              = VC_FOURCC('d','a','w','p'),
    MP4_BOX_TYPE_DEVC              = VC_FOURCC('d','e','v','c'),
    MP4_BOX_TYPE_WAVE              = VC_FOURCC('w','a','v','e'),
+   MP4_BOX_TYPE_MVEX              = VC_FOURCC('m','v','e','x'),
+   MP4_BOX_TYPE_TREX              = VC_FOURCC('t','r','e','x'),
+   MP4_BOX_TYPE_MOOF              = VC_FOURCC('m','o','o','f'),
+   MP4_BOX_TYPE_MFHD              = VC_FOURCC('m','f','h','d'),
+   MP4_BOX_TYPE_TRAF              = VC_FOURCC('t','r','a','f'),
+   MP4_BOX_TYPE_TFHD              = VC_FOURCC('t','f','h','d'),
+   MP4_BOX_TYPE_TFDT              = VC_FOURCC('t','f','d','t'),
+   MP4_BOX_TYPE_TRUN              = VC_FOURCC('t','r','u','n'),
    MP4_BOX_TYPE_ZERO              = 0
 } MP4_BOX_TYPE_T;
 
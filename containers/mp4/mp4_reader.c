@@ -61,6 +61,9 @@ Defines.
 
 #define MP4_MAX_SAMPLES_BATCH_SIZE (16*1024)
 
+#define MP4_RUNS_BLOCK_SHIFT 6 /* Number of runs per block in the sample index (log2) */
+#define MP4_RUNS_BLOCK_SIZE (1 << MP4_RUNS_BLOCK_SHIFT)
+
 #define MP4_SKIP_U8(ctx,n)   (size -= 1, SKIP_U8(ctx,n))
 #define MP4_SKIP_U16(ctx,n)  (size -= 2, SKIP_U16(ctx,n))
 #define MP4_SKIP_U24(ctx,n)  (size -= 3, SKIP_U24(ctx,n))
@@ -80,34 +83,89 @@ Defines.
 /******************************************************************************
 Type definitions.
 ******************************************************************************/
+/* The sample tables are decoded when the file is opened into a compact index which
+ * lives in memory. Each table becomes a list of runs of entries sharing the same value.
+ * Runs are stored as variable length integers (the value being coded as the difference
+ * with the value of the previous run) and grouped in blocks. Each block records the
+ * first entry it covers and the sum of the values of all the entries before it, which
+ * allows any entry to be found with a binary search followed by the decoding of a few
+ * runs. Those sums give the decoding time of a sample (durations), the offset of a
+ * sample within its chunk (sizes) and the first sample of a chunk (samples per chunk). */
+typedef struct
+{
+   size_t position;   /**< Position of the first run of the block in the data */
+   uint32_t entry;    /**< First entry covered by the block */
+   uint64_t sum;      /**< Sum of the values of all the entries before the block */
+} MP4_RUNS_BLOCK_T;
+
+typedef struct
+{
+   uint32_t entries;
+   uint32_t runs;
+
+   uint8_t *data;
+   size_t size;
+   size_t data_size;
+
+   MP4_RUNS_BLOCK_T *blocks;
+   uint32_t blocks_size;
+
+   /* Only used while the table is being built */
+   uint32_t count;    /**< Number of entries in the run being added */
+   int64_t value;     /**< Value of the run being added */
+   int64_t last;      /**< Value of the last run written */
+   uint64_t sum;      /**< Sum of the values of all the entries written */
+
+} MP4_RUNS_T;
+
+/* Position in a table, pointing to a decoded run */
+typedef struct
+{
+   uint32_t run;      /**< Index of the next run to decode */
+   size_t position;   /**< Position of the next run to decode in the data */
+   uint32_t entry;    /**< First entry of the run */
+   uint32_t count;    /**< Number of entries in the run */
+   int64_t value;     /**< Value of the entries of the run */
+   uint64_t sum;      /**< Sum of the values of all the entries before the run */
+} MP4_RUNS_CURSOR_T;
+
+typedef struct
+{
+   uint32_t samples;
+
+   MP4_RUNS_T sizes;          /**< Size of each sample */
+   MP4_RUNS_T durations;      /**< Duration of each sample */
+   MP4_RUNS_T composition;    /**< Composition time offset of each sample (if any) */
+   MP4_RUNS_T chunks;         /**< Number of samples in each chunk */
+   MP4_RUNS_T chunk_offsets;  /**< Offset of each chunk */
+   uint32_t *sync;            /**< One bit per sample, set for sync samples (if any) */
+
+} MP4_SAMPLE_INDEX_T;
+
 typedef struct
 {
    VC_CONTAINER_STATUS_T status;
 
-   int64_t  duration;
    int64_t  pts;
    int64_t  dts;
 
-   uint32_t sample;
+   uint32_t sample;           /**< Next sample to read */
    int64_t offset;
    unsigned int sample_offset;
    unsigned int sample_size;
 
-   uint32_t sample_duration;
-   uint32_t sample_duration_count;
-   int32_t sample_composition_offset;
-   uint32_t sample_composition_count;
-
-   uint32_t next_sync_sample;
    bool keyframe;
 
-   uint32_t samples_per_chunk;
-   uint32_t chunks;
-   uint32_t samples_in_chunk;
+   uint32_t chunk;
+   uint32_t chunk_end;        /**< First sample of the next chunk */
 
    struct {
-      uint32_t entry;
-   } sample_table[MP4_SAMPLE_TABLE_NUM];
+      MP4_RUNS_CURSOR_T sizes;
+      MP4_RUNS_CURSOR_T durations;
+      MP4_RUNS_CURSOR_T composition;
+      MP4_RUNS_CURSOR_T chunks;
+      MP4_RUNS_CURSOR_T chunk_offsets;
+   } cursors;
 
 } MP4_READER_STATE_T;
 
@@ -119,12 +177,17 @@ typedef struct VC_CONTAINER_TRACK_MODULE_T
    uint8_t object_type_indication;
 
    uint32_t sample_size;
+   uint32_t samples;
+
+   /* Sample tables as found in the file, only kept until the index is built */
    struct {
-      int64_t offset;
+      uint8_t *data;
       uint32_t entries;
       uint32_t entry_size;
    } sample_table[MP4_SAMPLE_TABLE_NUM];
 
+   MP4_SAMPLE_INDEX_T index;
+
    uint32_t samples_batch_size;
 
 } VC_CONTAINER_TRACK_MODULE_T;
@@ -174,6 +237,8 @@ static VC_CONTAINER_STATUS_T mp4_read_box_stsz( VC_CONTAINER_T *p_ctx, int64_t s
 static VC_CONTAINER_STATUS_T mp4_read_box_stco( VC_CONTAINER_T *p_ctx, int64_t size );
 static VC_CONTAINER_STATUS_T mp4_read_box_co64( VC_CONTAINER_T *p_ctx, int64_t size );
 static VC_CONTAINER_STATUS_T mp4_read_box_stss( VC_CONTAINER_T *p_ctx, int64_t size );
+static VC_CONTAINER_STATUS_T mp4_build_sample_index( VC_CONTAINER_T *p_ctx,
+   VC_CONTAINER_TRACK_MODULE_T *track_module );
 static VC_CONTAINER_STATUS_T mp4_read_box_vide( VC_CONTAINER_T *p_ctx, int64_t size );
 static VC_CONTAINER_STATUS_T mp4_read_box_soun( VC_CONTAINER_T *p_ctx, int64_t size );
 static VC_CONTAINER_STATUS_T mp4_read_box_text( VC_CONTAINER_T *p_ctx, int64_t size );
@@ -516,6 +581,10 @@ static VC_CONTAINER_STATUS_T mp4_read_box_trak( VC_CONTAINER_T *p_ctx, int64_t s
 
    /* TODO: Sanity check track */
 
+   /* Decode the sample tables we've just read */
+   if(status == VC_CONTAINER_SUCCESS)
+      status = mp4_build_sample_index( p_ctx, track->priv->module );
+
    track->is_enabled = true;
    track->format->flags |= VC_CONTAINER_ES_FORMAT_FLAG_FRAMED;
    module->current_track++;
@@ -820,33 +889,41 @@ static VC_CONTAINER_STATUS_T mp4_read_box_stsd( VC_CONTAINER_T *p_ctx, int64_t s
 }
 
 /*****************************************************************************/
-static VC_CONTAINER_STATUS_T mp4_cache_table( VC_CONTAINER_T *p_ctx, MP4_SAMPLE_TABLE_T table,
+static VC_CONTAINER_STATUS_T mp4_read_table( VC_CONTAINER_T *p_ctx, MP4_SAMPLE_TABLE_T table,
    uint32_t entries, int64_t size )
 {
    VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
    VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[module->current_track]->priv->module;
-   uint32_t available_entries, entries_size;
+   uint32_t available_entries, entry_size = track_module->sample_table[table].entry_size;
+   size_t entries_size;
 
    if(size < 0) return VC_CONTAINER_ERROR_CORRUPTED;
 
-   track_module->sample_table[table].offset = STREAM_POSITION(p_ctx);
-   track_module->sample_table[table].entries = entries;
-
-   available_entries = size / track_module->sample_table[table].entry_size;
+   available_entries = size / entry_size;
    if(available_entries < entries)
    {
       LOG_DEBUG(p_ctx, "table has less entries than advertised (%i/%i)", available_entries, entries);
       entries = available_entries;
    }
 
-   entries_size = entries * track_module->sample_table[table].entry_size;
-   size = vc_container_io_cache(p_ctx->priv->io, entries_size );
-   if(size != entries_size)
+   /* The table is only kept in memory until the sample index is built */
+   free(track_module->sample_table[table].data);
+   track_module->sample_table[table].data = 0;
+   track_module->sample_table[table].entries = 0;
+   if(!entries) return STREAM_STATUS(p_ctx);
+
+   entries_size = (size_t)entries * entry_size;
+   track_module->sample_table[table].data = malloc(entries_size);
+   if(!track_module->sample_table[table].data) return VC_CONTAINER_ERROR_OUT_OF_MEMORY;
+
+   size = READ_BYTES(p_ctx, track_module->sample_table[table].data, entries_size);
+   if((size_t)size != entries_size)
    {
-      available_entries = size / track_module->sample_table[table].entry_size;
-      LOG_DEBUG(p_ctx, "cached less table entries than advertised (%i/%i)", available_entries, entries);
-      track_module->sample_table[table].entries = available_entries;
+      available_entries = size / entry_size;
+      LOG_DEBUG(p_ctx, "read less table entries than advertised (%i/%i)", available_entries, entries);
+      entries = available_entries;
    }
+   track_module->sample_table[table].entries = entries;
 
    return STREAM_STATUS(p_ctx);
 }
@@ -860,7 +937,7 @@ static VC_CONTAINER_STATUS_T mp4_read_box_stts( VC_CONTAINER_T *p_ctx, int64_t s
    MP4_SKIP_U24(p_ctx, "flags");
 
    entries = MP4_READ_U32(p_ctx, "entry_count");
-   return mp4_cache_table( p_ctx, MP4_SAMPLE_TABLE_STTS, entries, size );
+   return mp4_read_table( p_ctx, MP4_SAMPLE_TABLE_STTS, entries, size );
 }
 
 /*****************************************************************************/
@@ -872,7 +949,7 @@ static VC_CONTAINER_STATUS_T mp4_read_box_ctts( VC_CONTAINER_T *p_ctx, int64_t s
    MP4_SKIP_U24(p_ctx, "flags");
 
    entries = MP4_READ_U32(p_ctx, "entry_count");
-   return mp4_cache_table( p_ctx, MP4_SAMPLE_TABLE_CTTS, entries, size );
+   return mp4_read_table( p_ctx, MP4_SAMPLE_TABLE_CTTS, entries, size );
 }
 
 /*****************************************************************************/
@@ -884,7 +961,7 @@ static VC_CONTAINER_STATUS_T mp4_read_box_stsc( VC_CONTAINER_T *p_ctx, int64_t s
    MP4_SKIP_U24(p_ctx, "flags");
 
    entries = MP4_READ_U32(p_ctx, "entry_count");
-   return mp4_cache_table( p_ctx, MP4_SAMPLE_TABLE_STSC, entries, size );
+   return mp4_read_table( p_ctx, MP4_SAMPLE_TABLE_STSC, entries, size );
 }
 
 /*****************************************************************************/
@@ -897,11 +974,11 @@ static VC_CONTAINER_STATUS_T mp4_read_box_stsz( VC_CONTAINER_T *p_ctx, int64_t s
    MP4_SKIP_U8(p_ctx, "version");
    MP4_SKIP_U24(p_ctx, "flags");
 
-   track_module->sample_size = READ_U32(p_ctx, "sample_size");
+   track_module->sample_size = MP4_READ_U32(p_ctx, "sample_size");
+   track_module->samples = entries = MP4_READ_U32(p_ctx, "sample_count");
    if(track_module->sample_size) return STREAM_STATUS(p_ctx);
 
-   entries = MP4_READ_U32(p_ctx, "sample_count");
-   return mp4_cache_table( p_ctx, MP4_SAMPLE_TABLE_STSZ, entries, size );
+   return mp4_read_table( p_ctx, MP4_SAMPLE_TABLE_STSZ, entries, size );
 }
 
 /*****************************************************************************/
@@ -913,7 +990,7 @@ static VC_CONTAINER_STATUS_T mp4_read_box_stco( VC_CONTAINER_T *p_ctx, int64_t s
    MP4_SKIP_U24(p_ctx, "flags");
 
    entries = MP4_READ_U32(p_ctx, "entry_count");
-   return mp4_cache_table( p_ctx, MP4_SAMPLE_TABLE_STCO, entries, size );
+   return mp4_read_table( p_ctx, MP4_SAMPLE_TABLE_STCO, entries, size );
 }
 
 /*****************************************************************************/
@@ -925,7 +1002,7 @@ static VC_CONTAINER_STATUS_T mp4_read_box_co64( VC_CONTAINER_T *p_ctx, int64_t s
    MP4_SKIP_U24(p_ctx, "flags");
 
    entries = MP4_READ_U32(p_ctx, "entry_count");
-   return mp4_cache_table( p_ctx, MP4_SAMPLE_TABLE_CO64, entries, size );
+   return mp4_read_table( p_ctx, MP4_SAMPLE_TABLE_CO64, entries, size );
 }
 
 /*****************************************************************************/
@@ -937,7 +1014,385 @@ static VC_CONTAINER_STATUS_T mp4_read_box_stss( VC_CONTAINER_T *p_ctx, int64_t s
    MP4_SKIP_U24(p_ctx, "flags");
 
    entries = MP4_READ_U32(p_ctx, "entry_count");
-   return mp4_cache_table( p_ctx, MP4_SAMPLE_TABLE_STSS, entries, size );
+   return mp4_read_table( p_ctx, MP4_SAMPLE_TABLE_STSS, entries, size );
+}
+
+/*****************************************************************************
+ * Sample index.
+ *****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_runs_write( MP4_RUNS_T *table )
+{
+   uint64_t delta, count = table->count;
+   uint8_t *data;
+
+   if(!table->count) return VC_CONTAINER_SUCCESS;
+
+   /* Make some room for the run (at most two 10 bytes integers) */
+   if(table->data_size - table->size < 2 * 10)
+   {
+      size_t data_size = table->data_size ? table->data_size * 2 : 256;
+      data = realloc(table->data, data_size);
+      if(!data) return VC_CONTAINER_ERROR_OUT_OF_MEMORY;
+      table->data = data;
+      table->data_size = data_size;
+   }
+   if(!(table->runs & (MP4_RUNS_BLOCK_SIZE - 1)))
+   {
+      uint32_t block = table->runs >> MP4_RUNS_BLOCK_SHIFT;
+      if(block >= table->blocks_size)
+      {
+         uint32_t blocks_size = table->blocks_size ? table->blocks_size * 2 : 16;
+         MP4_RUNS_BLOCK_T *blocks = realloc(table->blocks, blocks_size * sizeof(*blocks));
+         if(!blocks) return VC_CONTAINER_ERROR_OUT_OF_MEMORY;
+         table->blocks = blocks;
+         table->blocks_size = blocks_size;
+      }
+      table->blocks[block].position = table->size;
+      table->blocks[block].entry = table->entries;
+      table->blocks[block].sum = table->sum;
+      table->last = 0; /* The first run of a block is coded on its own */
+   }
+
+   /* The lowest bit tells whether the count is coded after the value (count > 1) and
+    * the value is zigzag coded so small negative differences stay small too. */
+   delta = table->value >= table->last ? (uint64_t)(table->value - table->last) << 1 :
+      (((uint64_t)(table->last - table->value)) << 1) - 1;
+   delta = (delta << 1) | (count > 1);
+   if(count > 1) count -= 2;
+   else count = 0;
+
+   data = table->data + table->size;
+   for(; delta >= 0x80; delta >>= 7) *data++ = (uint8_t)delta | 0x80;
+   *data++ = (uint8_t)delta;
+   if(table->count > 1)
+   {
+      for(; count >= 0x80; count >>= 7) *data++ = (uint8_t)count | 0x80;
+      *data++ = (uint8_t)count;
+   }
+   table->size = data - table->data;
+
+   table->entries += table->count;
+   table->sum += (uint64_t)table->value * table->count;
+   table->last = table->value;
+   table->runs++;
+   table->count = 0;
+   return VC_CONTAINER_SUCCESS;
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_runs_add( MP4_RUNS_T *table, uint32_t count, int64_t value )
+{
+   VC_CONTAINER_STATUS_T status;
+
+   if(!count) return VC_CONTAINER_SUCCESS;
+
+   /* Merge with the current run when possible */
+   if(table->count && (table->value != value || table->count > UINT32_MAX - count))
+   {
+      status = mp4_runs_write(table);
+      if(status != VC_CONTAINER_SUCCESS) return status;
+   }
+
+   table->value = value;
+   table->count += count;
+   return VC_CONTAINER_SUCCESS;
+}
+
+/*****************************************************************************/
+static void mp4_runs_clear( MP4_RUNS_T *table )
+{
+   free(table->data);
+   free(table->blocks);
+   memset(table, 0, sizeof(*table));
+}
+
+/*****************************************************************************/
+static uint64_t mp4_runs_read_varint( const MP4_RUNS_T *table, MP4_RUNS_CURSOR_T *cursor )
+{
+   uint64_t value = 0;
+   unsigned int shift = 0;
+   uint8_t byte;
+
+   do {
+      byte = table->data[cursor->position++];
+      value |= (uint64_t)(byte & 0x7f) << shift;
+      shift += 7;
+   } while(byte & 0x80);
+
+   return value;
+}
+
+/*****************************************************************************/
+static void mp4_runs_next( const MP4_RUNS_T *table, MP4_RUNS_CURSOR_T *cursor )
+{
+   uint64_t delta;
+
+   if(cursor->run >= table->runs) return;
+
+   cursor->sum += (uint64_t)cursor->value * cursor->count;
+   cursor->entry += cursor->count;
+   if(!(cursor->run & (MP4_RUNS_BLOCK_SIZE - 1)))
+      cursor->value = 0;
+
+   delta = mp4_runs_read_varint(table, cursor);
+   cursor->count = (delta & 1) ? mp4_runs_read_varint(table, cursor) + 2 : 1;
+   delta >>= 1;
+   if(delta & 1) cursor->value -= (int64_t)((delta + 1) >> 1);
+   else cursor->value += (int64_t)(delta >> 1);
+   cursor->run++;
+}
+
+/*****************************************************************************/
+static void mp4_runs_set_block( const MP4_RUNS_T *table, MP4_RUNS_CURSOR_T *cursor,
+   uint32_t block )
+{
+   cursor->run = block << MP4_RUNS_BLOCK_SHIFT;
+   cursor->position = table->blocks[block].position;
+   cursor->entry = table->blocks[block].entry;
+   cursor->sum = table->blocks[block].sum;
+   cursor->count = 0;
+   cursor->value = 0;
+}
+
+/*****************************************************************************/
+static int64_t mp4_runs_get( const MP4_RUNS_T *table, MP4_RUNS_CURSOR_T *cursor,
+   uint32_t entry, uint64_t *sum )
+{
+   if(!table->runs) return 0;
+
+   /* We're usually reading entries in order so try the current and next runs first */
+   if(entry >= cursor->entry + cursor->count)
+      mp4_runs_next(table, cursor);
+
+   if(entry < cursor->entry || entry >= cursor->entry + cursor->count)
+   {
+      uint32_t low = 0, high = (table->runs - 1) >> MP4_RUNS_BLOCK_SHIFT, middle;
+
+      /* Find the block which covers the entry */
+      while(low < high)
+      {
+         middle = (low + high + 1) / 2;
+         if(table->blocks[middle].entry <= entry) low = middle;
+         else high = middle - 1;
+      }
+
+      mp4_runs_set_block(table, cursor, low);
+      do mp4_runs_next(table, cursor);
+      while(entry >= cursor->entry + cursor->count && cursor->run < table->runs);
+   }
+
+   if(sum) *sum = cursor->sum + (uint64_t)cursor->value * (entry - cursor->entry);
+   return cursor->value;
+}
+
+/*****************************************************************************/
+static uint32_t mp4_runs_find( const MP4_RUNS_T *table, MP4_RUNS_CURSOR_T *cursor,
+   uint64_t sum )
+{
+   /* Returns the entry for which the sum of the values of all the entries up to and
+    * including it goes past the given sum. The values must not be negative. */
+   uint32_t low = 0, high, middle;
+
+   if(!table->runs) return 0;
+
+   /* We're usually moving forward so try the current and next runs first */
+   if(sum >= cursor->sum + (uint64_t)cursor->value * cursor->count)
+      mp4_runs_next(table, cursor);
+
+   if(sum < cursor->sum || sum >= cursor->sum + (uint64_t)cursor->value * cursor->count)
+   {
+      /* Find the last block which starts before the sum */
+      high = (table->runs - 1) >> MP4_RUNS_BLOCK_SHIFT;
+      while(low < high)
+      {
+         middle = (low + high + 1) / 2;
+         if(table->blocks[middle].sum <= sum) low = middle;
+         else high = middle - 1;
+      }
+
+      mp4_runs_set_block(table, cursor, low);
+      do mp4_runs_next(table, cursor);
+      while(sum >= cursor->sum + (uint64_t)cursor->value * cursor->count &&
+            cursor->run < table->runs);
+
+      if(sum >= cursor->sum + (uint64_t)cursor->value * cursor->count)
+         return table->entries; /* Past the end of the table */
+   }
+
+   return cursor->entry + (uint32_t)((sum - cursor->sum) / (uint64_t)cursor->value);
+}
+
+/*****************************************************************************/
+static bool mp4_index_is_sync( const MP4_SAMPLE_INDEX_T *index, uint32_t sample )
+{
+   return index->sync && (index->sync[sample >> 5] & (1u << (sample & 31)));
+}
+
+/*****************************************************************************/
+static uint32_t mp4_index_find_sync( const MP4_SAMPLE_INDEX_T *index, uint32_t sample,
+   bool forward )
+{
+   /* Returns the first sync sample after the given one (forward) or the last sync
+    * sample before or at the given one. index->samples is returned if there isn't any. */
+   if(forward)
+   {
+      while(++sample < index->samples)
+      {
+         if(!(sample & 31) && !index->sync[sample >> 5]) { sample += 31; continue; }
+         if(mp4_index_is_sync(index, sample)) return sample;
+      }
+      return index->samples;
+   }
+
+   for(sample++; sample--; )
+   {
+      if((sample & 31) == 31 && !index->sync[sample >> 5]) { sample -= 31; continue; }
+      if(mp4_index_is_sync(index, sample)) return sample;
+   }
+   return index->samples;
+}
+
+/*****************************************************************************/
+static uint32_t mp4_table_u32( VC_CONTAINER_TRACK_MODULE_T *track_module,
+   MP4_SAMPLE_TABLE_T table, uint32_t entry, unsigned int field )
+{
+   const uint8_t *p = track_module->sample_table[table].data +
+      (size_t)entry * track_module->sample_table[table].entry_size + field * 4;
+   return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_build_sample_index( VC_CONTAINER_T *p_ctx,
+   VC_CONTAINER_TRACK_MODULE_T *track_module )
+{
+   MP4_SAMPLE_INDEX_T *index = &track_module->index;
+   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
+   uint32_t i, count, chunk, chunks, samples;
+   MP4_SAMPLE_TABLE_T stco = MP4_SAMPLE_TABLE_STCO;
+   uint64_t total;
+
+   if(track_module->sample_table[MP4_SAMPLE_TABLE_CO64].entries)
+      stco = MP4_SAMPLE_TABLE_CO64;
+   chunks = track_module->sample_table[stco].entries;
+
+   /* Chunks. The number of samples in each chunk comes from the runs of the STSC */
+   for(i = 0; status == VC_CONTAINER_SUCCESS &&
+       i < track_module->sample_table[MP4_SAMPLE_TABLE_STSC].entries; i++)
+   {
+      uint32_t first_chunk = mp4_table_u32(track_module, MP4_SAMPLE_TABLE_STSC, i, 0);
+      uint32_t samples_per_chunk = mp4_table_u32(track_module, MP4_SAMPLE_TABLE_STSC, i, 1);
+      uint32_t done = index->chunks.entries + index->chunks.count;
+
+      count = chunks - done;
+      if(i + 1 < track_module->sample_table[MP4_SAMPLE_TABLE_STSC].entries)
+         count = mp4_table_u32(track_module, MP4_SAMPLE_TABLE_STSC, i + 1, 0) - first_chunk;
+      if(!first_chunk || !samples_per_chunk || (int32_t)count <= 0)
+      {
+         LOG_DEBUG(p_ctx, "invalid sample to chunk entry %i", i);
+         break;
+      }
+
+      status = mp4_runs_add(&index->chunks, MIN(count, chunks - done), samples_per_chunk);
+   }
+   if(status == VC_CONTAINER_SUCCESS) status = mp4_runs_write(&index->chunks);
+
+   for(chunk = 0; status == VC_CONTAINER_SUCCESS && chunk < index->chunks.entries; chunk++)
+   {
+      int64_t offset = mp4_table_u32(track_module, stco, chunk, 0);
+      if(stco == MP4_SAMPLE_TABLE_CO64)
+         offset = (offset << 32) | mp4_table_u32(track_module, stco, chunk, 1);
+      status = mp4_runs_add(&index->chunk_offsets, 1, offset);
+   }
+   if(status == VC_CONTAINER_SUCCESS) status = mp4_runs_write(&index->chunk_offsets);
+
+   /* We can only use the samples described by all the tables */
+   samples = track_module->samples;
+   if(!track_module->sample_size)
+      samples = MIN(samples, track_module->sample_table[MP4_SAMPLE_TABLE_STSZ].entries);
+   samples = MIN(samples, index->chunks.sum);
+   for(i = 0, total = 0; i < track_module->sample_table[MP4_SAMPLE_TABLE_STTS].entries; i++)
+      total += mp4_table_u32(track_module, MP4_SAMPLE_TABLE_STTS, i, 0);
+   samples = MIN(samples, total);
+   if(samples != track_module->samples)
+      LOG_DEBUG(p_ctx, "only %i samples out of %i are usable", samples, track_module->samples);
+   index->samples = samples;
+
+   /* Sizes */
+   if(track_module->sample_size)
+      status = mp4_runs_add(&index->sizes, samples, track_module->sample_size);
+   for(i = 0; status == VC_CONTAINER_SUCCESS && !track_module->sample_size && i < samples; i++)
+      status = mp4_runs_add(&index->sizes, 1,
+         mp4_table_u32(track_module, MP4_SAMPLE_TABLE_STSZ, i, 0));
+   if(status == VC_CONTAINER_SUCCESS) status = mp4_runs_write(&index->sizes);
+
+   /* Durations */
+   for(i = 0; status == VC_CONTAINER_SUCCESS && index->durations.entries +
+       index->durations.count < samples; i++)
+   {
+      count = mp4_table_u32(track_module, MP4_SAMPLE_TABLE_STTS, i, 0);
+      count = MIN(count, samples - index->durations.entries - index->durations.count);
+      status = mp4_runs_add(&index->durations, count,
+         mp4_table_u32(track_module, MP4_SAMPLE_TABLE_STTS, i, 1));
+   }
+   if(status == VC_CONTAINER_SUCCESS) status = mp4_runs_write(&index->durations);
+
+   /* Composition time offsets. Missing ones are assumed to be 0. */
+   for(i = 0; status == VC_CONTAINER_SUCCESS && index->composition.entries +
+       index->composition.count < samples; i++)
+   {
+      if(i < track_module->sample_table[MP4_SAMPLE_TABLE_CTTS].entries)
+      {
+         count = mp4_table_u32(track_module, MP4_SAMPLE_TABLE_CTTS, i, 0);
+         count = MIN(count, samples - index->composition.entries - index->composition.count);
+         status = mp4_runs_add(&index->composition, count, /* Converted to signed */
+            (int32_t)mp4_table_u32(track_module, MP4_SAMPLE_TABLE_CTTS, i, 1));
+      }
+      else if(i)
+         status = mp4_runs_add(&index->composition,
+            samples - index->composition.entries - index->composition.count, 0);
+      else break;
+   }
+   if(status == VC_CONTAINER_SUCCESS) status = mp4_runs_write(&index->composition);
+
+   /* Sync samples */
+   if(status == VC_CONTAINER_SUCCESS && track_module->sample_table[MP4_SAMPLE_TABLE_STSS].entries)
+   {
+      index->sync = calloc(samples / 32 + 1, sizeof(*index->sync));
+      if(!index->sync) status = VC_CONTAINER_ERROR_OUT_OF_MEMORY;
+   }
+   for(i = 0; index->sync && i < track_module->sample_table[MP4_SAMPLE_TABLE_STSS].entries; i++)
+   {
+      uint32_t sample = mp4_table_u32(track_module, MP4_SAMPLE_TABLE_STSS, i, 0) - 1;
+      if(sample < samples) index->sync[sample >> 5] |= 1u << (sample & 31);
+   }
+
+   /* We don't need the tables anymore */
+   for(i = 0; i < MP4_SAMPLE_TABLE_NUM; i++)
+   {
+      free(track_module->sample_table[i].data);
+      track_module->sample_table[i].data = 0;
+      track_module->sample_table[i].entries = 0;
+   }
+
+   LOG_DEBUG(p_ctx, "sample index: %i samples, %i chunks, %i bytes", samples, index->chunks.entries,
+             (int)(index->sizes.size + index->durations.size + index->composition.size +
+                   index->chunks.size + index->chunk_offsets.size));
+   return status;
+}
+
+/*****************************************************************************/
+static void mp4_free_sample_index( VC_CONTAINER_TRACK_MODULE_T *track_module )
+{
+   unsigned int i;
+
+   for(i = 0; i < MP4_SAMPLE_TABLE_NUM; i++)
+      free(track_module->sample_table[i].data);
+   mp4_runs_clear(&track_module->index.sizes);
+   mp4_runs_clear(&track_module->index.durations);
+   mp4_runs_clear(&track_module->index.composition);
+   mp4_runs_clear(&track_module->index.chunks);
+   mp4_runs_clear(&track_module->index.chunk_offsets);
+   free(track_module->index.sync);
 }
 
 /*****************************************************************************/
@@ -1204,7 +1659,11 @@ static VC_CONTAINER_STATUS_T mp4_reader_close( VC_CONTAINER_T *p_ctx )
    unsigned int i;
 
    for(i = 0; i < p_ctx->tracks_num; i++)
+   {
+      mp4_free_sample_index(p_ctx->tracks[i]->priv->module);
       vc_container_free_track(p_ctx, p_ctx->tracks[i]);
+   }
+   p_ctx->tracks_num = 0;
    free(module);
    return VC_CONTAINER_SUCCESS;
 }
@@ -1216,136 +1675,23 @@ static void mp4_log_state( VC_CONTAINER_T *p_ctx, MP4_READER_STATE_T *state )
    VC_CONTAINER_PARAM_UNUSED(p_ctx);
 
    LOG_DEBUG(p_ctx, "state:");
-   LOG_DEBUG(p_ctx, "duration: %i, pts %i, dts %i", (int)state->duration,
-             (int)state->pts, (int)state->dts);
+   LOG_DEBUG(p_ctx, "pts %i, dts %i", (int)state->pts, (int)state->dts);
    LOG_DEBUG(p_ctx, "sample: %i, offset %i, sample_offset %i, sample_size %i",
              state->sample, (int)state->offset, state->sample_offset,
              state->sample_size);
-   LOG_DEBUG(p_ctx, "sample_duration: %i, count %i",
-             state->sample_duration, state->sample_duration_count);
-   LOG_DEBUG(p_ctx, "sample_composition_offset: %i, count %i",
-             state->sample_composition_offset, state->sample_composition_count);
-   LOG_DEBUG(p_ctx, "next_sync_sample: %i, keyframe %i",
-             state->next_sync_sample, state->keyframe);
-   LOG_DEBUG(p_ctx, "samples_per_chunk: %i, chunks %i, samples_in_chunk %i",
-             state->samples_per_chunk, state->chunks, state->samples_in_chunk);
-   LOG_DEBUG(p_ctx, "MP4_SAMPLE_TABLE_STTS %i", state->sample_table[MP4_SAMPLE_TABLE_STTS].entry);
-   LOG_DEBUG(p_ctx, "MP4_SAMPLE_TABLE_STSZ %i", state->sample_table[MP4_SAMPLE_TABLE_STSZ].entry);
-   LOG_DEBUG(p_ctx, "MP4_SAMPLE_TABLE_STSC %i", state->sample_table[MP4_SAMPLE_TABLE_STSC].entry);
-   LOG_DEBUG(p_ctx, "MP4_SAMPLE_TABLE_STCO %i", state->sample_table[MP4_SAMPLE_TABLE_STCO].entry);
-   LOG_DEBUG(p_ctx, "MP4_SAMPLE_TABLE_CO64 %i", state->sample_table[MP4_SAMPLE_TABLE_CO64].entry);
-   LOG_DEBUG(p_ctx, "MP4_SAMPLE_TABLE_CTTS %i", state->sample_table[MP4_SAMPLE_TABLE_CTTS].entry);
+   LOG_DEBUG(p_ctx, "keyframe %i", state->keyframe);
+   LOG_DEBUG(p_ctx, "chunk: %i, chunk_end %i", state->chunk, state->chunk_end);
 }
 #endif /* ENABLE_MP4_READER_LOG_STATE */
 
-/*****************************************************************************/
-static VC_CONTAINER_STATUS_T mp4_seek_sample_table( VC_CONTAINER_T *p_ctx,
-   VC_CONTAINER_TRACK_MODULE_T *track_module, MP4_READER_STATE_T *state,
-   MP4_SAMPLE_TABLE_T table)
-{
-   int64_t seek_offset;
-
-   /* Seek to the next entry in the table */
-   if(state->sample_table[table].entry >= track_module->sample_table[table].entries)
-      return VC_CONTAINER_ERROR_EOS;
-
-   seek_offset = track_module->sample_table[table].offset +
-      track_module->sample_table[table].entry_size * state->sample_table[table].entry;
-
-   return SEEK(p_ctx, seek_offset);
-}
-
-/*****************************************************************************/
-static VC_CONTAINER_STATUS_T mp4_read_sample_table( VC_CONTAINER_T *p_ctx,
-   VC_CONTAINER_TRACK_MODULE_T *track_module, MP4_READER_STATE_T *state,
-   MP4_SAMPLE_TABLE_T table, unsigned int seek)
-{
-   uint32_t value;
-
-   if(table == MP4_SAMPLE_TABLE_STSZ && track_module->sample_size)
-   {
-      state->sample_size = track_module->sample_size;
-      return state->status;
-   }
-
-   /* CO64 support */
-   if(table == MP4_SAMPLE_TABLE_STCO &&
-      track_module->sample_table[MP4_SAMPLE_TABLE_CO64].entries)
-      table = MP4_SAMPLE_TABLE_CO64;
-
-   /* Seek to the next entry in the table */
-   if(seek)
-   {
-      state->status = mp4_seek_sample_table( p_ctx, track_module, state, table );
-      if(state->status != VC_CONTAINER_SUCCESS) return state->status;
-   }
-
-   switch(table)
-   {
-   case MP4_SAMPLE_TABLE_STSZ:
-      state->sample_size = _READ_U32(p_ctx);
-      state->status = STREAM_STATUS(p_ctx);
-      break;
-
-   case MP4_SAMPLE_TABLE_STTS:
-      state->sample_duration_count = _READ_U32(p_ctx);
-      state->sample_duration = _READ_U32(p_ctx);
-      state->status = STREAM_STATUS(p_ctx);
-      if(state->status != VC_CONTAINER_SUCCESS) break;
-      if(!state->sample_duration_count) state->status = VC_CONTAINER_ERROR_CORRUPTED;
-      break;
-
-   case MP4_SAMPLE_TABLE_CTTS:
-      state->sample_composition_count = _READ_U32(p_ctx);
-      state->sample_composition_offset = _READ_U32(p_ctx); /* Converted to signed */
-      state->status = STREAM_STATUS(p_ctx);
-      if(state->status != VC_CONTAINER_SUCCESS) break;
-      if(!state->sample_composition_count) state->status = VC_CONTAINER_ERROR_CORRUPTED;
-      break;
-
-   case MP4_SAMPLE_TABLE_STSC:
-      state->chunks = _READ_U32(p_ctx);
-      state->samples_per_chunk = _READ_U32(p_ctx);
-      _SKIP_U32(p_ctx);
-      state->status = STREAM_STATUS(p_ctx);
-      if(state->status != VC_CONTAINER_SUCCESS) break;
-
-      if(state->sample_table[table].entry + 1 <
-         track_module->sample_table[MP4_SAMPLE_TABLE_STSC].entries) value = _READ_U32(p_ctx);
-      else value = -1;
-
-      if(!state->chunks || !state->samples_per_chunk || state->chunks >= value )
-      {state->status = VC_CONTAINER_ERROR_CORRUPTED; break;}
-      state->chunks = value - state->chunks;
-      state->samples_in_chunk = state->samples_per_chunk;
-      break;
-
-   case MP4_SAMPLE_TABLE_STCO:
-   case MP4_SAMPLE_TABLE_CO64:
-      state->offset = table == MP4_SAMPLE_TABLE_STCO ? _READ_U32(p_ctx) : _READ_U64(p_ctx);
-      state->status = STREAM_STATUS(p_ctx);
-      if(state->status != VC_CONTAINER_SUCCESS) break;
-      if(!state->offset) state->status = VC_CONTAINER_ERROR_CORRUPTED;
-      state->samples_in_chunk = state->samples_per_chunk;
-      break;
-
-   case MP4_SAMPLE_TABLE_STSS:
-      state->next_sync_sample = _READ_U32(p_ctx);
-      state->status = STREAM_STATUS(p_ctx);
-      break;
-
-   default: break;
-   }
-
-   state->sample_table[table].entry++;
-   return state->status;
-}
-
 /*****************************************************************************/
 static VC_CONTAINER_STATUS_T mp4_read_sample_header( VC_CONTAINER_T *p_ctx, uint32_t track,
    MP4_READER_STATE_T *state )
 {
    VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[track]->priv->module;
+   MP4_SAMPLE_INDEX_T *index = &track_module->index;
+   uint64_t duration, first, offset;
+   uint32_t size;
 
    if(state->status != VC_CONTAINER_SUCCESS) return state->status;
 
@@ -1356,89 +1702,58 @@ static VC_CONTAINER_STATUS_T mp4_read_sample_header( VC_CONTAINER_T *p_ctx, uint
    state->offset += state->sample_size;
    state->sample_offset = 0;
    state->sample_size = 0;
-   state->sample++;
 
-   if(!state->samples_in_chunk)
+   if(state->sample >= index->samples)
    {
-      /* We're switching to the next chunk */
-      if(!state->chunks)
-      {
-         /* Seek to the next entry in the STSC */
-         state->status = mp4_read_sample_table( p_ctx, track_module, state, MP4_SAMPLE_TABLE_STSC, 1 );
-         if(state->status != VC_CONTAINER_SUCCESS) goto error;
-      }
-
-      /* Get the offset of the new chunk */
-      state->status = mp4_read_sample_table( p_ctx, track_module, state, MP4_SAMPLE_TABLE_STCO, 1 );
-      if(state->status != VC_CONTAINER_SUCCESS) goto error;
+      state->status = VC_CONTAINER_ERROR_EOS;
+      goto error;
+   }
 
-      state->chunks--;
+   if(state->sample >= state->chunk_end)
+   {
+      /* We're switching to another chunk. Find where it starts and where
+       * our sample is within it. */
+      state->chunk = mp4_runs_find(&index->chunks, &state->cursors.chunks, state->sample);
+      state->chunk_end = mp4_runs_get(&index->chunks, &state->cursors.chunks, state->chunk, &first);
+      state->chunk_end += first;
+
+      state->offset = mp4_runs_get(&index->chunk_offsets, &state->cursors.chunk_offsets,
+                                   state->chunk, 0);
+      if(!state->offset) {state->status = VC_CONTAINER_ERROR_CORRUPTED; goto error;}
+
+      mp4_runs_get(&index->sizes, &state->cursors.sizes, first, &first);
+      mp4_runs_get(&index->sizes, &state->cursors.sizes, state->sample, &offset);
+      state->offset += offset - first;
    }
-   state->samples_in_chunk--;
 
    /* Get the new sample size */
-   state->status = mp4_read_sample_table( p_ctx, track_module, state, MP4_SAMPLE_TABLE_STSZ, 1 );
-   if(state->status != VC_CONTAINER_SUCCESS) goto error;
+   size = mp4_runs_get(&index->sizes, &state->cursors.sizes, state->sample, 0);
 
    /* Get the timestamp */
+   mp4_runs_get(&index->durations, &state->cursors.durations, state->sample, &duration);
    if(track_module->timescale)
-      state->pts = state->dts = state->duration * 1000000 / track_module->timescale;
-   if(!state->sample_duration_count)
-   {
-      state->status = mp4_read_sample_table( p_ctx, track_module, state, MP4_SAMPLE_TABLE_STTS, 1 );
-      if(state->status != VC_CONTAINER_SUCCESS) goto error;
-   }
-   state->sample_duration_count--;
+      state->pts = state->dts = (int64_t)duration * 1000000 / track_module->timescale;
 
    /* Get the composition time */
-   if(track_module->sample_table[MP4_SAMPLE_TABLE_CTTS].entries)
-   {
-      if(!state->sample_composition_count)
-      {
-         state->status = mp4_read_sample_table( p_ctx, track_module, state, MP4_SAMPLE_TABLE_CTTS, 1 );
-         if(state->status != VC_CONTAINER_SUCCESS) goto error;
-      }
-      if(track_module->timescale)
-         state->pts = (state->duration + state->sample_composition_offset) * 1000000 / track_module->timescale;
-      state->sample_composition_count--;
-   }
-   state->duration += state->sample_duration;
+   if(index->composition.entries && track_module->timescale)
+      state->pts = ((int64_t)duration + mp4_runs_get(&index->composition,
+         &state->cursors.composition, state->sample, 0)) * 1000000 / track_module->timescale;
 
    /* Get the keyframe flag */
-   if(state->sample_table[MP4_SAMPLE_TABLE_STSS].entry <
-         track_module->sample_table[MP4_SAMPLE_TABLE_STSS].entries &&
-      !state->next_sync_sample)
-   {
-      mp4_read_sample_table( p_ctx, track_module, state, MP4_SAMPLE_TABLE_STSS, 1 );
-      state->status = VC_CONTAINER_SUCCESS; /* This isn't a critical error */
-   }
-
-   state->keyframe = 
-      track_module->sample_table[MP4_SAMPLE_TABLE_STSS].entries &&
-      state->sample == state->next_sync_sample;
-   if(state->keyframe)
-      state->next_sync_sample = 0;
+   state->keyframe = mp4_index_is_sync(index, state->sample);
+   state->sample++;
 
    /* Try to batch several samples together if requested. We'll always stop at the chunk boundary */
    if(track_module->samples_batch_size)
    {
-      uint32_t size = state->sample_size;
-      while(state->samples_in_chunk && size < track_module->samples_batch_size)
+      while(state->sample < state->chunk_end && state->sample < index->samples &&
+            size < track_module->samples_batch_size)
       {
-         if(mp4_read_sample_table( p_ctx, track_module, state, MP4_SAMPLE_TABLE_STSZ, 1 )) break;
-
-         if(!state->sample_duration_count)
-            if(mp4_read_sample_table( p_ctx, track_module, state, MP4_SAMPLE_TABLE_STTS, 1 )) break;
-
-         state->sample_duration_count--;
-         state->duration += state->sample_duration;
-
-         size += state->sample_size;
-         state->samples_in_chunk--;
+         size += mp4_runs_get(&index->sizes, &state->cursors.sizes, state->sample, 0);
          state->sample++;
       }
-      state->sample_size = size;
    }
+   state->sample_size = size;
 
 #ifdef ENABLE_MP4_READER_LOG_STATE
    mp4_log_state(p_ctx, state);
@@ -1450,25 +1765,25 @@ static VC_CONTAINER_STATUS_T mp4_read_sample_header( VC_CONTAINER_T *p_ctx, uint
 
 /*****************************************************************************/
 static VC_CONTAINER_STATUS_T mp4_read_sample_data( VC_CONTAINER_T *p_ctx, uint32_t track,
-   MP4_READER_STATE_T *state, uint8_t *data, unsigned int *data_size )
+   MP4_READER_STATE_T *state, VC_CONTAINER_PACKET_T *packet, uint32_t flags )
 {
    VC_CONTAINER_STATUS_T status;
    unsigned int size = state->sample_size - state->sample_offset;
 
    if(state->status != VC_CONTAINER_SUCCESS) return state->status;
 
-   if(data_size && *data_size < size) size = *data_size;
-
-   if(data)
+   if(packet)
    {
+      if(packet->buffer_size < size) size = packet->buffer_size;
+
       state->status = SEEK(p_ctx, state->offset + state->sample_offset);
       if(state->status != VC_CONTAINER_SUCCESS) return state->status;
 
-      size = READ_BYTES(p_ctx, data, size);
+      size = READ_PACKET_BYTES(p_ctx, packet, flags, size);
+      packet->size = size;
    }
    state->sample_offset += size;
 
-   if(data_size) *data_size = size;
    state->status = STREAM_STATUS(p_ctx);
    if(state->status != VC_CONTAINER_SUCCESS) return state->status;
 
@@ -1489,8 +1804,6 @@ static VC_CONTAINER_STATUS_T mp4_reader_read( VC_CONTAINER_T *p_ctx,
    VC_CONTAINER_STATUS_T status;
    MP4_READER_STATE_T *state;
    uint32_t i, track;
-   unsigned int data_size;
-   uint8_t *data = 0;
    int64_t offset;
 
    /* Select the track to read from. If no specific track is requested by the caller, this
@@ -1536,17 +1849,13 @@ static VC_CONTAINER_STATUS_T mp4_reader_read( VC_CONTAINER_T *p_ctx,
    else if((flags & VC_CONTAINER_READ_FLAG_INFO) || !packet->data)
       return VC_CONTAINER_SUCCESS;
 
-   data = packet->data;
-   data_size = packet->buffer_size;
-
-   status = mp4_read_sample_data(p_ctx, track, state, data, &data_size);
+   status = mp4_read_sample_data(p_ctx, track, state, packet, flags);
    if(status != VC_CONTAINER_SUCCESS)
    {
       /* FIXME */
       return status;
    }
 
-   packet->size = data_size;
    if(state->sample_offset) //?
       packet->flags &= ~VC_CONTAINER_PACKET_FLAG_FRAME_END;
 
@@ -1558,147 +1867,27 @@ static uint32_t mp4_find_sample( VC_CONTAINER_T *p_ctx, uint32_t track,
    MP4_READER_STATE_T *state, int64_t seek_time, VC_CONTAINER_STATUS_T *p_status )
 {
    VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[track]->priv->module;
-   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
-   uint32_t sample = 0, sample_duration_count;
-   int64_t sample_duration, seek_time_up = seek_time + 1;
-   unsigned int i;
+   MP4_RUNS_CURSOR_T cursor;
    VC_CONTAINER_PARAM_UNUSED(state);
 
-   seek_time = seek_time * track_module->timescale / 1000000;
-   /* We also need to check against the time rounded up to account for
+   /* We need to check against the time rounded up to account for
     * rounding errors in the timestamp (because of the timescale conversion) */
-   seek_time_up = seek_time_up * track_module->timescale / 1000000;
-
-   status = SEEK(p_ctx, track_module->sample_table[MP4_SAMPLE_TABLE_STTS].offset);
-   if(status != VC_CONTAINER_SUCCESS) goto end;
+   seek_time = (seek_time + 1) * track_module->timescale / 1000000;
+   if(seek_time < 0) seek_time = 0;
 
    /* Find the sample which corresponds to the requested time */
-   for(i = 0; i < track_module->sample_table[MP4_SAMPLE_TABLE_STTS].entries; i++)
-   {
-      sample_duration_count = _READ_U32(p_ctx);
-      sample_duration = _READ_U32(p_ctx);
-      status = STREAM_STATUS(p_ctx);
-      if(status != VC_CONTAINER_SUCCESS) break;
-
-      if(sample_duration_count * sample_duration <= seek_time)
-      {
-         seek_time -= sample_duration_count * sample_duration;
-         seek_time_up -= sample_duration_count * sample_duration;
-         sample += sample_duration_count;
-         continue;
-      }
-      if(!sample_duration) break;
-
-      seek_time /= sample_duration;
-      seek_time_up /= sample_duration;
-      sample += MAX(seek_time, seek_time_up);
-      break;
-   }
-
- end:
-   if(p_status) *p_status = status;
-   return sample;
+   memset(&cursor, 0, sizeof(cursor));
+   if(p_status) *p_status = VC_CONTAINER_SUCCESS;
+   return mp4_runs_find(&track_module->index.durations, &cursor, seek_time);
 }
 
 /*****************************************************************************/
 static VC_CONTAINER_STATUS_T mp4_seek_track( VC_CONTAINER_T *p_ctx, uint32_t track,
    MP4_READER_STATE_T *state, uint32_t sample )
 {
-   VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[track]->priv->module;
-   uint32_t chunk = 0, samples;
-   unsigned int i;
-
    memset(state, 0, sizeof(*state));
-
-   /* Find the right chunk */
-   for(i = 0, samples = sample; i < track_module->sample_table[MP4_SAMPLE_TABLE_STSC].entries; i++)
-   {
-      state->status = mp4_read_sample_table( p_ctx, track_module, state, MP4_SAMPLE_TABLE_STSC, 1 );
-      if(state->status != VC_CONTAINER_SUCCESS) goto error;
-
-      if(state->chunks * state->samples_per_chunk <= samples)
-      {
-         samples -= state->chunks * state->samples_per_chunk;
-         chunk += state->chunks;
-         continue;
-      }
-
-      while(samples >= state->samples_per_chunk)
-      {
-         samples -= state->samples_per_chunk;
-         state->chunks--;
-         chunk++;
-      }
-
-      state->chunks--;
-      break;
-   }
-
-   /* Get the offset of the selected chunk */
-   state->sample_table[MP4_SAMPLE_TABLE_STCO].entry = chunk;
-   state->sample_table[MP4_SAMPLE_TABLE_CO64].entry = chunk;
-   state->status = mp4_read_sample_table( p_ctx, track_module, state, MP4_SAMPLE_TABLE_STCO, 1 );
-   if(state->status != VC_CONTAINER_SUCCESS) goto error;
-
-   /* Find the sample offset within the chunk */
-   state->sample_table[MP4_SAMPLE_TABLE_STSZ].entry = sample - samples;
-   for(i = 0; i < samples; i++)
-   {
-      state->status = mp4_read_sample_table( p_ctx, track_module, state, MP4_SAMPLE_TABLE_STSZ, !i );
-      if(state->status != VC_CONTAINER_SUCCESS) goto error;
-      state->offset += state->sample_size;
-      state->samples_in_chunk--;
-   }
-
-   /* Get the timestamp */
-   for(i = 0, samples = sample; i < track_module->sample_table[MP4_SAMPLE_TABLE_STTS].entries; i++)
-   {
-      state->status = mp4_read_sample_table( p_ctx, track_module, state, MP4_SAMPLE_TABLE_STTS, !i );
-      if(state->status != VC_CONTAINER_SUCCESS) goto error;
-
-      if(state->sample_duration_count <= samples)
-      {
-         samples -= state->sample_duration_count;
-         state->duration += state->sample_duration * state->sample_duration_count;
-         continue;
-      }
-
-      state->sample_duration_count -= samples;
-      state->duration += samples * state->sample_duration;
-      break;
-   }
-
-   /* Find the right place in the sample composition table */
-   for(i = 0, samples = sample; i < track_module->sample_table[MP4_SAMPLE_TABLE_CTTS].entries; i++)
-   {
-      state->status = mp4_read_sample_table( p_ctx, track_module, state, MP4_SAMPLE_TABLE_CTTS, !i );
-      if(state->status != VC_CONTAINER_SUCCESS) goto error;
-
-      if(state->sample_composition_count <= samples)
-      {
-         samples -= state->sample_composition_count;
-         continue;
-      }
-
-      state->sample_composition_count -= samples;
-      break;
-   }
-
-   /* Find the right place in the synchronisation table */
-   for(i = 0; i < track_module->sample_table[MP4_SAMPLE_TABLE_STSS].entries; i++)
-   {
-      state->status = mp4_read_sample_table( p_ctx, track_module, state, MP4_SAMPLE_TABLE_STSS, !i );
-      if(state->status != VC_CONTAINER_SUCCESS) goto error;
-
-      if(state->next_sync_sample >= sample + 1) break;
-   }
-
    state->sample = sample;
-   state->sample_size = 0;
-   mp4_read_sample_header(p_ctx, track, state);
-
- error:
-   return state->status;
+   return mp4_read_sample_header(p_ctx, track, state);
 }
 
 /*****************************************************************************/
@@ -1741,18 +1930,14 @@ static VC_CONTAINER_STATUS_T mp4_reader_seek(VC_CONTAINER_T *p_ctx,
    if(status != VC_CONTAINER_SUCCESS) goto seek_time_found;
 
    /* Find the closest sync sample */
-   status = mp4_seek_sample_table( p_ctx, track_module, &track_module->state, MP4_SAMPLE_TABLE_STSS );
-   if(status != VC_CONTAINER_SUCCESS) goto seek_time_found;
-   for(i = 0, prev_sample = 0, next_sample = 0;
-       i < track_module->sample_table[MP4_SAMPLE_TABLE_STSS].entries; i++)
+   if(!track_module->index.sync) goto seek_time_found;
+   if(sample < track_module->index.samples && !mp4_index_is_sync(&track_module->index, sample))
    {
-      next_sample = _READ_U32(p_ctx) - 1;
-      if(next_sample > sample)
-      {
-         sample = (flags & VC_CONTAINER_SEEK_FLAG_FORWARD) ? next_sample : prev_sample;
-         break;
-      }
-      prev_sample = next_sample;
+      next_sample = mp4_index_find_sync(&track_module->index, sample, true);
+      prev_sample = mp4_index_find_sync(&track_module->index, sample, false);
+      if(prev_sample == track_module->index.samples) prev_sample = 0;
+      sample = (flags & VC_CONTAINER_SEEK_FLAG_FORWARD) &&
+         next_sample < track_module->index.samples ? next_sample : prev_sample;
    }
 
    /* Do the seek on this track and use its timestamp as the new seek point */
@@ -47,9 +47,38 @@ Defines.
 
 #define MP4_64BITS_TIME 0 /* 0 to disable / 1 to enable */
 
+#define MP4_AVC_PARAM_SET_MAX 256 /* Maximum size of a SPS / PPS we keep */
+#define MP4_AVC_NAL_SPS 7
+#define MP4_AVC_NAL_PPS 8
+#define MP4_AVC_NAL_IDR 5
+
+#define MP4_TRUN_FLAGS 0x000701 /* data_offset, sample_duration, sample_size, sample_flags */
+#define MP4_SAMPLE_FLAGS_SYNC 0x02000000 /* sample_depends_on = 2 */
+#define MP4_SAMPLE_FLAGS_NON_SYNC 0x01010000 /* sample_depends_on = 1, sample_is_non_sync_sample */
+
+#define MP4_SAMPLE_TABLES_MEMORY_MAX (1024*1024) /* Sample tables kept in memory before spilling to disk */
+
 /******************************************************************************
 Type definitions.
 ******************************************************************************/
+/** Sample buffered in the current fragment */
+typedef struct MP4_FRAGMENT_SAMPLE_T
+{
+   uint32_t size;
+   uint32_t flags;
+   int64_t dts;
+   uint32_t duration;
+
+} MP4_FRAGMENT_SAMPLE_T;
+
+/** Part of a sample table which was moved out to the temporary file */
+typedef struct MP4_TABLE_SPILL_T
+{
+   int64_t offset;
+   unsigned int size;
+
+} MP4_TABLE_SPILL_T;
+
 typedef struct VC_CONTAINER_TRACK_MODULE_T
 {
    uint32_t fourcc;
@@ -59,16 +88,57 @@ typedef struct VC_CONTAINER_TRACK_MODULE_T
    int64_t offset;
    int64_t timestamp;
    int64_t delta_timestamp;
+   uint32_t samples_in_delta;
+   uint32_t sample_size;
    int64_t samples_in_chunk;
    int64_t samples_in_prev_chunk;
+   uint32_t first_chunk;
+
+   /* Entries of the sample tables, already in the format written to the file.
+    * Runs of samples with the same duration and chunks with the same number of
+    * samples are merged as they come, and the sample sizes are only stored once
+    * they stop being constant. */
    struct {
       uint32_t entries;
       uint32_t entry_size;
+      uint8_t *data;
+      unsigned int size;
+      unsigned int alloc;
+      MP4_TABLE_SPILL_T *spills;
+      unsigned int spills_num;
+      unsigned int spills_alloc;
    } sample_table[MP4_SAMPLE_TABLE_NUM];
 
    int64_t first_pts;
    int64_t last_pts;
 
+   /* H.264 byte stream input, converted to length prefixed NAL units */
+   bool annexb;
+   uint8_t sps[MP4_AVC_PARAM_SET_MAX];
+   unsigned int sps_size;
+   uint8_t pps[MP4_AVC_PARAM_SET_MAX];
+   unsigned int pps_size;
+
+   /* Frame being assembled when whole frames are needed before writing */
+   uint8_t *frame;
+   unsigned int frame_size;
+   unsigned int frame_alloc;
+   int64_t frame_pts;
+   uint32_t frame_flags;
+
+   /* Samples of the current fragment */
+   struct {
+      uint8_t *data;
+      unsigned int size;
+      unsigned int alloc;
+      MP4_FRAGMENT_SAMPLE_T *samples;
+      unsigned int samples_num;
+      unsigned int samples_alloc;
+      int64_t next_dts;
+      uint32_t data_offset;
+   } fragment;
+   uint32_t last_duration;
+
 } VC_CONTAINER_TRACK_MODULE_T;
 
 typedef struct VC_CONTAINER_MODULE_T
@@ -89,13 +159,20 @@ typedef struct VC_CONTAINER_MODULE_T
 
    uint32_t samples;
    VC_CONTAINER_WRITER_EXTRAIO_T temp;
+   unsigned int tables_size;      /* size of the sample table entries held in memory */
    VC_CONTAINER_PACKET_T sample;
    int64_t sample_offset;
-   int64_t prev_sample_dts;
 
    int64_t duration;
    /**/
 
+   int64_t fragment_duration;     /* 0 when writing a single moov at close */
+   int64_t fragment_start;        /* dts of the first sample of the current fragment */
+   uint32_t fragment_sequence;
+   int64_t first_dts;
+   bool moov_written;
+   unsigned int video_tracks;
+
 } VC_CONTAINER_MODULE_T;
 
 /******************************************************************************
@@ -128,6 +205,16 @@ static VC_CONTAINER_STATUS_T mp4_write_box_stss( VC_CONTAINER_T *p_ctx );
 static VC_CONTAINER_STATUS_T mp4_write_box_vide( VC_CONTAINER_T *p_ctx );
 static VC_CONTAINER_STATUS_T mp4_write_box_soun( VC_CONTAINER_T *p_ctx );
 static VC_CONTAINER_STATUS_T mp4_write_box_esds( VC_CONTAINER_T *p_ctx );
+static VC_CONTAINER_STATUS_T mp4_write_box_mvex( VC_CONTAINER_T *p_ctx );
+static VC_CONTAINER_STATUS_T mp4_write_box_trex( VC_CONTAINER_T *p_ctx );
+static VC_CONTAINER_STATUS_T mp4_write_box_moof( VC_CONTAINER_T *p_ctx );
+static VC_CONTAINER_STATUS_T mp4_write_box_mfhd( VC_CONTAINER_T *p_ctx );
+static VC_CONTAINER_STATUS_T mp4_write_box_traf( VC_CONTAINER_T *p_ctx );
+static VC_CONTAINER_STATUS_T mp4_write_box_tfhd( VC_CONTAINER_T *p_ctx );
+static VC_CONTAINER_STATUS_T mp4_write_box_tfdt( VC_CONTAINER_T *p_ctx );
+static VC_CONTAINER_STATUS_T mp4_write_box_trun( VC_CONTAINER_T *p_ctx );
+static VC_CONTAINER_STATUS_T mp4_writer_add_sample( VC_CONTAINER_T *p_ctx, VC_CONTAINER_PACKET_T *packet );
+static VC_CONTAINER_STATUS_T mp4_writer_add_track_done( VC_CONTAINER_T *p_ctx );
 
 static struct {
   const MP4_BOX_TYPE_T type;
@@ -159,6 +246,14 @@ static struct {
    {MP4_BOX_TYPE_VIDE, mp4_write_box_vide},
    {MP4_BOX_TYPE_SOUN, mp4_write_box_soun},
    {MP4_BOX_TYPE_ESDS, mp4_write_box_esds},
+   {MP4_BOX_TYPE_MVEX, mp4_write_box_mvex},
+   {MP4_BOX_TYPE_TREX, mp4_write_box_trex},
+   {MP4_BOX_TYPE_MOOF, mp4_write_box_moof},
+   {MP4_BOX_TYPE_MFHD, mp4_write_box_mfhd},
+   {MP4_BOX_TYPE_TRAF, mp4_write_box_traf},
+   {MP4_BOX_TYPE_TFHD, mp4_write_box_tfhd},
+   {MP4_BOX_TYPE_TFDT, mp4_write_box_tfdt},
+   {MP4_BOX_TYPE_TRUN, mp4_write_box_trun},
    {MP4_BOX_TYPE_UNKNOWN, 0}
 };
 
@@ -252,6 +347,10 @@ static VC_CONTAINER_STATUS_T mp4_write_box_moov( VC_CONTAINER_T *p_ctx )
       if(status != VC_CONTAINER_SUCCESS) return status;
    }
 
+   /* Signal that the samples are to be found in movie fragments */
+   if(module->fragment_duration)
+      status = mp4_write_box(p_ctx, MP4_BOX_TYPE_MVEX);
+
    return status;
 }
 
@@ -259,15 +358,16 @@ static VC_CONTAINER_STATUS_T mp4_write_box_moov( VC_CONTAINER_T *p_ctx )
 static VC_CONTAINER_STATUS_T mp4_write_box_mvhd( VC_CONTAINER_T *p_ctx )
 {
    static uint32_t matrix[] = { 0x10000,0,0,0,0x10000,0,0,0,0x40000000 };
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
    unsigned int version = MP4_64BITS_TIME;
    unsigned int i;
 
    WRITE_U8(p_ctx,  version, "version");
    WRITE_U24(p_ctx, 0, "flags");
 
-   /**/
+   /* The duration of a fragmented file is given by its fragments */
    p_ctx->duration = 0;
-   for(i = 0; i < p_ctx->tracks_num; i++)
+   for(i = 0; !module->fragment_duration && i < p_ctx->tracks_num; i++)
    {
       VC_CONTAINER_TRACK_T *track = p_ctx->tracks[i];
       VC_CONTAINER_TRACK_MODULE_T *track_module = track->priv->module;
@@ -606,34 +706,39 @@ static VC_CONTAINER_STATUS_T mp4_write_box_stsd( VC_CONTAINER_T *p_ctx )
 }
 
 /*****************************************************************************/
-static VC_CONTAINER_STATUS_T mp4_writer_write_sample_to_temp( VC_CONTAINER_T *p_ctx,
-   VC_CONTAINER_PACKET_T *packet)
+static VC_CONTAINER_STATUS_T mp4_write_sample_table( VC_CONTAINER_T *p_ctx, MP4_SAMPLE_TABLE_T type )
 {
    VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
-   int32_t dts_diff = packet->dts - module->prev_sample_dts;
-   uint8_t keyframe = (packet->flags & VC_CONTAINER_PACKET_FLAG_KEYFRAME) ? 0x80 : 0;
-
-   vc_container_io_write_be_uint32(module->temp.io, packet->size);
-   vc_container_io_write_be_uint32(module->temp.io, dts_diff);
-   vc_container_io_write_be_uint24(module->temp.io, (uint32_t)(packet->pts - packet->dts));
-   vc_container_io_write_uint8(module->temp.io, packet->track | keyframe);
-   module->prev_sample_dts = packet->dts;
-   return module->temp.io->status;
-}
+   VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[module->current_track]->priv->module;
+   uint8_t buffer[1024];
+   unsigned int i, size;
 
-/*****************************************************************************/
-static VC_CONTAINER_STATUS_T mp4_writer_read_sample_from_temp( VC_CONTAINER_T *p_ctx,
-   VC_CONTAINER_PACKET_T *packet)
-{
-   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+   if(module->null.refcount || module->fragment_duration)
+   {
+      /* We're not actually writing the data, we just want the size (or the
+       * samples are described by the movie fragments and the table is empty) */
+      WRITE_BYTES(p_ctx, 0, track_module->sample_table[type].entries *
+         track_module->sample_table[type].entry_size);
+      return STREAM_STATUS(p_ctx);
+   }
+
+   /* Copy back what was spilled to the temporary file, then what we still have in memory */
+   for(i = 0; i < track_module->sample_table[type].spills_num; i++)
+   {
+      MP4_TABLE_SPILL_T *spill = &track_module->sample_table[type].spills[i];
+
+      vc_container_io_seek(module->temp.io, spill->offset);
+      for(size = 0; size < spill->size; size += sizeof(buffer))
+      {
+         unsigned int bytes = MIN(spill->size - size, sizeof(buffer));
+         if(vc_container_io_read(module->temp.io, buffer, bytes) != bytes)
+            return module->temp.io->status ? module->temp.io->status : VC_CONTAINER_ERROR_CORRUPTED;
+         WRITE_BYTES(p_ctx, buffer, bytes);
+      }
+   }
+   WRITE_BYTES(p_ctx, track_module->sample_table[type].data, track_module->sample_table[type].size);
 
-   packet->size = vc_container_io_read_be_uint32(module->temp.io);
-   packet->dts += (int32_t)vc_container_io_read_be_uint32(module->temp.io);
-   packet->pts = packet->dts + vc_container_io_read_be_uint24(module->temp.io);
-   packet->track = vc_container_io_read_uint8(module->temp.io);
-   packet->flags = (packet->track & 0x80) ? VC_CONTAINER_PACKET_FLAG_KEYFRAME : 0;
-   packet->track &= 0x7F;
-   return module->temp.io->status;
+   return STREAM_STATUS(p_ctx);
 }
 
 /*****************************************************************************/
@@ -641,45 +746,13 @@ static VC_CONTAINER_STATUS_T mp4_write_box_stts( VC_CONTAINER_T *p_ctx )
 {
    VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
    VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[module->current_track]->priv->module;
-   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
-   VC_CONTAINER_PACKET_T sample;
-   unsigned int entries = 0;
-   int64_t last_dts = 0, delta;
 
    WRITE_U8(p_ctx,  0, "version");
    WRITE_U24(p_ctx, 0, "flags");
 
    WRITE_U32(p_ctx, track_module->sample_table[MP4_SAMPLE_TABLE_STTS].entries, "entry_count");
 
-   if(module->null.refcount)
-   {
-      /* We're not actually writing the data, we just want the size */
-      WRITE_BYTES(p_ctx, 0, track_module->sample_table[MP4_SAMPLE_TABLE_STTS].entries * 8);
-      return STREAM_STATUS(p_ctx);
-   }
-
-   /* Go through all the samples written */
-   vc_container_io_seek(module->temp.io, INT64_C(0));
-   sample.dts = 0;
-
-   status = mp4_writer_read_sample_from_temp(p_ctx, &sample);
-   while(status == VC_CONTAINER_SUCCESS)
-   {
-      if(sample.track != module->current_track) goto skip;
-
-      delta = sample.dts * MP4_TIMESCALE / 1000000 - last_dts;
-      if(delta < 0) delta = 0;
-      WRITE_U32(p_ctx, 1, "sample_count");
-      WRITE_U32(p_ctx, delta, "sample_delta");
-      entries++;
-      last_dts += delta;
-
-     skip:
-      status = mp4_writer_read_sample_from_temp(p_ctx, &sample);
-   }
-   vc_container_assert(entries == track_module->sample_table[MP4_SAMPLE_TABLE_STTS].entries);
-
-   return STREAM_STATUS(p_ctx);
+   return mp4_write_sample_table(p_ctx, MP4_SAMPLE_TABLE_STTS);
 }
 
 /*****************************************************************************/
@@ -699,65 +772,12 @@ static VC_CONTAINER_STATUS_T mp4_write_box_stsc( VC_CONTAINER_T *p_ctx )
 {
    VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
    VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[module->current_track]->priv->module;
-   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
-   VC_CONTAINER_PACKET_T sample;
-   int64_t offset = 0, track_offset = -1;
-   unsigned int entries = 0, chunks = 0, first_chunk = 0, samples_in_chunk = 0;
-
-   memset(&sample, 0, sizeof(VC_CONTAINER_PACKET_T));
 
    WRITE_U8(p_ctx,  0, "version");
    WRITE_U24(p_ctx, 0, "flags");
    WRITE_U32(p_ctx, track_module->sample_table[MP4_SAMPLE_TABLE_STSC].entries, "entry_count");
 
-   if(module->null.refcount)
-   {
-      /* We're not actually writing the data, we just want the size */
-      WRITE_BYTES(p_ctx, 0, track_module->sample_table[MP4_SAMPLE_TABLE_STSC].entries * 12);
-      return STREAM_STATUS(p_ctx);
-   }
-
-   /* Go through all the samples written */
-   vc_container_io_seek(module->temp.io, INT64_C(0));
-
-   status = mp4_writer_read_sample_from_temp(p_ctx, &sample);
-   while(status == VC_CONTAINER_SUCCESS)
-   {
-      if(sample.track != module->current_track) goto skip;
-
-      /* Is it a new chunk ? */
-      if(track_offset != offset)
-      {
-         chunks++;
-         if(samples_in_chunk)
-         {
-            WRITE_U32(p_ctx,  first_chunk, "first_chunk");
-            WRITE_U32(p_ctx,  samples_in_chunk, "samples_per_chunk");
-            WRITE_U32(p_ctx,  1, "sample_description_index");
-            entries++;
-         }
-         first_chunk = chunks;
-         samples_in_chunk = 0;
-      }
-      track_offset = offset + sample.size;
-      samples_in_chunk++;
-
-     skip:
-      offset += sample.size;
-      status = mp4_writer_read_sample_from_temp(p_ctx, &sample);
-   }
-
-   if(samples_in_chunk)
-   {
-      WRITE_U32(p_ctx,  first_chunk, "first_chunk");
-      WRITE_U32(p_ctx,  samples_in_chunk, "samples_per_chunk");
-      WRITE_U32(p_ctx,  1, "sample_description_index");
-      entries++;
-   }
-
-   vc_container_assert(entries == track_module->sample_table[MP4_SAMPLE_TABLE_STSC].entries);
-
-   return STREAM_STATUS(p_ctx);
+   return mp4_write_sample_table(p_ctx, MP4_SAMPLE_TABLE_STSC);
 }
 
 /*****************************************************************************/
@@ -765,42 +785,16 @@ static VC_CONTAINER_STATUS_T mp4_write_box_stsz( VC_CONTAINER_T *p_ctx )
 {
    VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
    VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[module->current_track]->priv->module;
-   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
-   VC_CONTAINER_PACKET_T sample;
-   unsigned int entries = 0;
-
-   memset(&sample, 0, sizeof(VC_CONTAINER_PACKET_T));
+   bool constant = !track_module->sample_table[MP4_SAMPLE_TABLE_STSZ].entries;
 
    WRITE_U8(p_ctx,  0, "version");
    WRITE_U24(p_ctx, 0, "flags");
 
-   WRITE_U32(p_ctx, 0, "sample_size");
-   WRITE_U32(p_ctx, track_module->sample_table[MP4_SAMPLE_TABLE_STSZ].entries, "sample_count");
+   /* All the samples have the same size unless we had to store them */
+   WRITE_U32(p_ctx, constant ? track_module->sample_size : 0, "sample_size");
+   WRITE_U32(p_ctx, module->fragment_duration ? 0 : track_module->samples, "sample_count");
 
-   if(module->null.refcount)
-   {
-      /* We're not actually writing the data, we just want the size */
-      WRITE_BYTES(p_ctx, 0, track_module->sample_table[MP4_SAMPLE_TABLE_STSZ].entries * 4);
-      return STREAM_STATUS(p_ctx);
-   }
-
-   /* Go through all the samples written */
-   vc_container_io_seek(module->temp.io, INT64_C(0));
-
-   status = mp4_writer_read_sample_from_temp(p_ctx, &sample);
-   while(status == VC_CONTAINER_SUCCESS)
-   {
-      if(sample.track != module->current_track) goto skip;
-
-      WRITE_U32(p_ctx, sample.size, "entry_size");
-      entries++;
-
-     skip:
-      status = mp4_writer_read_sample_from_temp(p_ctx, &sample);
-   }
-   vc_container_assert(entries == track_module->sample_table[MP4_SAMPLE_TABLE_STSZ].entries);
-
-   return STREAM_STATUS(p_ctx);
+   return mp4_write_sample_table(p_ctx, MP4_SAMPLE_TABLE_STSZ);
 }
 
 /*****************************************************************************/
@@ -808,47 +802,12 @@ static VC_CONTAINER_STATUS_T mp4_write_box_stco( VC_CONTAINER_T *p_ctx )
 {
    VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
    VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[module->current_track]->priv->module;
-   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
-   VC_CONTAINER_PACKET_T sample;
-   int64_t offset = module->data_offset, track_offset = -1;
-   unsigned int entries = 0;
-
-   memset(&sample, 0, sizeof(VC_CONTAINER_PACKET_T));
 
    WRITE_U8(p_ctx,  0, "version");
    WRITE_U24(p_ctx, 0, "flags");
    WRITE_U32(p_ctx, track_module->sample_table[MP4_SAMPLE_TABLE_STCO].entries, "entry_count");
 
-   if(module->null.refcount)
-   {
-      /* We're not actually writing the data, we just want the size */
-      WRITE_BYTES(p_ctx, 0, track_module->sample_table[MP4_SAMPLE_TABLE_STCO].entries * 4);
-      return STREAM_STATUS(p_ctx);
-   }
-
-   /* Go through all the samples written */
-   vc_container_io_seek(module->temp.io, INT64_C(0));
-
-   status = mp4_writer_read_sample_from_temp(p_ctx, &sample);
-   while(status == VC_CONTAINER_SUCCESS)
-   {
-      if(sample.track != module->current_track) goto skip;
-
-      /* Is it a new chunk ? */
-      if(track_offset != offset)
-      {
-         WRITE_U32(p_ctx, offset, "chunk_offset");
-         entries++;
-      }
-      track_offset = offset + sample.size;
-
-     skip:
-      offset += sample.size;
-      status = mp4_writer_read_sample_from_temp(p_ctx, &sample);
-   }
-   vc_container_assert(entries == track_module->sample_table[MP4_SAMPLE_TABLE_STCO].entries);
-
-   return STREAM_STATUS(p_ctx);
+   return mp4_write_sample_table(p_ctx, MP4_SAMPLE_TABLE_STCO);
 }
 
 /*****************************************************************************/
@@ -861,9 +820,10 @@ static VC_CONTAINER_STATUS_T mp4_write_box_co64( VC_CONTAINER_T *p_ctx )
    WRITE_U24(p_ctx, 0, "flags");
    WRITE_U32(p_ctx, track_module->sample_table[MP4_SAMPLE_TABLE_CO64].entries, "entry_count");
 
-   if(module->null.refcount)
+   if(module->null.refcount || module->fragment_duration)
    {
-      /* We're not actually writing the data, we just want the size */
+      /* We're not actually writing the data, we just want the size (or the
+       * samples are described by the movie fragments and the table is empty) */
       WRITE_BYTES(p_ctx, 0, track_module->sample_table[MP4_SAMPLE_TABLE_CO64].entries * 8);
       return STREAM_STATUS(p_ctx);
    }
@@ -876,44 +836,12 @@ static VC_CONTAINER_STATUS_T mp4_write_box_stss( VC_CONTAINER_T *p_ctx )
 {
    VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
    VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[module->current_track]->priv->module;
-   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
-   VC_CONTAINER_PACKET_T sample;
-   unsigned int entries = 0, samples = 0;
-
-   memset(&sample, 0, sizeof(VC_CONTAINER_PACKET_T));
 
    WRITE_U8(p_ctx,  0, "version");
    WRITE_U24(p_ctx, 0, "flags");
    WRITE_U32(p_ctx, track_module->sample_table[MP4_SAMPLE_TABLE_STSS].entries, "entry_count");
 
-   if(module->null.refcount)
-   {
-      /* We're not actually writing the data, we just want the size */
-      WRITE_BYTES(p_ctx, 0, track_module->sample_table[MP4_SAMPLE_TABLE_STSS].entries * 4);
-      return STREAM_STATUS(p_ctx);
-   }
-
-   /* Go through all the samples written */
-   vc_container_io_seek(module->temp.io, INT64_C(0));
-
-   status = mp4_writer_read_sample_from_temp(p_ctx, &sample);
-   while(status == VC_CONTAINER_SUCCESS)
-   {
-      if(sample.track != module->current_track) goto skip;
-
-      samples++;
-      if(sample.flags & VC_CONTAINER_PACKET_FLAG_KEYFRAME)
-      {
-         WRITE_U32(p_ctx, samples, "sample_number");
-         entries++;
-      }
-
-     skip:
-      status = mp4_writer_read_sample_from_temp(p_ctx, &sample);
-   }
-   vc_container_assert(entries == track_module->sample_table[MP4_SAMPLE_TABLE_STSS].entries);
-
-   return STREAM_STATUS(p_ctx);
+   return mp4_write_sample_table(p_ctx, MP4_SAMPLE_TABLE_STSS);
 }
 
 /*****************************************************************************/
@@ -1138,6 +1066,598 @@ static VC_CONTAINER_STATUS_T mp4_write_box_esds( VC_CONTAINER_T *p_ctx )
    return STREAM_STATUS(p_ctx);
 }
 
+/*****************************************************************************/
+static int64_t mp4_writer_media_time( VC_CONTAINER_T *p_ctx, int64_t dts )
+{
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+   return (dts - module->first_dts) * MP4_TIMESCALE / 1000000;
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_write_box_mvex( VC_CONTAINER_T *p_ctx )
+{
+   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+   unsigned int i;
+
+   for(i = 0; i < p_ctx->tracks_num; i++)
+   {
+      module->current_track = i;
+      status = mp4_write_box(p_ctx, MP4_BOX_TYPE_TREX);
+      if(status != VC_CONTAINER_SUCCESS) return status;
+   }
+
+   return status;
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_write_box_trex( VC_CONTAINER_T *p_ctx )
+{
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+
+   WRITE_U8(p_ctx,  0, "version");
+   WRITE_U24(p_ctx, 0, "flags");
+
+   WRITE_U32(p_ctx, module->current_track + 1, "track_ID");
+   WRITE_U32(p_ctx, 1, "default_sample_description_index");
+   WRITE_U32(p_ctx, 0, "default_sample_duration");
+   WRITE_U32(p_ctx, 0, "default_sample_size");
+   WRITE_U32(p_ctx, 0, "default_sample_flags");
+
+   return STREAM_STATUS(p_ctx);
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_write_box_moof( VC_CONTAINER_T *p_ctx )
+{
+   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+   unsigned int i;
+
+   status = mp4_write_box(p_ctx, MP4_BOX_TYPE_MFHD);
+   if(status != VC_CONTAINER_SUCCESS) return status;
+
+   for(i = 0; i < p_ctx->tracks_num; i++)
+   {
+      if(!p_ctx->tracks[i]->priv->module->fragment.samples_num) continue;
+      module->current_track = i;
+      status = mp4_write_box(p_ctx, MP4_BOX_TYPE_TRAF);
+      if(status != VC_CONTAINER_SUCCESS) return status;
+   }
+
+   return status;
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_write_box_mfhd( VC_CONTAINER_T *p_ctx )
+{
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+
+   WRITE_U8(p_ctx,  0, "version");
+   WRITE_U24(p_ctx, 0, "flags");
+
+   WRITE_U32(p_ctx, module->fragment_sequence, "sequence_number");
+
+   return STREAM_STATUS(p_ctx);
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_write_box_traf( VC_CONTAINER_T *p_ctx )
+{
+   VC_CONTAINER_STATUS_T status;
+
+   status = mp4_write_box(p_ctx, MP4_BOX_TYPE_TFHD);
+   if(status != VC_CONTAINER_SUCCESS) return status;
+
+   status = mp4_write_box(p_ctx, MP4_BOX_TYPE_TFDT);
+   if(status != VC_CONTAINER_SUCCESS) return status;
+
+   status = mp4_write_box(p_ctx, MP4_BOX_TYPE_TRUN);
+   if(status != VC_CONTAINER_SUCCESS) return status;
+
+   return status;
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_write_box_tfhd( VC_CONTAINER_T *p_ctx )
+{
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+
+   WRITE_U8(p_ctx,  0, "version");
+   WRITE_U24(p_ctx, 0x020000, "flags"); /* default-base-is-moof */
+
+   WRITE_U32(p_ctx, module->current_track + 1, "track_ID");
+
+   return STREAM_STATUS(p_ctx);
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_write_box_tfdt( VC_CONTAINER_T *p_ctx )
+{
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+   VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[module->current_track]->priv->module;
+
+   WRITE_U8(p_ctx,  1, "version");
+   WRITE_U24(p_ctx, 0, "flags");
+
+   WRITE_U64(p_ctx, mp4_writer_media_time(p_ctx, track_module->fragment.samples[0].dts),
+      "base_media_decode_time");
+
+   return STREAM_STATUS(p_ctx);
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_write_box_trun( VC_CONTAINER_T *p_ctx )
+{
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+   VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[module->current_track]->priv->module;
+   unsigned int i;
+
+   WRITE_U8(p_ctx,  0, "version");
+   WRITE_U24(p_ctx, MP4_TRUN_FLAGS, "flags");
+
+   WRITE_U32(p_ctx, track_module->fragment.samples_num, "sample_count");
+   WRITE_U32(p_ctx, track_module->fragment.data_offset, "data_offset");
+
+   if(module->null.refcount)
+   {
+      /* We're not actually writing the data, we just want the size */
+      WRITE_BYTES(p_ctx, 0, track_module->fragment.samples_num * 12);
+      return STREAM_STATUS(p_ctx);
+   }
+
+   for(i = 0; i < track_module->fragment.samples_num; i++)
+   {
+      MP4_FRAGMENT_SAMPLE_T *sample = &track_module->fragment.samples[i];
+      WRITE_U32(p_ctx, sample->duration, "sample_duration");
+      WRITE_U32(p_ctx, sample->size, "sample_size");
+      WRITE_U32(p_ctx, (sample->flags & VC_CONTAINER_PACKET_FLAG_KEYFRAME) ?
+         MP4_SAMPLE_FLAGS_SYNC : MP4_SAMPLE_FLAGS_NON_SYNC, "sample_flags");
+   }
+
+   return STREAM_STATUS(p_ctx);
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_writer_grow( void **data, unsigned int *alloc,
+   unsigned int needed, unsigned int unit )
+{
+   unsigned int size = *alloc ? *alloc : 64;
+   void *new_data;
+
+   if(needed <= *alloc) return VC_CONTAINER_SUCCESS;
+   while(size < needed) size *= 2;
+
+   new_data = realloc(*data, (size_t)size * unit);
+   if(!new_data) return VC_CONTAINER_ERROR_OUT_OF_MEMORY;
+   *data = new_data;
+   *alloc = size;
+   return VC_CONTAINER_SUCCESS;
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_writer_write_fragment( VC_CONTAINER_T *p_ctx )
+{
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
+   uint32_t data_offset = 8, mdat_size = 8;
+   unsigned int i, j, samples = 0;
+
+   for(i = 0; i < p_ctx->tracks_num; i++)
+      samples += p_ctx->tracks[i]->priv->module->fragment.samples_num;
+   if(!samples) return VC_CONTAINER_SUCCESS;
+
+   /* The header goes out with the first fragment, once the codec config is known */
+   if(!module->moov_written)
+   {
+      status = mp4_write_box(p_ctx, MP4_BOX_TYPE_MOOV);
+      if(status != VC_CONTAINER_SUCCESS) return status;
+      module->moov_written = true;
+   }
+
+   /* Work out the durations of the samples. The last one of a track lasts until
+    * the sample which started the next fragment, if we know it. */
+   for(i = 0; i < p_ctx->tracks_num; i++)
+   {
+      VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[i]->priv->module;
+      MP4_FRAGMENT_SAMPLE_T *sample = track_module->fragment.samples;
+
+      for(j = 0; j < track_module->fragment.samples_num; j++)
+      {
+         int64_t delta;
+
+         if(j + 1 < track_module->fragment.samples_num)
+            delta = mp4_writer_media_time(p_ctx, sample[j+1].dts);
+         else if(track_module->fragment.next_dts != VC_CONTAINER_TIME_UNKNOWN)
+            delta = mp4_writer_media_time(p_ctx, track_module->fragment.next_dts);
+         else
+            delta = mp4_writer_media_time(p_ctx, sample[j].dts) + track_module->last_duration;
+         delta -= mp4_writer_media_time(p_ctx, sample[j].dts);
+         if(delta < 0) delta = 0;
+
+         sample[j].duration = (uint32_t)delta;
+         track_module->last_duration = sample[j].duration;
+      }
+      mdat_size += track_module->fragment.size;
+   }
+
+   /* We need the size of the moof to point the track runs into the mdat */
+   if(!vc_container_writer_extraio_enable(p_ctx, &module->null))
+   {
+      status = mp4_write_box(p_ctx, MP4_BOX_TYPE_MOOF);
+      data_offset = STREAM_POSITION(p_ctx) + 8;
+   }
+   vc_container_writer_extraio_disable(p_ctx, &module->null);
+   if(status != VC_CONTAINER_SUCCESS) return status;
+
+   for(i = 0; i < p_ctx->tracks_num; i++)
+   {
+      VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[i]->priv->module;
+      track_module->fragment.data_offset = data_offset;
+      data_offset += track_module->fragment.size;
+   }
+
+   status = mp4_write_box(p_ctx, MP4_BOX_TYPE_MOOF);
+   if(status != VC_CONTAINER_SUCCESS) return status;
+
+   _WRITE_U32(p_ctx, mdat_size);
+   _WRITE_FOURCC(p_ctx, VC_FOURCC('m','d','a','t'));
+   for(i = 0; i < p_ctx->tracks_num; i++)
+   {
+      VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[i]->priv->module;
+      WRITE_BYTES(p_ctx, track_module->fragment.data, track_module->fragment.size);
+      track_module->fragment.size = 0;
+      track_module->fragment.samples_num = 0;
+      track_module->fragment.next_dts = VC_CONTAINER_TIME_UNKNOWN;
+   }
+   module->fragment_sequence++;
+
+   /* Make the fragment playable straight away */
+   vc_container_io_control(p_ctx->priv->io, VC_CONTAINER_CONTROL_IO_FLUSH);
+
+   return STREAM_STATUS(p_ctx);
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_writer_fragment_add_sample( VC_CONTAINER_T *p_ctx,
+   VC_CONTAINER_PACKET_T *sample )
+{
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+   VC_CONTAINER_TRACK_T *track = p_ctx->tracks[sample->track];
+   VC_CONTAINER_TRACK_MODULE_T *track_module = track->priv->module;
+   VC_CONTAINER_STATUS_T status;
+   MP4_FRAGMENT_SAMPLE_T *entry;
+
+   /* Start a new fragment on a keyframe once the current one is long enough.
+    * If there is video, only video decides where fragments start. */
+   if(module->fragment_start == VC_CONTAINER_TIME_UNKNOWN)
+      module->fragment_start = sample->dts;
+   else if(sample->dts - module->fragment_start >= module->fragment_duration &&
+           (track->format->es_type == VC_CONTAINER_ES_TYPE_VIDEO ?
+              (sample->flags & VC_CONTAINER_PACKET_FLAG_KEYFRAME) : !module->video_tracks))
+   {
+      track_module->fragment.next_dts = sample->dts;
+      status = mp4_writer_write_fragment(p_ctx);
+      if(status != VC_CONTAINER_SUCCESS) return status;
+      module->fragment_start = sample->dts;
+   }
+
+   status = mp4_writer_grow((void **)&track_module->fragment.samples,
+      &track_module->fragment.samples_alloc, track_module->fragment.samples_num + 1,
+      sizeof(*track_module->fragment.samples));
+   if(status != VC_CONTAINER_SUCCESS) return status;
+
+   entry = &track_module->fragment.samples[track_module->fragment.samples_num++];
+   entry->size = sample->size;
+   entry->flags = sample->flags;
+   entry->dts = sample->dts;
+   entry->duration = 0;
+   return VC_CONTAINER_SUCCESS;
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_writer_write_sample_data( VC_CONTAINER_T *p_ctx,
+   VC_CONTAINER_TRACK_MODULE_T *track_module, const uint8_t *data, unsigned int size )
+{
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+   VC_CONTAINER_STATUS_T status;
+
+   if(!module->fragment_duration)
+   {
+      if(WRITE_BYTES(p_ctx, data, size) != size)
+         return STREAM_STATUS(p_ctx);
+      p_ctx->size += size;
+      return VC_CONTAINER_SUCCESS;
+   }
+
+   status = mp4_writer_grow((void **)&track_module->fragment.data, &track_module->fragment.alloc,
+      track_module->fragment.size + size, 1);
+   if(status != VC_CONTAINER_SUCCESS) return status;
+   memcpy(track_module->fragment.data + track_module->fragment.size, data, size);
+   track_module->fragment.size += size;
+   return VC_CONTAINER_SUCCESS;
+}
+
+/*****************************************************************************/
+static const uint8_t *mp4_writer_avc_next_nal( const uint8_t *data, const uint8_t *end,
+   unsigned int *nal_size )
+{
+   const uint8_t *nal, *p;
+
+   /* Find the start code */
+   for(p = data; p + 3 <= end; p++)
+      if(!p[0] && !p[1] && p[2] == 1) break;
+   if(p + 3 > end) return 0;
+   nal = p + 3;
+
+   /* The NAL unit runs until the next start code */
+   for(p = nal; p + 3 <= end; p++)
+      if(!p[0] && !p[1] && p[2] <= 1) break;
+   if(p + 3 > end) p = end;
+
+   /* Drop trailing zero bytes, they belong to the next start code */
+   while(p > nal && !p[-1]) p--;
+   *nal_size = p - nal;
+   return nal;
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_writer_avc_set_extradata( VC_CONTAINER_T *p_ctx,
+   VC_CONTAINER_TRACK_T *track )
+{
+   VC_CONTAINER_TRACK_MODULE_T *track_module = track->priv->module;
+   VC_CONTAINER_STATUS_T status;
+   unsigned int size = 11 + track_module->sps_size + track_module->pps_size;
+   uint8_t *avcc;
+
+   status = vc_container_track_allocate_extradata(p_ctx, track, size);
+   if(status != VC_CONTAINER_SUCCESS) return status;
+
+   avcc = track->format->extradata;
+   avcc[0] = 1; /* configurationVersion */
+   avcc[1] = track_module->sps[1]; /* AVCProfileIndication */
+   avcc[2] = track_module->sps[2]; /* profile_compatibility */
+   avcc[3] = track_module->sps[3]; /* AVCLevelIndication */
+   avcc[4] = 0xFF; /* 4 bytes NAL unit length */
+   avcc[5] = 0xE1; /* 1 SPS */
+   avcc[6] = track_module->sps_size >> 8;
+   avcc[7] = track_module->sps_size;
+   memcpy(avcc + 8, track_module->sps, track_module->sps_size);
+   avcc += 8 + track_module->sps_size;
+   avcc[0] = 1; /* 1 PPS */
+   avcc[1] = track_module->pps_size >> 8;
+   avcc[2] = track_module->pps_size;
+   memcpy(avcc + 3, track_module->pps, track_module->pps_size);
+   track->format->extradata_size = size;
+
+   return VC_CONTAINER_SUCCESS;
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_writer_write_frame( VC_CONTAINER_T *p_ctx, unsigned int track_num )
+{
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+   VC_CONTAINER_TRACK_T *track = p_ctx->tracks[track_num];
+   VC_CONTAINER_TRACK_MODULE_T *track_module = track->priv->module;
+   const uint8_t *end = track_module->frame + track_module->frame_size;
+   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
+   VC_CONTAINER_PACKET_T *sample = &module->sample;
+   const uint8_t *nal;
+   unsigned int nal_size;
+
+   memset(sample, 0, sizeof(*sample));
+   sample->track = track_num;
+   sample->pts = sample->dts = track_module->frame_pts;
+   sample->flags = track_module->frame_flags;
+   sample->size = track_module->frame_size;
+
+   /* Parameter sets go in the avcC, everything else gets a length prefix */
+   if(track_module->annexb)
+   {
+      bool new_params = false;
+
+      sample->size = 0;
+      for(nal = track_module->frame; (nal = mp4_writer_avc_next_nal(nal, end, &nal_size)) != 0; nal += nal_size)
+      {
+         unsigned int type = nal_size ? nal[0] & 0x1F : 0;
+
+         if((type == MP4_AVC_NAL_SPS || type == MP4_AVC_NAL_PPS) &&
+            nal_size <= MP4_AVC_PARAM_SET_MAX && !track->format->extradata_size)
+         {
+            if(type == MP4_AVC_NAL_SPS && nal_size >= 4)
+            { memcpy(track_module->sps, nal, nal_size); track_module->sps_size = nal_size; }
+            else if(type == MP4_AVC_NAL_PPS)
+            { memcpy(track_module->pps, nal, nal_size); track_module->pps_size = nal_size; }
+            new_params = true;
+         }
+         else if(type == MP4_AVC_NAL_SPS || type == MP4_AVC_NAL_PPS || !nal_size)
+            continue;
+         else
+         {
+            if(type == MP4_AVC_NAL_IDR) sample->flags |= VC_CONTAINER_PACKET_FLAG_KEYFRAME;
+            sample->size += 4 + nal_size;
+         }
+      }
+
+      if(new_params && track_module->sps_size && track_module->pps_size)
+         status = mp4_writer_avc_set_extradata(p_ctx, track);
+      if(status != VC_CONTAINER_SUCCESS) goto end;
+   }
+
+   /* Nothing left to write for this frame (e.g. codec config only) */
+   if(!sample->size) goto end;
+
+   if(track_module->frame_pts == VC_CONTAINER_TIME_UNKNOWN)
+      sample->pts = sample->dts = track_module->last_pts;
+   if(module->first_dts == VC_CONTAINER_TIME_UNKNOWN)
+      module->first_dts = sample->dts;
+
+   if(module->fragment_duration)
+      status = mp4_writer_fragment_add_sample(p_ctx, sample);
+   else
+      module->sample_offset = STREAM_POSITION(p_ctx);
+   if(status != VC_CONTAINER_SUCCESS) goto end;
+
+   if(track_module->annexb)
+   {
+      for(nal = track_module->frame; (nal = mp4_writer_avc_next_nal(nal, end, &nal_size)) != 0; nal += nal_size)
+      {
+         unsigned int type = nal_size ? nal[0] & 0x1F : 0;
+         uint8_t length[4];
+
+         if(type == MP4_AVC_NAL_SPS || type == MP4_AVC_NAL_PPS || !nal_size) continue;
+
+         length[0] = nal_size >> 24; length[1] = nal_size >> 16;
+         length[2] = nal_size >> 8; length[3] = nal_size;
+         status = mp4_writer_write_sample_data(p_ctx, track_module, length, 4);
+         if(status != VC_CONTAINER_SUCCESS) goto end;
+         status = mp4_writer_write_sample_data(p_ctx, track_module, nal, nal_size);
+         if(status != VC_CONTAINER_SUCCESS) goto end;
+      }
+   }
+   else
+   {
+      status = mp4_writer_write_sample_data(p_ctx, track_module, track_module->frame, track_module->frame_size);
+      if(status != VC_CONTAINER_SUCCESS) goto end;
+   }
+
+   if(module->fragment_duration)
+   {
+      track_module->last_pts = sample->pts;
+      if(!track_module->samples++) track_module->first_pts = sample->pts;
+   }
+   else
+      status = mp4_writer_add_sample(p_ctx, sample);
+
+ end:
+   track_module->frame_size = 0;
+   return status;
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_writer_spill_tables( VC_CONTAINER_T *p_ctx )
+{
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
+   unsigned int i, j;
+
+   /* The temporary file is only created once the tables outgrow our memory budget */
+   if(!module->temp.io)
+   {
+      status = vc_container_writer_extraio_create_temp(p_ctx, &module->temp);
+      if(status != VC_CONTAINER_SUCCESS) return status;
+   }
+
+   for(i = 0; i < p_ctx->tracks_num; i++)
+   {
+      VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[i]->priv->module;
+
+      for(j = 0; j < MP4_SAMPLE_TABLE_NUM; j++)
+      {
+         MP4_TABLE_SPILL_T *spill;
+         if(!track_module->sample_table[j].size) continue;
+
+         status = mp4_writer_grow((void **)&track_module->sample_table[j].spills,
+            &track_module->sample_table[j].spills_alloc, track_module->sample_table[j].spills_num + 1,
+            sizeof(*track_module->sample_table[j].spills));
+         if(status != VC_CONTAINER_SUCCESS) return status;
+
+         spill = &track_module->sample_table[j].spills[track_module->sample_table[j].spills_num++];
+         spill->offset = module->temp.io->offset;
+         spill->size = track_module->sample_table[j].size;
+         if(vc_container_io_write(module->temp.io, track_module->sample_table[j].data, spill->size) != spill->size)
+            return module->temp.io->status ? module->temp.io->status : VC_CONTAINER_ERROR_OUT_OF_RESOURCES;
+         track_module->sample_table[j].size = 0;
+      }
+   }
+
+   module->tables_size = 0;
+   return status;
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_writer_table_add( VC_CONTAINER_T *p_ctx,
+   VC_CONTAINER_TRACK_MODULE_T *track_module, MP4_SAMPLE_TABLE_T type,
+   uint32_t value1, uint32_t value2, uint32_t value3 )
+{
+   VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
+   uint32_t values[3] = {value1, value2, value3};
+   VC_CONTAINER_STATUS_T status;
+   unsigned int i, entry_size = track_module->sample_table[type].entry_size;
+   uint8_t *entry;
+
+   status = mp4_writer_grow((void **)&track_module->sample_table[type].data,
+      &track_module->sample_table[type].alloc, track_module->sample_table[type].size + entry_size, 1);
+   if(status != VC_CONTAINER_SUCCESS) return status;
+
+   entry = track_module->sample_table[type].data + track_module->sample_table[type].size;
+   for(i = 0; i < entry_size / 4; i++, entry += 4)
+   {
+      entry[0] = values[i] >> 24; entry[1] = values[i] >> 16;
+      entry[2] = values[i] >> 8; entry[3] = values[i];
+   }
+   track_module->sample_table[type].size += entry_size;
+
+   module->tables_size += entry_size;
+   if(module->tables_size > MP4_SAMPLE_TABLES_MEMORY_MAX)
+      status = mp4_writer_spill_tables(p_ctx);
+   return status;
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_writer_table_close_chunk( VC_CONTAINER_T *p_ctx,
+   VC_CONTAINER_TRACK_MODULE_T *track_module )
+{
+   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
+
+   if(!track_module->samples_in_chunk) return status;
+
+   /* A chunk with the same number of samples as the previous one doesn't need an entry */
+   if(track_module->samples_in_chunk == track_module->samples_in_prev_chunk)
+   {
+      track_module->sample_table[MP4_SAMPLE_TABLE_STSC].entries--;
+      p_ctx->size -= track_module->sample_table[MP4_SAMPLE_TABLE_STSC].entry_size;
+   }
+   else
+   {
+      if(track_module->samples_in_prev_chunk)
+         status = mp4_writer_table_add(p_ctx, track_module, MP4_SAMPLE_TABLE_STSC,
+            track_module->first_chunk, track_module->samples_in_prev_chunk, 1);
+      track_module->first_chunk = track_module->chunks;
+      track_module->samples_in_prev_chunk = track_module->samples_in_chunk;
+   }
+
+   track_module->samples_in_chunk = 0;
+   return status;
+}
+
+/*****************************************************************************/
+static VC_CONTAINER_STATUS_T mp4_writer_tables_done( VC_CONTAINER_T *p_ctx )
+{
+   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
+   unsigned int i;
+
+   /* Store the runs which were still open */
+   for(i = 0; i < p_ctx->tracks_num && status == VC_CONTAINER_SUCCESS; i++)
+   {
+      VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[i]->priv->module;
+
+      if(track_module->samples_in_delta)
+         status = mp4_writer_table_add(p_ctx, track_module, MP4_SAMPLE_TABLE_STTS,
+            track_module->samples_in_delta, track_module->delta_timestamp, 0);
+      track_module->samples_in_delta = 0;
+      if(status != VC_CONTAINER_SUCCESS) break;
+
+      status = mp4_writer_table_close_chunk(p_ctx, track_module);
+      if(status == VC_CONTAINER_SUCCESS && track_module->samples_in_prev_chunk)
+         status = mp4_writer_table_add(p_ctx, track_module, MP4_SAMPLE_TABLE_STSC,
+            track_module->first_chunk, track_module->samples_in_prev_chunk, 1);
+      track_module->samples_in_prev_chunk = 0;
+   }
+
+   return status;
+}
+
 /*****************************************************************************/
 static VC_CONTAINER_STATUS_T mp4_writer_close( VC_CONTAINER_T *p_ctx )
 {
@@ -1145,19 +1665,46 @@ static VC_CONTAINER_STATUS_T mp4_writer_close( VC_CONTAINER_T *p_ctx )
    VC_CONTAINER_STATUS_T status;
    int64_t mdat_size;
 
-   mdat_size = STREAM_POSITION(p_ctx) - module->mdat_offset;
+   status = mp4_writer_add_track_done(p_ctx);
 
-   /* Write the moov box */
-   status = mp4_write_box(p_ctx, MP4_BOX_TYPE_MOOV);
+   if(status == VC_CONTAINER_SUCCESS && module->fragment_duration)
+   {
+      /* Write out the last fragment, making sure we have a header even if
+       * no samples were written */
+      status = mp4_writer_write_fragment(p_ctx);
+      if(status == VC_CONTAINER_SUCCESS && !module->moov_written)
+         status = mp4_write_box(p_ctx, MP4_BOX_TYPE_MOOV);
+   }
+   else if(status == VC_CONTAINER_SUCCESS)
+   {
+      mdat_size = STREAM_POSITION(p_ctx) - module->mdat_offset;
 
-   /* Finalise the mdat box */
-   SEEK(p_ctx, module->mdat_offset);
-   WRITE_U32(p_ctx, (uint32_t)mdat_size, "mdat size" );
+      /* Write the moov box */
+      status = mp4_writer_tables_done(p_ctx);
+      if(status == VC_CONTAINER_SUCCESS)
+         status = mp4_write_box(p_ctx, MP4_BOX_TYPE_MOOV);
+
+      /* Finalise the mdat box */
+      SEEK(p_ctx, module->mdat_offset);
+      WRITE_U32(p_ctx, (uint32_t)mdat_size, "mdat size" );
+   }
 
    for(; p_ctx->tracks_num > 0; p_ctx->tracks_num--)
+   {
+      VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[p_ctx->tracks_num-1]->priv->module;
+      unsigned int i;
+      for(i = 0; i < MP4_SAMPLE_TABLE_NUM; i++)
+      {
+         free(track_module->sample_table[i].data);
+         free(track_module->sample_table[i].spills);
+      }
+      free(track_module->frame);
+      free(track_module->fragment.data);
+      free(track_module->fragment.samples);
       vc_container_free_track(p_ctx, p_ctx->tracks[p_ctx->tracks_num-1]);
+   }
 
-   vc_container_writer_extraio_delete(p_ctx, &module->temp);
+   if(module->temp.io) vc_container_writer_extraio_delete(p_ctx, &module->temp);
    vc_container_writer_extraio_delete(p_ctx, &module->null);
    free(module);
 
@@ -1188,7 +1735,8 @@ static VC_CONTAINER_STATUS_T mp4_writer_add_track( VC_CONTAINER_T *p_ctx, VC_CON
    case VC_CONTAINER_CODEC_JPEG:   type = VC_FOURCC('m','p','4','v'); break;
    case VC_CONTAINER_CODEC_H263:   type = VC_FOURCC('s','2','6','3'); break;
    case VC_CONTAINER_CODEC_H264:
-      if(format->codec_variant == VC_FOURCC('a','v','c','C')) type = VC_FOURCC('a','v','c','1'); break;
+      if(format->codec_variant == VC_FOURCC('a','v','c','C') ||
+         format->codec_variant == VC_CONTAINER_VARIANT_H264_DEFAULT) type = VC_FOURCC('a','v','c','1'); break;
    case VC_CONTAINER_CODEC_MJPEG:  type = VC_FOURCC('j','p','e','g'); break;
    case VC_CONTAINER_CODEC_MJPEGA: type = VC_FOURCC('m','j','p','a'); break;
    case VC_CONTAINER_CODEC_MJPEGB: type = VC_FOURCC('m','j','p','b'); break;
@@ -1215,6 +1763,18 @@ static VC_CONTAINER_STATUS_T mp4_writer_add_track( VC_CONTAINER_T *p_ctx, VC_CON
    vc_container_format_copy(track->format, format, format->extradata_size);
    track->priv->module->fourcc = type;
    track->priv->module->offset = -1;
+   track->priv->module->fragment.next_dts = VC_CONTAINER_TIME_UNKNOWN;
+
+   /* A byte stream gets converted, with the avcC built from its parameter sets */
+   if(format->codec == VC_CONTAINER_CODEC_H264 &&
+      format->codec_variant == VC_CONTAINER_VARIANT_H264_DEFAULT)
+   {
+      track->priv->module->annexb = true;
+      track->format->codec_variant = VC_CONTAINER_VARIANT_H264_AVC1;
+      track->format->extradata_size = 0;
+   }
+   if(format->es_type == VC_CONTAINER_ES_TYPE_VIDEO)
+      p_ctx->priv->module->video_tracks++;
    track->priv->module->sample_table[MP4_SAMPLE_TABLE_STTS].entry_size = 8;
    track->priv->module->sample_table[MP4_SAMPLE_TABLE_STSZ].entry_size = 4;
    track->priv->module->sample_table[MP4_SAMPLE_TABLE_STSC].entry_size = 12;
@@ -1238,6 +1798,13 @@ static VC_CONTAINER_STATUS_T mp4_writer_add_track_done( VC_CONTAINER_T *p_ctx )
    VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
    if(module->tracks_add_done) return status;
 
+   /* In a fragmented file the moov goes out with the first fragment */
+   if(module->fragment_duration)
+   {
+      module->tracks_add_done = true;
+      return status;
+   }
+
    /* We need to find out the size of the object we're going to write it. */
    if(!vc_container_writer_extraio_enable(p_ctx, &module->null))
    {
@@ -1246,9 +1813,16 @@ static VC_CONTAINER_STATUS_T mp4_writer_add_track_done( VC_CONTAINER_T *p_ctx )
       p_ctx->size = module->moov_size;
    }
    vc_container_writer_extraio_disable(p_ctx, &module->null);
+   if(status != VC_CONTAINER_SUCCESS) return status;
 
-   if(status == VC_CONTAINER_SUCCESS) module->tracks_add_done = true;
-   return status;
+   /* Start the mdat box */
+   module->mdat_offset = STREAM_POSITION(p_ctx);
+   WRITE_U32(p_ctx, 0, "size");
+   WRITE_FOURCC(p_ctx, VC_FOURCC('m','d','a','t'), "type");
+   module->data_offset = STREAM_POSITION(p_ctx);
+
+   module->tracks_add_done = true;
+   return STREAM_STATUS(p_ctx);
 }
 
 /*****************************************************************************/
@@ -1269,6 +1843,15 @@ static VC_CONTAINER_STATUS_T mp4_writer_control( VC_CONTAINER_T *p_ctx, VC_CONTA
    case VC_CONTAINER_CONTROL_TRACK_ADD_DONE:
       return mp4_writer_add_track_done(p_ctx);
 
+   case VC_CONTAINER_CONTROL_SET_FRAGMENT_DURATION:
+      {
+         int64_t duration = (int64_t)va_arg( args, int64_t );
+         if(module->tracks_add_done || module->brand == MP4_BRAND_QT || duration < 0)
+            return VC_CONTAINER_ERROR_UNSUPPORTED_OPERATION;
+         module->fragment_duration = duration;
+         return VC_CONTAINER_SUCCESS;
+      }
+
    default: return VC_CONTAINER_ERROR_UNSUPPORTED_OPERATION;
    }
 }
@@ -1280,42 +1863,79 @@ static VC_CONTAINER_STATUS_T mp4_writer_add_sample( VC_CONTAINER_T *p_ctx,
    VC_CONTAINER_MODULE_T *module = p_ctx->priv->module;
    VC_CONTAINER_TRACK_T *track = p_ctx->tracks[packet->track];
    VC_CONTAINER_TRACK_MODULE_T *track_module = track->priv->module;
+   VC_CONTAINER_STATUS_T status = VC_CONTAINER_SUCCESS;
+   int64_t delta = 0;
 
    track_module->last_pts = packet->pts;
    if(!track_module->samples) track_module->first_pts = packet->pts;
 
-   track_module->samples++;
-   track_module->sample_table[MP4_SAMPLE_TABLE_STSZ].entries++; /* sample size */
-   p_ctx->size += track_module->sample_table[MP4_SAMPLE_TABLE_STSZ].entry_size;
-   track_module->sample_table[MP4_SAMPLE_TABLE_STTS].entries++; /* time to sample */
-   p_ctx->size += track_module->sample_table[MP4_SAMPLE_TABLE_STTS].entry_size;
-
-   #if 0
-   delta_ts = packet->dts - track_module->timestamp;
-   track_module->timestamp = packet->dts;
-   if(!track_module->samples) track_module->delta_ts =
-   if()
-#endif
+   /* Sample sizes only get stored once they stop being all the same */
+   if(!track_module->samples++)
+      track_module->sample_size = packet->size;
+   else if(packet->size != track_module->sample_size &&
+           !track_module->sample_table[MP4_SAMPLE_TABLE_STSZ].entries)
+   {
+      for(; track_module->sample_table[MP4_SAMPLE_TABLE_STSZ].entries < track_module->samples - 1;
+          track_module->sample_table[MP4_SAMPLE_TABLE_STSZ].entries++)
+      {
+         status = mp4_writer_table_add(p_ctx, track_module, MP4_SAMPLE_TABLE_STSZ, track_module->sample_size, 0, 0);
+         if(status != VC_CONTAINER_SUCCESS) return status;
+         p_ctx->size += track_module->sample_table[MP4_SAMPLE_TABLE_STSZ].entry_size;
+      }
+   }
+   if(track_module->sample_table[MP4_SAMPLE_TABLE_STSZ].entries)
+   {
+      status = mp4_writer_table_add(p_ctx, track_module, MP4_SAMPLE_TABLE_STSZ, packet->size, 0, 0);
+      if(status != VC_CONTAINER_SUCCESS) return status;
+      track_module->sample_table[MP4_SAMPLE_TABLE_STSZ].entries++; /* sample size */
+      p_ctx->size += track_module->sample_table[MP4_SAMPLE_TABLE_STSZ].entry_size;
+   }
+
+   /* Samples with the same duration share a time to sample entry */
+   if(packet->dts != VC_CONTAINER_TIME_UNKNOWN)
+      delta = packet->dts * MP4_TIMESCALE / 1000000 - track_module->timestamp;
+   if(delta < 0) delta = 0;
+   track_module->timestamp += delta;
+   if(!track_module->samples_in_delta || delta != track_module->delta_timestamp)
+   {
+      if(track_module->samples_in_delta)
+         status = mp4_writer_table_add(p_ctx, track_module, MP4_SAMPLE_TABLE_STTS,
+            track_module->samples_in_delta, track_module->delta_timestamp, 0);
+      if(status != VC_CONTAINER_SUCCESS) return status;
+      track_module->delta_timestamp = delta;
+      track_module->samples_in_delta = 0;
+      track_module->sample_table[MP4_SAMPLE_TABLE_STTS].entries++; /* time to sample */
+      p_ctx->size += track_module->sample_table[MP4_SAMPLE_TABLE_STTS].entry_size;
+   }
+   track_module->samples_in_delta++;
 
    /* Is it a new chunk ? */
    if(module->sample_offset != track_module->offset)
    {
+      status = mp4_writer_table_close_chunk(p_ctx, track_module);
+      if(status != VC_CONTAINER_SUCCESS) return status;
       track_module->chunks++;
+      status = mp4_writer_table_add(p_ctx, track_module, MP4_SAMPLE_TABLE_STCO,
+         (uint32_t)module->sample_offset, 0, 0);
+      if(status != VC_CONTAINER_SUCCESS) return status;
       track_module->sample_table[MP4_SAMPLE_TABLE_STCO].entries++; /* chunk offset */
       p_ctx->size += track_module->sample_table[MP4_SAMPLE_TABLE_STCO].entry_size;
       track_module->sample_table[MP4_SAMPLE_TABLE_STSC].entries++; /* sample to chunk */
       p_ctx->size += track_module->sample_table[MP4_SAMPLE_TABLE_STSC].entry_size;
    }
    track_module->offset = module->sample_offset + packet->size;
+   track_module->samples_in_chunk++;
 
    if(track->format->es_type == VC_CONTAINER_ES_TYPE_VIDEO &&
       (packet->flags & VC_CONTAINER_PACKET_FLAG_KEYFRAME))
    {
+      status = mp4_writer_table_add(p_ctx, track_module, MP4_SAMPLE_TABLE_STSS, track_module->samples, 0, 0);
+      if(status != VC_CONTAINER_SUCCESS) return status;
       track_module->sample_table[MP4_SAMPLE_TABLE_STSS].entries++; /* sync sample */
       p_ctx->size += track_module->sample_table[MP4_SAMPLE_TABLE_STSS].entry_size;
    }
 
-   return VC_CONTAINER_SUCCESS;
+   return status;
 }
 
 /*****************************************************************************/
@@ -1332,9 +1952,37 @@ static VC_CONTAINER_STATUS_T mp4_writer_write( VC_CONTAINER_T *p_ctx,
       if(status != VC_CONTAINER_SUCCESS) return status;
    }
 
+   if(packet->track >= p_ctx->tracks_num)
+      return VC_CONTAINER_ERROR_INVALID_ARGUMENT;
+
    if(packet->flags & VC_CONTAINER_PACKET_FLAG_FRAME_START)
       ++module->samples; /* Switching to a new sample */
 
+   /* Fragments and byte stream conversion need whole frames */
+   if(module->fragment_duration || p_ctx->tracks[packet->track]->priv->module->annexb)
+   {
+      VC_CONTAINER_TRACK_MODULE_T *track_module = p_ctx->tracks[packet->track]->priv->module;
+
+      if(packet->flags & VC_CONTAINER_PACKET_FLAG_FRAME_START)
+      {
+         track_module->frame_size = 0;
+         track_module->frame_pts = packet->pts;
+         track_module->frame_flags = packet->flags;
+      }
+      else
+         track_module->frame_flags |= packet->flags;
+
+      status = mp4_writer_grow((void **)&track_module->frame, &track_module->frame_alloc,
+         track_module->frame_size + packet->size, 1);
+      if(status != VC_CONTAINER_SUCCESS) return status;
+      memcpy(track_module->frame + track_module->frame_size, packet->data, packet->size);
+      track_module->frame_size += packet->size;
+
+      if(!(packet->flags & VC_CONTAINER_PACKET_FLAG_FRAME_END))
+         return VC_CONTAINER_SUCCESS;
+      return mp4_writer_write_frame(p_ctx, packet->track);
+   }
+
    if(packet->flags & VC_CONTAINER_PACKET_FLAG_FRAME_START)
    {
       module->sample_offset = STREAM_POSITION(p_ctx);
@@ -1356,10 +2004,7 @@ static VC_CONTAINER_STATUS_T mp4_writer_write( VC_CONTAINER_T *p_ctx,
 
    //
    if(packet->flags & VC_CONTAINER_PACKET_FLAG_FRAME_END)
-   {
-      status = mp4_writer_write_sample_to_temp(p_ctx, sample);
-      status = mp4_writer_add_sample(p_ctx, sample);
-   }
+      return mp4_writer_add_sample(p_ctx, sample);
 
    return VC_CONTAINER_SUCCESS;
 }
@@ -1372,6 +2017,7 @@ VC_CONTAINER_STATUS_T mp4_writer_open( VC_CONTAINER_T *p_ctx )
 {
    VC_CONTAINER_STATUS_T status = VC_CONTAINER_ERROR_FORMAT_NOT_SUPPORTED;
    const char *extension = vc_uri_path_extension(p_ctx->priv->uri);
+   const char *fragment = 0;
    VC_CONTAINER_MODULE_T *module = 0;
    MP4_BRAND_T brand;
 
@@ -1404,19 +2050,17 @@ VC_CONTAINER_STATUS_T mp4_writer_open( VC_CONTAINER_T *p_ctx )
    status = vc_container_writer_extraio_create_null(p_ctx, &module->null);
    if(status != VC_CONTAINER_SUCCESS) goto error;
 
-   /* Create a temporary i/o writer to help us out in writing our data */
-   status = vc_container_writer_extraio_create_temp(p_ctx, &module->temp);
-   if(status != VC_CONTAINER_SUCCESS) goto error;
+   /* The fragment duration (in ms) can also be given in the uri */
+   if(vc_uri_find_query(p_ctx->priv->uri, 0, "fragment", &fragment) && fragment &&
+      brand != MP4_BRAND_QT)
+      module->fragment_duration = INT64_C(1000) * strtoul(fragment, 0, 10);
+   module->fragment_start = VC_CONTAINER_TIME_UNKNOWN;
+   module->fragment_sequence = 1;
+   module->first_dts = VC_CONTAINER_TIME_UNKNOWN;
 
    status = mp4_write_box(p_ctx, MP4_BOX_TYPE_FTYP);
    if(status != VC_CONTAINER_SUCCESS) goto error;
 
-   /* Start the mdat box */
-   module->mdat_offset = STREAM_POSITION(p_ctx);
-   WRITE_U32(p_ctx, 0, "size");
-   WRITE_FOURCC(p_ctx, VC_FOURCC('m','d','a','t'), "type");
-   module->data_offset = STREAM_POSITION(p_ctx);
-
    p_ctx->priv->pf_close = mp4_writer_close;
    p_ctx->priv->pf_write = mp4_writer_write;
    p_ctx->priv->pf_control = mp4_writer_control;
@@ -0,0 +1,398 @@
+/*
+Copyright (c) 2018, Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "interface/vcos/vcos.h"
+#include "interface/mmal/mmal_logging.h"
+
+#include "RaspiEventLoop.h"
+
+/// Maximum number of events handled per epoll_wait()
+#define EVENT_LOOP_MAX_EVENTS 16
+/// Number of GPIO changes that can be pending before new ones are lost
+#define EVENT_LOOP_GPIO_QUEUE_SIZE 64
+
+typedef enum
+{
+   EVENT_SOURCE_FD,
+   EVENT_SOURCE_TIMER,
+   EVENT_SOURCE_WAKEUP
+} EVENT_SOURCE_TYPE_T;
+
+struct RASPI_EVENT_SOURCE_S
+{
+   RASPI_EVENT_LOOP_T *loop;
+   EVENT_SOURCE_TYPE_T type;
+   int fd;
+   RASPI_EVENT_FD_CALLBACK_T fd_callback;
+   RASPI_EVENT_TIMER_CALLBACK_T timer_callback;
+   void *userdata;
+   int removed;                      /// Freed once the current dispatch round is over
+   struct RASPI_EVENT_SOURCE_S *next;
+};
+
+typedef struct
+{
+   unsigned int gpio;
+   int level;
+} GPIO_EVENT_T;
+
+struct RASPI_EVENT_LOOP_S
+{
+   int epoll_fd;
+   struct RASPI_EVENT_SOURCE_S wakeup;   /// eventfd signalled for GPIO changes and stop
+   struct RASPI_EVENT_SOURCE_S *sources;
+
+   int stop;                         /// Set with atomics, from any thread or a signal handler
+
+   RASPI_EVENT_GPIO_CALLBACK_T gpio_callback;
+   void *gpio_userdata;
+   pthread_mutex_t gpio_lock;
+   GPIO_EVENT_T gpio_queue[EVENT_LOOP_GPIO_QUEUE_SIZE];
+   unsigned int gpio_read;
+   unsigned int gpio_count;
+};
+
+static int event_loop_stopped(RASPI_EVENT_LOOP_T *loop)
+{
+   return __atomic_load_n(&loop->stop, __ATOMIC_ACQUIRE);
+}
+
+static void event_loop_wakeup(RASPI_EVENT_LOOP_T *loop)
+{
+   uint64_t one = 1;
+   ssize_t ret;
+
+   // Only fails if the counter is about to overflow, in which case the loop is awake anyway
+   ret = write(loop->wakeup.fd, &one, sizeof(one));
+   (void)ret;
+}
+
+/** Register a new source with epoll and link it into the loop */
+static struct RASPI_EVENT_SOURCE_S *event_source_add(RASPI_EVENT_LOOP_T *loop, EVENT_SOURCE_TYPE_T type,
+                                                     int fd, uint32_t events, void *userdata)
+{
+   struct RASPI_EVENT_SOURCE_S *source;
+   struct epoll_event event;
+
+   source = calloc(1, sizeof(*source));
+   if (!source)
+      return NULL;
+
+   source->loop = loop;
+   source->type = type;
+   source->fd = fd;
+   source->userdata = userdata;
+
+   memset(&event, 0, sizeof(event));
+   event.events = events;
+   event.data.ptr = source;
+   if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0)
+   {
+      vcos_log_error("%s: unable to watch fd %d: %s", __func__, fd, strerror(errno));
+      free(source);
+      return NULL;
+   }
+
+   source->next = loop->sources;
+   loop->sources = source;
+   return source;
+}
+
+static void event_source_remove(struct RASPI_EVENT_SOURCE_S *source)
+{
+   epoll_ctl(source->loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+   if (source->type == EVENT_SOURCE_TIMER)
+      close(source->fd);
+   source->fd = -1;
+   source->removed = 1;
+}
+
+/** Free the sources removed since the last call */
+static void event_loop_sweep(RASPI_EVENT_LOOP_T *loop)
+{
+   struct RASPI_EVENT_SOURCE_S **link = &loop->sources;
+
+   while (*link)
+   {
+      struct RASPI_EVENT_SOURCE_S *source = *link;
+
+      if (source->removed)
+      {
+         *link = source->next;
+         free(source);
+      }
+      else
+      {
+         link = &source->next;
+      }
+   }
+}
+
+/** Hand the pending GPIO changes to the GPIO callback */
+static void event_loop_dispatch_gpio(RASPI_EVENT_LOOP_T *loop)
+{
+   GPIO_EVENT_T events[EVENT_LOOP_GPIO_QUEUE_SIZE];
+   unsigned int i, count;
+   uint64_t value;
+
+   if (read(loop->wakeup.fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+      vcos_log_error("%s: eventfd read failed: %s", __func__, strerror(errno));
+
+   pthread_mutex_lock(&loop->gpio_lock);
+   count = loop->gpio_count;
+   for (i = 0; i < count; i++)
+      events[i] = loop->gpio_queue[(loop->gpio_read + i) % EVENT_LOOP_GPIO_QUEUE_SIZE];
+   loop->gpio_read = (loop->gpio_read + count) % EVENT_LOOP_GPIO_QUEUE_SIZE;
+   loop->gpio_count = 0;
+   pthread_mutex_unlock(&loop->gpio_lock);
+
+   for (i = 0; i < count && !event_loop_stopped(loop); i++)
+   {
+      if (loop->gpio_callback)
+         loop->gpio_callback(loop, events[i].gpio, events[i].level, loop->gpio_userdata);
+   }
+}
+
+RASPI_EVENT_LOOP_T *raspi_event_loop_create(RASPI_EVENT_GPIO_CALLBACK_T gpio_callback, void *userdata)
+{
+   RASPI_EVENT_LOOP_T *loop;
+   struct epoll_event event;
+
+   loop = calloc(1, sizeof(*loop));
+   if (!loop)
+      return NULL;
+
+   loop->gpio_callback = gpio_callback;
+   loop->gpio_userdata = userdata;
+
+   loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+   if (loop->epoll_fd < 0)
+      goto error_epoll;
+
+   loop->wakeup.loop = loop;
+   loop->wakeup.type = EVENT_SOURCE_WAKEUP;
+   loop->wakeup.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+   if (loop->wakeup.fd < 0)
+      goto error_eventfd;
+
+   memset(&event, 0, sizeof(event));
+   event.events = EPOLLIN;
+   event.data.ptr = &loop->wakeup;
+   if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, loop->wakeup.fd, &event) < 0)
+      goto error_ctl;
+
+   pthread_mutex_init(&loop->gpio_lock, NULL);
+   return loop;
+
+error_ctl:
+   close(loop->wakeup.fd);
+error_eventfd:
+   close(loop->epoll_fd);
+error_epoll:
+   vcos_log_error("%s: unable to create event loop: %s", __func__, strerror(errno));
+   free(loop);
+   return NULL;
+}
+
+void raspi_event_loop_destroy(RASPI_EVENT_LOOP_T *loop)
+{
+   struct RASPI_EVENT_SOURCE_S *source;
+
+   if (!loop)
+      return;
+
+   for (source = loop->sources; source; source = source->next)
+   {
+      if (!source->removed)
+         event_source_remove(source);
+   }
+   event_loop_sweep(loop);
+
+   pthread_mutex_destroy(&loop->gpio_lock);
+   close(loop->wakeup.fd);
+   close(loop->epoll_fd);
+   free(loop);
+}
+
+int raspi_event_loop_add_fd(RASPI_EVENT_LOOP_T *loop, int fd, uint32_t events,
+                            RASPI_EVENT_FD_CALLBACK_T callback, void *userdata)
+{
+   struct RASPI_EVENT_SOURCE_S *source;
+
+   source = event_source_add(loop, EVENT_SOURCE_FD, fd, events, userdata);
+   if (!source)
+      return -1;
+
+   source->fd_callback = callback;
+   return 0;
+}
+
+int raspi_event_loop_remove_fd(RASPI_EVENT_LOOP_T *loop, int fd)
+{
+   struct RASPI_EVENT_SOURCE_S *source;
+
+   for (source = loop->sources; source; source = source->next)
+   {
+      if (!source->removed && source->type == EVENT_SOURCE_FD && source->fd == fd)
+      {
+         event_source_remove(source);
+         return 0;
+      }
+   }
+   return -1;
+}
+
+RASPI_EVENT_TIMER_T *raspi_event_timer_create(RASPI_EVENT_LOOP_T *loop,
+                                              RASPI_EVENT_TIMER_CALLBACK_T callback, void *userdata)
+{
+   struct RASPI_EVENT_SOURCE_S *source;
+   int fd;
+
+   fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+   if (fd < 0)
+   {
+      vcos_log_error("%s: unable to create timer: %s", __func__, strerror(errno));
+      return NULL;
+   }
+
+   source = event_source_add(loop, EVENT_SOURCE_TIMER, fd, EPOLLIN, userdata);
+   if (!source)
+   {
+      close(fd);
+      return NULL;
+   }
+
+   source->timer_callback = callback;
+   return source;
+}
+
+int raspi_event_timer_set(RASPI_EVENT_TIMER_T *timer, unsigned int ms, int periodic)
+{
+   struct itimerspec spec;
+
+   memset(&spec, 0, sizeof(spec));
+   spec.it_value.tv_sec = ms / 1000;
+   spec.it_value.tv_nsec = (ms % 1000) * 1000000;
+   if (periodic)
+      spec.it_interval = spec.it_value;
+
+   return timerfd_settime(timer->fd, 0, &spec, NULL) < 0 ? -1 : 0;
+}
+
+void raspi_event_timer_destroy(RASPI_EVENT_TIMER_T *timer)
+{
+   if (timer && !timer->removed)
+      event_source_remove(timer);
+}
+
+int raspi_event_loop_post_gpio(RASPI_EVENT_LOOP_T *loop, unsigned int gpio, int level)
+{
+   int ret = 0;
+
+   pthread_mutex_lock(&loop->gpio_lock);
+   if (loop->gpio_count < EVENT_LOOP_GPIO_QUEUE_SIZE)
+   {
+      GPIO_EVENT_T *event = &loop->gpio_queue[(loop->gpio_read + loop->gpio_count) % EVENT_LOOP_GPIO_QUEUE_SIZE];
+      event->gpio = gpio;
+      event->level = level;
+      loop->gpio_count++;
+   }
+   else
+   {
+      ret = -1;
+   }
+   pthread_mutex_unlock(&loop->gpio_lock);
+
+   event_loop_wakeup(loop);
+   return ret;
+}
+
+int raspi_event_loop_run(RASPI_EVENT_LOOP_T *loop)
+{
+   struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+   while (!event_loop_stopped(loop))
+   {
+      int i, num;
+
+      num = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, -1);
+      if (num < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         vcos_log_error("%s: epoll_wait failed: %s", __func__, strerror(errno));
+         return -1;
+      }
+
+      for (i = 0; i < num && !event_loop_stopped(loop); i++)
+      {
+         struct RASPI_EVENT_SOURCE_S *source = events[i].data.ptr;
+         uint64_t expirations;
+
+         // Removed by a handler called earlier in this round
+         if (source->removed)
+            continue;
+
+         switch (source->type)
+         {
+         case EVENT_SOURCE_FD:
+            source->fd_callback(loop, source->fd, events[i].events, source->userdata);
+            break;
+
+         case EVENT_SOURCE_TIMER:
+            // A timer disarmed since the wakeup has nothing to read
+            if (read(source->fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+               source->timer_callback(loop, source, source->userdata);
+            break;
+
+         case EVENT_SOURCE_WAKEUP:
+            event_loop_dispatch_gpio(loop);
+            break;
+         }
+      }
+
+      event_loop_sweep(loop);
+   }
+
+   return 0;
+}
+
+void raspi_event_loop_stop(RASPI_EVENT_LOOP_T *loop)
+{
+   __atomic_store_n(&loop->stop, 1, __ATOMIC_RELEASE);
+   event_loop_wakeup(loop);
+}
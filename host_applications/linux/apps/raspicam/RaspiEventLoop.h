@@ -0,0 +1,130 @@
+/*
+Copyright (c) 2018, Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef RASPIEVENTLOOP_H_
+#define RASPIEVENTLOOP_H_
+
+#include <stdint.h>
+
+/**
+ * Single threaded event loop based on epoll.
+ *
+ * Waits on any number of file descriptors (serial ports, sockets...), timers
+ * and GPIO level changes, and calls the matching handler from the thread
+ * running raspi_event_loop_run(). GPIO changes are posted to the loop from any
+ * thread with raspi_event_loop_post_gpio(), for example from a pigpio alert
+ * callback or, when testing without the hardware, from a simulated source.
+ */
+typedef struct RASPI_EVENT_LOOP_S RASPI_EVENT_LOOP_T;
+
+/// Timer owned by an event loop
+typedef struct RASPI_EVENT_SOURCE_S RASPI_EVENT_TIMER_T;
+
+/// Called when a file descriptor is ready. events is the EPOLL* mask returned by epoll.
+typedef void (*RASPI_EVENT_FD_CALLBACK_T)(RASPI_EVENT_LOOP_T *loop, int fd, uint32_t events, void *userdata);
+
+/// Called when a timer expires
+typedef void (*RASPI_EVENT_TIMER_CALLBACK_T)(RASPI_EVENT_LOOP_T *loop, RASPI_EVENT_TIMER_T *timer, void *userdata);
+
+/// Called for each GPIO level change posted to the loop, in posting order
+typedef void (*RASPI_EVENT_GPIO_CALLBACK_T)(RASPI_EVENT_LOOP_T *loop, unsigned int gpio, int level, void *userdata);
+
+/**
+ * Create an event loop
+ *
+ * @param gpio_callback Handler for the GPIO changes posted to the loop, may be NULL
+ * @param userdata Passed to gpio_callback
+ *
+ * @return The new loop or NULL on failure
+ */
+RASPI_EVENT_LOOP_T *raspi_event_loop_create(RASPI_EVENT_GPIO_CALLBACK_T gpio_callback, void *userdata);
+
+/**
+ * Destroy an event loop and all its timers. File descriptors added to the loop
+ * are not closed.
+ */
+void raspi_event_loop_destroy(RASPI_EVENT_LOOP_T *loop);
+
+/**
+ * Watch a file descriptor
+ *
+ * @param events EPOLL* mask to wait for, usually EPOLLIN
+ *
+ * @return 0 on success, -1 on failure
+ */
+int raspi_event_loop_add_fd(RASPI_EVENT_LOOP_T *loop, int fd, uint32_t events,
+                            RASPI_EVENT_FD_CALLBACK_T callback, void *userdata);
+
+/**
+ * Stop watching a file descriptor. Safe to call from any handler of the loop.
+ *
+ * @return 0 on success, -1 if fd wasn't watched
+ */
+int raspi_event_loop_remove_fd(RASPI_EVENT_LOOP_T *loop, int fd);
+
+/**
+ * Create a timer. The timer starts disarmed.
+ *
+ * @return The new timer or NULL on failure
+ */
+RASPI_EVENT_TIMER_T *raspi_event_timer_create(RASPI_EVENT_LOOP_T *loop,
+                                              RASPI_EVENT_TIMER_CALLBACK_T callback, void *userdata);
+
+/**
+ * Arm or disarm a timer
+ *
+ * @param ms Delay before the timer expires in milliseconds, 0 to disarm it
+ * @param periodic If set, the timer keeps expiring every ms milliseconds
+ *
+ * @return 0 on success, -1 on failure
+ */
+int raspi_event_timer_set(RASPI_EVENT_TIMER_T *timer, unsigned int ms, int periodic);
+
+/** Destroy a timer. Safe to call from any handler of the loop. */
+void raspi_event_timer_destroy(RASPI_EVENT_TIMER_T *timer);
+
+/**
+ * Post a GPIO level change to the loop. Can be called from any thread.
+ *
+ * @return 0 on success, -1 if the change was lost because too many are pending
+ */
+int raspi_event_loop_post_gpio(RASPI_EVENT_LOOP_T *loop, unsigned int gpio, int level);
+
+/**
+ * Run the loop until raspi_event_loop_stop() is called
+ *
+ * @return 0 once stopped, -1 on failure
+ */
+int raspi_event_loop_run(RASPI_EVENT_LOOP_T *loop);
+
+/**
+ * Make raspi_event_loop_run() return. Can be called from any thread and from a
+ * signal handler. A stopped loop can't be restarted.
+ */
+void raspi_event_loop_stop(RASPI_EVENT_LOOP_T *loop);
+
+#endif /* RASPIEVENTLOOP_H_ */
@@ -0,0 +1,574 @@
+/*
+Copyright (c) 2018, Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include "interface/vcos/vcos.h"
+#include "interface/mmal/mmal_logging.h"
+
+#include "RaspiOV528.h"
+
+/// First byte of every command
+#define OV528_COMMAND_START 0xAA
+/// Package ID of the ACK closing a picture transfer
+#define OV528_LAST_PACKAGE_ID 0xF0F0
+/// Package header (ID and data size) and trailer (checksum and 0) lengths
+#define OV528_PACKAGE_HEADER 4
+#define OV528_PACKAGE_TRAILER 2
+/// Clock the OV528 baud rate dividers apply to
+#define OV528_BAUD_CLOCK 7372800
+
+/** Precomputed package of a picture */
+typedef struct
+{
+   uint8_t header[OV528_PACKAGE_HEADER];   /// Package ID and data size, little endian
+   uint8_t trailer[OV528_PACKAGE_TRAILER]; /// Checksum and 0
+   unsigned int segment;                   /// Segment holding the first data byte
+   size_t offset;                          /// Offset of the first data byte in that segment
+} OV528_PACKAGE_T;
+
+/** A picture and the table of its packages */
+typedef struct
+{
+   void *picture;                    /// Userdata of the picture, NULL if there is no picture
+   struct iovec *segments;
+   unsigned int num_segments;
+   size_t length;                    /// Total number of bytes
+   OV528_PACKAGE_T *packages;
+   unsigned int num_packages;
+   unsigned int package_size;        /// Package size the table was built for
+   unsigned int sent;                /// Packages 0 to sent - 1 have all been sent at least once
+} OV528_PICTURE_T;
+
+struct RASPI_OV528_S
+{
+   int fd;
+   RASPI_OV528_COMMAND_CALLBACK_T command_callback;
+   RASPI_OV528_RELEASE_CALLBACK_T release_callback;
+   void *userdata;
+
+   uint8_t command[RASPI_OV528_COMMAND_LENGTH]; /// Command being received
+   unsigned int command_length;      /// Number of bytes of command received so far
+
+   unsigned int package_size;        /// Package size set by the host
+   unsigned int window;              /// Packages sent per request
+   unsigned int baud_rate;
+
+   OV528_PICTURE_T current;          /// Picture being transferred
+   OV528_PICTURE_T next;             /// Picture queued for the next GET_PICTURE
+};
+
+/** Supported baud rates */
+static const struct
+{
+   unsigned int baud_rate;
+   speed_t speed;
+} ov528_speeds[] =
+{
+   {9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600}, {115200, B115200},
+   {230400, B230400}, {460800, B460800},
+#ifdef B921600
+   {921600, B921600},
+#endif
+#ifdef B1000000
+   {1000000, B1000000}, {1152000, B1152000}, {1500000, B1500000}, {2000000, B2000000},
+#endif
+};
+
+static int ov528_speed(unsigned int baud_rate, speed_t *speed)
+{
+   unsigned int i;
+
+   for (i = 0; i < vcos_countof(ov528_speeds); i++)
+   {
+      if (ov528_speeds[i].baud_rate == baud_rate)
+      {
+         *speed = ov528_speeds[i].speed;
+         return 0;
+      }
+   }
+   return -1;
+}
+
+/**
+ * Sum of bytes modulo 256, 8 bytes at a time.
+ * Each 64-bit word is split in 4 lanes of 16 bits holding the sum of 2 bytes,
+ * which are accumulated without carrying into the next lane for up to 128 words.
+ */
+static uint8_t ov528_checksum(const uint8_t *data, size_t length)
+{
+   const uint64_t mask = 0x00FF00FF00FF00FFULL;
+   uint64_t lanes = 0;
+   unsigned int sum = 0, words = 0;
+
+   for (; length >= sizeof(uint64_t); data += sizeof(uint64_t), length -= sizeof(uint64_t))
+   {
+      uint64_t word;
+
+      memcpy(&word, data, sizeof(word));
+      lanes += (word & mask) + ((word >> 8) & mask);
+      if (++words == 128)
+      {
+         sum += lanes + (lanes >> 16) + (lanes >> 32) + (lanes >> 48);
+         lanes = 0;
+         words = 0;
+      }
+   }
+   sum += lanes + (lanes >> 16) + (lanes >> 32) + (lanes >> 48);
+
+   while (length--)
+      sum += *data++;
+   return (uint8_t)sum;
+}
+
+/** Write a whole iovec array, waiting for the port if it is non-blocking */
+static int ov528_writev(int fd, struct iovec *iov, int iov_num)
+{
+   while (iov_num)
+   {
+      ssize_t written = writev(fd, iov, iov_num);
+
+      if (written < 0)
+      {
+         struct pollfd pfd = {fd, POLLOUT, 0};
+
+         if (errno == EINTR)
+            continue;
+         if (errno == EAGAIN && poll(&pfd, 1, -1) >= 0)
+            continue;
+         return -1;
+      }
+
+      while (iov_num && (size_t)written >= iov->iov_len)
+      {
+         written -= iov->iov_len;
+         iov++;
+         iov_num--;
+      }
+      if (iov_num)
+      {
+         iov->iov_base = (uint8_t *)iov->iov_base + written;
+         iov->iov_len -= written;
+      }
+   }
+   return 0;
+}
+
+static int ov528_send_command(RASPI_OV528_T *ov528, uint8_t id, uint8_t p1, uint8_t p2, uint8_t p3, uint8_t p4)
+{
+   uint8_t command[RASPI_OV528_COMMAND_LENGTH] = {OV528_COMMAND_START, id, p1, p2, p3, p4};
+   struct iovec iov = {command, sizeof(command)};
+
+   return ov528_writev(ov528->fd, &iov, 1);
+}
+
+int raspi_ov528_ack(RASPI_OV528_T *ov528, uint8_t command_id)
+{
+   return ov528_send_command(ov528, RASPI_OV528_ACK, command_id, 0, 0, 0);
+}
+
+int raspi_ov528_nak(RASPI_OV528_T *ov528, uint8_t error)
+{
+   return ov528_send_command(ov528, RASPI_OV528_NAK, 0, 0, error, 0);
+}
+
+/** Build the package table of a picture for the current package size */
+static int ov528_picture_prepare(RASPI_OV528_T *ov528, OV528_PICTURE_T *picture)
+{
+   unsigned int data_size = ov528->package_size - OV528_PACKAGE_HEADER - OV528_PACKAGE_TRAILER;
+   unsigned int num_packages = (picture->length + data_size - 1) / data_size;
+   unsigned int i, segment = 0;
+   size_t offset = 0;
+
+   if (picture->package_size == ov528->package_size)
+      return 0;
+   if (num_packages > 0xFFFF)
+   {
+      vcos_log_error("%s: picture of %zu bytes needs too many packages", __func__, picture->length);
+      return -1;
+   }
+
+   free(picture->packages);
+   picture->packages = calloc(num_packages ? num_packages : 1, sizeof(*picture->packages));
+   if (!picture->packages)
+      return -1;
+
+   for (i = 0; i < num_packages; i++)
+   {
+      OV528_PACKAGE_T *package = &picture->packages[i];
+      size_t size = vcos_min(data_size, picture->length - (size_t)i * data_size);
+      size_t left = size;
+      uint8_t checksum;
+
+      package->header[0] = i & 0xFF;
+      package->header[1] = (i >> 8) & 0xFF;
+      package->header[2] = size & 0xFF;
+      package->header[3] = (size >> 8) & 0xFF;
+      checksum = ov528_checksum(package->header, sizeof(package->header));
+
+      // Skip empty segments so the package starts where its data is
+      while (segment < picture->num_segments && offset == picture->segments[segment].iov_len)
+      {
+         segment++;
+         offset = 0;
+      }
+      package->segment = segment;
+      package->offset = offset;
+
+      while (left)
+      {
+         size_t chunk = vcos_min(left, picture->segments[segment].iov_len - offset);
+
+         checksum += ov528_checksum((const uint8_t *)picture->segments[segment].iov_base + offset, chunk);
+         left -= chunk;
+         offset += chunk;
+         if (offset == picture->segments[segment].iov_len)
+         {
+            segment++;
+            offset = 0;
+         }
+      }
+      package->trailer[0] = checksum;
+      package->trailer[1] = 0;
+   }
+
+   picture->num_packages = num_packages;
+   picture->package_size = ov528->package_size;
+   picture->sent = 0;
+   return 0;
+}
+
+static void ov528_picture_release(RASPI_OV528_T *ov528, OV528_PICTURE_T *picture)
+{
+   void *userdata = picture->picture;
+   int complete = picture->sent == picture->num_packages;
+
+   free(picture->segments);
+   free(picture->packages);
+   memset(picture, 0, sizeof(*picture));
+   if (userdata && ov528->release_callback)
+      ov528->release_callback(ov528->userdata, userdata, complete);
+}
+
+/** Send a package of the current picture, straight from the picture memory */
+static int ov528_send_package(RASPI_OV528_T *ov528, unsigned int id)
+{
+   OV528_PICTURE_T *picture = &ov528->current;
+   const OV528_PACKAGE_T *package = &picture->packages[id];
+   struct iovec iov[RASPI_OV528_MAX_PACKAGE_SIZE + 2];
+   size_t left = package->header[2] | (package->header[3] << 8);
+   unsigned int segment = package->segment;
+   size_t offset = package->offset;
+   int iov_num = 0;
+
+   iov[iov_num].iov_base = (void *)package->header;
+   iov[iov_num++].iov_len = sizeof(package->header);
+   while (left)
+   {
+      size_t chunk = vcos_min(left, picture->segments[segment].iov_len - offset);
+
+      if (chunk)
+      {
+         iov[iov_num].iov_base = (uint8_t *)picture->segments[segment].iov_base + offset;
+         iov[iov_num++].iov_len = chunk;
+      }
+      left -= chunk;
+      segment++;
+      offset = 0;
+   }
+   iov[iov_num].iov_base = (void *)package->trailer;
+   iov[iov_num++].iov_len = sizeof(package->trailer);
+
+   return ov528_writev(ov528->fd, iov, iov_num);
+}
+
+/** The host asks for a package: send it and the rest of the window */
+static void ov528_package_request(RASPI_OV528_T *ov528, unsigned int id)
+{
+   OV528_PICTURE_T *picture = &ov528->current;
+   unsigned int start = id, end;
+
+   if (!picture->picture || id >= picture->num_packages)
+   {
+      vcos_log_error("%s: no package %u to send", __func__, id);
+      return;
+   }
+
+   // The requested package is always sent, the rest of the window only if not sent yet
+   end = vcos_min(id + ov528->window, picture->num_packages);
+   for (; id < end; id++)
+   {
+      if (id != start && id < picture->sent)
+         continue;
+      if (ov528_send_package(ov528, id) < 0)
+      {
+         vcos_log_error("%s: failed to send package %u: %s", __func__, id, strerror(errno));
+         return;
+      }
+      if (id == picture->sent)
+         picture->sent++;
+   }
+}
+
+/** GET_PICTURE: switch to the queued picture and announce its size */
+static void ov528_get_picture(RASPI_OV528_T *ov528, const RASPI_OV528_COMMAND_T *command)
+{
+   if (ov528->next.picture)
+   {
+      ov528_picture_release(ov528, &ov528->current);
+      ov528->current = ov528->next;
+      memset(&ov528->next, 0, sizeof(ov528->next));
+   }
+   if (!ov528->current.picture || ov528_picture_prepare(ov528, &ov528->current) != 0)
+   {
+      raspi_ov528_nak(ov528, 0);
+      return;
+   }
+   ov528->current.sent = 0;
+
+   raspi_ov528_ack(ov528, command->id);
+   ov528_send_command(ov528, RASPI_OV528_DATA, command->param[0], ov528->current.length & 0xFF,
+                      (ov528->current.length >> 8) & 0xFF, (ov528->current.length >> 16) & 0xFF);
+}
+
+static void ov528_set_baud_rate_command(RASPI_OV528_T *ov528, const RASPI_OV528_COMMAND_T *command)
+{
+   unsigned int baud_rate = OV528_BAUD_CLOCK / (command->param[0] + 1) / (command->param[1] + 1);
+   speed_t speed;
+
+   if (ov528_speed(baud_rate, &speed) != 0)
+   {
+      vcos_log_error("%s: unsupported baud rate %u", __func__, baud_rate);
+      raspi_ov528_nak(ov528, 0);
+      return;
+   }
+   // The acknowledgement still goes out at the previous rate
+   raspi_ov528_ack(ov528, command->id);
+   raspi_ov528_set_baud_rate(ov528, baud_rate);
+}
+
+static void ov528_process_command(RASPI_OV528_T *ov528, const RASPI_OV528_COMMAND_T *command)
+{
+   switch (command->id)
+   {
+   case RASPI_OV528_SET_PACKAGE_SIZE:
+   {
+      unsigned int size = command->param[1] | (command->param[2] << 8);
+
+      if (size <= OV528_PACKAGE_HEADER + OV528_PACKAGE_TRAILER || size > RASPI_OV528_MAX_PACKAGE_SIZE)
+      {
+         raspi_ov528_nak(ov528, 0);
+         break;
+      }
+      ov528->package_size = size;
+      raspi_ov528_ack(ov528, command->id);
+      break;
+   }
+   case RASPI_OV528_SET_BAUD_RATE:
+      ov528_set_baud_rate_command(ov528, command);
+      break;
+   case RASPI_OV528_GET_PICTURE:
+      ov528_get_picture(ov528, command);
+      break;
+   case RASPI_OV528_ACK:
+      // Package requests and the end of a transfer come as ACKs of command 0
+      if (command->param[0] == 0)
+      {
+         unsigned int id = command->param[2] | (command->param[3] << 8);
+
+         if (id == OV528_LAST_PACKAGE_ID)
+            ov528_picture_release(ov528, &ov528->current);
+         else
+            ov528_package_request(ov528, id);
+         break;
+      }
+      /* fall through */
+   default:
+      if (ov528->command_callback)
+         ov528->command_callback(ov528, command, ov528->userdata);
+      break;
+   }
+}
+
+void raspi_ov528_feed(RASPI_OV528_T *ov528, const uint8_t *data, size_t length)
+{
+   size_t i;
+
+   for (i = 0; i < length; i++)
+   {
+      // Every command starts with 0xAA, anything else in between is skipped
+      if (ov528->command_length == 0 && data[i] != OV528_COMMAND_START)
+         continue;
+      ov528->command[ov528->command_length++] = data[i];
+      if (ov528->command_length == RASPI_OV528_COMMAND_LENGTH)
+      {
+         RASPI_OV528_COMMAND_T command;
+
+         command.id = ov528->command[1];
+         memcpy(command.param, ov528->command + 2, sizeof(command.param));
+         ov528->command_length = 0;
+         ov528_process_command(ov528, &command);
+      }
+   }
+}
+
+int raspi_ov528_receive(RASPI_OV528_T *ov528)
+{
+   uint8_t buffer[64];
+   int available = 0;
+
+   // Only read what is already there so the caller's loop is never blocked
+   if (ioctl(ov528->fd, FIONREAD, &available) < 0)
+      return -1;
+   while (available > 0)
+   {
+      ssize_t res = read(ov528->fd, buffer, vcos_min((size_t)available, sizeof(buffer)));
+
+      if (res < 0 && errno == EINTR)
+         continue;
+      if (res <= 0)
+         return -1;
+      available -= res;
+      raspi_ov528_feed(ov528, buffer, res);
+   }
+   return 0;
+}
+
+int raspi_ov528_set_picture(RASPI_OV528_T *ov528, const struct iovec *segments, unsigned int num_segments,
+                            void *picture)
+{
+   OV528_PICTURE_T next;
+   unsigned int i;
+
+   if (!picture)
+      return -1;
+
+   memset(&next, 0, sizeof(next));
+   next.segments = malloc((num_segments ? num_segments : 1) * sizeof(*segments));
+   if (!next.segments)
+      return -1;
+   memcpy(next.segments, segments, num_segments * sizeof(*segments));
+   next.num_segments = num_segments;
+   for (i = 0; i < num_segments; i++)
+      next.length += segments[i].iov_len;
+   if (next.length > 0xFFFFFF || ov528_picture_prepare(ov528, &next) != 0)
+   {
+      free(next.segments);
+      free(next.packages);
+      return -1;
+   }
+   next.picture = picture;
+
+   ov528_picture_release(ov528, &ov528->next);
+   ov528->next = next;
+   return 0;
+}
+
+RASPI_OV528_T *raspi_ov528_create(int fd, RASPI_OV528_COMMAND_CALLBACK_T command_callback,
+                                  RASPI_OV528_RELEASE_CALLBACK_T release_callback, void *userdata)
+{
+   RASPI_OV528_T *ov528 = calloc(1, sizeof(*ov528));
+
+   if (!ov528)
+      return NULL;
+
+   ov528->fd = fd;
+   ov528->command_callback = command_callback;
+   ov528->release_callback = release_callback;
+   ov528->userdata = userdata;
+   ov528->package_size = RASPI_OV528_DEFAULT_PACKAGE_SIZE;
+   ov528->window = 1;
+   return ov528;
+}
+
+void raspi_ov528_destroy(RASPI_OV528_T *ov528)
+{
+   if (!ov528)
+      return;
+   ov528_picture_release(ov528, &ov528->next);
+   ov528_picture_release(ov528, &ov528->current);
+   free(ov528);
+}
+
+int raspi_ov528_serial_setup(int fd, unsigned int baud_rate, struct termios *old_settings)
+{
+   struct termios settings;
+   speed_t speed;
+
+   if (ov528_speed(baud_rate, &speed) != 0)
+   {
+      vcos_log_error("%s: unsupported baud rate %u", __func__, baud_rate);
+      return -1;
+   }
+   if (tcgetattr(fd, &settings) != 0)
+      return -1;
+   if (old_settings)
+      *old_settings = settings;
+
+   // 8N1, no flow control, no line discipline or character mapping
+   cfmakeraw(&settings);
+   settings.c_cflag |= CLOCAL | CREAD;
+   settings.c_cflag &= ~(PARENB | CSTOPB | CRTSCTS);
+   cfsetispeed(&settings, speed);
+   cfsetospeed(&settings, speed);
+   settings.c_cc[VTIME] = 1;
+   settings.c_cc[VMIN] = RASPI_OV528_COMMAND_LENGTH;
+   tcflush(fd, TCIFLUSH);
+   return tcsetattr(fd, TCSANOW, &settings);
+}
+
+int raspi_ov528_set_baud_rate(RASPI_OV528_T *ov528, unsigned int baud_rate)
+{
+   struct termios settings;
+   speed_t speed;
+
+   if (ov528_speed(baud_rate, &speed) != 0 || tcgetattr(ov528->fd, &settings) != 0)
+      return -1;
+   tcdrain(ov528->fd);
+   cfsetispeed(&settings, speed);
+   cfsetospeed(&settings, speed);
+   if (tcsetattr(ov528->fd, TCSANOW, &settings) != 0)
+      return -1;
+   ov528->baud_rate = baud_rate;
+   return 0;
+}
+
+void raspi_ov528_set_window(RASPI_OV528_T *ov528, unsigned int window)
+{
+   ov528->window = window ? window : 1;
+}
+
+unsigned int raspi_ov528_get_package_size(RASPI_OV528_T *ov528)
+{
+   return ov528->package_size;
+}
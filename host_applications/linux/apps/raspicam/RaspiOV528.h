@@ -0,0 +1,176 @@
+/*
+Copyright (c) 2018, Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef RASPIOV528_H_
+#define RASPIOV528_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <termios.h>
+#include <sys/uio.h>
+
+/**
+ * OV528 serial camera protocol, camera side.
+ *
+ * Parses the commands sent by the host and transfers pictures in packages.
+ * The headers and checksums of all the packages of a picture are computed
+ * once when the picture is handed over, and package data is written straight
+ * from the picture memory, so a retransmission costs nothing but the write.
+ * Up to a configurable window of packages is sent ahead of the one the host
+ * asks for. The next picture can be queued while the current one is still
+ * being transferred, it replaces it when the host asks for it.
+ *
+ * The engine only uses the file descriptor it is given, so it can be tested
+ * over a pty pair.
+ */
+typedef struct RASPI_OV528_S RASPI_OV528_T;
+
+/// Length of an OV528 command
+#define RASPI_OV528_COMMAND_LENGTH 6
+/// Largest package size a host may set
+#define RASPI_OV528_MAX_PACKAGE_SIZE 512
+/// Package size used until the host sets one
+#define RASPI_OV528_DEFAULT_PACKAGE_SIZE 64
+
+/** Command IDs */
+enum
+{
+   RASPI_OV528_INIT = 0x01,
+   RASPI_OV528_GET_PICTURE = 0x04,
+   RASPI_OV528_SNAPSHOT = 0x05,
+   RASPI_OV528_SET_PACKAGE_SIZE = 0x06,
+   RASPI_OV528_SET_BAUD_RATE = 0x07,
+   RASPI_OV528_RESET = 0x08,
+   RASPI_OV528_POWER_DOWN = 0x09,
+   RASPI_OV528_DATA = 0x0A,
+   RASPI_OV528_SYNC = 0x0D,
+   RASPI_OV528_ACK = 0x0E,
+   RASPI_OV528_NAK = 0x0F
+};
+
+/** A command received from the host */
+typedef struct
+{
+   uint8_t id;                       /// Command ID
+   uint8_t param[4];                 /// Parameters 1 to 4
+} RASPI_OV528_COMMAND_T;
+
+/**
+ * Called for the commands the engine doesn't handle itself, i.e. everything
+ * but SET_PACKAGE_SIZE, SET_BAUD_RATE, GET_PICTURE and the package ACKs.
+ * The handler answers with raspi_ov528_ack() or raspi_ov528_nak().
+ */
+typedef void (*RASPI_OV528_COMMAND_CALLBACK_T)(RASPI_OV528_T *ov528, const RASPI_OV528_COMMAND_T *command,
+                                               void *userdata);
+
+/**
+ * Called when the engine is done with a picture
+ *
+ * @param picture Userdata given with raspi_ov528_set_picture()
+ * @param complete Set if every package of the picture has been sent
+ */
+typedef void (*RASPI_OV528_RELEASE_CALLBACK_T)(void *userdata, void *picture, int complete);
+
+/**
+ * Create a protocol engine
+ *
+ * @param fd Serial port, already set up with raspi_ov528_serial_setup()
+ * @param command_callback Handler for the other commands
+ * @param release_callback Called when a picture isn't needed anymore, may be NULL
+ * @param userdata Passed to the callbacks
+ *
+ * @return The new engine or NULL on failure
+ */
+RASPI_OV528_T *raspi_ov528_create(int fd, RASPI_OV528_COMMAND_CALLBACK_T command_callback,
+                                  RASPI_OV528_RELEASE_CALLBACK_T release_callback, void *userdata);
+
+/** Destroy an engine. Pictures still held are released. The fd is not closed. */
+void raspi_ov528_destroy(RASPI_OV528_T *ov528);
+
+/**
+ * Set up a serial port for the protocol: 8N1, raw, no flow control
+ *
+ * @param baud_rate Baud rate, e.g. 115200
+ * @param old_settings If not NULL, filled in with the previous settings
+ *
+ * @return 0 on success, -1 if the baud rate is not supported or the port can't be set up
+ */
+int raspi_ov528_serial_setup(int fd, unsigned int baud_rate, struct termios *old_settings);
+
+/**
+ * Change the baud rate. Waits until everything written so far has been sent.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int raspi_ov528_set_baud_rate(RASPI_OV528_T *ov528, unsigned int baud_rate);
+
+/**
+ * Set the number of packages sent per package request. 1 (the default) is the
+ * plain OV528 behaviour, larger windows need a host that buffers the packages
+ * it hasn't asked for yet.
+ */
+void raspi_ov528_set_window(RASPI_OV528_T *ov528, unsigned int window);
+
+/**
+ * Read what is available on the serial port without blocking and process the
+ * commands received. To be called when the fd is readable.
+ *
+ * @return 0 on success, -1 if the port failed or was closed
+ */
+int raspi_ov528_receive(RASPI_OV528_T *ov528);
+
+/**
+ * Process bytes received from the host. Commands may be split across calls,
+ * bytes outside of a command are skipped.
+ */
+void raspi_ov528_feed(RASPI_OV528_T *ov528, const uint8_t *data, size_t length);
+
+/** Acknowledge a command. @return 0 on success, -1 on failure */
+int raspi_ov528_ack(RASPI_OV528_T *ov528, uint8_t command_id);
+
+/** Reject a command. @return 0 on success, -1 on failure */
+int raspi_ov528_nak(RASPI_OV528_T *ov528, uint8_t error);
+
+/**
+ * Queue the next picture. The headers and checksums of its packages are
+ * computed right away. It becomes the current picture on the next GET_PICTURE,
+ * a picture queued before and not asked for yet is released.
+ *
+ * @param segments The picture data, in order. The memory must stay valid until
+ *                 the picture is released.
+ * @param num_segments Number of entries in segments
+ * @param picture Passed to the release callback
+ *
+ * @return 0 on success, -1 on failure (the picture is not released)
+ */
+int raspi_ov528_set_picture(RASPI_OV528_T *ov528, const struct iovec *segments, unsigned int num_segments,
+                            void *picture);
+
+/** Current package size */
+unsigned int raspi_ov528_get_package_size(RASPI_OV528_T *ov528);
+
+#endif /* RASPIOV528_H_ */
@@ -0,0 +1,452 @@
+/*
+Copyright (c) 2018, Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "interface/vcos/vcos.h"
+#include "interface/mmal/mmal.h"
+#include "interface/mmal/mmal_logging.h"
+
+#include "RaspiRingBuf.h"
+
+/// Maximum size of the codec config (SPS/PPS) kept for the start of a dump
+#define RINGBUF_MAX_HEADER 256
+/// Amount of data copied out of the ring at a time while dumping
+#define RINGBUF_DUMP_CHUNK (64 * 1024)
+
+/** Entry of the key frame index */
+typedef struct
+{
+   uint64_t offset;                  /// Stream offset of the first byte of the key frame
+   int64_t pts;                      /// Presentation time of the key frame
+   uint64_t frame;                   /// Number of the key frame in the frame index
+} RINGBUF_KEYFRAME_T;
+
+/** Entry of the frame index */
+typedef struct
+{
+   uint64_t offset;                  /// Stream offset of the first byte of the frame
+   int64_t pts;                      /// Presentation time of the frame
+   uint32_t flags;                   /// MMAL_BUFFER_HEADER_FLAG_KEYFRAME if it is a key frame
+} RINGBUF_FRAME_T;
+
+struct RASPICAM_RINGBUF_S
+{
+   pthread_mutex_t lock;
+
+   uint8_t *data;
+   size_t size;
+   uint64_t write_offset;            /// Number of bytes pushed so far. Offset x is stored at x % size
+
+   unsigned int max_frames;          /// Size of both the frame and the key frame rings
+
+   RINGBUF_KEYFRAME_T *keyframes;    /// Ring of indexed key frames, oldest first
+   unsigned int first_keyframe;
+   unsigned int num_keyframes;
+
+   RINGBUF_FRAME_T *frames;          /// Ring of indexed frames. Frame n is stored at n % max_frames
+   uint64_t first_frame;             /// Number of the oldest frame indexed
+   uint64_t num_frames;              /// Number of frames pushed so far
+
+   uint64_t frame_start;             /// Stream offset of the frame being received
+   int64_t frame_pts;                /// Presentation time of the frame being received
+   int in_frame;                     /// Part of a frame has been received
+   int frame_indexed;                /// The frame being received is already in the index
+   int64_t last_pts;                 /// Newest known presentation time
+
+   uint8_t header[RINGBUF_MAX_HEADER];
+   unsigned int header_length;
+   int header_done;                  /// Stream data followed the header, the next config replaces it
+
+   RASPICAM_RINGBUF_SINK_T sink;     /// Live sink, called for each push
+   void *sink_userdata;
+};
+
+/** Oldest stream offset still held in the ring */
+static uint64_t ringbuf_oldest(const RASPICAM_RINGBUF_T *ringbuf)
+{
+   return ringbuf->write_offset > ringbuf->size ? ringbuf->write_offset - ringbuf->size : 0;
+}
+
+/** Copy length bytes at stream offset out of the ring */
+static void ringbuf_read(const RASPICAM_RINGBUF_T *ringbuf, uint64_t offset, uint8_t *dest, size_t length)
+{
+   size_t pos = offset % ringbuf->size;
+   size_t to_end = ringbuf->size - pos;
+
+   if (to_end > length)
+      to_end = length;
+   memcpy(dest, ringbuf->data + pos, to_end);
+   memcpy(dest + to_end, ringbuf->data, length - to_end);
+}
+
+static int ringbuf_write_all(int fd, const uint8_t *data, size_t length)
+{
+   while (length)
+   {
+      ssize_t written = write(fd, data, length);
+
+      if (written < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         return -1;
+      }
+      data += written;
+      length -= written;
+   }
+   return 0;
+}
+
+RASPICAM_RINGBUF_T *raspicam_ringbuf_create(size_t size, unsigned int max_frames)
+{
+   RASPICAM_RINGBUF_T *ringbuf;
+
+   if (!size || !max_frames)
+      return NULL;
+
+   ringbuf = calloc(1, sizeof(*ringbuf));
+   if (!ringbuf)
+      return NULL;
+
+   ringbuf->data = malloc(size);
+   ringbuf->keyframes = calloc(max_frames, sizeof(*ringbuf->keyframes));
+   ringbuf->frames = calloc(max_frames, sizeof(*ringbuf->frames));
+   if (!ringbuf->data || !ringbuf->keyframes || !ringbuf->frames)
+   {
+      vcos_log_error("%s: unable to allocate %zu bytes ring buffer", __func__, size);
+      free(ringbuf->data);
+      free(ringbuf->keyframes);
+      free(ringbuf->frames);
+      free(ringbuf);
+      return NULL;
+   }
+
+   ringbuf->size = size;
+   ringbuf->max_frames = max_frames;
+   ringbuf->last_pts = MMAL_TIME_UNKNOWN;
+   pthread_mutex_init(&ringbuf->lock, NULL);
+
+   return ringbuf;
+}
+
+void raspicam_ringbuf_destroy(RASPICAM_RINGBUF_T *ringbuf)
+{
+   if (!ringbuf)
+      return;
+
+   pthread_mutex_destroy(&ringbuf->lock);
+   free(ringbuf->frames);
+   free(ringbuf->keyframes);
+   free(ringbuf->data);
+   free(ringbuf);
+}
+
+void raspicam_ringbuf_push(RASPICAM_RINGBUF_T *ringbuf, const uint8_t *data, size_t length,
+                           uint32_t flags, int64_t pts, void *buffer)
+{
+   pthread_mutex_lock(&ringbuf->lock);
+
+   if (flags & MMAL_BUFFER_HEADER_FLAG_CONFIG)
+   {
+      if (ringbuf->header_done)
+      {
+         ringbuf->header_length = 0;
+         ringbuf->header_done = 0;
+      }
+      if (ringbuf->header_length + length > sizeof(ringbuf->header))
+      {
+         vcos_log_error("%s: codec config too large (%zu bytes)", __func__, ringbuf->header_length + length);
+      }
+      else
+      {
+         memcpy(ringbuf->header + ringbuf->header_length, data, length);
+         ringbuf->header_length += length;
+      }
+   }
+   else if (!(flags & MMAL_BUFFER_HEADER_FLAG_CODECSIDEINFO) && length)
+   {
+      RINGBUF_FRAME_T *frame;
+      uint64_t oldest;
+
+      ringbuf->header_done = 1;
+
+      if (!ringbuf->in_frame)
+      {
+         ringbuf->in_frame = 1;
+         ringbuf->frame_indexed = 0;
+         ringbuf->frame_start = ringbuf->write_offset;
+         ringbuf->frame_pts = MMAL_TIME_UNKNOWN;
+
+         // A full index forgets its oldest frame
+         if (ringbuf->num_frames - ringbuf->first_frame == ringbuf->max_frames)
+            ringbuf->first_frame++;
+         frame = &ringbuf->frames[ringbuf->num_frames++ % ringbuf->max_frames];
+         frame->offset = ringbuf->frame_start;
+         frame->pts = MMAL_TIME_UNKNOWN;
+         frame->flags = 0;
+      }
+      frame = &ringbuf->frames[(ringbuf->num_frames - 1) % ringbuf->max_frames];
+      if (pts != MMAL_TIME_UNKNOWN)
+      {
+         if (ringbuf->frame_pts == MMAL_TIME_UNKNOWN)
+            ringbuf->frame_pts = frame->pts = pts;
+         ringbuf->last_pts = pts;
+      }
+      frame->flags |= flags & MMAL_BUFFER_HEADER_FLAG_KEYFRAME;
+
+      if ((flags & MMAL_BUFFER_HEADER_FLAG_KEYFRAME) && !ringbuf->frame_indexed)
+      {
+         RINGBUF_KEYFRAME_T *keyframe;
+
+         // A full index forgets its oldest key frame
+         if (ringbuf->num_keyframes == ringbuf->max_frames)
+         {
+            ringbuf->first_keyframe = (ringbuf->first_keyframe + 1) % ringbuf->max_frames;
+            ringbuf->num_keyframes--;
+         }
+         keyframe = &ringbuf->keyframes[(ringbuf->first_keyframe + ringbuf->num_keyframes) % ringbuf->max_frames];
+         keyframe->offset = ringbuf->frame_start;
+         keyframe->pts = ringbuf->frame_pts != MMAL_TIME_UNKNOWN ? ringbuf->frame_pts : ringbuf->last_pts;
+         keyframe->frame = ringbuf->num_frames - 1;
+         ringbuf->num_keyframes++;
+         ringbuf->frame_indexed = 1;
+      }
+
+      // Only the tail of a buffer larger than the ring is kept
+      if (length > ringbuf->size)
+      {
+         ringbuf->write_offset += length - ringbuf->size;
+         data += length - ringbuf->size;
+         length = ringbuf->size;
+      }
+      {
+         size_t pos = ringbuf->write_offset % ringbuf->size;
+         size_t to_end = ringbuf->size - pos;
+
+         if (to_end > length)
+            to_end = length;
+         memcpy(ringbuf->data + pos, data, to_end);
+         memcpy(ringbuf->data, data + to_end, length - to_end);
+      }
+      ringbuf->write_offset += length;
+
+      // Forget the key frames that have just been overwritten
+      oldest = ringbuf_oldest(ringbuf);
+      while (ringbuf->num_keyframes && ringbuf->keyframes[ringbuf->first_keyframe].offset < oldest)
+      {
+         ringbuf->first_keyframe = (ringbuf->first_keyframe + 1) % ringbuf->max_frames;
+         ringbuf->num_keyframes--;
+      }
+      while (ringbuf->first_frame < ringbuf->num_frames &&
+             ringbuf->frames[ringbuf->first_frame % ringbuf->max_frames].offset < oldest)
+         ringbuf->first_frame++;
+
+      if (flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END)
+         ringbuf->in_frame = 0;
+   }
+
+   if (ringbuf->sink)
+      ringbuf->sink(ringbuf->sink_userdata, buffer);
+
+   pthread_mutex_unlock(&ringbuf->lock);
+}
+
+/** Output of raspicam_ringbuf_dump(), writes everything to a file descriptor */
+static int ringbuf_output_fd(void *userdata, const uint8_t *data, size_t length,
+                             uint32_t flags, int64_t pts)
+{
+   if (ringbuf_write_all(*(int *)userdata, data, length) < 0)
+   {
+      vcos_log_error("%s: write failed: %s", __func__, strerror(errno));
+      return -1;
+   }
+   return 0;
+}
+
+/**
+ * Write the end of the stream out, starting at a key frame
+ *
+ * @param frames If set, the data is written out one frame at a time, with the
+ *               frame flags and presentation time. Otherwise it is written out
+ *               in large chunks.
+ */
+static int64_t ringbuf_dump(RASPICAM_RINGBUF_T *ringbuf, uint32_t duration, int frames,
+                            RASPICAM_RINGBUF_FRAME_T output, void *output_userdata,
+                            RASPICAM_RINGBUF_SINK_T sink, void *sink_userdata)
+{
+   uint8_t header[RINGBUF_MAX_HEADER];
+   unsigned int header_length, i;
+   uint64_t pos, end, frame;
+   int64_t total;
+   uint8_t *chunk;
+
+   chunk = malloc(RINGBUF_DUMP_CHUNK);
+   if (!chunk)
+      return -1;
+
+   pthread_mutex_lock(&ringbuf->lock);
+
+   if (!ringbuf->num_keyframes)
+   {
+      // Nothing decodable yet, go live straight away
+      if (sink)
+      {
+         ringbuf->sink = sink;
+         ringbuf->sink_userdata = sink_userdata;
+      }
+      pthread_mutex_unlock(&ringbuf->lock);
+      free(chunk);
+      return 0;
+   }
+
+   // Newest key frame at least duration old, searching back from the newest one
+   i = ringbuf->num_keyframes - 1;
+   if (duration == RASPICAM_RINGBUF_DUMP_ALL)
+   {
+      i = 0;
+   }
+   else if (ringbuf->last_pts != MMAL_TIME_UNKNOWN)
+   {
+      int64_t start_pts = ringbuf->last_pts - (int64_t)duration * 1000;
+
+      while (i > 0 && ringbuf->keyframes[(ringbuf->first_keyframe + i) % ringbuf->max_frames].pts > start_pts)
+         i--;
+   }
+   pos = ringbuf->keyframes[(ringbuf->first_keyframe + i) % ringbuf->max_frames].offset;
+   frame = ringbuf->keyframes[(ringbuf->first_keyframe + i) % ringbuf->max_frames].frame;
+   end = ringbuf->write_offset;
+
+   header_length = ringbuf->header_length;
+   memcpy(header, ringbuf->header, header_length);
+
+   pthread_mutex_unlock(&ringbuf->lock);
+
+   if (header_length &&
+       output(output_userdata, header, header_length, MMAL_BUFFER_HEADER_FLAG_CONFIG |
+              MMAL_BUFFER_HEADER_FLAG_FRAME_START | MMAL_BUFFER_HEADER_FLAG_FRAME_END, MMAL_TIME_UNKNOWN) < 0)
+      goto error;
+   total = header_length;
+
+   while (1)
+   {
+      uint32_t flags = 0;
+      int64_t pts = MMAL_TIME_UNKNOWN;
+      size_t length;
+
+      pthread_mutex_lock(&ringbuf->lock);
+
+      if (pos < ringbuf_oldest(ringbuf) || (frames && frame < ringbuf->first_frame))
+      {
+         pthread_mutex_unlock(&ringbuf->lock);
+         vcos_log_error("%s: encoder overtook the dump after %lld bytes", __func__, (long long)total);
+         goto error;
+      }
+
+      if (sink)
+      {
+         // Caught up: everything pushed from now on goes to the sink
+         if (pos == ringbuf->write_offset)
+         {
+            ringbuf->sink = sink;
+            ringbuf->sink_userdata = sink_userdata;
+            pthread_mutex_unlock(&ringbuf->lock);
+            break;
+         }
+         end = ringbuf->write_offset;
+      }
+      else if (pos == end)
+      {
+         pthread_mutex_unlock(&ringbuf->lock);
+         break;
+      }
+
+      length = end - pos < RINGBUF_DUMP_CHUNK ? end - pos : RINGBUF_DUMP_CHUNK;
+
+      // Stop at the end of the frame. The last one may still be incomplete.
+      if (frames)
+      {
+         const RINGBUF_FRAME_T *entry = &ringbuf->frames[frame % ringbuf->max_frames];
+         int complete = frame + 1 < ringbuf->num_frames || !ringbuf->in_frame;
+         uint64_t frame_end = frame + 1 < ringbuf->num_frames ?
+            ringbuf->frames[(frame + 1) % ringbuf->max_frames].offset : ringbuf->write_offset;
+
+         if (pos + length > frame_end)
+            length = frame_end - pos;
+         flags = entry->flags;
+         pts = entry->pts;
+         if (pos == entry->offset)
+            flags |= MMAL_BUFFER_HEADER_FLAG_FRAME_START;
+         if (complete && pos + length == frame_end)
+         {
+            flags |= MMAL_BUFFER_HEADER_FLAG_FRAME_END;
+            frame++;
+         }
+      }
+      ringbuf_read(ringbuf, pos, chunk, length);
+
+      pthread_mutex_unlock(&ringbuf->lock);
+
+      if (output(output_userdata, chunk, length, flags, pts) < 0)
+         goto error;
+      pos += length;
+      total += length;
+   }
+
+   free(chunk);
+   return total;
+
+error:
+   free(chunk);
+   return -1;
+}
+
+int64_t raspicam_ringbuf_dump(RASPICAM_RINGBUF_T *ringbuf, int fd, uint32_t duration,
+                              RASPICAM_RINGBUF_SINK_T sink, void *sink_userdata)
+{
+   return ringbuf_dump(ringbuf, duration, 0, ringbuf_output_fd, &fd, sink, sink_userdata);
+}
+
+int64_t raspicam_ringbuf_dump_frames(RASPICAM_RINGBUF_T *ringbuf, uint32_t duration,
+                                     RASPICAM_RINGBUF_FRAME_T output, void *output_userdata,
+                                     RASPICAM_RINGBUF_SINK_T sink, void *sink_userdata)
+{
+   return ringbuf_dump(ringbuf, duration, 1, output, output_userdata, sink, sink_userdata);
+}
+
+void raspicam_ringbuf_set_sink(RASPICAM_RINGBUF_T *ringbuf, RASPICAM_RINGBUF_SINK_T sink, void *sink_userdata)
+{
+   pthread_mutex_lock(&ringbuf->lock);
+   ringbuf->sink = sink;
+   ringbuf->sink_userdata = sink_userdata;
+   pthread_mutex_unlock(&ringbuf->lock);
+}
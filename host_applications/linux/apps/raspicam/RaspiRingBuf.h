@@ -0,0 +1,147 @@
+/*
+Copyright (c) 2018, Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef RASPIRINGBUF_H_
+#define RASPIRINGBUF_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Pre-event ring buffer for an encoded H.264 stream.
+ *
+ * Keeps the most recent encoder output in a fixed size byte ring together with
+ * an index of the frames and key frames still held in it, so that the footage
+ * preceding an event can be written out starting at a key frame. The indexes
+ * are updated in constant time per buffer, no start code scanning is needed.
+ *
+ * Buffers are pushed from the encoder callback while dumps run from any other
+ * thread; capture carries on during a dump. A dump can optionally hand the
+ * stream over to a live sink once it has caught up with the encoder, so that
+ * a recording starts with the pre-event footage and continues seamlessly.
+ */
+typedef struct RASPICAM_RINGBUF_S RASPICAM_RINGBUF_T;
+
+/**
+ * Live sink of a ring buffer, called for all the data pushed once a dump has
+ * caught up with the encoder. It is called with the ring buffer locked so it
+ * must not block.
+ *
+ * @param userdata Userdata given with the sink
+ * @param buffer Opaque pointer given to raspicam_ringbuf_push() with the data
+ */
+typedef void (*RASPICAM_RINGBUF_SINK_T)(void *userdata, void *buffer);
+
+/**
+ * Create a ring buffer
+ *
+ * @param size Size of the ring in bytes, typically bitrate / 8 * seconds
+ * @param max_frames Maximum number of frames indexed, typically frame rate * seconds.
+ *                   The key frames are a subset of them and use the same limit.
+ *                   Older ones are forgotten first.
+ *
+ * @return The new ring buffer or NULL on failure
+ */
+RASPICAM_RINGBUF_T *raspicam_ringbuf_create(size_t size, unsigned int max_frames);
+
+/** Destroy a ring buffer. No dump may be running. */
+void raspicam_ringbuf_destroy(RASPICAM_RINGBUF_T *ringbuf);
+
+/**
+ * Add encoder output to the ring
+ *
+ * Codec config (SPS/PPS) is kept aside and written at the start of every dump.
+ * Codec side info (motion vectors) is ignored.
+ *
+ * @param data Encoded data
+ * @param length Number of bytes
+ * @param flags MMAL_BUFFER_HEADER_FLAG_* of the buffer holding the data
+ * @param pts Presentation time of the data in microseconds, or MMAL_TIME_UNKNOWN
+ * @param buffer Passed to the live sink, if one is set, typically the MMAL
+ *               buffer header holding the data
+ */
+void raspicam_ringbuf_push(RASPICAM_RINGBUF_T *ringbuf, const uint8_t *data, size_t length,
+                           uint32_t flags, int64_t pts, void *buffer);
+
+/// Duration to pass to raspicam_ringbuf_dump() to write everything held
+#define RASPICAM_RINGBUF_DUMP_ALL UINT32_MAX
+
+/**
+ * Write the end of the stream to a file descriptor, starting at a key frame
+ *
+ * The dump starts at the newest key frame at least duration old, or the oldest
+ * key frame held if the ring doesn't go back that far. It only fails if the
+ * encoder overwrites data before it could be written out.
+ *
+ * @param fd File descriptor to write to
+ * @param duration Amount of footage wanted in milliseconds. 0 starts at the
+ *                 newest key frame, RASPICAM_RINGBUF_DUMP_ALL at the oldest.
+ * @param sink If not NULL, keep writing data pushed during the dump until the
+ *             dump has caught up with the encoder, then hand everything
+ *             pushed from then on to sink
+ * @param sink_userdata Passed to sink
+ *
+ * @return Number of bytes written or -1 on failure
+ */
+int64_t raspicam_ringbuf_dump(RASPICAM_RINGBUF_T *ringbuf, int fd, uint32_t duration,
+                              RASPICAM_RINGBUF_SINK_T sink, void *sink_userdata);
+
+/**
+ * Output of raspicam_ringbuf_dump_frames()
+ *
+ * @param userdata Userdata given with the output
+ * @param data Encoded data, a complete frame or part of one
+ * @param length Number of bytes
+ * @param flags MMAL_BUFFER_HEADER_FLAG_FRAME_START / FRAME_END where the data
+ *              starts / ends a frame, plus KEYFRAME or CONFIG
+ * @param pts Presentation time of the frame, or MMAL_TIME_UNKNOWN
+ *
+ * @return 0 on success, -1 to abort the dump
+ */
+typedef int (*RASPICAM_RINGBUF_FRAME_T)(void *userdata, const uint8_t *data, size_t length,
+                                        uint32_t flags, int64_t pts);
+
+/**
+ * Same as raspicam_ringbuf_dump() but hand the data to output one frame at a
+ * time, for writers which need frame boundaries and timestamps (e.g. a
+ * container). The codec config comes first. Frames larger than the dump chunk
+ * size and the frame still being received are split, in which case only the
+ * last piece carries MMAL_BUFFER_HEADER_FLAG_FRAME_END.
+ *
+ * @return Number of bytes written or -1 on failure
+ */
+int64_t raspicam_ringbuf_dump_frames(RASPICAM_RINGBUF_T *ringbuf, uint32_t duration,
+                                     RASPICAM_RINGBUF_FRAME_T output, void *output_userdata,
+                                     RASPICAM_RINGBUF_SINK_T sink, void *sink_userdata);
+
+/**
+ * Set or clear (NULL) the live sink. Once the call returns the previous sink
+ * is not called anymore.
+ */
+void raspicam_ringbuf_set_sink(RASPICAM_RINGBUF_T *ringbuf, RASPICAM_RINGBUF_SINK_T sink, void *sink_userdata);
+
+#endif /* RASPIRINGBUF_H_ */
@@ -75,6 +75,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "interface/mmal/mmal_buffer.h"
 #include "interface/mmal/util/mmal_util.h"
 #include "interface/mmal/util/mmal_util_params.h"
+#include "interface/mmal/util/mmal_util_convert.h"
 #include "interface/mmal/util/mmal_default_components.h"
 #include "interface/mmal/util/mmal_connection.h"
 #include "interface/mmal/mmal_parameters_camera.h"
@@ -85,6 +86,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "RaspiCLI.h"
 #include "RaspiHelpers.h"
 #include "RaspiGPS.h"
+#include "RaspiWriter.h"
+#include "RaspiRingBuf.h"
 
 #include <semaphore.h>
 
@@ -107,6 +110,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /// Video render needs at least 2 buffers.
 #define VIDEO_OUTPUT_BUFFERS_NUM 3
 
+// Number of encoded video buffers the storage writer may hold before dropping frames
+#define WRITER_QUEUE_DEPTH 8
+
 // Max bitrate we allow for recording
 const int MAX_BITRATE_MJPEG = 25000000; // 25Mbits/s
 const int MAX_BITRATE_LEVEL4 = 25000000; // 25Mbits/s
@@ -137,21 +143,15 @@ typedef struct
    FILE *file_handle;                   /// File handle to write buffer data to.
    RASPIVID_STATE *pstate;              /// pointer to our state in case required in callback
    int abort;                           /// Set to 1 in callback if an error occurs to attempt to abort the capture
-   char *cb_buff;                       /// Circular buffer
-   int   cb_len;                        /// Length of buffer
-   int   cb_wptr;                       /// Current write pointer
-   int   cb_wrap;                       /// Has buffer wrapped at least once?
-   int   cb_data;                       /// Valid bytes in buffer
-#define IFRAME_BUFSIZE (60*1000)
-   int   iframe_buff[IFRAME_BUFSIZE];          /// buffer of iframe pointers
-   int   iframe_buff_wpos;
-   int   iframe_buff_rpos;
-   char  header_bytes[29];
-   int  header_wptr;
+   RASPICAM_RINGBUF_T *ringbuf;         /// Circular buffer
    FILE *imv_file_handle;               /// File handle to write inline motion vectors to.
    FILE *raw_file_handle;               /// File handle to write raw data to.
+   uint8_t *raw_buffer;                 /// Raw frame converted before being written, e.g. luma only
+   uint32_t raw_buffer_size;            /// Size of raw_buffer
    int  flush_buffers;
    FILE *pts_file_handle;               /// File timestamps
+   RASPI_WRITER_T *writer;              /// Asynchronous writer for file_handle, NULL to write from the callback
+   VC_CONTAINER_T *container;           /// MP4 file written instead of file_handle
 } PORT_USERDATA;
 
 /** Possible raw output formats
@@ -191,6 +191,7 @@ struct RASPIVID_STATE_S
    int segmentNumber;                  /// Current segment counter
    int splitNow;                       /// Split at next possible i-frame if set to 1.
    int splitWait;                      /// Switch if user wants splited files
+   int fragmentSize;                   /// Duration of the fragments of an MP4 output in ms, 0 for a regular MP4
 
    RASPIPREVIEW_PARAMETERS preview_parameters;   /// Preview setup parameters
    RASPICAM_CAMERA_PARAMETERS camera_parameters; /// Camera setup parameters
@@ -308,7 +309,8 @@ enum
    CommandRawFormat,
    CommandNetListen,
    CommandSPSTimings,
-   CommandSlices
+   CommandSlices,
+   CommandFragment
 };
 
 static COMMAND_LIST cmdline_commands[] =
@@ -342,6 +344,7 @@ static COMMAND_LIST cmdline_commands[] =
    { CommandNetListen,     "-listen",     "l", "Listen on a TCP socket", 0},
    { CommandSPSTimings,    "-spstimings",    "stm", "Add in h.264 sps timings", 0},
    { CommandSlices   ,     "-slices",     "sl", "Horizontal slices per frame. Default 1 (off)", 1},
+   { CommandFragment,      "-fragment",   "fg", "Write a fragmented MP4 with fragments of <ms>. Output is MP4 if the filename ends in .mp4", 1},
 };
 
 static int cmdline_commands_size = sizeof(cmdline_commands) / sizeof(cmdline_commands[0]);
@@ -406,6 +409,7 @@ static void default_status(RASPIVID_STATE *state)
    state->segmentWrap = 0; // Point at which to wrap segment number back to 1. 0 = no wrap
    state->splitNow = 0;
    state->splitWait = 0;
+   state->fragmentSize = 0;
    state->inlineMotionVectors = 0;
    state->intra_refresh_type = -1;
    state->frame = 0;
@@ -917,6 +921,15 @@ static int parse_cmdline(int argc, const char **argv, RASPIVID_STATE *state)
          break;
       }
 
+      case CommandFragment:
+      {
+         if ((sscanf(argv[i + 1], "%d", &state->fragmentSize) == 1) && (state->fragmentSize >= 0))
+            i++;
+         else
+            valid = 0;
+         break;
+      }
+
       case CommandSPSTimings:
       {
          state->addSPSTiming = MMAL_TRUE;
@@ -961,13 +974,15 @@ static int parse_cmdline(int argc, const char **argv, RASPIVID_STATE *state)
 }
 
 /**
- * Open a file based on the settings in state
+ * Build the name of the current segment in segment or split mode
  *
  * @param state Pointer to state
+ * @param filename Filename given on the command line
+ *
+ * @return The allocated segment filename, or NULL when not segmenting
  */
-static FILE *open_filename(RASPIVID_STATE *pState, char *filename)
+static char *segment_filename(RASPIVID_STATE *pState, const char *filename)
 {
-   FILE *new_handle = NULL;
    char *tempname = NULL;
 
    if (pState->segmentSize || pState->splitWait)
@@ -998,10 +1013,72 @@ static FILE *open_filename(RASPIVID_STATE *pState, char *filename)
          strftime(temp_ts_str, 100, filename, tm);
          asprintf(&tempname, "%s", temp_ts_str);
       }
+   }
+
+   return tempname;
+}
+
+/**
+ * Whether the output goes to an MP4 file rather than a raw stream
+ */
+static int is_mp4_filename(const char *filename)
+{
+   size_t len = filename ? strlen(filename) : 0;
+
+   return len > 4 && !strcasecmp(filename + len - 4, ".mp4") &&
+          strncmp("tcp://", filename, 6) && strncmp("udp://", filename, 6);
+}
 
+/**
+ * Open an MP4 file for the encoder output based on the settings in state
+ *
+ * @param state Pointer to state
+ */
+static VC_CONTAINER_T *open_container(RASPIVID_STATE *pState, char *filename)
+{
+   VC_CONTAINER_T *container;
+   char *tempname = segment_filename(pState, filename);
+
+   if (tempname)
       filename = tempname;
+
+   container = raspi_writer_open_mp4(filename, pState->encoder_component->output[0], pState->fragmentSize);
+
+   if (pState->common_settings.verbose)
+   {
+      if (container)
+         fprintf(stderr, "Opening output file \"%s\"\n", filename);
+      else
+         fprintf(stderr, "Failed to open new file \"%s\"\n", filename);
    }
 
+   if (tempname)
+      free(tempname);
+
+   return container;
+}
+
+/**
+ * Write a frame of the circular buffer to the MP4 output
+ */
+static int circular_output(void *userdata, const uint8_t *data, size_t length, uint32_t flags, int64_t pts)
+{
+   return raspi_writer_container_write((VC_CONTAINER_T *)userdata, data, length, flags, pts);
+}
+
+/**
+ * Open a file based on the settings in state
+ *
+ * @param state Pointer to state
+ */
+static FILE *open_filename(RASPIVID_STATE *pState, char *filename)
+{
+   FILE *new_handle = NULL;
+   char *tempname = segment_filename(pState, filename);
+
+   if (tempname)
+      filename = tempname;
+
    if (filename)
    {
       bool bNetwork = false;
@@ -1221,87 +1298,14 @@ static void encoder_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
       int bytes_written = buffer->length;
       int64_t current_time = get_microseconds64()/1000;
 
-      vcos_assert(pData->file_handle);
+      vcos_assert(pData->file_handle || pData->container);
       if(pData->pstate->inlineMotionVectors) vcos_assert(pData->imv_file_handle);
 
-      if (pData->cb_buff)
+      if (pData->ringbuf)
       {
-         int space_in_buff = pData->cb_len - pData->cb_wptr;
-         int copy_to_end = space_in_buff > buffer->length ? buffer->length : space_in_buff;
-         int copy_to_start = buffer->length - copy_to_end;
-
-         if(buffer->flags & MMAL_BUFFER_HEADER_FLAG_CONFIG)
-         {
-            if(pData->header_wptr + buffer->length > sizeof(pData->header_bytes))
-            {
-               vcos_log_error("Error in header bytes\n");
-            }
-            else
-            {
-               // These are the header bytes, save them for final output
-               mmal_buffer_header_mem_lock(buffer);
-               memcpy(pData->header_bytes + pData->header_wptr, buffer->data, buffer->length);
-               mmal_buffer_header_mem_unlock(buffer);
-               pData->header_wptr += buffer->length;
-            }
-         }
-         else if((buffer->flags & MMAL_BUFFER_HEADER_FLAG_CODECSIDEINFO))
-         {
-            // Do something with the inline motion vectors...
-         }
-         else
-         {
-            static int frame_start = -1;
-            int i;
-
-            if(frame_start == -1)
-               frame_start = pData->cb_wptr;
-
-            if(buffer->flags & MMAL_BUFFER_HEADER_FLAG_KEYFRAME)
-            {
-               pData->iframe_buff[pData->iframe_buff_wpos] = frame_start;
-               pData->iframe_buff_wpos = (pData->iframe_buff_wpos + 1) % IFRAME_BUFSIZE;
-            }
-
-            if(buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END)
-               frame_start = -1;
-
-            // If we overtake the iframe rptr then move the rptr along
-            if((pData->iframe_buff_rpos + 1) % IFRAME_BUFSIZE != pData->iframe_buff_wpos)
-            {
-               while(
-                  (
-                     pData->cb_wptr <= pData->iframe_buff[pData->iframe_buff_rpos] &&
-                     (pData->cb_wptr + buffer->length) > pData->iframe_buff[pData->iframe_buff_rpos]
-                  ) ||
-                  (
-                     (pData->cb_wptr > pData->iframe_buff[pData->iframe_buff_rpos]) &&
-                     (pData->cb_wptr + buffer->length) > (pData->iframe_buff[pData->iframe_buff_rpos] + pData->cb_len)
-                  )
-               )
-                  pData->iframe_buff_rpos = (pData->iframe_buff_rpos + 1) % IFRAME_BUFSIZE;
-            }
-
-            mmal_buffer_header_mem_lock(buffer);
-            // We are pushing data into a circular buffer
-            memcpy(pData->cb_buff + pData->cb_wptr, buffer->data, copy_to_end);
-            memcpy(pData->cb_buff, buffer->data + copy_to_end, copy_to_start);
-            mmal_buffer_header_mem_unlock(buffer);
-
-            if((pData->cb_wptr + buffer->length) > pData->cb_len)
-               pData->cb_wrap = 1;
-
-            pData->cb_wptr = (pData->cb_wptr + buffer->length) % pData->cb_len;
-
-            for(i = pData->iframe_buff_rpos; i != pData->iframe_buff_wpos; i = (i + 1) % IFRAME_BUFSIZE)
-            {
-               int p = pData->iframe_buff[i];
-               if(pData->cb_buff[p] != 0 || pData->cb_buff[p+1] != 0 || pData->cb_buff[p+2] != 0 || pData->cb_buff[p+3] != 1)
-               {
-                  vcos_log_error("Error in iframe list\n");
-               }
-            }
-         }
+         mmal_buffer_header_mem_lock(buffer);
+         raspicam_ringbuf_push(pData->ringbuf, buffer->data, buffer->length, buffer->flags, buffer->pts, buffer);
+         mmal_buffer_header_mem_unlock(buffer);
       }
       else
       {
@@ -1324,13 +1328,28 @@ static void encoder_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
             if (pData->pstate->segmentWrap && pData->pstate->segmentNumber > pData->pstate->segmentWrap)
                pData->pstate->segmentNumber = 1;
 
-            if (pData->pstate->common_settings.filename && pData->pstate->common_settings.filename[0] != '-')
+            if (pData->container)
+            {
+               VC_CONTAINER_T *new_container = open_container(pData->pstate, pData->pstate->common_settings.filename);
+
+               // The writer closes the old container once everything queued for it is written
+               if (new_container)
+               {
+                  if (raspi_writer_switch_container(pData->writer, new_container) != 0)
+                     vc_container_close(new_container);
+                  else
+                     pData->container = new_container;
+               }
+            }
+            else if (pData->pstate->common_settings.filename && pData->pstate->common_settings.filename[0] != '-')
             {
                new_handle = open_filename(pData->pstate, pData->pstate->common_settings.filename);
 
                if (new_handle)
                {
-                  fclose(pData->file_handle);
+                  // The writer closes the old file once everything queued for it is written
+                  if (!pData->writer || raspi_writer_switch_file(pData->writer, new_handle) != 0)
+                     fclose(pData->file_handle);
                   pData->file_handle = new_handle;
                }
             }
@@ -1373,6 +1392,14 @@ static void encoder_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
                   bytes_written = buffer->length;
                }
             }
+            else if (pData->writer)
+            {
+               // Dropped buffers are accounted for by the writer, only a failed write aborts
+               if (raspi_writer_write(pData->writer, buffer) == RASPI_WRITER_FAILED)
+                  bytes_written = 0;
+               else
+                  bytes_written = buffer->length;
+            }
             else
             {
                bytes_written = fwrite(buffer->data, 1, buffer->length, pData->file_handle);
@@ -1437,6 +1464,48 @@ static void encoder_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
    }
 }
 
+/**
+ * Extract the luma plane of a raw I420 frame, without the padding of its rows
+ *
+ * @param pData Callback data holding the buffer the luma is written to
+ * @param format Format of the frame
+ * @param buffer Buffer header holding the frame
+ * @return size of the luma plane in pData->raw_buffer, 0 on error
+ */
+static uint32_t raw_output_gray(PORT_USERDATA *pData, MMAL_ES_FORMAT_T *format, MMAL_BUFFER_HEADER_T *buffer)
+{
+   MMAL_ES_SPECIFIC_FORMAT_T es;
+   MMAL_ES_FORMAT_T gray;
+   MMAL_STATUS_T status;
+   uint32_t size;
+
+   memset(&gray, 0, sizeof(gray));
+   memset(&es, 0, sizeof(es));
+   gray.type = MMAL_ES_TYPE_VIDEO;
+   gray.encoding = MMAL_ENCODING_GREY;
+   gray.es = &es;
+   es.video.width = format->es->video.crop.width ? format->es->video.crop.width : format->es->video.width;
+   es.video.height = format->es->video.crop.height ? format->es->video.crop.height : format->es->video.height;
+   size = mmal_frame_size(&gray);
+
+   if (size > pData->raw_buffer_size)
+   {
+      free(pData->raw_buffer);
+      pData->raw_buffer_size = 0;
+      pData->raw_buffer = malloc(size);
+      if (!pData->raw_buffer)
+         return 0;
+      pData->raw_buffer_size = size;
+   }
+
+   mmal_buffer_header_mem_lock(buffer);
+   status = mmal_frame_convert(pData->raw_buffer, size, &gray,
+                               buffer->data + buffer->offset, buffer->length, format);
+   mmal_buffer_header_mem_unlock(buffer);
+
+   return status == MMAL_SUCCESS ? size : 0;
+}
+
 /**
  *  buffer header callback function for splitter
  *
@@ -1455,18 +1524,31 @@ static void splitter_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *bu
       int bytes_written = 0;
       int bytes_to_write = buffer->length;
 
-      /* Write only luma component to get grayscale image: */
-      if (buffer->length && pData->pstate->raw_output_fmt == RAW_OUTPUT_FMT_GRAY)
-         bytes_to_write = port->format->es->video.width * port->format->es->video.height;
-
       vcos_assert(pData->raw_file_handle);
 
-      if (bytes_to_write)
+      /* Write only luma component to get grayscale image: */
+      if (buffer->length && pData->pstate->raw_output_fmt == RAW_OUTPUT_FMT_GRAY)
+      {
+         bytes_to_write = raw_output_gray(pData, port->format, buffer);
+         if (!bytes_to_write)
+         {
+            vcos_log_error("Failed to extract the luma of a raw buffer - aborting");
+            pData->abort = 1;
+         }
+         else
+         {
+            bytes_written = fwrite(pData->raw_buffer, 1, bytes_to_write, pData->raw_file_handle);
+         }
+      }
+      else if (bytes_to_write)
       {
          mmal_buffer_header_mem_lock(buffer);
          bytes_written = fwrite(buffer->data, 1, bytes_to_write, pData->raw_file_handle);
          mmal_buffer_header_mem_unlock(buffer);
+      }
 
+      if (bytes_to_write)
+      {
          if (bytes_written != bytes_to_write)
          {
             vcos_log_error("Failed to write raw buffer data (%d from %d)- aborting", bytes_written, bytes_to_write);
@@ -1996,6 +2078,10 @@ static MMAL_STATUS_T create_encoder_component(RASPIVID_STATE *state)
    if (encoder_output->buffer_num < encoder_output->buffer_num_min)
       encoder_output->buffer_num = encoder_output->buffer_num_min;
 
+   // Extra buffers so the encoder keeps going while the writer holds some
+   if (!state->bCircularBuffer)
+      encoder_output->buffer_num += WRITER_QUEUE_DEPTH;
+
    // We need to set the frame rate on output to 0, to ensure it gets
    // updated correctly from the input framerate when port connected
    encoder_output->format->es->video.frame_rate.num = 0;
@@ -2607,8 +2693,19 @@ int main(int argc, const char **argv)
          }
 
          state.callback_data.file_handle = NULL;
+         state.callback_data.container = NULL;
+
+         if (state.common_settings.filename && is_mp4_filename(state.common_settings.filename))
+         {
+            state.callback_data.container = open_container(&state, state.common_settings.filename);
 
-         if (state.common_settings.filename)
+            if (!state.callback_data.container)
+            {
+               // Notify user, carry on but discarding encoded output buffers
+               vcos_log_error("%s: Error opening output file: %s\nNo output file will be generated\n", __func__, state.common_settings.filename);
+            }
+         }
+         else if (state.common_settings.filename)
          {
             if (state.common_settings.filename[0] == '-')
             {
@@ -2626,6 +2723,31 @@ int main(int argc, const char **argv)
             }
          }
 
+         // The circular buffer is written out at the end, everything else goes through the writer
+         state.callback_data.writer = NULL;
+
+         if (state.callback_data.file_handle && !state.bCircularBuffer)
+         {
+            state.callback_data.writer = raspi_writer_create(state.callback_data.file_handle, WRITER_QUEUE_DEPTH,
+                                                             state.callback_data.flush_buffers,
+                                                             encoder_output_port, state.encoder_pool);
+            if (!state.callback_data.writer)
+               vcos_log_error("%s: Unable to create storage writer, writing from the encoder callback", __func__);
+         }
+         else if (state.callback_data.container && !state.bCircularBuffer)
+         {
+            // MP4 files are only written by the writer
+            state.callback_data.writer = raspi_writer_create(NULL, WRITER_QUEUE_DEPTH,
+                                                             state.callback_data.flush_buffers,
+                                                             encoder_output_port, state.encoder_pool);
+            if (!state.callback_data.writer ||
+                raspi_writer_switch_container(state.callback_data.writer, state.callback_data.container) != 0)
+            {
+               vcos_log_error("%s: Unable to create storage writer", __func__);
+               goto error;
+            }
+         }
+
          state.callback_data.imv_file_handle = NULL;
 
          if (state.imv_filename)
@@ -2708,7 +2830,7 @@ int main(int argc, const char **argv)
                vcos_log_error("%s: Error, Circular buffer mode requires either keypress (-k) or signal (-s) triggering\n", __func__);
                goto error;
             }
-            else if(!state.callback_data.file_handle)
+            else if(!state.callback_data.file_handle && !state.callback_data.container)
             {
                vcos_log_error("%s: Error require output file (or stdout) for Circular buffer mode\n", __func__);
                goto error;
@@ -2716,23 +2838,15 @@ int main(int argc, const char **argv)
             else
             {
                int count = state.bitrate * (state.timeout / 1000) / 8;
+               // Every frame may be a key frame
+               int max_frames = (state.timeout / 1000 + 1) * (state.framerate ? state.framerate : VIDEO_FRAME_RATE_NUM);
 
-               state.callback_data.cb_buff = (char *) malloc(count);
-               if(state.callback_data.cb_buff == NULL)
+               state.callback_data.ringbuf = raspicam_ringbuf_create(count, max_frames);
+               if(state.callback_data.ringbuf == NULL)
                {
                   vcos_log_error("%s: Unable to allocate circular buffer for %d seconds at %.1f Mbits\n", __func__, state.timeout / 1000, (double)state.bitrate/1000000.0);
                   goto error;
                }
-               else
-               {
-                  state.callback_data.cb_len = count;
-                  state.callback_data.cb_wptr = 0;
-                  state.callback_data.cb_wrap = 0;
-                  state.callback_data.cb_data = 0;
-                  state.callback_data.iframe_buff_wpos = 0;
-                  state.callback_data.iframe_buff_rpos = 0;
-                  state.callback_data.header_wptr = 0;
-               }
             }
          }
 
@@ -2770,42 +2884,26 @@ int main(int argc, const char **argv)
          {
             // Only encode stuff if we have a filename and it opened
             // Note we use the copy in the callback, as the call back MIGHT change the file handle
-            if (state.callback_data.file_handle || state.callback_data.raw_file_handle)
+            if (state.callback_data.file_handle || state.callback_data.container || state.callback_data.raw_file_handle)
             {
                int running = 1;
 
                // Send all the buffers to the encoder output port
-               if (state.callback_data.file_handle)
+               if (state.callback_data.file_handle || state.callback_data.container)
                {
-                  int num = mmal_queue_length(state.encoder_pool->queue);
-                  int q;
-                  for (q=0; q<num; q++)
-                  {
-                     MMAL_BUFFER_HEADER_T *buffer = mmal_queue_get(state.encoder_pool->queue);
+                  unsigned int sent;
 
-                     if (!buffer)
-                        vcos_log_error("Unable to get a required buffer %d from pool queue", q);
-
-                     if (mmal_port_send_buffer(encoder_output_port, buffer)!= MMAL_SUCCESS)
-                        vcos_log_error("Unable to send a buffer to encoder output port (%d)", q);
-                  }
+                  if (mmal_port_send_pool_buffers(encoder_output_port, state.encoder_pool, &sent) != MMAL_SUCCESS)
+                     vcos_log_error("Unable to send a buffer to encoder output port (%u sent)", sent);
                }
 
                // Send all the buffers to the splitter output port
                if (state.callback_data.raw_file_handle)
                {
-                  int num = mmal_queue_length(state.splitter_pool->queue);
-                  int q;
-                  for (q = 0; q < num; q++)
-                  {
-                     MMAL_BUFFER_HEADER_T *buffer = mmal_queue_get(state.splitter_pool->queue);
-
-                     if (!buffer)
-                        vcos_log_error("Unable to get a required buffer %d from pool queue", q);
+                  unsigned int sent;
 
-                     if (mmal_port_send_buffer(splitter_output_port, buffer)!= MMAL_SUCCESS)
-                        vcos_log_error("Unable to send a buffer to splitter output port (%d)", q);
-                  }
+                  if (mmal_port_send_pool_buffers(splitter_output_port, state.splitter_pool, &sent) != MMAL_SUCCESS)
+                     vcos_log_error("Unable to send a buffer to splitter output port (%u sent)", sent);
                }
 
                int initialCapturing=state.bCapturing;
@@ -2875,24 +2973,20 @@ int main(int argc, const char **argv)
          vcos_log_error("%s: Failed to connect camera to preview", __func__);
       }
 
-      if(state.bCircularBuffer)
+      if(state.callback_data.ringbuf && state.callback_data.container)
       {
-         int copy_from_end, copy_from_start;
-
-         copy_from_end = state.callback_data.cb_len - state.callback_data.iframe_buff[state.callback_data.iframe_buff_rpos];
-         copy_from_start = state.callback_data.cb_len - copy_from_end;
-         copy_from_start = state.callback_data.cb_wptr < copy_from_start ? state.callback_data.cb_wptr : copy_from_start;
-         if(!state.callback_data.cb_wrap)
-         {
-            copy_from_start = state.callback_data.cb_wptr;
-            copy_from_end = 0;
-         }
-
-         fwrite(state.callback_data.header_bytes, 1, state.callback_data.header_wptr, state.callback_data.file_handle);
-         // Save circular buffer
-         fwrite(state.callback_data.cb_buff + state.callback_data.iframe_buff[state.callback_data.iframe_buff_rpos], 1, copy_from_end, state.callback_data.file_handle);
-         fwrite(state.callback_data.cb_buff, 1, copy_from_start, state.callback_data.file_handle);
-         if(state.callback_data.flush_buffers) fflush(state.callback_data.file_handle);
+         // Save circular buffer frame by frame, starting at the oldest key frame it holds
+         if (raspicam_ringbuf_dump_frames(state.callback_data.ringbuf, RASPICAM_RINGBUF_DUMP_ALL,
+                                          circular_output, state.callback_data.container, NULL, NULL) < 0)
+            vcos_log_error("%s: Failed to save the circular buffer", __func__);
+      }
+      else if(state.callback_data.ringbuf)
+      {
+         // Save circular buffer, starting at the oldest key frame it holds
+         fflush(state.callback_data.file_handle);
+         if (raspicam_ringbuf_dump(state.callback_data.ringbuf, fileno(state.callback_data.file_handle),
+                                   RASPICAM_RINGBUF_DUMP_ALL, NULL, NULL) < 0)
+            vcos_log_error("%s: Failed to save the circular buffer", __func__);
       }
 
 error:
@@ -2916,6 +3010,23 @@ error:
       if (state.splitter_connection)
          mmal_connection_destroy(state.splitter_connection);
 
+      // Write out what the writer still holds before closing the file
+      if (state.callback_data.writer)
+      {
+         if (state.common_settings.verbose)
+            raspi_writer_print_stats(state.callback_data.writer, stderr);
+         raspi_writer_destroy(state.callback_data.writer);
+         state.callback_data.writer = NULL;
+      }
+
+      raspicam_ringbuf_destroy(state.callback_data.ringbuf);
+      state.callback_data.ringbuf = NULL;
+
+      // Closing the container writes out its index (or last fragment)
+      if (state.callback_data.container)
+         vc_container_close(state.callback_data.container);
+      state.callback_data.container = NULL;
+
       // Can now close our file. Note disabling ports may flush buffers which causes
       // problems if we have already closed the file!
       if (state.callback_data.file_handle && state.callback_data.file_handle != stdout)
@@ -2926,6 +3037,7 @@ error:
          fclose(state.callback_data.pts_file_handle);
       if (state.callback_data.raw_file_handle && state.callback_data.raw_file_handle != stdout)
          fclose(state.callback_data.raw_file_handle);
+      free(state.callback_data.raw_buffer);
 
       /* Disable components */
       if (state.encoder_component)
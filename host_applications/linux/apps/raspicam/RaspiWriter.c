@@ -0,0 +1,537 @@
+/*
+Copyright (c) 2018, Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "interface/vcos/vcos.h"
+#include "interface/mmal/mmal.h"
+#include "interface/mmal/mmal_logging.h"
+#include "interface/mmal/util/mmal_connection.h"
+#include "containers/containers.h"
+#include "containers/containers_codecs.h"
+#include "containers/core/containers_utils.h"
+
+#include "RaspiHelpers.h"
+#include "RaspiWriter.h"
+
+/// Maximum number of buffers written with a single writev()
+#define WRITER_MAX_BATCH 16
+
+/** Entry of the writer queue. Either a buffer to write or a file switch. */
+typedef struct
+{
+   MMAL_BUFFER_HEADER_T *buffer;     /// Buffer to write, NULL for a file switch
+   FILE *file;                       /// New output file for a file switch
+   VC_CONTAINER_T *container;        /// New output container for a file switch
+} WRITER_ENTRY_T;
+
+struct RASPI_WRITER_S
+{
+   pthread_mutex_t lock;
+   pthread_cond_t cond;
+   pthread_t thread;
+   int terminate;
+
+   FILE *file;                       /// File currently written to (writer thread only)
+   VC_CONTAINER_T *container;        /// Container currently written to, instead of file
+   int frame_end;                    /// The last buffer written to the container ended a frame
+   int flush;
+   MMAL_PORT_T *port;
+   MMAL_POOL_T *pool;
+
+   WRITER_ENTRY_T *entries;          /// Ring of queued entries
+   unsigned int depth;
+   unsigned int head;                /// Next free entry (producer side)
+   unsigned int tail;                /// Oldest queued entry (writer thread side)
+   unsigned int count;
+
+   int dropping;                     /// Dropping until the next key frame
+
+   uint64_t start_time;
+   uint64_t total_latency;
+   RASPI_WRITER_STATS_T stats;
+};
+
+/** Send the buffers available in the pool back to the port they came from */
+static void writer_recycle_buffers(RASPI_WRITER_T *writer)
+{
+   MMAL_BUFFER_HEADER_T *buffer;
+
+   if (!writer->port || !writer->pool)
+      return;
+
+   while (writer->port->is_enabled && (buffer = mmal_queue_get(writer->pool->queue)) != NULL)
+   {
+      if (mmal_port_send_buffer(writer->port, buffer) != MMAL_SUCCESS)
+      {
+         mmal_queue_put_back(writer->pool->queue, buffer);
+         break;
+      }
+   }
+}
+
+/** Write an array of iovecs completely, coping with short writes */
+static int writer_writev(int fd, struct iovec *iov, int iov_num)
+{
+   while (iov_num)
+   {
+      ssize_t written = writev(fd, iov, iov_num);
+
+      if (written < 0)
+      {
+         if (errno == EINTR)
+            continue;
+         return -1;
+      }
+
+      while (iov_num && (size_t)written >= iov->iov_len)
+      {
+         written -= iov->iov_len;
+         iov++;
+         iov_num--;
+      }
+      if (iov_num)
+      {
+         iov->iov_base = (uint8_t *)iov->iov_base + written;
+         iov->iov_len -= written;
+      }
+   }
+   return 0;
+}
+
+static void *writer_thread(void *arg)
+{
+   RASPI_WRITER_T *writer = (RASPI_WRITER_T *)arg;
+   MMAL_BUFFER_HEADER_T *batch[WRITER_MAX_BATCH];
+   struct iovec iov[WRITER_MAX_BATCH];
+
+   pthread_mutex_lock(&writer->lock);
+   while (1)
+   {
+      unsigned int i, num = 0, bytes = 0;
+      uint64_t start, latency;
+      int error = 0;
+
+      while (!writer->count && !writer->terminate)
+         pthread_cond_wait(&writer->cond, &writer->lock);
+      if (!writer->count)
+         break;
+
+      // A file switch at the head of the queue applies before anything else
+      if (!writer->entries[writer->tail].buffer)
+      {
+         FILE *old_file = writer->file;
+         VC_CONTAINER_T *old_container = writer->container;
+
+         writer->file = writer->entries[writer->tail].file;
+         writer->container = writer->entries[writer->tail].container;
+         writer->frame_end = 1;
+         writer->tail = (writer->tail + 1) % writer->depth;
+         writer->count--;
+         pthread_mutex_unlock(&writer->lock);
+
+         if (old_file && old_file != stdout)
+            fclose(old_file);
+         if (old_container)
+            vc_container_close(old_container);
+
+         pthread_mutex_lock(&writer->lock);
+         continue;
+      }
+
+      // Gather consecutive buffers. They stay in the ring until written so the
+      // queue depth accounts for them.
+      for (i = writer->tail; num < writer->count && num < WRITER_MAX_BATCH; i = (i + 1) % writer->depth)
+      {
+         MMAL_BUFFER_HEADER_T *buffer = writer->entries[i].buffer;
+         if (!buffer)
+            break;
+         batch[num] = buffer;
+         iov[num].iov_base = buffer->data + buffer->offset;
+         iov[num].iov_len = buffer->length;
+         bytes += buffer->length;
+         num++;
+      }
+      pthread_mutex_unlock(&writer->lock);
+
+      start = get_microseconds64();
+      if (writer->container)
+      {
+         // Containers need the frame boundaries, buffers are written one by one
+         for (i = 0; i < num && !error; i++)
+            error = raspi_writer_write_direct(writer, batch[i]->data + batch[i]->offset,
+                                              batch[i]->length, batch[i]->flags, batch[i]->pts);
+      }
+      else if (writer->file)
+      {
+         // The file may also have been written through stdio
+         fflush(writer->file);
+         error = writer_writev(fileno(writer->file), iov, num);
+         if (!error && writer->flush)
+            fdatasync(fileno(writer->file));
+      }
+      latency = get_microseconds64() - start;
+
+      for (i = 0; i < num; i++)
+      {
+         mmal_buffer_header_mem_unlock(batch[i]);
+         mmal_buffer_header_release(batch[i]);
+      }
+      writer_recycle_buffers(writer);
+
+      pthread_mutex_lock(&writer->lock);
+      writer->tail = (writer->tail + num) % writer->depth;
+      writer->count -= num;
+
+      if (error)
+      {
+         vcos_log_error("Storage writer failed to write %u bytes: %s", bytes, strerror(errno));
+         writer->stats.error = 1;
+      }
+      else
+      {
+         if (!writer->start_time)
+            writer->start_time = start;
+         writer->stats.bytes_written += bytes;
+         writer->stats.buffers_written += num;
+      }
+      writer->stats.writes++;
+      writer->stats.last_write_latency = (unsigned int)latency;
+      if (latency > writer->stats.max_write_latency)
+         writer->stats.max_write_latency = (unsigned int)latency;
+      writer->total_latency += latency;
+   }
+   pthread_mutex_unlock(&writer->lock);
+
+   return NULL;
+}
+
+RASPI_WRITER_T *raspi_writer_create(FILE *file, unsigned int depth, int flush,
+                                    MMAL_PORT_T *port, MMAL_POOL_T *pool)
+{
+   RASPI_WRITER_T *writer;
+
+   if (!depth)
+      return NULL;
+
+   writer = calloc(1, sizeof(*writer));
+   if (!writer)
+      return NULL;
+
+   // One extra entry so a file switch can always be queued
+   writer->depth = depth + 1;
+   writer->entries = calloc(writer->depth, sizeof(*writer->entries));
+   if (!writer->entries)
+   {
+      free(writer);
+      return NULL;
+   }
+
+   writer->file = file;
+   writer->frame_end = 1;
+   writer->flush = flush;
+   writer->port = port;
+   writer->pool = pool;
+
+   pthread_mutex_init(&writer->lock, NULL);
+   pthread_cond_init(&writer->cond, NULL);
+
+   if (pthread_create(&writer->thread, NULL, writer_thread, writer))
+   {
+      vcos_log_error("Unable to create storage writer thread");
+      pthread_cond_destroy(&writer->cond);
+      pthread_mutex_destroy(&writer->lock);
+      free(writer->entries);
+      free(writer);
+      return NULL;
+   }
+
+   return writer;
+}
+
+RASPI_WRITER_RESULT_T raspi_writer_write(RASPI_WRITER_T *writer, MMAL_BUFFER_HEADER_T *buffer)
+{
+   RASPI_WRITER_RESULT_T result = RASPI_WRITER_QUEUED;
+
+   if (!buffer->length)
+      return RASPI_WRITER_QUEUED;
+
+   pthread_mutex_lock(&writer->lock);
+
+   if (writer->stats.error)
+   {
+      result = RASPI_WRITER_FAILED;
+   }
+   else
+   {
+      // After a drop, wait for a point the decoder can restart from
+      if (writer->dropping &&
+          (buffer->flags & (MMAL_BUFFER_HEADER_FLAG_KEYFRAME | MMAL_BUFFER_HEADER_FLAG_CONFIG)))
+         writer->dropping = 0;
+
+      // Keep the last entry for file switches
+      if (writer->dropping || writer->count >= writer->depth - 1)
+      {
+         writer->dropping = 1;
+         writer->stats.buffers_dropped++;
+         if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END)
+            writer->stats.frames_dropped++;
+         result = RASPI_WRITER_DROPPED;
+      }
+      else
+      {
+         mmal_buffer_header_acquire(buffer);
+         mmal_buffer_header_mem_lock(buffer);
+         writer->entries[writer->head].buffer = buffer;
+         writer->entries[writer->head].file = NULL;
+         writer->entries[writer->head].container = NULL;
+         writer->head = (writer->head + 1) % writer->depth;
+         writer->count++;
+         if (writer->count > writer->stats.max_queue_depth)
+            writer->stats.max_queue_depth = writer->count;
+         pthread_cond_signal(&writer->cond);
+      }
+   }
+
+   pthread_mutex_unlock(&writer->lock);
+   return result;
+}
+
+/** Queue a switch to a new output file or container */
+static int writer_switch(RASPI_WRITER_T *writer, FILE *file, VC_CONTAINER_T *container)
+{
+   FILE *old_file = NULL;
+   VC_CONTAINER_T *old_container = NULL;
+   int ret = 0;
+
+   pthread_mutex_lock(&writer->lock);
+   if (writer->count >= writer->depth)
+   {
+      ret = -1;
+   }
+   else if (!writer->count)
+   {
+      // Nothing queued, the writer thread isn't using the output: switch right away
+      old_file = writer->file;
+      old_container = writer->container;
+      writer->file = file;
+      writer->container = container;
+      writer->frame_end = 1;
+   }
+   else
+   {
+      writer->entries[writer->head].buffer = NULL;
+      writer->entries[writer->head].file = file;
+      writer->entries[writer->head].container = container;
+      writer->head = (writer->head + 1) % writer->depth;
+      writer->count++;
+      pthread_cond_signal(&writer->cond);
+   }
+   pthread_mutex_unlock(&writer->lock);
+
+   if (old_file && old_file != stdout)
+      fclose(old_file);
+   if (old_container)
+      vc_container_close(old_container);
+   return ret;
+}
+
+int raspi_writer_switch_file(RASPI_WRITER_T *writer, FILE *file)
+{
+   return writer_switch(writer, file, NULL);
+}
+
+int raspi_writer_switch_container(RASPI_WRITER_T *writer, VC_CONTAINER_T *container)
+{
+   return writer_switch(writer, NULL, container);
+}
+
+VC_CONTAINER_T *raspi_writer_open_mp4(const char *filename, MMAL_PORT_T *port, unsigned int fragment_ms)
+{
+   VC_CONTAINER_STATUS_T status;
+   VC_CONTAINER_ES_FORMAT_T *format;
+   VC_CONTAINER_T *container;
+   MMAL_VIDEO_FORMAT_T *video = &port->format->es->video;
+
+   if (port->format->encoding != MMAL_ENCODING_H264)
+   {
+      vcos_log_error("%s: only H264 can be written to %s", __func__, filename);
+      return NULL;
+   }
+
+   container = vc_container_open_writer(filename, &status, 0, 0);
+   if (!container)
+   {
+      vcos_log_error("%s: unable to open %s (%i)", __func__, filename, status);
+      return NULL;
+   }
+
+   format = vc_container_format_create(0);
+   if (!format)
+   {
+      status = VC_CONTAINER_ERROR_OUT_OF_MEMORY;
+      goto error;
+   }
+
+   // The encoder output is a byte stream, the container builds the avcC from it
+   format->es_type = VC_CONTAINER_ES_TYPE_VIDEO;
+   format->codec = VC_CONTAINER_CODEC_H264;
+   format->codec_variant = VC_CONTAINER_VARIANT_H264_DEFAULT;
+   format->flags |= VC_CONTAINER_ES_FORMAT_FLAG_FRAMED;
+   format->bitrate = port->format->bitrate;
+   format->type->video.width = video->crop.width ? video->crop.width : video->width;
+   format->type->video.height = video->crop.height ? video->crop.height : video->height;
+   format->type->video.frame_rate_num = video->frame_rate.num;
+   format->type->video.frame_rate_den = video->frame_rate.den;
+   format->type->video.par_num = video->par.num;
+   format->type->video.par_den = video->par.den;
+
+   status = vc_container_control(container, VC_CONTAINER_CONTROL_TRACK_ADD, format);
+   vc_container_format_delete(format);
+   if (status != VC_CONTAINER_SUCCESS)
+      goto error;
+
+   if (fragment_ms)
+   {
+      status = vc_container_control(container, VC_CONTAINER_CONTROL_SET_FRAGMENT_DURATION,
+                                    (int64_t)fragment_ms * 1000);
+      if (status != VC_CONTAINER_SUCCESS)
+         goto error;
+   }
+
+   status = vc_container_control(container, VC_CONTAINER_CONTROL_TRACK_ADD_DONE);
+   if (status != VC_CONTAINER_SUCCESS)
+      goto error;
+
+   return container;
+
+error:
+   vcos_log_error("%s: unable to set up %s (%i)", __func__, filename, status);
+   vc_container_close(container);
+   return NULL;
+}
+
+int raspi_writer_container_write(VC_CONTAINER_T *container, const uint8_t *data, size_t length,
+                                 uint32_t flags, int64_t pts)
+{
+   VC_CONTAINER_PACKET_T packet;
+
+   // Motion vectors are not part of the stream
+   if (!length || (flags & MMAL_BUFFER_HEADER_FLAG_CODECSIDEINFO))
+      return 0;
+
+   memset(&packet, 0, sizeof(packet));
+   packet.data = (uint8_t *)data;
+   packet.size = packet.buffer_size = length;
+   packet.pts = packet.dts = pts == MMAL_TIME_UNKNOWN ? VC_CONTAINER_TIME_UNKNOWN : pts;
+   if (flags & MMAL_BUFFER_HEADER_FLAG_FRAME_START)
+      packet.flags |= VC_CONTAINER_PACKET_FLAG_FRAME_START;
+   if (flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END)
+      packet.flags |= VC_CONTAINER_PACKET_FLAG_FRAME_END;
+   if (flags & MMAL_BUFFER_HEADER_FLAG_KEYFRAME)
+      packet.flags |= VC_CONTAINER_PACKET_FLAG_KEYFRAME;
+   if (flags & MMAL_BUFFER_HEADER_FLAG_CONFIG)
+      packet.flags |= VC_CONTAINER_PACKET_FLAG_CONFIG;
+
+   return vc_container_write(container, &packet) == VC_CONTAINER_SUCCESS ? 0 : -1;
+}
+
+int raspi_writer_write_direct(RASPI_WRITER_T *writer, const uint8_t *data, size_t length,
+                              uint32_t flags, int64_t pts)
+{
+   int ret = 0;
+
+   if (!length || (flags & MMAL_BUFFER_HEADER_FLAG_CODECSIDEINFO))
+      return 0;
+
+   // The encoder only marks the end of frames
+   if (writer->frame_end)
+      flags |= MMAL_BUFFER_HEADER_FLAG_FRAME_START;
+   writer->frame_end = !!(flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END);
+
+   if (writer->container)
+      ret = raspi_writer_container_write(writer->container, data, length, flags, pts);
+   else if (writer->file)
+      ret = fwrite(data, 1, length, writer->file) == length ? 0 : -1;
+   return ret;
+}
+
+void raspi_writer_get_stats(RASPI_WRITER_T *writer, RASPI_WRITER_STATS_T *stats)
+{
+   uint64_t elapsed;
+
+   pthread_mutex_lock(&writer->lock);
+   *stats = writer->stats;
+   stats->queue_depth = writer->count;
+   if (writer->stats.writes)
+      stats->avg_write_latency = (unsigned int)(writer->total_latency / writer->stats.writes);
+   elapsed = writer->start_time ? get_microseconds64() - writer->start_time : 0;
+   if (elapsed)
+      stats->bytes_per_second = (unsigned int)(writer->stats.bytes_written * 1000000ULL / elapsed);
+   pthread_mutex_unlock(&writer->lock);
+}
+
+void raspi_writer_print_stats(RASPI_WRITER_T *writer, FILE *out)
+{
+   RASPI_WRITER_STATS_T stats;
+
+   raspi_writer_get_stats(writer, &stats);
+   fprintf(out, "Writer: %llu bytes in %u buffers (%u bytes/s), %u buffers / %u frames dropped\n",
+           (unsigned long long)stats.bytes_written, stats.buffers_written, stats.bytes_per_second,
+           stats.buffers_dropped, stats.frames_dropped);
+   fprintf(out, "Writer: queue depth %u (max %u), write latency %uus (avg %uus, max %uus)%s\n",
+           stats.queue_depth, stats.max_queue_depth, stats.last_write_latency,
+           stats.avg_write_latency, stats.max_write_latency, stats.error ? ", write error" : "");
+}
+
+void raspi_writer_destroy(RASPI_WRITER_T *writer)
+{
+   if (!writer)
+      return;
+
+   pthread_mutex_lock(&writer->lock);
+   writer->terminate = 1;
+   pthread_cond_signal(&writer->cond);
+   pthread_mutex_unlock(&writer->lock);
+
+   pthread_join(writer->thread, NULL);
+
+   if (writer->file)
+      fflush(writer->file);
+
+   pthread_cond_destroy(&writer->cond);
+   pthread_mutex_destroy(&writer->lock);
+   free(writer->entries);
+   free(writer);
+}
@@ -0,0 +1,165 @@
+/*
+Copyright (c) 2018, Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef RASPIWRITER_H_
+#define RASPIWRITER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "interface/mmal/mmal.h"
+#include "containers/containers.h"
+
+/**
+ * Asynchronous storage writer for encoder output.
+ *
+ * The encoder callback hands its buffer headers over to the writer instead of
+ * writing them itself, so a slow storage device never holds up the return of
+ * buffers to the encoder. A dedicated thread writes the queued payloads out in
+ * batches with writev() and releases the buffers afterwards. When the queue is
+ * full the buffer is dropped and counted, and further buffers are dropped until
+ * the next key frame or codec config so the written stream stays decodable.
+ *
+ * Instead of a raw file the writer can also output to a container, see
+ * raspi_writer_open_mp4(), in which case buffers are written as packets.
+ */
+typedef struct RASPI_WRITER_S RASPI_WRITER_T;
+
+/** Statistics gathered by a writer */
+typedef struct
+{
+   uint64_t bytes_written;           /// Total number of bytes written
+   unsigned int buffers_written;     /// Number of buffers written
+   unsigned int buffers_dropped;     /// Number of buffers dropped because the queue was full
+   unsigned int frames_dropped;      /// Number of complete frames dropped
+   unsigned int queue_depth;         /// Number of buffers currently queued
+   unsigned int max_queue_depth;     /// Highest number of buffers queued at once
+   unsigned int writes;              /// Number of write batches
+   unsigned int last_write_latency;  /// Duration of the last write batch, in microseconds
+   unsigned int max_write_latency;   /// Longest write batch, in microseconds
+   unsigned int avg_write_latency;   /// Average write batch duration, in microseconds
+   unsigned int bytes_per_second;    /// Average write throughput since the first write
+   int error;                        /// Set once a write has failed
+} RASPI_WRITER_STATS_T;
+
+/** Return values of raspi_writer_write() */
+typedef enum
+{
+   RASPI_WRITER_QUEUED = 0,          /// The buffer will be written
+   RASPI_WRITER_DROPPED,             /// The buffer was dropped to keep up
+   RASPI_WRITER_FAILED               /// A previous write failed, the output is unusable
+} RASPI_WRITER_RESULT_T;
+
+/**
+ * Create a writer and start its thread
+ *
+ * @param file File to write to. It is not closed by the writer.
+ * @param depth Maximum number of buffers queued before buffers get dropped
+ * @param flush If set, sync the data to the device after every batch
+ * @param port Port the buffers come from, or NULL. Buffers released by the
+ *             writer are sent straight back to this port while it is enabled.
+ * @param pool Pool the buffers of port belong to, or NULL
+ *
+ * @return The new writer or NULL on failure
+ */
+RASPI_WRITER_T *raspi_writer_create(FILE *file, unsigned int depth, int flush,
+                                    MMAL_PORT_T *port, MMAL_POOL_T *pool);
+
+/**
+ * Queue a buffer to be written. Never blocks on I/O.
+ * The writer acquires its own reference on the buffer so the caller still
+ * releases the buffer as usual.
+ *
+ * @return RASPI_WRITER_QUEUED, RASPI_WRITER_DROPPED or RASPI_WRITER_FAILED
+ */
+RASPI_WRITER_RESULT_T raspi_writer_write(RASPI_WRITER_T *writer, MMAL_BUFFER_HEADER_T *buffer);
+
+/**
+ * Switch to a new output file. Buffers queued before the call still go to the
+ * previous file, which the writer closes once they are written (unless it is stdout).
+ * When nothing is queued the switch is immediate.
+ *
+ * @return 0 on success, -1 if the switch could not be queued
+ */
+int raspi_writer_switch_file(RASPI_WRITER_T *writer, FILE *file);
+
+/**
+ * Switch to a new output container. Like raspi_writer_switch_file(), the
+ * previous file or container is closed by the writer once its buffers are
+ * written. When nothing is queued the switch is immediate.
+ *
+ * @return 0 on success, -1 if the switch could not be queued
+ */
+int raspi_writer_switch_container(RASPI_WRITER_T *writer, VC_CONTAINER_T *container);
+
+/**
+ * Open an MP4 file for the H264 stream produced by an encoder output port.
+ * The port format must be committed.
+ *
+ * @param filename Name of the file to create
+ * @param port Encoder output port the stream comes from
+ * @param fragment_ms Duration of the fragments in milliseconds, or 0 to write
+ *                    a regular MP4 which is only playable once closed
+ *
+ * @return The container, ready to be written to, or NULL on failure
+ */
+VC_CONTAINER_T *raspi_writer_open_mp4(const char *filename, MMAL_PORT_T *port, unsigned int fragment_ms);
+
+/**
+ * Write a piece of encoder output to a container.
+ *
+ * @param flags MMAL buffer header flags of the data
+ * @param pts Presentation timestamp of the data, or MMAL_TIME_UNKNOWN
+ *
+ * @return 0 on success, -1 on failure
+ */
+int raspi_writer_container_write(VC_CONTAINER_T *container, const uint8_t *data, size_t length,
+                                 uint32_t flags, int64_t pts);
+
+/**
+ * Synchronously write data to the current output of the writer, bypassing the
+ * queue. Only to be used while nothing is queued, e.g. to write out a
+ * pre-event buffer before handing the encoder output over to the writer.
+ *
+ * @return 0 on success, -1 on failure
+ */
+int raspi_writer_write_direct(RASPI_WRITER_T *writer, const uint8_t *data, size_t length,
+                              uint32_t flags, int64_t pts);
+
+/** Get a snapshot of the writer statistics */
+void raspi_writer_get_stats(RASPI_WRITER_T *writer, RASPI_WRITER_STATS_T *stats);
+
+/** Print the writer statistics */
+void raspi_writer_print_stats(RASPI_WRITER_T *writer, FILE *out);
+
+/**
+ * Write out everything still queued, stop the thread and free the writer.
+ * The current output file is left open.
+ */
+void raspi_writer_destroy(RASPI_WRITER_T *writer);
+
+#endif /* RASPIWRITER_H_ */
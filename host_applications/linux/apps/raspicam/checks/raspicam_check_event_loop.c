@@ -0,0 +1,352 @@
+/*
+Copyright (c) 2018, Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Checks of the event loop without any hardware. GPIO edges are simulated by a
+ * thread writing levels into a pipe, which a second thread turns into posted
+ * GPIO changes the way a pigpio alert callback would. Timers are checked for
+ * one-shot, periodic and disarmed expiry, and stop() is called from another
+ * thread and from a signal handler.
+ *
+ * Usage: raspicam_check_event_loop
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "interface/vcos/vcos.h"
+
+#include "RaspiEventLoop.h"
+
+/// GPIO pin the simulated edges are reported on
+#define CHECK_GPIO 17
+/// Number of edges simulated
+#define CHECK_EDGES 500
+/// Time after which a loop that hasn't stopped is considered stuck
+#define CHECK_WATCHDOG_MS 5000
+
+#define CHECK(cond) do { if (!(cond)) { \
+   fprintf(stderr, "%s:%i: check failed: %s\n", __FILE__, __LINE__, #cond); \
+   return -1; } } while (0)
+
+typedef struct
+{
+   RASPI_EVENT_LOOP_T *loop;
+   int pipe[2];                      /// Simulated GPIO line, one byte per edge
+   unsigned int edges;               /// GPIO changes seen by the loop
+   unsigned int errors;              /// GPIO changes out of order or on the wrong pin
+   int level;                        /// Last level seen
+   unsigned int delay_ms;            /// Delay before the helper thread acts
+   pthread_t loop_thread;            /// Thread running the loop
+
+   RASPI_EVENT_TIMER_T *once;
+   RASPI_EVENT_TIMER_T *periodic;
+   RASPI_EVENT_TIMER_T *disarmed;
+   unsigned int once_count;
+   unsigned int periodic_count;
+   unsigned int disarmed_count;
+   int64_t start_us;
+   int64_t once_us;
+   int64_t periodic_us;
+} CHECK_STATE_T;
+
+/// Loop stopped by the signal handler
+static RASPI_EVENT_LOOP_T *check_signal_loop;
+
+static int64_t check_time_us(void)
+{
+   struct timespec ts;
+
+   clock_gettime(CLOCK_MONOTONIC, &ts);
+   return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/** Stop the loop if it is still running after CHECK_WATCHDOG_MS */
+static void check_watchdog(RASPI_EVENT_LOOP_T *loop, RASPI_EVENT_TIMER_T *timer, void *userdata)
+{
+   int *fired = (int *)userdata;
+
+   vcos_unused(timer);
+   *fired = 1;
+   raspi_event_loop_stop(loop);
+}
+
+/** Run the loop with a watchdog timer, returns 0 if it stopped by itself */
+static int check_run(RASPI_EVENT_LOOP_T *loop)
+{
+   RASPI_EVENT_TIMER_T *watchdog;
+   int fired = 0;
+
+   watchdog = raspi_event_timer_create(loop, check_watchdog, &fired);
+   CHECK(watchdog);
+   CHECK(raspi_event_timer_set(watchdog, CHECK_WATCHDOG_MS, 0) == 0);
+   CHECK(raspi_event_loop_run(loop) == 0);
+   CHECK(!fired);
+   return 0;
+}
+
+/*****************************************************************************/
+/** Simulated GPIO line: alternate levels written to the pipe */
+static void *check_edge_thread(void *arg)
+{
+   CHECK_STATE_T *state = (CHECK_STATE_T *)arg;
+   unsigned int i;
+
+   for (i = 0; i < CHECK_EDGES; i++)
+   {
+      uint8_t level = (uint8_t)(i & 1 ? 0 : 1);
+
+      if (write(state->pipe[1], &level, 1) != 1)
+         break;
+      if (!(i % 50))
+         vcos_sleep(1);
+   }
+   return NULL;
+}
+
+/** Alert thread: reads the simulated line and posts each edge to the loop */
+static void *check_alert_thread(void *arg)
+{
+   CHECK_STATE_T *state = (CHECK_STATE_T *)arg;
+   uint8_t levels[64];
+   ssize_t i, res;
+
+   while ((res = read(state->pipe[0], levels, sizeof(levels))) > 0)
+   {
+      for (i = 0; i < res; i++)
+      {
+         // The queue is bounded, give the loop time to drain it
+         while (raspi_event_loop_post_gpio(state->loop, CHECK_GPIO, levels[i]) != 0)
+            vcos_sleep(1);
+      }
+   }
+   return NULL;
+}
+
+static void check_gpio_callback(RASPI_EVENT_LOOP_T *loop, unsigned int gpio, int level, void *userdata)
+{
+   CHECK_STATE_T *state = (CHECK_STATE_T *)userdata;
+
+   if (gpio != CHECK_GPIO || level == state->level)
+      state->errors++;
+   state->level = level;
+   if (++state->edges == CHECK_EDGES)
+      raspi_event_loop_stop(loop);
+}
+
+/** Every edge reaches the GPIO callback once, in order */
+static int check_gpio(CHECK_STATE_T *state)
+{
+   pthread_t edge_thread, alert_thread;
+
+   state->level = 0;
+   state->loop = raspi_event_loop_create(check_gpio_callback, state);
+   CHECK(state->loop);
+   CHECK(pipe(state->pipe) == 0);
+   CHECK(pthread_create(&alert_thread, NULL, check_alert_thread, state) == 0);
+   CHECK(pthread_create(&edge_thread, NULL, check_edge_thread, state) == 0);
+
+   CHECK(check_run(state->loop) == 0);
+
+   pthread_join(edge_thread, NULL);
+   close(state->pipe[1]);
+   pthread_join(alert_thread, NULL);
+   close(state->pipe[0]);
+   raspi_event_loop_destroy(state->loop);
+
+   CHECK(state->edges == CHECK_EDGES);
+   CHECK(state->errors == 0);
+   return 0;
+}
+
+/*****************************************************************************/
+static void check_once_callback(RASPI_EVENT_LOOP_T *loop, RASPI_EVENT_TIMER_T *timer, void *userdata)
+{
+   CHECK_STATE_T *state = (CHECK_STATE_T *)userdata;
+
+   vcos_unused(loop);
+   vcos_unused(timer);
+   state->once_count++;
+   state->once_us = check_time_us() - state->start_us;
+}
+
+static void check_periodic_callback(RASPI_EVENT_LOOP_T *loop, RASPI_EVENT_TIMER_T *timer, void *userdata)
+{
+   CHECK_STATE_T *state = (CHECK_STATE_T *)userdata;
+
+   if (++state->periodic_count < 5)
+      return;
+
+   // Destroying timers from a handler, including the one being called
+   state->periodic_us = check_time_us() - state->start_us;
+   raspi_event_timer_destroy(timer);
+   raspi_event_timer_destroy(state->disarmed);
+   raspi_event_loop_stop(loop);
+}
+
+static void check_disarmed_callback(RASPI_EVENT_LOOP_T *loop, RASPI_EVENT_TIMER_T *timer, void *userdata)
+{
+   CHECK_STATE_T *state = (CHECK_STATE_T *)userdata;
+
+   vcos_unused(loop);
+   vcos_unused(timer);
+   state->disarmed_count++;
+}
+
+/** A one-shot timer fires once, a periodic one keeps firing, a disarmed one never does */
+static int check_timers(CHECK_STATE_T *state)
+{
+   state->loop = raspi_event_loop_create(NULL, NULL);
+   CHECK(state->loop);
+   state->once = raspi_event_timer_create(state->loop, check_once_callback, state);
+   state->periodic = raspi_event_timer_create(state->loop, check_periodic_callback, state);
+   state->disarmed = raspi_event_timer_create(state->loop, check_disarmed_callback, state);
+   CHECK(state->once && state->periodic && state->disarmed);
+
+   state->start_us = check_time_us();
+   CHECK(raspi_event_timer_set(state->once, 30, 0) == 0);
+   CHECK(raspi_event_timer_set(state->periodic, 20, 1) == 0);
+   CHECK(raspi_event_timer_set(state->disarmed, 40, 0) == 0);
+   CHECK(raspi_event_timer_set(state->disarmed, 0, 0) == 0);
+
+   CHECK(check_run(state->loop) == 0);
+   raspi_event_loop_destroy(state->loop);
+
+   CHECK(state->once_count == 1);
+   CHECK(state->once_us >= 30000);
+   CHECK(state->periodic_count == 5);
+   CHECK(state->periodic_us >= 100000);
+   CHECK(state->disarmed_count == 0);
+   return 0;
+}
+
+/*****************************************************************************/
+/** Stop the loop from another thread while it is waiting */
+static void *check_stop_thread(void *arg)
+{
+   CHECK_STATE_T *state = (CHECK_STATE_T *)arg;
+
+   vcos_sleep(state->delay_ms);
+   raspi_event_loop_stop(state->loop);
+   return NULL;
+}
+
+static int check_stop(CHECK_STATE_T *state)
+{
+   pthread_t thread;
+
+   state->loop = raspi_event_loop_create(NULL, NULL);
+   CHECK(state->loop);
+   state->delay_ms = 50;
+   CHECK(pthread_create(&thread, NULL, check_stop_thread, state) == 0);
+   CHECK(check_run(state->loop) == 0);
+   pthread_join(thread, NULL);
+   raspi_event_loop_destroy(state->loop);
+   return 0;
+}
+
+/*****************************************************************************/
+static void check_signal_handler(int signum)
+{
+   vcos_unused(signum);
+   raspi_event_loop_stop(check_signal_loop);
+}
+
+/** Signal the thread running the loop, as SIGINT would */
+static void *check_signal_thread(void *arg)
+{
+   CHECK_STATE_T *state = (CHECK_STATE_T *)arg;
+
+   vcos_sleep(state->delay_ms);
+   pthread_kill(state->loop_thread, SIGUSR1);
+   return NULL;
+}
+
+/** Stop the loop from a signal handler running on the loop thread itself */
+static int check_signal(CHECK_STATE_T *state)
+{
+   struct sigaction action, old_action;
+   pthread_t thread;
+
+   state->loop = raspi_event_loop_create(NULL, NULL);
+   CHECK(state->loop);
+   check_signal_loop = state->loop;
+
+   memset(&action, 0, sizeof(action));
+   action.sa_handler = check_signal_handler;
+   sigemptyset(&action.sa_mask);
+   CHECK(sigaction(SIGUSR1, &action, &old_action) == 0);
+
+   state->loop_thread = pthread_self();
+   state->delay_ms = 50;
+   CHECK(pthread_create(&thread, NULL, check_signal_thread, state) == 0);
+   CHECK(check_run(state->loop) == 0);
+   pthread_join(thread, NULL);
+
+   sigaction(SIGUSR1, &old_action, NULL);
+   raspi_event_loop_destroy(state->loop);
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   static const struct
+   {
+      const char *name;
+      int (*check)(CHECK_STATE_T *state);
+   } checks[] =
+   {
+      { "gpio", check_gpio },
+      { "timers", check_timers },
+      { "stop", check_stop },
+      { "signal", check_signal },
+   };
+   unsigned int i, failures = 0;
+
+   vcos_unused(argc);
+   vcos_unused(argv);
+   vcos_init();
+
+   for (i = 0; i < vcos_countof(checks); i++)
+   {
+      CHECK_STATE_T state;
+      int result;
+
+      memset(&state, 0, sizeof(state));
+      result = checks[i].check(&state);
+      printf("%s: %s\n", checks[i].name, result ? "FAILED" : "ok");
+      if (result)
+         failures++;
+   }
+
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,382 @@
+/*
+Copyright (c) 2018, Raspberry Pi (Trading) Ltd.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Checks of the OV528 protocol engine, run over a pty pair. The engine gets the
+ * slave side as its serial port and the check plays the host on the master
+ * side: it initialises the camera, takes a snapshot and downloads the picture
+ * package by package, checking the headers and checksums of the packages
+ * against the picture, then asks for packages again and changes the baud rate.
+ *
+ * Usage: raspicam_check_ov528
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pty.h>
+#include <unistd.h>
+
+#include "interface/vcos/vcos.h"
+
+#include "RaspiOV528.h"
+
+/// Size of the picture handed over on SNAPSHOT, not a multiple of any package size
+#define CHECK_PICTURE_SIZE 3001
+/// Time to wait for bytes from the engine before giving up
+#define CHECK_READ_TIMEOUT_MS 1000
+
+#define CHECK(cond) do { if (!(cond)) { \
+   fprintf(stderr, "%s:%i: check failed: %s\n", __FILE__, __LINE__, #cond); \
+   return -1; } } while (0)
+
+typedef struct
+{
+   int host;                         /// Master side of the pty, the host end
+   int camera;                       /// Slave side of the pty, given to the engine
+   RASPI_OV528_T *ov528;
+
+   uint8_t picture[CHECK_PICTURE_SIZE];
+   unsigned int snapshots;           /// Pictures handed over
+   unsigned int released;            /// Release callbacks
+   unsigned int released_complete;   /// Release callbacks of pictures sent in full
+   uint8_t last_command;             /// Last command passed to the command callback
+} CHECK_STATE_T;
+
+/*****************************************************************************/
+/** Hand over the picture in several segments, one of them empty, so that
+ * packages straddle segments */
+static void check_command(RASPI_OV528_T *ov528, const RASPI_OV528_COMMAND_T *command, void *userdata)
+{
+   CHECK_STATE_T *state = (CHECK_STATE_T *)userdata;
+
+   state->last_command = command->id;
+   switch (command->id)
+   {
+   case RASPI_OV528_INIT:
+      raspi_ov528_ack(ov528, command->id);
+      break;
+   case RASPI_OV528_SNAPSHOT:
+   {
+      struct iovec segments[4] =
+      {
+         {state->picture, 100},
+         {state->picture + 100, 0},
+         {state->picture + 100, 1000},
+         {state->picture + 1100, CHECK_PICTURE_SIZE - 1100},
+      };
+
+      if (raspi_ov528_set_picture(ov528, segments, vcos_countof(segments), state) != 0)
+      {
+         raspi_ov528_nak(ov528, 0);
+         break;
+      }
+      state->snapshots++;
+      raspi_ov528_ack(ov528, command->id);
+      break;
+   }
+   default:
+      raspi_ov528_nak(ov528, 0);
+      break;
+   }
+}
+
+static void check_release(void *userdata, void *picture, int complete)
+{
+   CHECK_STATE_T *state = (CHECK_STATE_T *)userdata;
+
+   vcos_unused(picture);
+   state->released++;
+   if (complete)
+      state->released_complete++;
+}
+
+/*****************************************************************************/
+/** Send a command from the host and let the engine process it */
+static int check_send(CHECK_STATE_T *state, uint8_t id, uint8_t p1, uint8_t p2, uint8_t p3, uint8_t p4)
+{
+   uint8_t command[RASPI_OV528_COMMAND_LENGTH] = {0xAA, id, p1, p2, p3, p4};
+   struct pollfd pfd = {state->camera, POLLIN, 0};
+
+   CHECK(write(state->host, command, sizeof(command)) == sizeof(command));
+   CHECK(poll(&pfd, 1, CHECK_READ_TIMEOUT_MS) == 1);
+   CHECK(raspi_ov528_receive(state->ov528) == 0);
+   return 0;
+}
+
+/** Read exactly length bytes on the host side */
+static int check_read(CHECK_STATE_T *state, uint8_t *data, size_t length)
+{
+   while (length)
+   {
+      struct pollfd pfd = {state->host, POLLIN, 0};
+      ssize_t res;
+
+      CHECK(poll(&pfd, 1, CHECK_READ_TIMEOUT_MS) == 1);
+      res = read(state->host, data, length);
+      if (res < 0 && errno == EINTR)
+         continue;
+      CHECK(res > 0);
+      data += res;
+      length -= res;
+   }
+   return 0;
+}
+
+/** Whether the engine has sent nothing more */
+static int check_nothing_sent(CHECK_STATE_T *state)
+{
+   struct pollfd pfd = {state->host, POLLIN, 0};
+
+   return poll(&pfd, 1, 50) == 0;
+}
+
+/** Read a command sent by the engine and check it */
+static int check_reply(CHECK_STATE_T *state, uint8_t id, uint8_t p1)
+{
+   uint8_t reply[RASPI_OV528_COMMAND_LENGTH];
+
+   CHECK(check_read(state, reply, sizeof(reply)) == 0);
+   CHECK(reply[0] == 0xAA);
+   CHECK(reply[1] == id);
+   CHECK(reply[2] == p1);
+   return 0;
+}
+
+/** Read a package and check its header, data and checksum against the picture */
+static int check_read_package(CHECK_STATE_T *state, unsigned int package_size, unsigned int id)
+{
+   uint8_t package[RASPI_OV528_MAX_PACKAGE_SIZE];
+   unsigned int data_size = package_size - 6, size, i;
+   uint8_t checksum = 0;
+
+   size = CHECK_PICTURE_SIZE - id * data_size;
+   if (size > data_size)
+      size = data_size;
+
+   CHECK(check_read(state, package, size + 6) == 0);
+   CHECK((package[0] | (package[1] << 8)) == id);
+   CHECK((package[2] | (package[3] << 8)) == size);
+   CHECK(!memcmp(package + 4, state->picture + id * data_size, size));
+   for (i = 0; i < size + 4; i++)
+      checksum += package[i];
+   CHECK(package[size + 4] == checksum);
+   CHECK(package[size + 5] == 0);
+   return 0;
+}
+
+/** Ask for a package and check what comes back */
+static int check_package(CHECK_STATE_T *state, unsigned int package_size, unsigned int id)
+{
+   CHECK(check_send(state, RASPI_OV528_ACK, 0, 0, id & 0xFF, id >> 8) == 0);
+   return check_read_package(state, package_size, id);
+}
+
+/** Take a snapshot and ask for it, checking the size announced */
+static int check_get_picture(CHECK_STATE_T *state)
+{
+   uint8_t data[RASPI_OV528_COMMAND_LENGTH];
+
+   CHECK(check_send(state, RASPI_OV528_SNAPSHOT, 0, 0, 0, 0) == 0);
+   CHECK(check_reply(state, RASPI_OV528_ACK, RASPI_OV528_SNAPSHOT) == 0);
+   CHECK(check_send(state, RASPI_OV528_GET_PICTURE, 1, 0, 0, 0) == 0);
+   CHECK(check_reply(state, RASPI_OV528_ACK, RASPI_OV528_GET_PICTURE) == 0);
+   CHECK(check_read(state, data, sizeof(data)) == 0);
+   CHECK(data[0] == 0xAA && data[1] == RASPI_OV528_DATA && data[2] == 1);
+   CHECK((data[3] | (data[4] << 8) | (data[5] << 16)) == CHECK_PICTURE_SIZE);
+   return 0;
+}
+
+static int check_set_package_size(CHECK_STATE_T *state, unsigned int package_size)
+{
+   CHECK(check_send(state, RASPI_OV528_SET_PACKAGE_SIZE, 8, package_size & 0xFF, package_size >> 8, 0) == 0);
+   CHECK(check_reply(state, RASPI_OV528_ACK, RASPI_OV528_SET_PACKAGE_SIZE) == 0);
+   CHECK(raspi_ov528_get_package_size(state->ov528) == package_size);
+   return 0;
+}
+
+/*****************************************************************************/
+/** INIT, SNAPSHOT, GET_PICTURE and a plain transfer, one package per request */
+static int check_transfer(CHECK_STATE_T *state)
+{
+   unsigned int package_size = 64, data_size = package_size - 6;
+   unsigned int packages = (CHECK_PICTURE_SIZE + data_size - 1) / data_size, id;
+
+   CHECK(check_send(state, RASPI_OV528_INIT, 0, 7, 0, 7) == 0);
+   CHECK(check_reply(state, RASPI_OV528_ACK, RASPI_OV528_INIT) == 0);
+   CHECK(state->last_command == RASPI_OV528_INIT);
+   CHECK(check_set_package_size(state, package_size) == 0);
+   CHECK(check_get_picture(state) == 0);
+
+   for (id = 0; id < packages; id++)
+      CHECK(check_package(state, package_size, id) == 0);
+   CHECK(check_nothing_sent(state));
+
+   /* A package past the end of the picture is not sent */
+   CHECK(check_send(state, RASPI_OV528_ACK, 0, 0, packages & 0xFF, packages >> 8) == 0);
+   CHECK(check_nothing_sent(state));
+
+   /* The host closes the transfer */
+   CHECK(check_send(state, RASPI_OV528_ACK, 0, 0, 0xF0, 0xF0) == 0);
+   CHECK(state->released == 1 && state->released_complete == 1);
+   return 0;
+}
+
+/** Packages asked for again, with and without a window of packages sent ahead */
+static int check_retransmit(CHECK_STATE_T *state)
+{
+   unsigned int package_size = RASPI_OV528_MAX_PACKAGE_SIZE, data_size = package_size - 6;
+   unsigned int packages = (CHECK_PICTURE_SIZE + data_size - 1) / data_size, id;
+
+   CHECK(check_set_package_size(state, package_size) == 0);
+   CHECK(check_get_picture(state) == 0);
+
+   /* The same package twice, as after a checksum error on the host */
+   CHECK(check_package(state, package_size, 0) == 0);
+   CHECK(check_package(state, package_size, 0) == 0);
+   CHECK(check_package(state, package_size, 1) == 0);
+   CHECK(check_nothing_sent(state));
+
+   /* With a window of 3, the packages not sent yet follow the one asked for,
+    * but the ones already sent only go again when asked for */
+   raspi_ov528_set_window(state->ov528, 3);
+   CHECK(check_package(state, package_size, 1) == 0);
+   CHECK(check_read_package(state, package_size, 2) == 0);
+   CHECK(check_read_package(state, package_size, 3) == 0);
+   CHECK(check_nothing_sent(state));
+   CHECK(check_package(state, package_size, 2) == 0);
+   CHECK(check_read_package(state, package_size, 4) == 0);
+   CHECK(check_nothing_sent(state));
+   for (id = 5; id < packages; id++)
+      CHECK(check_package(state, package_size, id) == 0);
+   raspi_ov528_set_window(state->ov528, 1);
+
+   /* A new snapshot replaces the picture, which was not acknowledged in full */
+   CHECK(check_get_picture(state) == 0);
+   CHECK(state->released == 2 && state->released_complete == 2);
+   CHECK(check_package(state, package_size, 0) == 0);
+   CHECK(check_send(state, RASPI_OV528_ACK, 0, 0, 0xF0, 0xF0) == 0);
+   CHECK(state->released == 3 && state->released_complete == 2);
+   return 0;
+}
+
+/** Commands split across reads and mixed with noise */
+static int check_feed(CHECK_STATE_T *state)
+{
+   static const uint8_t data[] = {0x00, 0x55, 0xAA, RASPI_OV528_INIT, 0, 7};
+   static const uint8_t rest[] = {0, 7, 0xFF};
+
+   state->last_command = 0;
+   raspi_ov528_feed(state->ov528, data, 3);
+   raspi_ov528_feed(state->ov528, data + 3, sizeof(data) - 3);
+   CHECK(state->last_command == 0);
+   raspi_ov528_feed(state->ov528, rest, sizeof(rest));
+   CHECK(state->last_command == RASPI_OV528_INIT);
+   CHECK(check_reply(state, RASPI_OV528_ACK, RASPI_OV528_INIT) == 0);
+   CHECK(check_nothing_sent(state));
+   return 0;
+}
+
+/** SET_BAUD_RATE is acknowledged at the old rate, then the port is switched */
+static int check_baud_rate(CHECK_STATE_T *state)
+{
+   struct termios settings;
+
+   /* 7372800 / (63 + 1) / (1 + 1) = 57600 */
+   CHECK(check_send(state, RASPI_OV528_SET_BAUD_RATE, 63, 1, 0, 0) == 0);
+   CHECK(check_reply(state, RASPI_OV528_ACK, RASPI_OV528_SET_BAUD_RATE) == 0);
+   CHECK(tcgetattr(state->camera, &settings) == 0);
+   CHECK(cfgetospeed(&settings) == B57600 && cfgetispeed(&settings) == B57600);
+
+   /* 7372800 / (6 + 1) / (1 + 1) is not a rate a serial port can use */
+   CHECK(check_send(state, RASPI_OV528_SET_BAUD_RATE, 6, 1, 0, 0) == 0);
+   CHECK(check_reply(state, RASPI_OV528_NAK, 0) == 0);
+   CHECK(tcgetattr(state->camera, &settings) == 0);
+   CHECK(cfgetospeed(&settings) == B57600);
+
+   /* Pictures still go through at the new rate */
+   CHECK(check_set_package_size(state, 128) == 0);
+   CHECK(check_get_picture(state) == 0);
+   CHECK(check_package(state, 128, 0) == 0);
+   CHECK(check_package(state, 128, 23) == 0);
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   static const struct
+   {
+      const char *name;
+      int (*check)(CHECK_STATE_T *state);
+   } checks[] =
+   {
+      { "transfer", check_transfer },
+      { "retransmit", check_retransmit },
+      { "feed", check_feed },
+      { "baud rate", check_baud_rate },
+   };
+   CHECK_STATE_T *state;
+   unsigned int i, failures = 0;
+
+   vcos_unused(argc);
+   vcos_unused(argv);
+   vcos_init();
+
+   state = calloc(1, sizeof(*state));
+   if (!state || openpty(&state->host, &state->camera, NULL, NULL, NULL) != 0)
+   {
+      fprintf(stderr, "failed to open a pty pair: %s\n", strerror(errno));
+      return 1;
+   }
+   for (i = 0; i < CHECK_PICTURE_SIZE; i++)
+      state->picture[i] = (uint8_t)(i * 7 + (i >> 8));
+
+   if (raspi_ov528_serial_setup(state->camera, 115200, NULL) != 0)
+   {
+      fprintf(stderr, "failed to set up the pty: %s\n", strerror(errno));
+      return 1;
+   }
+   state->ov528 = raspi_ov528_create(state->camera, check_command, check_release, state);
+   if (!state->ov528)
+      return 1;
+
+   for (i = 0; i < vcos_countof(checks); i++)
+   {
+      int result = checks[i].check(state);
+      printf("%s: %s\n", checks[i].name, result ? "FAILED" : "ok");
+      if (result)
+         failures++;
+   }
+
+   raspi_ov528_destroy(state->ov528);
+   CHECK(state->released == state->snapshots);
+   close(state->camera);
+   close(state->host);
+   free(state);
+   return failures ? 1 : 0;
+}
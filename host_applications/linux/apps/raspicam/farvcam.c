@@ -73,6 +73,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "RaspiCLI.h"
 #include "RaspiHelpers.h"
 #include "RaspiGPS.h"
+#include "RaspiWriter.h"
+#include "RaspiEventLoop.h"
+#include "RaspiRingBuf.h"
+#include "RaspiOV528.h"
 
 #include <semaphore.h>
 #include <threads.h>
@@ -81,15 +85,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <pthread.h>
 #include <termios.h>
 #include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include "pigpio.h"
 
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 
-#define STB_IMAGE_RESIZE_IMPLEMENTATION
-#include "stb_image_resize.h"
-
 // Standard port setting for the camera component
 #define MMAL_CAMERA_PREVIEW_PORT 0
 #define MMAL_CAMERA_VIDEO_PORT 1
@@ -112,11 +116,42 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 /// Video render needs at least 2 buffers.
 #define VIDEO_OUTPUT_BUFFERS_NUM 3
 
+// Number of encoded video buffers the storage writer may hold before dropping frames
+#define WRITER_QUEUE_DEPTH 8
+
 #define MAX_USER_EXIF_TAGS 32
 #define MAX_EXIF_PAYLOAD_LENGTH 128
 
+/// Minimum number of buffers in the JPEG encoder output pool. Buffers holding
+/// an image are kept until it has been sent, so the pool must cover a whole image.
+#define IMAGE_OUTPUT_BUFFERS_NUM 8
+/// Maximum number of encoder buffers a single JPEG can span
+#define JPEG_MAX_SEGMENTS 16
+/// How long to wait for the JPEG encoder to deliver a full image (ms)
+#define JPEG_CAPTURE_TIMEOUT 5000
+/// Still resolution used until the terminal requests one with INIT
+#define STILL_DEFAULT_WIDTH 640
+#define STILL_DEFAULT_HEIGHT 480
+
 #define PIN_VIDEO 23
 #define PIN_RUNNING 24
+/// Time a GPIO level has to be stable before it is reported (us), filters out contact bounce
+#define GPIO_DEBOUNCE_US (50 * 1000)
+/// Maximum length of a single video while the video output stays enabled (ms)
+#define VIDEO_RECORD_LIMIT_MS (20 * 1000)
+/// Seconds of footage preceding a trigger written at the start of a video, or to an
+/// event file on SIGUSR1. 0 disables the pre-event buffer, the encoder then only runs while recording.
+#define PRE_EVENT_SECONDS 10
+/// Duration of the fragments of the recorded MP4 files (ms). Everything up to the last
+/// complete fragment stays playable if the recording is cut short by a power loss.
+#define VIDEO_FRAGMENT_MS 1000
+
+/// Serial device connected to the CAN-WAY terminal, can be overridden on the command line
+#define SERIAL_DEVICE "/dev/serial0"
+/// Serial baud rate until the terminal changes it with SET_BAUD_RATE, can be overridden on the command line
+#define SERIAL_BAUD_RATE 115200
+/// Snapshots held at once: the one being sent, the one queued after it and the one being taken
+#define STILL_IMAGES 3
 
 // Max bitrate we allow for recording
 const int MAX_BITRATE_MJPEG = 25000000;   // 25Mbits/s
@@ -161,24 +196,31 @@ typedef struct
     FILE *file_handle;      /// File handle to write buffer data to.
     RASPIVID_STATE *pstate; /// pointer to our state in case required in callback
     int abort;              /// Set to 1 in callback if an error occurs to attempt to abort the capture
-    char *cb_buff;          /// Circular buffer
-    int cb_len;             /// Length of buffer
-    int cb_wptr;            /// Current write pointer
-    int cb_wrap;            /// Has buffer wrapped at least once?
-    int cb_data;            /// Valid bytes in buffer
-#define IFRAME_BUFSIZE (60 * 1000)
-    int iframe_buff[IFRAME_BUFSIZE]; /// buffer of iframe pointers
-    int iframe_buff_wpos;
-    int iframe_buff_rpos;
-    char header_bytes[29];
-    int header_wptr;
+    RASPICAM_RINGBUF_T *ringbuf; /// Pre-event buffer, fed by the encoder between recordings too
     FILE *imv_file_handle; /// File handle to write inline motion vectors to.
     FILE *raw_file_handle; /// File handle to write raw data to.
     int flush_buffers;
     FILE *pts_file_handle; /// File timestamps
+    RASPI_WRITER_T *writer; /// Asynchronous writer for file_handle, NULL to write from the callback
+    pthread_mutex_t writer_lock; /// Held by the encoder callbacks while they use writer
+    VC_CONTAINER_T *container; /// MP4 file written by the writer instead of file_handle
 } PORT_USERDATA;
 
-/** Struct used to pass image information in encoder port userdata to callback
+/** Encoded JPEG image kept as the list of encoder buffer headers holding it,
+ * so that the data never has to be copied out of the encoder buffers.
+ * The buffer headers are acquired in the encoder callback and must be given back
+ * with jpeg_image_release() once the image has been sent and saved.
+ */
+typedef struct
+{
+    MMAL_BUFFER_HEADER_T *segment[JPEG_MAX_SEGMENTS]; /// Acquired encoder buffers, in stream order
+    unsigned int num_segments;                        /// Number of valid entries in segment
+    unsigned int length;                              /// Total size of the image in bytes
+} JPEG_IMAGE_T;
+
+/** Struct used to pass image information in encoder port userdata to callback.
+ * It lives as long as the still branch (splitter -> resizer -> JPEG encoder), which
+ * stays connected between captures.
  */
 typedef struct
 {
@@ -186,12 +228,10 @@ typedef struct
     VCOS_SEMAPHORE_T complete_semaphore; /// semaphore which is posted when we reach end of frame (indicates end of capture or fault)
     RASPIVID_STATE *pstate;              /// pointer to our state in case required in callback
     MMAL_POOL_T *encoderPool;
-    unsigned char *data;
-    unsigned int bufferPosition;
-    unsigned int startingOffset;
-    unsigned int offset;
-    unsigned int length;
-    unsigned int lengthActual;
+    pthread_mutex_t lock;                /// Protects the fields below, shared with the MMAL callbacks
+    int capture_pending;                 /// Set until a splitter frame has been passed on to the resizer
+    JPEG_IMAGE_T *image;                 /// Image the encoder buffers are collected into, NULL between captures
+    int overflow;                        /// Set if the image didn't fit in JPEG_MAX_SEGMENTS buffers
 } PORT_USERDATA_IMAGE;
 
 /** Possible raw output formats
@@ -246,8 +286,8 @@ struct RASPIVID_STATE_S
     MMAL_CONNECTION_T *preview_connection;       // Pointer to the connection from camera or splitter to preview
     MMAL_CONNECTION_T *splitter_connection;      // Pointer to the connection from camera to splitter
     MMAL_CONNECTION_T *encoder_connection;       // Pointer to the connection from camera to encoder
-    MMAL_CONNECTION_T *encoder_connection_image; // Pointer to the connection from splitter to encoder
-    MMAL_CONNECTION_T *resizer_connection;       // Pointer to the connection from splitter to encoder
+    MMAL_CONNECTION_T *encoder_connection_image; // Pointer to the connection from resizer to image encoder
+    MMAL_CONNECTION_T *resizer_connection;       // Pointer to the connection from splitter to resizer
 
     MMAL_POOL_T *splitter_pool;       /// Pointer to the pool of buffers used by splitter output port 0
     MMAL_POOL_T *splitter_pool_image; // Pointer to the pool of buffers used by splitter output port 1
@@ -256,6 +296,11 @@ struct RASPIVID_STATE_S
     MMAL_POOL_T *encoder_pool_image;
 
     PORT_USERDATA callback_data; /// Used to move data to the encoder callback
+    PORT_USERDATA_IMAGE callback_data_image; /// Used by the still branch callbacks
+
+    int still_width;   /// Current output size of the resizer
+    int still_height;
+    int still_quality; /// Current JPEG quality of the image encoder
 
     int bCapturing;      /// State of capture/pause
     int bCircularBuffer; /// Whether we are writing to a circular buffer
@@ -428,6 +473,43 @@ enum Data
     DATA_JPEG_PICTURE = 0x05
 };
 
+/** Состояние управляющего цикла farvcam. Общее для обработчиков GPIO, последовательного
+ * порта и таймера, которые вызываются из одного потока событийного цикла
+ */
+typedef struct
+{
+    RASPIVID_STATE *state;            /// Camera, encoders and their settings
+    RASPI_EVENT_LOOP_T *loop;         /// Event loop running the handlers below
+    int running;                      /// Set while the terminal keeps the camera enabled
+    int video_level;                  /// Last reported level of PIN_VIDEO
+
+    // Запись видео
+    RASPI_EVENT_TIMER_T *video_timer; /// Limits the length of a single video
+    int recording;                    /// Set while a video is being recorded
+    int video_num;                    /// Number of the video being recorded
+    FILE *video_log;                  /// Holds the number of the next video to write
+
+    // Буфер предыстории
+    pthread_t dump_thread;            /// Writes the pre-event footage at the start of a video
+    int dump_running;
+    uint32_t dump_duration;           /// Amount of pre-event footage wanted (ms)
+    pthread_t event_thread;           /// Writes the footage preceding a SIGUSR1 trigger
+    int event_running;
+    int event_num;                    /// Number of the next event file
+    int signal_fd;                    /// Receives SIGUSR1
+
+    // Обмен с терминалом по протоколу OV528
+    const char *serial_device;        /// Serial device connected to the terminal
+    int serial_fd;
+    struct termios old_serial;        /// Serial settings restored on exit
+    unsigned int baud_rate;           /// Initial baud rate of the serial port
+    RASPI_OV528_T *ov528;             /// Protocol engine, sends the pictures in packages
+    int still_width;                  /// Picture resolution set by INIT
+    int still_height;
+    JPEG_IMAGE_T images[STILL_IMAGES]; /// Snapshots kept in the encoder buffers until sent, free if empty
+    FILE *photo_log;                  /// Holds the number of the next photo to write
+} FARVCAM_CONTROL_T;
+
 /**
  * Assign a default set of parameters to the state passed in
  *
@@ -443,6 +525,7 @@ static void default_status(RASPIVID_STATE *state)
 
     // Default everything to zero
     memset(state, 0, sizeof(RASPIVID_STATE));
+    pthread_mutex_init(&state->callback_data.writer_lock, NULL);
 
     raspicommonsettings_set_defaults(&state->common_settings);
 
@@ -853,84 +936,16 @@ static void encoder_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
         // printf("Buffer length in callback: %d \n", bytes_written);
         int64_t current_time = get_microseconds64() / 1000;
 
-        vcos_assert(pData->file_handle);
+        vcos_assert(pData->file_handle || pData->container || pData->ringbuf);
         if (pData->pstate->inlineMotionVectors)
             vcos_assert(pData->imv_file_handle);
 
-        if (pData->cb_buff)
+        if (pData->ringbuf)
         {
-            int space_in_buff = pData->cb_len - pData->cb_wptr;
-            int copy_to_end = space_in_buff > buffer->length ? buffer->length : space_in_buff;
-            int copy_to_start = buffer->length - copy_to_end;
-
-            if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_CONFIG)
-            {
-                if (pData->header_wptr + buffer->length > sizeof(pData->header_bytes))
-                {
-                    vcos_log_error("Error in header bytes\n");
-                }
-                else
-                {
-                    // These are the header bytes, save them for final output
-                    mmal_buffer_header_mem_lock(buffer);
-                    memcpy(pData->header_bytes + pData->header_wptr, buffer->data, buffer->length);
-                    mmal_buffer_header_mem_unlock(buffer);
-                    pData->header_wptr += buffer->length;
-                }
-            }
-            else if ((buffer->flags & MMAL_BUFFER_HEADER_FLAG_CODECSIDEINFO))
-            {
-                // Do something with the inline motion vectors...
-            }
-            else
-            {
-                static int frame_start = -1;
-                int i;
-
-                if (frame_start == -1)
-                    frame_start = pData->cb_wptr;
-
-                if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_KEYFRAME)
-                {
-                    pData->iframe_buff[pData->iframe_buff_wpos] = frame_start;
-                    pData->iframe_buff_wpos = (pData->iframe_buff_wpos + 1) % IFRAME_BUFSIZE;
-                }
-
-                if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END)
-                    frame_start = -1;
-
-                // If we overtake the iframe rptr then move the rptr along
-                if ((pData->iframe_buff_rpos + 1) % IFRAME_BUFSIZE != pData->iframe_buff_wpos)
-                {
-                    while (
-                        (
-                            pData->cb_wptr <= pData->iframe_buff[pData->iframe_buff_rpos] &&
-                            (pData->cb_wptr + buffer->length) > pData->iframe_buff[pData->iframe_buff_rpos]) ||
-                        ((pData->cb_wptr > pData->iframe_buff[pData->iframe_buff_rpos]) &&
-                         (pData->cb_wptr + buffer->length) > (pData->iframe_buff[pData->iframe_buff_rpos] + pData->cb_len)))
-                        pData->iframe_buff_rpos = (pData->iframe_buff_rpos + 1) % IFRAME_BUFSIZE;
-                }
-
-                mmal_buffer_header_mem_lock(buffer);
-                // We are pushing data into a circular buffer
-                memcpy(pData->cb_buff + pData->cb_wptr, buffer->data, copy_to_end);
-                memcpy(pData->cb_buff, buffer->data + copy_to_end, copy_to_start);
-                mmal_buffer_header_mem_unlock(buffer);
-
-                if ((pData->cb_wptr + buffer->length) > pData->cb_len)
-                    pData->cb_wrap = 1;
-
-                pData->cb_wptr = (pData->cb_wptr + buffer->length) % pData->cb_len;
-
-                for (i = pData->iframe_buff_rpos; i != pData->iframe_buff_wpos; i = (i + 1) % IFRAME_BUFSIZE)
-                {
-                    int p = pData->iframe_buff[i];
-                    if (pData->cb_buff[p] != 0 || pData->cb_buff[p + 1] != 0 || pData->cb_buff[p + 2] != 0 || pData->cb_buff[p + 3] != 1)
-                    {
-                        vcos_log_error("Error in iframe list\n");
-                    }
-                }
-            }
+            // Во время записи буфер передаётся писателю через pre_event_sink
+            mmal_buffer_header_mem_lock(buffer);
+            raspicam_ringbuf_push(pData->ringbuf, buffer->data, buffer->length, buffer->flags, buffer->pts, buffer);
+            mmal_buffer_header_mem_unlock(buffer);
         }
         else
         {
@@ -959,7 +974,9 @@ static void encoder_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
 
                     if (new_handle)
                     {
-                        fclose(pData->file_handle);
+                        // The writer closes the old file once everything queued for it is written
+                        if (!pData->writer || raspi_writer_switch_file(pData->writer, new_handle) != 0)
+                            fclose(pData->file_handle);
                         pData->file_handle = new_handle;
                     }
                 }
@@ -1004,6 +1021,17 @@ static void encoder_buffer_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
                         bytes_written = buffer->length;
                     }
                 }
+                else if (pData->writer)
+                {
+                    pthread_mutex_lock(&pData->writer_lock);
+                    // Dropped buffers are accounted for by the writer, only a failed write aborts.
+                    // Buffers arriving once stop_recording() has taken the writer away are dropped.
+                    if (pData->writer && raspi_writer_write(pData->writer, buffer) == RASPI_WRITER_FAILED)
+                        bytes_written = 0;
+                    else
+                        bytes_written = buffer->length;
+                    pthread_mutex_unlock(&pData->writer_lock);
+                }
                 else
                 {
                     bytes_written = fwrite(buffer->data, 1, buffer->length, pData->file_handle);
@@ -1588,6 +1616,9 @@ static MMAL_STATUS_T create_encoder_component(RASPIVID_STATE *state)
     if (encoder_output->buffer_num < encoder_output->buffer_num_min)
         encoder_output->buffer_num = encoder_output->buffer_num_min;
 
+    // Extra buffers so the encoder keeps going while the writer holds some
+    encoder_output->buffer_num += WRITER_QUEUE_DEPTH;
+
     // We need to set the frame rate on output to 0, to ensure it gets
     // updated correctly from the input framerate when port connected
     encoder_output->format->es->video.frame_rate.num = 0;
@@ -1896,6 +1927,11 @@ static MMAL_STATUS_T create_encoder_component_image(RASPIVID_STATE *state)
     if (encoder_output->buffer_num < encoder_output->buffer_num_min)
         encoder_output->buffer_num = encoder_output->buffer_num_min;
 
+    // The buffers of a picture are held until it has been sent, so make sure the
+    // encoder still has buffers to fill while we hold on to the previous ones
+    if (encoder_output->buffer_num < IMAGE_OUTPUT_BUFFERS_NUM)
+        encoder_output->buffer_num = IMAGE_OUTPUT_BUFFERS_NUM;
+
     // Commit the port changes to the output port
     status = mmal_port_format_commit(encoder_output);
 
@@ -2009,6 +2045,12 @@ MMAL_STATUS_T create_resizer_component(RASPIVID_STATE *state)
     }
     status = mmal_component_create("vc.ril.isp", &resizer);
     if (status != MMAL_SUCCESS)
+    {
+        // Без ISP видеоядра кадр масштабируется программно
+        vcos_log_error("Unable to create vc.ril.isp, falling back to the software isp");
+        status = mmal_component_create("isp", &resizer);
+    }
+    if (status != MMAL_SUCCESS)
     {
         printf("Failed to create resize component\n");
         goto error;
@@ -2030,12 +2072,12 @@ MMAL_STATUS_T create_resizer_component(RASPIVID_STATE *state)
     }
     resizer->output[0]->buffer_num = 1;
     mmal_format_copy(resizer->output[0]->format, resizer->input[0]->format);
-    resizer->output[0]->format->es->video.width = 640;
-    resizer->output[0]->format->es->video.height = 480;
+    resizer->output[0]->format->es->video.width = VCOS_ALIGN_UP(STILL_DEFAULT_WIDTH, 32);
+    resizer->output[0]->format->es->video.height = VCOS_ALIGN_UP(STILL_DEFAULT_HEIGHT, 16);
     resizer->output[0]->format->es->video.crop.x = 0;
     resizer->output[0]->format->es->video.crop.y = 0;
-    resizer->output[0]->format->es->video.crop.width = 640;
-    resizer->output[0]->format->es->video.crop.height = 480;
+    resizer->output[0]->format->es->video.crop.width = STILL_DEFAULT_WIDTH;
+    resizer->output[0]->format->es->video.crop.height = STILL_DEFAULT_HEIGHT;
     // resizer->output[0]->format->es->video.frame_rate.num = 0;
     // resizer->output[0]->format->es->video.frame_rate.den = 1;
 
@@ -2081,32 +2123,28 @@ static void encoder_buffer_callback_image(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_
 
     if (pData)
     {
-        unsigned int flags = buffer->flags;
-        pData->lengthActual += buffer->length;
-        mmal_buffer_header_mem_lock(buffer);
-        // printf("buffer->length: %d\n", buffer->length);
-        // printf("pData->offset: %d\n", pData->offset);
-        for (unsigned int i = 0; i < buffer->length; i++, pData->bufferPosition++)
+        JPEG_IMAGE_T *image;
+
+        pthread_mutex_lock(&pData->lock);
+        // Output arriving after a capture timed out has nowhere to go
+        image = pData->image;
+        if (image && buffer->length)
         {
-            if (pData->offset >= pData->length)
+            if (image->num_segments < JPEG_MAX_SEGMENTS)
             {
-                printf("pData->offset: %d\n", pData->offset);
-                printf("pData->length: %d\n", pData->length);
-                printf("buffer->length: %d\n", buffer->length);
-                printf("Buffer provided was too small! Failed to copy data into buffer\n");
-                break;
+                // Keep the buffer rather than copying its contents, it is
+                // given back to the pool by jpeg_image_release()
+                mmal_buffer_header_acquire(buffer);
+                mmal_buffer_header_mem_lock(buffer);
+                image->segment[image->num_segments++] = buffer;
+                image->length += buffer->length;
             }
             else
             {
-                // if (pData->bufferPosition >= 54)
-                // {
-
-                pData->data[pData->offset] = buffer->data[i];
-                pData->offset++;
-                // }
+                vcos_log_error("JPEG image spans more than %d encoder buffers", JPEG_MAX_SEGMENTS);
+                pData->overflow = 1;
             }
         }
-        mmal_buffer_header_mem_unlock(buffer);
         // int bytes_written = buffer->length;
 
         // if (buffer->length && pData->file_handle)
@@ -2126,19 +2164,22 @@ static void encoder_buffer_callback_image(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_
         // }
 
         // // Now flag if we have completed
-        if (buffer->flags & (MMAL_BUFFER_HEADER_FLAG_FRAME_END | MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED))
+        if (image && (buffer->flags & (MMAL_BUFFER_HEADER_FLAG_FRAME_END | MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED)))
         {
-            printf("HERE\n");
+            if (buffer->flags & MMAL_BUFFER_HEADER_FLAG_TRANSMISSION_FAILED)
+                pData->overflow = 1;
+            pData->image = NULL;
             // Перенёс функцию увеличения семафора сюда из конца функции
             // после этого перестала возникать ошибка с недостаточным объёмом буфера
             vcos_semaphore_post(&(pData->complete_semaphore));
         }
+        pthread_mutex_unlock(&pData->lock);
     }
     else
     {
         vcos_log_error("Received a encoder buffer callback with no state");
     }
-    // release buffer back to the pool
+    // release buffer back to the pool (it stays out of the pool if we acquired it above)
     mmal_buffer_header_release(buffer);
     // and send one back to the port (if still open)
     if (port->is_enabled)
@@ -2159,7 +2200,12 @@ static void encoder_buffer_callback_image(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_
     //     vcos_semaphore_post(&(pData->complete_semaphore));
 }
 
-int start_recording(RASPIVID_STATE *state)
+/** Подключение видеоэнкодера и запуск кодирования. Пока не идёт запись, данные
+ * энкодера попадают только в буфер предыстории (если он есть)
+ * @param state указатель на структуру state
+ * @return 0 в случае успеха, -1 при ошибке
+ * */
+static int start_encoding(RASPIVID_STATE *state)
 {
     int status;
     MMAL_PORT_T *camera_video_port = state->camera_component->output[MMAL_CAMERA_VIDEO_PORT];
@@ -2182,16 +2228,6 @@ int start_recording(RASPIVID_STATE *state)
     // Set up our video userdata - this is passed through to the callback where we need the information.
     state->callback_data.pstate = state;
     state->callback_data.abort = 0;
-    state->callback_data.file_handle = NULL;
-    // state->common_settings.filename = malloc(max_filename_length);
-    // strncpy(state->common_settings.filename, "video1.h264", max_filename_length);
-    state->callback_data.file_handle = fopen(state->common_settings.filename, "wb");
-    if (!state->callback_data.file_handle)
-    {
-        // Notify user, carry on but discarding encoded output buffers
-        vcos_log_error("%s: Error opening output file: %s\nNo output file will be generated\n", __func__, state->common_settings.filename);
-        return -1;
-    }
     // Set up our userdata - this is passed through to the callback where we need the information.
     encoder_output_port->userdata = (struct MMAL_PORT_USERDATA_T *)&state->callback_data;
     if (encoder_output_port->is_enabled)
@@ -2203,25 +2239,14 @@ int start_recording(RASPIVID_STATE *state)
     status = mmal_port_enable(encoder_output_port, encoder_buffer_callback);
     if (status != MMAL_SUCCESS)
         return -1;
-    // Send all the buffers to the encoder output port
-    if (state->callback_data.file_handle)
+    // Send all the buffers to the encoder output port in one go
     {
-        int num = mmal_queue_length(state->encoder_pool->queue);
-        int q;
-        for (q = 0; q < num; q++)
-        {
-            MMAL_BUFFER_HEADER_T *buffer = mmal_queue_get(state->encoder_pool->queue);
-            if (!buffer)
-            {
-                vcos_log_error("Unable to get a required buffer %d from pool queue", q);
-                return -1;
-            }
+        unsigned int sent;
 
-            if (mmal_port_send_buffer(encoder_output_port, buffer) != MMAL_SUCCESS)
-            {
-                vcos_log_error("Unable to send a buffer to encoder output port (%d)", q);
-                return -1;
-            }
+        if (mmal_port_send_pool_buffers(encoder_output_port, state->encoder_pool, &sent) != MMAL_SUCCESS)
+        {
+            vcos_log_error("Unable to send a buffer to encoder output port (%u sent)", sent);
+            return -1;
         }
     }
     // Enable Capture parameter of camera video port for starting video capture
@@ -2230,7 +2255,10 @@ int start_recording(RASPIVID_STATE *state)
     return 0;
 }
 
-int stop_recording(RASPIVID_STATE *state)
+/** Остановка кодирования и отключение видеоэнкодера
+ * @param state указатель на структуру state
+ * */
+static void stop_encoding(RASPIVID_STATE *state)
 {
     int status;
     MMAL_PORT_T *camera_video_port = state->camera_component->output[MMAL_CAMERA_VIDEO_PORT];
@@ -2246,166 +2274,455 @@ int stop_recording(RASPIVID_STATE *state)
         else
             printf("Encoder connection was not destroyed\n");
     }
-    fclose(state->callback_data.file_handle);
-    // Clear callback userdata
-    // encoder_output_port->userdata = (struct MMAL_PORT_USERDATA_T *){0};
-    state->callback_data = (const PORT_USERDATA){0};
-    return 0;
 }
 
-int take_picture(RASPIVID_STATE *state, unsigned char *preallocated_data, unsigned int length, unsigned int *lengthActual)
+/** Живой приёмник буфера предыстории: после того, как предыстория записана в файл,
+ * данные энкодера передаются асинхронному писателю
+ * */
+static void pre_event_sink(void *userdata, void *buffer)
 {
-    int status;
-    VCOS_STATUS_T vcos_status;
-    MMAL_PORT_T *camera_video_port = state->camera_component->output[MMAL_CAMERA_VIDEO_PORT];
-    MMAL_PORT_T *splitter_image_port = state->splitter_component->output[1];
-    MMAL_PORT_T *encoder_input_port_image = state->encoder_component_image->input[0];
-    MMAL_PORT_T *encoder_output_port_image = state->encoder_component_image->output[0];
+    PORT_USERDATA *pData = (PORT_USERDATA *)userdata;
+
+    pthread_mutex_lock(&pData->writer_lock);
+    if (pData->writer && raspi_writer_write(pData->writer, (MMAL_BUFFER_HEADER_T *)buffer) == RASPI_WRITER_FAILED)
+        pData->abort = 1;
+    pthread_mutex_unlock(&pData->writer_lock);
+}
+
+int start_recording(RASPIVID_STATE *state)
+{
+    MMAL_PORT_T *encoder_output_port = state->encoder_component->output[0];
+    RASPI_WRITER_T *writer;
+    VC_CONTAINER_T *container;
 
-    // Восстанавливаем соединение энкодера, если оно было разорвано (после получения очередной фотографии)
-    if (!state->encoder_connection_image->is_enabled)
+    // state->common_settings.filename = malloc(max_filename_length);
+    // strncpy(state->common_settings.filename, "video1.h264", max_filename_length);
+    container = raspi_writer_open_mp4(state->common_settings.filename, encoder_output_port, VIDEO_FRAGMENT_MS);
+    if (!container)
     {
-        status = connect_ports(splitter_image_port, encoder_input_port_image, &state->encoder_connection_image);
-        if (status != MMAL_SUCCESS)
-        {
-            state->encoder_connection_image = NULL;
-            vcos_log_error("%s: Failed to connect splitter output port 1 to image encoder input", __func__);
-            return -1;
-        }
-        printf("Encoder connection for still image is ready\n");
-    }
-    PORT_USERDATA_IMAGE userdata;
-    userdata.pstate = state;
-    vcos_status = vcos_semaphore_create(&userdata.complete_semaphore, "Farvcam-sem", 0);
-    userdata.encoderPool = state->encoder_pool_image;
-    userdata.data = preallocated_data;
-    userdata.bufferPosition = 0;
-    userdata.offset = 0;
-    userdata.startingOffset = 0;
-    userdata.length = length;
-    userdata.lengthActual = 0;
-
-    encoder_output_port_image->userdata = (struct MMAL_PORT_USERDATA_T *)&userdata;
-    if (encoder_output_port_image->is_enabled)
-    {
-        printf("Could not enable encoder output port. Try waiting longer before attempting to take another picture\n");
+        // Notify user, carry on but discarding encoded output buffers
+        vcos_log_error("%s: Error opening output file: %s\nNo output file will be generated\n", __func__, state->common_settings.filename);
+        return -1;
+    }
+    // MP4 файл пишется только через писателя
+    writer = raspi_writer_create(NULL, WRITER_QUEUE_DEPTH, state->callback_data.flush_buffers,
+                                 encoder_output_port, state->encoder_pool);
+    if (!writer || raspi_writer_switch_container(writer, container) != 0)
+    {
+        vcos_log_error("%s: Unable to create storage writer", __func__);
+        if (writer)
+            raspi_writer_destroy(writer);
+        vc_container_close(container);
         return -1;
     }
-    status = mmal_port_enable(encoder_output_port_image, encoder_buffer_callback_image);
 
-    int num = mmal_queue_length(state->encoder_pool_image->queue);
-    for (int q = 0; q < num; q++)
+    state->callback_data.container = container;
+    pthread_mutex_lock(&state->callback_data.writer_lock);
+    state->callback_data.writer = writer;
+    pthread_mutex_unlock(&state->callback_data.writer_lock);
+
+    // Энкодер уже работает на буфер предыстории. Писатель подключается после того,
+    // как предыстория будет записана в файл (см. pre_event_dump)
+    if (state->callback_data.ringbuf)
+        return 0;
+
+    return start_encoding(state);
+}
+
+int stop_recording(RASPIVID_STATE *state)
+{
+    RASPI_WRITER_T *writer;
+
+    if (state->callback_data.ringbuf)
+    {
+        // энкодер продолжает работать на буфер предыстории, отключаем от него только файл
+        raspicam_ringbuf_set_sink(state->callback_data.ringbuf, NULL, NULL);
+    }
+    else
     {
-        MMAL_BUFFER_HEADER_T *buffer = mmal_queue_get(state->encoder_pool_image->queue);
+        stop_encoding(state);
+    }
+    // Once the writer is taken away under writer_lock, no encoder callback can still be using it
+    pthread_mutex_lock(&state->callback_data.writer_lock);
+    writer = state->callback_data.writer;
+    state->callback_data.writer = NULL;
+    pthread_mutex_unlock(&state->callback_data.writer_lock);
+    if (writer)
+    {
+        if (state->common_settings.verbose)
+            raspi_writer_print_stats(writer, stderr);
+        raspi_writer_destroy(writer);
+    }
+    // закрытие дописывает последний фрагмент
+    if (state->callback_data.container)
+        vc_container_close(state->callback_data.container);
+    state->callback_data.container = NULL;
+    if (state->callback_data.file_handle)
+        fclose(state->callback_data.file_handle);
+    state->callback_data.file_handle = NULL;
+    return 0;
+}
 
-        if (!buffer)
-            vcos_log_error("Unable to get a required buffer %d from pool queue", q);
+/**
+ * Give the encoder buffers holding an image back to their pool
+ *
+ * @param image Image to release. It is left empty.
+ */
+static void jpeg_image_release(JPEG_IMAGE_T *image)
+{
+    unsigned int i;
 
-        if (mmal_port_send_buffer(encoder_output_port_image, buffer) != MMAL_SUCCESS)
-            vcos_log_error("Unable to send a buffer to encoder output port (%d)", q);
+    for (i = 0; i < image->num_segments; i++)
+    {
+        mmal_buffer_header_mem_unlock(image->segment[i]);
+        mmal_buffer_header_release(image->segment[i]);
     }
-    if (mmal_port_parameter_set_boolean(camera_video_port, MMAL_PARAMETER_CAPTURE, 1) != MMAL_SUCCESS)
+    image->num_segments = 0;
+    image->length = 0;
+}
+
+/**
+ * Describe a range of an image as a list of iovecs pointing into the encoder buffers
+ *
+ * @param image Image to read from
+ * @param offset Offset of the range in the image
+ * @param size Size of the range. Must be within the image.
+ * @param iov Array filled in with the pieces of the range
+ * @param max_iov Number of entries available in iov
+ *
+ * @return number of iovecs used
+ */
+static int jpeg_image_gather(const JPEG_IMAGE_T *image, unsigned int offset, unsigned int size,
+                             struct iovec *iov, int max_iov)
+{
+    unsigned int i;
+    int iov_num = 0;
+
+    for (i = 0; i < image->num_segments && size && iov_num < max_iov; i++)
     {
-        vcos_log_error("Failed to start capture");
-        return -1;
+        MMAL_BUFFER_HEADER_T *segment = image->segment[i];
+        unsigned int chunk;
+
+        if (offset >= segment->length)
+        {
+            offset -= segment->length;
+            continue;
+        }
+
+        chunk = vcos_min(segment->length - offset, size);
+        iov[iov_num].iov_base = segment->data + segment->offset + offset;
+        iov[iov_num].iov_len = chunk;
+        iov_num++;
+        size -= chunk;
+        offset = 0;
     }
-    vcos_semaphore_wait(&userdata.complete_semaphore);
-    vcos_semaphore_delete(&userdata.complete_semaphore);
-    // mmal_port_parameter_set_boolean(camera_video_port, MMAL_PARAMETER_CAPTURE, 0);
-    printf("Actual image size: %d\n", userdata.lengthActual);
-    *lengthActual = userdata.lengthActual;
+    return iov_num;
+}
 
-    // Выключаем порт и разрываем соединение, чтобы происходила очистка буферов перед следующим захватом
-    check_disable_port(encoder_output_port_image);
-    if (state->encoder_connection_image->is_enabled)
+/**
+ * Write a whole image to a file
+ *
+ * @return 0 on success, -1 if the image could not be written completely
+ */
+static int jpeg_image_write(const JPEG_IMAGE_T *image, FILE *file)
+{
+    unsigned int i;
+
+    for (i = 0; i < image->num_segments; i++)
     {
-        status = mmal_connection_destroy(state->encoder_connection_image);
-        if (status == MMAL_SUCCESS)
-            printf("Encoder image connection was destroyed\n");
-        else
-            printf("Encoder image connection was not destroyed\n");
+        const MMAL_BUFFER_HEADER_T *segment = image->segment[i];
+        if (fwrite(segment->data + segment->offset, 1, segment->length, file) != segment->length)
+            return -1;
     }
-    encoder_output_port_image->userdata = (const struct MMAL_PORT_USERDATA_T *){0};
-    userdata = (const PORT_USERDATA_IMAGE){0};
     return 0;
 }
 
-size_t getImageBufferSize(RASPIVID_STATE *state)
+/** Send the image encoder buffers available in its pool to its output port
+ * */
+static void still_send_buffers(RASPIVID_STATE *state)
 {
-    //oversize the buffer so to fit BMP images
-    //oversize the buffer so to fit BMP images
-    int width = VCOS_ALIGN_UP(1920, 32);
-    int height = VCOS_ALIGN_UP(1080, 16);
-    size_t buffer_size = width * height * 3 + 54;
-    return buffer_size;
+    MMAL_PORT_T *encoder_output_port_image = state->encoder_component_image->output[0];
+
+    if (encoder_output_port_image->is_enabled &&
+        mmal_port_send_pool_buffers(encoder_output_port_image, state->encoder_pool_image, NULL) != MMAL_SUCCESS)
+        vcos_log_error("Unable to send a buffer to encoder output port");
 }
 
-int serial_setup(int fd, struct termios *old_serial, struct termios *new_serial)
+/** Callback of the splitter -> resizer connection. The splitter delivers every
+ * video frame, only the frame following a capture request is passed on to the
+ * resizer, the others go straight back to the splitter
+ * */
+static void still_connection_callback(MMAL_CONNECTION_T *connection)
 {
-    tcgetattr(fd, old_serial);
-    bzero(new_serial, sizeof(*new_serial));
-    /*
-      BAUDRATE: 115200 baud.
-      CRTSCTS : no output hardware flow control
-      CLOCAL  : do not change "owner" of the port
-      CS8     : 8n1 (8bit,no parity,1 stopbit)
-      CREAD   : enable receiving
-    */
-    cfsetispeed(new_serial, B115200);
-    cfsetospeed(new_serial, B115200);
-    new_serial->c_cflag |= (CLOCAL | CREAD);
-    new_serial->c_cflag &= ~PARENB;
-    new_serial->c_cflag &= ~CSTOPB;
-    new_serial->c_cflag &= ~CSIZE;
-    new_serial->c_cflag |= CS8;
-    new_serial->c_cflag &= ~CRTSCTS;
-    /* Do not map CR to NL and vice versa for input */
-    new_serial->c_iflag &= ~(ICRNL | INLCR);
-    new_serial->c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
-    new_serial->c_cc[VTIME] = 1; // межсимвольный таймер 0.1 sec
-    new_serial->c_cc[VMIN] = 6;  // блокирующее чтение до тех пор, пока не получим 6 символов
-    new_serial->c_oflag &= ~OPOST;
-    tcflush(fd, TCIFLUSH);
-    tcsetattr(fd, TCSANOW, new_serial);
-    return 0;
+    PORT_USERDATA_IMAGE *pData = (PORT_USERDATA_IMAGE *)connection->user_data;
+    MMAL_BUFFER_HEADER_T *buffer;
+
+    while ((buffer = mmal_queue_get(connection->queue)) != NULL)
+    {
+        int forward = 0;
+
+        if (!buffer->cmd && buffer->length)
+        {
+            pthread_mutex_lock(&pData->lock);
+            forward = pData->capture_pending;
+            pData->capture_pending = 0;
+            pthread_mutex_unlock(&pData->lock);
+        }
+        if (forward && connection->in->is_enabled &&
+            mmal_port_send_buffer(connection->in, buffer) == MMAL_SUCCESS)
+            continue;
+        if (forward)
+        {
+            // кадр не принят, захватываем следующий
+            pthread_mutex_lock(&pData->lock);
+            pData->capture_pending = 1;
+            pthread_mutex_unlock(&pData->lock);
+        }
+        mmal_buffer_header_release(buffer);
+    }
+
+    // Keep the splitter output supplied with buffers
+    if (connection->out->is_enabled)
+        mmal_port_send_pool_buffers(connection->out, connection->pool, NULL);
 }
 
-bool write_serial_command(int fd, uint8_t *args, uint8_t argn)
+/** Set the size and quality of the pictures produced by the still branch. Nothing
+ * is done if they don't change, otherwise only the still branch is briefly stopped.
+ * The frame is cropped to the aspect ratio of the picture before being resized.
+ * @param state указатель на структуру state
+ * @return MMAL_SUCCESS или код ошибки
+ * */
+static MMAL_STATUS_T still_configure(RASPIVID_STATE *state, int width, int height, int quality)
 {
-    int w = write(fd, args, argn);
-    //tcdrain(fd);
-    if (w < 0)
-        return false;
+    MMAL_PORT_T *resizer_input = state->resize_component->input[0];
+    MMAL_PORT_T *resizer_output = state->resize_component->output[0];
+    MMAL_PORT_T *encoder_input_port_image = state->encoder_component_image->input[0];
+    MMAL_PORT_T *encoder_output_port_image = state->encoder_component_image->output[0];
+    MMAL_VIDEO_FORMAT_T *video;
+    MMAL_STATUS_T status;
+    int frame_width, frame_height, crop_width, crop_height;
+
+    if (width == state->still_width && height == state->still_height && quality == state->still_quality)
+        return MMAL_SUCCESS;
+
+    check_disable_port(encoder_output_port_image);
+    if (state->encoder_connection_image)
+    {
+        mmal_connection_destroy(state->encoder_connection_image);
+        state->encoder_connection_image = NULL;
+    }
+    status = mmal_connection_disable(state->resizer_connection);
+    if (status != MMAL_SUCCESS)
+        goto error;
+    state->still_width = 0;
+
+    // Кадр видео 16:9 обрезается до соотношения сторон фотографии (4:3 или 5:4),
+    // чтобы уменьшение размера не искажало изображение
+    video = &resizer_input->format->es->video;
+    frame_width = video->width;
+    frame_height = video->height;
+    if (state->splitter_component->output[1]->format->es->video.crop.width)
+    {
+        frame_width = state->splitter_component->output[1]->format->es->video.crop.width;
+        frame_height = state->splitter_component->output[1]->format->es->video.crop.height;
+    }
+    crop_width = frame_width;
+    crop_height = frame_height;
+    if ((int64_t)frame_width * height > (int64_t)frame_height * width)
+        crop_width = ((int64_t)frame_height * width / height) & ~1;
     else
-        return true;
+        crop_height = ((int64_t)frame_width * height / width) & ~1;
+    video->crop.x = ((frame_width - crop_width) / 2) & ~1;
+    video->crop.y = ((frame_height - crop_height) / 2) & ~1;
+    video->crop.width = crop_width;
+    video->crop.height = crop_height;
+    status = mmal_port_format_commit(resizer_input);
+    if (status != MMAL_SUCCESS)
+    {
+        vcos_log_error("Unable to set the crop on resizer input port");
+        goto error;
+    }
+
+    video = &resizer_output->format->es->video;
+    video->width = VCOS_ALIGN_UP(width, 32);
+    video->height = VCOS_ALIGN_UP(height, 16);
+    video->crop.x = 0;
+    video->crop.y = 0;
+    video->crop.width = width;
+    video->crop.height = height;
+    status = mmal_port_format_commit(resizer_output);
+    if (status != MMAL_SUCCESS)
+    {
+        vcos_log_error("Unable to set format on resizer output port");
+        goto error;
+    }
+
+    status = mmal_connection_enable(state->resizer_connection);
+    if (status != MMAL_SUCCESS)
+        goto error;
+    // The image encoder input takes the new format of the resizer output
+    status = connect_ports(resizer_output, encoder_input_port_image, &state->encoder_connection_image);
+    if (status != MMAL_SUCCESS)
+    {
+        state->encoder_connection_image = NULL;
+        vcos_log_error("%s: Failed to connect resizer output to image encoder input", __func__);
+        goto error;
+    }
+
+    status = mmal_port_parameter_set_uint32(encoder_output_port_image, MMAL_PARAMETER_JPEG_Q_FACTOR, quality);
+    if (status != MMAL_SUCCESS)
+    {
+        vcos_log_error("Unable to set JPEG quality");
+        goto error;
+    }
+    status = mmal_port_enable(encoder_output_port_image, encoder_buffer_callback_image);
+    if (status != MMAL_SUCCESS)
+        goto error;
+    still_send_buffers(state);
+
+    state->still_width = width;
+    state->still_height = height;
+    state->still_quality = quality;
+    printf("Still branch set to %dx%d, quality %d\n", width, height, quality);
+    return MMAL_SUCCESS;
+
+error:
+    vcos_log_error("%s: Failed to configure the still branch for %dx%d", __func__, width, height);
+    return status;
 }
 
-/** Функция для обрезки кадра
- * @param input_image указатель на массив входного изображения
- * @param input_w ширина в пкс входного изображения
- * @param input_h высота в пкс входного изображения
- * @param output_image указатель на массив выходного обрезанного изображения, он должен
- * быть создан заранее
- * @param output_w ширина в пкс выходного обрезанного изображения
- * @param output_h высота в пкс выходного обрезанного изображения
- * @param cropX номер пикселя по оси X (горизонталь) изображения, с которого начинается обрезка
- * @param cropY номер пикселя по оси Y (вертикаль) изображения, с которого начинается обрезка
- * @return NULL
+/** Создание ветви фотосъёмки: выход 1 разветвителя -> масштабирование (vc.ril.isp) ->
+ * JPEG энкодер. Соединения остаются активными между снимками
+ * @param state указатель на структуру state
+ * @return MMAL_SUCCESS или код ошибки
  * */
-void cropRGB(uint8_t *input_image, int input_w, int input_h,
-             uint8_t *output_image, int output_w, int output_h,
-             int cropX, int cropY)
+static MMAL_STATUS_T still_pipeline_create(RASPIVID_STATE *state)
 {
-    unsigned int row;
-    uint8_t *rowBuffer = malloc(3 * output_w * sizeof(uint8_t));
-    uint8_t *out_ptr = output_image;
-    for (row = cropY; row < cropY + output_h; ++row)
+    PORT_USERDATA_IMAGE *pData = &state->callback_data_image;
+    MMAL_PORT_T *splitter_image_port = state->splitter_component->output[1];
+    MMAL_PORT_T *encoder_output_port_image = state->encoder_component_image->output[0];
+    MMAL_STATUS_T status;
+
+    status = create_resizer_component(state);
+    if (status != MMAL_SUCCESS)
+        return status;
+    status = mmal_component_enable(state->resize_component);
+    if (status != MMAL_SUCCESS)
+        return status;
+
+    pData->pstate = state;
+    pData->encoderPool = state->encoder_pool_image;
+    pData->image = NULL;
+    pData->capture_pending = 0;
+    if (vcos_semaphore_create(&pData->complete_semaphore, "Farvcam-sem", 0) != VCOS_SUCCESS)
+        return MMAL_ENOMEM;
+    pthread_mutex_init(&pData->lock, NULL);
+    encoder_output_port_image->userdata = (struct MMAL_PORT_USERDATA_T *)pData;
+
+    // Every video frame passes through the host on its way to the resizer, share
+    // the buffers with the GPU instead of copying them
+    mmal_port_parameter_set_boolean(splitter_image_port, MMAL_PARAMETER_ZERO_COPY, MMAL_TRUE);
+    mmal_port_parameter_set_boolean(state->resize_component->input[0], MMAL_PARAMETER_ZERO_COPY, MMAL_TRUE);
+    status = mmal_connection_create(&state->resizer_connection, splitter_image_port,
+                                    state->resize_component->input[0], 0);
+    if (status != MMAL_SUCCESS)
     {
-        memcpy(out_ptr, input_image + 3 * (row * input_w + cropX), 3 * output_w);
-        if (row != cropY + output_h - 1)
-            out_ptr += 3 * output_w;
+        state->resizer_connection = NULL;
+        vcos_log_error("%s: Failed to connect splitter output port 1 to resizer input", __func__);
+        return status;
     }
-    free(rowBuffer);
+    state->resizer_connection->user_data = pData;
+    state->resizer_connection->callback = still_connection_callback;
+
+    state->still_width = 0;
+    return still_configure(state, STILL_DEFAULT_WIDTH, STILL_DEFAULT_HEIGHT, state->quality);
+}
+
+/** Остановка и удаление ветви фотосъёмки
+ * @param state указатель на структуру state
+ * */
+static void still_pipeline_destroy(RASPIVID_STATE *state)
+{
+    PORT_USERDATA_IMAGE *pData = &state->callback_data_image;
+
+    if (state->encoder_component_image)
+        check_disable_port(state->encoder_component_image->output[0]);
+    if (state->encoder_connection_image)
+        mmal_connection_destroy(state->encoder_connection_image);
+    state->encoder_connection_image = NULL;
+    if (state->resizer_connection)
+    {
+        mmal_connection_destroy(state->resizer_connection);
+        state->resizer_connection = NULL;
+        vcos_semaphore_delete(&pData->complete_semaphore);
+        pthread_mutex_destroy(&pData->lock);
+    }
+}
+
+/**
+ * Capture a JPEG image from the still branch. The branch stays connected, a
+ * capture only lets the next video frame through to the resizer.
+ *
+ * @param state Pointer to state control struct
+ * @param image Filled in with the encoder buffers holding the image. The caller
+ * must call jpeg_image_release() once done with it.
+ * @param width Width of the picture
+ * @param height Height of the picture
+ * @param quality JPEG quality (1-100)
+ *
+ * @return 0 on success, -1 on failure
+ */
+int take_picture(RASPIVID_STATE *state, JPEG_IMAGE_T *image, int width, int height, int quality)
+{
+    PORT_USERDATA_IMAGE *pData = &state->callback_data_image;
+    MMAL_PORT_T *camera_video_port = state->camera_component->output[MMAL_CAMERA_VIDEO_PORT];
+    int overflow;
+
+    image->num_segments = 0;
+    image->length = 0;
+    if (!state->resizer_connection || still_configure(state, width, height, quality) != MMAL_SUCCESS)
+    {
+        vcos_log_error("%s: Still branch is not available", __func__);
+        return -1;
+    }
+    // Buffers of the previous picture are back in the pool by now
+    still_send_buffers(state);
+
+    // A late completion of a timed out capture must not end this one
+    while (vcos_semaphore_trywait(&pData->complete_semaphore) == VCOS_SUCCESS)
+        ;
+    pthread_mutex_lock(&pData->lock);
+    pData->image = image;
+    pData->overflow = 0;
+    pData->capture_pending = 1;
+    pthread_mutex_unlock(&pData->lock);
+
+    // Кадры поступают на разветвитель, пока включён захват видеопорта камеры
+    if (mmal_port_parameter_set_boolean(camera_video_port, MMAL_PARAMETER_CAPTURE, 1) != MMAL_SUCCESS)
+    {
+        vcos_log_error("Failed to start capture");
+        pData->overflow = 1;
+    }
+    // Don't wait forever if the encoder runs out of buffers to fill
+    else if (vcos_semaphore_wait_timeout(&pData->complete_semaphore, JPEG_CAPTURE_TIMEOUT) != VCOS_SUCCESS)
+    {
+        vcos_log_error("Timed out waiting for the JPEG encoder");
+        pData->overflow = 1;
+    }
+
+    pthread_mutex_lock(&pData->lock);
+    pData->image = NULL;
+    pData->capture_pending = 0;
+    overflow = pData->overflow;
+    pthread_mutex_unlock(&pData->lock);
+
+    printf("Actual image size: %d in %d buffers\n", image->length, image->num_segments);
+    if (overflow)
+    {
+        jpeg_image_release(image);
+        return -1;
+    }
+    return 0;
 }
 
 /** Функция возвращающая текущий номер медиафайла, который нужно сохранить
@@ -2421,51 +2738,153 @@ int get_last_media_num(FILE *file)
     return num;
 }
 
-/** Функция вызываемая потоком для записи и сохранения видео.
- * @param state_arg указатель на структуру state
- * @return NULL
+/** Запись кадра предыстории в начало видео, напрямую через писателя (его очередь
+ * ещё пуста)
+ * */
+static int pre_event_output(void *userdata, const uint8_t *data, size_t length, uint32_t flags, int64_t pts)
+{
+    PORT_USERDATA *pData = (PORT_USERDATA *)userdata;
+
+    return raspi_writer_write_direct(pData->writer, data, length, flags, pts);
+}
+
+/** Поток записи предыстории в начало видео. Когда предыстория записана и запись
+ * догнала энкодер, данные энкодера передаются писателю
  * */
-void *video_routine(void *state_arg)
+static void *pre_event_dump_routine(void *arg)
 {
-    RASPIVID_STATE *state = (RASPIVID_STATE *)state_arg;
-    char video_name[max_filename_length];
-    int video_num = 0;
-    state->common_settings.filename = malloc(max_filename_length);
-    struct timespec start_time, end_time;
-    FILE *video_log; // текстовый файл, в котором записан номер видео, которое надо записать
-    if ((video_log = fopen("video_log.txt", "r+")) == NULL)
+    FARVCAM_CONTROL_T *control = (FARVCAM_CONTROL_T *)arg;
+    PORT_USERDATA *pData = &control->state->callback_data;
+
+    if (raspicam_ringbuf_dump_frames(pData->ringbuf, control->dump_duration, pre_event_output, pData,
+                                     pre_event_sink, pData) < 0)
     {
-        printf("Error opening file!\n");
+        // предыстория записана не полностью, но само видео терять нельзя
+        vcos_log_error("Failed to write the pre-event footage");
+        raspicam_ringbuf_set_sink(pData->ringbuf, pre_event_sink, pData);
+    }
+    return NULL;
+}
+
+/** Начало записи очередного видео. Номер видео берётся из video_log.txt
+ * @param control состояние управляющего цикла
+ * @param pre_event_ms длительность предыстории в начале видео (мс). Видео, продолжающее
+ * предыдущее, начинается с последнего ключевого кадра (0)
+ * */
+static void video_start(FARVCAM_CONTROL_T *control, uint32_t pre_event_ms)
+{
+    RASPIVID_STATE *state = control->state;
+
+    control->video_num = get_last_media_num(control->video_log);
+    if (control->video_num > 5)
+    {
+        control->video_num = 1;
+    }
+    snprintf(state->common_settings.filename, max_filename_length, "usbdisk.d/video_%d.mp4", control->video_num);
+    if (start_recording(state) != 0)
+        return;
+    control->recording = 1;
+    if (state->callback_data.ringbuf)
+    {
+        control->dump_duration = pre_event_ms;
+        if (pthread_create(&control->dump_thread, NULL, pre_event_dump_routine, control) == 0)
+            control->dump_running = 1;
+        else
+            raspicam_ringbuf_set_sink(state->callback_data.ringbuf, pre_event_sink, &state->callback_data);
+    }
+    // ограничиваем длительность одного видео, по истечении времени запись продолжается в следующий файл
+    raspi_event_timer_set(control->video_timer, VIDEO_RECORD_LIMIT_MS, 0);
+}
+
+/** Остановка записи видео и сохранение номера следующего видео в video_log.txt
+ * @param control состояние управляющего цикла
+ * */
+static void video_stop(FARVCAM_CONTROL_T *control)
+{
+    if (!control->recording)
+        return;
+    raspi_event_timer_set(control->video_timer, 0, 0);
+    if (control->dump_running)
+    {
+        pthread_join(control->dump_thread, NULL);
+        control->dump_running = 0;
+    }
+    stop_recording(control->state);
+    control->recording = 0;
+    control->video_num++;
+    fprintf(control->video_log, "video%3d", control->video_num);
+    fflush(control->video_log);
+}
+
+/** Истекло максимальное время записи одного видео
+ * */
+static void video_timer_event(RASPI_EVENT_LOOP_T *loop, RASPI_EVENT_TIMER_T *timer, void *userdata)
+{
+    FARVCAM_CONTROL_T *control = (FARVCAM_CONTROL_T *)userdata;
+
+    video_stop(control);
+    // если выход для управления камерой всё ещё включен, сразу начинаем следующее видео
+    if (control->running && control->video_level == PI_OFF)
+        video_start(control, 0);
+}
+
+/** Запись кадра предыстории события в его MP4 файл
+ * */
+static int event_output(void *userdata, const uint8_t *data, size_t length, uint32_t flags, int64_t pts)
+{
+    return raspi_writer_container_write((VC_CONTAINER_T *)userdata, data, length, flags, pts);
+}
+
+/** Поток записи предыстории события в отдельный файл
+ * */
+static void *event_dump_routine(void *arg)
+{
+    FARVCAM_CONTROL_T *control = (FARVCAM_CONTROL_T *)arg;
+    char event_name[max_filename_length];
+    VC_CONTAINER_T *container;
+
+    snprintf(event_name, sizeof(event_name), "usbdisk.d/event_%d.mp4", control->event_num);
+    // файл события записывается целиком сразу, фрагменты не нужны
+    container = raspi_writer_open_mp4(event_name, control->state->encoder_component->output[0], 0);
+    if (!container)
+    {
+        vcos_log_error("Unable to open %s", event_name);
         return NULL;
     }
-    while (gpioRead(PIN_RUNNING) == PI_OFF)
+    if (raspicam_ringbuf_dump_frames(control->state->callback_data.ringbuf, PRE_EVENT_SECONDS * 1000,
+                                     event_output, container, NULL, NULL) < 0)
+        vcos_log_error("Failed to write %s", event_name);
+    else
+        printf("Pre-event footage saved to %s\n", event_name);
+    vc_container_close(container);
+    return NULL;
+}
+
+/** Получен SIGUSR1: сохраняем последние PRE_EVENT_SECONDS секунд видео, не прерывая
+ * кодирование и текущую запись
+ * */
+static void signal_event(RASPI_EVENT_LOOP_T *loop, int fd, uint32_t events, void *userdata)
+{
+    FARVCAM_CONTROL_T *control = (FARVCAM_CONTROL_T *)userdata;
+    struct signalfd_siginfo info;
+
+    if (read(fd, &info, sizeof(info)) != sizeof(info))
+        return;
+    if (!control->running || !control->state->callback_data.ringbuf)
+        return;
+    if (control->event_running)
     {
-        // если выход для управления камерой включен, записываем видео по 5 минут
-        if (gpioRead(PIN_VIDEO) == PI_OFF)
+        if (pthread_tryjoin_np(control->event_thread, NULL) != 0)
         {
-            usleep(50*1000); // нужно немного подождать, потому что есть небольшой дребезг
-            video_num = get_last_media_num(video_log);
-            if (video_num > 5)
-            {
-                video_num = 1;
-            }
-            sprintf(video_name, "usbdisk.d/video_%d.h264", video_num);
-            strncpy(state->common_settings.filename, video_name, max_filename_length);
-            start_recording(state);
-            clock_gettime(CLOCK_MONOTONIC, &start_time);
-            while ((gpioRead(PIN_VIDEO) == PI_OFF) && (end_time.tv_sec - start_time.tv_sec < 20) && (gpioRead(PIN_RUNNING) == PI_OFF))
-            {
-                // ждём пока выход не отключится, не истечет время (5 минут) или не получен сигнал на выключение расберри 
-                clock_gettime(CLOCK_MONOTONIC, &end_time);
-            }
-            stop_recording(state);
-            video_num++;
-            fprintf(video_log, "video%3d", video_num);
+            printf("Previous event is still being saved, trigger ignored\n");
+            return;
         }
+        control->event_running = 0;
     }
-    free(state->common_settings.filename);
-    fclose(video_log);
-    return NULL;
+    if (++control->event_num > 5)
+        control->event_num = 1;
+    if (pthread_create(&control->event_thread, NULL, event_dump_routine, control) == 0)
+        control->event_running = 1;
 }
 
 typedef struct
@@ -2487,271 +2906,322 @@ static void custom_stbi_write_mem(void *context, void *data, int size)
     c->last_pos = cur_pos;
 }
 
-/** Функция вызываемая потоком для получения фото и его отправки в терминал CAN-WAY
- * по протоколу OV528
- * @param state_arg указатель на структуру state
- * @return NULL
+/** Снимок больше не нужен протоколу: сохраняем его на диске, если он был отправлен
+ * целиком, и возвращаем буферы энкодеру
+ * @param userdata состояние управляющего цикла
+ * @param picture снимок (JPEG_IMAGE_T)
+ * @param complete все пакеты снимка были отправлены
  * */
-void *photo_routine(void *state_arg)
+static void photo_release(void *userdata, void *picture, int complete)
 {
-    RASPIVID_STATE *state = (RASPIVID_STATE *)state_arg;
-    MMAL_STATUS_T status = MMAL_SUCCESS;
-    uint8_t commID, param1, param2, param3, param4;
-    uint8_t ACK_counter = 0x00;
-    // Буфер, в котором хранится принятое сообщение
-    uint8_t buffer[12];
-    /** Переменная, хранящая размер буфера изображения,
-     * вычисляемый в callback-функции, т.е. это реальный размер изображения,
-     * не взятый с запасом
-     */
-    unsigned int data_length;
-    size_t package_size;
-    size_t reserve_size;
-    /** буфер для хранения данных изображения, получаемых динамически. В этот
-     * буфер будут копироваться данные после захвата изображения
-     */
-    uint8_t *data;
-    /** указатель на data для отправки данных буфера в последовательный порт
-     */
-    uint8_t *ptr;
-    // буфер для отправки пакета данных (пока что ограничен размером 512)
-    uint8_t package[512];
-    // резервный буфер для отправки данных в случае повторного запроса пакета данных
-    uint8_t reserve_package[512];
-    // ID текущего пакета, который необходимо отправить
-    uint32_t package_id = 0;
-    // ID предыдущего пакета, который уже отправлен
-    uint32_t package_id_prev = -1;
-    uint32_t package_max_id;
-    uint32_t verify_checksum = 0;
-    int im_width, im_height;
-    unsigned int crop_width, crop_height;
-    int cropX, cropY;
-    float w_to_h;
-    // переменная, запускающая цикл ожидания и обработки запроса
-    int running = 1;
-    int bytes_in_buf; 
+    FARVCAM_CONTROL_T *control = (FARVCAM_CONTROL_T *)userdata;
+    RASPIVID_STATE *state = control->state;
+    JPEG_IMAGE_T *image = (JPEG_IMAGE_T *)picture;
     FILE *output_file = NULL; // файл, в который записывается изображение
-    FILE *photo_log; // текстовый файл, в котором записан номер фото, которое надо сохранить
-    state->jpeg_filename = malloc(max_filename_length);
     int photo_num = 0;
 
-    // Открытие и настройка последовательного порта
-    struct termios old_serial, new_serial;
-    int fd = open("/dev/serial0", O_RDWR | O_NOCTTY);
-    if (fd == -1)
+    if (complete)
     {
-        fprintf(stderr, "Unable to open serial device\n");
-        return -1;
+        // сохраняем фотографию на диске (перезаписываем файлы, если превысили предел)
+        photo_num = get_last_media_num(control->photo_log);
+        if (photo_num > 5)
+        {
+            photo_num = 1;
+        }
+        sprintf(state->jpeg_filename, "usbdisk.d/photo_%d.jpeg", photo_num);
+        output_file = fopen(state->jpeg_filename, "wb");
+        if (output_file)
+        {
+            // здесь записываем только реальное количество байт
+            if (jpeg_image_write(image, output_file) != 0)
+                vcos_log_error("Failed to write %s", state->jpeg_filename);
+            fclose(output_file);
+        }
+        photo_num++;
+        fprintf(control->photo_log, "photo%3d", photo_num);
+    }
+    jpeg_image_release(image);
+}
+
+/** Снимок для терминала. Он делается в свободный буфер, поэтому предыдущий снимок
+ * продолжает отправляться, пока терминал не запросит новый
+ * @param control состояние управляющего цикла
+ * */
+static void snapshot(FARVCAM_CONTROL_T *control)
+{
+    RASPIVID_STATE *state = control->state;
+    struct iovec iov[JPEG_MAX_SEGMENTS];
+    JPEG_IMAGE_T *image = NULL;
+    int i, iov_num;
+
+    for (i = 0; i < STILL_IMAGES && !image; i++)
+    {
+        if (control->images[i].num_segments == 0)
+            image = &control->images[i];
     }
-    serial_setup(fd, &old_serial, &new_serial);
-    if ((photo_log = fopen("photo_log.txt", "r+")) == NULL)
+    if (!image)
     {
-        printf("Error opening file!\n");
-        return NULL;
+        vcos_log_error("No free buffer for the picture");
+        return;
     }
-    printf("Starting communication routine\n");
-    while (gpioRead(PIN_RUNNING) == PI_OFF)
+
+    int64_t tic = get_microseconds64();
+    if (take_picture(state, image, control->still_width, control->still_height, state->quality) != 0)
     {
-        ioctl(fd, FIONREAD, &bytes_in_buf); // определяем сколько байт в буфере последовательного порта
-        if (bytes_in_buf == 0) // эта проверка нужна, чтобы прерывать цикл, если первый цифровой выход терминала выключен
-        {
-            continue;
-        }
-        int res = read(fd, buffer, 6);
-        // printf("Number of received bytes: %d \n", res);
-        commID = buffer[1];
-        param1 = buffer[2];
-        param2 = buffer[3];
-        param3 = buffer[4];
-        param4 = buffer[5];
-        switch (commID)
+        vcos_log_error("Failed to take a picture");
+        return;
+    }
+    printf("Elapsed: %.3f seconds\n", (get_microseconds64() - tic) / 1000000.0);
+
+    // заголовки и контрольные суммы всех пакетов рассчитываются здесь, до запроса снимка
+    iov_num = jpeg_image_gather(image, 0, image->length, iov, JPEG_MAX_SEGMENTS);
+    if (raspi_ov528_set_picture(control->ov528, iov, iov_num, image) != 0)
+    {
+        vcos_log_error("Failed to queue the picture");
+        jpeg_image_release(image);
+    }
+}
+
+/** Обработка команды, принятой от терминала CAN-WAY по протоколу OV528.
+ * Размер пакета, скорость порта, запрос снимка и передача пакетов
+ * обрабатываются RaspiOV528
+ * @param ov528 протокол
+ * @param command принятая команда
+ * @param userdata состояние управляющего цикла
+ * */
+static void process_ov528_command(RASPI_OV528_T *ov528, const RASPI_OV528_COMMAND_T *command, void *userdata)
+{
+    FARVCAM_CONTROL_T *control = (FARVCAM_CONTROL_T *)userdata;
+    int im_width, im_height;
+
+    switch (command->id)
+    {
+    case SYNC:
+    {
+        printf("Received SYNC command \n");
+        raspi_ov528_ack(ov528, command->id);
+        break;
+    }
+    case INIT:
+    {
+        im_width = control->still_width;
+        im_height = control->still_height;
+        switch (command->param[3])
         {
-        case SYNC:
+        case RES_160x128:
         {
-            uint8_t args[] = {0xAA, ACK, commID, ACK_counter, 0x00, 0x00};
-            printf("Received SYNC command \n");
-            write_serial_command(fd, args, 6);
+            // Это разрешение не поддерживается терминалом CAN-WAY
+            im_width = 160;
+            im_height = 128;
             break;
         }
-        case INIT:
+        case RES_320x240:
         {
-            /**
-             * изменение разрешения фотографии пока не работает
-             */
-            switch (param4)
-            {
-            case RES_160x128:
-            {
-                // Это разрешение не поддерживается терминалом CAN-WAY
-                im_width = 160;
-                im_height = 128;
-                break;
-            }
-            case RES_320x240:
-            {
-                im_width = 320;
-                im_height = 240;
-                break;
-            }
-            case RES_640x480:
-            {
-                im_width = 640;
-                im_height = 480;
-                break;
-            }
-            }
-            printf("Received Initial command\n");
-            // w_to_h = (float)im_width / (float)im_height;
-            // crop_width = ceil(state->common_settings.height * w_to_h);
-            // /** Терминал CAN-WAY отправляет запрос на получения фотографий, у которых отношение
-            //  * ширина/высота равно 5:4 или 4:3. При этом для разрешения видео 1920х1080 это отношение равно
-            //  * 16:9. Поэтому сначала видеокадр обрезается так, чтобы сохранить максимально возможное исходное
-            //  * разрешение, но при этом уменьшить ширину кадра для соответствия отношению 5:4 или 4:3. После
-            //  * этого разрешение обрезанного кадра можно уменьшить до заданного без искажения фото.
-            //  * */
-            // crop_height = state->common_settings.height;
-            // cropX = state->common_settings.width / 2 - crop_width / 2;
-            // cropY = 0;
-            uint8_t args[] = {0xAA, ACK, commID, ACK_counter, 0x00, 0x00};
-            write_serial_command(fd, args, 6);
+            im_width = 320;
+            im_height = 240;
             break;
         }
-        case SET_PACKAGE_SIZE:
+        case RES_640x480:
         {
-            printf("Received Set Package Command\n");
-            package_size = (param3 << 8U) | param2;
-            uint8_t args[] = {0xAA, ACK, commID, ACK_counter, 0x00, 0x00};
-            printf("Package size is: %d\n", package_size);
-            write_serial_command(fd, args, 6);
+            im_width = 640;
+            im_height = 480;
             break;
         }
-        case SNAPSHOT:
+        }
+        // Ветвь фотосъёмки перестраивается на новое разрешение при следующем снимке
+        control->still_width = im_width;
+        control->still_height = im_height;
+        printf("Received Initial command, resolution %dx%d\n", im_width, im_height);
+        /** Терминал CAN-WAY отправляет запрос на получения фотографий, у которых отношение
+         * ширина/высота равно 5:4 или 4:3, а у видеокадра оно 16:9. Кадр обрезается до
+         * соотношения сторон фотографии перед уменьшением (см. still_configure)
+         * */
+        raspi_ov528_ack(ov528, command->id);
+        break;
+    }
+    case SNAPSHOT:
+    {
+        printf("Received Snapshot command\n");
+        raspi_ov528_ack(ov528, command->id);
+        snapshot(control);
+        break;
+    }
+    default:
+        printf("Unsupported command 0x%02x\n", command->id);
+        raspi_ov528_nak(ov528, 0);
+        break;
+    }
+}
+
+/** Приём данных от терминала. Команды OV528 собираются из принятых байт, поэтому
+ * команда, пришедшая по частям, обрабатывается после получения последнего байта
+ * */
+static void serial_event(RASPI_EVENT_LOOP_T *loop, int fd, uint32_t events, void *userdata)
+{
+    FARVCAM_CONTROL_T *control = (FARVCAM_CONTROL_T *)userdata;
+
+    if ((events & (EPOLLERR | EPOLLHUP)) || raspi_ov528_receive(control->ov528) != 0)
+    {
+        vcos_log_error("Serial device %s closed", control->serial_device);
+        raspi_event_loop_remove_fd(loop, fd);
+    }
+}
+
+/** Терминал включил камеру: открываем последовательный порт и файлы с номерами
+ * видео и фото
+ * @param control состояние управляющего цикла
+ * @return 0 в случае успеха, -1 при ошибке
+ * */
+static int control_start(FARVCAM_CONTROL_T *control)
+{
+    if ((control->video_log = fopen("video_log.txt", "r+")) == NULL ||
+        (control->photo_log = fopen("photo_log.txt", "r+")) == NULL)
+    {
+        printf("Error opening file!\n");
+        return -1;
+    }
+
+    // Открытие и настройка последовательного порта
+    control->serial_fd = open(control->serial_device, O_RDWR | O_NOCTTY);
+    if (control->serial_fd == -1)
+    {
+        fprintf(stderr, "Unable to open serial device %s\n", control->serial_device);
+        return -1;
+    }
+    if (raspi_ov528_serial_setup(control->serial_fd, control->baud_rate, &control->old_serial) != 0)
+    {
+        fprintf(stderr, "Unable to set up serial device %s at %u baud\n", control->serial_device, control->baud_rate);
+        close(control->serial_fd);
+        control->serial_fd = -1;
+        return -1;
+    }
+    control->ov528 = raspi_ov528_create(control->serial_fd, process_ov528_command, photo_release, control);
+    if (!control->ov528)
+        return -1;
+    if (raspi_event_loop_add_fd(control->loop, control->serial_fd, EPOLLIN, serial_event, control) != 0)
+        return -1;
+
+    // Энкодер работает постоянно на буфер предыстории. Буфер вмещает вдвое больше
+    // PRE_EVENT_SECONDS, чтобы предыстория могла начинаться с предшествующего ключевого кадра
+    if (PRE_EVENT_SECONDS > 0)
+    {
+        RASPIVID_STATE *state = control->state;
+        size_t size = (size_t)(state->bitrate ? state->bitrate : MAX_BITRATE_LEVEL4) / 8 * PRE_EVENT_SECONDS * 2;
+        unsigned int max_frames = PRE_EVENT_SECONDS * 2 * (state->framerate ? state->framerate : VIDEO_FRAME_RATE_NUM);
+
+        state->callback_data.ringbuf = raspicam_ringbuf_create(size, max_frames);
+        if (state->callback_data.ringbuf && start_encoding(state) != 0)
         {
-            printf("Received Snapshot command\n");
-            uint8_t args[] = {0xAA, ACK, commID, ACK_counter, 0x00, 0x00};
-            write_serial_command(fd, args, 6);
-            unsigned int length_oversized = getImageBufferSize(state);
-            // Выделяем память для изображения
-            data = malloc(length_oversized * sizeof(uint8_t));
-            // Делаем снимок
-            clock_t tic = clock();
-            take_picture(state, data, length_oversized, &data_length);
-            clock_t toc = clock();
-            printf("Elapsed: %f seconds\n", (double)(toc - tic) / CLOCKS_PER_SEC);
-            // рассчитываем максимальный ID отправляемого пакета
-            package_max_id = floor(data_length / (package_size - 6));
-            // ptr теперь указывает на первый элемент буфера data
-            ptr = data;
-            break;
+            stop_encoding(state);
+            raspicam_ringbuf_destroy(state->callback_data.ringbuf);
+            state->callback_data.ringbuf = NULL;
         }
-        case GET_PICTURE:
+        if (!state->callback_data.ringbuf)
+            vcos_log_error("%s: Pre-event buffer disabled, the encoder will only run while recording", __func__);
+    }
+
+    control->running = 1;
+    printf("Starting communication routine\n");
+
+    // выход для управления видео мог быть включен раньше камеры
+    if (control->video_level == PI_OFF)
+        video_start(control, PRE_EVENT_SECONDS * 1000);
+    return 0;
+}
+
+/** Остановка записи видео, возврат буферов энкодеру и закрытие всех файлов
+ * @param control состояние управляющего цикла
+ * */
+static void control_stop(FARVCAM_CONTROL_T *control)
+{
+    video_stop(control);
+    control->running = 0;
+
+    if (control->event_running)
+    {
+        pthread_join(control->event_thread, NULL);
+        control->event_running = 0;
+    }
+    if (control->state->callback_data.ringbuf)
+    {
+        stop_encoding(control->state);
+        raspicam_ringbuf_destroy(control->state->callback_data.ringbuf);
+        control->state->callback_data.ringbuf = NULL;
+    }
+
+    if (control->serial_fd != -1)
+    {
+        raspi_event_loop_remove_fd(control->loop, control->serial_fd);
+        // снимки, которые ещё не были отправлены, возвращаются энкодеру
+        raspi_ov528_destroy(control->ov528);
+        control->ov528 = NULL;
+        tcsetattr(control->serial_fd, TCSANOW, &control->old_serial);
+        close(control->serial_fd);
+        control->serial_fd = -1;
+    }
+    if (control->video_log)
+    {
+        fclose(control->video_log);
+        control->video_log = NULL;
+    }
+    if (control->photo_log)
+    {
+        fclose(control->photo_log);
+        control->photo_log = NULL;
+    }
+}
+
+/** Изменение уровня на входах управления камерой.
+ * В терминале ВКЛЮЧЁННОЕ состояние выхода соответствует PI_OFF!
+ * */
+static void gpio_event(RASPI_EVENT_LOOP_T *loop, unsigned int gpio, int level, void *userdata)
+{
+    FARVCAM_CONTROL_T *control = (FARVCAM_CONTROL_T *)userdata;
+
+    switch (gpio)
+    {
+    case PIN_RUNNING:
+        if (level == PI_OFF && !control->running)
         {
-            printf("Received Get picture command\n");
-            uint8_t args_1[] = {0xAA, ACK, commID, ACK_counter, 0x00, 0x00};
-            write_serial_command(fd, args_1, 6);
-            param1 = data_length & 0x000000FFU;
-            param2 = (data_length & 0x0000FF00U) >> 8U;
-            param3 = (data_length & 0x00FF0000U) >> 16U;
-            uint8_t args_2[] = {0xAA, DATA, 0x01, param1, param2, param3};
-            write_serial_command(fd, args_2, 6);
-            break;
+            if (control_start(control) != 0)
+                raspi_event_loop_stop(loop);
         }
-        case ACK:
+        else if (level == PI_ON && control->running)
         {
-            printf("Received ACK command\n");
-            if ((param3 == 0xF0) && (param4 == 0xF0))
-            {
-                printf("All Image data was sent!\n");
-            }
-            else
-            {
-                /** Отправляем целый пакет данных, если текущий ID требуемого
-                 * пакета меньше максимального
-                */
-                package_id = (param4 << 8U) | param3;
-                printf("Package maximum ID: %d, package ID: %d \n", package_max_id, package_id);
-                // printf("Package ID: %d \n", package_id);
-                if ((package_id < package_max_id) && (package_id != package_id_prev))
-                {
-                    package[0] = param3;
-                    package[1] = param4;
-                    package[2] = (package_size - 6) & 0x000000FFU;
-                    package[3] = ((package_size - 6) & 0x0000FF00U) >> 8U;
-                    memcpy(package + 4, ptr, package_size - 6);
-                    for (int i = 0; i < package_size - 2; i++)
-                    {
-                        verify_checksum += package[i];
-                    }
-                    package[package_size - 2] = verify_checksum & 0x000000FFU;
-                    package[package_size - 1] = 0x00;
-                    int w = write(fd, package, package_size);
-                    // printf("Bytes written: %d \n", w);
-                    ptr += package_size - 6;
-                    verify_checksum = 0;
-                    package_id_prev = package_id;
-                    reserve_size = package_size;
-                    memcpy(reserve_package, package, package_size);
-                }
-                /** Отправляем остаток данных в пакете меньшего размера - это пакет
-                 * с максимальным идентификатором
-                */
-                else if (package_id != package_id_prev)
-                {
-                    package[0] = param3;
-                    package[1] = param4;
-                    package[2] = (data_length - package_max_id * (package_size - 6)) & 0x000000FFU;
-                    package[3] = ((data_length - package_max_id * (package_size - 6)) & 0x0000FF00U) >> 8U;
-                    memcpy(package + 4, ptr, data_length - package_max_id * (package_size - 6));
-                    for (int i = 0; i < 4 + data_length - package_max_id * (package_size - 6); i++)
-                    {
-                        verify_checksum += package[i];
-                    }
-                    package[4 + data_length - package_max_id * (package_size - 6)] = verify_checksum & 0x000000FFU;
-                    package[4 + data_length - package_max_id * (package_size - 6) + 1] = 0x00;
-
-                    int w = write(fd, package, 6 + data_length - package_max_id * (package_size - 6));
-                    // tcdrain(fd);
-                    verify_checksum = 0;
-                    package_id_prev = package_id;
-                    reserve_size = package_size;
-                    memcpy(reserve_package, package, 6 + data_length - package_max_id * (package_size - 6));
-
-                    // сохраняем фотографию на диске (перезаписываем файлы, если превысили предел)
-                    photo_num = get_last_media_num(photo_log);
-                    if (photo_num > 5)
-                    {
-                        photo_num = 1;
-                    }
-                    sprintf(state->jpeg_filename, "usbdisk.d/photo_%d.jpeg", photo_num);
-                    output_file = fopen(state->jpeg_filename, "wb");
-                    fwrite(data, 1, data_length, output_file); // здесь записываем только реальное количество байт
-                    fclose(output_file);
-                    output_file = NULL;
-                    photo_num++;
-                    fprintf(photo_log, "photo%3d", photo_num);
-                    // сбрасываем указатель
-                    ptr = NULL;
-                    // освобождаем память, динамически выделенную для хранения изображения
-                    free(data);
-                }
-                else
-                {
-                    int w = write(fd, reserve_package, reserve_size);
-                }
-            }
+            // терминал выключил камеру - завершаем работу
+            raspi_event_loop_stop(loop);
         }
+        break;
 
+    case PIN_VIDEO:
+        control->video_level = level;
+        if (!control->running)
+            break;
+        // если выход для управления камерой включен, записываем видео по VIDEO_RECORD_LIMIT_MS
+        if (level == PI_OFF && !control->recording)
+            video_start(control, PRE_EVENT_SECONDS * 1000);
+        else if (level == PI_ON)
+            video_stop(control);
         break;
-        }
-        if (buffer[0] == 'Z')
-            running = 0;
     }
-    tcsetattr(fd, TCSANOW, &old_serial);
-    close(fd);
-    
-    free(state->jpeg_filename);
-    return NULL;
+}
+
+/// Event loop of the running application, used to stop it from a signal handler
+static RASPI_EVENT_LOOP_T *control_loop;
+
+/** Передача изменения уровня входа из потока pigpio в событийный цикл
+ * */
+static void gpio_alert(int gpio, int level, uint32_t tick, void *userdata)
+{
+    // PI_TIMEOUT приходит от watchdog, а не от изменения уровня
+    if (level != PI_TIMEOUT)
+        raspi_event_loop_post_gpio((RASPI_EVENT_LOOP_T *)userdata, gpio, level);
+}
+
+static void control_signal_handler(int signal_number)
+{
+    if (control_loop)
+        raspi_event_loop_stop(control_loop);
 }
 
 /**
@@ -2761,7 +3231,6 @@ int main(int argc, const char **argv)
 {
     // Основная структура, хранящая практически все данные о камере и прочих компонентах
     RASPIVID_STATE state;
-    PORT_USERDATA_IMAGE callback_data_image;
     // int exit_code = EX_OK;
     MMAL_STATUS_T status = MMAL_SUCCESS;
     MMAL_PORT_T *camera_preview_port = NULL;
@@ -2782,12 +3251,17 @@ int main(int argc, const char **argv)
     MMAL_PORT_T *resizer_input_port = NULL;
     MMAL_PORT_T *resizer_output_port = NULL;
 
+    // SIGUSR1 запускает сохранение предыстории. Он блокируется до создания всех потоков
+    // и принимается через signalfd в управляющем цикле
+    sigset_t trigger_signals;
+    sigemptyset(&trigger_signals);
+    sigaddset(&trigger_signals, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &trigger_signals, NULL);
+
     bcm_host_init();
     // Register our application with the logging system
     vcos_log_register("Farvcamera", VCOS_LOG_CATEGORY);
     signal(SIGINT, default_signal_handler);
-    // Disable USR1 for the moment - may be reenabled if go in to signal capture mode
-    signal(SIGUSR1, SIG_IGN);
     default_status(&state);
 
     state.timeout = 5000;
@@ -2853,12 +3327,11 @@ int main(int argc, const char **argv)
         vcos_log_error("%s: Failed to connect splitter output port 0 to video encoder input", __func__);
         // goto error;
     }
-    printf("Connecting splitter output port 1 to image encoder input port\n");
-    status = connect_ports(splitter_image_port, encoder_input_port_image, &state.encoder_connection_image);
+    printf("Connecting splitter output port 1 to the resizer and image encoder\n");
+    status = still_pipeline_create(&state);
     if (status != MMAL_SUCCESS)
     {
-        state.encoder_connection_image = NULL;
-        vcos_log_error("%s: Failed to connect splitter output port 1 to image encoder input", __func__);
+        vcos_log_error("%s: Failed to set up the still branch", __func__);
         // goto error;
     }
     
@@ -2866,48 +3339,85 @@ int main(int argc, const char **argv)
     // Ждём некоторое время для стабилизации камеры после соединений
     vcos_sleep(state.timeout_image);
     // Настройка портов для управления камерой
-    gpioInitialise();
+    // Управляющий цикл: входы GPIO, последовательный порт и таймер записи видео
+    // обрабатываются в этом потоке по событиям, без активного ожидания
+    FARVCAM_CONTROL_T control = {0};
+    control.state = &state;
+    control.serial_device = argc > 1 ? argv[1] : SERIAL_DEVICE;
+    control.serial_fd = -1;
+    control.signal_fd = -1;
+    control.video_level = PI_ON;
+    control.baud_rate = argc > 2 ? strtoul(argv[2], NULL, 10) : SERIAL_BAUD_RATE;
+    control.still_width = STILL_DEFAULT_WIDTH;
+    control.still_height = STILL_DEFAULT_HEIGHT;
+    state.common_settings.filename = malloc(max_filename_length);
+    state.jpeg_filename = malloc(max_filename_length);
+    control.loop = raspi_event_loop_create(gpio_event, &control);
+    if (!control.loop)
+    {
+        vcos_log_error("%s: Failed to create the event loop", __func__);
+        goto shutdown;
+    }
+    control.video_timer = raspi_event_timer_create(control.loop, video_timer_event, &control);
+    if (!control.video_timer)
+    {
+        vcos_log_error("%s: Failed to create the video timer", __func__);
+        goto shutdown;
+    }
+    control.signal_fd = signalfd(-1, &trigger_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (control.signal_fd < 0 ||
+        raspi_event_loop_add_fd(control.loop, control.signal_fd, EPOLLIN, signal_event, &control) != 0)
+        vcos_log_error("%s: Failed to set up the SIGUSR1 trigger", __func__);
+
+    // Настройка портов для управления камерой
+    if (gpioInitialise() < 0)
+    {
+        vcos_log_error("%s: Failed to initialise GPIO", __func__);
+        goto shutdown;
+    }
+    control_loop = control.loop;
+    gpioSetSignalFunc(SIGINT, control_signal_handler);
+    gpioSetSignalFunc(SIGTERM, control_signal_handler);
     gpioSetMode(PIN_VIDEO, PI_INPUT);
     gpioSetPullUpDown(PIN_VIDEO, PI_PUD_UP);
+    gpioGlitchFilter(PIN_VIDEO, GPIO_DEBOUNCE_US);
     gpioSetMode(PIN_RUNNING, PI_INPUT);
     gpioSetPullUpDown(PIN_RUNNING, PI_PUD_UP);
-    // В терминале ВКЛЮЧЁННОЕ состояние порта соответствует PI_OFF!
-    while (gpioRead(PIN_RUNNING) == PI_ON)
-    {
-        // Ждём пока пользователь не включит камеру с помощью цифрового выхода терминала
-    }
-    // Настройка потоков для работы с видео и фотографиями
-    int rc1, rc2;
-    pthread_t video_thread, photo_thread;
-    // Создаём два потока - один для снятия и сохранения видео, второй - для получения фото и отправки по RS-232
-    if (rc1 = pthread_create(&video_thread, NULL, &video_routine, &state))
-    {
-        printf("Video thread creation failed: %d\n", rc1);
-    }
-    if (rc2 = pthread_create(&photo_thread, NULL, &photo_routine, &state))
-    {
-        printf("Photo thread creation failed: %d\n", rc2);
-    }
-
-    pthread_join(video_thread, NULL);
-    pthread_join(photo_thread, NULL);
+    gpioGlitchFilter(PIN_RUNNING, GPIO_DEBOUNCE_US);
+    gpioSetAlertFuncEx(PIN_VIDEO, gpio_alert, control.loop);
+    gpioSetAlertFuncEx(PIN_RUNNING, gpio_alert, control.loop);
+    // Текущие уровни входов: алерты приходят только при изменении уровня
+    raspi_event_loop_post_gpio(control.loop, PIN_VIDEO, gpioRead(PIN_VIDEO));
+    raspi_event_loop_post_gpio(control.loop, PIN_RUNNING, gpioRead(PIN_RUNNING));
+
+    // Ждём пока пользователь не включит камеру с помощью цифрового выхода терминала,
+    // затем записываем видео и отвечаем на запросы фото, пока камера не будет выключена
+    raspi_event_loop_run(control.loop);
+
+    gpioSetAlertFuncEx(PIN_VIDEO, NULL, NULL);
+    gpioSetAlertFuncEx(PIN_RUNNING, NULL, NULL);
+    control_loop = NULL;
+
+shutdown:
+    control_stop(&control);
+    raspi_event_loop_destroy(control.loop);
+    if (control.signal_fd >= 0)
+        close(control.signal_fd);
+    free(state.common_settings.filename);
+    free(state.jpeg_filename);
 
     fprintf(stderr, "Closing down\n");
 
     // Disable all our ports that are not handled by connections
     check_disable_port(camera_still_port);
     check_disable_port(encoder_output_port);
-    check_disable_port(encoder_output_port_image);
     // check_disable_port(splitter_output_port);
 
+    still_pipeline_destroy(&state);
     if (state.encoder_connection)
         mmal_connection_destroy(state.encoder_connection);
-    if (state.resizer_connection)
-        mmal_connection_destroy(state.resizer_connection);
     if (state.splitter_connection)
         mmal_connection_destroy(state.splitter_connection);
-    if (state.encoder_connection_image)
-        mmal_connection_destroy(state.encoder_connection_image);
 
     /* Disable components */
     if (state.encoder_component)
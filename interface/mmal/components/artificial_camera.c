@@ -29,6 +29,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "core/mmal_component_private.h"
 #include "core/mmal_port_private.h"
 #include "mmal_logging.h"
+#include "containers/containers.h"
 
 #define ARTIFICIAL_CAMERA_PORTS_NUM 3
 
@@ -38,115 +39,488 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #define DEFAULT_WIDTH 320
 #define DEFAULT_HEIGHT 240
+#define DEFAULT_FRAME_RATE 30
+
+/* Number of pixels the moving patterns scroll by on each frame */
+#define PATTERN_SPEED 4
+
+#define URI_SIZE_MAX 512
 
 /*****************************************************************************/
 typedef struct MMAL_PORT_MODULE_T
 {
    MMAL_BUFFER_HEADER_VIDEO_SPECIFIC_T frame;
    unsigned int frame_size;
+   unsigned int plane_width[4];  /**< bytes of picture in a line of each plane */
+   unsigned int plane_height[4]; /**< lines in each plane */
+   uint8_t *line;                              /**< scratch line used to draw the patterns */
    int count;
 
    MMAL_QUEUE_T *queue;
 
+   MMAL_PARAMETER_VIDEO_SOURCE_PATTERN_T pattern;
+   MMAL_PARAMETER_VIDEO_SOURCE_TIMING_T timing;
+   MMAL_PARAMETER_STATISTICS_T stats;
+
+   char uri[URI_SIZE_MAX];
+   VC_CONTAINER_T *container;  /**< raw video replayed instead of the pattern */
+
+   int64_t period;          /**< frame period in microseconds, 0 when running as fast as buffers come back */
+   int64_t start;           /**< wall time at which the port was enabled */
+   unsigned int frame_num;  /**< index of the next frame */
+   uint32_t random;         /**< state of the noise generator */
+   MMAL_BOOL_T eos;         /**< end of stream sent */
+
 } MMAL_PORT_MODULE_T;
 
 typedef struct MMAL_COMPONENT_MODULE_T
 {
    MMAL_STATUS_T status;
 
+   VCOS_TIMER_T timer;      /**< triggers the action when the next frame is due */
+   MMAL_BOOL_T timer_created;
+
 } MMAL_COMPONENT_MODULE_T;
 
 /*****************************************************************************/
-static void artificial_camera_do_processing(MMAL_COMPONENT_T *component)
+static uint32_t artificial_camera_random(uint32_t *state)
 {
-   MMAL_COMPONENT_MODULE_T *module = component->priv->module;
-   MMAL_BUFFER_HEADER_T *buffer;
+   /* xorshift32 */
+   uint32_t x = *state;
+   x ^= x << 13;
+   x ^= x >> 17;
+   x ^= x << 5;
+   return *state = x;
+}
+
+/** Offset of the delivery of a frame, in [-jitter, jitter]. This only depends on
+ * the frame index so the delivery time of any frame can be worked out again. */
+static int64_t artificial_camera_jitter(MMAL_PORT_MODULE_T *port_module, unsigned int frame_num)
+{
+   uint32_t jitter = port_module->timing.jitter, x = frame_num;
+
+   if (!jitter)
+      return 0;
+
+   x = (x ^ (x >> 16)) * 0x45d9f3b;
+   x = (x ^ (x >> 16)) * 0x45d9f3b;
+   x = x ^ (x >> 16);
+   return (int64_t)(x % (2 * jitter + 1)) - jitter;
+}
+
+/** Wall time, relative to the start, at which a frame is due */
+static int64_t artificial_camera_frame_due(MMAL_PORT_MODULE_T *port_module, unsigned int frame_num)
+{
+   unsigned int interval = port_module->timing.burst_interval;
+   unsigned int length = MMAL_MIN(port_module->timing.burst_length, interval);
+   unsigned int delivered = frame_num;
+   int64_t due;
+
+   /* Frames at the start of a burst are held back until the last one of the burst */
+   if (interval && length && frame_num % interval < length)
+      delivered = frame_num - frame_num % interval + length - 1;
+
+   due = delivered * port_module->period + artificial_camera_jitter(port_module, delivered);
+   return due < 0 ? 0 : due;
+}
+
+/** Convert a 0xRRGGBB colour to limited range BT.601 YUV */
+static void artificial_camera_rgb_to_yuv(uint32_t rgb, uint8_t *y, uint8_t *u, uint8_t *v)
+{
+   int r = (rgb >> 16) & 0xff, g = (rgb >> 8) & 0xff, b = rgb & 0xff;
+
+   *y = (uint8_t)((( 66 * r + 129 * g +  25 * b + 128) >> 8) + 16);
+   *u = (uint8_t)(((-38 * r -  74 * g + 112 * b + 128) >> 8) + 128);
+   *v = (uint8_t)(((112 * r -  94 * g -  18 * b + 128) >> 8) + 128);
+}
+
+/** Fill the chroma planes with a constant colour */
+static void artificial_camera_fill_chroma(MMAL_PORT_MODULE_T *port_module, uint8_t *data,
+   uint8_t u, uint8_t v)
+{
+   MMAL_BUFFER_HEADER_VIDEO_SPECIFIC_T *frame = &port_module->frame;
    unsigned int i;
 
-   if (module->status != MMAL_SUCCESS)
-      return;
+   if (frame->planes == 3)
+   {
+      memset(data + frame->offset[1], u, frame->pitch[1] * port_module->plane_height[1]);
+      memset(data + frame->offset[2], v, frame->pitch[2] * port_module->plane_height[2]);
+   }
+   else if (u == v)
+   {
+      memset(data + frame->offset[1], u, frame->pitch[1] * port_module->plane_height[1]);
+   }
+   else
+   {
+      /* Interleaved VU */
+      uint8_t *dest = data + frame->offset[1];
+      for (i = 0; i < frame->pitch[1] * port_module->plane_height[1]; i += 2)
+      {
+         dest[i] = v;
+         dest[i + 1] = u;
+      }
+   }
+}
 
-   /* Loop through all the ports */
-   for (i = 0; i < component->output_num; i++)
+/** Fill a plane with random values */
+static void artificial_camera_fill_noise(MMAL_PORT_MODULE_T *port_module, uint8_t *data, unsigned int plane)
+{
+   uint32_t *dest = (uint32_t *)(data + port_module->frame.offset[plane]);
+   unsigned int i, size = port_module->frame.pitch[plane] * port_module->plane_height[plane] / 4;
+
+   for (i = 0; i < size; i++)
+      dest[i] = artificial_camera_random(&port_module->random);
+}
+
+/** Draw vertical colour bars scrolling horizontally */
+static void artificial_camera_fill_bars(MMAL_PORT_MODULE_T *port_module, uint8_t *data)
+{
+   static const uint32_t bars[] = {0xbfbfbf, 0xbfbf00, 0x00bfbf, 0x00bf00,
+                                   0xbf00bf, 0xbf0000, 0x0000bf, 0x000000};
+   MMAL_BUFFER_HEADER_VIDEO_SPECIFIC_T *frame = &port_module->frame;
+   unsigned int width = port_module->plane_width[0];
+   unsigned int shift = port_module->frame_num * PATTERN_SPEED % width;
+   uint8_t y[8], u[8], v[8];
+   unsigned int plane, x, line;
+
+   for (x = 0; x < vcos_countof(bars); x++)
+      artificial_camera_rgb_to_yuv(bars[x], &y[x], &u[x], &v[x]);
+
+   for (plane = 0; plane < frame->planes; plane++)
+   {
+      unsigned int plane_width = port_module->plane_width[plane];
+      uint8_t *dest = data + frame->offset[plane];
+
+      /* Draw one line and repeat it */
+      for (x = 0; x < plane_width; x++)
+      {
+         /* Horizontal position in luma samples */
+         unsigned int pos = plane == 0 ? x : frame->planes == 3 ? x * 2 : x & ~1;
+         unsigned int bar = (pos + shift) % width * vcos_countof(bars) / width;
+
+         if (plane == 0)
+            port_module->line[x] = y[bar];
+         else if (frame->planes == 3)
+            port_module->line[x] = plane == 1 ? u[bar] : v[bar];
+         else
+            port_module->line[x] = x & 1 ? u[bar] : v[bar];
+      }
+      for (line = 0; line < port_module->plane_height[plane]; line++)
+         memcpy(dest + line * frame->pitch[plane], port_module->line, plane_width);
+   }
+}
+
+/** Draw a luma ramp moving diagonally */
+static void artificial_camera_fill_diagonal(MMAL_PORT_MODULE_T *port_module, uint8_t *data)
+{
+   MMAL_BUFFER_HEADER_VIDEO_SPECIFIC_T *frame = &port_module->frame;
+   unsigned int width = port_module->plane_width[0];
+   unsigned int shift = port_module->frame_num * PATTERN_SPEED;
+   unsigned int x, line;
+
+   for (x = 0; x < width + 256; x++)
+      port_module->line[x] = (uint8_t)x;
+   for (line = 0; line < port_module->plane_height[0]; line++)
+      memcpy(data + line * frame->pitch[0], port_module->line + ((line + shift) & 0xff), width);
+   artificial_camera_fill_chroma(port_module, data, 0x80, 0x80);
+}
+
+/** Read the next frame of the raw video file, going back to the start at the end */
+static MMAL_STATUS_T artificial_camera_fill_file(MMAL_PORT_MODULE_T *port_module, uint8_t *data)
+{
+   MMAL_BUFFER_HEADER_VIDEO_SPECIFIC_T *frame = &port_module->frame;
+   VC_CONTAINER_ES_FORMAT_T *format = port_module->container->tracks[0]->format;
+   unsigned int plane, line, retries = 0;
+   VC_CONTAINER_STATUS_T status;
+   VC_CONTAINER_PACKET_T packet;
+   int64_t offset = 0;
+
+   memset(&packet, 0, sizeof(packet));
+
+   for (plane = 0; plane < frame->planes; plane++)
+   {
+      /* Lines in the file are not padded */
+      unsigned int width = plane == 0 || frame->planes == 2 ? format->type->video.width :
+         format->type->video.width / 2;
+      unsigned int height = port_module->plane_height[plane] == port_module->plane_height[0] ?
+         format->type->video.height : format->type->video.height / 2;
+
+      for (line = 0; line < height; line++)
+      {
+         packet.data = data + frame->offset[plane] + line * frame->pitch[plane];
+         packet.buffer_size = width;
+         status = vc_container_read(port_module->container, &packet, 0);
+         if (status == VC_CONTAINER_ERROR_EOS && !plane && !line && !retries++)
+         {
+            /* Start again from the first frame */
+            status = vc_container_seek(port_module->container, &offset, VC_CONTAINER_SEEK_MODE_TIME, 0);
+            if (status == VC_CONTAINER_SUCCESS)
+               status = vc_container_read(port_module->container, &packet, 0);
+         }
+         if (status != VC_CONTAINER_SUCCESS || packet.size != width)
+         {
+            LOG_ERROR("failed to read frame from %s (%i)", port_module->uri, status);
+            return MMAL_EIO;
+         }
+      }
+   }
+
+   return MMAL_SUCCESS;
+}
+
+/** Fill a buffer with the next frame */
+static MMAL_STATUS_T artificial_camera_fill(MMAL_PORT_MODULE_T *port_module, MMAL_BUFFER_HEADER_T *buffer)
+{
+   MMAL_PARAMETER_VIDEO_SOURCE_PATTERN_T *pattern = &port_module->pattern;
+   uint8_t y, u, v;
+
+   if (port_module->container)
+      return artificial_camera_fill_file(port_module, buffer->data);
+
+   switch (pattern->pattern)
+   {
+   case MMAL_VIDEO_SOURCE_PATTERN_BLACK:
+   case MMAL_VIDEO_SOURCE_PATTERN_COLOUR:
+      artificial_camera_rgb_to_yuv(pattern->pattern == MMAL_VIDEO_SOURCE_PATTERN_BLACK ?
+                                   0 : pattern->param, &y, &u, &v);
+      memset(buffer->data, y, port_module->frame.offset[1]);
+      artificial_camera_fill_chroma(port_module, buffer->data, u, v);
+      break;
+   case MMAL_VIDEO_SOURCE_PATTERN_DIAGONAL:
+      artificial_camera_fill_diagonal(port_module, buffer->data);
+      break;
+   case MMAL_VIDEO_SOURCE_PATTERN_NOISE:
+      artificial_camera_fill_noise(port_module, buffer->data, 0);
+      artificial_camera_fill_chroma(port_module, buffer->data, 0x80, 0x80);
+      break;
+   case MMAL_VIDEO_SOURCE_PATTERN_RANDOM:
+      artificial_camera_fill_noise(port_module, buffer->data, 0);
+      artificial_camera_fill_noise(port_module, buffer->data, 1);
+      if (port_module->frame.planes == 3)
+         artificial_camera_fill_noise(port_module, buffer->data, 2);
+      break;
+   case MMAL_VIDEO_SOURCE_PATTERN_BLOCKS:
+      artificial_camera_fill_bars(port_module, buffer->data);
+      break;
+   default:
+      /* White, with the chroma changing on every frame */
+      memset(buffer->data, 0xff, buffer->length);
+      memset(buffer->data + port_module->frame.offset[1], 0x7f - port_module->count++,
+             buffer->length - port_module->frame.offset[1]);
+      break;
+   }
+
+   return MMAL_SUCCESS;
+}
+
+/** Send the frames which are due on a port.
+ * Returns the wall time at which the next frame is due, or 0 if the port
+ * needs to wait for a buffer. */
+static int64_t artificial_camera_process_port(MMAL_PORT_T *port, int64_t now)
+{
+   MMAL_COMPONENT_T *component = port->component;
+   MMAL_COMPONENT_MODULE_T *module = component->priv->module;
+   MMAL_PORT_MODULE_T *port_module = port->priv->module;
+   uint32_t framecount = port_module->pattern.framecount;
+   MMAL_BUFFER_HEADER_T *buffer;
+
+   while (!port_module->eos)
    {
-      MMAL_PORT_T *port = component->output[i];
+      int64_t due = port_module->start + artificial_camera_frame_due(port_module, port_module->frame_num);
 
-      buffer = mmal_queue_get(port->priv->module->queue);
+      if (framecount && port_module->frame_num >= framecount)
+         due = now;
+      if (due > now)
+         return due;
+
+      buffer = mmal_queue_get(port_module->queue);
       if (!buffer)
-         continue;
+         return 0;
+
+      /* A frame which could not be sent before the next one was due is dropped,
+       * as a sensor would */
+      while (port_module->period && (!framecount || port_module->frame_num + 1 < framecount))
+      {
+         int64_t next = port_module->start +
+            artificial_camera_frame_due(port_module, port_module->frame_num + 1);
+         if (next > now || next <= due)
+            break;
+         port_module->frame_num++;
+         port_module->stats.frames_skipped++;
+         due = next;
+      }
+
+      buffer->offset = 0;
+      if (framecount && port_module->frame_num >= framecount)
+      {
+         buffer->length = 0;
+         buffer->flags = MMAL_BUFFER_HEADER_FLAG_EOS;
+         buffer->pts = buffer->dts = MMAL_TIME_UNKNOWN;
+         port_module->eos = port_module->stats.eos_seen = MMAL_TRUE;
+         mmal_port_buffer_header_callback(port, buffer);
+         break;
+      }
 
       /* Sanity check the buffer size */
-      if (buffer->alloc_size < port->priv->module->frame_size)
+      if (buffer->alloc_size < port_module->frame_size)
       {
          LOG_ERROR("buffer too small (%i/%i)",
-                   buffer->alloc_size, port->priv->module->frame_size);
+                   buffer->alloc_size, port_module->frame_size);
          module->status = MMAL_EINVAL;
-         mmal_queue_put_back(port->priv->module->queue, buffer);
+         mmal_queue_put_back(port_module->queue, buffer);
          mmal_event_error_send(component, module->status);
-         return;
+         return 0;
       }
       module->status = mmal_buffer_header_mem_lock(buffer);
       if (module->status != MMAL_SUCCESS)
       {
          LOG_ERROR("invalid buffer (%p, %p)", buffer, buffer->data);
-         mmal_queue_put_back(port->priv->module->queue, buffer);
+         mmal_queue_put_back(port_module->queue, buffer);
          mmal_event_error_send(component, module->status);
-         return;
+         return 0;
       }
 
-      buffer->offset = 0;
-      buffer->length = port->priv->module->frame_size;
-      buffer->type->video = port->priv->module->frame;
-
-      memset(buffer->data, 0xff, buffer->length);
-      if (buffer->type->video.planes > 1)
-         memset(buffer->data + buffer->type->video.offset[1],
-                0x7f - port->priv->module->count++,
-                buffer->length - buffer->type->video.offset[1]);
-
+      buffer->length = port_module->frame_size;
+      buffer->type->video = port_module->frame;
+      module->status = artificial_camera_fill(port_module, buffer);
       mmal_buffer_header_mem_unlock(buffer);
+      if (module->status != MMAL_SUCCESS)
+      {
+         mmal_queue_put_back(port_module->queue, buffer);
+         mmal_event_error_send(component, module->status);
+         return 0;
+      }
+
+      /* Frames are timestamped on the nominal frame rate, whatever the delivery time */
+      buffer->flags = MMAL_BUFFER_HEADER_FLAG_FRAME_END;
+      buffer->pts = buffer->dts = port_module->period ?
+         port_module->frame_num * port_module->period : now - port_module->start;
+      port_module->frame_num++;
+      port_module->stats.buffer_count++;
+      port_module->stats.frame_count++;
+      port_module->stats.total_bytes += buffer->length;
+      port_module->stats.maximum_frame_bytes = buffer->length;
       mmal_port_buffer_header_callback(port, buffer);
    }
 
-   vcos_sleep(10); /* Make sure we don't peg all the resources */
+   return 0;
+}
+
+static void artificial_camera_do_processing(MMAL_COMPONENT_T *component)
+{
+   MMAL_COMPONENT_MODULE_T *module = component->priv->module;
+   int64_t now, due, next_due = 0;
+   unsigned int i;
+
+   if (module->status != MMAL_SUCCESS)
+      return;
+
+   /* Loop through all the ports */
+   now = vcos_getmicrosecs64();
+   for (i = 0; i < component->output_num; i++)
+   {
+      if (!component->output[i]->is_enabled)
+         continue;
+
+      due = artificial_camera_process_port(component->output[i], now);
+      if (module->status != MMAL_SUCCESS)
+         return;
+      if (due && (!next_due || due < next_due))
+         next_due = due;
+   }
+
+   /* The timer only has millisecond resolution so round up */
+   if (next_due)
+      vcos_timer_set(&module->timer, (VCOS_UNSIGNED)((next_due - now + 999) / 1000));
+}
+
+static void artificial_camera_timer_cb(void *ctx)
+{
+   mmal_component_action_trigger((MMAL_COMPONENT_T *)ctx);
 }
 
 /** Destroy a previously created component */
 static MMAL_STATUS_T artificial_camera_component_destroy(MMAL_COMPONENT_T *component)
 {
+   MMAL_COMPONENT_MODULE_T *module = component->priv->module;
    unsigned int i;
 
+   if (module->timer_created)
+      vcos_timer_delete(&module->timer);
+
    for (i = 0; i < component->output_num; i++)
-      if (component->output[i]->priv->module->queue)
-         mmal_queue_destroy(component->output[i]->priv->module->queue);
+   {
+      MMAL_PORT_MODULE_T *port_module = component->output[i]->priv->module;
+      if (port_module->queue)
+         mmal_queue_destroy(port_module->queue);
+      if (port_module->container)
+         vc_container_close(port_module->container);
+      vcos_free(port_module->line);
+   }
 
    if(component->output_num)
       mmal_ports_free(component->output, component->output_num);
 
-   vcos_free(component->priv->module);
+   vcos_free(module);
    return MMAL_SUCCESS;
 }
 
 /** Enable processing on a port */
 static MMAL_STATUS_T artificial_camera_port_enable(MMAL_PORT_T *port, MMAL_PORT_BH_CB_T cb)
 {
-   MMAL_PARAM_UNUSED(port);
+   MMAL_PORT_MODULE_T *port_module = port->priv->module;
+   MMAL_RATIONAL_T frame_rate = port_module->pattern.framerate;
    MMAL_PARAM_UNUSED(cb);
+
+   if (port_module->container)
+   {
+      VC_CONTAINER_ES_FORMAT_T *format = port_module->container->tracks[0]->format;
+      int64_t offset = 0;
+
+      if (format->codec != port->format->encoding ||
+          format->type->video.width != port->format->es->video.width ||
+          format->type->video.height != port->format->es->video.height)
+      {
+         LOG_ERROR("%s does not match the format of %s", port_module->uri, port->name);
+         return MMAL_EINVAL;
+      }
+      vc_container_seek(port_module->container, &offset, VC_CONTAINER_SEEK_MODE_TIME, 0);
+   }
+
+   if (!frame_rate.num || !frame_rate.den)
+      frame_rate = port->format->es->video.frame_rate;
+   port_module->period = frame_rate.num > 0 && frame_rate.den > 0 ?
+      INT64_C(1000000) * frame_rate.den / frame_rate.num : 0;
+
+   port_module->start = vcos_getmicrosecs64();
+   port_module->frame_num = 0;
+   port_module->random = port->index + 1;
+   port_module->eos = MMAL_FALSE;
+   memset(&port_module->stats, 0, sizeof(port_module->stats));
    return MMAL_SUCCESS;
 }
 
 /** Flush a port */
 static MMAL_STATUS_T artificial_camera_port_flush(MMAL_PORT_T *port)
 {
-   MMAL_PARAM_UNUSED(port);
+   MMAL_PORT_MODULE_T *port_module = port->priv->module;
+   MMAL_BUFFER_HEADER_T *buffer;
+
+   /* Flush buffers that our component is holding on to */
+   while ((buffer = mmal_queue_get(port_module->queue)) != NULL)
+   {
+      buffer->length = 0;
+      mmal_port_buffer_header_callback(port, buffer);
+   }
+
    return MMAL_SUCCESS;
 }
 
 /** Disable processing on a port */
 static MMAL_STATUS_T artificial_camera_port_disable(MMAL_PORT_T *port)
 {
-   MMAL_PARAM_UNUSED(port);
-   return MMAL_SUCCESS;
+   /* We just need to flush our internal queue */
+   return artificial_camera_port_flush(port);
 }
 
 /** Send a buffer header to a port */
@@ -164,6 +538,7 @@ static MMAL_STATUS_T artificial_camera_port_format_commit(MMAL_PORT_T *port)
    MMAL_PORT_MODULE_T *port_module = port->priv->module;
    unsigned int width = port->format->es->video.width;
    unsigned int height = port->format->es->video.height;
+   uint8_t *line;
    width = (width + 31) & ~31;
    height = (height + 15) & ~15;
 
@@ -178,6 +553,7 @@ static MMAL_STATUS_T artificial_camera_port_format_commit(MMAL_PORT_T *port)
       port_module->frame.pitch[1] = width / 2;
       port_module->frame.offset[2] = port_module->frame.offset[1] + port_module->frame.pitch[1] * height / 2;
       port_module->frame.pitch[2] = width / 2;
+      port_module->plane_height[1] = port_module->plane_height[2] = height / 2;
       break;
    case MMAL_ENCODING_NV21:
       port_module->frame_size = width * height * 3 / 2;
@@ -185,6 +561,7 @@ static MMAL_STATUS_T artificial_camera_port_format_commit(MMAL_PORT_T *port)
       port_module->frame.pitch[0] = width;
       port_module->frame.offset[1] = port_module->frame.pitch[0] * height;
       port_module->frame.pitch[1] = width;
+      port_module->plane_height[1] = height / 2;
       break;
    case MMAL_ENCODING_I422:
       port_module->frame_size = width * height * 2;
@@ -194,10 +571,22 @@ static MMAL_STATUS_T artificial_camera_port_format_commit(MMAL_PORT_T *port)
       port_module->frame.pitch[1] = width / 2;
       port_module->frame.offset[2] = port_module->frame.offset[1] + port_module->frame.pitch[1] * height;
       port_module->frame.pitch[2] = width / 2;
+      port_module->plane_height[1] = port_module->plane_height[2] = height;
       break;
    default:
       return MMAL_ENOSYS;
    }
+   port_module->plane_height[0] = height;
+   port_module->plane_width[0] = port_module->frame.pitch[0];
+   port_module->plane_width[1] = port_module->frame.pitch[1];
+   port_module->plane_width[2] = port_module->frame.pitch[2];
+
+   /* Room for a line of the diagonal ramp */
+   line = vcos_malloc(width + 256, "artificial camera line");
+   if (!line)
+      return MMAL_ENOMEM;
+   vcos_free(port_module->line);
+   port_module->line = line;
 
    port->buffer_size_min = port->buffer_size_recommended = port_module->frame_size;
    return MMAL_SUCCESS;
@@ -206,9 +595,58 @@ static MMAL_STATUS_T artificial_camera_port_format_commit(MMAL_PORT_T *port)
 /** Set parameter on a port */
 static MMAL_STATUS_T artificial_port_parameter_set(MMAL_PORT_T *port, const MMAL_PARAMETER_HEADER_T *param)
 {
-   MMAL_PARAM_UNUSED(port);
+   MMAL_PORT_MODULE_T *port_module = port->priv->module;
+   VC_CONTAINER_STATUS_T cstatus;
+
    switch (param->id)
    {
+   case MMAL_PARAMETER_VIDEO_SOURCE_PATTERN:
+      {
+         const MMAL_PARAMETER_VIDEO_SOURCE_PATTERN_T *pattern =
+            (const MMAL_PARAMETER_VIDEO_SOURCE_PATTERN_T *)param;
+         if (param->size < sizeof(*pattern))
+            return MMAL_EINVAL;
+         if (pattern->pattern > MMAL_VIDEO_SOURCE_PATTERN_BLOCKS)
+            return MMAL_ENOSYS;
+         port_module->pattern = *pattern;
+      }
+      return MMAL_SUCCESS;
+
+   case MMAL_PARAMETER_VIDEO_SOURCE_TIMING:
+      if (param->size < sizeof(port_module->timing))
+         return MMAL_EINVAL;
+      port_module->timing = *(const MMAL_PARAMETER_VIDEO_SOURCE_TIMING_T *)param;
+      return MMAL_SUCCESS;
+
+   case MMAL_PARAMETER_URI:
+      if (port->is_enabled)
+         return MMAL_EINVAL;
+      if (port_module->container)
+         vc_container_close(port_module->container);
+      port_module->container = NULL;
+
+      memset(port_module->uri, 0, sizeof(port_module->uri));
+      strncpy(port_module->uri, ((const MMAL_PARAMETER_URI_T *)param)->uri, sizeof(port_module->uri)-1);
+      if (!port_module->uri[0])
+         return MMAL_SUCCESS; /* Back to the pattern */
+
+      /* Frames are replayed from a raw video file */
+      port_module->container = vc_container_open_reader(port_module->uri, &cstatus, 0, 0);
+      if (!port_module->container)
+      {
+         LOG_ERROR("error opening file %s (%i)", port_module->uri, cstatus);
+         return MMAL_ENOENT;
+      }
+      if (port_module->container->tracks_num < 1 ||
+          port_module->container->tracks[0]->format->es_type != VC_CONTAINER_ES_TYPE_VIDEO)
+      {
+         LOG_ERROR("%s is not a raw video file", port_module->uri);
+         vc_container_close(port_module->container);
+         port_module->container = NULL;
+         return MMAL_EINVAL;
+      }
+      return MMAL_SUCCESS;
+
    default:
       return MMAL_ENOSYS;
    }
@@ -217,9 +655,29 @@ static MMAL_STATUS_T artificial_port_parameter_set(MMAL_PORT_T *port, const MMAL
 /** Get parameter on a port */
 static MMAL_STATUS_T artificial_port_parameter_get(MMAL_PORT_T *port, MMAL_PARAMETER_HEADER_T *param)
 {
-   MMAL_PARAM_UNUSED(port);
+   MMAL_PORT_MODULE_T *port_module = port->priv->module;
+
    switch (param->id)
    {
+   case MMAL_PARAMETER_VIDEO_SOURCE_PATTERN:
+      if (param->size < sizeof(port_module->pattern))
+         return MMAL_EINVAL;
+      *(MMAL_PARAMETER_VIDEO_SOURCE_PATTERN_T *)param = port_module->pattern;
+      return MMAL_SUCCESS;
+
+   case MMAL_PARAMETER_VIDEO_SOURCE_TIMING:
+      if (param->size < sizeof(port_module->timing))
+         return MMAL_EINVAL;
+      *(MMAL_PARAMETER_VIDEO_SOURCE_TIMING_T *)param = port_module->timing;
+      return MMAL_SUCCESS;
+
+   case MMAL_PARAMETER_STATISTICS:
+      if (param->size < sizeof(port_module->stats))
+         return MMAL_EINVAL;
+      port_module->stats.hdr = *param;
+      *(MMAL_PARAMETER_STATISTICS_T *)param = port_module->stats;
+      return MMAL_SUCCESS;
+
    default:
       return MMAL_ENOSYS;
    }
@@ -248,11 +706,12 @@ static MMAL_STATUS_T mmal_component_create_artificial_camera(const char *name, M
 
    for (i = 0; i < component->output_num; i++)
    {
+      MMAL_PORT_MODULE_T *port_module = component->output[i]->priv->module;
+
       component->output[i]->priv->pf_enable = artificial_camera_port_enable;
       component->output[i]->priv->pf_disable = artificial_camera_port_disable;
       component->output[i]->priv->pf_flush = artificial_camera_port_flush;
       component->output[i]->priv->pf_send = artificial_camera_port_send;
-      component->output[i]->priv->pf_send = artificial_camera_port_send;
       component->output[i]->priv->pf_set_format = artificial_camera_port_format_commit;
       component->output[i]->priv->pf_parameter_set = artificial_port_parameter_set;
       component->output[i]->priv->pf_parameter_get = artificial_port_parameter_get;
@@ -260,15 +719,29 @@ static MMAL_STATUS_T mmal_component_create_artificial_camera(const char *name, M
       component->output[i]->format->encoding = MMAL_ENCODING_I420;
       component->output[i]->format->es->video.width = DEFAULT_WIDTH;
       component->output[i]->format->es->video.height = DEFAULT_HEIGHT;
+      component->output[i]->format->es->video.frame_rate.num = DEFAULT_FRAME_RATE;
+      component->output[i]->format->es->video.frame_rate.den = 1;
       component->output[i]->buffer_num_min = OUTPUT_MIN_BUFFER_NUM;
       component->output[i]->buffer_num_recommended = OUTPUT_RECOMMENDED_BUFFER_NUM;
-      artificial_camera_port_format_commit(component->output[i]);
+      if (artificial_camera_port_format_commit(component->output[i]) != MMAL_SUCCESS)
+         goto error;
+
+      port_module->pattern.hdr.id = MMAL_PARAMETER_VIDEO_SOURCE_PATTERN;
+      port_module->pattern.hdr.size = sizeof(port_module->pattern);
+      port_module->pattern.pattern = MMAL_VIDEO_SOURCE_PATTERN_WHITE;
+      port_module->timing.hdr.id = MMAL_PARAMETER_VIDEO_SOURCE_TIMING;
+      port_module->timing.hdr.size = sizeof(port_module->timing);
 
-      component->output[i]->priv->module->queue = mmal_queue_create();
-      if (!component->output[i]->priv->module->queue)
+      port_module->queue = mmal_queue_create();
+      if (!port_module->queue)
          goto error;
    }
 
+   if (vcos_timer_create(&component->priv->module->timer, "artificial camera",
+                         artificial_camera_timer_cb, component) != VCOS_SUCCESS)
+      goto error;
+   component->priv->module->timer_created = MMAL_TRUE;
+
    status = mmal_component_action_register(component, artificial_camera_do_processing);
    if (status != MMAL_SUCCESS)
       goto error;
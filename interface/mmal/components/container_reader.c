@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "mmal.h"
 #include "core/mmal_component_private.h"
 #include "core/mmal_port_private.h"
+#include "core/mmal_buffer_private.h"
 #include "mmal_logging.h"
 
 #include "containers/containers.h"
@@ -58,6 +59,7 @@ typedef struct MMAL_COMPONENT_MODULE_T
 
    /* Reader specific */
    MMAL_BOOL_T packet_logged;
+   struct READER_LENDER_T *lender;
 
    /* Writer specific */
    unsigned int port_last_used;
@@ -72,11 +74,35 @@ typedef struct MMAL_PORT_MODULE_T
 
    MMAL_BOOL_T flush;
    MMAL_BOOL_T eos;
+   MMAL_BOOL_T zero_copy; /**< Hand out packet data borrowed from the container */
 
    VC_CONTAINER_ES_FORMAT_T *format; /**< Format description for the elementary stream */
 
 } MMAL_PORT_MODULE_T;
 
+/** Keeps track of the packet data lent to buffer headers so the container only gets
+ * closed once all of it has been given back. This can outlive the component. */
+typedef struct READER_LENDER_T
+{
+   VCOS_MUTEX_T lock;
+   VC_CONTAINER_T *container;
+   unsigned int borrowed; /**< Number of buffer headers holding data from the container */
+   MMAL_BOOL_T closed;    /**< The component is gone, the last borrower closes the container */
+
+} READER_LENDER_T;
+
+/** Packet data lent to a buffer header by the container */
+typedef struct READER_BORROWED_T
+{
+   READER_LENDER_T *lender;
+   void *token;
+   uint8_t *data;                  /**< Original payload of the buffer header */
+
+   MMAL_BH_PRE_RELEASE_CB_T cb;    /**< Pre-release callback we took the place of */
+   void *cb_userdata;
+
+} READER_BORROWED_T;
+
 /*****************************************************************************/
 static struct {
    VC_CONTAINER_FOURCC_T codec;
@@ -335,13 +361,70 @@ static MMAL_STATUS_T mmal_to_container_format(VC_CONTAINER_ES_FORMAT_T *containe
    return MMAL_SUCCESS;
 }
 
+/*****************************************************************************/
+static void reader_lender_close(READER_LENDER_T *lender)
+{
+   vc_container_close(lender->container);
+   vcos_mutex_delete(&lender->lock);
+   vcos_free(lender);
+}
+
+/** Give back to the container the data a buffer header borrowed from it */
+static void reader_buffer_unborrow(MMAL_BUFFER_HEADER_T *buffer)
+{
+   READER_BORROWED_T *borrowed = buffer->priv->pre_release_userdata;
+   READER_LENDER_T *lender = borrowed->lender;
+   MMAL_BOOL_T last;
+
+   buffer->data = borrowed->data;
+   mmal_buffer_header_pre_release_cb_set(buffer, borrowed->cb, borrowed->cb_userdata);
+   vc_container_release_borrowed(lender->container, borrowed->token);
+   vcos_free(borrowed);
+
+   vcos_mutex_lock(&lender->lock);
+   last = !--lender->borrowed && lender->closed;
+   vcos_mutex_unlock(&lender->lock);
+   if(last)
+      reader_lender_close(lender);
+}
+
+static MMAL_BOOL_T reader_buffer_pre_release(MMAL_BUFFER_HEADER_T *buffer, void *userdata)
+{
+   MMAL_PARAM_UNUSED(userdata);
+   reader_buffer_unborrow(buffer);
+
+   /* Chain to the callback which was there before */
+   if(buffer->priv->pf_pre_release)
+      return buffer->priv->pf_pre_release(buffer, buffer->priv->pre_release_userdata);
+   return MMAL_FALSE;
+}
+
+static void reader_buffer_borrow(MMAL_BUFFER_HEADER_T *buffer, READER_BORROWED_T *borrowed,
+   READER_LENDER_T *lender, VC_CONTAINER_PACKET_BORROW_T *packet)
+{
+   vcos_mutex_lock(&lender->lock);
+   lender->borrowed++;
+   vcos_mutex_unlock(&lender->lock);
+
+   borrowed->lender = lender;
+   borrowed->token = packet->token;
+   borrowed->data = buffer->data;
+   borrowed->cb = buffer->priv->pf_pre_release;
+   borrowed->cb_userdata = buffer->priv->pre_release_userdata;
+
+   buffer->data = packet->packet.data;
+   mmal_buffer_header_pre_release_cb_set(buffer, reader_buffer_pre_release, borrowed);
+}
+
 /*****************************************************************************/
 static void reader_do_processing(MMAL_COMPONENT_T *component)
 {
    MMAL_COMPONENT_MODULE_T *module = component->priv->module;
    MMAL_BUFFER_HEADER_T *buffer;
    VC_CONTAINER_STATUS_T cstatus;
+   VC_CONTAINER_PACKET_BORROW_T borrow;
    VC_CONTAINER_PACKET_T packet;
+   READER_BORROWED_T *borrowed;
    MMAL_STATUS_T status;
    unsigned int i;
 
@@ -392,18 +475,38 @@ static void reader_do_processing(MMAL_COMPONENT_T *component)
          component->output[i]->priv->module->flush = MMAL_FALSE;
       }
 
+      /* Packet data can only be borrowed when it starts a new buffer */
+      borrowed = 0;
+      if(component->output[i]->priv->module->zero_copy && !buffer->length)
+         borrowed = vcos_malloc(sizeof(*borrowed), "reader borrowed");
+
       mmal_buffer_header_mem_lock(buffer);
       packet.data = buffer->data + buffer->length;
       packet.buffer_size = buffer->alloc_size - buffer->length;
       packet.size = 0;
-      cstatus = vc_container_read(module->container, &packet, 0);
+      if(borrowed)
+      {
+         borrow.packet = packet;
+         cstatus = vc_container_read(module->container, &borrow.packet,
+                                     VC_CONTAINER_READ_FLAG_BORROW);
+         packet = borrow.packet;
+      }
+      else
+         cstatus = vc_container_read(module->container, &packet, 0);
       mmal_buffer_header_mem_unlock(buffer);
+      if(borrowed && (cstatus != VC_CONTAINER_SUCCESS || !borrow.token))
+      {
+         vcos_free(borrowed);
+         borrowed = 0;
+      }
       if(cstatus != VC_CONTAINER_SUCCESS)
       {
          LOG_DEBUG("TEST read status: %i", cstatus);
          mmal_queue_put_back(component->output[i]->priv->module->queue, buffer);
          break;
       }
+      if(borrowed)
+         reader_buffer_borrow(buffer, borrowed, module->lender, &borrow);
 
       if(!buffer->length)
       {
@@ -424,7 +527,8 @@ static void reader_do_processing(MMAL_COMPONENT_T *component)
 
       buffer->length += packet.size;
 
-      if((component->output[i]->format->flags & MMAL_ES_FORMAT_FLAG_FRAMED) &&
+      /* Borrowed data can't be appended to so send it straight away */
+      if((component->output[i]->format->flags & MMAL_ES_FORMAT_FLAG_FRAMED) && !borrowed &&
          buffer->length != buffer->alloc_size &&
          !(buffer->flags & MMAL_BUFFER_HEADER_FLAG_FRAME_END))
       {
@@ -608,9 +712,23 @@ static void writer_do_processing(MMAL_COMPONENT_T *component)
 static MMAL_STATUS_T container_component_destroy(MMAL_COMPONENT_T *component)
 {
    MMAL_COMPONENT_MODULE_T *module = component->priv->module;
+   MMAL_BOOL_T lent = MMAL_FALSE;
    unsigned int i;
 
-   if(module->container)
+   /* Buffer headers still holding packet data close the container when
+    * they give the last of it back */
+   if(module->lender)
+   {
+      vcos_mutex_lock(&module->lender->lock);
+      module->lender->closed = MMAL_TRUE;
+      lent = module->lender->borrowed != 0;
+      vcos_mutex_unlock(&module->lender->lock);
+      if(!lent)
+         reader_lender_close(module->lender);
+      else
+         LOG_DEBUG("closing of the container deferred until its data is given back");
+   }
+   else if(module->container)
       vc_container_close(module->container);
 
    for(i = 0; i < component->input_num; i++)
@@ -710,6 +828,10 @@ static MMAL_STATUS_T container_port_disable(MMAL_PORT_T *port)
 /** Send a buffer header to a port */
 static MMAL_STATUS_T container_port_send(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
 {
+   /* The buffer might be sent back without having been released */
+   if(buffer->priv->pf_pre_release == reader_buffer_pre_release)
+      reader_buffer_unborrow(buffer);
+
    mmal_queue_put(port->priv->module->queue, buffer);
    mmal_component_action_trigger(port->component);
    return MMAL_SUCCESS;
@@ -753,6 +875,17 @@ static MMAL_STATUS_T reader_container_open(MMAL_COMPONENT_T *component, const ch
      return container_map_to_mmal_status(cstatus);
    }
 
+   module->lender = vcos_calloc(1, sizeof(*module->lender), "reader lender");
+   if(!module->lender)
+      return MMAL_ENOMEM;
+   if(vcos_mutex_create(&module->lender->lock, "reader lender") != VCOS_SUCCESS)
+   {
+      vcos_free(module->lender);
+      module->lender = 0;
+      return MMAL_ENOSPC;
+   }
+   module->lender->container = container;
+
    /* Disable all tracks */
    for(track = 0; track < container->tracks_num; track++)
       container->tracks[track]->is_enabled = 0;
@@ -821,6 +954,9 @@ static MMAL_STATUS_T reader_container_seek(MMAL_COMPONENT_T *component, const MM
    }
    cstatus = vc_container_seek( module->container, &offset, VC_CONTAINER_SEEK_MODE_TIME, flags);
    mmal_component_action_unlock(component);
+
+   /* The output buffers may all be waiting already, e.g. after the end of the stream */
+   mmal_component_action_trigger(component);
    return container_map_to_mmal_status(cstatus);
 }
 
@@ -852,6 +988,24 @@ static MMAL_STATUS_T reader_parameter_set(MMAL_PORT_T *port, const MMAL_PARAMETE
    return MMAL_SUCCESS;
 }
 
+static MMAL_STATUS_T reader_port_parameter_set(MMAL_PORT_T *port, const MMAL_PARAMETER_HEADER_T *param)
+{
+   switch(param->id)
+   {
+   case MMAL_PARAMETER_ZERO_COPY:
+      /* Buffer headers get pointed at the packet data in place instead of having it copied
+       * into their payload (only possible when the container is opened with "mmap:"). The
+       * data is read-only and only valid until the buffer header is released. */
+      if(param->size < sizeof(MMAL_PARAMETER_BOOLEAN_T))
+         return MMAL_EINVAL;
+      port->priv->module->zero_copy = ((const MMAL_PARAMETER_BOOLEAN_T *)param)->enable;
+      return MMAL_SUCCESS;
+
+   default:
+      return MMAL_ENOSYS;
+   }
+}
+
 /** Create an instance of a component  */
 static MMAL_STATUS_T mmal_component_create_reader(const char *name, MMAL_COMPONENT_T *component)
 {
@@ -886,6 +1040,7 @@ static MMAL_STATUS_T mmal_component_create_reader(const char *name, MMAL_COMPONE
       component->output[i]->priv->pf_disable = container_port_disable;
       component->output[i]->priv->pf_flush = container_port_flush;
       component->output[i]->priv->pf_send = container_port_send;
+      component->output[i]->priv->pf_parameter_set = reader_port_parameter_set;
       component->output[i]->priv->module->queue = mmal_queue_create();
       if(!component->output[i]->priv->module->queue)
          goto error;
@@ -28,6 +28,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "mmal.h"
 #include "core/mmal_component_private.h"
 #include "core/mmal_port_private.h"
+#include "util/mmal_util_convert.h"
 #include "mmal_logging.h"
 
 /*****************************************************************************/
@@ -35,6 +36,11 @@ typedef struct MMAL_COMPONENT_MODULE_T
 {
    MMAL_STATUS_T status; /**< current status of the component */
 
+   /* Layout requested on the output port, kept across changes of the input format */
+   MMAL_FOURCC_T encoding; /**< encoding to convert to, 0 to keep the input one */
+   uint32_t width;         /**< padded width of the output frames, 0 to keep the input one */
+   uint32_t height;        /**< padded height of the output frames, 0 to keep the input one */
+
 } MMAL_COMPONENT_MODULE_T;
 
 typedef struct MMAL_PORT_MODULE_T
@@ -101,27 +107,18 @@ static MMAL_BOOL_T copy_do_processing(MMAL_COMPONENT_T *component)
       return 0;
    }
 
-   /* Sanity check the output buffer is big enough */
-   if (out->alloc_size < in->length)
+   /* Copy the frame, converting it if the output port asked for another layout.
+    * This also checks the output buffer is big enough. */
+   module->status = mmal_buffer_header_convert(out, port_out->format, in, port_in->format);
+   if (module->status != MMAL_SUCCESS)
    {
-      module->status = MMAL_EINVAL;
+      mmal_queue_put_back(port_in->priv->module->queue, in);
+      mmal_queue_put_back(port_out->priv->module->queue, out);
       if (mmal_event_error_send(component, module->status) != MMAL_SUCCESS)
          LOG_ERROR("unable to send an error event buffer");
       return 0;
    }
 
-   mmal_buffer_header_mem_lock(out);
-   mmal_buffer_header_mem_lock(in);
-   memcpy(out->data, in->data + in->offset, in->length);
-   mmal_buffer_header_mem_unlock(in);
-   mmal_buffer_header_mem_unlock(out);
-   out->length     = in->length;
-   out->offset     = 0;
-   out->flags      = in->flags;
-   out->pts        = in->pts;
-   out->dts        = in->dts;
-   *out->type      = *in->type;
-
    /* Send buffers back */
    in->length = 0;
    mmal_port_buffer_header_callback(port_in, in);
@@ -201,6 +198,72 @@ static MMAL_STATUS_T copy_port_send(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buf
    return MMAL_SUCCESS;
 }
 
+/** Send several buffer headers to a port, triggering the action only once */
+static MMAL_STATUS_T copy_port_send_batch(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T **buffers,
+   unsigned int *count)
+{
+   unsigned int i;
+
+   for (i = 0; i < *count; i++)
+      mmal_queue_put(port->priv->module->queue, buffers[i]);
+   mmal_component_action_trigger(port->component);
+   return MMAL_SUCCESS;
+}
+
+/** Check whether frames can be converted from the input format to the output one */
+static MMAL_BOOL_T copy_conversion_supported(MMAL_ES_FORMAT_T *in, MMAL_ES_FORMAT_T *out)
+{
+   MMAL_RECT_T crop;
+
+   if (in->type != MMAL_ES_TYPE_VIDEO || out->type != MMAL_ES_TYPE_VIDEO ||
+       !mmal_frame_convert_supported(in->encoding, out->encoding))
+      return MMAL_FALSE;
+
+   /* The visible region of the input frames has to fit in the output frames */
+   crop = in->es->video.crop;
+   if (!crop.width || !crop.height)
+   {
+      crop.x = crop.y = 0;
+      crop.width = in->es->video.width;
+      crop.height = in->es->video.height;
+   }
+   return crop.x + crop.width <= out->es->video.width &&
+      crop.y + crop.height <= out->es->video.height;
+}
+
+/** Work out the format of the output port from the one of the input port and
+ * the layout requested on the output port */
+static MMAL_STATUS_T copy_output_format_from_input(MMAL_PORT_T *in, MMAL_ES_FORMAT_T *format,
+   uint32_t *buffer_size)
+{
+   MMAL_COMPONENT_MODULE_T *module = in->component->priv->module;
+   MMAL_STATUS_T status;
+
+   status = mmal_format_full_copy(format, in->format);
+   if (status != MMAL_SUCCESS)
+      return status;
+   *buffer_size = MMAL_MAX(in->buffer_size, in->buffer_size_min);
+
+   if (format->type != MMAL_ES_TYPE_VIDEO || (!module->encoding && !module->width && !module->height))
+      return MMAL_SUCCESS;
+
+   if (module->encoding)
+      format->encoding = format->encoding_variant = module->encoding;
+   if (module->width)
+      format->es->video.width = module->width;
+   if (module->height)
+      format->es->video.height = module->height;
+   if (!copy_conversion_supported(in->format, format))
+   {
+      /* The new input format can't be converted, go back to a plain copy */
+      LOG_INFO("%s: dropping the conversion to %4.4s", in->name, (char *)&module->encoding);
+      module->encoding = module->width = module->height = 0;
+      return mmal_format_full_copy(format, in->format);
+   }
+   *buffer_size = mmal_frame_size(format);
+   return MMAL_SUCCESS;
+}
+
 /** Set format on input port */
 static MMAL_STATUS_T copy_input_port_format_commit(MMAL_PORT_T *in)
 {
@@ -208,22 +271,30 @@ static MMAL_STATUS_T copy_input_port_format_commit(MMAL_PORT_T *in)
    MMAL_PORT_T *out = component->output[0];
    MMAL_EVENT_FORMAT_CHANGED_T *event;
    MMAL_BUFFER_HEADER_T *buffer;
+   MMAL_ES_FORMAT_T *format;
+   uint32_t buffer_size;
    MMAL_STATUS_T status;
 
+   format = mmal_format_alloc();
+   if (!format)
+      return MMAL_ENOMEM;
+   status = copy_output_format_from_input(in, format, &buffer_size);
+   if (status != MMAL_SUCCESS)
+      goto end;
+
    /* Check if there's anything to propagate to the output port */
-   /* The format of the output port needs to match the input port */
-   if (!mmal_format_compare(in->format, out->format) &&
+   if (!mmal_format_compare(format, out->format) &&
        out->buffer_size_min == out->buffer_size_recommended &&
-       out->buffer_size_min == MMAL_MAX(in->buffer_size_min, in->buffer_size))
-      return MMAL_SUCCESS;
+       out->buffer_size_min == buffer_size)
+      goto end;
 
    /* If the output port is not enabled we just need to update its format.
     * Otherwise we'll have to trigger a format changed event for it. */
    if (!out->is_enabled)
    {
-      out->buffer_size_min = out->buffer_size_recommended =
-         MMAL_MAX(in->buffer_size, in->buffer_size_min);
-      return mmal_format_full_copy(out->format, in->format);
+      out->buffer_size_min = out->buffer_size_recommended = buffer_size;
+      status = mmal_format_full_copy(out->format, format);
+      goto end;
    }
 
    /* Send an event on the output port */
@@ -235,16 +306,18 @@ static MMAL_STATUS_T copy_input_port_format_commit(MMAL_PORT_T *in)
    }
 
    event = mmal_event_format_changed_get(buffer);
-   mmal_format_copy(event->format, in->format); /* FIXME: can full copy be done ? */
+   mmal_format_copy(event->format, format); /* FIXME: can full copy be done ? */
 
    /* Pass on the buffer requirements */
    event->buffer_num_min = out->buffer_num_min;
    event->buffer_num_recommended = out->buffer_num_recommended;
-   event->buffer_size_min = event->buffer_size_recommended =
-      MMAL_MAX(in->buffer_size_min, in->buffer_size);
+   event->buffer_size_min = event->buffer_size_recommended = buffer_size;
 
    out->priv->module->needs_configuring = 1;
    mmal_port_event_send(out, buffer);
+
+ end:
+   mmal_format_free(format);
    return status;
 }
 
@@ -252,10 +325,27 @@ static MMAL_STATUS_T copy_input_port_format_commit(MMAL_PORT_T *in)
 static MMAL_STATUS_T copy_output_port_format_commit(MMAL_PORT_T *out)
 {
    MMAL_COMPONENT_T *component = out->component;
+   MMAL_COMPONENT_MODULE_T *module = component->priv->module;
    MMAL_PORT_T *in = component->input[0];
 
-   /* The format of the output port needs to match the input port */
-   if (mmal_format_compare(out->format, in->format))
+   /* The output port either matches the input port or asks for a conversion
+    * of the video frames, to another encoding and/or frame padding */
+   if (!mmal_format_compare(out->format, in->format))
+   {
+      module->encoding = module->width = module->height = 0;
+   }
+   else if (copy_conversion_supported(in->format, out->format))
+   {
+      module->encoding = out->format->encoding != in->format->encoding ? out->format->encoding : 0;
+      module->width = out->format->es->video.width != in->format->es->video.width ?
+         out->format->es->video.width : 0;
+      module->height = out->format->es->video.height != in->format->es->video.height ?
+         out->format->es->video.height : 0;
+      out->format->encoding_variant = out->format->encoding;
+      out->format->es->video.crop = in->format->es->video.crop;
+      out->buffer_size_min = out->buffer_size_recommended = mmal_frame_size(out->format);
+   }
+   else
       return MMAL_EINVAL;
 
    out->priv->module->needs_configuring = 0;
@@ -287,6 +377,7 @@ static MMAL_STATUS_T mmal_component_create_copy(const char *name, MMAL_COMPONENT
    component->input[0]->priv->pf_disable = copy_port_disable;
    component->input[0]->priv->pf_flush = copy_port_flush;
    component->input[0]->priv->pf_send = copy_port_send;
+   component->input[0]->priv->pf_send_batch = copy_port_send_batch;
    component->input[0]->priv->pf_set_format = copy_input_port_format_commit;
    component->input[0]->buffer_num_min = 1;
    component->input[0]->buffer_num_recommended = 0;
@@ -302,6 +393,7 @@ static MMAL_STATUS_T mmal_component_create_copy(const char *name, MMAL_COMPONENT
    component->output[0]->priv->pf_disable = copy_port_disable;
    component->output[0]->priv->pf_flush = copy_port_flush;
    component->output[0]->priv->pf_send = copy_port_send;
+   component->output[0]->priv->pf_send_batch = copy_port_send_batch;
    component->output[0]->priv->pf_set_format = copy_output_port_format_commit;
    component->output[0]->buffer_num_min = 1;
    component->output[0]->buffer_num_recommended = 0;
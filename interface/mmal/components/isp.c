@@ -0,0 +1,849 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/** \file
+ * Software image signal processor.
+ *
+ * This component is a host side stand-in for vc.ril.isp. It takes YUV frames
+ * (I420, NV12 or YUYV) and crops, scales and colour converts them in a single
+ * pass into I420, NV12, RGB24, BGR24 or GREY frames of the size of the output
+ * port.
+ *
+ * The region of the input frames which is used is the crop of the input
+ * format, unless one is set with MMAL_PARAMETER_CROP on the input port. It is
+ * scaled into the crop of the output format. Downscaling averages the source
+ * pixels covered by each destination pixel (area filter), upscaling uses a
+ * bilinear filter. Positions and sizes are rounded down to even values.
+ *
+ * The frame is processed in strips of a few rows: each strip is scaled into
+ * a small I420 buffer which stays in the cache and is then converted into the
+ * output frame with the frame conversion utilities.
+ */
+
+#include "mmal.h"
+#include "core/mmal_component_private.h"
+#include "core/mmal_port_private.h"
+#include "util/mmal_util.h"
+#include "util/mmal_util_convert.h"
+#include "mmal_logging.h"
+
+/* Like the converter ones, the NEON kernels are only built with MMAL_ISP_NEON
+ * until they pass mmal_check_isp on ARM. MMAL_ISP_NO_SIMD leaves only the C
+ * kernels for the check to compare against. */
+#if defined(MMAL_ISP_NO_SIMD)
+#elif defined(MMAL_ISP_NEON) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define ISP_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define ISP_SSE2 1
+#endif
+
+#define ISP_WEIGHT_BITS 7  /**< precision of the filter weights */
+#define ISP_STRIP_ROWS  16 /**< number of output rows scaled at once */
+
+/** Scaling filter along one axis, sampling the source for each destination
+ * sample with a fixed number of weighted taps */
+typedef struct
+{
+   unsigned int taps;  /**< number of source samples per destination sample */
+   uint32_t *first;    /**< first source sample of each destination sample */
+   uint8_t *weights;   /**< weights of the taps, summing to 1 << ISP_WEIGHT_BITS */
+} ISP_FILTER_T;
+
+/** Region of a source plane which is scaled */
+typedef struct
+{
+   uint32_t offset;    /**< offset of the first sample from the start of the frame */
+   uint32_t pitch;     /**< distance between 2 rows */
+   unsigned int step;  /**< distance between 2 samples of a row */
+   uint32_t width;     /**< number of samples in a row */
+} ISP_PLANE_T;
+
+/*****************************************************************************/
+typedef struct MMAL_COMPONENT_MODULE_T
+{
+   MMAL_STATUS_T status; /**< current status of the component */
+
+   MMAL_RECT_T crop;         /**< crop set with MMAL_PARAMETER_CROP, empty to use the input format one */
+   MMAL_BOOL_T output_set;   /**< format of the output port set by the client */
+   MMAL_BOOL_T reconfigure;  /**< processing needs setting up again for new formats */
+
+   /* Processing setup, only used from the action thread */
+   MMAL_BOOL_T direct;            /**< no scaling, frames are converted in one go */
+   MMAL_ES_FORMAT_T *source;      /**< input format with the region to process as crop */
+   MMAL_ES_FORMAT_T *target;      /**< output format with the region to fill as crop */
+   MMAL_ES_FORMAT_T *strip_format;/**< format of a scaled strip */
+   uint32_t source_size;          /**< minimum size of an input frame */
+   uint32_t target_size;          /**< size of an output frame */
+   ISP_PLANE_T plane[3];          /**< Y, U and V regions of the source */
+   ISP_FILTER_T filter[2][2];     /**< luma and chroma, horizontal and vertical filters */
+   uint8_t *strip;                /**< scaled rows, in I420 */
+   uint8_t *row;                  /**< source row filtered vertically */
+
+} MMAL_COMPONENT_MODULE_T;
+
+typedef struct MMAL_PORT_MODULE_T
+{
+   MMAL_QUEUE_T *queue; /**< queue for the buffers sent to the ports */
+
+} MMAL_PORT_MODULE_T;
+
+/*****************************************************************************
+ * Scaling
+ *****************************************************************************/
+
+static void isp_filter_free(ISP_FILTER_T *filter)
+{
+   vcos_free(filter->first);
+   vcos_free(filter->weights);
+   memset(filter, 0, sizeof(*filter));
+}
+
+/** Build the filter scaling src samples into dst samples */
+static MMAL_STATUS_T isp_filter_init(ISP_FILTER_T *filter, uint32_t src, uint32_t dst)
+{
+   const unsigned int one = 1 << ISP_WEIGHT_BITS;
+   unsigned int taps, i, t;
+
+   if (src == dst)
+      taps = 1;
+   else if (src > dst)
+      taps = (src + dst - 1) / dst + 1; /* area filter */
+   else
+      taps = 2;                         /* bilinear filter */
+   taps = MMAL_MIN(taps, src);
+
+   filter->taps = taps;
+   filter->first = vcos_calloc(dst, sizeof(*filter->first), "isp filter");
+   filter->weights = vcos_calloc(dst, taps, "isp filter");
+   if (!filter->first || !filter->weights)
+   {
+      isp_filter_free(filter);
+      return MMAL_ENOMEM;
+   }
+
+   /* Positions are worked out in fractions of a source sample to stay exact */
+   for (i = 0; i < dst; i++)
+   {
+      uint8_t *weights = filter->weights + i * taps;
+      unsigned int sum = 0, largest = 0;
+      uint32_t first;
+
+      if (taps == 1)
+      {
+         first = src == dst ? i : 0;
+         weights[0] = one;
+      }
+      else if (src > dst)
+      {
+         /* Source interval [i * src, (i + 1) * src) in units of 1 / dst */
+         uint64_t begin = (uint64_t)i * src, end = begin + src;
+
+         first = begin / dst;
+         for (t = 0; t < taps; t++)
+         {
+            uint64_t lo = MMAL_MAX(begin, (uint64_t)(first + t) * dst);
+            uint64_t hi = MMAL_MIN(end, (uint64_t)(first + t + 1) * dst);
+            weights[t] = hi > lo ? ((hi - lo) * one + src / 2) / src : 0;
+         }
+      }
+      else
+      {
+         /* Centre of the destination sample, (i + 0.5) * src / dst - 0.5 */
+         int64_t centre = (int64_t)(2 * i + 1) * src - dst;
+         uint64_t frac;
+
+         if (centre < 0)
+            centre = 0;
+         first = centre / (2 * dst);
+         frac = centre % (2 * dst);
+         if (first >= src - 1)
+            first = src - 1, frac = 0;
+         weights[1] = (frac * one + dst) / (2 * dst);
+         weights[0] = one - weights[1];
+      }
+
+      /* Keep the taps inside the source, the ones past its end have no weight */
+      if (first + taps > src)
+      {
+         unsigned int shift = first + taps - src;
+         for (t = taps; t-- > 0; )
+            weights[t] = t >= shift ? weights[t - shift] : 0;
+         first -= shift;
+      }
+
+      /* Rounding may leave the weights slightly off, fix up the largest one */
+      for (t = 0; t < taps; t++)
+      {
+         sum += weights[t];
+         if (weights[t] > weights[largest])
+            largest = t;
+      }
+      weights[largest] += one - sum;
+      filter->first[i] = first;
+   }
+
+   return MMAL_SUCCESS;
+}
+
+/** Filter several source rows into one */
+static void isp_filter_vertical(uint8_t *dst, const uint8_t *src, uint32_t pitch, unsigned int step,
+   const uint8_t *weights, unsigned int taps, unsigned int width)
+{
+   unsigned int x = 0, t;
+
+   if (taps == 1 && step == 1)
+   {
+      memcpy(dst, src, width);
+      return;
+   }
+
+   if (step == 1)
+   {
+#if defined(ISP_NEON)
+      for (; x + 8 <= width; x += 8)
+      {
+         uint16x8_t acc = vdupq_n_u16(1 << (ISP_WEIGHT_BITS - 1));
+         for (t = 0; t < taps; t++)
+            acc = vmlal_u8(acc, vld1_u8(src + t * pitch + x), vdup_n_u8(weights[t]));
+         vst1_u8(dst + x, vshrn_n_u16(acc, ISP_WEIGHT_BITS));
+      }
+#elif defined(ISP_SSE2)
+      const __m128i zero = _mm_setzero_si128();
+      for (; x + 8 <= width; x += 8)
+      {
+         __m128i acc = _mm_set1_epi16(1 << (ISP_WEIGHT_BITS - 1));
+         for (t = 0; t < taps; t++)
+         {
+            __m128i pixels = _mm_loadl_epi64((const __m128i *)(src + t * pitch + x));
+            acc = _mm_add_epi16(acc, _mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero),
+                                                     _mm_set1_epi16(weights[t])));
+         }
+         _mm_storel_epi64((__m128i *)(dst + x),
+                          _mm_packus_epi16(_mm_srli_epi16(acc, ISP_WEIGHT_BITS), zero));
+      }
+#endif
+   }
+
+   /* The weights sum to 1 << ISP_WEIGHT_BITS so the sums fit in 16 bits */
+   for (; x < width; x++)
+   {
+      unsigned int acc = 1 << (ISP_WEIGHT_BITS - 1);
+      for (t = 0; t < taps; t++)
+         acc += src[t * pitch + x * step] * weights[t];
+      dst[x] = acc >> ISP_WEIGHT_BITS;
+   }
+}
+
+/** Filter a row horizontally */
+static void isp_filter_horizontal(uint8_t *dst, const uint8_t *src, const ISP_FILTER_T *filter,
+   unsigned int width)
+{
+   const uint8_t *weights = filter->weights;
+   unsigned int x, t;
+
+   if (filter->taps == 1)
+   {
+      memcpy(dst, src, width);
+      return;
+   }
+
+   for (x = 0; x < width; x++, weights += filter->taps)
+   {
+      const uint8_t *pixels = src + filter->first[x];
+      unsigned int acc = 1 << (ISP_WEIGHT_BITS - 1);
+      for (t = 0; t < filter->taps; t++)
+         acc += pixels[t] * weights[t];
+      dst[x] = acc >> ISP_WEIGHT_BITS;
+   }
+}
+
+/** Scale one row of a plane */
+static void isp_scale_row(MMAL_COMPONENT_MODULE_T *module, uint8_t *dst, const uint8_t *frame,
+   const ISP_PLANE_T *plane, const ISP_FILTER_T *filter, unsigned int row, unsigned int width)
+{
+   const ISP_FILTER_T *vertical = filter + 1;
+
+   isp_filter_vertical(module->row, frame + plane->offset + vertical->first[row] * plane->pitch,
+      plane->pitch, plane->step, vertical->weights + row * vertical->taps, vertical->taps, plane->width);
+   isp_filter_horizontal(dst, module->row, filter, width);
+}
+
+/** Scale a frame strip by strip, converting each strip into the output frame */
+static MMAL_STATUS_T isp_scale_frame(MMAL_COMPONENT_MODULE_T *module, uint8_t *dst, uint32_t dst_size,
+   const uint8_t *src)
+{
+   MMAL_RECT_T *region = &module->target->es->video.crop;
+   uint32_t width = region->width, height = region->height, top = region->y;
+   uint8_t *strip_u = module->strip + width * ISP_STRIP_ROWS;
+   uint8_t *strip_v = strip_u + width / 2 * ISP_STRIP_ROWS / 2;
+   MMAL_STATUS_T status = MMAL_SUCCESS;
+   unsigned int row, rows, i;
+
+   for (row = 0; row < height && status == MMAL_SUCCESS; row += rows)
+   {
+      rows = MMAL_MIN(height - row, ISP_STRIP_ROWS);
+
+      for (i = 0; i < rows; i++)
+         isp_scale_row(module, module->strip + i * width, src, &module->plane[0],
+                       module->filter[0], row + i, width);
+      for (i = 0; i < rows / 2; i++)
+      {
+         isp_scale_row(module, strip_u + i * width / 2, src, &module->plane[1],
+                       module->filter[1], row / 2 + i, width / 2);
+         isp_scale_row(module, strip_v + i * width / 2, src, &module->plane[2],
+                       module->filter[1], row / 2 + i, width / 2);
+      }
+
+      /* The strip is laid out as an I420 frame of ISP_STRIP_ROWS rows,
+       * the region of the output frame it goes to follows it down */
+      module->strip_format->es->video.crop.height = rows;
+      region->y = top + row;
+      region->height = rows;
+      status = mmal_frame_convert(dst, dst_size, module->target, module->strip,
+                                  width * ISP_STRIP_ROWS * 3 / 2, module->strip_format);
+   }
+
+   region->y = top;
+   region->height = height;
+   return status;
+}
+
+/*****************************************************************************
+ * Configuration
+ *****************************************************************************/
+
+/** Encodings which can be processed */
+static MMAL_BOOL_T isp_input_encoding_supported(MMAL_FOURCC_T encoding)
+{
+   return encoding == MMAL_ENCODING_I420 || encoding == MMAL_ENCODING_NV12 ||
+      encoding == MMAL_ENCODING_YUYV;
+}
+
+static MMAL_BOOL_T isp_output_encoding_supported(MMAL_FOURCC_T encoding)
+{
+   return mmal_frame_convert_supported(MMAL_ENCODING_I420, encoding);
+}
+
+/** Visible region of a frame, rounded to even values */
+static MMAL_BOOL_T isp_frame_region(const MMAL_ES_FORMAT_T *format, const MMAL_RECT_T *crop,
+   MMAL_RECT_T *rect)
+{
+   const MMAL_VIDEO_FORMAT_T *video = &format->es->video;
+
+   *rect = crop && crop->width && crop->height ? *crop : video->crop;
+   if (!rect->width || !rect->height)
+   {
+      rect->x = rect->y = 0;
+      rect->width = video->width;
+      rect->height = video->height;
+   }
+   rect->x &= ~1; rect->y &= ~1;
+   rect->width &= ~1; rect->height &= ~1;
+
+   return rect->x >= 0 && rect->y >= 0 && rect->width > 0 && rect->height > 0 &&
+      (uint32_t)(rect->x + rect->width) <= video->width &&
+      (uint32_t)(rect->y + rect->height) <= video->height;
+}
+
+/** Work out where the samples of the processed region of each plane are */
+static void isp_source_planes(const MMAL_ES_FORMAT_T *format, const MMAL_RECT_T *rect, ISP_PLANE_T *plane)
+{
+   uint32_t stride = mmal_encoding_width_to_stride(format->encoding, format->es->video.width);
+   uint32_t luma_size = stride * format->es->video.height;
+   unsigned int i;
+
+   switch (format->encoding)
+   {
+   case MMAL_ENCODING_YUYV:
+      for (i = 0; i < 3; i++)
+      {
+         plane[i].pitch = stride;
+         plane[i].step = i ? 4 : 2;
+         plane[i].offset = rect->y * stride + rect->x * 2 + (i ? 2 * i - 1 : 0);
+      }
+      break;
+   case MMAL_ENCODING_NV12:
+      plane[0].pitch = plane[1].pitch = plane[2].pitch = stride;
+      plane[0].step = 1;
+      plane[1].step = plane[2].step = 2;
+      plane[0].offset = rect->y * stride + rect->x;
+      plane[1].offset = luma_size + rect->y / 2 * stride + rect->x;
+      plane[2].offset = plane[1].offset + 1;
+      break;
+   default: /* I420 */
+      plane[0].pitch = stride;
+      plane[1].pitch = plane[2].pitch = stride / 2;
+      plane[0].step = plane[1].step = plane[2].step = 1;
+      plane[0].offset = rect->y * stride + rect->x;
+      plane[1].offset = luma_size + rect->y / 2 * (stride / 2) + rect->x / 2;
+      plane[2].offset = plane[1].offset + luma_size / 4;
+      break;
+   }
+
+   plane[0].width = rect->width;
+   plane[1].width = plane[2].width = rect->width / 2;
+}
+
+static void isp_processing_release(MMAL_COMPONENT_MODULE_T *module)
+{
+   unsigned int i;
+
+   for (i = 0; i < 4; i++)
+      isp_filter_free(&module->filter[i / 2][i % 2]);
+   vcos_free(module->strip);
+   vcos_free(module->row);
+   module->strip = module->row = NULL;
+}
+
+/** Set up the processing for the current formats of the ports */
+static MMAL_STATUS_T isp_processing_setup(MMAL_COMPONENT_T *component)
+{
+   MMAL_COMPONENT_MODULE_T *module = component->priv->module;
+   MMAL_ES_FORMAT_T *in = component->input[0]->format, *out = component->output[0]->format;
+   MMAL_RECT_T src, dst;
+   MMAL_STATUS_T status;
+   uint32_t chroma_height;
+
+   isp_processing_release(module);
+
+   if (!isp_input_encoding_supported(in->encoding) || !isp_output_encoding_supported(out->encoding) ||
+       !isp_frame_region(in, &module->crop, &src) || !isp_frame_region(out, NULL, &dst))
+   {
+      LOG_ERROR("can't process %4.4s to %4.4s", (char *)&in->encoding, (char *)&out->encoding);
+      return MMAL_EINVAL;
+   }
+
+   if (mmal_format_full_copy(module->source, in) != MMAL_SUCCESS ||
+       mmal_format_full_copy(module->target, out) != MMAL_SUCCESS)
+      return MMAL_ENOMEM;
+   module->source->es->video.crop = src;
+   module->target->es->video.crop = dst;
+   module->source_size = mmal_frame_size(module->source);
+   module->target_size = mmal_frame_size(module->target);
+
+   /* Frames which only need cropping are converted directly if possible */
+   module->direct = src.width == dst.width && src.height == dst.height &&
+      mmal_frame_convert_supported(in->encoding, out->encoding);
+   if (module->direct)
+      return MMAL_SUCCESS;
+
+   module->strip_format->type = MMAL_ES_TYPE_VIDEO;
+   module->strip_format->encoding = MMAL_ENCODING_I420;
+   module->strip_format->es->video.width = dst.width;
+   module->strip_format->es->video.height = ISP_STRIP_ROWS;
+   module->strip_format->es->video.crop.width = dst.width;
+
+   chroma_height = in->encoding == MMAL_ENCODING_YUYV ? src.height : src.height / 2;
+   isp_source_planes(in, &src, module->plane);
+   status = isp_filter_init(&module->filter[0][0], src.width, dst.width);
+   if (status == MMAL_SUCCESS)
+      status = isp_filter_init(&module->filter[0][1], src.height, dst.height);
+   if (status == MMAL_SUCCESS)
+      status = isp_filter_init(&module->filter[1][0], src.width / 2, dst.width / 2);
+   if (status == MMAL_SUCCESS)
+      status = isp_filter_init(&module->filter[1][1], chroma_height, dst.height / 2);
+   if (status != MMAL_SUCCESS)
+      goto error;
+
+   module->strip = vcos_malloc(dst.width * ISP_STRIP_ROWS * 3 / 2, "isp strip");
+   module->row = vcos_malloc(src.width, "isp row");
+   if (!module->strip || !module->row)
+   {
+      status = MMAL_ENOMEM;
+      goto error;
+   }
+   return MMAL_SUCCESS;
+
+ error:
+   isp_processing_release(module);
+   return status;
+}
+
+/*****************************************************************************/
+
+/** Actual processing function */
+static MMAL_BOOL_T isp_do_processing(MMAL_COMPONENT_T *component)
+{
+   MMAL_COMPONENT_MODULE_T *module = component->priv->module;
+   MMAL_PORT_T *port_in = component->input[0];
+   MMAL_PORT_T *port_out = component->output[0];
+   MMAL_BUFFER_HEADER_T *in, *out;
+
+   in = mmal_queue_get(port_in->priv->module->queue);
+   if (!in)
+      return 0;
+
+   /* Handle event buffers */
+   if (in->cmd)
+   {
+      MMAL_EVENT_FORMAT_CHANGED_T *event = mmal_event_format_changed_get(in);
+      if (event)
+      {
+         module->status = mmal_format_full_copy(port_in->format, event->format);
+         if (module->status == MMAL_SUCCESS)
+            module->status = port_in->priv->pf_set_format(port_in);
+         if (module->status != MMAL_SUCCESS)
+         {
+            LOG_ERROR("format not set on port %s %p (%i)", port_in->name, port_in, module->status);
+            if (mmal_event_error_send(component, module->status) != MMAL_SUCCESS)
+               LOG_ERROR("unable to send an error event buffer");
+         }
+      }
+      else
+      {
+         LOG_ERROR("discarding event %i on port %s %p", (int)in->cmd, port_in->name, port_in);
+      }
+
+      in->length = 0;
+      mmal_port_buffer_header_callback(port_in, in);
+      return 1;
+   }
+
+   /* Don't do anything if we've already seen an error */
+   if (module->status != MMAL_SUCCESS)
+   {
+      mmal_queue_put_back(port_in->priv->module->queue, in);
+      return 0;
+   }
+
+   out = mmal_queue_get(port_out->priv->module->queue);
+   if (!out)
+   {
+      mmal_queue_put_back(port_in->priv->module->queue, in);
+      return 0;
+   }
+
+   if (module->reconfigure)
+   {
+      module->reconfigure = MMAL_FALSE;
+      module->status = isp_processing_setup(component);
+   }
+
+   if (module->status == MMAL_SUCCESS && in->length)
+   {
+      if (in->length < module->source_size || out->alloc_size < module->target_size)
+      {
+         LOG_ERROR("buffers too small (%u/%u, %u/%u)", in->length, module->source_size,
+                   out->alloc_size, module->target_size);
+         module->status = MMAL_EINVAL;
+      }
+      else
+      {
+         mmal_buffer_header_mem_lock(out);
+         mmal_buffer_header_mem_lock(in);
+         if (module->direct)
+            module->status = mmal_frame_convert(out->data, out->alloc_size, module->target,
+                                                in->data + in->offset, in->length, module->source);
+         else
+            module->status = isp_scale_frame(module, out->data, out->alloc_size, in->data + in->offset);
+         mmal_buffer_header_mem_unlock(in);
+         mmal_buffer_header_mem_unlock(out);
+      }
+   }
+
+   if (module->status != MMAL_SUCCESS)
+   {
+      mmal_queue_put_back(port_in->priv->module->queue, in);
+      mmal_queue_put_back(port_out->priv->module->queue, out);
+      if (mmal_event_error_send(component, module->status) != MMAL_SUCCESS)
+         LOG_ERROR("unable to send an error event buffer");
+      return 0;
+   }
+
+   out->length = in->length ? module->target_size : 0;
+   out->offset = 0;
+   out->flags = in->flags;
+   out->pts = in->pts;
+   out->dts = in->dts;
+
+   /* Send buffers back */
+   in->length = 0;
+   mmal_port_buffer_header_callback(port_in, in);
+   mmal_port_buffer_header_callback(port_out, out);
+   return 1;
+}
+
+/*****************************************************************************/
+static void isp_do_processing_loop(MMAL_COMPONENT_T *component)
+{
+   while (isp_do_processing(component));
+}
+
+/** Destroy a previously created component */
+static MMAL_STATUS_T isp_component_destroy(MMAL_COMPONENT_T *component)
+{
+   MMAL_COMPONENT_MODULE_T *module = component->priv->module;
+   unsigned int i;
+
+   for(i = 0; i < component->input_num; i++)
+      if(component->input[i]->priv->module->queue)
+         mmal_queue_destroy(component->input[i]->priv->module->queue);
+   if(component->input_num)
+      mmal_ports_free(component->input, component->input_num);
+
+   for(i = 0; i < component->output_num; i++)
+      if(component->output[i]->priv->module->queue)
+         mmal_queue_destroy(component->output[i]->priv->module->queue);
+   if(component->output_num)
+      mmal_ports_free(component->output, component->output_num);
+
+   isp_processing_release(module);
+   if (module->source)
+      mmal_format_free(module->source);
+   if (module->target)
+      mmal_format_free(module->target);
+   if (module->strip_format)
+      mmal_format_free(module->strip_format);
+   vcos_free(module);
+   return MMAL_SUCCESS;
+}
+
+/** Enable processing on a port */
+static MMAL_STATUS_T isp_port_enable(MMAL_PORT_T *port, MMAL_PORT_BH_CB_T cb)
+{
+   MMAL_PARAM_UNUSED(port);
+   MMAL_PARAM_UNUSED(cb);
+   return MMAL_SUCCESS;
+}
+
+/** Flush a port */
+static MMAL_STATUS_T isp_port_flush(MMAL_PORT_T *port)
+{
+   MMAL_PORT_MODULE_T *port_module = port->priv->module;
+   MMAL_BUFFER_HEADER_T *buffer;
+
+   /* Flush buffers that our component is holding on to */
+   buffer = mmal_queue_get(port_module->queue);
+   while(buffer)
+   {
+      mmal_port_buffer_header_callback(port, buffer);
+      buffer = mmal_queue_get(port_module->queue);
+   }
+
+   return MMAL_SUCCESS;
+}
+
+/** Disable processing on a port */
+static MMAL_STATUS_T isp_port_disable(MMAL_PORT_T *port)
+{
+   /* We just need to flush our internal queue */
+   return isp_port_flush(port);
+}
+
+/** Send a buffer header to a port */
+static MMAL_STATUS_T isp_port_send(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+   mmal_queue_put(port->priv->module->queue, buffer);
+   mmal_component_action_trigger(port->component);
+   return MMAL_SUCCESS;
+}
+
+/** Send several buffer headers to a port, triggering the action only once */
+static MMAL_STATUS_T isp_port_send_batch(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T **buffers,
+   unsigned int *count)
+{
+   unsigned int i;
+
+   for (i = 0; i < *count; i++)
+      mmal_queue_put(port->priv->module->queue, buffers[i]);
+   mmal_component_action_trigger(port->component);
+   return MMAL_SUCCESS;
+}
+
+/** Give the output port the size of the processed region until the client
+ * sets its own format */
+static MMAL_STATUS_T isp_output_format_default(MMAL_COMPONENT_T *component)
+{
+   MMAL_COMPONENT_MODULE_T *module = component->priv->module;
+   MMAL_PORT_T *in = component->input[0], *out = component->output[0];
+   MMAL_RECT_T rect;
+   MMAL_STATUS_T status;
+
+   if (module->output_set || out->is_enabled || !isp_frame_region(in->format, &module->crop, &rect))
+      return MMAL_SUCCESS;
+
+   status = mmal_format_full_copy(out->format, in->format);
+   if (status != MMAL_SUCCESS)
+      return status;
+   if (!isp_output_encoding_supported(out->format->encoding))
+      out->format->encoding = MMAL_ENCODING_I420;
+   out->format->encoding_variant = out->format->encoding;
+   out->format->es->video.width = rect.width;
+   out->format->es->video.height = rect.height;
+   out->format->es->video.crop.x = out->format->es->video.crop.y = 0;
+   out->format->es->video.crop.width = rect.width;
+   out->format->es->video.crop.height = rect.height;
+   out->buffer_size_min = out->buffer_size_recommended = mmal_frame_size(out->format);
+   return MMAL_SUCCESS;
+}
+
+/** Set format on input port */
+static MMAL_STATUS_T isp_input_port_format_commit(MMAL_PORT_T *in)
+{
+   MMAL_COMPONENT_T *component = in->component;
+   MMAL_COMPONENT_MODULE_T *module = component->priv->module;
+   MMAL_RECT_T rect;
+
+   if (in->format->type != MMAL_ES_TYPE_VIDEO || !isp_input_encoding_supported(in->format->encoding) ||
+       !isp_frame_region(in->format, NULL, &rect))
+      return MMAL_EINVAL;
+
+   in->buffer_size_min = in->buffer_size_recommended = mmal_frame_size(in->format);
+   module->reconfigure = MMAL_TRUE;
+   return isp_output_format_default(component);
+}
+
+/** Set format on output port */
+static MMAL_STATUS_T isp_output_port_format_commit(MMAL_PORT_T *out)
+{
+   MMAL_COMPONENT_T *component = out->component;
+   MMAL_COMPONENT_MODULE_T *module = component->priv->module;
+   MMAL_RECT_T rect;
+
+   if (out->format->type != MMAL_ES_TYPE_VIDEO || !isp_output_encoding_supported(out->format->encoding) ||
+       !isp_frame_region(out->format, NULL, &rect))
+      return MMAL_EINVAL;
+
+   out->format->encoding_variant = out->format->encoding;
+   out->buffer_size_min = out->buffer_size_recommended = mmal_frame_size(out->format);
+   module->output_set = MMAL_TRUE;
+   module->reconfigure = MMAL_TRUE;
+   mmal_component_action_trigger(component);
+   return MMAL_SUCCESS;
+}
+
+/** Set parameter on the input port */
+static MMAL_STATUS_T isp_port_parameter_set(MMAL_PORT_T *port, const MMAL_PARAMETER_HEADER_T *param)
+{
+   MMAL_COMPONENT_MODULE_T *module = port->component->priv->module;
+
+   switch (param->id)
+   {
+   case MMAL_PARAMETER_CROP:
+      if (param->size < sizeof(MMAL_PARAMETER_CROP_T))
+         return MMAL_EINVAL;
+      module->crop = ((const MMAL_PARAMETER_CROP_T *)param)->rect;
+      module->reconfigure = MMAL_TRUE;
+      return isp_output_format_default(port->component);
+
+   default:
+      return MMAL_ENOSYS;
+   }
+}
+
+/** Get parameter from the input port */
+static MMAL_STATUS_T isp_port_parameter_get(MMAL_PORT_T *port, MMAL_PARAMETER_HEADER_T *param)
+{
+   MMAL_COMPONENT_MODULE_T *module = port->component->priv->module;
+
+   switch (param->id)
+   {
+   case MMAL_PARAMETER_CROP:
+      if (param->size < sizeof(MMAL_PARAMETER_CROP_T))
+         return MMAL_EINVAL;
+      ((MMAL_PARAMETER_CROP_T *)param)->rect = module->crop;
+      return MMAL_SUCCESS;
+
+   default:
+      return MMAL_ENOSYS;
+   }
+}
+
+/** Create an instance of a component  */
+static MMAL_STATUS_T mmal_component_create_isp(const char *name, MMAL_COMPONENT_T *component)
+{
+   MMAL_COMPONENT_MODULE_T *module;
+   MMAL_STATUS_T status = MMAL_ENOMEM;
+   MMAL_PARAM_UNUSED(name);
+
+   /* Allocate the context for our module */
+   component->priv->module = module = vcos_malloc(sizeof(*module), "mmal module");
+   if (!module)
+      return MMAL_ENOMEM;
+   memset(module, 0, sizeof(*module));
+
+   component->priv->pf_destroy = isp_component_destroy;
+
+   module->source = mmal_format_alloc();
+   module->target = mmal_format_alloc();
+   module->strip_format = mmal_format_alloc();
+   if (!module->source || !module->target || !module->strip_format)
+      goto error;
+
+   /* Allocate and initialise all the ports for this component */
+   component->input = mmal_ports_alloc(component, 1, MMAL_PORT_TYPE_INPUT, sizeof(MMAL_PORT_MODULE_T));
+   if(!component->input)
+      goto error;
+   component->input_num = 1;
+   component->input[0]->priv->pf_enable = isp_port_enable;
+   component->input[0]->priv->pf_disable = isp_port_disable;
+   component->input[0]->priv->pf_flush = isp_port_flush;
+   component->input[0]->priv->pf_send = isp_port_send;
+   component->input[0]->priv->pf_send_batch = isp_port_send_batch;
+   component->input[0]->priv->pf_set_format = isp_input_port_format_commit;
+   component->input[0]->priv->pf_parameter_set = isp_port_parameter_set;
+   component->input[0]->priv->pf_parameter_get = isp_port_parameter_get;
+   component->input[0]->buffer_num_min = 1;
+   component->input[0]->buffer_num_recommended = 0;
+   component->input[0]->priv->module->queue = mmal_queue_create();
+   if(!component->input[0]->priv->module->queue)
+      goto error;
+
+   component->output = mmal_ports_alloc(component, 1, MMAL_PORT_TYPE_OUTPUT, sizeof(MMAL_PORT_MODULE_T));
+   if(!component->output)
+      goto error;
+   component->output_num = 1;
+   component->output[0]->priv->pf_enable = isp_port_enable;
+   component->output[0]->priv->pf_disable = isp_port_disable;
+   component->output[0]->priv->pf_flush = isp_port_flush;
+   component->output[0]->priv->pf_send = isp_port_send;
+   component->output[0]->priv->pf_send_batch = isp_port_send_batch;
+   component->output[0]->priv->pf_set_format = isp_output_port_format_commit;
+   component->output[0]->buffer_num_min = 1;
+   component->output[0]->buffer_num_recommended = 0;
+   component->output[0]->priv->module->queue = mmal_queue_create();
+   if(!component->output[0]->priv->module->queue)
+      goto error;
+
+   status = mmal_component_action_register(component, isp_do_processing_loop);
+   if (status != MMAL_SUCCESS)
+      goto error;
+
+   return MMAL_SUCCESS;
+
+ error:
+   isp_component_destroy(component);
+   return status;
+}
+
+MMAL_CONSTRUCTOR(mmal_register_component_isp);
+void mmal_register_component_isp(void)
+{
+   mmal_component_supplier_register("isp", mmal_component_create_isp);
+}
@@ -30,6 +30,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "core/mmal_port_private.h"
 #include "core/mmal_component_private.h"
 #include "core/mmal_clock_private.h"
+#include "util/mmal_util_convert.h"
 
 #define SCHEDULER_CLOCK_PORTS_NUM  1
 #define SCHEDULER_INPUT_PORTS_NUM  1
@@ -167,27 +168,17 @@ static MMAL_BOOL_T scheduler_component_process_buffers(MMAL_COMPONENT_T *compone
    }
    else
    {
-      /* Make a full copy of the input payload */
-      if (out->alloc_size < in->length)
+      /* Make a full copy of the input payload, following the plane layout of
+       * the output port if it differs from the input one */
+      module->status = mmal_buffer_header_convert(out, port_out->format, in, port_in->format);
+      if (module->status != MMAL_SUCCESS)
       {
-         LOG_ERROR("output buffer too small");
+         LOG_ERROR("could not copy to the output buffer");
 
-         module->status = MMAL_EINVAL;
          if (mmal_event_error_send(component, module->status) != MMAL_SUCCESS)
             LOG_ERROR("unable to send an error event buffer");
          goto end;
       }
-      mmal_buffer_header_mem_lock(out);
-      mmal_buffer_header_mem_lock(in);
-      memcpy(out->data, in->data + in->offset, in->length);
-      mmal_buffer_header_mem_unlock(in);
-      mmal_buffer_header_mem_unlock(out);
-      out->length     = in->length;
-      out->offset     = 0;
-      out->flags      = in->flags;
-      out->pts        = in->pts;
-      out->dts        = in->dts;
-      *out->type      = *in->type;
    }
 
    /* Finished with the input buffer, so return it */
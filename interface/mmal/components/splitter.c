@@ -31,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "mmal_logging.h"
 
 #define SPLITTER_OUTPUT_PORTS_NUM 4 /* 4 should do for now */
+#define SPLITTER_LATEST_HEADERS_NUM 4 /* headers available to keep-latest outputs */
 
 /*****************************************************************************/
 typedef struct MMAL_COMPONENT_MODULE_T
@@ -38,6 +39,7 @@ typedef struct MMAL_COMPONENT_MODULE_T
    uint32_t enabled_flags; /**< Flags indicating which output port is enabled */
    uint32_t sent_flags;    /**< Flags indicating which output port we've already sent data to */
    MMAL_BOOL_T error;      /**< Error state */
+   MMAL_BOOL_T frame_started; /**< Outputs skipping the current input have been marked */
 
 } MMAL_COMPONENT_MODULE_T;
 
@@ -45,6 +47,13 @@ typedef struct MMAL_PORT_MODULE_T
 {
    MMAL_QUEUE_T *queue; /**< queue for the buffers sent to the ports */
 
+   MMAL_PARAMETER_OUTPUT_POLICY_T policy; /**< what to do when the output has no buffer */
+   uint32_t decimation_count;   /**< frames seen since the output was last flushed */
+   int64_t next_time;           /**< earliest time of the next frame when rate limiting */
+   MMAL_POOL_T *latest_pool;    /**< headers used to keep the latest frame */
+   MMAL_QUEUE_T *latest;        /**< latest frame kept for a keep-latest output */
+   MMAL_PARAMETER_STATISTICS_T stats; /**< per-output frame counts */
+
 } MMAL_PORT_MODULE_T;
 
 /*****************************************************************************/
@@ -61,8 +70,20 @@ static MMAL_STATUS_T splitter_component_destroy(MMAL_COMPONENT_T *component)
       mmal_ports_free(component->input, component->input_num);
 
    for(i = 0; i < component->output_num; i++)
-      if(component->output[i]->priv->module->queue)
-         mmal_queue_destroy(component->output[i]->priv->module->queue);
+   {
+      MMAL_PORT_MODULE_T *port_module = component->output[i]->priv->module;
+      if(port_module->latest)
+      {
+         MMAL_BUFFER_HEADER_T *latest;
+         while((latest = mmal_queue_get(port_module->latest)) != NULL)
+            mmal_buffer_header_release(latest);
+         mmal_queue_destroy(port_module->latest);
+      }
+      if(port_module->latest_pool)
+         mmal_pool_destroy(port_module->latest_pool);
+      if(port_module->queue)
+         mmal_queue_destroy(port_module->queue);
+   }
    if(component->output_num)
       mmal_ports_free(component->output, component->output_num);
 
@@ -98,7 +119,11 @@ static MMAL_STATUS_T splitter_port_enable(MMAL_PORT_T *port, MMAL_PORT_BH_CB_T c
    MMAL_PARAM_UNUSED(cb);
    if (port->buffer_size)
    if (port->type == MMAL_PORT_TYPE_OUTPUT)
+   {
+      mmal_component_action_lock(port->component);
       port->component->priv->module->enabled_flags |= (1<<port->index);
+      mmal_component_action_unlock(port->component);
+   }
    return MMAL_SUCCESS;
 }
 
@@ -117,7 +142,18 @@ static MMAL_STATUS_T splitter_port_flush(MMAL_PORT_T *port)
    }
 
    if (port->type == MMAL_PORT_TYPE_INPUT)
+   {
       port->component->priv->module->sent_flags = 0;
+      port->component->priv->module->frame_started = 0;
+   }
+   else
+   {
+      /* Drop the frame kept for a keep-latest output and restart pacing */
+      while ((buffer = mmal_queue_get(port_module->latest)) != NULL)
+         mmal_buffer_header_release(buffer);
+      port_module->next_time = MMAL_TIME_UNKNOWN;
+      port_module->decimation_count = 0;
+   }
 
    return MMAL_SUCCESS;
 }
@@ -125,11 +161,51 @@ static MMAL_STATUS_T splitter_port_flush(MMAL_PORT_T *port)
 /** Disable processing on a port */
 static MMAL_STATUS_T splitter_port_disable(MMAL_PORT_T *port)
 {
+   MMAL_STATUS_T status;
+
    if (port->type == MMAL_PORT_TYPE_OUTPUT)
       port->component->priv->module->enabled_flags &= ~(1<<port->index);
 
    /* We just need to flush our internal queue */
-   return splitter_port_flush(port);
+   status = splitter_port_flush(port);
+
+   /* The input buffer may have been waiting for that output only */
+   if (port->type == MMAL_PORT_TYPE_OUTPUT)
+      mmal_component_action_trigger(port->component);
+   return status;
+}
+
+/** Decide whether an output should be given the current input frame,
+ * according to its decimation and frame rate limit */
+static MMAL_BOOL_T splitter_output_wants(MMAL_PORT_T *out_port, MMAL_BUFFER_HEADER_T *in)
+{
+   MMAL_PORT_MODULE_T *port_module = out_port->priv->module;
+   MMAL_PARAMETER_OUTPUT_POLICY_T *policy = &port_module->policy;
+   int64_t time, interval;
+
+   if (policy->decimation > 1)
+   {
+      if (port_module->decimation_count++ % policy->decimation)
+         return MMAL_FALSE;
+   }
+
+   if (policy->max_frame_rate.num <= 0 || policy->max_frame_rate.den <= 0)
+      return MMAL_TRUE;
+
+   /* Frames are paced on their timestamps, or on their arrival if they have none */
+   time = in->pts != MMAL_TIME_UNKNOWN ? in->pts : (int64_t)vcos_getmicrosecs64();
+   interval = INT64_C(1000000) * policy->max_frame_rate.den / policy->max_frame_rate.num;
+
+   /* Allow some jitter so that e.g. halving the frame rate keeps every other frame */
+   if (port_module->next_time != MMAL_TIME_UNKNOWN && time < port_module->next_time - interval / 4)
+      return MMAL_FALSE;
+
+   if (port_module->next_time == MMAL_TIME_UNKNOWN || time - port_module->next_time >= interval ||
+       time < port_module->next_time - interval)
+      port_module->next_time = time + interval; /* Start over after a gap or a discontinuity */
+   else
+      port_module->next_time += interval;
+   return MMAL_TRUE;
 }
 
 /** Send a buffer header to a port */
@@ -149,6 +225,7 @@ static MMAL_STATUS_T splitter_send_output(MMAL_BUFFER_HEADER_T *buffer, MMAL_POR
       goto error;
 
    /* Send buffer back */
+   out_port->priv->module->stats.buffer_count++;
    mmal_port_buffer_header_callback(out_port, out);
    return MMAL_SUCCESS;
 
@@ -157,35 +234,128 @@ static MMAL_STATUS_T splitter_send_output(MMAL_BUFFER_HEADER_T *buffer, MMAL_POR
    return status;
 }
 
-/** Send a buffer header to a port */
-static MMAL_STATUS_T splitter_port_send(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+/** Keep the frame for a keep-latest output which has no buffer, replacing
+ * the one it was keeping */
+static void splitter_keep_latest(MMAL_BUFFER_HEADER_T *in, MMAL_PORT_T *out_port)
+{
+   MMAL_PORT_MODULE_T *port_module = out_port->priv->module;
+   MMAL_BUFFER_HEADER_T *latest;
+
+   while ((latest = mmal_queue_get(port_module->latest)) != NULL)
+   {
+      port_module->stats.frames_discarded++;
+      mmal_buffer_header_release(latest);
+   }
+
+   /* The header holds a reference to the input buffer until it is sent */
+   latest = mmal_queue_get(port_module->latest_pool->queue);
+   if (!latest || mmal_buffer_header_replicate(latest, in) != MMAL_SUCCESS)
+   {
+      if (latest)
+         mmal_buffer_header_release(latest);
+      port_module->stats.frames_discarded++;
+      return;
+   }
+   mmal_queue_put(port_module->latest, latest);
+}
+
+/** Send the frame kept for a keep-latest output now that it has a buffer */
+static MMAL_STATUS_T splitter_send_latest(MMAL_PORT_T *out_port)
+{
+   MMAL_PORT_MODULE_T *port_module = out_port->priv->module;
+   MMAL_BUFFER_HEADER_T *latest = mmal_queue_get(port_module->latest);
+   MMAL_STATUS_T status;
+
+   if (!latest)
+      return MMAL_SUCCESS;
+
+   status = splitter_send_output(latest, out_port);
+   if (status == MMAL_EAGAIN)
+   {
+      mmal_queue_put_back(port_module->latest, latest);
+      return MMAL_SUCCESS;
+   }
+   mmal_buffer_header_release(latest);
+   return status;
+}
+
+/** Hand the current input buffer to the outputs which can take it.
+ * This runs in the action of the component so the state shared by the ports is
+ * only changed on one thread. Port calls touching that state from the client
+ * hold the action lock (the core already holds it around disable and flush).
+ * @return 1 if the input buffer was done with */
+static int splitter_do_processing(MMAL_COMPONENT_T *component)
 {
-   MMAL_COMPONENT_T *component = port->component;
    MMAL_COMPONENT_MODULE_T *module = component->priv->module;
-   MMAL_PORT_T *in_port, *out_port;
-   MMAL_BUFFER_HEADER_T *in;
+   MMAL_PORT_T *in_port = component->input[0], *out_port;
+   MMAL_BUFFER_HEADER_T *in = NULL;
    MMAL_STATUS_T status;
    unsigned int i;
 
-   mmal_queue_put(port->priv->module->queue, buffer);
-
    if (module->error)
-      return MMAL_SUCCESS; /* Just do nothing */
+      return 0; /* Just do nothing */
+
+   /* Buffers which came back to keep-latest outputs take the frame they missed */
+   for (i = 0; i < component->output_num; i++)
+   {
+      out_port = component->output[i];
+      if (!(module->enabled_flags & (1<<i)) ||
+          out_port->priv->module->policy.policy != MMAL_OUTPUT_POLICY_KEEP_LATEST)
+         continue;
+      status = splitter_send_latest(out_port);
+      if (status != MMAL_SUCCESS)
+         goto error;
+   }
 
    /* Get input buffer header */
-   in_port = component->input[0];
    in = mmal_queue_get(in_port->priv->module->queue);
    if (!in)
-      return MMAL_SUCCESS; /* Nothing to do */
+      return 0; /* Nothing to do */
+
+   /* Outputs which don't want this frame are done with it straight away */
+   if (!module->frame_started)
+   {
+      for (i = 0; i < component->output_num; i++)
+      {
+         out_port = component->output[i];
+         if (!(module->enabled_flags & (1<<i)))
+            continue;
+         out_port->priv->module->stats.frame_count++;
+         if (!splitter_output_wants(out_port, in))
+            module->sent_flags |= (1<<i);
+      }
+      module->frame_started = 1;
+   }
 
    for (i = 0; i < component->output_num; i++)
    {
       out_port = component->output[i];
+      if ((module->sent_flags & (1<<i)) || !(module->enabled_flags & (1<<i)))
+         continue;
+
       status = splitter_send_output(in, out_port);
 
       if (status != MMAL_SUCCESS && status != MMAL_EAGAIN)
          goto error;
 
+      if (status == MMAL_EAGAIN)
+      {
+         /* Only blocking outputs hold on to the input buffer */
+         switch (out_port->priv->module->policy.policy)
+         {
+         case MMAL_OUTPUT_POLICY_DROP:
+            out_port->priv->module->stats.frames_discarded++;
+            status = MMAL_SUCCESS;
+            break;
+         case MMAL_OUTPUT_POLICY_KEEP_LATEST:
+            splitter_keep_latest(in, out_port);
+            status = MMAL_SUCCESS;
+            break;
+         default:
+            break;
+         }
+      }
+
       if (status == MMAL_SUCCESS)
          module->sent_flags |= (1<<i);
    }
@@ -196,23 +366,38 @@ static MMAL_STATUS_T splitter_port_send(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T
       in->length = 0; /* Consume the input buffer */
       mmal_port_buffer_header_callback(in_port, in);
       module->sent_flags = 0;
-      return MMAL_SUCCESS;
+      module->frame_started = 0;
+      return 1;
    }
 
    /* We're not done yet so put the buffer back in the queue */
-   mmal_queue_put(in_port->priv->module->queue, in);
-   return MMAL_SUCCESS;
+   mmal_queue_put_back(in_port->priv->module->queue, in);
+   return 0;
 
  error:
-   mmal_queue_put(in_port->priv->module->queue, in);
+   if (in)
+      mmal_queue_put_back(in_port->priv->module->queue, in);
 
-   status = mmal_event_error_send(port->component, status);
+   status = mmal_event_error_send(component, status);
    if (status != MMAL_SUCCESS)
    {
       LOG_ERROR("unable to send an error event buffer (%i)", (int)status);
-      return MMAL_SUCCESS;
+      return 0;
    }
    module->error = 1;
+   return 0;
+}
+
+static void splitter_do_processing_loop(MMAL_COMPONENT_T *component)
+{
+   while (splitter_do_processing(component));
+}
+
+/** Send a buffer header to a port */
+static MMAL_STATUS_T splitter_port_send(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+   mmal_queue_put(port->priv->module->queue, buffer);
+   mmal_component_action_trigger(port->component);
    return MMAL_SUCCESS;
 }
 
@@ -272,6 +457,50 @@ static MMAL_STATUS_T splitter_port_parameter_set(MMAL_PORT_T *port, const MMAL_P
       }
       return MMAL_SUCCESS;
 
+   case MMAL_PARAMETER_OUTPUT_POLICY:
+      {
+         const MMAL_PARAMETER_OUTPUT_POLICY_T *policy = (const MMAL_PARAMETER_OUTPUT_POLICY_T *)param;
+         if (port->type != MMAL_PORT_TYPE_OUTPUT)
+            return MMAL_ENOSYS;
+         if (param->size < sizeof(*policy) || policy->policy > MMAL_OUTPUT_POLICY_KEEP_LATEST ||
+             policy->max_frame_rate.num < 0 || policy->max_frame_rate.den < 0)
+            return MMAL_EINVAL;
+         mmal_component_action_lock(component);
+         port->priv->module->policy = *policy;
+         port->priv->module->decimation_count = 0;
+         port->priv->module->next_time = MMAL_TIME_UNKNOWN;
+         mmal_component_action_unlock(component);
+      }
+      return MMAL_SUCCESS;
+
+   default:
+      return MMAL_ENOSYS;
+   }
+}
+
+static MMAL_STATUS_T splitter_port_parameter_get(MMAL_PORT_T *port, MMAL_PARAMETER_HEADER_T *param)
+{
+   MMAL_PORT_MODULE_T *port_module = port->priv->module;
+
+   switch (param->id)
+   {
+   case MMAL_PARAMETER_OUTPUT_POLICY:
+      if (param->size < sizeof(port_module->policy))
+         return MMAL_EINVAL;
+      mmal_component_action_lock(port->component);
+      *(MMAL_PARAMETER_OUTPUT_POLICY_T *)param = port_module->policy;
+      mmal_component_action_unlock(port->component);
+      return MMAL_SUCCESS;
+
+   case MMAL_PARAMETER_STATISTICS:
+      if (param->size < sizeof(port_module->stats))
+         return MMAL_EINVAL;
+      mmal_component_action_lock(port->component);
+      port_module->stats.hdr = *param;
+      *(MMAL_PARAMETER_STATISTICS_T *)param = port_module->stats;
+      mmal_component_action_unlock(port->component);
+      return MMAL_SUCCESS;
+
    default:
       return MMAL_ENOSYS;
    }
@@ -323,14 +552,28 @@ static MMAL_STATUS_T mmal_component_create_splitter(const char *name, MMAL_COMPO
       component->output[i]->priv->pf_send = splitter_port_send;
       component->output[i]->priv->pf_set_format = splitter_port_format_commit;
       component->output[i]->priv->pf_parameter_set = splitter_port_parameter_set;
+      component->output[i]->priv->pf_parameter_get = splitter_port_parameter_get;
       component->output[i]->buffer_num_min = 1;
       component->output[i]->buffer_num_recommended = 0;
       component->output[i]->capabilities = MMAL_PORT_CAPABILITY_PASSTHROUGH;
       component->output[i]->priv->module->queue = mmal_queue_create();
       if(!component->output[i]->priv->module->queue)
          goto error;
+
+      component->output[i]->priv->module->policy.hdr.id = MMAL_PARAMETER_OUTPUT_POLICY;
+      component->output[i]->priv->module->policy.hdr.size = sizeof(MMAL_PARAMETER_OUTPUT_POLICY_T);
+      component->output[i]->priv->module->policy.policy = MMAL_OUTPUT_POLICY_BLOCK;
+      component->output[i]->priv->module->next_time = MMAL_TIME_UNKNOWN;
+      component->output[i]->priv->module->latest = mmal_queue_create();
+      component->output[i]->priv->module->latest_pool = mmal_pool_create(SPLITTER_LATEST_HEADERS_NUM, 0);
+      if(!component->output[i]->priv->module->latest || !component->output[i]->priv->module->latest_pool)
+         goto error;
    }
 
+   status = mmal_component_action_register(component, splitter_do_processing_loop);
+   if (status != MMAL_SUCCESS)
+      goto error;
+
    return MMAL_SUCCESS;
 
  error:
@@ -27,7 +27,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "interface/vcos/vcos.h"
 #include "interface/mmal/mmal_logging.h"
-#include "interface/mmal/util/mmal_list.h"
 #include "interface/mmal/util/mmal_util_rational.h"
 #include "interface/mmal/core/mmal_clock_private.h"
 
@@ -49,7 +48,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define Q16_ONE  (1 << 16)
 
 /* Maximum number of pending requests */
-#define CLOCK_REQUEST_SLOTS  32
+#ifndef CLOCK_REQUEST_SLOTS
+#define CLOCK_REQUEST_SLOTS  128
+#endif
 
 /* Number of microseconds the clock tries to service requests early
  * to account for processing overhead */
@@ -92,7 +93,8 @@ typedef VCOS_TIMER_T MMAL_TIMER_T;
 
 typedef struct MMAL_CLOCK_REQUEST_T
 {
-   MMAL_LIST_ELEMENT_T link; /**< must be first */
+   uint32_t seq;             /**< order of arrival, to keep requests for the same
+                                  time in the order they were made */
    MMAL_CLOCK_VOID_FP priv;  /**< client-supplied function pointer */
    MMAL_CLOCK_REQUEST_CB cb; /**< client-supplied callback to invoke */
    void *cb_data;            /**< client-supplied callback data */
@@ -148,11 +150,15 @@ typedef struct MMAL_CLOCK_PRIVATE_T
    int64_t  update_threshold_upper;
                               /**< Time differences above this threshold reset media time */
 
-   /* Client requests */
+   /* Client requests. Pending requests are kept in a binary heap with the
+    * next one due at the root. */
    struct
    {
-      MMAL_LIST_T* list_free;
-      MMAL_LIST_T* list_pending;
+      MMAL_CLOCK_REQUEST_T *free[CLOCK_REQUEST_SLOTS];
+      unsigned int free_num;
+      MMAL_CLOCK_REQUEST_T *pending[CLOCK_REQUEST_SLOTS];
+      unsigned int pending_num;
+      uint32_t seq;
       MMAL_CLOCK_REQUEST_T pool[CLOCK_REQUEST_SLOTS];
    } request;
 
@@ -252,49 +258,90 @@ static int64_t mmal_clock_media_time_get_locked(MMAL_CLOCK_PRIVATE_T *private)
    return private->media_time;
 }
 
-/* Comparison function used for inserting a request into
- * the list of pending requests when clock scale is positive. */
-static int mmal_clock_request_compare_pos(MMAL_LIST_ELEMENT_T *lhs, MMAL_LIST_ELEMENT_T *rhs)
+/* Whether a request is due before another one, given the direction of the clock */
+static inline MMAL_BOOL_T mmal_clock_request_before(MMAL_CLOCK_PRIVATE_T *private,
+      const MMAL_CLOCK_REQUEST_T *lhs, const MMAL_CLOCK_REQUEST_T *rhs)
 {
-   return ((MMAL_CLOCK_REQUEST_T*)lhs)->media_time_adj < ((MMAL_CLOCK_REQUEST_T*)rhs)->media_time_adj;
+   if (lhs->media_time_adj != rhs->media_time_adj)
+      return (private->scale >= 0) ? lhs->media_time_adj < rhs->media_time_adj :
+                                     lhs->media_time_adj > rhs->media_time_adj;
+   return (int32_t)(lhs->seq - rhs->seq) < 0;
 }
 
-/* Comparison function used for inserting a request into
- * the list of pending requests when clock scale is negative. */
-static int mmal_clock_request_compare_neg(MMAL_LIST_ELEMENT_T *lhs, MMAL_LIST_ELEMENT_T *rhs)
+/* Move a pending request up the heap until its parent is due before it */
+static void mmal_clock_request_sift_up(MMAL_CLOCK_PRIVATE_T *private, unsigned int i)
 {
-   return ((MMAL_CLOCK_REQUEST_T*)lhs)->media_time_adj > ((MMAL_CLOCK_REQUEST_T*)rhs)->media_time_adj;
+   MMAL_CLOCK_REQUEST_T **heap = private->request.pending;
+   MMAL_CLOCK_REQUEST_T *request = heap[i];
+
+   while (i > 0 && mmal_clock_request_before(private, request, heap[(i - 1) / 2]))
+   {
+      heap[i] = heap[(i - 1) / 2];
+      i = (i - 1) / 2;
+   }
+   heap[i] = request;
 }
 
-/* Insert a new request into the list of pending requests */
-static MMAL_BOOL_T mmal_clock_request_insert(MMAL_CLOCK_PRIVATE_T *private, MMAL_CLOCK_REQUEST_T *request)
+/* Move a pending request down the heap until it is due before its children */
+static void mmal_clock_request_sift_down(MMAL_CLOCK_PRIVATE_T *private, unsigned int i)
 {
-   MMAL_LIST_T *list = private->request.list_pending;
-   MMAL_CLOCK_REQUEST_T *pending;
+   MMAL_CLOCK_REQUEST_T **heap = private->request.pending;
+   MMAL_CLOCK_REQUEST_T *request = heap[i];
+   unsigned int num = private->request.pending_num, child;
 
-   if (private->stop_thread)
-      return MMAL_FALSE; /* the clock is being destroyed */
-
-   if (list->length == 0)
+   while ((child = 2 * i + 1) < num)
    {
-      mmal_list_push_front(list, &request->link);
-      return MMAL_TRUE;
+      if (child + 1 < num && mmal_clock_request_before(private, heap[child + 1], heap[child]))
+         child++;
+      if (!mmal_clock_request_before(private, heap[child], request))
+         break;
+      heap[i] = heap[child];
+      i = child;
    }
+   heap[i] = request;
+}
 
-   /* It is more likely for requests to be received in sequence,
-    * so try adding to the back of the list first before doing
-    * a more expensive list insert. */
-   pending = (MMAL_CLOCK_REQUEST_T*)list->last;
-   if ((private->scale >= 0 && (request->media_time_adj >= pending->media_time_adj)) ||
-       (private->scale <  0 && (request->media_time_adj <= pending->media_time_adj)))
-   {
-      mmal_list_push_back(list, &request->link);
-   }
-   else
+/* Get the next pending request due, without removing it */
+static inline MMAL_CLOCK_REQUEST_T *mmal_clock_request_peek(MMAL_CLOCK_PRIVATE_T *private)
+{
+   return private->request.pending_num ? private->request.pending[0] : NULL;
+}
+
+/* Remove the next pending request due */
+static MMAL_CLOCK_REQUEST_T *mmal_clock_request_pop(MMAL_CLOCK_PRIVATE_T *private)
+{
+   MMAL_CLOCK_REQUEST_T *request;
+
+   if (!private->request.pending_num)
+      return NULL;
+
+   request = private->request.pending[0];
+   if (--private->request.pending_num)
    {
-      mmal_list_insert(list, &request->link,
-            (private->scale >= 0) ? mmal_clock_request_compare_pos : mmal_clock_request_compare_neg);
+      private->request.pending[0] = private->request.pending[private->request.pending_num];
+      mmal_clock_request_sift_down(private, 0);
    }
+   return request;
+}
+
+/* Rebuild the heap, needed when the direction of the clock changes */
+static void mmal_clock_request_reorder(MMAL_CLOCK_PRIVATE_T *private)
+{
+   unsigned int i = private->request.pending_num / 2;
+
+   while (i--)
+      mmal_clock_request_sift_down(private, i);
+}
+
+/* Insert a new request into the heap of pending requests */
+static MMAL_BOOL_T mmal_clock_request_insert(MMAL_CLOCK_PRIVATE_T *private, MMAL_CLOCK_REQUEST_T *request)
+{
+   if (private->stop_thread)
+      return MMAL_FALSE; /* the clock is being destroyed */
+
+   request->seq = private->request.seq++;
+   private->request.pending[private->request.pending_num] = request;
+   mmal_clock_request_sift_up(private, private->request.pending_num++);
    return MMAL_TRUE;
 }
 
@@ -302,16 +349,14 @@ static MMAL_BOOL_T mmal_clock_request_insert(MMAL_CLOCK_PRIVATE_T *private, MMAL
 static MMAL_STATUS_T mmal_clock_request_flush_locked(MMAL_CLOCK_PRIVATE_T *private,
                                                      int64_t media_time)
 {
-   MMAL_LIST_T *pending = private->request.list_pending;
-   MMAL_LIST_T *list_free = private->request.list_free;
    MMAL_CLOCK_REQUEST_T *request;
 
-   while ((request = (MMAL_CLOCK_REQUEST_T *)mmal_list_pop_front(pending)) != NULL)
+   while ((request = mmal_clock_request_pop(private)) != NULL)
    {
       /* Inform the client */
       request->cb(&private->clock, media_time, request->cb_data, request->priv);
       /* Recycle request slot */
-      mmal_list_push_back(list_free, &request->link);
+      private->request.free[private->request.free_num++] = request;
    }
 
    private->media_time_at_timer = 0;
@@ -323,11 +368,9 @@ static MMAL_STATUS_T mmal_clock_request_flush_locked(MMAL_CLOCK_PRIVATE_T *priva
 static void mmal_clock_process_requests(MMAL_CLOCK_PRIVATE_T *private)
 {
    int64_t media_time_now;
-   MMAL_LIST_T* free = private->request.list_free;
-   MMAL_LIST_T* pending = private->request.list_pending;
    MMAL_CLOCK_REQUEST_T *next;
 
-   if (pending->length == 0 || !private->is_active)
+   if (private->request.pending_num == 0 || !private->is_active)
       return;
 
    LOCK(private);
@@ -341,7 +384,7 @@ static void mmal_clock_process_requests(MMAL_CLOCK_PRIVATE_T *private)
           media_time_now + private->discont_threshold < private->media_time_at_timer)
       {
          LOG_INFO("discontinuity: was=%" PRIi64 " now=%" PRIi64 " pending=%d",
-                  private->media_time_at_timer, media_time_now, pending->length);
+                  private->media_time_at_timer, media_time_now, private->request.pending_num);
 
          /* It's likely that packets from before the discontinuity will continue to arrive for
           * a short time. Ensure these are detected and the requests fired immediately. */
@@ -354,8 +397,8 @@ static void mmal_clock_process_requests(MMAL_CLOCK_PRIVATE_T *private)
       }
    }
 
-   /* Earliest request is always at the front */
-   next = (MMAL_CLOCK_REQUEST_T*)mmal_list_pop_front(pending);
+   /* Earliest request is always at the root of the heap */
+   next = mmal_clock_request_peek(private);
    while (next)
    {
       media_time_now = mmal_clock_media_time_get_locked(private);
@@ -372,12 +415,13 @@ static void mmal_clock_process_requests(MMAL_CLOCK_PRIVATE_T *private)
           (private->scale < 0 && ((media_time_now - MIN_TIMER_DELAY) <= next->media_time_adj)))
       {
          LOG_TRACE("servicing request: next %"PRIi64" now %"PRIi64, next->media_time_adj, media_time_now);
+         mmal_clock_request_pop(private);
          /* Inform the client */
          next->cb(&private->clock, media_time_now, next->cb_data, next->priv);
          /* Recycle the request slot */
-         mmal_list_push_back(free, &next->link);
+         private->request.free[private->request.free_num++] = next;
          /* Move onto next pending request */
-         next = (MMAL_CLOCK_REQUEST_T*)mmal_list_pop_front(pending);
+         next = mmal_clock_request_peek(private);
       }
       else
       {
@@ -389,8 +433,7 @@ static void mmal_clock_process_requests(MMAL_CLOCK_PRIVATE_T *private)
          if (private->scale == 0)
             wall_time_delay = CLOCK_WAIT_TIME; /* Clock is paused */
 
-         /* Put next request back into pending list */
-         mmal_list_push_front(pending, &next->link);
+         /* Leave the next request pending */
          next = NULL;
 
          /* Set the timer */
@@ -461,17 +504,11 @@ static MMAL_STATUS_T mmal_clock_create_scheduling(MMAL_CLOCK_PRIVATE_T *private)
       goto error;
    }
 
-   private->request.list_free = mmal_list_create();
-   private->request.list_pending = mmal_list_create();
-   if (!private->request.list_free || !private->request.list_pending)
-   {
-      LOG_ERROR("failed to create list %p %p", private->request.list_free, private->request.list_pending);
-      goto error;
-   }
-
    /* Populate the list of available request slots */
    for (i = 0; i < CLOCK_REQUEST_SLOTS; ++i)
-      mmal_list_push_back(private->request.list_free, &private->request.pool[i].link);
+      private->request.free[i] = &private->request.pool[i];
+   private->request.free_num = CLOCK_REQUEST_SLOTS;
+   private->request.pending_num = 0;
 
    if (vcos_thread_create(&private->thread, "mmal-clock thread", NULL,
                           mmal_clock_worker_thread, private) != VCOS_SUCCESS)
@@ -489,8 +526,6 @@ static MMAL_STATUS_T mmal_clock_create_scheduling(MMAL_CLOCK_PRIVATE_T *private)
 error:
    if (event_status == VCOS_SUCCESS) vcos_semaphore_delete(&private->event);
    if (timer_status) mmal_clock_timer_destroy(&private->timer);
-   if (private->request.list_free) mmal_list_destroy(private->request.list_free);
-   if (private->request.list_pending) mmal_list_destroy(private->request.list_pending);
    return MMAL_ENOSPC;
 }
 
@@ -501,9 +536,6 @@ static void mmal_clock_destroy_scheduling(MMAL_CLOCK_PRIVATE_T *private)
 
    mmal_clock_request_flush(&private->clock);
 
-   mmal_list_destroy(private->request.list_free);
-   mmal_list_destroy(private->request.list_pending);
-
    vcos_semaphore_delete(&private->event);
 
    mmal_clock_timer_destroy(&private->timer);
@@ -629,7 +661,7 @@ MMAL_STATUS_T mmal_clock_request_add(MMAL_CLOCK_T *clock, int64_t media_time,
       }
    }
 
-   request = (MMAL_CLOCK_REQUEST_T*)mmal_list_pop_front(private->request.list_free);
+   request = private->request.free_num ? private->request.free[--private->request.free_num] : NULL;
    if (request == NULL)
    {
       LOG_ERROR("no more free clock request slots");
@@ -645,6 +677,8 @@ MMAL_STATUS_T mmal_clock_request_add(MMAL_CLOCK_T *clock, int64_t media_time,
 
    if (mmal_clock_request_insert(private, request))
       wake_thread = private->is_active;
+   else
+      private->request.free[private->request.free_num++] = request;
 
    UNLOCK(private);
 
@@ -747,6 +781,12 @@ MMAL_STATUS_T mmal_clock_scale_set(MMAL_CLOCK_T *clock, MMAL_RATIONAL_T scale)
    mmal_clock_update_local_time_locked(private);
 
    private->scale_rational = scale;
+   if ((mmal_rational_to_fixed_16_16(scale) < 0) != (private->scale < 0))
+   {
+      /* Pending requests are now due in the opposite order */
+      private->scale = mmal_rational_to_fixed_16_16(scale);
+      mmal_clock_request_reorder(private);
+   }
    private->scale = mmal_rational_to_fixed_16_16(scale);
 
    if (private->scale)
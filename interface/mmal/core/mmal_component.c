@@ -29,7 +29,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "core/mmal_component_private.h"
 #include "core/mmal_port_private.h"
 #include "core/mmal_core_private.h"
+#include "core/mmal_executor_private.h"
 #include "mmal_logging.h"
+#include "mmal_trace.h"
 
 /* Minimum number of buffers that will be available on the control port */
 #define MMAL_CONTROL_PORT_BUFFERS_MIN 4
@@ -47,6 +49,9 @@ typedef struct
    VCOS_EVENT_T action_event;
    VCOS_MUTEX_T action_mutex;
    MMAL_BOOL_T action_quit;
+   /** Action run by the shared executor instead of the action thread */
+   MMAL_BOOL_T action_executor;
+   MMAL_EXECUTOR_TASK_T action_task;
 
    VCOS_MUTEX_T lock; /**< Used to lock access to the component */
    MMAL_BOOL_T destruction_pending;
@@ -542,6 +547,24 @@ MMAL_STATUS_T mmal_port_release(MMAL_PORT_T *port)
  * Actions support
  *****************************************************************************/
 
+/** Runs the action once, with the action lock held */
+static void mmal_component_action_run(MMAL_COMPONENT_T *component)
+{
+   MMAL_COMPONENT_CORE_PRIVATE_T *private = (MMAL_COMPONENT_CORE_PRIVATE_T *)component->priv;
+
+   vcos_mutex_lock(&private->action_mutex);
+   MMAL_TRACE_COMPONENT(MMAL_TRACE_EVENT_ACTION_BEGIN, component);
+   private->pf_action(component);
+   MMAL_TRACE_COMPONENT(MMAL_TRACE_EVENT_ACTION_END, component);
+   vcos_mutex_unlock(&private->action_mutex);
+}
+
+/** Runs the action as an executor task */
+static void mmal_component_action_task_func(void *arg)
+{
+   mmal_component_action_run((MMAL_COMPONENT_T *)arg);
+}
+
 /** Registers an action with the core */
 static void *mmal_component_action_thread_func(void *arg)
 {
@@ -560,9 +583,7 @@ static void *mmal_component_action_thread_func(void *arg)
       if (!vcos_verify(status == VCOS_SUCCESS))
          break;
 
-      vcos_mutex_lock(&private->action_mutex);
-      private->pf_action(component);
-      vcos_mutex_unlock(&private->action_mutex);
+      mmal_component_action_run(component);
    }
    return 0;
 }
@@ -578,14 +599,24 @@ MMAL_STATUS_T mmal_component_action_register(MMAL_COMPONENT_T *component,
    if (private->pf_action)
       return MMAL_EINVAL;
 
-   status = vcos_event_create(&private->action_event, component->name);
+   status = vcos_mutex_create(&private->action_mutex, component->name);
    if (status != VCOS_SUCCESS)
       return MMAL_ENOMEM;
 
-   status = vcos_mutex_create(&private->action_mutex, component->name);
+   /* Run the action on the shared executor if it is enabled */
+   if (mmal_executor_is_enabled() &&
+       mmal_executor_task_attach(&private->action_task, private->private.priority,
+                                 mmal_component_action_task_func, component) == MMAL_SUCCESS)
+   {
+      private->action_executor = MMAL_TRUE;
+      private->pf_action = pf_action;
+      return MMAL_SUCCESS;
+   }
+
+   status = vcos_event_create(&private->action_event, component->name);
    if (status != VCOS_SUCCESS)
    {
-      vcos_event_delete(&private->action_event);
+      vcos_mutex_delete(&private->action_mutex);
       return MMAL_ENOMEM;
    }
 
@@ -613,6 +644,15 @@ MMAL_STATUS_T mmal_component_action_deregister(MMAL_COMPONENT_T *component)
    if (!private->pf_action)
       return MMAL_EINVAL;
 
+   if (private->action_executor)
+   {
+      mmal_executor_task_detach(&private->action_task);
+      vcos_mutex_delete(&private->action_mutex);
+      private->action_executor = MMAL_FALSE;
+      private->pf_action = NULL;
+      return MMAL_SUCCESS;
+   }
+
    private->action_quit = 1;
    vcos_event_signal(&private->action_event);
    vcos_thread_join(&private->action_thread, NULL);
@@ -631,7 +671,10 @@ MMAL_STATUS_T mmal_component_action_trigger(MMAL_COMPONENT_T *component)
    if (!private->pf_action)
       return MMAL_EINVAL;
 
-   vcos_event_signal(&private->action_event);
+   if (private->action_executor)
+      mmal_executor_task_post(&private->action_task);
+   else
+      vcos_event_signal(&private->action_event);
    return MMAL_SUCCESS;
 }
 
@@ -682,6 +725,7 @@ static void mmal_core_init(void)
 
    mmal_logging_init();
    vcos_mutex_unlock(&mmal_core_lock);
+   mmal_executor_init_from_env();
 }
 
 static void mmal_core_deinit(void)
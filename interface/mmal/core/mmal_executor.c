@@ -0,0 +1,626 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if defined(__unix__)
+#include <unistd.h>
+#endif
+
+#include "mmal.h"
+#include "core/mmal_executor_private.h"
+#include "mmal_logging.h"
+
+/* Upper limit on the number of worker threads */
+#define MMAL_EXECUTOR_THREADS_MAX 32
+/* Number of threads used when the number of cores can't be found */
+#define MMAL_EXECUTOR_THREADS_DEFAULT 2
+
+#if defined(__GNUC__) && !defined(MMAL_EXECUTOR_NO_ATOMICS)
+#define MMAL_EXECUTOR_HAVE_ATOMICS 1
+#endif
+
+/** Priority bands. Workers take tasks from all the deques of a band before
+ * looking at the next one. */
+enum {
+   MMAL_EXECUTOR_BAND_HIGH,
+   MMAL_EXECUTOR_BAND_NORMAL,
+   MMAL_EXECUTOR_BAND_LOW,
+   MMAL_EXECUTOR_BANDS
+};
+
+/** Scheduling state of a task.
+ * A task is pushed on a deque only on the IDLE to QUEUED transition, so it is
+ * on at most one deque at a time and is never run by two workers at once. */
+enum {
+   MMAL_EXECUTOR_TASK_IDLE,      /**< Attached and waiting to be posted */
+   MMAL_EXECUTOR_TASK_QUEUED,    /**< On a deque */
+   MMAL_EXECUTOR_TASK_RUNNING,   /**< Being run by a worker */
+   MMAL_EXECUTOR_TASK_RERUN,     /**< Posted again while running */
+   MMAL_EXECUTOR_TASK_DETACHING, /**< Queued or running, detached once done */
+   MMAL_EXECUTOR_TASK_DETACHED,  /**< Not attached to the executor */
+};
+
+/** Worker thread and its deques. The owner takes tasks from the front of its
+ * deques, other workers steal them from the back. */
+typedef struct MMAL_EXECUTOR_WORKER_T
+{
+   VCOS_MUTEX_T lock;           /**< Protects the deques */
+   MMAL_EXECUTOR_TASK_T *head[MMAL_EXECUTOR_BANDS];
+   MMAL_EXECUTOR_TASK_T *tail[MMAL_EXECUTOR_BANDS];
+   uint32_t length[MMAL_EXECUTOR_BANDS]; /**< Read without the lock to skip empty deques */
+   VCOS_THREAD_T thread;
+   unsigned int index;
+
+   uint64_t runs;               /**< Statistics, only updated by the worker itself */
+   uint64_t steals;
+   uint64_t wakeups;
+} MMAL_EXECUTOR_WORKER_T;
+
+typedef struct MMAL_EXECUTOR_T
+{
+   VCOS_MUTEX_T lock;           /**< Serialises enabling, disabling and attaching */
+#ifndef MMAL_EXECUTOR_HAVE_ATOMICS
+   VCOS_MUTEX_T atomic_lock;    /**< Replaces atomic operations when not available */
+#endif
+   VCOS_TLS_KEY_T worker_key;   /**< Worker of the current thread, NULL for other threads */
+   MMAL_BOOL_T enabled;
+   uint32_t quit;               /**< Tells the workers to exit */
+
+   MMAL_EXECUTOR_WORKER_T *workers;
+   unsigned int threads;
+   unsigned int tasks;          /**< Number of attached tasks */
+
+   VCOS_SEMAPHORE_T sema;       /**< Posted to wake up sleeping workers */
+   uint32_t sleepers;           /**< Workers about to sleep which haven't been posted yet */
+   uint32_t next_worker;        /**< Round-robin for tasks posted from other threads */
+} MMAL_EXECUTOR_T;
+
+static MMAL_EXECUTOR_T executor;
+static VCOS_ONCE_T executor_once = VCOS_ONCE_INIT;
+static MMAL_BOOL_T executor_ready;
+
+/*****************************************************************************/
+
+#ifdef MMAL_EXECUTOR_HAVE_ATOMICS
+static inline uint32_t executor_load(uint32_t *p)
+{
+   return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+static inline void executor_store(uint32_t *p, uint32_t value)
+{
+   __atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+}
+
+static inline MMAL_BOOL_T executor_cas(uint32_t *p, uint32_t expected, uint32_t value)
+{
+   return __atomic_compare_exchange_n(p, &expected, value, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline uint32_t executor_add(uint32_t *p, int32_t value)
+{
+   return __atomic_add_fetch(p, value, __ATOMIC_SEQ_CST);
+}
+#else
+static inline uint32_t executor_load(uint32_t *p)
+{
+   uint32_t value;
+   vcos_mutex_lock(&executor.atomic_lock);
+   value = *p;
+   vcos_mutex_unlock(&executor.atomic_lock);
+   return value;
+}
+
+static inline void executor_store(uint32_t *p, uint32_t value)
+{
+   vcos_mutex_lock(&executor.atomic_lock);
+   *p = value;
+   vcos_mutex_unlock(&executor.atomic_lock);
+}
+
+static inline MMAL_BOOL_T executor_cas(uint32_t *p, uint32_t expected, uint32_t value)
+{
+   MMAL_BOOL_T swapped;
+   vcos_mutex_lock(&executor.atomic_lock);
+   swapped = *p == expected;
+   if (swapped)
+      *p = value;
+   vcos_mutex_unlock(&executor.atomic_lock);
+   return swapped;
+}
+
+static inline uint32_t executor_add(uint32_t *p, int32_t value)
+{
+   uint32_t result;
+   vcos_mutex_lock(&executor.atomic_lock);
+   result = *p += value;
+   vcos_mutex_unlock(&executor.atomic_lock);
+   return result;
+}
+#endif
+
+/** Decrement a counter unless it is already 0 */
+static MMAL_BOOL_T executor_dec_if_positive(uint32_t *p)
+{
+   uint32_t value = executor_load(p);
+   while (value)
+   {
+      if (executor_cas(p, value, value - 1))
+         return MMAL_TRUE;
+      value = executor_load(p);
+   }
+   return MMAL_FALSE;
+}
+
+/*****************************************************************************/
+
+static void executor_init_once(void)
+{
+   if (vcos_mutex_create(&executor.lock, "mmal executor") != VCOS_SUCCESS)
+      return;
+#ifndef MMAL_EXECUTOR_HAVE_ATOMICS
+   if (vcos_mutex_create(&executor.atomic_lock, "mmal executor atomic") != VCOS_SUCCESS)
+   {
+      vcos_mutex_delete(&executor.lock);
+      return;
+   }
+#endif
+   if (vcos_tls_create(&executor.worker_key) != VCOS_SUCCESS)
+   {
+#ifndef MMAL_EXECUTOR_HAVE_ATOMICS
+      vcos_mutex_delete(&executor.atomic_lock);
+#endif
+      vcos_mutex_delete(&executor.lock);
+      return;
+   }
+   executor_ready = MMAL_TRUE;
+}
+
+static unsigned int executor_default_threads(void)
+{
+#if defined(_SC_NPROCESSORS_ONLN)
+   long cores = sysconf(_SC_NPROCESSORS_ONLN);
+   if (cores > 0)
+      return (unsigned int)cores;
+#endif
+   return MMAL_EXECUTOR_THREADS_DEFAULT;
+}
+
+/** Map a VCOS thread priority to a priority band */
+static unsigned int executor_band(int priority)
+{
+   int delta = (priority - VCOS_THREAD_PRI_NORMAL) * VCOS_THREAD_PRI_INCREASE;
+   if (delta > 0)
+      return MMAL_EXECUTOR_BAND_HIGH;
+   if (delta < 0)
+      return MMAL_EXECUTOR_BAND_LOW;
+   return MMAL_EXECUTOR_BAND_NORMAL;
+}
+
+/*****************************************************************************/
+
+/** Queue a task at the back of a deque of a worker.
+ * @return the number of tasks now queued on the worker */
+static unsigned int executor_push(MMAL_EXECUTOR_WORKER_T *worker, MMAL_EXECUTOR_TASK_T *task)
+{
+   unsigned int band = task->band, length = 0, i;
+
+   vcos_mutex_lock(&worker->lock);
+   task->next = NULL;
+   task->prev = worker->tail[band];
+   if (worker->tail[band])
+      worker->tail[band]->next = task;
+   else
+      worker->head[band] = task;
+   worker->tail[band] = task;
+   executor_add(&worker->length[band], 1);
+   for (i = 0; i < MMAL_EXECUTOR_BANDS; i++)
+      length += worker->length[i];
+   vcos_mutex_unlock(&worker->lock);
+   return length;
+}
+
+static MMAL_EXECUTOR_TASK_T *executor_take(MMAL_EXECUTOR_WORKER_T *worker, unsigned int band,
+   MMAL_BOOL_T steal)
+{
+   MMAL_EXECUTOR_TASK_T *task;
+
+   if (!executor_load(&worker->length[band]))
+      return NULL;
+
+   vcos_mutex_lock(&worker->lock);
+   task = steal ? worker->tail[band] : worker->head[band];
+   if (task)
+   {
+      if (task->prev)
+         task->prev->next = task->next;
+      else
+         worker->head[band] = task->next;
+      if (task->next)
+         task->next->prev = task->prev;
+      else
+         worker->tail[band] = task->prev;
+      task->next = task->prev = NULL;
+      executor_add(&worker->length[band], -1);
+   }
+   vcos_mutex_unlock(&worker->lock);
+   return task;
+}
+
+/** Find the next task for a worker, highest band first, stealing from the
+ * other workers when its own deque of a band is empty */
+static MMAL_EXECUTOR_TASK_T *executor_next(MMAL_EXECUTOR_WORKER_T *worker)
+{
+   MMAL_EXECUTOR_TASK_T *task;
+   unsigned int band, i;
+
+   for (band = 0; band < MMAL_EXECUTOR_BANDS; band++)
+   {
+      task = executor_take(worker, band, MMAL_FALSE);
+      if (task)
+         return task;
+
+      for (i = 1; i < executor.threads; i++)
+      {
+         task = executor_take(&executor.workers[(worker->index + i) % executor.threads], band, MMAL_TRUE);
+         if (task)
+         {
+            worker->steals++;
+            return task;
+         }
+      }
+   }
+   return NULL;
+}
+
+static void executor_wake(void)
+{
+   if (executor_dec_if_positive(&executor.sleepers))
+      vcos_semaphore_post(&executor.sema);
+}
+
+static void executor_run(MMAL_EXECUTOR_WORKER_T *worker, MMAL_EXECUTOR_TASK_T *task)
+{
+   /* A task being detached while queued still runs this once */
+   executor_cas(&task->state, MMAL_EXECUTOR_TASK_QUEUED, MMAL_EXECUTOR_TASK_RUNNING);
+   task->pf_run(task->userdata);
+   worker->runs++;
+
+   if (executor_cas(&task->state, MMAL_EXECUTOR_TASK_RUNNING, MMAL_EXECUTOR_TASK_IDLE))
+      return;
+
+   /* Posted again while running. Queue it behind the tasks already waiting
+    * rather than running it straight away, so one busy task can't starve the
+    * others on this worker. */
+   if (executor_cas(&task->state, MMAL_EXECUTOR_TASK_RERUN, MMAL_EXECUTOR_TASK_QUEUED))
+   {
+      executor_push(worker, task);
+      return;
+   }
+
+   /* Being detached. The task may be freed as soon as the detaching thread
+    * is woken up, so this is the last time it is touched. */
+   vcos_semaphore_post(&task->detached);
+}
+
+static void *executor_worker_func(void *arg)
+{
+   MMAL_EXECUTOR_WORKER_T *worker = (MMAL_EXECUTOR_WORKER_T *)arg;
+   MMAL_EXECUTOR_TASK_T *task;
+
+   vcos_tls_set(executor.worker_key, worker);
+
+   while (1)
+   {
+      task = executor_next(worker);
+      if (task)
+      {
+         executor_run(worker, task);
+         continue;
+      }
+
+      /* Announce we're going to sleep then look again, so that a task posted
+       * in between either is found here or wakes us up */
+      executor_add(&executor.sleepers, 1);
+      task = executor_next(worker);
+      if (task || executor_load(&executor.quit))
+      {
+         /* Someone may already have posted on our behalf */
+         if (!executor_dec_if_positive(&executor.sleepers))
+            vcos_semaphore_wait(&executor.sema);
+         if (task)
+            executor_run(worker, task);
+         else
+            break;
+         continue;
+      }
+
+      vcos_semaphore_wait(&executor.sema);
+      worker->wakeups++;
+      if (executor_load(&executor.quit))
+         break;
+   }
+
+   vcos_tls_set(executor.worker_key, NULL);
+   return NULL;
+}
+
+static void executor_stop(unsigned int started)
+{
+   unsigned int i;
+
+   executor_store(&executor.quit, 1);
+   for (i = 0; i < started; i++)
+      vcos_semaphore_post(&executor.sema);
+   for (i = 0; i < started; i++)
+   {
+      vcos_thread_join(&executor.workers[i].thread, NULL);
+      vcos_mutex_delete(&executor.workers[i].lock);
+   }
+
+   vcos_semaphore_delete(&executor.sema);
+   vcos_free(executor.workers);
+   executor.workers = NULL;
+   executor.threads = 0;
+   executor.sleepers = 0;
+   executor.quit = 0;
+}
+
+/*****************************************************************************/
+
+MMAL_STATUS_T mmal_executor_enable(unsigned int threads)
+{
+   MMAL_EXECUTOR_WORKER_T *worker;
+   VCOS_THREAD_ATTR_T attrs;
+   MMAL_STATUS_T status = MMAL_ENOMEM;
+   char name[16];
+   unsigned int i;
+
+   vcos_init();
+   vcos_once(&executor_once, executor_init_once);
+   if (!executor_ready)
+      return MMAL_ENOMEM;
+
+   if (!threads)
+      threads = executor_default_threads();
+   threads = MMAL_MIN(threads, MMAL_EXECUTOR_THREADS_MAX);
+
+   vcos_mutex_lock(&executor.lock);
+   if (executor.enabled)
+   {
+      status = MMAL_EINVAL;
+      goto end;
+   }
+
+   executor.workers = vcos_calloc(threads, sizeof(*executor.workers), "mmal executor workers");
+   if (!executor.workers)
+      goto end;
+   if (vcos_semaphore_create(&executor.sema, "mmal executor", 0) != VCOS_SUCCESS)
+   {
+      vcos_free(executor.workers);
+      executor.workers = NULL;
+      goto end;
+   }
+   executor.threads = threads;
+
+   vcos_thread_attr_init(&attrs);
+   for (i = 0; i < threads; i++)
+   {
+      worker = &executor.workers[i];
+      worker->index = i;
+      if (vcos_mutex_create(&worker->lock, "mmal executor worker") != VCOS_SUCCESS)
+         break;
+      snprintf(name, sizeof(name), "mmal exec %u", i);
+      if (vcos_thread_create(&worker->thread, name, &attrs, executor_worker_func, worker) != VCOS_SUCCESS)
+      {
+         vcos_mutex_delete(&worker->lock);
+         break;
+      }
+   }
+   if (i < threads)
+   {
+      executor_stop(i);
+      goto end;
+   }
+
+   LOG_INFO("executor enabled with %u threads", threads);
+   executor.enabled = MMAL_TRUE;
+   status = MMAL_SUCCESS;
+
+ end:
+   vcos_mutex_unlock(&executor.lock);
+   return status;
+}
+
+MMAL_STATUS_T mmal_executor_disable(void)
+{
+   MMAL_STATUS_T status = MMAL_EINVAL;
+
+   vcos_once(&executor_once, executor_init_once);
+   if (!executor_ready)
+      return MMAL_EINVAL;
+
+   vcos_mutex_lock(&executor.lock);
+   if (executor.enabled && !executor.tasks)
+   {
+      executor_stop(executor.threads);
+      executor.enabled = MMAL_FALSE;
+      status = MMAL_SUCCESS;
+   }
+   vcos_mutex_unlock(&executor.lock);
+   return status;
+}
+
+MMAL_STATUS_T mmal_executor_get_stats(MMAL_EXECUTOR_STATS_T *stats)
+{
+   MMAL_STATUS_T status = MMAL_EINVAL;
+   unsigned int i;
+
+   vcos_once(&executor_once, executor_init_once);
+   if (!executor_ready || !stats)
+      return MMAL_EINVAL;
+
+   memset(stats, 0, sizeof(*stats));
+   vcos_mutex_lock(&executor.lock);
+   if (executor.enabled)
+   {
+      stats->threads = executor.threads;
+      stats->tasks = executor.tasks;
+      /* The counters are updated by the workers without a lock, so this is
+       * only a snapshot */
+      for (i = 0; i < executor.threads; i++)
+      {
+         stats->runs += executor.workers[i].runs;
+         stats->steals += executor.workers[i].steals;
+         stats->wakeups += executor.workers[i].wakeups;
+      }
+      status = MMAL_SUCCESS;
+   }
+   vcos_mutex_unlock(&executor.lock);
+   return status;
+}
+
+/*****************************************************************************/
+
+MMAL_BOOL_T mmal_executor_is_enabled(void)
+{
+   return executor_ready && executor.enabled;
+}
+
+MMAL_STATUS_T mmal_executor_task_attach(MMAL_EXECUTOR_TASK_T *task, int priority,
+   void (*pf_run)(void *userdata), void *userdata)
+{
+   MMAL_STATUS_T status = MMAL_EINVAL;
+
+   if (!executor_ready)
+      return MMAL_EINVAL;
+
+   memset(task, 0, sizeof(*task));
+   if (vcos_semaphore_create(&task->detached, "mmal executor task", 0) != VCOS_SUCCESS)
+      return MMAL_ENOMEM;
+
+   vcos_mutex_lock(&executor.lock);
+   if (executor.enabled)
+   {
+      task->pf_run = pf_run;
+      task->userdata = userdata;
+      task->band = executor_band(priority);
+      executor_store(&task->state, MMAL_EXECUTOR_TASK_IDLE);
+      executor.tasks++;
+      status = MMAL_SUCCESS;
+   }
+   vcos_mutex_unlock(&executor.lock);
+
+   if (status != MMAL_SUCCESS)
+      vcos_semaphore_delete(&task->detached);
+   return status;
+}
+
+void mmal_executor_task_detach(MMAL_EXECUTOR_TASK_T *task)
+{
+   MMAL_BOOL_T wait = MMAL_FALSE;
+   uint32_t state;
+
+   /* From here on posting the task does nothing. If it is queued or running,
+    * the worker running it signals once it is done with it. */
+   vcos_mutex_lock(&executor.lock);
+   while (1)
+   {
+      state = executor_load(&task->state);
+      if (state == MMAL_EXECUTOR_TASK_IDLE)
+      {
+         if (executor_cas(&task->state, state, MMAL_EXECUTOR_TASK_DETACHED))
+            break;
+      }
+      else if (executor_cas(&task->state, state, MMAL_EXECUTOR_TASK_DETACHING))
+      {
+         wait = MMAL_TRUE;
+         break;
+      }
+   }
+   executor.tasks--;
+   vcos_mutex_unlock(&executor.lock);
+
+   /* Not waited for with the lock held, as the task may itself be attaching
+    * or detaching other tasks */
+   if (wait)
+   {
+      vcos_semaphore_wait(&task->detached);
+      executor_store(&task->state, MMAL_EXECUTOR_TASK_DETACHED);
+   }
+   vcos_semaphore_delete(&task->detached);
+}
+
+void mmal_executor_task_post(MMAL_EXECUTOR_TASK_T *task)
+{
+   MMAL_EXECUTOR_WORKER_T *worker;
+
+   while (1)
+   {
+      switch (executor_load(&task->state))
+      {
+      case MMAL_EXECUTOR_TASK_IDLE:
+         if (!executor_cas(&task->state, MMAL_EXECUTOR_TASK_IDLE, MMAL_EXECUTOR_TASK_QUEUED))
+            continue;
+         /* A task posted by a worker, typically the next component in a
+          * pipeline, is run by the same worker once it is done. Another worker
+          * is only woken up to steal it if tasks are piling up. */
+         worker = vcos_tls_get(executor.worker_key);
+         if (worker)
+         {
+            if (executor_push(worker, task) > 1)
+               executor_wake();
+            return;
+         }
+         worker = &executor.workers[executor_add(&executor.next_worker, 1) % executor.threads];
+         executor_push(worker, task);
+         executor_wake();
+         return;
+      case MMAL_EXECUTOR_TASK_RUNNING:
+         if (!executor_cas(&task->state, MMAL_EXECUTOR_TASK_RUNNING, MMAL_EXECUTOR_TASK_RERUN))
+            continue;
+         return;
+      default:
+         return; /* Already going to run, or detached */
+      }
+   }
+}
+
+void mmal_executor_init_from_env(void)
+{
+   const char *value = getenv("MMAL_EXECUTOR_THREADS");
+   MMAL_STATUS_T status;
+
+   if (!value || !*value)
+      return;
+
+   status = mmal_executor_enable(strtoul(value, NULL, 0));
+   if (status != MMAL_SUCCESS && status != MMAL_EINVAL)
+      LOG_ERROR("could not enable the executor (%i)", status);
+}
@@ -0,0 +1,97 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef MMAL_EXECUTOR_PRIVATE_H
+#define MMAL_EXECUTOR_PRIVATE_H
+
+#include "interface/mmal/mmal.h"
+#include "interface/mmal/mmal_executor.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Task run by the executor.
+ * This is embedded in the structure of its owner and only manipulated through
+ * the functions below.
+ */
+typedef struct MMAL_EXECUTOR_TASK_T
+{
+   struct MMAL_EXECUTOR_TASK_T *next; /**< Link in the deque the task is queued on */
+   struct MMAL_EXECUTOR_TASK_T *prev;
+   void (*pf_run)(void *userdata);    /**< Function run each time the task is posted */
+   void *userdata;                    /**< Argument passed to pf_run */
+   unsigned int band;                 /**< Priority band of the task */
+   uint32_t state;                    /**< Scheduling state, see mmal_executor.c */
+   VCOS_SEMAPHORE_T detached;         /**< Signalled when a task being detached is done */
+} MMAL_EXECUTOR_TASK_T;
+
+/** Check whether the executor is enabled.
+ *
+ * @return MMAL_TRUE if tasks can be attached to the executor
+ */
+MMAL_BOOL_T mmal_executor_is_enabled(void);
+
+/** Attach a task to the executor.
+ *
+ * @param task     Task to initialise
+ * @param priority VCOS thread priority the task would have had on its own thread
+ * @param pf_run   Function to run when the task is posted
+ * @param userdata Argument passed to pf_run
+ * @return MMAL_SUCCESS, MMAL_EINVAL if the executor is not enabled or MMAL_ENOMEM
+ */
+MMAL_STATUS_T mmal_executor_task_attach(MMAL_EXECUTOR_TASK_T *task, int priority,
+   void (*pf_run)(void *userdata), void *userdata);
+
+/** Detach a task from the executor.
+ * Posting the task has no effect once this is called. If the task is queued
+ * or running, this waits for it to finish running, without running it again
+ * for posts made while it was running. It must not be called from the task
+ * itself.
+ *
+ * @param task Task to detach
+ */
+void mmal_executor_task_detach(MMAL_EXECUTOR_TASK_T *task);
+
+/** Post a task to be run.
+ * A task posted while it is queued is only run once. A task posted while it is
+ * running is run again once it is done. Tasks posted from a worker thread
+ * are queued on that worker.
+ *
+ * @param task Task to post
+ */
+void mmal_executor_task_post(MMAL_EXECUTOR_TASK_T *task);
+
+/** Enable the executor from the MMAL_EXECUTOR_THREADS environment variable.
+ * Called when the core is initialised.
+ */
+void mmal_executor_init_from_env(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MMAL_EXECUTOR_PRIVATE_H */
@@ -25,11 +25,26 @@ ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 */
 
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include "mmal.h"
 #include "mmal_pool.h"
 #include "core/mmal_buffer_private.h"
 #include "mmal_logging.h"
 
+/** Memory the payloads of an arena pool are carved out of */
+typedef struct MMAL_POOL_ARENA_T
+{
+   uint8_t *mem;             /**< Start of the arena */
+   size_t size;              /**< Size of the arena */
+   MMAL_BOOL_T mapped;       /**< Arena was mmap()ed rather than allocated */
+   int fd;                   /**< memfd backing the arena, or -1 */
+} MMAL_POOL_ARENA_T;
+
 /** Definition of a pool */
 typedef struct MMAL_POOL_PRIVATE_T
 {
@@ -47,12 +62,24 @@ typedef struct MMAL_POOL_PRIVATE_T
 
    unsigned int headers_alloc_num; /**< Number of buffer headers allocated as part of the private structure */
 
+   /* Payloads carved out of a single arena, see mmal_pool_create_arena() */
+   MMAL_BOOL_T arena_mode;   /**< Payloads come from the arena rather than the allocator */
+   uint32_t arena_flags;     /**< MMAL_POOL_ARENA_FLAG_* */
+   uint32_t arena_alignment; /**< Alignment of each payload */
+   MMAL_POOL_ARENA_T arena;  /**< Where the payloads are */
+
 } MMAL_POOL_PRIVATE_T;
 
 #define ROUND_UP(s,align) ((((unsigned long)(s)) & ~((align)-1)) + (align))
 #define ALIGN  8
+#define ARENA_ALIGN_UP(s,align) (((s) + (align) - 1) & ~((size_t)(align) - 1))
+#define ARENA_PAGE_SIZE 4096
 
 static void mmal_pool_buffer_header_release(MMAL_BUFFER_HEADER_T *header);
+static MMAL_POOL_T *mmal_pool_create_internal(unsigned int headers, uint32_t payload_size,
+                              void *allocator_context, mmal_pool_allocator_alloc_t allocator_alloc,
+                              mmal_pool_allocator_free_t allocator_free, uint32_t alignment,
+                              uint32_t arena_flags);
 
 static void *mmal_pool_allocator_default_alloc(void *context, uint32_t size)
 {
@@ -66,8 +93,124 @@ static void mmal_pool_allocator_default_free(void *context, void *mem)
    vcos_free(mem);
 }
 
+static void mmal_pool_arena_init(MMAL_POOL_ARENA_T *arena)
+{
+   arena->mem = NULL;
+   arena->size = 0;
+   arena->mapped = 0;
+   arena->fd = -1;
+}
+
+static void mmal_pool_arena_free(MMAL_POOL_ARENA_T *arena)
+{
+   if (!arena->mem)
+      return;
+
+#if defined(__linux__)
+   if (arena->mapped)
+      munmap(arena->mem, arena->size);
+   else
+#endif
+      vcos_free(arena->mem);
+#if defined(__linux__)
+   if (arena->fd >= 0)
+      close(arena->fd);
+#endif
+   mmal_pool_arena_init(arena);
+}
+
+#if defined(__linux__)
+/** Map an arena, either anonymous or backed by a memfd */
+static MMAL_STATUS_T mmal_pool_arena_map(MMAL_POOL_PRIVATE_T *private, size_t size,
+                                         MMAL_POOL_ARENA_T *arena)
+{
+   int fd = -1, flags = MAP_PRIVATE | MAP_ANONYMOUS;
+   void *mem;
+
+   if (private->arena_flags & MMAL_POOL_ARENA_FLAG_MEMFD)
+   {
+#if defined(SYS_memfd_create)
+      fd = syscall(SYS_memfd_create, "mmal pool", 1 /* MFD_CLOEXEC */);
+#endif
+      if (fd < 0)
+      {
+         LOG_ERROR("failed to create memfd for the pool arena");
+         return MMAL_ENOSYS;
+      }
+      if (ftruncate(fd, size))
+      {
+         LOG_ERROR("failed to size the pool arena to %zu bytes", size);
+         close(fd);
+         return MMAL_ENOMEM;
+      }
+      flags = MAP_SHARED;
+   }
+
+   mem = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+   if (mem == MAP_FAILED)
+   {
+      LOG_ERROR("failed to map %zu bytes for the pool arena", size);
+      if (fd >= 0)
+         close(fd);
+      return MMAL_ENOMEM;
+   }
+
+#if defined(MADV_HUGEPAGE)
+   if (private->arena_flags & MMAL_POOL_ARENA_FLAG_HUGEPAGES)
+      madvise(mem, size, MADV_HUGEPAGE); /* Only a hint */
+#endif
+
+   arena->mem = mem;
+   arena->size = size;
+   arena->mapped = 1;
+   arena->fd = fd;
+   return MMAL_SUCCESS;
+}
+#endif
+
+/** Allocate a new arena for the given payloads, unless the current one is
+ * large enough. The current arena is left untouched either way. */
+static MMAL_STATUS_T mmal_pool_arena_reserve(MMAL_POOL_PRIVATE_T *private, unsigned int headers,
+                                             uint32_t payload_size, MMAL_POOL_ARENA_T *arena)
+{
+   size_t stride = ARENA_ALIGN_UP((size_t)payload_size, private->arena_alignment);
+   size_t size = stride * headers;
+
+   mmal_pool_arena_init(arena);
+   if (size <= private->arena.size)
+      return MMAL_SUCCESS;
+
+   if (headers && size / headers != stride)
+   {
+      LOG_ERROR("pool arena for %u payloads of %u bytes is too large", headers, payload_size);
+      return MMAL_ENOMEM;
+   }
+
+   LOG_TRACE("allocating %zu bytes arena for %u payloads", size, headers);
+
+#if defined(__linux__)
+   if (private->arena_flags & (MMAL_POOL_ARENA_FLAG_MEMFD | MMAL_POOL_ARENA_FLAG_HUGEPAGES))
+      return mmal_pool_arena_map(private, ARENA_ALIGN_UP(size, ARENA_PAGE_SIZE), arena);
+#endif
+
+   /* vcos_malloc_aligned() only takes 32-bit sizes */
+   if (size == (VCOS_UNSIGNED)size)
+      arena->mem = vcos_malloc_aligned(size, private->arena_alignment, "mmal_pool arena");
+   if (!arena->mem)
+   {
+      LOG_ERROR("failed to allocate %zu bytes for the pool arena", size);
+      return MMAL_ENOMEM;
+   }
+   arena->size = size;
+   return MMAL_SUCCESS;
+}
+
+/** Initialise the buffer headers of a pool with their payloads. The arena,
+ * if any, must already be large enough. The payloads of a pool without an
+ * arena are taken from the given array when there is one, otherwise they
+ * are allocated one by one. */
 static MMAL_STATUS_T mmal_pool_initialise_buffer_headers(MMAL_POOL_T *pool, unsigned int headers,
-                                                         MMAL_BOOL_T reinitialise)
+                                                         MMAL_BOOL_T reinitialise, uint8_t **payloads)
 {
    MMAL_POOL_PRIVATE_T *private = (MMAL_POOL_PRIVATE_T *)pool;
    MMAL_BUFFER_HEADER_T *header;
@@ -81,7 +224,16 @@ static MMAL_STATUS_T mmal_pool_initialise_buffer_headers(MMAL_POOL_T *pool, unsi
       if (reinitialise)
          header = mmal_buffer_header_initialise(header, private->header_size);
 
-      if (private->payload_size && private->allocator_alloc)
+      if (private->payload_size && private->arena_mode)
+      {
+         payload = private->arena.mem +
+            i * ARENA_ALIGN_UP((size_t)private->payload_size, private->arena_alignment);
+      }
+      else if (private->payload_size && payloads)
+      {
+         payload = payloads[i];
+      }
+      else if (private->payload_size && private->allocator_alloc)
       {
          LOG_TRACE("allocating %u bytes for payload %u/%u", private->payload_size, i, headers);
          payload = (uint8_t*)private->allocator_alloc(private->allocator_context, private->payload_size);
@@ -106,7 +258,8 @@ static MMAL_STATUS_T mmal_pool_initialise_buffer_headers(MMAL_POOL_T *pool, unsi
       header->priv->refcount = 1;
       header->priv->payload = payload;
       header->priv->payload_context = private->allocator_context;
-      header->priv->pf_payload_free = private->allocator_free;
+      /* Arena payloads are freed with the arena */
+      header->priv->pf_payload_free = private->arena_mode ? NULL : private->allocator_free;
       header->priv->payload_size = private->payload_size;
       pool->header[i] = header;
       pool->headers_num = i+1;
@@ -123,10 +276,49 @@ MMAL_POOL_T *mmal_pool_create(unsigned int headers, uint32_t payload_size)
              mmal_pool_allocator_default_alloc, mmal_pool_allocator_default_free);
 }
 
+/** Create a pool of MMAL_BUFFER_HEADER_T with its payloads in a single arena */
+MMAL_POOL_T *mmal_pool_create_arena(unsigned int headers, uint32_t payload_size,
+                                    uint32_t alignment, uint32_t flags)
+{
+   if (!alignment)
+      alignment = ALIGN;
+   if (alignment & (alignment - 1))
+   {
+      LOG_ERROR("alignment %u is not a power of 2", alignment);
+      return NULL;
+   }
+#if defined(__linux__)
+   if ((flags & (MMAL_POOL_ARENA_FLAG_MEMFD | MMAL_POOL_ARENA_FLAG_HUGEPAGES)) &&
+       alignment > ARENA_PAGE_SIZE)
+   {
+      LOG_ERROR("alignment %u is larger than a page", alignment);
+      return NULL;
+   }
+#else
+   if (flags & MMAL_POOL_ARENA_FLAG_MEMFD)
+   {
+      LOG_ERROR("memfd arenas are not supported on this platform");
+      return NULL;
+   }
+#endif
+
+   return mmal_pool_create_internal(headers, payload_size, NULL, NULL, NULL, alignment, flags);
+}
+
 /** Create a pool of MMAL_BUFFER_HEADER_T */
 MMAL_POOL_T *mmal_pool_create_with_allocator(unsigned int headers, uint32_t payload_size,
                               void *allocator_context, mmal_pool_allocator_alloc_t allocator_alloc,
                               mmal_pool_allocator_free_t allocator_free)
+{
+   return mmal_pool_create_internal(headers, payload_size, allocator_context,
+                                    allocator_alloc, allocator_free, 0, 0);
+}
+
+/** Create a pool of MMAL_BUFFER_HEADER_T, with an arena if alignment is not 0 */
+static MMAL_POOL_T *mmal_pool_create_internal(unsigned int headers, uint32_t payload_size,
+                              void *allocator_context, mmal_pool_allocator_alloc_t allocator_alloc,
+                              mmal_pool_allocator_free_t allocator_free, uint32_t alignment,
+                              uint32_t arena_flags)
 {
    unsigned int i, headers_array_size, header_size, pool_size;
    MMAL_POOL_PRIVATE_T *private;
@@ -164,6 +356,10 @@ MMAL_POOL_T *mmal_pool_create_with_allocator(unsigned int headers, uint32_t payl
    private->header_size = header_size;
    private->payload_size = payload_size;
    private->headers_alloc_num = headers;
+   mmal_pool_arena_init(&private->arena);
+   private->arena_mode = alignment != 0;
+   private->arena_alignment = alignment;
+   private->arena_flags = arena_flags;
 
    /* Use default allocators if none has been specified by client */
    if (!allocator_alloc || !allocator_free)
@@ -178,7 +374,14 @@ MMAL_POOL_T *mmal_pool_create_with_allocator(unsigned int headers, uint32_t payl
    private->allocator_free = allocator_free;
    private->allocator_context = allocator_context;
 
-   if (mmal_pool_initialise_buffer_headers(pool, headers, 1) != MMAL_SUCCESS)
+   if (private->arena_mode &&
+       mmal_pool_arena_reserve(private, headers, payload_size, &private->arena) != MMAL_SUCCESS)
+   {
+      mmal_pool_destroy(pool);
+      return NULL;
+   }
+
+   if (mmal_pool_initialise_buffer_headers(pool, headers, 1, NULL) != MMAL_SUCCESS)
    {
       mmal_pool_destroy(pool);
       return NULL;
@@ -212,6 +415,7 @@ void mmal_pool_destroy(MMAL_POOL_T *pool)
    if (pool->header)
       vcos_free(pool->header);
 
+   mmal_pool_arena_free(&((MMAL_POOL_PRIVATE_T *)pool)->arena);
    if(pool->queue) mmal_queue_destroy(pool->queue);
    vcos_free(pool);
 }
@@ -220,6 +424,10 @@ void mmal_pool_destroy(MMAL_POOL_T *pool)
 MMAL_STATUS_T mmal_pool_resize(MMAL_POOL_T *pool, unsigned int headers, uint32_t payload_size)
 {
    MMAL_POOL_PRIVATE_T *private = (MMAL_POOL_PRIVATE_T *)pool;
+   MMAL_BUFFER_HEADER_T **header = NULL;
+   MMAL_STATUS_T status = MMAL_SUCCESS;
+   MMAL_POOL_ARENA_T arena;
+   uint8_t **payloads = NULL;
    unsigned int i;
 
    if (!private || !headers)
@@ -229,38 +437,100 @@ MMAL_STATUS_T mmal_pool_resize(MMAL_POOL_T *pool, unsigned int headers, uint32_t
    if (headers == pool->headers_num && payload_size == private->payload_size)
       return MMAL_SUCCESS;
 
+   /* Allocate everything the new size needs before releasing anything, so
+    * that the pool is left as it was if an allocation fails */
+   mmal_pool_arena_init(&arena);
+   if (headers > private->headers_alloc_num)
+   {
+      header = vcos_calloc(private->header_size * headers + ROUND_UP(sizeof(void *)*headers,ALIGN),
+                           1, "MMAL buffer headers");
+      if (!header)
+         return MMAL_ENOMEM;
+   }
+
+   if (private->arena_mode && payload_size)
+   {
+      /* An arena is only reallocated if it is too small */
+      status = mmal_pool_arena_reserve(private, headers, payload_size, &arena);
+   }
+   else if (payload_size)
+   {
+      payloads = vcos_calloc(headers, sizeof(*payloads), "mmal_pool payloads");
+      for (i = 0; payloads && i < headers; i++)
+      {
+         LOG_TRACE("allocating %u bytes for payload %u/%u", payload_size, i, headers);
+         payloads[i] = (uint8_t*)private->allocator_alloc(private->allocator_context, payload_size);
+         if (!payloads[i])
+         {
+            LOG_ERROR("failed to allocate payload %u/%u", i, headers);
+            break;
+         }
+      }
+      if (!payloads || i < headers)
+         status = MMAL_ENOMEM;
+   }
+
+   if (status != MMAL_SUCCESS)
+   {
+      for (i = 0; payloads && i < headers && payloads[i]; i++)
+         private->allocator_free(private->allocator_context, payloads[i]);
+      if (payloads)
+         vcos_free(payloads);
+      mmal_pool_arena_free(&arena);
+      if (header)
+         vcos_free(header);
+      return status;
+   }
+
    /* Remove all the headers from the queue */
    for (i = 0; i < pool->headers_num; i++)
       mmal_queue_get(pool->queue);
 
-   /* Start by freeing the current payloads */
+   /* Free the current payloads */
    private->payload_size = 0;
-   mmal_pool_initialise_buffer_headers(pool, pool->headers_num, 0);
+   mmal_pool_initialise_buffer_headers(pool, pool->headers_num, 0, NULL);
    pool->headers_num = 0;
 
-   /* Check if we need to reallocate the buffer headers themselves */
-   if (headers > private->headers_alloc_num)
+   if (header)
    {
-      private->headers_alloc_num = 0;
-      if (pool->header)
-         vcos_free(pool->header);
-      pool->header =
-         vcos_calloc(private->header_size * headers + ROUND_UP(sizeof(void *)*headers,ALIGN),
-                     1, "MMAL buffer headers");
-      if (!pool->header)
-         return MMAL_ENOMEM;
+      vcos_free(pool->header);
+      pool->header = header;
       private->headers_alloc_num = headers;
    }
+   if (arena.mem)
+   {
+      mmal_pool_arena_free(&private->arena);
+      private->arena = arena;
+   }
 
-   /* Allocate the new payloads */
    private->payload_size = payload_size;
-   mmal_pool_initialise_buffer_headers(pool, headers, 1);
+   status = mmal_pool_initialise_buffer_headers(pool, headers, 1, payloads);
+   if (payloads)
+      vcos_free(payloads);
 
    /* Add all the headers to the queue */
    for (i = 0; i < pool->headers_num; i++)
       mmal_queue_put(pool->queue, pool->header[i]);
 
-   return MMAL_SUCCESS;
+   return status;
+}
+
+/** Get the memfd backing the arena of a pool */
+int mmal_pool_arena_fd(MMAL_POOL_T *pool)
+{
+   MMAL_POOL_PRIVATE_T *private = (MMAL_POOL_PRIVATE_T *)pool;
+   return private ? private->arena.fd : -1;
+}
+
+/** Get the offset of a payload in the arena of a pool */
+int64_t mmal_pool_arena_offset(MMAL_POOL_T *pool, const MMAL_BUFFER_HEADER_T *header)
+{
+   MMAL_POOL_PRIVATE_T *private = (MMAL_POOL_PRIVATE_T *)pool;
+
+   if (!private || !header || !private->arena.mem || header->data < private->arena.mem ||
+       header->data >= private->arena.mem + private->arena.size)
+      return -1;
+   return header->data - private->arena.mem;
 }
 
 /** Buffer header release callback.
@@ -29,18 +29,22 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "util/mmal_util.h"
 #include "core/mmal_component_private.h"
 #include "core/mmal_port_private.h"
+#include "core/mmal_buffer_private.h"
 #include "interface/vcos/vcos.h"
 #include "mmal_logging.h"
 #include "interface/mmal/util/mmal_util.h"
 #include "interface/mmal/mmal_parameters.h"
+#include "interface/mmal/mmal_trace.h"
 #include <stdio.h>
 
 #ifdef _VIDEOCORE
 #include "vcfw/rtos/common/rtos_common_mem.h" /* mem_alloc */
 #endif
 
-/** Only collect port stats if enabled in build. Performance could be
- * affected on an ARM since gettimeofday() involves a system call.
+/** Only collect stats on returned buffers and latency histograms if enabled in
+ * build. Performance could be affected on an ARM since gettimeofday() involves
+ * a system call, and buffers sent to a port then need time stamping as well.
+ * The stats are updated without taking a lock where compiler atomics are available.
  */
 #if defined(MMAL_COLLECT_PORT_STATS)
 # define MMAL_COLLECT_PORT_STATS_ENABLED 1
@@ -48,6 +52,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 # define MMAL_COLLECT_PORT_STATS_ENABLED 0
 #endif
 
+#if defined(__GNUC__) && !defined(MMAL_PORT_STATS_NO_ATOMICS)
+#define MMAL_PORT_STATS_HAVE_ATOMICS 1
+#endif
+
 static MMAL_STATUS_T mmal_port_private_parameter_get(MMAL_PORT_T *port,
                                                      MMAL_PARAMETER_HEADER_T *param);
 
@@ -62,7 +70,7 @@ typedef struct MMAL_PORT_PRIVATE_CORE_T
 {
    VCOS_MUTEX_T lock; /**< Used to lock access to the port */
    VCOS_MUTEX_T send_lock; /**< Used to lock access while sending buffer to the port */
-   VCOS_MUTEX_T stats_lock; /**< Used to lock access to the stats */
+   VCOS_MUTEX_T stats_lock; /**< Used to lock access to the stats when there are no atomics */
    VCOS_MUTEX_T connection_lock; /**< Used to lock access to a connection */
 
    /** Callback set by client to call when buffer headers need to be returned */
@@ -94,6 +102,8 @@ typedef struct MMAL_PORT_PRIVATE_CORE_T
 
    /** Per-port statistics collected directly by the MMAL core */
    MMAL_CORE_PORT_STATISTICS_T stats;
+   /** Per-port latency histograms collected directly by the MMAL core */
+   MMAL_CORE_PORT_HISTOGRAMS_T histograms;
 
    char *name; /**< Port name */
    unsigned int name_size; /** Size of the memory area reserved for the name string */
@@ -116,7 +126,13 @@ static void mmal_port_connected_output_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_
 static MMAL_BOOL_T mmal_port_connected_pool_cb(MMAL_POOL_T *pool, MMAL_BUFFER_HEADER_T *buffer, void *userdata);
 
 static void mmal_port_name_update(MMAL_PORT_T *port);
-static void mmal_port_update_port_stats(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR direction);
+static uint32_t mmal_port_stats_time(void);
+static uint32_t mmal_port_stats_stamp(MMAL_BUFFER_HEADER_T *buffer);
+static void mmal_port_update_port_stats(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR direction,
+                                        MMAL_BUFFER_HEADER_T *buffer, uint32_t stc);
+static void mmal_port_update_send_errors(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T **buffers,
+                                         unsigned int num);
+static MMAL_STATUS_T mmal_port_get_core_histograms(MMAL_PORT_T *port, MMAL_PARAMETER_HEADER_T *param);
 
 /*****************************************************************************/
 
@@ -144,6 +160,17 @@ static void mmal_port_update_port_stats(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR d
    if (!--(a)->priv->core->transit_buffer_headers) \
       vcos_semaphore_post(&(a)->priv->core->transit_sema); \
    vcos_mutex_unlock(&(a)->priv->core->transit_lock)
+#define IN_TRANSIT_ADD(a,n) \
+   vcos_mutex_lock(&(a)->priv->core->transit_lock); \
+   if (!(a)->priv->core->transit_buffer_headers) \
+      vcos_semaphore_wait(&(a)->priv->core->transit_sema); \
+   (a)->priv->core->transit_buffer_headers += (n); \
+   vcos_mutex_unlock(&(a)->priv->core->transit_lock)
+#define IN_TRANSIT_SUB(a,n) \
+   vcos_mutex_lock(&(a)->priv->core->transit_lock); \
+   if (!((a)->priv->core->transit_buffer_headers -= (n))) \
+      vcos_semaphore_post(&(a)->priv->core->transit_sema); \
+   vcos_mutex_unlock(&(a)->priv->core->transit_lock)
 #define IN_TRANSIT_WAIT(a) \
    vcos_semaphore_wait(&(a)->priv->core->transit_sema); \
    vcos_semaphore_post(&(a)->priv->core->transit_sema)
@@ -710,6 +737,7 @@ MMAL_STATUS_T mmal_port_send_buffer(MMAL_PORT_T *port,
    MMAL_BUFFER_HEADER_T *buffer)
 {
    MMAL_STATUS_T status = MMAL_SUCCESS;
+   uint32_t stc = 0;
 
    if (!port || !port->priv)
    {
@@ -751,6 +779,7 @@ MMAL_STATUS_T mmal_port_send_buffer(MMAL_PORT_T *port,
    /* coverity[lock] transit_sema is used for signalling, and is not a lock */
    /* coverity[lock_order] since transit_sema is not a lock, there is no ordering conflict */
    IN_TRANSIT_INCREMENT(port);
+   MMAL_TRACE_PORT(MMAL_TRACE_EVENT_SEND, port, buffer);
 
    if (port->priv->core->is_paused)
    {
@@ -761,8 +790,17 @@ MMAL_STATUS_T mmal_port_send_buffer(MMAL_PORT_T *port,
    }
    else
    {
+      /* The buffer is time stamped first as it may come back before pf_send
+       * returns, but it is only counted once the component has taken it */
+      if (MMAL_COLLECT_PORT_STATS_ENABLED)
+         stc = mmal_port_stats_stamp(buffer);
+
       /* Send buffer to component */
       status = port->priv->pf_send(port, buffer);
+      if (status == MMAL_SUCCESS)
+         mmal_port_update_port_stats(port, MMAL_CORE_STATS_RX, NULL, stc);
+      else
+         mmal_port_update_send_errors(port, &buffer, 1);
    }
 
    if (status != MMAL_SUCCESS)
@@ -770,12 +808,115 @@ MMAL_STATUS_T mmal_port_send_buffer(MMAL_PORT_T *port,
       IN_TRANSIT_DECREMENT(port);
       LOG_ERROR("%s: send failed: %s", port->name, mmal_status_to_string(status));
    }
+
+   UNLOCK_SENDING(port);
+   return status;
+}
+
+/** Send an array of buffers to a port */
+MMAL_STATUS_T mmal_port_send_buffers(MMAL_PORT_T *port,
+   MMAL_BUFFER_HEADER_T **buffers, unsigned int *count)
+{
+   MMAL_STATUS_T status = MMAL_SUCCESS;
+   unsigned int i, sent = 0, num;
+   uint32_t stc = 0;
+
+   if (!port || !port->priv || !buffers || !count)
+   {
+      LOG_ERROR("invalid port");
+      return MMAL_EINVAL;
+   }
+   num = *count;
+   *count = 0;
+   if (!num)
+      return MMAL_SUCCESS;
+
+   for (i = 0; i < num; i++)
+   {
+      if (buffers[i]->alloc_size && !buffers[i]->data &&
+          !(port->capabilities & MMAL_PORT_CAPABILITY_PASSTHROUGH))
+      {
+         LOG_ERROR("%s(%p) received invalid buffer header", port->name, port);
+         return MMAL_EINVAL;
+      }
+   }
+
+   if (!port->priv->pf_send)
+      return MMAL_ENOSYS;
+
+   LOCK_SENDING(port);
+
+   if (!port->is_enabled)
+   {
+      UNLOCK_SENDING(port);
+      return MMAL_EINVAL;
+   }
+
+   /* The transit count is raised for all the buffers at once, so that none of
+    * them can come back before the others are accounted for */
+   IN_TRANSIT_ADD(port, num);
+
+   for (i = 0; i < num; i++)
+   {
+      if (port->type == MMAL_PORT_TYPE_OUTPUT && buffers[i]->length)
+      {
+         LOG_DEBUG("given an output buffer with length != 0");
+         buffers[i]->length = 0;
+      }
+      MMAL_TRACE_PORT(MMAL_TRACE_EVENT_SEND, port, buffers[i]);
+   }
+
+   if (port->priv->core->is_paused)
+   {
+      /* Add buffers to our internal queue */
+      for (i = 0; i < num; i++)
+      {
+         buffers[i]->next = NULL;
+         *port->priv->core->queue_last = buffers[i];
+         port->priv->core->queue_last = &buffers[i]->next;
+      }
+      sent = num;
+   }
    else
    {
-      mmal_port_update_port_stats(port, MMAL_CORE_STATS_RX);
+      /* The buffers are time stamped first as they may come back before they are
+       * all sent, but they are only counted once the component has taken them */
+      if (MMAL_COLLECT_PORT_STATS_ENABLED)
+         for (i = 0; i < num; i++)
+            stc = mmal_port_stats_stamp(buffers[i]);
+
+      if (port->priv->pf_send_batch)
+      {
+         sent = num;
+         status = port->priv->pf_send_batch(port, buffers, &sent);
+         if (status == MMAL_SUCCESS && sent != num)
+            status = MMAL_ENOSPC;
+      }
+      else
+      {
+         for (; sent < num && status == MMAL_SUCCESS; sent++)
+            status = port->priv->pf_send(port, buffers[sent]);
+         if (status != MMAL_SUCCESS)
+            sent--;
+      }
+
+      if (!stc && sent)
+         stc = mmal_port_stats_time();
+      for (i = 0; i < sent; i++)
+         mmal_port_update_port_stats(port, MMAL_CORE_STATS_RX, NULL, stc);
+      if (sent != num)
+         mmal_port_update_send_errors(port, buffers + sent, num - sent);
+   }
+
+   if (sent != num)
+   {
+      IN_TRANSIT_SUB(port, num - sent);
+      LOG_ERROR("%s: send failed after %u/%u buffers: %s", port->name, sent, num,
+                mmal_status_to_string(status));
    }
 
    UNLOCK_SENDING(port);
+   *count = sent;
    return status;
 }
 
@@ -864,6 +1005,77 @@ MMAL_STATUS_T mmal_port_parameter_set(MMAL_PORT_T *port,
    return status;
 }
 
+/** Maximum number of parameters given to pf_parameters_set in one call */
+#define MMAL_PORT_PARAMETERS_BATCH 16
+
+/* Set several parameters on a port */
+MMAL_STATUS_T mmal_port_parameters_set(MMAL_PORT_T *port,
+   const MMAL_PARAMETER_HEADER_T *const *params, unsigned int num)
+{
+   MMAL_STATUS_T results[MMAL_PORT_PARAMETERS_BATCH];
+   MMAL_STATUS_T status = MMAL_SUCCESS;
+   unsigned int i, done = 0, count;
+
+   if (!port || !port->priv)
+   {
+      LOG_ERROR("invalid port");
+      return MMAL_EINVAL;
+   }
+   if (num && !params)
+   {
+      LOG_ERROR("params not supplied");
+      return MMAL_EINVAL;
+   }
+   for (i = 0; i < num; i++)
+   {
+      if (!params[i])
+      {
+         LOG_ERROR("param %u not supplied", i);
+         return MMAL_EINVAL;
+      }
+   }
+
+   LOG_TRACE("%s(%i:%i) port %p, %u params", port->component->name,
+             (int)port->type, (int)port->index, port, num);
+
+   LOCK_PORT(port);
+   while (status == MMAL_SUCCESS && done < num)
+   {
+      count = MMAL_MIN(num - done, MMAL_PORT_PARAMETERS_BATCH);
+
+      if (!port->priv->pf_parameters_set)
+      {
+         /* One at a time, as mmal_port_parameter_set does */
+         status = MMAL_ENOSYS;
+         if (port->priv->pf_parameter_set)
+            status = port->priv->pf_parameter_set(port, params[done]);
+         if (status == MMAL_ENOSYS)
+            status = mmal_port_private_parameter_set(port, params[done]);
+         done++;
+         continue;
+      }
+
+      status = port->priv->pf_parameters_set(port, params + done, results, &count);
+      vcos_assert(count <= MMAL_MIN(num - done, MMAL_PORT_PARAMETERS_BATCH));
+      if (status == MMAL_SUCCESS && !count)
+         status = MMAL_EINVAL;
+
+      for (i = 0; i < count; i++)
+      {
+         if (results[i] == MMAL_ENOSYS)
+         {
+            /* is this a core parameter? */
+            results[i] = mmal_port_private_parameter_set(port, params[done + i]);
+         }
+         if (results[i] != MMAL_SUCCESS && status == MMAL_SUCCESS)
+            status = results[i];
+      }
+      done += count;
+   }
+   UNLOCK_PORT(port);
+   return status;
+}
+
 /* Get a port parameter */
 MMAL_STATUS_T mmal_port_parameter_get(MMAL_PORT_T *port,
    MMAL_PARAMETER_HEADER_T *param)
@@ -880,6 +1092,10 @@ MMAL_STATUS_T mmal_port_parameter_get(MMAL_PORT_T *port,
    if (!param)
       return MMAL_EINVAL;
 
+   /* The histograms only exist in this core, components never see the request */
+   if (param->id == MMAL_PARAMETER_CORE_HISTOGRAMS)
+      return mmal_port_get_core_histograms(port, param);
+
    LOCK_PORT(port);
    if (port->priv->pf_parameter_get)
       status = port->priv->pf_parameter_get(port, param);
@@ -908,8 +1124,9 @@ void mmal_port_buffer_header_callback(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *b
 
    if (MMAL_COLLECT_PORT_STATS_ENABLED)
    {
-      mmal_port_update_port_stats(port, MMAL_CORE_STATS_TX);
+      mmal_port_update_port_stats(port, MMAL_CORE_STATS_TX, buffer, 0);
    }
+   MMAL_TRACE_PORT(MMAL_TRACE_EVENT_CALLBACK, port, buffer);
 
    port->priv->core->buffer_header_callback(port, buffer);
 
@@ -1238,34 +1455,45 @@ static MMAL_STATUS_T mmal_port_populate_clock_ports(MMAL_PORT_T* output, MMAL_PO
 static MMAL_STATUS_T mmal_port_populate_from_pool(MMAL_PORT_T* port, MMAL_POOL_T* pool)
 {
    MMAL_STATUS_T status = MMAL_SUCCESS;
-   uint32_t buffer_idx;
-   MMAL_BUFFER_HEADER_T *buffer;
+   MMAL_BUFFER_HEADER_T **buffers;
+   unsigned int num = 0, sent, i;
 
    if (!port->priv->pf_send)
       return MMAL_ENOSYS;
 
    LOG_TRACE("%s port %p, pool: %p", port->name, port, pool);
 
+   buffers = vcos_malloc(port->buffer_num * sizeof(*buffers), "mmal populate");
+   if (!buffers)
+      return MMAL_ENOMEM;
+
    /* Populate port from pool */
-   for (buffer_idx = 0; buffer_idx < port->buffer_num; buffer_idx++)
+   while (num < port->buffer_num)
    {
-      buffer = mmal_queue_get(pool->queue);
-      if (!buffer)
+      buffers[num] = mmal_queue_get(pool->queue);
+      if (!buffers[num])
       {
          LOG_ERROR("too few buffers in the pool");
          status = MMAL_ENOMEM;
          break;
       }
+      num++;
+   }
 
-      status = mmal_port_send_buffer(port, buffer);
-      if (status != MMAL_SUCCESS)
+   sent = num;
+   if (num)
+   {
+      MMAL_STATUS_T send_status = mmal_port_send_buffers(port, buffers, &sent);
+      if (send_status != MMAL_SUCCESS)
       {
          LOG_ERROR("failed to send buffer to port");
-         mmal_buffer_header_release(buffer);
-         break;
+         status = send_status;
       }
    }
+   for (i = sent; i < num; i++)
+      mmal_buffer_header_release(buffers[i]);
 
+   vcos_free(buffers);
    return status;
 }
 
@@ -1388,13 +1616,78 @@ static void mmal_port_name_update(MMAL_PORT_T *port)
             port->format && port->format->encoding ? (char *)&port->format->encoding : "");
 }
 
+#ifdef MMAL_PORT_STATS_HAVE_ATOMICS
+#define STATS_LOCK(core) (void)(core)
+#define STATS_UNLOCK(core)
+#define STATS_LOAD(p) __atomic_load_n(p, __ATOMIC_RELAXED)
+#define STATS_EXCHANGE(p,v) __atomic_exchange_n(p, v, __ATOMIC_RELAXED)
+#define STATS_INCREMENT(p) __atomic_add_fetch(p, 1, __ATOMIC_RELAXED)
+#define STATS_CAS(p,old,v) __atomic_compare_exchange_n(p, old, v, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)
+#else
+#define STATS_LOCK(core) vcos_mutex_lock(&(core)->stats_lock)
+#define STATS_UNLOCK(core) vcos_mutex_unlock(&(core)->stats_lock)
+#define STATS_LOAD(p) (*(p))
+static uint32_t stats_exchange(uint32_t *p, uint32_t v) { uint32_t old = *p; *p = v; return old; }
+#define STATS_EXCHANGE(p,v) stats_exchange(p, v)
+#define STATS_INCREMENT(p) (++*(p))
+static int stats_cas(uint32_t *p, uint32_t *old, uint32_t v)
+{
+   if (*p != *old) { *old = *p; return 0; }
+   *p = v; return 1;
+}
+#define STATS_CAS(p,old,v) stats_cas(p, old, v)
+#endif
+
+/** Read a stat, resetting it if requested */
+#define STATS_READ(p,reset) ((reset) ? STATS_EXCHANGE(p, 0) : STATS_LOAD(p))
+
+static void mmal_port_stats_max(uint32_t *max, uint32_t value)
+{
+   uint32_t current = STATS_LOAD(max);
+   while (value > current && !STATS_CAS(max, &current, value))
+      continue;
+}
+
+static void mmal_port_histogram_add(MMAL_CORE_HISTOGRAM_T *histogram, uint32_t value)
+{
+   unsigned int bucket;
+
+#ifdef __GNUC__
+   bucket = value ? 32 - __builtin_clz(value) : 0;
+#else
+   for (bucket = 0; bucket < 32 && (value >> bucket); bucket++);
+#endif
+   if (bucket >= MMAL_CORE_HISTOGRAM_BUCKETS)
+      bucket = MMAL_CORE_HISTOGRAM_BUCKETS - 1;
+
+   STATS_INCREMENT(&histogram->bucket[bucket]);
+   STATS_INCREMENT(&histogram->count);
+   mmal_port_stats_max(&histogram->max, value);
+}
+
+static void mmal_port_histogram_read(MMAL_CORE_HISTOGRAM_T *dst, MMAL_CORE_HISTOGRAM_T *src,
+                                     MMAL_BOOL_T reset)
+{
+   unsigned int i;
+
+   dst->count = STATS_READ(&src->count, reset);
+   dst->max = STATS_READ(&src->max, reset);
+   for (i = 0; i < MMAL_CORE_HISTOGRAM_BUCKETS; i++)
+      dst->bucket[i] = STATS_READ(&src->bucket[i], reset);
+}
+
 static MMAL_STATUS_T mmal_port_get_core_stats(MMAL_PORT_T *port, MMAL_PARAMETER_HEADER_T *param)
 {
    MMAL_PARAMETER_CORE_STATISTICS_T *stats_param = (MMAL_PARAMETER_CORE_STATISTICS_T*)param;
    MMAL_CORE_STATISTICS_T *stats = &stats_param->stats;
    MMAL_CORE_STATISTICS_T *src_stats;
    MMAL_PORT_PRIVATE_CORE_T *core = port->priv->core;
-   vcos_mutex_lock(&core->stats_lock);
+   MMAL_BOOL_T reset = stats_param->reset;
+
+   if (param->size < sizeof(*stats_param))
+      return MMAL_EINVAL;
+
+   STATS_LOCK(core);
    switch (stats_param->dir)
    {
    case MMAL_CORE_STATS_RX:
@@ -1404,38 +1697,127 @@ static MMAL_STATUS_T mmal_port_get_core_stats(MMAL_PORT_T *port, MMAL_PARAMETER_
       src_stats = &port->priv->core->stats.tx;
       break;
    }
-   *stats = *src_stats;
-   if (stats_param->reset)
-      memset(src_stats, 0, sizeof(*src_stats));
-   vcos_mutex_unlock(&core->stats_lock);
+   stats->buffer_count = STATS_READ(&src_stats->buffer_count, reset);
+   stats->first_buffer_time = STATS_READ(&src_stats->first_buffer_time, reset);
+   stats->last_buffer_time = STATS_READ(&src_stats->last_buffer_time, reset);
+   stats->max_delay = STATS_READ(&src_stats->max_delay, reset);
+   STATS_UNLOCK(core);
    return MMAL_SUCCESS;
 }
 
+static MMAL_STATUS_T mmal_port_get_core_histograms(MMAL_PORT_T *port, MMAL_PARAMETER_HEADER_T *param)
+{
+   MMAL_PARAMETER_CORE_HISTOGRAMS_T *histograms_param = (MMAL_PARAMETER_CORE_HISTOGRAMS_T*)param;
+   MMAL_CORE_PORT_HISTOGRAMS_T *histograms = &histograms_param->histograms;
+   MMAL_PORT_PRIVATE_CORE_T *core = port->priv->core;
+   MMAL_BOOL_T reset = histograms_param->reset;
+
+   if (!MMAL_COLLECT_PORT_STATS_ENABLED)
+      return MMAL_ENOSYS;
+   if (param->size < sizeof(*histograms_param))
+      return MMAL_EINVAL;
+
+   STATS_LOCK(core);
+   mmal_port_histogram_read(&histograms->rx_interval, &core->histograms.rx_interval, reset);
+   mmal_port_histogram_read(&histograms->tx_interval, &core->histograms.tx_interval, reset);
+   mmal_port_histogram_read(&histograms->residency, &core->histograms.residency, reset);
+   histograms->rx_errors = STATS_READ(&core->histograms.rx_errors, reset);
+   STATS_UNLOCK(core);
+   return MMAL_SUCCESS;
+}
+
+/** Current time for the stats. 0 means no time was recorded. */
+static uint32_t mmal_port_stats_time(void)
+{
+   uint32_t stc = vcos_getmicrosecs();
+   return stc ? stc : 1;
+}
+
+/** Time stamp a buffer about to be sent to a port, so that the time it spends
+ * in the port can be measured when it is returned.
+ * @return the time stamp, for the stats of the port once it has taken the buffer
+ */
+static uint32_t mmal_port_stats_stamp(MMAL_BUFFER_HEADER_T *buffer)
+{
+   uint32_t stc = mmal_port_stats_time();
+
+   if (buffer->priv)
+      buffer->priv->send_time = stc;
+   return stc;
+}
+
+/** Account for buffers a port failed to take. They are not counted as received. */
+static void mmal_port_update_send_errors(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T **buffers,
+                                         unsigned int num)
+{
+   MMAL_PORT_PRIVATE_CORE_T *core = port->priv->core;
+   unsigned int i;
+
+   if (!MMAL_COLLECT_PORT_STATS_ENABLED)
+      return;
+
+   for (i = 0; i < num; i++)
+      if (buffers[i]->priv)
+         buffers[i]->priv->send_time = 0;
+
+   STATS_LOCK(core);
+   for (i = 0; i < num; i++)
+      STATS_INCREMENT(&core->histograms.rx_errors);
+   STATS_UNLOCK(core);
+}
+
 /** Update the port stats, called per buffer.
- *
+ * Buffers returned by the port which were time stamped when they were sent give
+ * the time they spent in the port.
+ * @param buffer the buffer returned by the port (TX only)
+ * @param stc time the buffer was sent to the port (RX only)
  */
-static void mmal_port_update_port_stats(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR direction)
+static void mmal_port_update_port_stats(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR direction,
+                                        MMAL_BUFFER_HEADER_T *buffer, uint32_t stc)
 {
    MMAL_PORT_PRIVATE_CORE_T *core = port->priv->core;
    MMAL_CORE_STATISTICS_T *stats;
-   unsigned stc = vcos_getmicrosecs();
+   MMAL_CORE_HISTOGRAM_T *interval;
+   uint32_t last;
 
-   vcos_mutex_lock(&core->stats_lock);
+   if (!stc)
+      stc = mmal_port_stats_time();
 
-   stats = direction == MMAL_CORE_STATS_RX ? &core->stats.rx : &core->stats.tx;
+   if (direction == MMAL_CORE_STATS_RX)
+   {
+      stats = &core->stats.rx;
+      interval = &core->histograms.rx_interval;
+   }
+   else
+   {
+      stats = &core->stats.tx;
+      interval = &core->histograms.tx_interval;
+   }
 
-   stats->buffer_count++;
+   STATS_LOCK(core);
 
-   if (!stats->first_buffer_time)
+   STATS_INCREMENT(&stats->buffer_count);
+
+   last = STATS_EXCHANGE(&stats->last_buffer_time, stc);
+   if (!last)
    {
-      stats->last_buffer_time = stats->first_buffer_time = stc;
+      uint32_t none = 0;
+      STATS_CAS(&stats->first_buffer_time, &none, stc);
    }
    else
    {
-      stats->max_delay = vcos_max(stats->max_delay, stc-stats->last_buffer_time);
-      stats->last_buffer_time = stc;
+      mmal_port_stats_max(&stats->max_delay, stc - last);
+      if (MMAL_COLLECT_PORT_STATS_ENABLED)
+         mmal_port_histogram_add(interval, stc - last);
    }
-   vcos_mutex_unlock(&core->stats_lock);
+
+   if (MMAL_COLLECT_PORT_STATS_ENABLED && buffer && buffer->priv && buffer->priv->send_time)
+   {
+      mmal_port_histogram_add(&core->histograms.residency, stc - buffer->priv->send_time);
+      buffer->priv->send_time = 0;
+   }
+
+   STATS_UNLOCK(core);
 }
 
 static MMAL_STATUS_T mmal_port_private_parameter_get(MMAL_PORT_T *port,
@@ -58,6 +58,16 @@ typedef struct MMAL_PORT_PRIVATE_T
    uint8_t *(*pf_payload_alloc)(MMAL_PORT_T *port, uint32_t payload_size);
    void     (*pf_payload_free)(MMAL_PORT_T *port, uint8_t *payload);
 
+   /** Optional, sends several buffers at once. On return count holds the number
+    * of buffers accepted. Ports without it get their buffers through pf_send. */
+   MMAL_STATUS_T (*pf_send_batch)(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T **buffers, unsigned int *count);
+
+   /** Optional, sets several parameters at once. On return count holds the number
+    * of parameters processed and status the result of each of them. MMAL_ENOSYS
+    * doesn't stop the batch, those parameters are then handled by the core. */
+   MMAL_STATUS_T (*pf_parameters_set)(MMAL_PORT_T *port, const MMAL_PARAMETER_HEADER_T *const *params,
+                                      MMAL_STATUS_T *status, unsigned int *count);
+
 } MMAL_PORT_PRIVATE_T;
 
 /** Callback called by components when a \ref MMAL_BUFFER_HEADER_T needs to be sent back to the
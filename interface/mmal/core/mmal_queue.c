@@ -28,6 +28,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "mmal.h"
 #include "mmal_queue.h"
 
+/* The single-producer/single-consumer variant relies on compiler atomics */
+#if defined(__GNUC__) && !defined(MMAL_QUEUE_NO_ATOMICS)
+#define MMAL_QUEUE_HAVE_ATOMICS 1
+#endif
+
 /** Definition of the QUEUE */
 struct MMAL_QUEUE_T
 {
@@ -36,6 +41,16 @@ struct MMAL_QUEUE_T
    MMAL_BUFFER_HEADER_T *first;
    MMAL_BUFFER_HEADER_T **last;
    VCOS_SEMAPHORE_T semaphore;
+
+   /* Lock-free variant (see mmal_queue_create_spsc). The list is intrusive,
+    * linked through buffer->next, with a stub node so that the producer and
+    * the consumer never touch the same pointer. The semaphore is only used
+    * when the consumer is parked. */
+   MMAL_BOOL_T spsc;
+   MMAL_BUFFER_HEADER_T *head;  /**< Last buffer linked in (producer side) */
+   MMAL_BUFFER_HEADER_T *tail;  /**< Next buffer to dequeue (consumer side) */
+   MMAL_BUFFER_HEADER_T stub;
+   unsigned int parked;         /**< Set while the consumer sleeps on the semaphore */
 };
 
 // Only sanity check if asserts are enabled
@@ -83,15 +98,159 @@ MMAL_QUEUE_T *mmal_queue_create(void)
    mmal_queue_sanity_check(queue, NULL);
    /* gratuitous unlock for coverity */ vcos_mutex_unlock(&queue->lock);
 
+   queue->spsc = MMAL_FALSE;
    return queue;
 }
 
+#ifdef MMAL_QUEUE_HAVE_ATOMICS
+
+/* Number of times the consumer polls an empty queue before parking */
+#ifndef MMAL_QUEUE_SPSC_SPIN_COUNT
+#define MMAL_QUEUE_SPSC_SPIN_COUNT 16
+#endif
+
+#define SPSC_LOAD(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define SPSC_STORE(p,v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+
+/** Create a lock-free single-producer/single-consumer QUEUE */
+MMAL_QUEUE_T *mmal_queue_create_spsc(void)
+{
+   MMAL_QUEUE_T *queue = mmal_queue_create();
+   if(!queue) return 0;
+
+   memset(&queue->stub, 0, sizeof(queue->stub));
+   queue->head = queue->tail = &queue->stub;
+   queue->parked = 0;
+   queue->spsc = MMAL_TRUE;
+   return queue;
+}
+
+/** Link a buffer at the end of a lock-free QUEUE. Only ever called by the
+ * producer, or by the consumer when it re-inserts the stub. */
+static void mmal_queue_spsc_push(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer)
+{
+   MMAL_BUFFER_HEADER_T *prev;
+
+   buffer->next = 0;
+   prev = __atomic_exchange_n(&queue->head, buffer, __ATOMIC_ACQ_REL);
+   SPSC_STORE(&prev->next, buffer);
+}
+
+/** Unlink the first buffer of a lock-free QUEUE. Consumer side only. */
+static MMAL_BUFFER_HEADER_T *mmal_queue_spsc_pop(MMAL_QUEUE_T *queue)
+{
+   MMAL_BUFFER_HEADER_T *tail = queue->tail, *next;
+
+   if (!__atomic_load_n(&queue->length, __ATOMIC_SEQ_CST))
+      return NULL;
+
+   next = SPSC_LOAD(&tail->next);
+   if (tail == &queue->stub)
+   {
+      /* The length guarantees the producer has already linked something */
+      while (!next)
+         next = SPSC_LOAD(&tail->next);
+      queue->tail = tail = next;
+      next = SPSC_LOAD(&tail->next);
+   }
+
+   if (!next)
+   {
+      if (tail == SPSC_LOAD(&queue->head))
+         mmal_queue_spsc_push(queue, &queue->stub);
+
+      /* Either we just linked the stub, or the producer is in the middle of
+       * linking a new buffer after this one. Both only take a few cycles. */
+      while (!(next = SPSC_LOAD(&tail->next)))
+         vcos_sleep(0);
+   }
+
+   queue->tail = next;
+   tail->next = 0;
+   __atomic_sub_fetch(&queue->length, 1, __ATOMIC_SEQ_CST);
+   return tail;
+}
+
+/** Wake up the consumer of a lock-free QUEUE if it is asleep */
+static void mmal_queue_spsc_wake(MMAL_QUEUE_T *queue)
+{
+   if (__atomic_load_n(&queue->parked, __ATOMIC_SEQ_CST) &&
+       __atomic_exchange_n(&queue->parked, 0, __ATOMIC_SEQ_CST))
+      vcos_semaphore_post(&queue->semaphore);
+}
+
+/** Wait for a MMAL_BUFFER_HEADER_T from a lock-free QUEUE */
+static MMAL_BUFFER_HEADER_T *mmal_queue_spsc_wait(MMAL_QUEUE_T *queue, MMAL_BOOL_T timed,
+   VCOS_UNSIGNED timeout)
+{
+   MMAL_BUFFER_HEADER_T *buffer;
+   unsigned int spin;
+
+   while (1)
+   {
+      /* Buffers usually come back quickly so spin for a little while before
+       * going through the kernel */
+      for (spin = 0; spin < MMAL_QUEUE_SPSC_SPIN_COUNT; spin++)
+      {
+         buffer = mmal_queue_spsc_pop(queue);
+         if (buffer)
+            return buffer;
+      }
+      if (timed && !timeout)
+         return NULL;
+
+      /* Announce we are going to sleep then check again. The producer checks
+       * the flag after having published its buffer. */
+      __atomic_store_n(&queue->parked, 1, __ATOMIC_SEQ_CST);
+      buffer = mmal_queue_spsc_pop(queue);
+      if (!buffer)
+      {
+         if (!timed)
+         {
+            if (vcos_semaphore_wait(&queue->semaphore) != VCOS_SUCCESS)
+               return NULL;
+            continue;
+         }
+         if (vcos_semaphore_wait_timeout(&queue->semaphore, timeout) == VCOS_SUCCESS)
+            continue;
+         buffer = mmal_queue_spsc_pop(queue);
+      }
+
+      /* We didn't end up sleeping. If the producer has already cleared the
+       * flag then it has also posted the semaphore, so consume that post. */
+      if (!__atomic_exchange_n(&queue->parked, 0, __ATOMIC_SEQ_CST))
+         vcos_semaphore_wait(&queue->semaphore);
+      return buffer;
+   }
+}
+
+#else /* MMAL_QUEUE_HAVE_ATOMICS */
+
+/** Create a lock-free single-producer/single-consumer QUEUE */
+MMAL_QUEUE_T *mmal_queue_create_spsc(void)
+{
+   /* No atomics available so fall back to the locked implementation */
+   return mmal_queue_create();
+}
+
+#endif /* MMAL_QUEUE_HAVE_ATOMICS */
+
 /** Put a MMAL_BUFFER_HEADER_T into a QUEUE */
 void mmal_queue_put(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer)
 {
    vcos_assert(queue && buffer);
    if(!queue || !buffer) return;
 
+#ifdef MMAL_QUEUE_HAVE_ATOMICS
+   if (queue->spsc)
+   {
+      mmal_queue_spsc_push(queue, buffer);
+      __atomic_add_fetch(&queue->length, 1, __ATOMIC_SEQ_CST);
+      mmal_queue_spsc_wake(queue);
+      return;
+   }
+#endif
+
    vcos_mutex_lock(&queue->lock);
    mmal_queue_sanity_check(queue, buffer);
    queue->length++;
@@ -116,6 +275,17 @@ void mmal_queue_put_back(MMAL_QUEUE_T *queue, MMAL_BUFFER_HEADER_T *buffer)
 {
    if(!queue || !buffer) return;
 
+#ifdef MMAL_QUEUE_HAVE_ATOMICS
+   if (queue->spsc)
+   {
+      /* Only the consumer puts buffers back, and it owns the tail */
+      buffer->next = queue->tail;
+      queue->tail = buffer;
+      __atomic_add_fetch(&queue->length, 1, __ATOMIC_SEQ_CST);
+      return;
+   }
+#endif
+
    vcos_mutex_lock(&queue->lock);
    mmal_queue_sanity_check(queue, buffer);
    queue->length++;
@@ -152,6 +322,11 @@ MMAL_BUFFER_HEADER_T *mmal_queue_get(MMAL_QUEUE_T *queue)
    vcos_assert(queue);
    if(!queue) return 0;
 
+#ifdef MMAL_QUEUE_HAVE_ATOMICS
+   if (queue->spsc)
+      return mmal_queue_spsc_pop(queue);
+#endif
+
    if(vcos_semaphore_trywait(&queue->semaphore) != VCOS_SUCCESS)
        return NULL;
 
@@ -163,6 +338,11 @@ MMAL_BUFFER_HEADER_T *mmal_queue_wait(MMAL_QUEUE_T *queue)
 {
 	if(!queue) return 0;
 
+#ifdef MMAL_QUEUE_HAVE_ATOMICS
+   if (queue->spsc)
+      return mmal_queue_spsc_wait(queue, MMAL_FALSE, 0);
+#endif
+
    if (vcos_semaphore_wait(&queue->semaphore) != VCOS_SUCCESS)
        return NULL;
 
@@ -174,6 +354,11 @@ MMAL_BUFFER_HEADER_T *mmal_queue_timedwait(MMAL_QUEUE_T *queue, VCOS_UNSIGNED ti
     if (!queue)
         return NULL;
 
+#ifdef MMAL_QUEUE_HAVE_ATOMICS
+    if (queue->spsc)
+        return mmal_queue_spsc_wait(queue, MMAL_TRUE, timeout);
+#endif
+
     if (vcos_semaphore_wait_timeout(&queue->semaphore, timeout) != VCOS_SUCCESS)
         return NULL;
 
@@ -185,6 +370,11 @@ unsigned int mmal_queue_length(MMAL_QUEUE_T *queue)
 {
 	if(!queue) return 0;
 
+#ifdef MMAL_QUEUE_HAVE_ATOMICS
+	if (queue->spsc)
+		return __atomic_load_n(&queue->length, __ATOMIC_ACQUIRE);
+#endif
+
 	return queue->length;
 }
 
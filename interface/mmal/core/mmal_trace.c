@@ -0,0 +1,259 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "mmal.h"
+#include "mmal_trace.h"
+#include "mmal_logging.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef MMAL_TRACE
+
+#ifndef __GNUC__
+#error "MMAL_TRACE relies on compiler atomics"
+#endif
+
+/* Number of events kept per thread, must be a power of 2 */
+#ifndef MMAL_TRACE_RING_SIZE
+#define MMAL_TRACE_RING_SIZE 8192
+#endif
+#define MMAL_TRACE_NAME_LENGTH 48
+
+/** Recorded event */
+typedef struct
+{
+   uint32_t seq;          /**< Index of the event + 1 once written, 0 while it is being written */
+   uint32_t event;        /**< MMAL_TRACE_EVENT_T */
+   uint32_t flags;        /**< Buffer flags */
+   int64_t pts;           /**< Buffer pts */
+   int64_t time;          /**< Time of the event (us) */
+   const void *buffer;    /**< Buffer header, used to match sends and callbacks */
+   char name[MMAL_TRACE_NAME_LENGTH]; /**< Port or component name, truncated */
+} MMAL_TRACE_ENTRY_T;
+
+/** Events recorded by one thread. Only that thread writes to it. */
+typedef struct MMAL_TRACE_RING_T
+{
+   struct MMAL_TRACE_RING_T *next;
+   unsigned int tid;      /**< Thread index used in the trace */
+   char thread_name[32];
+   uint32_t count;        /**< Number of events recorded so far */
+   MMAL_TRACE_ENTRY_T entry[MMAL_TRACE_RING_SIZE];
+} MMAL_TRACE_RING_T;
+
+static VCOS_ONCE_T mmal_trace_once = VCOS_ONCE_INIT;
+static VCOS_TLS_KEY_T mmal_trace_key;
+static MMAL_BOOL_T mmal_trace_ready;
+/* Rings of all the threads which recorded events. Rings are never freed, so the
+ * events of threads which have exited can still be dumped. */
+static MMAL_TRACE_RING_T *mmal_trace_rings;
+static unsigned int mmal_trace_tid;
+static const char *mmal_trace_exit_file;
+
+static void mmal_trace_atexit(void)
+{
+   if (mmal_trace_dump(mmal_trace_exit_file) != MMAL_SUCCESS)
+      LOG_ERROR("could not write trace to %s", mmal_trace_exit_file);
+}
+
+static void mmal_trace_init(void)
+{
+   if (vcos_tls_create(&mmal_trace_key) != VCOS_SUCCESS)
+      return;
+   mmal_trace_ready = MMAL_TRUE;
+
+   mmal_trace_exit_file = getenv("MMAL_TRACE_FILE");
+   if (mmal_trace_exit_file && *mmal_trace_exit_file)
+      atexit(mmal_trace_atexit);
+}
+
+/** Get the ring of the calling thread, creating it on first use */
+static MMAL_TRACE_RING_T *mmal_trace_ring(void)
+{
+   MMAL_TRACE_RING_T *ring;
+   const char *name;
+
+   vcos_once(&mmal_trace_once, mmal_trace_init);
+   if (!mmal_trace_ready)
+      return NULL;
+
+   ring = vcos_tls_get(mmal_trace_key);
+   if (ring)
+      return ring;
+
+   ring = vcos_calloc(1, sizeof(*ring), "mmal trace");
+   if (!ring)
+      return NULL;
+   ring->tid = __atomic_add_fetch(&mmal_trace_tid, 1, __ATOMIC_RELAXED);
+   name = vcos_thread_get_name(vcos_thread_current());
+   if (name && *name)
+      vcos_safe_strcpy(ring->thread_name, name, sizeof(ring->thread_name), 0);
+   else
+      snprintf(ring->thread_name, sizeof(ring->thread_name), "thread %u", ring->tid);
+   vcos_tls_set(mmal_trace_key, ring);
+
+   ring->next = __atomic_load_n(&mmal_trace_rings, __ATOMIC_RELAXED);
+   while (!__atomic_compare_exchange_n(&mmal_trace_rings, &ring->next, ring, 1,
+                                       __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+      continue;
+   return ring;
+}
+
+void mmal_trace_event(MMAL_TRACE_EVENT_T event, const char *name, const MMAL_BUFFER_HEADER_T *buffer)
+{
+   MMAL_TRACE_RING_T *ring = mmal_trace_ring();
+   MMAL_TRACE_ENTRY_T *entry;
+   uint32_t index;
+
+   if (!ring)
+      return;
+
+   index = ring->count;
+   entry = &ring->entry[index & (MMAL_TRACE_RING_SIZE - 1)];
+
+   /* The entry is marked invalid while it is being rewritten, see mmal_trace_dump */
+   __atomic_store_n(&entry->seq, 0, __ATOMIC_RELAXED);
+   __atomic_thread_fence(__ATOMIC_RELEASE);
+
+   entry->event = event;
+   entry->time = vcos_getmicrosecs64();
+   entry->buffer = buffer;
+   entry->flags = buffer ? buffer->flags : 0;
+   entry->pts = buffer ? buffer->pts : MMAL_TIME_UNKNOWN;
+   vcos_safe_strcpy(entry->name, name ? name : "", sizeof(entry->name), 0);
+
+   __atomic_store_n(&entry->seq, index + 1, __ATOMIC_RELEASE);
+   __atomic_store_n(&ring->count, index + 1, __ATOMIC_RELEASE);
+}
+
+/** Write a string as a JSON string, replacing anything that would need escaping */
+static void mmal_trace_write_string(FILE *file, const char *str)
+{
+   fputc('"', file);
+   for (; *str; str++)
+      fputc(*str == '"' || *str == '\\' || (unsigned char)*str < 0x20 ? '?' : *str, file);
+   fputc('"', file);
+}
+
+static void mmal_trace_write_entry(FILE *file, const MMAL_TRACE_RING_T *ring,
+                                   const MMAL_TRACE_ENTRY_T *entry)
+{
+   const char *phase, *cat;
+
+   switch (entry->event)
+   {
+   case MMAL_TRACE_EVENT_SEND: phase = "b"; cat = "buffer"; break;
+   case MMAL_TRACE_EVENT_CALLBACK: phase = "e"; cat = "buffer"; break;
+   case MMAL_TRACE_EVENT_CONNECTION: phase = "i"; cat = "connection"; break;
+   case MMAL_TRACE_EVENT_ACTION_BEGIN: phase = "B"; cat = "action"; break;
+   default: phase = "E"; cat = "action"; break;
+   }
+
+   fprintf(file, ",\n{\"name\":");
+   mmal_trace_write_string(file, entry->name);
+   fprintf(file, ",\"cat\":\"%s\",\"ph\":\"%s\",\"ts\":%" PRIi64 ",\"pid\":1,\"tid\":%u",
+           cat, phase, entry->time, ring->tid);
+   if (entry->event == MMAL_TRACE_EVENT_CONNECTION)
+      fprintf(file, ",\"s\":\"t\"");
+   if (entry->buffer)
+   {
+      /* Async slices are matched on their id, one slice per buffer header and port */
+      fprintf(file, ",\"id\":\"%p\",\"args\":{\"buffer\":\"%p\",\"flags\":\"0x%x\"",
+              entry->buffer, entry->buffer, entry->flags);
+      if (entry->pts != MMAL_TIME_UNKNOWN)
+         fprintf(file, ",\"pts\":%" PRIi64, entry->pts);
+      fprintf(file, "}");
+   }
+   fprintf(file, "}");
+}
+
+MMAL_STATUS_T mmal_trace_dump(const char *filename)
+{
+   MMAL_TRACE_RING_T *ring;
+   FILE *file;
+   int error;
+
+   if (!filename)
+      return MMAL_EINVAL;
+   file = fopen(filename, "w");
+   if (!file)
+      return MMAL_EIO;
+
+   fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+           "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"mmal\"}}");
+
+   for (ring = __atomic_load_n(&mmal_trace_rings, __ATOMIC_ACQUIRE); ring; ring = ring->next)
+   {
+      uint32_t count = __atomic_load_n(&ring->count, __ATOMIC_ACQUIRE);
+      uint32_t index = count > MMAL_TRACE_RING_SIZE ? count - MMAL_TRACE_RING_SIZE : 0;
+
+      fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", ring->tid);
+      mmal_trace_write_string(file, ring->thread_name);
+      fprintf(file, "}}");
+
+      for (; index != count; index++)
+      {
+         const MMAL_TRACE_ENTRY_T *src = &ring->entry[index & (MMAL_TRACE_RING_SIZE - 1)];
+         MMAL_TRACE_ENTRY_T entry;
+
+         /* Skip entries the thread has started overwriting since count was read */
+         if (__atomic_load_n(&src->seq, __ATOMIC_ACQUIRE) != index + 1)
+            continue;
+         entry = *src;
+         __atomic_thread_fence(__ATOMIC_ACQUIRE);
+         if (__atomic_load_n(&src->seq, __ATOMIC_RELAXED) != index + 1)
+            continue;
+         entry.name[sizeof(entry.name) - 1] = 0;
+
+         mmal_trace_write_entry(file, ring, &entry);
+      }
+   }
+
+   fprintf(file, "\n]}\n");
+   error = ferror(file);
+   if (fclose(file) || error)
+      return MMAL_EIO;
+   return MMAL_SUCCESS;
+}
+
+#else /* MMAL_TRACE */
+
+void mmal_trace_event(MMAL_TRACE_EVENT_T event, const char *name, const MMAL_BUFFER_HEADER_T *buffer)
+{
+   MMAL_PARAM_UNUSED(event);
+   MMAL_PARAM_UNUSED(name);
+   MMAL_PARAM_UNUSED(buffer);
+}
+
+MMAL_STATUS_T mmal_trace_dump(const char *filename)
+{
+   MMAL_PARAM_UNUSED(filename);
+   return MMAL_ENOSYS;
+}
+
+#endif /* MMAL_TRACE */
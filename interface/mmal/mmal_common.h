@@ -77,6 +77,31 @@ typedef struct MMAL_CORE_PORT_STATISTICS_T
    MMAL_CORE_STATISTICS_T tx;
 } MMAL_CORE_PORT_STATISTICS_T;
 
+/** Number of buckets in a \ref MMAL_CORE_HISTOGRAM_T */
+#define MMAL_CORE_HISTOGRAM_BUCKETS 32
+
+/** Histogram of durations in log2 buckets.
+ * Bucket 0 counts durations of 0us and bucket i counts durations from 2^(i-1) to
+ * 2^i - 1 us. The last bucket also counts anything longer.
+ */
+typedef struct MMAL_CORE_HISTOGRAM_T
+{
+   uint32_t count;               /**< Number of durations recorded */
+   uint32_t max;                 /**< Longest duration (us) */
+   uint32_t bucket[MMAL_CORE_HISTOGRAM_BUCKETS]; /**< Number of durations in each bucket */
+} MMAL_CORE_HISTOGRAM_T;
+
+/** Latency histograms collected by the core on all ports.
+ */
+typedef struct MMAL_CORE_PORT_HISTOGRAMS_T
+{
+   MMAL_CORE_HISTOGRAM_T rx_interval; /**< Time between buffers sent to the port */
+   MMAL_CORE_HISTOGRAM_T tx_interval; /**< Time between buffers returned by the port */
+   MMAL_CORE_HISTOGRAM_T residency;   /**< Time from a buffer being sent to the port until it is returned */
+   uint32_t rx_errors;                /**< Buffers sent to the port which it failed to take. These
+                                           are left out of the other statistics. */
+} MMAL_CORE_PORT_HISTOGRAMS_T;
+
 /** Unsigned 16.16 fixed point value, also known as Q16.16 */
 typedef uint32_t MMAL_FIXED_16_16_T;
 
@@ -0,0 +1,96 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+#ifndef MMAL_EXECUTOR_H
+#define MMAL_EXECUTOR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \defgroup MmalExecutor Shared executor for component actions
+ * By default each component which registers an action gets its own thread to
+ * run it. A graph of software components therefore uses many threads which
+ * spend most of their time waking each other up.
+ *
+ * Once the executor is enabled, the actions of components created from then on
+ * are posted as tasks to a process-wide pool of worker threads instead. Each
+ * worker has its own deques of tasks and takes work from the other workers when
+ * it runs out. The guarantees of the dedicated threads are kept: an action never
+ * runs concurrently with itself, a trigger while it runs makes it run again, and
+ * \ref mmal_component_action_lock still prevents it from running. Components
+ * with a thread priority above normal have their actions run before the others,
+ * and those below normal after them.
+ *
+ * Actions should not block for long when the executor is in use, since a
+ * blocked action holds on to a worker thread.
+ *
+ * The executor is also enabled when the core is first initialised if the
+ * MMAL_EXECUTOR_THREADS environment variable is set, with its value as the
+ * number of threads.
+ */
+/* @{ */
+
+#include "mmal_types.h"
+
+/** Executor statistics */
+typedef struct MMAL_EXECUTOR_STATS_T
+{
+   uint32_t threads;        /**< Number of worker threads */
+   uint32_t tasks;          /**< Number of actions currently attached to the executor */
+   uint64_t runs;           /**< Number of times an action was run */
+   uint64_t steals;         /**< Number of actions taken from another worker */
+   uint64_t wakeups;        /**< Number of times a worker went to sleep and was woken up */
+} MMAL_EXECUTOR_STATS_T;
+
+/** Enable the shared executor.
+ * Only actions registered after this call run on the executor.
+ *
+ * @param threads Number of worker threads, 0 for one per CPU core
+ * @return MMAL_SUCCESS, MMAL_EINVAL if already enabled or MMAL_ENOMEM
+ */
+MMAL_STATUS_T mmal_executor_enable(unsigned int threads);
+
+/** Disable the shared executor and stop its worker threads.
+ *
+ * @return MMAL_SUCCESS, or MMAL_EINVAL if actions are still attached to it
+ */
+MMAL_STATUS_T mmal_executor_disable(void);
+
+/** Get the executor statistics.
+ *
+ * @param stats Returned statistics
+ * @return MMAL_SUCCESS, or MMAL_EINVAL if the executor is not enabled
+ */
+MMAL_STATUS_T mmal_executor_get_stats(MMAL_EXECUTOR_STATS_T *stats);
+
+/* @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MMAL_EXECUTOR_H */
@@ -74,7 +74,9 @@ enum {
    MMAL_PARAMETER_LOGGING,                /**< Takes a MMAL_PARAMETER_LOGGING_T */
    MMAL_PARAMETER_SYSTEM_TIME,            /**< Takes a MMAL_PARAMETER_UINT64_T */
    MMAL_PARAMETER_NO_IMAGE_PADDING,       /**< Takes a MMAL_PARAMETER_BOOLEAN_T */
-   MMAL_PARAMETER_LOCKSTEP_ENABLE         /**< Takes a MMAL_PARAMETER_BOOLEAN_T */
+   MMAL_PARAMETER_LOCKSTEP_ENABLE,        /**< Takes a MMAL_PARAMETER_BOOLEAN_T */
+   MMAL_PARAMETER_CORE_HISTOGRAMS,        /**< Takes a MMAL_PARAMETER_CORE_HISTOGRAMS_T */
+   MMAL_PARAMETER_OUTPUT_POLICY,          /**< Takes a MMAL_PARAMETER_OUTPUT_POLICY_T */
 };
 
 /**@}*/
@@ -167,6 +169,42 @@ typedef struct MMAL_PARAMETER_CORE_STATISTICS_T
    MMAL_CORE_STATISTICS_T stats;    /**< The statistics */
 } MMAL_PARAMETER_CORE_STATISTICS_T;
 
+/** MMAL core latency histograms. These are collected by the core itself on
+ * the host side, so they are never forwarded to the component. They are only
+ * available when the core is built with MMAL_COLLECT_PORT_STATS.
+ */
+typedef struct MMAL_PARAMETER_CORE_HISTOGRAMS_T
+{
+   MMAL_PARAMETER_HEADER_T hdr;
+   MMAL_BOOL_T reset;                        /**< Reset to zero after reading */
+   MMAL_CORE_PORT_HISTOGRAMS_T histograms;   /**< The histograms */
+} MMAL_PARAMETER_CORE_HISTOGRAMS_T;
+
+/** What to do with a frame when an output port has no buffer to take it.
+ */
+typedef enum
+{
+   MMAL_OUTPUT_POLICY_BLOCK,        /**< Wait for a buffer, holding up the input and the other outputs */
+   MMAL_OUTPUT_POLICY_DROP,         /**< Drop the frame for this output */
+   MMAL_OUTPUT_POLICY_KEEP_LATEST,  /**< Keep the latest frame and send it as soon as a buffer is available */
+   MMAL_OUTPUT_POLICY_MAX = 0x7fffffff /* Force 32 bit size for this enum */
+} MMAL_OUTPUT_POLICY_T;
+
+/** Output port policy. Lets an output which can't keep up lose frames instead of
+ * stalling the other outputs of the component, and limits the frames it is given.
+ * Frames dropped because of the policy are counted as discarded in the port
+ * \ref MMAL_PARAMETER_STATISTICS_T, frames left out by the decimation or the
+ * frame rate limit are not.
+ */
+typedef struct MMAL_PARAMETER_OUTPUT_POLICY_T
+{
+   MMAL_PARAMETER_HEADER_T hdr;
+
+   MMAL_OUTPUT_POLICY_T policy;     /**< What to do when the port has no buffer */
+   uint32_t decimation;             /**< Only pass on one frame out of this many, 0 or 1 for all */
+   MMAL_RATIONAL_T max_frame_rate;  /**< Pass on at most this many frames per second, 0 for no limit */
+} MMAL_PARAMETER_OUTPUT_POLICY_T;
+
 /**
  * Component memory usage statistics.
  */
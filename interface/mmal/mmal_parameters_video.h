@@ -107,6 +107,7 @@ enum {
    MMAL_PARAMETER_VIDEO_STALL_THRESHOLD,           /**< Take a @ref MMAL_PARAMETER_VIDEO_STALL_T */
    MMAL_PARAMETER_VIDEO_ENCODE_HEADERS_WITH_FRAME, /**< Take a @ref MMAL_PARAMETER_BOOLEAN_T */
    MMAL_PARAMETER_VIDEO_VALIDATE_TIMESTAMPS,       /**< Take a @ref MMAL_PARAMETER_BOOLEAN_T */
+   MMAL_PARAMETER_VIDEO_SOURCE_TIMING,             /**< Take a @ref MMAL_PARAMETER_VIDEO_SOURCE_TIMING_T */
 };
 
 /** Display transformations.
@@ -527,6 +528,18 @@ typedef struct MMAL_PARAMETER_VIDEO_SOURCE_PATTERN_T {
    MMAL_RATIONAL_T framerate;                   /**< Framerate used when determining buffer timestamps */
 } MMAL_PARAMETER_VIDEO_SOURCE_PATTERN_T;
 
+/** Irregularities in the delivery of frames by a synthetic source.
+ * The timestamps of the frames stay on the nominal frame rate, as they would
+ * for a sensor, only the time at which they are delivered is affected.
+ */
+typedef struct MMAL_PARAMETER_VIDEO_SOURCE_TIMING_T {
+   MMAL_PARAMETER_HEADER_T hdr;
+
+   uint32_t jitter;                             /**< Maximum random delivery offset of a frame, in microseconds */
+   uint32_t burst_interval;                     /**< Number of frames between bursts. 0 for no bursts. */
+   uint32_t burst_length;                       /**< Number of frames held back then delivered together in a burst */
+} MMAL_PARAMETER_VIDEO_SOURCE_TIMING_T;
+
 typedef struct MMAL_PARAMETER_VIDEO_STALL_T {
    MMAL_PARAMETER_HEADER_T hdr;
 
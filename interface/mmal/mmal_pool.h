@@ -102,6 +102,43 @@ MMAL_POOL_T *mmal_pool_create_with_allocator(unsigned int headers, uint32_t payl
                               void *allocator_context, mmal_pool_allocator_alloc_t allocator_alloc,
                               mmal_pool_allocator_free_t allocator_free);
 
+/** Flags for \ref mmal_pool_create_arena */
+#define MMAL_POOL_ARENA_FLAG_MEMFD     0x1 /**< Back the arena with a memfd, see \ref mmal_pool_arena_fd */
+#define MMAL_POOL_ARENA_FLAG_HUGEPAGES 0x2 /**< Ask for transparent huge pages for the arena */
+
+/** Create a pool of MMAL_BUFFER_HEADER_T with all the payloads in a single arena.
+ * Rather than allocating each payload separately, the payloads are carved out of
+ * one contiguous block of memory, each starting on the given alignment (e.g. 64 for
+ * SIMD code or 4096 for O_DIRECT I/O). \ref mmal_pool_resize keeps using the same
+ * arena as long as the new payloads fit in it.
+ * With \ref MMAL_POOL_ARENA_FLAG_MEMFD the arena is a shared mapping of a memfd, so
+ * the payloads can be handed to another process or to vmsplice()/sendfile() without
+ * being copied. The alignment then can't be larger than a page.
+ * @param headers      Number of buffer headers to be allocated with the pool.
+ * @param payload_size Size of the payload buffer of each of the buffer headers.
+ * @param alignment    Alignment of the payloads, a power of 2, or 0 for the default.
+ * @param flags        Combination of MMAL_POOL_ARENA_FLAG_* values.
+ * @return Pointer to the newly created pool or NULL on failure.
+ */
+MMAL_POOL_T *mmal_pool_create_arena(unsigned int headers, uint32_t payload_size,
+                                    uint32_t alignment, uint32_t flags);
+
+/** Get the memfd backing the arena of a pool.
+ * The file descriptor belongs to the pool and is closed when the pool is destroyed,
+ * or replaced when it is resized beyond the size of the arena.
+ * @param pool Pointer to a pool created with \ref MMAL_POOL_ARENA_FLAG_MEMFD
+ * @return The file descriptor, or -1 if the pool has no memfd.
+ */
+int mmal_pool_arena_fd(MMAL_POOL_T *pool);
+
+/** Get the offset of the payload of a buffer header in the arena of its pool.
+ * Together with \ref mmal_pool_arena_fd this locates the payload in the memfd.
+ * @param pool   Pointer to a pool created with \ref mmal_pool_create_arena
+ * @param header Buffer header from that pool
+ * @return The offset in bytes, or -1 if the payload is not part of the arena.
+ */
+int64_t mmal_pool_arena_offset(MMAL_POOL_T *pool, const MMAL_BUFFER_HEADER_T *header);
+
 /** Destroy a pool of MMAL_BUFFER_HEADER_T.
  * This will also deallocate all of the memory which was allocated when creating or
  * resizing the pool.
@@ -116,7 +153,8 @@ void mmal_pool_destroy(MMAL_POOL_T *pool);
 
 /** Resize a pool of MMAL_BUFFER_HEADER_T.
  * This allows modifying either the number of allocated buffers, the payload size or both at the
- * same time.
+ * same time. All the buffer headers must have been returned to the pool. If the new buffer
+ * headers or payloads can't be allocated, the pool is left unchanged.
  *
  * @param pool         Pointer to the pool
  * @param headers      New number of buffer headers to be allocated in the pool.
@@ -190,6 +190,21 @@ MMAL_STATUS_T mmal_port_flush(MMAL_PORT_T *port);
 MMAL_STATUS_T mmal_port_parameter_set(MMAL_PORT_T *port,
    const MMAL_PARAMETER_HEADER_T *param);
 
+/** Set several parameters on a port.
+ * This is equivalent to calling \ref mmal_port_parameter_set for each of the
+ * parameters in turn, but the port is only locked once and components which
+ * support it can have several requests in flight at the same time.
+ * The parameters are applied in order. When one fails, the following ones are
+ * not sent, although some may already have been applied.
+ *
+ * @param port The port to which the requests are sent.
+ * @param params Array of pointers to the headers of the parameters to set.
+ * @param num Number of parameters in the array.
+ * @return MMAL_SUCCESS or the status of the first parameter which failed
+ */
+MMAL_STATUS_T mmal_port_parameters_set(MMAL_PORT_T *port,
+   const MMAL_PARAMETER_HEADER_T *const *params, unsigned int num);
+
 /** Get a parameter from a port.
  * The size field must be set on input to the maximum size of the parameter
  * (including the header) and will be set on output to the actual size of the
@@ -216,6 +231,22 @@ MMAL_STATUS_T mmal_port_parameter_get(MMAL_PORT_T *port,
 MMAL_STATUS_T mmal_port_send_buffer(MMAL_PORT_T *port,
    MMAL_BUFFER_HEADER_T *buffer);
 
+/** Send several buffer headers to a port at once.
+ * This is equivalent to calling \ref mmal_port_send_buffer for each of the
+ * buffer headers in turn, but the port locking and accounting is only done
+ * once, and components which support it receive all the buffer headers in a
+ * single call.
+ *
+ * @param port The port to which the buffer headers are to be sent.
+ * @param buffers Array of buffer headers to send.
+ * @param count On input, the number of buffer headers in the array. On output,
+ * the number of buffer headers which were sent. Buffer headers which weren't
+ * sent are still owned by the caller.
+ * @return MMAL_SUCCESS if all the buffer headers were sent
+ */
+MMAL_STATUS_T mmal_port_send_buffers(MMAL_PORT_T *port,
+   MMAL_BUFFER_HEADER_T **buffers, unsigned int *count);
+
 /** Connect an output port to an input port.
  *
  * When connected and enabled, buffers will automatically progress from the
@@ -48,6 +48,19 @@ typedef struct MMAL_QUEUE_T MMAL_QUEUE_T;
  */
 MMAL_QUEUE_T *mmal_queue_create(void);
 
+/** Create a lock-free queue of MMAL_BUFFER_HEADER_T for a single producer and
+ * a single consumer.
+ * The queue has the same API as the one returned by \ref mmal_queue_create but
+ * puts and gets don't take any lock, and the consumer is only signalled when it
+ * is actually blocked in \ref mmal_queue_wait or \ref mmal_queue_timedwait.
+ * Only one thread may put buffers into the queue and only one (possibly different)
+ * thread may get buffers from it. \ref mmal_queue_put_back may only be called by
+ * the consumer.
+ *
+ * @return Pointer to the newly created queue or NULL on failure.
+ */
+MMAL_QUEUE_T *mmal_queue_create_spsc(void);
+
 /** Put a MMAL_BUFFER_HEADER_T into a queue
  *
  * @param queue  Pointer to a queue
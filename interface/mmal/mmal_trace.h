@@ -0,0 +1,99 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MMAL_TRACE_H
+#define MMAL_TRACE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \defgroup MmalTrace Pipeline tracing
+ * When MMAL is built with MMAL_TRACE defined (cmake -DMMAL_TRACE=ON), the core
+ * records an event each time a buffer header is sent to a port, returned by a
+ * port or passed on by a connection, and each time a component action runs.
+ * Events are kept in a ring buffer per thread, so recording never takes a lock,
+ * and the oldest events are overwritten once a ring is full.
+ *
+ * The events are written out as Chrome trace JSON, which can be loaded in
+ * chrome://tracing or Perfetto. Each buffer header shows up as an async slice
+ * on the port it was sent to, from the send until it is returned.
+ * They are written on demand with \ref mmal_trace_dump, and at exit to the
+ * file named by the MMAL_TRACE_FILE environment variable if it is set.
+ *
+ * Without MMAL_TRACE nothing is recorded and \ref mmal_trace_dump returns MMAL_ENOSYS.
+ */
+/* @{ */
+
+#include "mmal_types.h"
+#include "mmal_port.h"
+#include "mmal_buffer.h"
+
+/** Type of a traced event */
+typedef enum
+{
+   MMAL_TRACE_EVENT_SEND,            /**< Buffer header sent to a port */
+   MMAL_TRACE_EVENT_CALLBACK,        /**< Buffer header returned by a port */
+   MMAL_TRACE_EVENT_CONNECTION,      /**< Buffer header passed on by a connection */
+   MMAL_TRACE_EVENT_ACTION_BEGIN,    /**< Component action started */
+   MMAL_TRACE_EVENT_ACTION_END,      /**< Component action done */
+} MMAL_TRACE_EVENT_T;
+
+/** Record an event in the ring buffer of the calling thread.
+ * This is normally called through the MMAL_TRACE_* macros below, which
+ * compile to nothing unless MMAL_TRACE is defined.
+ *
+ * @param event  Type of event
+ * @param name   Port or component name
+ * @param buffer Buffer header concerned, or NULL
+ */
+void mmal_trace_event(MMAL_TRACE_EVENT_T event, const char *name, const MMAL_BUFFER_HEADER_T *buffer);
+
+/** Write the recorded events as Chrome trace JSON.
+ * Events keep being recorded while the file is written. Events being overwritten
+ * at the same time are skipped.
+ *
+ * @param filename File to write
+ * @return MMAL_SUCCESS, MMAL_ENOSYS if tracing is not built in, or an error
+ */
+MMAL_STATUS_T mmal_trace_dump(const char *filename);
+
+#ifdef MMAL_TRACE
+#define MMAL_TRACE_PORT(event, port, buffer) mmal_trace_event(event, (port)->name, buffer)
+#define MMAL_TRACE_COMPONENT(event, component) mmal_trace_event(event, (component)->name, NULL)
+#else
+#define MMAL_TRACE_PORT(event, port, buffer)
+#define MMAL_TRACE_COMPONENT(event, component)
+#endif
+
+/* @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MMAL_TRACE_H */
@@ -0,0 +1,641 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Throughput and latency harness for graphs of software components.
+ *
+ * The graph is given as a chain of component names separated by commas. The
+ * first component is the source and each following one is connected to the
+ * first output of the previous one. A component followed by *N has its first
+ * N outputs connected, each to its own copy of the rest of the chain, and one
+ * followed by =URI has the URI set on its control port. A source given a URI
+ * keeps the format of the stream it reads. For instance:
+ *
+ *    mmal_bench artificial_camera,splitter*2,copy,null_sink
+ *    mmal_bench container_reader=clip.wav,copy,container_writer=out.bin
+ *
+ * The graph runs for a warm-up period, then is measured for the given
+ * duration or until all the sinks have signalled the end of the stream,
+ * whichever comes first. A source reading a URI is rewound to the start
+ * whenever the stream ends instead, so that clips shorter than the run are
+ * looped. The report gives the frames produced by the source
+ * per second, the CPU time and heap allocations per frame, and the
+ * percentiles of the time buffers spend in each input port, taken from the
+ * latency histograms collected by the core. As those are log2 histograms, percentiles are the
+ * upper bounds of the buckets they fall into. The core only collects them when
+ * built with MMAL_COLLECT_PORT_STATS (cmake -DMMAL_COLLECT_PORT_STATS=ON).
+ *
+ * Usage: mmal_bench [-d seconds] [-s WxH] [-r fps] [-p pattern] [-b buffers]
+ *                   [-e threads] [-j file] [graph]
+ */
+
+#include "mmal.h"
+#include "mmal_executor.h"
+#include "util/mmal_util.h"
+#include "util/mmal_util_params.h"
+#include "util/mmal_graph.h"
+#include "interface/vcos/vcos.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#define DEFAULT_GRAPH "artificial_camera,splitter*2,copy,null_sink"
+#define DEFAULT_DURATION 5
+#define DEFAULT_WIDTH 640
+#define DEFAULT_HEIGHT 480
+#define DEFAULT_BUFFERS 3
+#define WARMUP_MS 500
+#define BENCH_ELEMENTS_MAX 16
+#define BENCH_HOPS_MAX 64
+
+/* Count the heap allocations of the whole process by wrapping the allocator
+ * of the C library. This relies on the glibc internal entry points. */
+#if defined(__GLIBC__) && defined(__GNUC__)
+#define BENCH_COUNT_ALLOCATIONS 1
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long bench_allocations;
+
+void *malloc(size_t size)
+{
+   __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED);
+   return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+   __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED);
+   return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+   __atomic_fetch_add(&bench_allocations, 1, __ATOMIC_RELAXED);
+   return __libc_realloc(ptr, size);
+}
+
+static unsigned long bench_allocations_get(void)
+{
+   return __atomic_load_n(&bench_allocations, __ATOMIC_RELAXED);
+}
+#else
+static unsigned long bench_allocations_get(void)
+{
+   return 0;
+}
+#endif
+
+typedef struct BENCH_OPTIONS_T
+{
+   const char *graph;
+   unsigned int duration;     /**< seconds */
+   unsigned int width;
+   unsigned int height;
+   unsigned int frame_rate;   /**< 0 for as fast as possible */
+   int pattern;               /**< -1 to leave the default pattern */
+   unsigned int buffers;      /**< buffers on each connection */
+   int executor_threads;      /**< -1 for dedicated action threads */
+   const char *json;          /**< JSON report, "-" for stdout */
+} BENCH_OPTIONS_T;
+
+typedef struct BENCH_HOP_T
+{
+   MMAL_PORT_T *port;
+   MMAL_CORE_HISTOGRAM_T residency;
+} BENCH_HOP_T;
+
+typedef struct BENCH_T
+{
+   const BENCH_OPTIONS_T *options;
+   MMAL_GRAPH_T *graph;
+   MMAL_PORT_T *source;
+   uint32_t buffer_size;      /**< size of the buffers of the source */
+   BENCH_HOP_T hop[BENCH_HOPS_MAX];
+   unsigned int hops_num;
+   MMAL_PORT_T *clock[BENCH_HOPS_MAX];
+   unsigned int clocks_num;
+   unsigned int sinks_num;
+   unsigned int eos_num;      /**< sinks at the end of the stream, updated atomically */
+   MMAL_BOOL_T rewind;        /**< the source reads a URI and is rewound at the end */
+   uint32_t rewind_frames;    /**< frames sent by the source when it was last rewound */
+   VCOS_SEMAPHORE_T done;     /**< posted on error or once all the sinks got EOS */
+   MMAL_STATUS_T error;
+   MMAL_BOOL_T no_histograms; /**< the core was built without MMAL_COLLECT_PORT_STATS */
+
+   /* Results */
+   double seconds;
+   uint32_t frames;
+   unsigned int loops;        /**< times the source was rewound during the measurement */
+   uint64_t cpu_time;
+   unsigned long allocations;
+} BENCH_T;
+
+static const struct {
+   const char *name;
+   MMAL_SOURCE_PATTERN_T pattern;
+} bench_patterns[] = {
+   {"white", MMAL_VIDEO_SOURCE_PATTERN_WHITE},
+   {"black", MMAL_VIDEO_SOURCE_PATTERN_BLACK},
+   {"diagonal", MMAL_VIDEO_SOURCE_PATTERN_DIAGONAL},
+   {"noise", MMAL_VIDEO_SOURCE_PATTERN_NOISE},
+   {"random", MMAL_VIDEO_SOURCE_PATTERN_RANDOM},
+   {"bars", MMAL_VIDEO_SOURCE_PATTERN_BLOCKS},
+};
+
+static uint64_t bench_cpu_time(void)
+{
+   struct rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage))
+      return 0;
+   return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+      usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+static void bench_event_cb(MMAL_GRAPH_T *graph, MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer, void *cb_data)
+{
+   BENCH_T *bench = (BENCH_T *)cb_data;
+   MMAL_PARAM_UNUSED(graph);
+
+   if (buffer->cmd == MMAL_EVENT_ERROR)
+   {
+      bench->error = *(MMAL_STATUS_T *)buffer->data;
+      fprintf(stderr, "error on %s: %s\n", port->name, mmal_status_to_string(bench->error));
+      vcos_semaphore_post(&bench->done);
+   }
+   else if (buffer->cmd == MMAL_EVENT_EOS)
+   {
+      /* Sinks can run on different threads, and bench_wait() resets the count */
+      if (__atomic_add_fetch(&bench->eos_num, 1, __ATOMIC_ACQ_REL) == bench->sinks_num)
+         vcos_semaphore_post(&bench->done);
+   }
+   mmal_buffer_header_release(buffer);
+}
+
+/** Set up the format of the source, if it is a video one */
+static void bench_configure_source(BENCH_T *bench, MMAL_PORT_T *port)
+{
+   const BENCH_OPTIONS_T *options = bench->options;
+   MMAL_ES_FORMAT_T *format = port->format;
+
+   if (format->type == MMAL_ES_TYPE_VIDEO)
+   {
+      format->es->video.width = VCOS_ALIGN_UP(options->width, 32);
+      format->es->video.height = VCOS_ALIGN_UP(options->height, 16);
+      format->es->video.crop.x = format->es->video.crop.y = 0;
+      format->es->video.crop.width = options->width;
+      format->es->video.crop.height = options->height;
+      format->es->video.frame_rate.num = options->frame_rate;
+      format->es->video.frame_rate.den = 1;
+      if (mmal_port_format_commit(port) != MMAL_SUCCESS)
+         fprintf(stderr, "could not set the format of %s\n", port->name);
+   }
+
+   if (options->pattern >= 0)
+   {
+      MMAL_PARAMETER_VIDEO_SOURCE_PATTERN_T pattern = {{MMAL_PARAMETER_VIDEO_SOURCE_PATTERN, sizeof(pattern)},
+         (MMAL_SOURCE_PATTERN_T)options->pattern, 0, 0, {0, 0}};
+      if (mmal_port_parameter_set(port, &pattern.hdr) != MMAL_SUCCESS)
+         fprintf(stderr, "%s does not support patterns\n", port->name);
+   }
+}
+
+/** Create the components of a chain and connect them after the given output port */
+static MMAL_STATUS_T bench_build(BENCH_T *bench, MMAL_PORT_T *upstream, char **elements,
+   unsigned int elements_num)
+{
+   MMAL_COMPONENT_T *component;
+   MMAL_STATUS_T status;
+   char name[128], *uri, *fanout_str;
+   unsigned int fanout = 1, i;
+
+   /* name[=uri][*fanout] */
+   snprintf(name, sizeof(name), "%s", elements[0]);
+   fanout_str = strrchr(name, '*');
+   if (fanout_str)
+   {
+      *fanout_str++ = 0;
+      fanout = strtoul(fanout_str, NULL, 0);
+   }
+   uri = strchr(name, '=');
+   if (uri)
+      *uri++ = 0;
+
+   status = mmal_graph_new_component(bench->graph, name, &component);
+   if (status != MMAL_SUCCESS)
+   {
+      fprintf(stderr, "could not create %s: %s\n", name, mmal_status_to_string(status));
+      return status;
+   }
+   if (uri)
+   {
+      status = mmal_port_parameter_set_string(component->control, MMAL_PARAMETER_URI, uri);
+      if (status != MMAL_SUCCESS)
+      {
+         fprintf(stderr, "could not open %s: %s\n", uri, mmal_status_to_string(status));
+         return status;
+      }
+   }
+
+   if (!upstream)
+   {
+      if (!component->output_num)
+      {
+         fprintf(stderr, "%s has no output to be a source\n", name);
+         return MMAL_EINVAL;
+      }
+      bench->source = component->output[0];
+      /* The format of a stream read from a URI is the one of the stream */
+      if (!uri)
+         bench_configure_source(bench, bench->source);
+      bench->rewind = uri != NULL;
+      bench->buffer_size = MMAL_MAX(bench->source->buffer_size_min,
+                                    bench->source->buffer_size_recommended);
+   }
+   else
+   {
+      if (!component->input_num || bench->hops_num >= BENCH_HOPS_MAX)
+      {
+         fprintf(stderr, "cannot connect %s\n", name);
+         return MMAL_EINVAL;
+      }
+      status = mmal_graph_new_connection(bench->graph, upstream, component->input[0],
+                                         MMAL_CONNECTION_FLAG_TUNNELLING, NULL);
+      if (status != MMAL_SUCCESS)
+      {
+         fprintf(stderr, "could not connect %s to %s: %s\n", upstream->name,
+                 component->input[0]->name, mmal_status_to_string(status));
+         return status;
+      }
+      bench->hop[bench->hops_num++].port = component->input[0];
+
+      /* Tunnelled connections allocate the larger number and size of buffers
+       * of both ports. Ports which only pass buffers along, like the outputs
+       * of the splitter, don't ask for a size so they are given the size of
+       * the source buffers. */
+      upstream->buffer_num = MMAL_MAX(bench->options->buffers, upstream->buffer_num_min);
+      upstream->buffer_size = MMAL_MAX(bench->buffer_size, upstream->buffer_size_min);
+   }
+
+   /* Components scheduling on a clock of their own, like the scheduler,
+    * only run once their clock is started */
+   if (component->clock_num && bench->clocks_num < BENCH_HOPS_MAX)
+      bench->clock[bench->clocks_num++] = component->clock[0];
+
+   if (elements_num == 1)
+   {
+      bench->sinks_num++;
+      return MMAL_SUCCESS;
+   }
+
+   if (!fanout || fanout > component->output_num)
+   {
+      fprintf(stderr, "%s does not have %u outputs\n", name, fanout);
+      return MMAL_EINVAL;
+   }
+   for (i = 0; i < fanout && status == MMAL_SUCCESS; i++)
+      status = bench_build(bench, component->output[i], elements + 1, elements_num - 1);
+   return status;
+}
+
+/** Frames sent by the source, counted on the input port it feeds as the core
+ * only keeps stats on the buffers returned by a port in some builds */
+static uint32_t bench_source_frames(BENCH_T *bench)
+{
+   MMAL_PARAMETER_CORE_STATISTICS_T stats = {{MMAL_PARAMETER_CORE_STATISTICS, sizeof(stats)},
+      MMAL_CORE_STATS_RX, MMAL_FALSE, {0, 0, 0, 0}};
+
+   if (!bench->hops_num || mmal_port_parameter_get(bench->hop[0].port, &stats.hdr) != MMAL_SUCCESS)
+      return 0;
+   return stats.stats.buffer_count;
+}
+
+static void bench_read_hops(BENCH_T *bench, MMAL_BOOL_T reset)
+{
+   MMAL_CORE_PORT_HISTOGRAMS_T histograms;
+   MMAL_STATUS_T status;
+   unsigned int i;
+
+   for (i = 0; i < bench->hops_num; i++)
+   {
+      status = mmal_util_get_core_port_histograms(bench->hop[i].port, reset, &histograms);
+      if (status == MMAL_SUCCESS)
+         bench->hop[i].residency = histograms.residency;
+      else if (status == MMAL_ENOSYS)
+         bench->no_histograms = MMAL_TRUE;
+   }
+}
+
+/** Upper bound in microseconds of the bucket holding the given percentile */
+static uint32_t bench_percentile(const MMAL_CORE_HISTOGRAM_T *histogram, unsigned int percent)
+{
+   uint64_t target = ((uint64_t)histogram->count * percent + 99) / 100, total = 0;
+   unsigned int i;
+
+   if (!histogram->count)
+      return 0;
+   for (i = 0; i < MMAL_CORE_HISTOGRAM_BUCKETS - 1; i++)
+   {
+      total += histogram->bucket[i];
+      if (total >= target)
+         return MMAL_MIN(i ? (1u << i) - 1 : 0, histogram->max);
+   }
+   return histogram->max;
+}
+
+/** Wait until the given time or until the graph is done, rewinding the
+ * source whenever the stream ends if it reads a URI.
+ * @return MMAL_TRUE if the graph is done (error or end of the stream) */
+static MMAL_BOOL_T bench_wait(BENCH_T *bench, uint64_t deadline, unsigned int *loops)
+{
+   MMAL_PARAMETER_SEEK_T seek = {{MMAL_PARAMETER_SEEK, sizeof(seek)}, 0, 0};
+   uint32_t frames;
+   uint64_t now;
+
+   while ((now = vcos_getmicrosecs64()) < deadline)
+   {
+      if (vcos_semaphore_wait_timeout(&bench->done, (uint32_t)((deadline - now + 999) / 1000)) != VCOS_SUCCESS)
+         return MMAL_FALSE;
+      if (bench->error != MMAL_SUCCESS || !bench->rewind)
+         return MMAL_TRUE;
+
+      /* Don't loop over a stream which has nothing but its EOS buffer */
+      frames = bench_source_frames(bench);
+      if (frames - bench->rewind_frames <= 1)
+         return MMAL_TRUE;
+      bench->rewind_frames = frames;
+
+      /* All the sinks are at the end of the stream so none of them is
+       * counting anymore */
+      __atomic_store_n(&bench->eos_num, 0, __ATOMIC_RELEASE);
+      if (mmal_port_parameter_set(bench->source->component->control, &seek.hdr) != MMAL_SUCCESS)
+         return MMAL_TRUE;
+      if (loops)
+         (*loops)++;
+   }
+   return MMAL_FALSE;
+}
+
+/** Build the graph, run it and collect the results */
+static MMAL_STATUS_T bench_run(BENCH_T *bench)
+{
+   char *spec, *elements[BENCH_ELEMENTS_MAX], *save = NULL, *element;
+   unsigned int elements_num = 0, i;
+   uint32_t frames_start;
+   uint64_t time_start, cpu_start;
+   unsigned long allocations_start;
+   MMAL_STATUS_T status;
+
+   spec = strdup(bench->options->graph);
+   if (!spec)
+      return MMAL_ENOMEM;
+   for (element = strtok_r(spec, ",", &save); element; element = strtok_r(NULL, ",", &save))
+   {
+      if (elements_num == BENCH_ELEMENTS_MAX)
+         break;
+      elements[elements_num++] = element;
+   }
+
+   status = mmal_graph_create(&bench->graph, 0);
+   if (status == MMAL_SUCCESS && !elements_num)
+      status = MMAL_EINVAL;
+   if (status == MMAL_SUCCESS)
+      status = bench_build(bench, NULL, elements, elements_num);
+   free(spec);
+   if (status == MMAL_SUCCESS)
+      status = mmal_graph_enable(bench->graph, bench_event_cb, bench);
+   if (status != MMAL_SUCCESS)
+      goto end;
+   for (i = 0; i < bench->clocks_num; i++)
+      mmal_port_parameter_set_boolean(bench->clock[i], MMAL_PARAMETER_CLOCK_ACTIVE, MMAL_TRUE);
+
+   if (bench_wait(bench, vcos_getmicrosecs64() + WARMUP_MS * 1000, NULL))
+   {
+      if (bench->error == MMAL_SUCCESS)
+         fprintf(stderr, "the stream ended during the warm-up\n");
+      status = bench->error != MMAL_SUCCESS ? bench->error : MMAL_EINVAL;
+      mmal_graph_disable(bench->graph);
+      goto end;
+   }
+   bench_read_hops(bench, MMAL_TRUE);
+   frames_start = bench_source_frames(bench);
+   cpu_start = bench_cpu_time();
+   allocations_start = bench_allocations_get();
+   time_start = vcos_getmicrosecs64();
+
+   bench_wait(bench, time_start + (uint64_t)bench->options->duration * 1000000, &bench->loops);
+
+   bench->frames = bench_source_frames(bench) - frames_start;
+   bench->cpu_time = bench_cpu_time() - cpu_start;
+   bench->allocations = bench_allocations_get() - allocations_start;
+   bench->seconds = (vcos_getmicrosecs64() - time_start) / 1000000.0;
+   bench_read_hops(bench, MMAL_FALSE);
+
+   mmal_graph_disable(bench->graph);
+   status = bench->error;
+
+ end:
+   if (bench->graph)
+      mmal_graph_destroy(bench->graph);
+   bench->graph = NULL;
+   return status;
+}
+
+static void bench_report_text(BENCH_T *bench)
+{
+   double frames = bench->frames ? bench->frames : 1;
+   unsigned int i;
+
+   printf("graph: %s\n", bench->options->graph);
+   printf("%u frames in %.2fs: %.1f fps, %.1f us CPU/frame", bench->frames, bench->seconds,
+          bench->frames / bench->seconds, bench->cpu_time / frames);
+#ifdef BENCH_COUNT_ALLOCATIONS
+   printf(", %.2f allocations/frame", bench->allocations / frames);
+#endif
+   if (bench->loops)
+      printf(", stream looped %u times", bench->loops);
+   if (bench->no_histograms)
+   {
+      printf("\nno latencies, the MMAL core was built without MMAL_COLLECT_PORT_STATS\n");
+      return;
+   }
+   printf("\n%-4s %-32s %10s %8s %8s %8s %8s\n", "hop", "port", "buffers", "p50 us", "p90 us", "p99 us", "max us");
+   for (i = 0; i < bench->hops_num; i++)
+   {
+      const MMAL_CORE_HISTOGRAM_T *residency = &bench->hop[i].residency;
+      printf("%-4u %-32s %10u %8u %8u %8u %8u\n", i, bench->hop[i].port->name, residency->count,
+             bench_percentile(residency, 50), bench_percentile(residency, 90),
+             bench_percentile(residency, 99), residency->max);
+   }
+}
+
+static MMAL_STATUS_T bench_report_json(BENCH_T *bench, const char *filename)
+{
+   double frames = bench->frames ? bench->frames : 1;
+   FILE *file = strcmp(filename, "-") ? fopen(filename, "w") : stdout;
+   unsigned int i;
+
+   if (!file)
+      return MMAL_EIO;
+
+   fprintf(file, "{\n  \"graph\": \"%s\",\n", bench->options->graph);
+   fprintf(file, "  \"width\": %u,\n  \"height\": %u,\n  \"frame_rate\": %u,\n",
+           bench->options->width, bench->options->height, bench->options->frame_rate);
+   fprintf(file, "  \"buffers\": %u,\n  \"executor_threads\": %d,\n",
+           bench->options->buffers, bench->options->executor_threads);
+   fprintf(file, "  \"seconds\": %.3f,\n  \"frames\": %u,\n  \"fps\": %.2f,\n",
+           bench->seconds, bench->frames, bench->frames / bench->seconds);
+   fprintf(file, "  \"loops\": %u,\n", bench->loops);
+   fprintf(file, "  \"cpu_us_per_frame\": %.2f,\n", bench->cpu_time / frames);
+#ifdef BENCH_COUNT_ALLOCATIONS
+   fprintf(file, "  \"allocations_per_frame\": %.3f,\n", bench->allocations / frames);
+#else
+   fprintf(file, "  \"allocations_per_frame\": null,\n");
+#endif
+   if (bench->no_histograms)
+   {
+      fprintf(file, "  \"hops\": null\n}\n");
+   }
+   else
+   {
+      fprintf(file, "  \"hops\": [");
+      for (i = 0; i < bench->hops_num; i++)
+      {
+         const MMAL_CORE_HISTOGRAM_T *residency = &bench->hop[i].residency;
+         fprintf(file, "%s\n    {\"hop\": %u, \"port\": \"%s\", \"buffers\": %u, "
+                 "\"p50_us\": %u, \"p90_us\": %u, \"p99_us\": %u, \"max_us\": %u}",
+                 i ? "," : "", i, bench->hop[i].port->name, residency->count,
+                 bench_percentile(residency, 50), bench_percentile(residency, 90),
+                 bench_percentile(residency, 99), residency->max);
+      }
+      fprintf(file, "\n  ]\n}\n");
+   }
+
+   if (file != stdout)
+      fclose(file);
+   return MMAL_SUCCESS;
+}
+
+static void bench_usage(const char *name)
+{
+   unsigned int i;
+
+   fprintf(stderr, "usage: %s [-d seconds] [-s WxH] [-r fps] [-p pattern] [-b buffers] [-e threads]\n"
+           "       [-j file] [graph]\n"
+           "  -d  duration of the measurement (default %u)\n"
+           "  -s  size of the frames of a video source (default %ux%u)\n"
+           "  -r  frame rate of a video source, 0 for as fast as possible (default 0)\n"
+           "  -p  pattern of the source:", name, DEFAULT_DURATION, DEFAULT_WIDTH, DEFAULT_HEIGHT);
+   for (i = 0; i < vcos_countof(bench_patterns); i++)
+      fprintf(stderr, " %s", bench_patterns[i].name);
+   fprintf(stderr, "\n"
+           "  -b  buffers on each connection (default %u)\n"
+           "  -e  run the actions on the shared executor, 0 for one thread per core\n"
+           "  -j  write a JSON report to the file, - for stdout\n"
+           "graph defaults to %s\n", DEFAULT_BUFFERS, DEFAULT_GRAPH);
+}
+
+int main(int argc, char **argv)
+{
+   BENCH_OPTIONS_T options = {DEFAULT_GRAPH, DEFAULT_DURATION, DEFAULT_WIDTH, DEFAULT_HEIGHT, 0, -1,
+      DEFAULT_BUFFERS, -1, NULL};
+   BENCH_T bench;
+   MMAL_STATUS_T status;
+   unsigned int i;
+   int opt;
+
+   while ((opt = getopt(argc, argv, "d:s:r:p:b:e:j:h")) != -1)
+   {
+      switch (opt)
+      {
+      case 'd': options.duration = strtoul(optarg, NULL, 0); break;
+      case 'r': options.frame_rate = strtoul(optarg, NULL, 0); break;
+      case 'b': options.buffers = strtoul(optarg, NULL, 0); break;
+      case 'e': options.executor_threads = atoi(optarg); break;
+      case 'j': options.json = optarg; break;
+      case 's':
+         if (sscanf(optarg, "%ux%u", &options.width, &options.height) != 2)
+            options.width = 0;
+         break;
+      case 'p':
+         for (i = 0; i < vcos_countof(bench_patterns); i++)
+            if (!strcmp(optarg, bench_patterns[i].name))
+               options.pattern = bench_patterns[i].pattern;
+         if (options.pattern < 0)
+            options.duration = 0;
+         break;
+      default:
+         options.duration = 0;
+         break;
+      }
+   }
+   if (optind < argc)
+      options.graph = argv[optind];
+   if (!options.duration || !options.width || !options.height)
+   {
+      bench_usage(argv[0]);
+      return 1;
+   }
+
+   vcos_init();
+   if (options.executor_threads >= 0 &&
+       mmal_executor_enable(options.executor_threads) != MMAL_SUCCESS)
+   {
+      fprintf(stderr, "could not enable the executor\n");
+      return 1;
+   }
+
+   memset(&bench, 0, sizeof(bench));
+   bench.options = &options;
+   if (vcos_semaphore_create(&bench.done, "mmal_bench", 0) != VCOS_SUCCESS)
+   {
+      fprintf(stderr, "could not create semaphore\n");
+      return 1;
+   }
+   status = bench_run(&bench);
+   vcos_semaphore_delete(&bench.done);
+   if (status != MMAL_SUCCESS)
+   {
+      fprintf(stderr, "benchmark failed: %s\n", mmal_status_to_string(status));
+      return 1;
+   }
+
+   if (!options.json || strcmp(options.json, "-"))
+      bench_report_text(&bench);
+   if (options.json && bench_report_json(&bench, options.json) != MMAL_SUCCESS)
+   {
+      fprintf(stderr, "could not write %s\n", options.json);
+      return 1;
+   }
+
+   if (options.executor_threads >= 0)
+      mmal_executor_disable();
+   vcos_deinit();
+   return 0;
+}
@@ -0,0 +1,264 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Stress test for the scheduling of clock requests, with several streams
+ * sharing one clock and posting requests out of order, as audio and video
+ * do through the scheduler components.
+ *
+ * Usage: mmal_clock_bench [streams] [requests per stream] [period us]
+ */
+
+#include "mmal.h"
+#include "interface/mmal/core/mmal_clock_private.h"
+#include "interface/vcos/vcos.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_STREAMS 8
+#define DEFAULT_REQUESTS 2000
+#define DEFAULT_PERIOD 1000
+#define DEFAULT_ITERATIONS 2000
+
+/* Number of requests kept pending by all the streams, which must stay below
+ * the number of request slots of the clock */
+#define TOTAL_PENDING 96
+
+typedef struct BENCH_STREAM_T
+{
+   MMAL_CLOCK_T *clock;
+   unsigned int index;
+   unsigned int streams;
+   unsigned int requests;
+   int64_t period;
+   VCOS_SEMAPHORE_T slots;    /**< requests the stream can still post */
+   VCOS_THREAD_T thread;
+
+   /* Updated by the clock thread */
+   unsigned int done;
+   int64_t late_total;
+   int64_t late_max;
+   int64_t previous;
+   unsigned int out_of_order;
+
+   /* Updated by the stream thread */
+   uint64_t add_time;
+   unsigned int add_failed;
+} BENCH_STREAM_T;
+
+static void bench_flush_cb(MMAL_CLOCK_T *clock, int64_t media_time, void *cb_data, MMAL_CLOCK_VOID_FP priv)
+{
+   MMAL_PARAM_UNUSED(clock);
+   MMAL_PARAM_UNUSED(media_time);
+   MMAL_PARAM_UNUSED(cb_data);
+   MMAL_PARAM_UNUSED(priv);
+}
+
+/** Requests posted in a shuffled order to an inactive clock then flushed,
+ * measuring the cost of insertion only */
+static double bench_insert(unsigned int iterations, unsigned int depth)
+{
+   MMAL_CLOCK_T *clock;
+   int64_t *times = malloc(depth * sizeof(*times));
+   uint64_t start, total = 0;
+   unsigned int i, j;
+
+   if (!times || mmal_clock_create(&clock) != MMAL_SUCCESS)
+   {
+      free(times);
+      return 0;
+   }
+
+   /* Interleave the presentation times of several streams with different
+    * offsets so the requests arrive out of order */
+   for (i = 0; i < depth; i++)
+      times[i] = (int64_t)(i % 4) * 7919 + (int64_t)(i / 4) * 1000;
+   for (i = depth; i > 1; i--)
+   {
+      int64_t tmp;
+      j = rand() % i;
+      tmp = times[i - 1]; times[i - 1] = times[j]; times[j] = tmp;
+   }
+
+   for (i = 0; i < iterations; i++)
+   {
+      start = vcos_getmicrosecs64();
+      for (j = 0; j < depth; j++)
+         if (mmal_clock_request_add(clock, times[j], bench_flush_cb, NULL, NULL) != MMAL_SUCCESS)
+            break;
+      total += vcos_getmicrosecs64() - start;
+      mmal_clock_request_flush(clock);
+   }
+
+   mmal_clock_destroy(clock);
+   free(times);
+   if (!total)
+      total = 1;
+   return (double)iterations * depth * 1000.0 / (double)total;
+}
+
+static void bench_stream_cb(MMAL_CLOCK_T *clock, int64_t media_time, void *cb_data, MMAL_CLOCK_VOID_FP priv)
+{
+   BENCH_STREAM_T *stream = (BENCH_STREAM_T *)cb_data;
+   int64_t requested = (int64_t)(intptr_t)priv;
+   int64_t late = media_time - requested;
+   MMAL_PARAM_UNUSED(clock);
+
+   if (requested < stream->previous)
+      stream->out_of_order++;
+   stream->previous = requested;
+   if (late > stream->late_max)
+      stream->late_max = late;
+   stream->late_total += late;
+   stream->done++;
+   vcos_semaphore_post(&stream->slots);
+}
+
+static void *bench_stream(void *arg)
+{
+   BENCH_STREAM_T *stream = (BENCH_STREAM_T *)arg;
+   /* Streams are offset from each other so their requests interleave */
+   int64_t offset = stream->period * stream->index / stream->streams;
+   unsigned int i;
+
+   for (i = 0; i < stream->requests; i++)
+   {
+      int64_t media_time = offset + (int64_t)(i + 1) * stream->period;
+      uint64_t start;
+
+      vcos_semaphore_wait(&stream->slots);
+      start = vcos_getmicrosecs64();
+      if (mmal_clock_request_add(stream->clock, media_time, bench_stream_cb, stream,
+            (MMAL_CLOCK_VOID_FP)(intptr_t)media_time) != MMAL_SUCCESS)
+         stream->add_failed++;
+      stream->add_time += vcos_getmicrosecs64() - start;
+   }
+   return NULL;
+}
+
+/** Streams posting requests to a running clock */
+static void bench_streams(unsigned int streams_num, unsigned int requests, int64_t period)
+{
+   BENCH_STREAM_T *streams = calloc(streams_num, sizeof(*streams));
+   MMAL_CLOCK_T *clock;
+   MMAL_RATIONAL_T scale = {1, 1};
+   int64_t late_total = 0, late_max = 0;
+   uint64_t add_time = 0, start;
+   unsigned int i, created = 0, done = 0, failed = 0, out_of_order = 0;
+   unsigned int pending = TOTAL_PENDING / streams_num ? TOTAL_PENDING / streams_num : 1;
+
+   if (!streams || mmal_clock_create(&clock) != MMAL_SUCCESS)
+   {
+      free(streams);
+      return;
+   }
+   mmal_clock_scale_set(clock, scale);
+   mmal_clock_media_time_set(clock, 0);
+   mmal_clock_active_set(clock, MMAL_TRUE);
+
+   start = vcos_getmicrosecs64();
+   for (i = 0; i < streams_num; i++, created++)
+   {
+      BENCH_STREAM_T *stream = &streams[i];
+      stream->clock = clock;
+      stream->index = i;
+      stream->streams = streams_num;
+      stream->requests = requests;
+      stream->period = period;
+      stream->previous = INT64_MIN;
+      if (vcos_semaphore_create(&stream->slots, "bench stream", pending) != VCOS_SUCCESS)
+         break;
+      if (vcos_thread_create(&stream->thread, "bench stream", NULL, bench_stream, stream) != VCOS_SUCCESS)
+      {
+         vcos_semaphore_delete(&stream->slots);
+         break;
+      }
+   }
+
+   for (i = 0; i < created; i++)
+      vcos_thread_join(&streams[i].thread, NULL);
+   /* Wait for the last requests to be serviced */
+   vcos_sleep((uint32_t)(2 * period / 1000) + 50);
+   mmal_clock_active_set(clock, MMAL_FALSE);
+   start = vcos_getmicrosecs64() - start;
+
+   for (i = 0; i < created; i++)
+   {
+      done += streams[i].done;
+      failed += streams[i].add_failed;
+      out_of_order += streams[i].out_of_order;
+      add_time += streams[i].add_time;
+      late_total += streams[i].late_total;
+      if (streams[i].late_max > late_max)
+         late_max = streams[i].late_max;
+   }
+
+   printf("%u streams, %u requests posted in %.2fs, %u serviced, %u failed, %u out of order\n",
+          created, created * requests, (double)start / 1000000.0, done, failed, out_of_order);
+   printf("request_add: %.3f us average\n", created && requests ?
+          (double)add_time / (double)(created * requests) : 0.0);
+   /* Requests can be serviced up to the minimum timer delay early */
+   printf("lateness: %.1f us average, %lld us max\n",
+          done ? (double)late_total / (double)done : 0.0, (long long)late_max);
+
+   mmal_clock_destroy(clock);
+   for (i = 0; i < created; i++)
+      vcos_semaphore_delete(&streams[i].slots);
+   free(streams);
+}
+
+int main(int argc, char **argv)
+{
+   unsigned int streams = DEFAULT_STREAMS;
+   unsigned int requests = DEFAULT_REQUESTS;
+   unsigned int period = DEFAULT_PERIOD;
+   static const unsigned int depths[] = {8, 32, 64, 96};
+   unsigned int i;
+
+   if (argc > 1)
+      streams = strtoul(argv[1], NULL, 0);
+   if (argc > 2)
+      requests = strtoul(argv[2], NULL, 0);
+   if (argc > 3)
+      period = strtoul(argv[3], NULL, 0);
+   if (!streams || !requests || !period)
+   {
+      fprintf(stderr, "usage: %s [streams] [requests per stream] [period us]\n", argv[0]);
+      return 1;
+   }
+
+   vcos_init();
+
+   printf("%-8s %16s\n", "pending", "inserts/ms");
+   for (i = 0; i < vcos_countof(depths); i++)
+      printf("%-8u %16.0f\n", depths[i], bench_insert(DEFAULT_ITERATIONS, depths[i]));
+
+   bench_streams(streams, requests, period);
+
+   vcos_deinit();
+   return 0;
+}
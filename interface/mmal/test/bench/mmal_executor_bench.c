@@ -0,0 +1,320 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Benchmark running a chain of software components with their actions on
+ * dedicated threads and then on the shared executor, reporting the throughput
+ * and the number of context switches of the process.
+ *
+ * Usage: mmal_executor_bench [frames] [components] [frame size] [executor threads]
+ */
+
+#include "mmal.h"
+#include "mmal_executor.h"
+#include "util/mmal_util.h"
+#include "util/mmal_connection.h"
+#include "interface/vcos/vcos.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+
+#define DEFAULT_FRAMES 20000
+#define DEFAULT_COMPONENTS 6
+#define DEFAULT_FRAME_SIZE (64*1024)
+#define BENCH_BUFFERS 3
+#define BENCH_COMPONENTS_MAX 32
+
+typedef struct BENCH_GRAPH_T
+{
+   MMAL_COMPONENT_T *component[BENCH_COMPONENTS_MAX];
+   MMAL_CONNECTION_T *connection[BENCH_COMPONENTS_MAX];
+   unsigned int components_num;
+   MMAL_POOL_T *in_pool;
+   MMAL_POOL_T *out_pool;
+   MMAL_QUEUE_T *done;
+} BENCH_GRAPH_T;
+
+typedef struct BENCH_RESULT_T
+{
+   double rate;
+   uint64_t switches;
+   uint64_t cpu;
+} BENCH_RESULT_T;
+
+static void bench_input_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+   MMAL_PARAM_UNUSED(port);
+   mmal_buffer_header_release(buffer);
+}
+
+static void bench_output_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+   BENCH_GRAPH_T *graph = (BENCH_GRAPH_T *)port->userdata;
+   mmal_queue_put(graph->done, buffer);
+}
+
+static void bench_control_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+   if (buffer->cmd == MMAL_EVENT_ERROR)
+      fprintf(stderr, "error event from %s\n", port->component->name);
+   mmal_buffer_header_release(buffer);
+}
+
+static void bench_connection_cb(MMAL_CONNECTION_T *connection)
+{
+   MMAL_PARAM_UNUSED(connection);
+}
+
+static void bench_graph_destroy(BENCH_GRAPH_T *graph)
+{
+   unsigned int i;
+
+   for (i = 0; i < graph->components_num; i++)
+   {
+      if (graph->connection[i])
+         mmal_connection_destroy(graph->connection[i]);
+      if (graph->component[i])
+         mmal_component_disable(graph->component[i]);
+   }
+   if (graph->components_num)
+   {
+      mmal_port_disable(graph->component[0]->input[0]);
+      mmal_port_disable(graph->component[graph->components_num - 1]->output[0]);
+   }
+   if (graph->in_pool)
+      mmal_port_pool_destroy(graph->component[0]->input[0], graph->in_pool);
+   if (graph->out_pool)
+      mmal_port_pool_destroy(graph->component[graph->components_num - 1]->output[0], graph->out_pool);
+   for (i = 0; i < graph->components_num; i++)
+      if (graph->component[i])
+         mmal_component_destroy(graph->component[i]);
+   if (graph->done)
+      mmal_queue_destroy(graph->done);
+   memset(graph, 0, sizeof(*graph));
+}
+
+/** Create a chain of copy components, tunnelled to each other */
+static MMAL_STATUS_T bench_graph_create(BENCH_GRAPH_T *graph, unsigned int components_num,
+   unsigned int frame_size)
+{
+   MMAL_PORT_T *in, *out;
+   MMAL_STATUS_T status;
+   unsigned int i;
+
+   memset(graph, 0, sizeof(*graph));
+   graph->done = mmal_queue_create();
+   if (!graph->done)
+      return MMAL_ENOMEM;
+
+   for (i = 0; i < components_num; i++)
+   {
+      status = mmal_component_create("copy", &graph->component[i]);
+      if (status != MMAL_SUCCESS)
+         goto error;
+      graph->components_num++;
+      mmal_port_enable(graph->component[i]->control, bench_control_cb);
+
+      in = graph->component[i]->input[0];
+      out = graph->component[i]->output[0];
+      if (i)
+         mmal_format_full_copy(in->format, graph->component[i - 1]->output[0]->format);
+      else
+      {
+         in->format->type = MMAL_ES_TYPE_UNKNOWN;
+         in->format->encoding = MMAL_ENCODING_UNKNOWN;
+      }
+      status = mmal_port_format_commit(in);
+      if (status != MMAL_SUCCESS)
+         goto error;
+      mmal_format_full_copy(out->format, in->format);
+      status = mmal_port_format_commit(out);
+      if (status != MMAL_SUCCESS)
+         goto error;
+      in->buffer_num = out->buffer_num = BENCH_BUFFERS;
+      in->buffer_size = out->buffer_size = frame_size;
+   }
+
+   for (i = 0; i + 1 < components_num; i++)
+   {
+      status = mmal_connection_create(&graph->connection[i], graph->component[i]->output[0],
+         graph->component[i + 1]->input[0], MMAL_CONNECTION_FLAG_TUNNELLING |
+         MMAL_CONNECTION_FLAG_KEEP_BUFFER_REQUIREMENTS | MMAL_CONNECTION_FLAG_KEEP_PORT_FORMATS);
+      if (status != MMAL_SUCCESS)
+         goto error;
+      graph->connection[i]->callback = bench_connection_cb;
+      status = mmal_connection_enable(graph->connection[i]);
+      if (status != MMAL_SUCCESS)
+         goto error;
+   }
+
+   in = graph->component[0]->input[0];
+   out = graph->component[components_num - 1]->output[0];
+   out->userdata = (struct MMAL_PORT_USERDATA_T *)graph;
+   graph->in_pool = mmal_port_pool_create(in, in->buffer_num, in->buffer_size);
+   graph->out_pool = mmal_port_pool_create(out, out->buffer_num, out->buffer_size);
+   if (!graph->in_pool || !graph->out_pool)
+   {
+      status = MMAL_ENOMEM;
+      goto error;
+   }
+   status = mmal_port_enable(in, bench_input_cb);
+   if (status == MMAL_SUCCESS)
+      status = mmal_port_enable(out, bench_output_cb);
+   for (i = 0; i < components_num && status == MMAL_SUCCESS; i++)
+      status = mmal_component_enable(graph->component[i]);
+   if (status != MMAL_SUCCESS)
+      goto error;
+   return MMAL_SUCCESS;
+
+ error:
+   fprintf(stderr, "failed to create the graph (%i)\n", status);
+   bench_graph_destroy(graph);
+   return status;
+}
+
+static uint64_t bench_context_switches(void)
+{
+   struct rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage))
+      return 0;
+   return usage.ru_nvcsw + usage.ru_nivcsw;
+}
+
+static uint64_t bench_cpu_time(void)
+{
+   struct rusage usage;
+   if (getrusage(RUSAGE_SELF, &usage))
+      return 0;
+   return (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+      usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+/** Push frames through the graph and wait for all of them to come out */
+static MMAL_STATUS_T bench_run(BENCH_RESULT_T *result, unsigned int frames,
+   unsigned int components_num, unsigned int frame_size)
+{
+   BENCH_GRAPH_T graph;
+   MMAL_PORT_T *in, *out;
+   MMAL_BUFFER_HEADER_T *buffer;
+   unsigned int sent = 0, received = 0;
+   uint64_t start, end, switches, cpu;
+   MMAL_STATUS_T status;
+
+   status = bench_graph_create(&graph, components_num, frame_size);
+   if (status != MMAL_SUCCESS)
+      return status;
+   in = graph.component[0]->input[0];
+   out = graph.component[components_num - 1]->output[0];
+
+   switches = bench_context_switches();
+   cpu = bench_cpu_time();
+   start = vcos_getmicrosecs64();
+   while (received < frames)
+   {
+      while ((buffer = mmal_queue_get(graph.out_pool->queue)) != NULL)
+         mmal_port_send_buffer(out, buffer);
+      while (sent < frames && (buffer = mmal_queue_get(graph.in_pool->queue)) != NULL)
+      {
+         buffer->length = frame_size;
+         buffer->pts = sent++;
+         mmal_port_send_buffer(in, buffer);
+      }
+
+      buffer = mmal_queue_timedwait(graph.done, 1000);
+      if (!buffer)
+      {
+         fprintf(stderr, "timed out after %u frames\n", received);
+         status = MMAL_ENOTREADY;
+         break;
+      }
+      received++;
+      mmal_buffer_header_release(buffer);
+   }
+   end = vcos_getmicrosecs64();
+   result->switches = bench_context_switches() - switches;
+   result->cpu = bench_cpu_time() - cpu;
+   result->rate = (double)received * 1000000.0 / (double)(end > start ? end - start : 1);
+
+   bench_graph_destroy(&graph);
+   return status;
+}
+
+int main(int argc, char **argv)
+{
+   unsigned int frames = DEFAULT_FRAMES;
+   unsigned int components_num = DEFAULT_COMPONENTS;
+   unsigned int frame_size = DEFAULT_FRAME_SIZE;
+   unsigned int threads = 0;
+   MMAL_EXECUTOR_STATS_T stats;
+   BENCH_RESULT_T result[2];
+   MMAL_STATUS_T status;
+
+   if (argc > 1)
+      frames = strtoul(argv[1], NULL, 0);
+   if (argc > 2)
+      components_num = strtoul(argv[2], NULL, 0);
+   if (argc > 3)
+      frame_size = strtoul(argv[3], NULL, 0);
+   if (argc > 4)
+      threads = strtoul(argv[4], NULL, 0);
+   if (!frames || !components_num || components_num > BENCH_COMPONENTS_MAX || !frame_size)
+   {
+      fprintf(stderr, "usage: %s [frames] [components] [frame size] [executor threads]\n", argv[0]);
+      return 1;
+   }
+
+   vcos_init();
+
+   status = bench_run(&result[0], frames, components_num, frame_size);
+   if (status != MMAL_SUCCESS)
+      return 1;
+
+   status = mmal_executor_enable(threads);
+   if (status != MMAL_SUCCESS)
+   {
+      fprintf(stderr, "could not enable the executor (%i)\n", status);
+      return 1;
+   }
+   status = bench_run(&result[1], frames, components_num, frame_size);
+   if (status != MMAL_SUCCESS)
+      return 1;
+   mmal_executor_get_stats(&stats);
+   mmal_executor_disable();
+
+   printf("%u frames of %u bytes through %u copy components\n", frames, frame_size, components_num);
+   printf("%-16s %12s %16s %16s\n", "actions", "frames/s", "ctx switches", "cpu us/frame");
+   printf("%-16s %12.0f %16llu %16.1f\n", "threads", result[0].rate,
+          (unsigned long long)result[0].switches, (double)result[0].cpu / frames);
+   printf("%-16s %12.0f %16llu %16.1f\n", "executor", result[1].rate,
+          (unsigned long long)result[1].switches, (double)result[1].cpu / frames);
+   printf("executor: %u threads, %llu runs, %llu steals, %llu wakeups\n", stats.threads,
+          (unsigned long long)stats.runs, (unsigned long long)stats.steals,
+          (unsigned long long)stats.wakeups);
+
+   vcos_deinit();
+   return 0;
+}
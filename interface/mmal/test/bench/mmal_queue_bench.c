@@ -0,0 +1,203 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Microbenchmark comparing the locked MMAL queue with the lock-free
+ * single-producer/single-consumer variant.
+ *
+ * Usage: mmal_queue_bench [iterations] [buffers]
+ */
+
+#include "mmal.h"
+#include "interface/vcos/vcos.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFAULT_ITERATIONS 1000000
+#define DEFAULT_BUFFERS 8
+
+typedef MMAL_QUEUE_T *(*QUEUE_CREATE_FN_T)(void);
+
+typedef struct BENCH_CONTEXT_T
+{
+   MMAL_QUEUE_T *full;   /**< producer -> consumer */
+   MMAL_QUEUE_T *free;   /**< consumer -> producer */
+   unsigned int iterations;
+} BENCH_CONTEXT_T;
+
+static double bench_rate(unsigned int count, uint64_t start, uint64_t end)
+{
+   if (end <= start)
+      end = start + 1;
+   return (double)count * 1000000.0 / (double)(end - start);
+}
+
+/** Single thread put followed by get, no contention and no waiting */
+static double bench_put_get(QUEUE_CREATE_FN_T create, unsigned int iterations)
+{
+   MMAL_BUFFER_HEADER_T buffer;
+   MMAL_QUEUE_T *queue = create();
+   uint64_t start;
+   unsigned int i;
+
+   if (!queue)
+      return 0;
+   memset(&buffer, 0, sizeof(buffer));
+
+   start = vcos_getmicrosecs64();
+   for (i = 0; i < iterations; i++)
+   {
+      mmal_queue_put(queue, &buffer);
+      if (mmal_queue_get(queue) != &buffer)
+      {
+         fprintf(stderr, "queue returned the wrong buffer\n");
+         break;
+      }
+   }
+   start = vcos_getmicrosecs64() - start;
+
+   mmal_queue_destroy(queue);
+   return bench_rate(i, 0, start);
+}
+
+static void *bench_producer(void *arg)
+{
+   BENCH_CONTEXT_T *ctx = (BENCH_CONTEXT_T *)arg;
+   unsigned int i;
+
+   for (i = 0; i < ctx->iterations; i++)
+   {
+      MMAL_BUFFER_HEADER_T *buffer = mmal_queue_wait(ctx->free);
+      buffer->pts = i;
+      mmal_queue_put(ctx->full, buffer);
+   }
+   return NULL;
+}
+
+/** Two threads passing a small set of buffers back and forth, as a component
+ * and its client do. Each queue only has one producer and one consumer. */
+static double bench_ping_pong(QUEUE_CREATE_FN_T create, unsigned int iterations,
+   unsigned int buffers_num)
+{
+   BENCH_CONTEXT_T ctx;
+   MMAL_BUFFER_HEADER_T *buffers;
+   VCOS_THREAD_T thread;
+   uint64_t start, end;
+   unsigned int i;
+   double rate = 0;
+
+   buffers = calloc(buffers_num, sizeof(*buffers));
+   ctx.full = create();
+   ctx.free = create();
+   ctx.iterations = iterations;
+   if (!buffers || !ctx.full || !ctx.free)
+      goto end;
+
+   for (i = 0; i < buffers_num; i++)
+      mmal_queue_put(ctx.free, &buffers[i]);
+
+   start = vcos_getmicrosecs64();
+   if (vcos_thread_create(&thread, "bench producer", NULL, bench_producer, &ctx) != VCOS_SUCCESS)
+      goto end;
+
+   for (i = 0; i < iterations; i++)
+   {
+      MMAL_BUFFER_HEADER_T *buffer = mmal_queue_wait(ctx.full);
+      if (buffer->pts != (int64_t)i)
+         fprintf(stderr, "buffer out of order (%lld instead of %u)\n", (long long)buffer->pts, i);
+      mmal_queue_put(ctx.free, buffer);
+   }
+   end = vcos_getmicrosecs64();
+   vcos_thread_join(&thread, NULL);
+   rate = bench_rate(iterations, start, end);
+
+ end:
+   if (ctx.full)
+      mmal_queue_destroy(ctx.full);
+   if (ctx.free)
+      mmal_queue_destroy(ctx.free);
+   free(buffers);
+   return rate;
+}
+
+/** Empty queue polled with a timed wait, measuring the cost of a timeout */
+static double bench_timedwait(QUEUE_CREATE_FN_T create, unsigned int iterations)
+{
+   MMAL_QUEUE_T *queue = create();
+   uint64_t start;
+   unsigned int i;
+
+   if (!queue)
+      return 0;
+
+   start = vcos_getmicrosecs64();
+   for (i = 0; i < iterations; i++)
+      mmal_queue_timedwait(queue, 0);
+   start = vcos_getmicrosecs64() - start;
+
+   mmal_queue_destroy(queue);
+   return bench_rate(iterations, 0, start);
+}
+
+int main(int argc, char **argv)
+{
+   unsigned int iterations = DEFAULT_ITERATIONS;
+   unsigned int buffers_num = DEFAULT_BUFFERS;
+   static const struct {
+      const char *name;
+      QUEUE_CREATE_FN_T create;
+   } queues[] = {
+      {"locked", mmal_queue_create},
+      {"spsc", mmal_queue_create_spsc},
+   };
+   unsigned int i;
+
+   if (argc > 1)
+      iterations = strtoul(argv[1], NULL, 0);
+   if (argc > 2)
+      buffers_num = strtoul(argv[2], NULL, 0);
+   if (!iterations || !buffers_num)
+   {
+      fprintf(stderr, "usage: %s [iterations] [buffers]\n", argv[0]);
+      return 1;
+   }
+
+   vcos_init();
+
+   printf("%-8s %16s %16s %16s\n", "queue", "put+get/s", "ping-pong/s", "timedwait(0)/s");
+   for (i = 0; i < vcos_countof(queues); i++)
+   {
+      double put_get = bench_put_get(queues[i].create, iterations);
+      double ping_pong = bench_ping_pong(queues[i].create, iterations, buffers_num);
+      double timedwait = bench_timedwait(queues[i].create, iterations / 10);
+
+      printf("%-8s %16.0f %16.0f %16.0f\n", queues[i].name, put_get, ping_pong, timedwait);
+   }
+
+   vcos_deinit();
+   return 0;
+}
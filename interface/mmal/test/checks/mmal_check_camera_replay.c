@@ -0,0 +1,219 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* End-to-end check of the raw video replay of the artificial camera. A small
+ * YUV4MPEG2 file and a .yuv file are generated, played back through the
+ * component, and each frame which comes out is compared with what was written,
+ * including once the file has looped.
+ *
+ * Usage: mmal_check_camera_replay [directory for the temporary files]
+ */
+
+#include "mmal.h"
+#include "util/mmal_util.h"
+#include "util/mmal_util_params.h"
+#include "interface/vcos/vcos.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define WIDTH 64
+#define HEIGHT 48
+#define FRAMES 5
+#define FRAMES_CHECKED (2 * FRAMES + 2)
+
+/** Value of a sample of a frame of the generated files */
+static uint8_t check_sample(unsigned int frame, unsigned int plane, unsigned int x, unsigned int y)
+{
+   return (uint8_t)(frame * 37 + plane * 85 + x + 3 * y);
+}
+
+static int check_write_file(const char *path, int yuv4mpeg2)
+{
+   FILE *file = fopen(path, "wb");
+   unsigned int frame, plane, x, y;
+
+   if (!file)
+      return -1;
+
+   if (yuv4mpeg2)
+      fprintf(file, "YUV4MPEG2 W%i H%i F30:1 Ip A1:1 C420\n", WIDTH, HEIGHT);
+   for (frame = 0; frame < FRAMES; frame++)
+   {
+      if (yuv4mpeg2)
+         fprintf(file, "FRAME\n");
+      for (plane = 0; plane < 3; plane++)
+         for (y = 0; y < (plane ? HEIGHT / 2 : HEIGHT); y++)
+            for (x = 0; x < (plane ? WIDTH / 2 : WIDTH); x++)
+               fputc(check_sample(frame, plane, x, y), file);
+   }
+
+   return fclose(file) ? -1 : 0;
+}
+
+static void check_output_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
+{
+   mmal_queue_put((MMAL_QUEUE_T *)port->userdata, buffer);
+}
+
+static int check_frame(MMAL_BUFFER_HEADER_T *buffer, unsigned int frame)
+{
+   MMAL_BUFFER_HEADER_VIDEO_SPECIFIC_T *video = &buffer->type->video;
+   unsigned int plane, x, y;
+
+   for (plane = 0; plane < 3; plane++)
+      for (y = 0; y < (plane ? HEIGHT / 2 : HEIGHT); y++)
+         for (x = 0; x < (plane ? WIDTH / 2 : WIDTH); x++)
+            if (buffer->data[video->offset[plane] + y * video->pitch[plane] + x] !=
+                check_sample(frame, plane, x, y))
+            {
+               fprintf(stderr, "frame %u: plane %u differs at %ux%u\n", frame, plane, x, y);
+               return -1;
+            }
+   return 0;
+}
+
+static int check_replay(const char *uri)
+{
+   MMAL_COMPONENT_T *camera = NULL;
+   MMAL_POOL_T *pool = NULL;
+   MMAL_QUEUE_T *queue = NULL;
+   MMAL_BUFFER_HEADER_T *buffer;
+   MMAL_PORT_T *port;
+   MMAL_STATUS_T status;
+   unsigned int frames = 0;
+   int result = -1;
+
+   status = mmal_component_create("artificial_camera", &camera);
+   if (status != MMAL_SUCCESS)
+   {
+      fprintf(stderr, "failed to create the artificial camera (%s)\n", mmal_status_to_string(status));
+      return -1;
+   }
+   port = camera->output[0];
+
+   /* Frames come out as fast as buffers are given back */
+   port->format->encoding = MMAL_ENCODING_I420;
+   port->format->es->video.width = WIDTH;
+   port->format->es->video.height = HEIGHT;
+   port->format->es->video.crop.width = WIDTH;
+   port->format->es->video.crop.height = HEIGHT;
+   port->format->es->video.frame_rate.num = 0;
+   port->format->es->video.frame_rate.den = 1;
+   status = mmal_port_format_commit(port);
+   if (status != MMAL_SUCCESS)
+   {
+      fprintf(stderr, "failed to set the format (%s)\n", mmal_status_to_string(status));
+      goto end;
+   }
+
+   status = mmal_util_port_set_uri(port, uri);
+   if (status != MMAL_SUCCESS)
+   {
+      fprintf(stderr, "failed to replay %s (%s)\n", uri, mmal_status_to_string(status));
+      goto end;
+   }
+
+   port->buffer_num = port->buffer_num_recommended;
+   port->buffer_size = port->buffer_size_recommended;
+   queue = mmal_queue_create();
+   pool = mmal_port_pool_create(port, port->buffer_num, port->buffer_size);
+   if (!queue || !pool)
+      goto end;
+
+   port->userdata = (struct MMAL_PORT_USERDATA_T *)queue;
+   status = mmal_port_enable(port, check_output_cb);
+   if (status != MMAL_SUCCESS)
+   {
+      fprintf(stderr, "failed to enable %s (%s)\n", port->name, mmal_status_to_string(status));
+      goto end;
+   }
+
+   while ((buffer = mmal_queue_get(pool->queue)) != NULL)
+      mmal_port_send_buffer(port, buffer);
+
+   while (frames < FRAMES_CHECKED)
+   {
+      buffer = mmal_queue_timedwait(queue, 1000);
+      if (!buffer)
+      {
+         fprintf(stderr, "%s: timed out waiting for frame %u\n", uri, frames);
+         break;
+      }
+      if (buffer->length && check_frame(buffer, frames % FRAMES))
+      {
+         mmal_buffer_header_release(buffer);
+         break;
+      }
+      if (buffer->length)
+         frames++;
+
+      buffer->length = 0;
+      mmal_port_send_buffer(port, buffer);
+   }
+   if (frames == FRAMES_CHECKED)
+      result = 0;
+
+   mmal_port_disable(port);
+
+ end:
+   if (pool)
+      mmal_port_pool_destroy(port, pool);
+   if (queue)
+      mmal_queue_destroy(queue);
+   mmal_component_destroy(camera);
+   return result;
+}
+
+int main(int argc, char **argv)
+{
+   const char *dir = argc > 1 ? argv[1] : "/tmp";
+   char y4m[256], yuv[256];
+   int failures = 0;
+
+   /* The .yuv file describes its format in its name */
+   snprintf(y4m, sizeof(y4m), "%s/mmal_check_%i.y4m", dir, (int)getpid());
+   snprintf(yuv, sizeof(yuv), "%s/mmal_check_%i_CI420W%iH%i.yuv", dir, (int)getpid(), WIDTH, HEIGHT);
+
+   if (check_write_file(y4m, 1) || check_write_file(yuv, 0))
+   {
+      fprintf(stderr, "failed to write the test files in %s\n", dir);
+      return 1;
+   }
+
+   if (check_replay(y4m))
+      failures++;
+   if (check_replay(yuv))
+      failures++;
+
+   remove(y4m);
+   remove(yuv);
+
+   printf("camera replay: %s\n", failures ? "FAILED" : "passed");
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,162 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Checks that the vectorised kernels of the frame converter give the same
+ * results as the C ones. Every supported conversion is run on random frames
+ * by mmal_util and by a copy of the converter built with its C kernels only,
+ * with several sizes and crops so that the vector loops, their C tails and
+ * the chunked rows are all used, and the outputs are compared byte by byte.
+ *
+ * Usage: mmal_check_convert
+ */
+
+#include "mmal.h"
+#include "util/mmal_util.h"
+#include "util/mmal_util_convert.h"
+#include "interface/vcos/vcos.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* From mmal_check_convert_c.c */
+MMAL_STATUS_T mmal_check_c_frame_convert(uint8_t *dst, uint32_t dst_size, const MMAL_ES_FORMAT_T *dst_format,
+   const uint8_t *src, uint32_t src_size, const MMAL_ES_FORMAT_T *src_format);
+
+#define CHECK(cond) do { if (!(cond)) { \
+   fprintf(stderr, "%s:%i: check failed: %s\n", __FILE__, __LINE__, #cond); \
+   return -1; } } while (0)
+
+static const MMAL_FOURCC_T check_encodings[] =
+{
+   MMAL_ENCODING_I420, MMAL_ENCODING_NV12, MMAL_ENCODING_YUYV,
+   MMAL_ENCODING_RGB24, MMAL_ENCODING_BGR24, MMAL_ENCODING_GREY
+};
+
+/** Frame sizes and crops, with widths around the vector sizes and beyond the
+ * 256 pixel chunks of the NV12 and YUYV paths */
+static const struct
+{
+   unsigned int width, height;
+   MMAL_RECT_T crop;
+} check_sizes[] =
+{
+   {16, 2, {0, 0, 0, 0}},
+   {64, 16, {0, 0, 0, 0}},
+   {46, 10, {0, 0, 0, 0}},
+   {30, 6, {0, 0, 0, 0}},
+   {642, 8, {0, 0, 0, 0}},
+   {96, 32, {3, 5, 71, 21}},
+   {1280, 4, {2, 0, 1150, 4}},
+};
+
+static void check_format(MMAL_ES_FORMAT_T *format, MMAL_FOURCC_T encoding, unsigned int size)
+{
+   format->type = MMAL_ES_TYPE_VIDEO;
+   format->encoding = encoding;
+   format->es->video.width = check_sizes[size].width;
+   format->es->video.height = check_sizes[size].height;
+   format->es->video.crop = check_sizes[size].crop;
+}
+
+static int check_conversion(MMAL_FOURCC_T from, MMAL_FOURCC_T to, unsigned int size)
+{
+   MMAL_ES_FORMAT_T *src_format = mmal_format_alloc(), *dst_format = mmal_format_alloc();
+   uint8_t *src, *dst, *dst_c;
+   uint32_t src_size, dst_size, i;
+   int result = -1;
+
+   CHECK(src_format && dst_format);
+   check_format(src_format, from, size);
+   check_format(dst_format, to, size);
+   src_size = mmal_frame_size(src_format);
+   dst_size = mmal_frame_size(dst_format);
+   CHECK(src_size && dst_size);
+
+   src = malloc(src_size);
+   dst = malloc(dst_size);
+   dst_c = malloc(dst_size);
+   if (src && dst && dst_c)
+   {
+      /* Random samples, plus runs of extremes to hit the clamping */
+      for (i = 0; i < src_size; i++)
+         src[i] = (i / 7) % 5 == 0 ? 0 : (i / 7) % 5 == 1 ? 255 : (uint8_t)rand();
+      memset(dst, 0x5A, dst_size);
+      memset(dst_c, 0x5A, dst_size);
+
+      if (mmal_frame_convert(dst, dst_size, dst_format, src, src_size, src_format) == MMAL_SUCCESS &&
+          mmal_check_c_frame_convert(dst_c, dst_size, dst_format, src, src_size, src_format) == MMAL_SUCCESS)
+      {
+         for (i = 0; i < dst_size && dst[i] == dst_c[i]; i++);
+         if (i == dst_size)
+            result = 0;
+         else
+            fprintf(stderr, "%4.4s to %4.4s, %ux%u: byte %u is %u instead of %u\n",
+                    (char *)&from, (char *)&to, check_sizes[size].width, check_sizes[size].height,
+                    i, dst[i], dst_c[i]);
+      }
+   }
+
+   free(src);
+   free(dst);
+   free(dst_c);
+   mmal_format_free(src_format);
+   mmal_format_free(dst_format);
+   return result;
+}
+
+int main(int argc, char **argv)
+{
+   unsigned int from, to, size, conversions = 0, failures = 0;
+
+   MMAL_PARAM_UNUSED(argc);
+   MMAL_PARAM_UNUSED(argv);
+   vcos_init();
+   srand(1);
+
+   for (from = 0; from < vcos_countof(check_encodings); from++)
+      for (to = 0; to < vcos_countof(check_encodings); to++)
+      {
+         if (!mmal_frame_convert_supported(check_encodings[from], check_encodings[to]))
+            continue;
+         for (size = 0; size < vcos_countof(check_sizes); size++)
+         {
+            conversions++;
+            if (check_conversion(check_encodings[from], check_encodings[to], size))
+               failures++;
+         }
+      }
+
+#if defined(MMAL_UTIL_CONVERT_NEON) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+   printf("NEON against C: ");
+#elif defined(__SSE2__)
+   printf("SSE2 against C: ");
+#else
+   printf("C against C: ");
+#endif
+   printf("%u conversions, %s\n", conversions, failures ? "FAILED" : "ok");
+   return failures ? 1 : 0;
+}
@@ -0,0 +1,133 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/* Checks that the vectorised vertical filter of the software ISP gives the
+ * same results as the C one. The filters are built for a range of downscaling
+ * and upscaling ratios and run on random rows of every width up to a few
+ * vectors, so that the vector loop and its C tail are both used, against a
+ * copy of the ISP built with its C kernels only.
+ *
+ * Usage: mmal_check_isp
+ */
+
+#include "core/mmal_component_private.h"
+
+/* The kernels are static, so the ISP is built into the check. Its component
+ * isn't registered, the real one lives in mmal_components. */
+#define mmal_register_component_isp mmal_check_isp_register
+#define mmal_component_supplier_register(prefix, create) ((void)(prefix), (void)(create))
+
+#include "components/isp.c"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* From mmal_check_isp_c.c */
+void mmal_check_isp_filter_vertical_c(uint8_t *dst, const uint8_t *src, uint32_t pitch,
+   const uint8_t *weights, unsigned int taps, unsigned int width);
+
+#define CHECK_MAX_WIDTH 70
+#define CHECK_PITCH 80
+#define CHECK_MAX_ROWS 64
+
+#define CHECK(cond) do { if (!(cond)) { \
+   fprintf(stderr, "%s:%i: check failed: %s\n", __FILE__, __LINE__, #cond); \
+   return -1; } } while (0)
+
+/** Scaling ratios, as numbers of source and destination rows */
+static const struct
+{
+   uint32_t src, dst;
+} check_ratios[] =
+{
+   {16, 16}, {64, 3}, {60, 7}, {35, 16}, {32, 16}, {17, 9}, {9, 17}, {16, 40}, {3, 64},
+};
+
+static uint8_t check_src[CHECK_MAX_ROWS * CHECK_PITCH];
+
+static int check_ratio(uint32_t src_rows, uint32_t dst_rows)
+{
+   uint8_t dst[CHECK_MAX_WIDTH], dst_c[CHECK_MAX_WIDTH];
+   ISP_FILTER_T filter;
+   unsigned int row, width, i;
+
+   memset(&filter, 0, sizeof(filter));
+   CHECK(isp_filter_init(&filter, src_rows, dst_rows) == MMAL_SUCCESS);
+
+   for (row = 0; row < dst_rows; row++)
+   {
+      const uint8_t *src = check_src + filter.first[row] * CHECK_PITCH;
+      const uint8_t *weights = filter.weights + row * filter.taps;
+
+      for (width = 1; width <= CHECK_MAX_WIDTH; width++)
+      {
+         memset(dst, 0x5A, sizeof(dst));
+         memset(dst_c, 0x5A, sizeof(dst_c));
+         isp_filter_vertical(dst, src, CHECK_PITCH, 1, weights, filter.taps, width);
+         mmal_check_isp_filter_vertical_c(dst_c, src, CHECK_PITCH, weights, filter.taps, width);
+         for (i = 0; i < sizeof(dst) && dst[i] == dst_c[i]; i++);
+         if (i < sizeof(dst))
+         {
+            fprintf(stderr, "%u to %u rows, row %u, width %u: sample %u is %u instead of %u\n",
+                    src_rows, dst_rows, row, width, i, dst[i], dst_c[i]);
+            isp_filter_free(&filter);
+            return -1;
+         }
+      }
+   }
+
+   isp_filter_free(&filter);
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   unsigned int i, failures = 0;
+
+   MMAL_PARAM_UNUSED(argc);
+   MMAL_PARAM_UNUSED(argv);
+   vcos_init();
+   srand(1);
+
+   /* Random samples, plus runs of extremes to check the sums don't overflow */
+   for (i = 0; i < sizeof(check_src); i++)
+      check_src[i] = (i / 5) % 4 == 0 ? 255 : (i / 5) % 4 == 1 ? 0 : (uint8_t)rand();
+
+   for (i = 0; i < vcos_countof(check_ratios); i++)
+      if (check_ratio(check_ratios[i].src, check_ratios[i].dst))
+         failures++;
+
+#if defined(ISP_NEON)
+   printf("NEON against C: ");
+#elif defined(ISP_SSE2)
+   printf("SSE2 against C: ");
+#else
+   printf("C against C: ");
+#endif
+   printf("%u ratios, %s\n", (unsigned int)vcos_countof(check_ratios), failures ? "FAILED" : "ok");
+   return failures ? 1 : 0;
+}
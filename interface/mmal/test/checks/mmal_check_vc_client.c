@@ -0,0 +1,369 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/* Checks of the request tracking of the MMAL VC client, run against a
+ * loopback stand-in for VCHIQ so that replies can be delayed, dropped or
+ * delivered after the request was given up on.
+ *
+ * Usage: mmal_check_vc_client
+ */
+
+#include "mmal.h"
+#include "interface/mmal/vc/mmal_vc_msgs.h"
+#include "interface/mmal/vc/mmal_vc_api.h"
+#include "interface/mmal/vc/mmal_vc_client_priv.h"
+#include "interface/vcos/vcos.h"
+#include "mmal_vc_loopback.h"
+#include <stdio.h>
+#include <string.h>
+
+/** Number of requests the client can have in flight, see MAX_WAITERS */
+#define CHECK_WAITERS_MAX 256
+/** Deadline given to the requests which are expected to expire */
+#define CHECK_TIMEOUT_MS 50
+/** Deadline given to the other requests, so that a leaked waiter makes the
+ * check fail rather than hang */
+#define CHECK_LONG_TIMEOUT_MS 1000
+
+#define CHECK(cond) do { if (!(cond)) { \
+   fprintf(stderr, "%s:%i: check failed: %s\n", __FILE__, __LINE__, #cond); \
+   return -1; } } while (0)
+
+typedef struct
+{
+   mmal_worker_msg_header msg;
+   mmal_worker_reply reply;
+   uint32_t request;
+} CHECK_REQUEST_T;
+
+typedef struct
+{
+   VCOS_SEMAPHORE_T sem;
+   unsigned int calls;
+   MMAL_STATUS_T status;
+} CHECK_CALLBACK_T;
+
+static void check_callback(void *cb_data, uint32_t request, MMAL_STATUS_T status, size_t replylen)
+{
+   CHECK_CALLBACK_T *cb = (CHECK_CALLBACK_T *)cb_data;
+   MMAL_PARAM_UNUSED(request);
+   MMAL_PARAM_UNUSED(replylen);
+   cb->status = status;
+   cb->calls++;
+   vcos_semaphore_post(&cb->sem);
+}
+
+static void check_request_init(CHECK_REQUEST_T *request)
+{
+   memset(&request->msg, 0, sizeof(request->msg));
+   memset(&request->reply, 0xaa, sizeof(request->reply));
+   request->request = 0;
+}
+
+/** Whether the destination of a request was left alone */
+static MMAL_BOOL_T check_reply_untouched(const CHECK_REQUEST_T *request)
+{
+   const uint8_t *data = (const uint8_t *)&request->reply;
+   unsigned int i;
+
+   for (i = 0; i < sizeof(request->reply); i++)
+      if (data[i] != 0xaa)
+         return MMAL_FALSE;
+   return MMAL_TRUE;
+}
+
+static MMAL_STATUS_T check_send(CHECK_REQUEST_T *request, uint32_t timeout_ms,
+                                CHECK_CALLBACK_T *cb)
+{
+   check_request_init(request);
+   return mmal_vc_send_message_async(mmal_vc_get_client(), &request->msg, sizeof(request->msg),
+                                     MMAL_WORKER_GET_VERSION, &request->reply,
+                                     sizeof(request->reply), timeout_ms,
+                                     cb ? check_callback : NULL, cb, &request->request);
+}
+
+/*****************************************************************************/
+/** A request which gets no reply in time fails with MMAL_EAGAIN, and the reply
+ * arriving afterwards only recycles the waiter */
+static int check_deadline(void)
+{
+   CHECK_REQUEST_T request;
+   CHECK_CALLBACK_T cb;
+   uint64_t start, elapsed;
+
+   /* Waited for */
+   CHECK(check_send(&request, CHECK_TIMEOUT_MS, NULL) == MMAL_SUCCESS);
+   start = vcos_getmicrosecs64();
+   CHECK(mmal_vc_wait_reply(mmal_vc_get_client(), request.request, NULL) == MMAL_EAGAIN);
+   elapsed = vcos_getmicrosecs64() - start;
+   CHECK(elapsed >= CHECK_TIMEOUT_MS * 1000 - 1000);
+   CHECK(mmal_vc_wait_reply(mmal_vc_get_client(), request.request, NULL) == MMAL_EINVAL);
+   CHECK(mmal_vc_loopback_reply(MMAL_SUCCESS));
+   CHECK(check_reply_untouched(&request));
+
+   /* With a completion callback, expired by the timer of the client */
+   memset(&cb, 0, sizeof(cb));
+   CHECK(vcos_semaphore_create(&cb.sem, "check cb", 0) == VCOS_SUCCESS);
+   CHECK(check_send(&request, CHECK_TIMEOUT_MS, &cb) == MMAL_SUCCESS);
+   CHECK(vcos_semaphore_wait_timeout(&cb.sem, CHECK_LONG_TIMEOUT_MS) == VCOS_SUCCESS);
+   CHECK(cb.calls == 1 && cb.status == MMAL_EAGAIN);
+   CHECK(mmal_vc_loopback_reply(MMAL_SUCCESS));
+   CHECK(cb.calls == 1);
+   CHECK(check_reply_untouched(&request));
+   vcos_semaphore_delete(&cb.sem);
+
+   /* A reply arriving in time still gets through */
+   CHECK(check_send(&request, CHECK_LONG_TIMEOUT_MS, NULL) == MMAL_SUCCESS);
+   CHECK(mmal_vc_loopback_reply(MMAL_ENOSYS));
+   CHECK(mmal_vc_wait_reply(mmal_vc_get_client(), request.request, NULL) == MMAL_SUCCESS);
+   CHECK(request.reply.status == MMAL_ENOSYS);
+
+   CHECK(!mmal_vc_loopback_pending());
+   return 0;
+}
+
+/** A cancelled request ignores its reply when it comes */
+static int check_cancel(void)
+{
+   CHECK_REQUEST_T request;
+   CHECK_CALLBACK_T cb;
+
+   /* Cancelled before the reply */
+   CHECK(check_send(&request, 0, NULL) == MMAL_SUCCESS);
+   CHECK(mmal_vc_cancel_reply(mmal_vc_get_client(), request.request) == MMAL_SUCCESS);
+   CHECK(mmal_vc_cancel_reply(mmal_vc_get_client(), request.request) == MMAL_EINVAL);
+   CHECK(mmal_vc_wait_reply(mmal_vc_get_client(), request.request, NULL) == MMAL_EINVAL);
+   CHECK(mmal_vc_loopback_reply(MMAL_SUCCESS));
+   CHECK(check_reply_untouched(&request));
+
+   /* Cancelled after the reply, which was never collected */
+   CHECK(check_send(&request, 0, NULL) == MMAL_SUCCESS);
+   CHECK(mmal_vc_loopback_reply(MMAL_SUCCESS));
+   CHECK(mmal_vc_cancel_reply(mmal_vc_get_client(), request.request) == MMAL_SUCCESS);
+   CHECK(mmal_vc_wait_reply(mmal_vc_get_client(), request.request, NULL) == MMAL_EINVAL);
+
+   /* With a completion callback, which must never be called */
+   memset(&cb, 0, sizeof(cb));
+   CHECK(vcos_semaphore_create(&cb.sem, "check cb", 0) == VCOS_SUCCESS);
+   CHECK(check_send(&request, CHECK_TIMEOUT_MS, &cb) == MMAL_SUCCESS);
+   CHECK(mmal_vc_cancel_reply(mmal_vc_get_client(), request.request) == MMAL_SUCCESS);
+   vcos_sleep(2 * CHECK_TIMEOUT_MS);
+   CHECK(mmal_vc_loopback_reply(MMAL_SUCCESS));
+   CHECK(cb.calls == 0);
+   CHECK(check_reply_untouched(&request));
+   vcos_semaphore_delete(&cb.sem);
+
+   CHECK(!mmal_vc_loopback_pending());
+   return 0;
+}
+
+/** The waiter table grows up to its limit, then requests wait for a slot */
+static int check_waiters(void)
+{
+   CHECK_REQUEST_T *requests, extra;
+   unsigned int i, round;
+
+   requests = vcos_calloc(CHECK_WAITERS_MAX, sizeof(*requests), "check requests");
+   CHECK(requests);
+
+   for (round = 0; round < 2; round++)
+   {
+      for (i = 0; i < CHECK_WAITERS_MAX; i++)
+         CHECK(check_send(&requests[i], CHECK_LONG_TIMEOUT_MS, NULL) == MMAL_SUCCESS);
+      CHECK(mmal_vc_loopback_pending() == CHECK_WAITERS_MAX);
+
+      /* The table is full */
+      CHECK(check_send(&extra, CHECK_TIMEOUT_MS, NULL) == MMAL_EAGAIN);
+      CHECK(mmal_vc_loopback_pending() == CHECK_WAITERS_MAX);
+
+      /* The replies go to the right requests, whatever order they are
+       * collected in */
+      for (i = 0; i < CHECK_WAITERS_MAX; i++)
+         CHECK(mmal_vc_loopback_reply(i & 1 ? MMAL_ENOSYS : MMAL_SUCCESS));
+      for (i = CHECK_WAITERS_MAX; i-- > 0; )
+      {
+         CHECK(mmal_vc_wait_reply(mmal_vc_get_client(), requests[i].request, NULL) == MMAL_SUCCESS);
+         CHECK(requests[i].reply.status == (i & 1 ? MMAL_ENOSYS : MMAL_SUCCESS));
+      }
+   }
+
+   /* A slot freed by a reply lets a waiting request through */
+   for (i = 0; i < CHECK_WAITERS_MAX; i++)
+      CHECK(check_send(&requests[i], CHECK_LONG_TIMEOUT_MS, NULL) == MMAL_SUCCESS);
+   CHECK(mmal_vc_cancel_reply(mmal_vc_get_client(), requests[0].request) == MMAL_SUCCESS);
+   CHECK(check_send(&extra, CHECK_TIMEOUT_MS, NULL) == MMAL_EAGAIN);
+   CHECK(mmal_vc_loopback_reply(MMAL_SUCCESS));
+   CHECK(check_send(&extra, CHECK_TIMEOUT_MS, NULL) == MMAL_SUCCESS);
+   for (i = 1; i < CHECK_WAITERS_MAX; i++)
+      CHECK(mmal_vc_cancel_reply(mmal_vc_get_client(), requests[i].request) == MMAL_SUCCESS);
+   while (mmal_vc_loopback_reply(MMAL_SUCCESS))
+      ;
+   CHECK(mmal_vc_wait_reply(mmal_vc_get_client(), extra.request, NULL) == MMAL_SUCCESS);
+
+   vcos_free(requests);
+   return 0;
+}
+
+typedef struct
+{
+   CHECK_REQUEST_T request;
+   MMAL_BOOL_T wait_reply;    /**< wait with mmal_vc_wait_reply rather than send and wait */
+   VCOS_SEMAPHORE_T started;
+   VCOS_THREAD_T thread;
+   volatile MMAL_BOOL_T done;
+   MMAL_STATUS_T status;
+} CHECK_WAITING_T;
+
+static void *check_waiting_thread(void *arg)
+{
+   CHECK_WAITING_T *waiting = (CHECK_WAITING_T *)arg;
+   size_t len = sizeof(waiting->request.reply);
+
+   if (waiting->wait_reply)
+   {
+      vcos_semaphore_post(&waiting->started);
+      waiting->status = mmal_vc_wait_reply(mmal_vc_get_client(), waiting->request.request, NULL);
+   }
+   else
+   {
+      check_request_init(&waiting->request);
+      vcos_semaphore_post(&waiting->started);
+      waiting->status = mmal_vc_sendwait_message(mmal_vc_get_client(), &waiting->request.msg,
+                                                 sizeof(waiting->request.msg), MMAL_WORKER_GET_VERSION,
+                                                 &waiting->request.reply, &len, MMAL_FALSE);
+   }
+   waiting->done = MMAL_TRUE;
+   return NULL;
+}
+
+static MMAL_BOOL_T check_waiting_start(CHECK_WAITING_T *waiting, MMAL_BOOL_T wait_reply)
+{
+   waiting->wait_reply = wait_reply;
+   waiting->done = MMAL_FALSE;
+   waiting->status = MMAL_SUCCESS;
+   if (vcos_semaphore_create(&waiting->started, "check started", 0) != VCOS_SUCCESS)
+      return MMAL_FALSE;
+   if (vcos_thread_create(&waiting->thread, "check waiting", NULL, check_waiting_thread, waiting) != VCOS_SUCCESS)
+   {
+      vcos_semaphore_delete(&waiting->started);
+      return MMAL_FALSE;
+   }
+   vcos_semaphore_wait(&waiting->started);
+   vcos_semaphore_delete(&waiting->started);
+   /* Give the thread time to block */
+   vcos_sleep(CHECK_TIMEOUT_MS);
+   return MMAL_TRUE;
+}
+
+/** The synchronous calls have no deadline, they wait for as long as it takes */
+static int check_sync(void)
+{
+   CHECK_WAITING_T waiting;
+
+   CHECK(check_waiting_start(&waiting, MMAL_FALSE));
+   vcos_sleep(2 * CHECK_LONG_TIMEOUT_MS);
+   CHECK(!waiting.done);
+   CHECK(mmal_vc_loopback_reply(MMAL_ENOSYS));
+   vcos_thread_join(&waiting.thread, NULL);
+   CHECK(waiting.status == MMAL_SUCCESS);
+   CHECK(waiting.request.reply.status == MMAL_ENOSYS);
+
+   CHECK(!mmal_vc_loopback_pending());
+   return 0;
+}
+
+/** Shutting the client down fails the requests in flight and wakes up the
+ * threads waiting for them, which must then be left alone */
+static int check_shutdown(void)
+{
+   CHECK_WAITING_T sync, async;
+   CHECK_REQUEST_T request;
+   CHECK_CALLBACK_T cb;
+
+   memset(&cb, 0, sizeof(cb));
+   CHECK(vcos_semaphore_create(&cb.sem, "check cb", 0) == VCOS_SUCCESS);
+   CHECK(check_send(&request, 0, &cb) == MMAL_SUCCESS);
+   CHECK(check_send(&async.request, 0, NULL) == MMAL_SUCCESS);
+   CHECK(check_waiting_start(&async, MMAL_TRUE));
+   CHECK(check_waiting_start(&sync, MMAL_FALSE));
+   CHECK(mmal_vc_loopback_pending() == 3);
+
+   mmal_vc_deinit();
+   vcos_thread_join(&sync.thread, NULL);
+   vcos_thread_join(&async.thread, NULL);
+   CHECK(sync.status == MMAL_EIO);
+   CHECK(async.status == MMAL_EIO);
+   CHECK(cb.calls == 1 && cb.status == MMAL_EIO);
+   CHECK(check_reply_untouched(&request));
+   vcos_semaphore_delete(&cb.sem);
+
+   /* The client can be opened again */
+   CHECK(mmal_vc_init() == MMAL_SUCCESS);
+   CHECK(!mmal_vc_loopback_pending());
+   CHECK(check_send(&request, CHECK_LONG_TIMEOUT_MS, NULL) == MMAL_SUCCESS);
+   CHECK(mmal_vc_loopback_reply(MMAL_SUCCESS));
+   CHECK(mmal_vc_wait_reply(mmal_vc_get_client(), request.request, NULL) == MMAL_SUCCESS);
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   static const struct
+   {
+      const char *name;
+      int (*check)(void);
+   } checks[] =
+   {
+      { "deadline", check_deadline },
+      { "cancel", check_cancel },
+      { "waiters", check_waiters },
+      { "sync", check_sync },
+      { "shutdown", check_shutdown },
+   };
+   unsigned int i, failures = 0;
+   MMAL_PARAM_UNUSED(argc);
+   MMAL_PARAM_UNUSED(argv);
+
+   vcos_init();
+   if (mmal_vc_init() != MMAL_SUCCESS)
+   {
+      fprintf(stderr, "failed to open the loopback service\n");
+      return 1;
+   }
+
+   for (i = 0; i < vcos_countof(checks); i++)
+   {
+      int result = checks[i].check();
+      printf("%s: %s\n", checks[i].name, result ? "FAILED" : "ok");
+      if (result)
+         failures++;
+   }
+
+   mmal_vc_deinit();
+   return failures ? 1 : 0;
+}
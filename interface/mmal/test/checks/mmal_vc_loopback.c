@@ -0,0 +1,215 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#include "interface/vcos/vcos.h"
+#include "interface/vchiq_arm/vchiq_if.h"
+#include "interface/mmal/vc/mmal_vc_msgs.h"
+#include "mmal_vc_loopback.h"
+#include <string.h>
+
+/** Maximum number of messages waiting for a reply */
+#define LOOPBACK_MESSAGES_MAX 1024
+
+struct vchiq_instance_struct
+{
+   int connected;
+};
+
+static struct
+{
+   VCOS_ONCE_T once;
+   VCOS_MUTEX_T lock;
+   struct vchiq_instance_struct instance;
+
+   VCHIQ_CALLBACK_T callback;
+   void *userdata;
+   MMAL_BOOL_T opened;
+
+   /** Headers of the messages waiting for a reply, oldest first */
+   mmal_worker_msg_header messages[LOOPBACK_MESSAGES_MAX];
+   unsigned int first;
+   unsigned int num;
+} loopback = { VCOS_ONCE_INIT };
+
+#define LOOPBACK_SERVICE 1
+
+static void loopback_init_once(void)
+{
+   vcos_mutex_create(&loopback.lock, "mmal vc loopback");
+}
+
+/*****************************************************************************/
+VCHIQ_STATUS_T vchiq_initialise_fd(VCHIQ_INSTANCE_T *pinstance, int dev_vchiq_fd)
+{
+   vcos_unused(dev_vchiq_fd);
+   vcos_once(&loopback.once, loopback_init_once);
+   *pinstance = &loopback.instance;
+   return VCHIQ_SUCCESS;
+}
+
+VCHIQ_STATUS_T vchiq_shutdown(VCHIQ_INSTANCE_T instance)
+{
+   instance->connected = 0;
+   return VCHIQ_SUCCESS;
+}
+
+VCHIQ_STATUS_T vchiq_connect(VCHIQ_INSTANCE_T instance)
+{
+   instance->connected = 1;
+   return VCHIQ_SUCCESS;
+}
+
+VCHIQ_STATUS_T vchiq_open_service(VCHIQ_INSTANCE_T instance,
+   const VCHIQ_SERVICE_PARAMS_T *params, VCHIQ_SERVICE_HANDLE_T *pservice)
+{
+   if (!instance->connected)
+      return VCHIQ_ERROR;
+
+   vcos_mutex_lock(&loopback.lock);
+   loopback.callback = params->callback;
+   loopback.userdata = params->userdata;
+   loopback.opened = MMAL_TRUE;
+   loopback.first = loopback.num = 0;
+   vcos_mutex_unlock(&loopback.lock);
+
+   *pservice = LOOPBACK_SERVICE;
+   return VCHIQ_SUCCESS;
+}
+
+VCHIQ_STATUS_T vchiq_close_service(VCHIQ_SERVICE_HANDLE_T service)
+{
+   vcos_unused(service);
+   vcos_mutex_lock(&loopback.lock);
+   loopback.opened = MMAL_FALSE;
+   vcos_mutex_unlock(&loopback.lock);
+   return VCHIQ_SUCCESS;
+}
+
+VCHIQ_STATUS_T vchiq_use_service(VCHIQ_SERVICE_HANDLE_T service)
+{
+   return service == LOOPBACK_SERVICE ? VCHIQ_SUCCESS : VCHIQ_ERROR;
+}
+
+VCHIQ_STATUS_T vchiq_release_service(VCHIQ_SERVICE_HANDLE_T service)
+{
+   return service == LOOPBACK_SERVICE ? VCHIQ_SUCCESS : VCHIQ_ERROR;
+}
+
+VCHIQ_STATUS_T vchiq_queue_message(VCHIQ_SERVICE_HANDLE_T service,
+   const VCHIQ_ELEMENT_T *elements, int count)
+{
+   VCHIQ_STATUS_T status = VCHIQ_ERROR;
+
+   if (service != LOOPBACK_SERVICE || count < 1 ||
+       elements[0].size < (int)sizeof(mmal_worker_msg_header))
+      return VCHIQ_ERROR;
+
+   vcos_mutex_lock(&loopback.lock);
+   if (loopback.opened && loopback.num < LOOPBACK_MESSAGES_MAX)
+   {
+      unsigned int index = (loopback.first + loopback.num++) % LOOPBACK_MESSAGES_MAX;
+      memcpy(&loopback.messages[index], elements[0].data, sizeof(loopback.messages[index]));
+      status = VCHIQ_SUCCESS;
+   }
+   vcos_mutex_unlock(&loopback.lock);
+   return status;
+}
+
+void vchiq_release_message(VCHIQ_SERVICE_HANDLE_T service, VCHIQ_HEADER_T *header)
+{
+   /* The replies are freed once the callback returns */
+   vcos_unused(service);
+   vcos_unused(header);
+}
+
+/* Nothing is ever sent in bulk by the requests made in loopback */
+VCHIQ_STATUS_T vchiq_queue_bulk_transmit(VCHIQ_SERVICE_HANDLE_T service,
+   const void *data, int size, void *userdata)
+{
+   vcos_unused(service);
+   vcos_unused(data);
+   vcos_unused(size);
+   vcos_unused(userdata);
+   return VCHIQ_ERROR;
+}
+
+VCHIQ_STATUS_T vchiq_queue_bulk_receive(VCHIQ_SERVICE_HANDLE_T service,
+   void *data, int size, void *userdata)
+{
+   vcos_unused(service);
+   vcos_unused(data);
+   vcos_unused(size);
+   vcos_unused(userdata);
+   return VCHIQ_ERROR;
+}
+
+/*****************************************************************************/
+unsigned int mmal_vc_loopback_pending(void)
+{
+   unsigned int num;
+
+   vcos_mutex_lock(&loopback.lock);
+   num = loopback.num;
+   vcos_mutex_unlock(&loopback.lock);
+   return num;
+}
+
+MMAL_BOOL_T mmal_vc_loopback_reply(MMAL_STATUS_T status)
+{
+   VCHIQ_HEADER_T *header;
+   mmal_worker_reply *reply;
+   VCHIQ_CALLBACK_T callback;
+   void *userdata;
+
+   header = vcos_calloc(1, sizeof(*header) + sizeof(*reply), "mmal vc loopback reply");
+   if (!header)
+      return MMAL_FALSE;
+   reply = (mmal_worker_reply *)header->data;
+
+   vcos_mutex_lock(&loopback.lock);
+   if (!loopback.num)
+   {
+      vcos_mutex_unlock(&loopback.lock);
+      vcos_free(header);
+      return MMAL_FALSE;
+   }
+   reply->header = loopback.messages[loopback.first];
+   loopback.first = (loopback.first + 1) % LOOPBACK_MESSAGES_MAX;
+   loopback.num--;
+   callback = loopback.callback;
+   userdata = loopback.userdata;
+   vcos_mutex_unlock(&loopback.lock);
+
+   reply->header.status = status;
+   reply->status = status;
+   header->size = sizeof(*reply);
+   callback(VCHIQ_MESSAGE_AVAILABLE, header, LOOPBACK_SERVICE, userdata);
+
+   vcos_free(header);
+   return MMAL_TRUE;
+}
@@ -0,0 +1,54 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+#ifndef MMAL_VC_LOOPBACK_H
+#define MMAL_VC_LOOPBACK_H
+
+/** @file mmal_vc_loopback.h
+ *
+ * Stand-in for the VCHIQ library used to check the MMAL VC client without
+ * VideoCore. Messages queued by the client are kept in order and only get a
+ * reply when the check asks for one, so replies can be made late or never.
+ */
+
+#include "interface/mmal/mmal_types.h"
+
+/** Number of messages which have been queued and not replied to yet */
+unsigned int mmal_vc_loopback_pending(void);
+
+/** Reply to the oldest message still waiting for a reply.
+ *
+ * The reply is delivered to the client from the calling thread, as VCHIQ
+ * does from its own thread.
+ *
+ * @param status  status carried by the reply
+ * @return MMAL_TRUE if there was a message to reply to
+ */
+MMAL_BOOL_T mmal_vc_loopback_reply(MMAL_STATUS_T status);
+
+#endif /* MMAL_VC_LOOPBACK_H */
@@ -29,6 +29,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "util/mmal_util.h"
 #include "util/mmal_connection.h"
 #include "mmal_logging.h"
+#include "mmal_trace.h"
 #include <stdio.h>
 
 #define CONNECTION_NAME_FORMAT "%s:%.2222s:%i/%s:%.2222s:%i"
@@ -51,6 +52,7 @@ static void mmal_connection_bh_clock_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T
    MMAL_PORT_T *other_port = (port == connection->in) ? connection->out : connection->in;
 
    LOG_TRACE("(%s)%p,%p,%p,%i", port->name, port, buffer, buffer->data, (int)buffer->length);
+   MMAL_TRACE_PORT(MMAL_TRACE_EVENT_CONNECTION, port, buffer);
 
    if (other_port->is_enabled)
    {
@@ -71,6 +73,7 @@ static void mmal_connection_bh_clock_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T
 static void mmal_connection_bh_in_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *buffer)
 {
    LOG_TRACE("(%s)%p,%p,%p,%i", port->name, port, buffer, buffer->data, (int)buffer->length);
+   MMAL_TRACE_PORT(MMAL_TRACE_EVENT_CONNECTION, port, buffer);
 
    /* We're done with the buffer, just recycle it */
    mmal_buffer_header_release(buffer);
@@ -82,6 +85,7 @@ static void mmal_connection_bh_out_cb(MMAL_PORT_T *port, MMAL_BUFFER_HEADER_T *b
    MMAL_CONNECTION_T *connection = (MMAL_CONNECTION_T *)port->userdata;
 
    LOG_TRACE("(%s)%p,%p,%p,%i", port->name, port, buffer, buffer->data, (int)buffer->length);
+   MMAL_TRACE_PORT(MMAL_TRACE_EVENT_CONNECTION, port, buffer);
 
    /* Queue the buffer produced by the output port */
    mmal_queue_put(connection->queue, buffer);
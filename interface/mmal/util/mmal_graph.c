@@ -440,10 +440,12 @@ MMAL_STATUS_T mmal_graph_disable(MMAL_GRAPH_T *graph)
 
    graph_stop_worker_thread(private);
 
-   /* Disable all our connections */
-   for (i = 0; i < private->connection_num; i++)
+   /* Disable all our connections, downstream ones first so that components
+    * don't get disabled while they still hold references to buffers coming
+    * from upstream */
+   for (i = private->connection_num; i; i--)
    {
-      status = mmal_connection_disable(private->connection[i]);
+      status = mmal_connection_disable(private->connection[i-1]);
       if (status != MMAL_SUCCESS)
          break;
    }
@@ -27,6 +27,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "interface/mmal/mmal.h"
 #include "mmal_encodings.h"
 #include "mmal_util.h"
+#include "mmal_util_params.h"
 #include "mmal_logging.h"
 #include <string.h>
 #include <stdio.h>
@@ -107,6 +108,7 @@ static struct {
    {MMAL_ENCODING_YVYU,  2, 1, 1},
    {MMAL_ENCODING_UYVY,  2, 1, 1},
    {MMAL_ENCODING_VYUY,  2, 1, 1},
+   {MMAL_ENCODING_GREY,  1, 1, 1},
 
    // Bayer formats, the resulting alignment must also be a multiple of 16.
    // Camplus padded to a multiple of 32, so let's copy that.
@@ -320,6 +322,53 @@ void mmal_port_pool_destroy(MMAL_PORT_T *port, MMAL_POOL_T *pool)
    mmal_pool_destroy(pool);
 }
 
+/** Number of buffer headers taken from a pool for each batch sent to a port */
+#define SEND_POOL_BATCH_SIZE 16
+
+/** Send all the buffer headers available in a pool to a port */
+MMAL_STATUS_T mmal_port_send_pool_buffers(MMAL_PORT_T *port, MMAL_POOL_T *pool,
+   unsigned int *sent)
+{
+   MMAL_BUFFER_HEADER_T *buffers[SEND_POOL_BATCH_SIZE];
+   MMAL_STATUS_T status = MMAL_SUCCESS;
+   unsigned int total = 0, num, count;
+
+   if (sent)
+      *sent = 0;
+   if (!port || !pool)
+      return MMAL_EINVAL;
+
+   /* Walk the pool in fixed size batches so this can be called on every frame
+    * without going through the allocator */
+   while (total < pool->headers_num)
+   {
+      num = 0;
+      while (num < SEND_POOL_BATCH_SIZE && total + num < pool->headers_num &&
+             (buffers[num] = mmal_queue_get(pool->queue)) != NULL)
+         num++;
+      if (!num)
+         break;
+
+      count = num;
+      status = mmal_port_send_buffers(port, buffers, &count);
+      total += count;
+
+      /* Keep the order of the buffer headers which weren't sent */
+      if (count < num)
+      {
+         while (num > count)
+            mmal_queue_put_back(pool->queue, buffers[--num]);
+         break;
+      }
+      if (status != MMAL_SUCCESS)
+         break;
+   }
+
+   if (sent)
+      *sent = total;
+   return status;
+}
+
 /*****************************************************************************/
 void mmal_log_dump_port(MMAL_PORT_T *port)
 {
@@ -484,3 +533,61 @@ int mmal_util_rgb_order_fixed(MMAL_PORT_T *port)
    }
    return new_fw;
 }
+
+/*****************************************************************************/
+static void mmal_util_dump_histogram(const char *name, const MMAL_CORE_HISTOGRAM_T *histogram, FILE *file)
+{
+   unsigned int i;
+
+   fprintf(file, "  %-12s count %u, max %uus:", name, histogram->count, histogram->max);
+   for (i = 0; i < MMAL_CORE_HISTOGRAM_BUCKETS; i++)
+   {
+      if (!histogram->bucket[i])
+         continue;
+      if (!i)
+         fprintf(file, " 0us:%u", histogram->bucket[i]);
+      else if (i == MMAL_CORE_HISTOGRAM_BUCKETS - 1)
+         fprintf(file, " >=%uus:%u", 1u << (i - 1), histogram->bucket[i]);
+      else
+         fprintf(file, " <%uus:%u", 1u << i, histogram->bucket[i]);
+   }
+   fprintf(file, "\n");
+}
+
+MMAL_STATUS_T mmal_util_dump_port_histograms(MMAL_PORT_T *port, MMAL_BOOL_T reset, FILE *file)
+{
+   MMAL_CORE_PORT_HISTOGRAMS_T histograms;
+   MMAL_STATUS_T status;
+
+   status = mmal_util_get_core_port_histograms(port, reset, &histograms);
+   if (status != MMAL_SUCCESS)
+      return status;
+
+   fprintf(file, "%s\n", port->name);
+   mmal_util_dump_histogram("rx interval", &histograms.rx_interval, file);
+   mmal_util_dump_histogram("tx interval", &histograms.tx_interval, file);
+   mmal_util_dump_histogram("residency", &histograms.residency, file);
+   if (histograms.rx_errors)
+      fprintf(file, "  %-12s %u\n", "rx errors", histograms.rx_errors);
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_util_dump_component_histograms(MMAL_COMPONENT_T *component, MMAL_BOOL_T reset, FILE *file)
+{
+   MMAL_STATUS_T status = MMAL_SUCCESS, ret;
+   unsigned int i;
+
+   for (i = 0; i < component->input_num; i++)
+   {
+      ret = mmal_util_dump_port_histograms(component->input[i], reset, file);
+      if (status == MMAL_SUCCESS)
+         status = ret;
+   }
+   for (i = 0; i < component->output_num; i++)
+   {
+      ret = mmal_util_dump_port_histograms(component->output[i], reset, file);
+      if (status == MMAL_SUCCESS)
+         status = ret;
+   }
+   return status;
+}
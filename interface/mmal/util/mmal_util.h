@@ -29,6 +29,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define MMAL_UTIL_H
 
 #include "interface/mmal/mmal.h"
+#include <stdio.h>
 
 /** \defgroup MmalUtilities Utility functions
  * The utility functions provide helpers for common functionality that is not part
@@ -138,6 +139,19 @@ MMAL_POOL_T *mmal_port_pool_create(MMAL_PORT_T *port,
  */
 void mmal_port_pool_destroy(MMAL_PORT_T *port, MMAL_POOL_T *pool);
 
+/** Send all the buffer headers currently available in a pool to a port.
+ * The buffer headers are taken from the pool in small batches, each sent with a
+ * single call to \ref mmal_port_send_buffers, so no memory is allocated.
+ * Buffer headers which could not be sent are put back in the pool's queue.
+ *
+ * @param port  Port to send the buffer headers to.
+ * @param pool  Pool to take the buffer headers from.
+ * @param sent  If not NULL, set to the number of buffer headers sent.
+ * @return MMAL_SUCCESS if all the available buffer headers were sent.
+ */
+MMAL_STATUS_T mmal_port_send_pool_buffers(MMAL_PORT_T *port, MMAL_POOL_T *pool,
+   unsigned int *sent);
+
 /** Log the content of a \ref MMAL_PORT_T structure.
  *
  * @param port  Pointer to the port to dump.
@@ -182,6 +196,27 @@ char *mmal_4cc_to_string(char *buf, size_t len, uint32_t fourcc);
  */
 int mmal_util_rgb_order_fixed(MMAL_PORT_T *port);
 
+/** Print the latency histograms collected by the core on a port.
+ * Only the non-empty buckets are printed, each labelled with its upper bound.
+ *
+ * @param port   port to dump
+ * @param reset  reset the histograms as well
+ * @param file   where to print them
+ * @return MMAL_SUCCESS or error
+ */
+MMAL_STATUS_T mmal_util_dump_port_histograms(MMAL_PORT_T *port, MMAL_BOOL_T reset, FILE *file);
+
+/** Print the latency histograms collected by the core on all the input and
+ * output ports of a component. Dumping every component of a graph in order
+ * shows where the buffers queue up.
+ *
+ * @param component component to dump
+ * @param reset  reset the histograms as well
+ * @param file   where to print them
+ * @return MMAL_SUCCESS or the first error
+ */
+MMAL_STATUS_T mmal_util_dump_component_histograms(MMAL_COMPONENT_T *component, MMAL_BOOL_T reset, FILE *file);
+
 #ifdef __cplusplus
 }
 #endif
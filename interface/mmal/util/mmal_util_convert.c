@@ -0,0 +1,605 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#include "interface/mmal/mmal.h"
+#include "mmal_encodings.h"
+#include "mmal_util.h"
+#include "mmal_util_convert.h"
+#include "mmal_logging.h"
+#include <string.h>
+
+/* The NEON kernels have not been run on ARM hardware yet, so they are only
+ * built with MMAL_UTIL_CONVERT_NEON until they pass mmal_check_convert there.
+ * MMAL_UTIL_CONVERT_NO_SIMD leaves only the C kernels, which the check compares
+ * the vectorised ones against. */
+#if defined(MMAL_UTIL_CONVERT_NO_SIMD)
+#elif defined(MMAL_UTIL_CONVERT_NEON) && (defined(__ARM_NEON) || defined(__ARM_NEON__))
+#include <arm_neon.h>
+#define CONVERT_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define CONVERT_SSE2 1
+#endif
+
+#define CONVERT_PLANES_MAX 3
+
+/** Description of the planes of an encoding */
+typedef struct
+{
+   MMAL_FOURCC_T encoding;
+   unsigned int planes_num;
+   MMAL_BOOL_T subsampled;  /**< the horizontal position and size must be even */
+   struct {
+      uint8_t bpp;          /**< bytes per pixel within a row of the plane */
+      uint8_t x_shift;      /**< horizontal subsampling */
+      uint8_t y_shift;      /**< vertical subsampling */
+      uint8_t pitch_shift;  /**< pitch of the plane relative to the stride */
+   } plane[CONVERT_PLANES_MAX];
+} CONVERT_ENCODING_T;
+
+static const CONVERT_ENCODING_T convert_encodings[] =
+{
+   {MMAL_ENCODING_I420,  3, MMAL_TRUE,  {{1, 0, 0, 0}, {1, 1, 1, 1}, {1, 1, 1, 1}}},
+   {MMAL_ENCODING_NV12,  2, MMAL_TRUE,  {{1, 0, 0, 0}, {1, 0, 1, 0}}},
+   {MMAL_ENCODING_YUYV,  1, MMAL_TRUE,  {{2, 0, 0, 0}}},
+   {MMAL_ENCODING_RGB24, 1, MMAL_FALSE, {{3, 0, 0, 0}}},
+   {MMAL_ENCODING_BGR24, 1, MMAL_FALSE, {{3, 0, 0, 0}}},
+   {MMAL_ENCODING_GREY,  1, MMAL_FALSE, {{1, 0, 0, 0}}},
+   {MMAL_ENCODING_UNKNOWN, 0, MMAL_FALSE, {{0, 0, 0, 0}}}
+};
+
+/** Frame or region of a frame, with a pointer to the first pixel of each plane */
+typedef struct
+{
+   const CONVERT_ENCODING_T *info;
+   uint8_t *data[CONVERT_PLANES_MAX];
+   uint32_t pitch[CONVERT_PLANES_MAX];
+} CONVERT_FRAME_T;
+
+typedef void (*CONVERT_FN_T)(const CONVERT_FRAME_T *dst, const CONVERT_FRAME_T *src,
+   unsigned int width, unsigned int height);
+
+static const CONVERT_ENCODING_T *convert_encoding_info(MMAL_FOURCC_T encoding)
+{
+   const CONVERT_ENCODING_T *info;
+
+   for (info = convert_encodings; info->encoding != MMAL_ENCODING_UNKNOWN; info++)
+      if (info->encoding == encoding)
+         return info;
+   return NULL;
+}
+
+/** Work out the layout of a frame. Returns the size of the frame, 0 if the
+ * format isn't supported. */
+static uint32_t convert_frame_layout(CONVERT_FRAME_T *frame, const MMAL_ES_FORMAT_T *format,
+   const uint8_t *data)
+{
+   const MMAL_VIDEO_FORMAT_T *video = &format->es->video;
+   uint32_t stride, size = 0;
+   unsigned int i;
+
+   memset(frame, 0, sizeof(*frame));
+   if (format->type != MMAL_ES_TYPE_VIDEO)
+      return 0;
+   frame->info = convert_encoding_info(format->encoding);
+   if (!frame->info)
+      return 0;
+
+   stride = mmal_encoding_width_to_stride(format->encoding, video->width);
+   for (i = 0; i < frame->info->planes_num; i++)
+   {
+      frame->data[i] = (uint8_t *)data + size;
+      frame->pitch[i] = stride >> frame->info->plane[i].pitch_shift;
+      size += frame->pitch[i] * (video->height >> frame->info->plane[i].y_shift);
+   }
+   return size;
+}
+
+/** Move the pointers of a frame to the given pixel */
+static void convert_frame_offset(CONVERT_FRAME_T *frame, unsigned int x, unsigned int y)
+{
+   unsigned int i;
+
+   for (i = 0; i < frame->info->planes_num; i++)
+      frame->data[i] += (y >> frame->info->plane[i].y_shift) * frame->pitch[i] +
+         (x >> frame->info->plane[i].x_shift) * frame->info->plane[i].bpp;
+}
+
+/*****************************************************************************
+ * Row kernels
+ *****************************************************************************/
+
+static void convert_plane_copy(uint8_t *dst, uint32_t dst_pitch, const uint8_t *src, uint32_t src_pitch,
+   unsigned int row_size, unsigned int rows)
+{
+   if (dst_pitch == src_pitch && row_size == src_pitch)
+   {
+      memcpy(dst, src, row_size * rows);
+      return;
+   }
+
+   for (; rows; rows--, dst += dst_pitch, src += src_pitch)
+      memcpy(dst, src, row_size);
+}
+
+/** Interleave 2 chroma rows, as from I420 to NV12 */
+static void convert_row_interleave(uint8_t *uv, const uint8_t *u, const uint8_t *v, unsigned int n)
+{
+   unsigned int i = 0;
+
+#if defined(CONVERT_NEON)
+   for (; i + 16 <= n; i += 16)
+   {
+      uint8x16x2_t pair;
+      pair.val[0] = vld1q_u8(u + i);
+      pair.val[1] = vld1q_u8(v + i);
+      vst2q_u8(uv + 2 * i, pair);
+   }
+#elif defined(CONVERT_SSE2)
+   for (; i + 16 <= n; i += 16)
+   {
+      __m128i a = _mm_loadu_si128((const __m128i *)(u + i));
+      __m128i b = _mm_loadu_si128((const __m128i *)(v + i));
+      _mm_storeu_si128((__m128i *)(uv + 2 * i), _mm_unpacklo_epi8(a, b));
+      _mm_storeu_si128((__m128i *)(uv + 2 * i + 16), _mm_unpackhi_epi8(a, b));
+   }
+#endif
+
+   for (; i < n; i++)
+   {
+      uv[2 * i] = u[i];
+      uv[2 * i + 1] = v[i];
+   }
+}
+
+/** Split a row of byte pairs into 2 rows. This extracts the chroma of NV12
+ * as well as the luma of YUYV (with the chroma going to a scratch row). */
+static void convert_row_deinterleave(uint8_t *a, uint8_t *b, const uint8_t *pairs, unsigned int n)
+{
+   unsigned int i = 0;
+
+#if defined(CONVERT_NEON)
+   for (; i + 16 <= n; i += 16)
+   {
+      uint8x16x2_t pair = vld2q_u8(pairs + 2 * i);
+      vst1q_u8(a + i, pair.val[0]);
+      vst1q_u8(b + i, pair.val[1]);
+   }
+#elif defined(CONVERT_SSE2)
+   const __m128i mask = _mm_set1_epi16(0xff);
+   for (; i + 16 <= n; i += 16)
+   {
+      __m128i lo = _mm_loadu_si128((const __m128i *)(pairs + 2 * i));
+      __m128i hi = _mm_loadu_si128((const __m128i *)(pairs + 2 * i + 16));
+      _mm_storeu_si128((__m128i *)(a + i),
+         _mm_packus_epi16(_mm_and_si128(lo, mask), _mm_and_si128(hi, mask)));
+      _mm_storeu_si128((__m128i *)(b + i),
+         _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8)));
+   }
+#endif
+
+   for (; i < n; i++)
+   {
+      a[i] = pairs[2 * i];
+      b[i] = pairs[2 * i + 1];
+   }
+}
+
+/** Extract the chroma of 2 rows of YUYV, averaging them vertically */
+static void convert_row_yuyv_chroma(uint8_t *u, uint8_t *v, const uint8_t *row0, const uint8_t *row1,
+   unsigned int width)
+{
+   unsigned int i = 0, n = width / 2;
+
+#if defined(CONVERT_NEON)
+   for (; i + 8 <= n; i += 8)
+   {
+      uint8x8x4_t a = vld4_u8(row0 + 4 * i);
+      uint8x8x4_t b = vld4_u8(row1 + 4 * i);
+      vst1_u8(u + i, vrhadd_u8(a.val[1], b.val[1]));
+      vst1_u8(v + i, vrhadd_u8(a.val[3], b.val[3]));
+   }
+#elif defined(CONVERT_SSE2)
+   const __m128i mask = _mm_set1_epi16(0xff), zero = _mm_setzero_si128();
+   for (; i + 8 <= n; i += 8)
+   {
+      __m128i a0 = _mm_loadu_si128((const __m128i *)(row0 + 4 * i));
+      __m128i a1 = _mm_loadu_si128((const __m128i *)(row0 + 4 * i + 16));
+      __m128i b0 = _mm_loadu_si128((const __m128i *)(row1 + 4 * i));
+      __m128i b1 = _mm_loadu_si128((const __m128i *)(row1 + 4 * i + 16));
+      /* Odd bytes are the chroma, giving UVUV... once packed */
+      __m128i c = _mm_packus_epi16(_mm_srli_epi16(_mm_avg_epu8(a0, b0), 8),
+                                   _mm_srli_epi16(_mm_avg_epu8(a1, b1), 8));
+      _mm_storel_epi64((__m128i *)(u + i), _mm_packus_epi16(_mm_and_si128(c, mask), zero));
+      _mm_storel_epi64((__m128i *)(v + i), _mm_packus_epi16(_mm_srli_epi16(c, 8), zero));
+   }
+#endif
+
+   for (; i < n; i++)
+   {
+      u[i] = (row0[4 * i + 1] + row1[4 * i + 1] + 1) >> 1;
+      v[i] = (row0[4 * i + 3] + row1[4 * i + 3] + 1) >> 1;
+   }
+}
+
+/* BT.601 limited range to RGB, with 6 bits of fixed point precision so that
+ * the SIMD versions can work on 16 bits lanes and give the same results.
+ * The luma gain is 74.5, applied as y * 74 + y / 2. */
+#define CONVERT_Y_SCALE  74
+#define CONVERT_V_TO_R  102
+#define CONVERT_U_TO_G   25
+#define CONVERT_V_TO_G   52
+#define CONVERT_U_TO_B  129
+
+static inline uint8_t convert_clamp(int value)
+{
+   return value < 0 ? 0 : value > 255 ? 255 : value;
+}
+
+/** Convert a row of 4:2:0 YUV to RGB24 or BGR24 */
+static void convert_row_yuv_to_rgb(uint8_t *dst, const uint8_t *y, const uint8_t *u, const uint8_t *v,
+   unsigned int width, MMAL_BOOL_T bgr)
+{
+   unsigned int x = 0, r_index = bgr ? 2 : 0, b_index = bgr ? 0 : 2;
+
+#if defined(CONVERT_NEON)
+   const int16x8_t rounding = vdupq_n_s16(32);
+   for (; x + 16 <= width; x += 16)
+   {
+      uint8x16_t luma = vld1q_u8(y + x);
+      uint8x8x2_t cb = vzip_u8(vld1_u8(u + x / 2), vld1_u8(u + x / 2));
+      uint8x8x2_t cr = vzip_u8(vld1_u8(v + x / 2), vld1_u8(v + x / 2));
+      unsigned int half;
+
+      for (half = 0; half < 2; half++)
+      {
+         uint8x8_t l = half ? vget_high_u8(luma) : vget_low_u8(luma);
+         int16x8_t luma16 = vreinterpretq_s16_u16(vsubl_u8(l, vdup_n_u8(16)));
+         int16x8_t c = vaddq_s16(vaddq_s16(vmulq_n_s16(luma16, CONVERT_Y_SCALE), vshrq_n_s16(luma16, 1)),
+                                 rounding);
+         int16x8_t d = vreinterpretq_s16_u16(vsubl_u8(cb.val[half], vdup_n_u8(128)));
+         int16x8_t e = vreinterpretq_s16_u16(vsubl_u8(cr.val[half], vdup_n_u8(128)));
+         uint8x8x3_t pixels;
+
+         pixels.val[r_index] = vqshrun_n_s16(vqaddq_s16(c, vmulq_n_s16(e, CONVERT_V_TO_R)), 6);
+         pixels.val[1] = vqshrun_n_s16(vqsubq_s16(vqsubq_s16(c, vmulq_n_s16(d, CONVERT_U_TO_G)),
+                                                  vmulq_n_s16(e, CONVERT_V_TO_G)), 6);
+         pixels.val[b_index] = vqshrun_n_s16(vqaddq_s16(c, vmulq_n_s16(d, CONVERT_U_TO_B)), 6);
+         vst3_u8(dst + 3 * (x + 8 * half), pixels);
+      }
+   }
+#elif defined(CONVERT_SSE2)
+   const __m128i zero = _mm_setzero_si128();
+   const __m128i offset_y = _mm_set1_epi16(16), offset_uv = _mm_set1_epi16(128);
+   const __m128i rounding = _mm_set1_epi16(32);
+   for (; x + 8 <= width; x += 8)
+   {
+      uint8_t rgb[24];
+      uint32_t cb4, cr4;
+      __m128i l, d, e, c, r, g, b;
+      unsigned int i;
+
+      memcpy(&cb4, u + x / 2, sizeof(cb4));
+      memcpy(&cr4, v + x / 2, sizeof(cr4));
+      l = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(y + x)), zero);
+      d = _mm_cvtsi32_si128(cb4);
+      d = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_unpacklo_epi8(d, d), zero), offset_uv);
+      e = _mm_cvtsi32_si128(cr4);
+      e = _mm_sub_epi16(_mm_unpacklo_epi8(_mm_unpacklo_epi8(e, e), zero), offset_uv);
+      l = _mm_sub_epi16(l, offset_y);
+      c = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(l, _mm_set1_epi16(CONVERT_Y_SCALE)),
+                                      _mm_srai_epi16(l, 1)), rounding);
+
+      r = _mm_srai_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(e, _mm_set1_epi16(CONVERT_V_TO_R))), 6);
+      g = _mm_srai_epi16(_mm_subs_epi16(_mm_subs_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(CONVERT_U_TO_G))),
+                                        _mm_mullo_epi16(e, _mm_set1_epi16(CONVERT_V_TO_G))), 6);
+      b = _mm_srai_epi16(_mm_adds_epi16(c, _mm_mullo_epi16(d, _mm_set1_epi16(CONVERT_U_TO_B))), 6);
+
+      /* SSE2 has no byte shuffle, so the 3 channels are interleaved in C */
+      _mm_storel_epi64((__m128i *)rgb, _mm_packus_epi16(r, zero));
+      _mm_storel_epi64((__m128i *)(rgb + 8), _mm_packus_epi16(g, zero));
+      _mm_storel_epi64((__m128i *)(rgb + 16), _mm_packus_epi16(b, zero));
+      for (i = 0; i < 8; i++)
+      {
+         dst[3 * (x + i) + r_index] = rgb[i];
+         dst[3 * (x + i) + 1] = rgb[8 + i];
+         dst[3 * (x + i) + b_index] = rgb[16 + i];
+      }
+   }
+#endif
+
+   for (; x < width; x++)
+   {
+      int c = (y[x] - 16) * CONVERT_Y_SCALE + ((y[x] - 16) >> 1) + 32;
+      int d = u[x / 2] - 128, e = v[x / 2] - 128;
+
+      dst[3 * x + r_index] = convert_clamp((c + CONVERT_V_TO_R * e) >> 6);
+      dst[3 * x + 1] = convert_clamp((c - CONVERT_U_TO_G * d - CONVERT_V_TO_G * e) >> 6);
+      dst[3 * x + b_index] = convert_clamp((c + CONVERT_U_TO_B * d) >> 6);
+   }
+}
+
+/*****************************************************************************
+ * Frame conversions
+ *****************************************************************************/
+
+static void convert_copy(const CONVERT_FRAME_T *dst, const CONVERT_FRAME_T *src,
+   unsigned int width, unsigned int height)
+{
+   unsigned int i;
+
+   for (i = 0; i < src->info->planes_num; i++)
+      convert_plane_copy(dst->data[i], dst->pitch[i], src->data[i], src->pitch[i],
+         (width >> src->info->plane[i].x_shift) * src->info->plane[i].bpp,
+         height >> src->info->plane[i].y_shift);
+}
+
+static void convert_luma(const CONVERT_FRAME_T *dst, const CONVERT_FRAME_T *src,
+   unsigned int width, unsigned int height)
+{
+   convert_plane_copy(dst->data[0], dst->pitch[0], src->data[0], src->pitch[0], width, height);
+}
+
+static void convert_i420_to_nv12(const CONVERT_FRAME_T *dst, const CONVERT_FRAME_T *src,
+   unsigned int width, unsigned int height)
+{
+   unsigned int row;
+
+   convert_luma(dst, src, width, height);
+   for (row = 0; row < height / 2; row++)
+      convert_row_interleave(dst->data[1] + row * dst->pitch[1], src->data[1] + row * src->pitch[1],
+         src->data[2] + row * src->pitch[2], width / 2);
+}
+
+static void convert_nv12_to_i420(const CONVERT_FRAME_T *dst, const CONVERT_FRAME_T *src,
+   unsigned int width, unsigned int height)
+{
+   unsigned int row;
+
+   convert_luma(dst, src, width, height);
+   for (row = 0; row < height / 2; row++)
+      convert_row_deinterleave(dst->data[1] + row * dst->pitch[1], dst->data[2] + row * dst->pitch[2],
+         src->data[1] + row * src->pitch[1], width / 2);
+}
+
+static void convert_yuyv_to_luma(const CONVERT_FRAME_T *dst, const CONVERT_FRAME_T *src,
+   unsigned int width, unsigned int height)
+{
+   uint8_t scratch[256];
+   unsigned int row, x, n;
+
+   for (row = 0; row < height; row++)
+      for (x = 0; x < width; x += n)
+      {
+         n = MMAL_MIN(width - x, sizeof(scratch));
+         convert_row_deinterleave(dst->data[0] + row * dst->pitch[0] + x, scratch,
+            src->data[0] + row * src->pitch[0] + 2 * x, n);
+      }
+}
+
+static void convert_yuyv_to_i420(const CONVERT_FRAME_T *dst, const CONVERT_FRAME_T *src,
+   unsigned int width, unsigned int height)
+{
+   unsigned int row;
+
+   convert_yuyv_to_luma(dst, src, width, height);
+   for (row = 0; row < height / 2; row++)
+      convert_row_yuyv_chroma(dst->data[1] + row * dst->pitch[1], dst->data[2] + row * dst->pitch[2],
+         src->data[0] + 2 * row * src->pitch[0], src->data[0] + (2 * row + 1) * src->pitch[0], width);
+}
+
+static void convert_i420_to_rgb(const CONVERT_FRAME_T *dst, const CONVERT_FRAME_T *src,
+   unsigned int width, unsigned int height)
+{
+   MMAL_BOOL_T bgr = dst->info->encoding == MMAL_ENCODING_BGR24;
+   unsigned int row;
+
+   for (row = 0; row < height; row++)
+      convert_row_yuv_to_rgb(dst->data[0] + row * dst->pitch[0], src->data[0] + row * src->pitch[0],
+         src->data[1] + (row / 2) * src->pitch[1], src->data[2] + (row / 2) * src->pitch[2], width, bgr);
+}
+
+static void convert_nv12_to_rgb(const CONVERT_FRAME_T *dst, const CONVERT_FRAME_T *src,
+   unsigned int width, unsigned int height)
+{
+   MMAL_BOOL_T bgr = dst->info->encoding == MMAL_ENCODING_BGR24;
+   uint8_t u[256], v[256];
+   unsigned int row, x, n;
+
+   /* The chroma is split into planes in chunks, then converted as I420 */
+   for (row = 0; row < height; row++)
+      for (x = 0; x < width; x += n)
+      {
+         n = MMAL_MIN(width - x, 2 * sizeof(u));
+         convert_row_deinterleave(u, v, src->data[1] + (row / 2) * src->pitch[1] + x, (n + 1) / 2);
+         convert_row_yuv_to_rgb(dst->data[0] + row * dst->pitch[0] + 3 * x,
+            src->data[0] + row * src->pitch[0] + x, u, v, n, bgr);
+      }
+}
+
+static const struct {
+   MMAL_FOURCC_T from;
+   MMAL_FOURCC_T to;
+   CONVERT_FN_T fn;
+} convert_functions[] =
+{
+   {MMAL_ENCODING_I420, MMAL_ENCODING_NV12,  convert_i420_to_nv12},
+   {MMAL_ENCODING_NV12, MMAL_ENCODING_I420,  convert_nv12_to_i420},
+   {MMAL_ENCODING_I420, MMAL_ENCODING_RGB24, convert_i420_to_rgb},
+   {MMAL_ENCODING_I420, MMAL_ENCODING_BGR24, convert_i420_to_rgb},
+   {MMAL_ENCODING_NV12, MMAL_ENCODING_RGB24, convert_nv12_to_rgb},
+   {MMAL_ENCODING_NV12, MMAL_ENCODING_BGR24, convert_nv12_to_rgb},
+   {MMAL_ENCODING_YUYV, MMAL_ENCODING_I420,  convert_yuyv_to_i420},
+   {MMAL_ENCODING_I420, MMAL_ENCODING_GREY,  convert_luma},
+   {MMAL_ENCODING_NV12, MMAL_ENCODING_GREY,  convert_luma},
+   {MMAL_ENCODING_YUYV, MMAL_ENCODING_GREY,  convert_yuyv_to_luma},
+   {MMAL_ENCODING_UNKNOWN, MMAL_ENCODING_UNKNOWN, NULL}
+};
+
+static CONVERT_FN_T convert_function(MMAL_FOURCC_T from, MMAL_FOURCC_T to)
+{
+   unsigned int i;
+
+   if (from == to)
+      return convert_encoding_info(from) ? convert_copy : NULL;
+
+   for (i = 0; convert_functions[i].fn; i++)
+      if (convert_functions[i].from == from && convert_functions[i].to == to)
+         return convert_functions[i].fn;
+   return NULL;
+}
+
+/** Visible region of a frame, falling back to the whole frame without crop */
+static void convert_frame_region(const MMAL_ES_FORMAT_T *format, MMAL_RECT_T *rect)
+{
+   const MMAL_VIDEO_FORMAT_T *video = &format->es->video;
+
+   *rect = video->crop;
+   if (!rect->width || !rect->height)
+   {
+      rect->x = rect->y = 0;
+      rect->width = video->width;
+      rect->height = video->height;
+   }
+}
+
+/*****************************************************************************/
+MMAL_BOOL_T mmal_frame_convert_supported(MMAL_FOURCC_T from, MMAL_FOURCC_T to)
+{
+   return convert_function(from, to) != NULL;
+}
+
+/*****************************************************************************/
+uint32_t mmal_frame_size(const MMAL_ES_FORMAT_T *format)
+{
+   CONVERT_FRAME_T frame;
+   return convert_frame_layout(&frame, format, NULL);
+}
+
+/*****************************************************************************/
+MMAL_STATUS_T mmal_frame_convert(uint8_t *dst, uint32_t dst_size, const MMAL_ES_FORMAT_T *dst_format,
+   const uint8_t *src, uint32_t src_size, const MMAL_ES_FORMAT_T *src_format)
+{
+   CONVERT_FRAME_T dst_frame, src_frame;
+   MMAL_RECT_T dst_rect, src_rect;
+   uint32_t width, height, dst_frame_size, src_frame_size;
+   CONVERT_FN_T fn;
+
+   fn = convert_function(src_format->encoding, dst_format->encoding);
+   dst_frame_size = convert_frame_layout(&dst_frame, dst_format, dst);
+   src_frame_size = convert_frame_layout(&src_frame, src_format, src);
+   if (!fn || !dst_frame_size || !src_frame_size)
+   {
+      LOG_ERROR("conversion from %4.4s to %4.4s not supported",
+                (char *)&src_format->encoding, (char *)&dst_format->encoding);
+      return MMAL_ENOSYS;
+   }
+   if (dst_size < dst_frame_size || src_size < src_frame_size)
+   {
+      LOG_ERROR("buffer too small (%u/%u, %u/%u)", dst_size, dst_frame_size, src_size, src_frame_size);
+      return MMAL_EINVAL;
+   }
+
+   convert_frame_region(dst_format, &dst_rect);
+   convert_frame_region(src_format, &src_rect);
+   width = MMAL_MIN(dst_rect.width, src_rect.width);
+   height = MMAL_MIN(dst_rect.height, src_rect.height);
+   if (dst_frame.info->subsampled || src_frame.info->subsampled)
+   {
+      width &= ~1; height &= ~1;
+      dst_rect.x &= ~1; dst_rect.y &= ~1;
+      src_rect.x &= ~1; src_rect.y &= ~1;
+   }
+   if (dst_rect.x > dst_format->es->video.width || width > dst_format->es->video.width - dst_rect.x ||
+       dst_rect.y > dst_format->es->video.height || height > dst_format->es->video.height - dst_rect.y ||
+       src_rect.x > src_format->es->video.width || width > src_format->es->video.width - src_rect.x ||
+       src_rect.y > src_format->es->video.height || height > src_format->es->video.height - src_rect.y)
+   {
+      LOG_ERROR("visible region outside of the frame");
+      return MMAL_EINVAL;
+   }
+
+   convert_frame_offset(&dst_frame, dst_rect.x, dst_rect.y);
+   convert_frame_offset(&src_frame, src_rect.x, src_rect.y);
+   fn(&dst_frame, &src_frame, width, height);
+   return MMAL_SUCCESS;
+}
+
+/*****************************************************************************/
+MMAL_STATUS_T mmal_buffer_header_convert(MMAL_BUFFER_HEADER_T *dst, const MMAL_ES_FORMAT_T *dst_format,
+   MMAL_BUFFER_HEADER_T *src, const MMAL_ES_FORMAT_T *src_format)
+{
+   MMAL_STATUS_T status = MMAL_SUCCESS;
+   CONVERT_FRAME_T frame;
+   uint32_t length = src->length;
+   MMAL_BOOL_T convert;
+   unsigned int i;
+
+   /* Only frames with a different encoding or layout need converting */
+   convert = src->length && dst_format->type == MMAL_ES_TYPE_VIDEO &&
+      src_format->type == MMAL_ES_TYPE_VIDEO &&
+      (dst_format->encoding != src_format->encoding ||
+       dst_format->es->video.width != src_format->es->video.width ||
+       dst_format->es->video.height != src_format->es->video.height);
+   if (convert)
+      length = convert_frame_layout(&frame, dst_format, dst->data);
+
+   if (dst->alloc_size < length)
+      return MMAL_EINVAL;
+
+   mmal_buffer_header_mem_lock(dst);
+   mmal_buffer_header_mem_lock(src);
+   if (convert)
+      status = mmal_frame_convert(dst->data, dst->alloc_size, dst_format,
+                                  src->data + src->offset, src->length, src_format);
+   else
+      memcpy(dst->data, src->data + src->offset, length);
+   mmal_buffer_header_mem_unlock(src);
+   mmal_buffer_header_mem_unlock(dst);
+   if (status != MMAL_SUCCESS)
+      return status;
+
+   dst->length     = length;
+   dst->offset     = 0;
+   dst->flags      = src->flags;
+   dst->pts        = src->pts;
+   dst->dts        = src->dts;
+   *dst->type      = *src->type;
+
+   /* Describe the planes of the converted frame */
+   if (convert)
+   {
+      dst->type->video.planes = frame.info->planes_num;
+      for (i = 0; i < frame.info->planes_num; i++)
+      {
+         dst->type->video.offset[i] = frame.data[i] - dst->data;
+         dst->type->video.pitch[i] = frame.pitch[i];
+      }
+   }
+
+   return MMAL_SUCCESS;
+}
@@ -0,0 +1,122 @@
+/*
+Copyright (c) 2012, Broadcom Europe Ltd
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+    * Redistributions of source code must retain the above copyright
+      notice, this list of conditions and the following disclaimer.
+    * Redistributions in binary form must reproduce the above copyright
+      notice, this list of conditions and the following disclaimer in the
+      documentation and/or other materials provided with the distribution.
+    * Neither the name of the copyright holder nor the
+      names of its contributors may be used to endorse or promote products
+      derived from this software without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY
+DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND
+ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+#ifndef MMAL_UTIL_CONVERT_H
+#define MMAL_UTIL_CONVERT_H
+
+#include "interface/mmal/mmal.h"
+
+/** \defgroup MmalConvertUtilities Frame copy and conversion utility functions
+ * \ingroup MmalUtilities
+ * The conversion utility functions copy uncompressed video frames between
+ * buffers, taking into account the stride and plane layout of each side, and
+ * optionally convert them to another pixel format.
+ *
+ * The layout of a frame follows the MMAL conventions: the stride is derived
+ * from the width of the format with \ref mmal_encoding_width_to_stride and the
+ * planes are stored one after the other, each with as many rows as the height
+ * of the format (halved for the chroma planes of 4:2:0 formats).
+ *
+ * Supported conversions are copies between identical encodings for I420,
+ * NV12, YUYV, RGB24, BGR24 and GREY, as well as I420 <-> NV12,
+ * I420/NV12 -> RGB24/BGR24 (BT.601, limited range), YUYV -> I420 and
+ * I420/NV12/YUYV -> GREY (luma only).
+ *
+ * The kernels use SSE2 when the compiler targets it and fall back to plain C
+ * otherwise. NEON kernels are only built when MMAL_UTIL_CONVERT_NEON is
+ * defined, as they still have to be checked on ARM. All implementations give
+ * identical results, which mmal_check_convert verifies.
+ *
+ * @{
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Check whether frames of one encoding can be converted into another one.
+ *
+ * @param from Encoding of the source frames
+ * @param to   Encoding of the destination frames
+ *
+ * @return MMAL_TRUE if \ref mmal_frame_convert supports the conversion
+ */
+MMAL_BOOL_T mmal_frame_convert_supported(MMAL_FOURCC_T from, MMAL_FOURCC_T to);
+
+/** Get the size of a frame given its format.
+ *
+ * @param format Format of the frame
+ *
+ * @return size in bytes of the frame, or 0 if the encoding is not supported
+ */
+uint32_t mmal_frame_size(const MMAL_ES_FORMAT_T *format);
+
+/** Copy or convert a video frame.
+ * The visible region (crop) of the source frame is converted into the
+ * visible region of the destination frame. When the two regions differ in
+ * size, the smallest width and height are used, which means a sub-region of
+ * the source can be extracted by adjusting the crop of its format. With 4:2:0
+ * and 4:2:2 encodings the origin and size of the region are rounded down to
+ * even values.
+ *
+ * @param dst        Destination frame
+ * @param dst_size   Size of the destination buffer
+ * @param dst_format Format of the destination frame
+ * @param src        Source frame
+ * @param src_size   Size of the source data
+ * @param src_format Format of the source frame
+ *
+ * @return MMAL_SUCCESS, MMAL_ENOSYS if the conversion is not supported or
+ * MMAL_EINVAL if one of the buffers is too small for its format
+ */
+MMAL_STATUS_T mmal_frame_convert(uint8_t *dst, uint32_t dst_size, const MMAL_ES_FORMAT_T *dst_format,
+   const uint8_t *src, uint32_t src_size, const MMAL_ES_FORMAT_T *src_format);
+
+/** Copy the payload of a buffer header into another one, converting video
+ * frames when the formats of both sides differ.
+ * When both formats are identical, or are not uncompressed video, the payload
+ * is copied as is. The metadata of the buffer header (flags, timestamps and
+ * type specific data) is copied as well.
+ *
+ * @param dst        Destination buffer header
+ * @param dst_format Format of the destination buffer header
+ * @param src        Source buffer header
+ * @param src_format Format of the source buffer header
+ *
+ * @return MMAL_SUCCESS, MMAL_ENOSYS if the conversion is not supported or
+ * MMAL_EINVAL if the destination buffer is too small
+ */
+MMAL_STATUS_T mmal_buffer_header_convert(MMAL_BUFFER_HEADER_T *dst, const MMAL_ES_FORMAT_T *dst_format,
+   MMAL_BUFFER_HEADER_T *src, const MMAL_ES_FORMAT_T *src_format);
+
+#ifdef __cplusplus
+}
+#endif
+
+/** @} */
+
+#endif
@@ -221,3 +221,20 @@ MMAL_STATUS_T mmal_util_get_core_port_stats(MMAL_PORT_T *port,
       *stats = param.stats;
    return ret;
 }
+
+MMAL_STATUS_T mmal_util_get_core_port_histograms(MMAL_PORT_T *port,
+                                                 MMAL_BOOL_T reset,
+                                                 MMAL_CORE_PORT_HISTOGRAMS_T *histograms)
+{
+   MMAL_PARAMETER_CORE_HISTOGRAMS_T param;
+   MMAL_STATUS_T ret;
+
+   memset(&param, 0, sizeof(param));
+   param.hdr.id = MMAL_PARAMETER_CORE_HISTOGRAMS;
+   param.hdr.size = sizeof(param);
+   param.reset = reset;
+   ret = mmal_port_parameter_get(port, &param.hdr);
+   if (ret == MMAL_SUCCESS)
+      *histograms = param.histograms;
+   return ret;
+}
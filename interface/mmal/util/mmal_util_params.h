@@ -203,6 +203,17 @@ MMAL_STATUS_T mmal_util_camera_use_stc_timestamp(MMAL_PORT_T *port, MMAL_CAMERA_
 MMAL_STATUS_T mmal_util_get_core_port_stats(MMAL_PORT_T *port, MMAL_CORE_STATS_DIR dir, MMAL_BOOL_T reset,
                                             MMAL_CORE_STATISTICS_T *stats);
 
+/** Get the MMAL core latency histograms for a given port.
+ *
+ * @param port  port to query
+ * @param reset reset the histograms as well
+ * @param histograms filled in with results
+ * @return MMAL_SUCCESS, MMAL_ENOSYS if the core was built without
+ * MMAL_COLLECT_PORT_STATS, or another error
+ */
+MMAL_STATUS_T mmal_util_get_core_port_histograms(MMAL_PORT_T *port, MMAL_BOOL_T reset,
+                                                 MMAL_CORE_PORT_HISTOGRAMS_T *histograms);
+
 #ifdef __cplusplus
 }
 #endif
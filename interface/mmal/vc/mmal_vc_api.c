@@ -1162,6 +1162,125 @@ static MMAL_STATUS_T mmal_vc_port_parameter_set(MMAL_PORT_T *port, const MMAL_PA
    return status;
 }
 
+#define MMAL_VC_PARAMETERS_IN_FLIGHT 16
+
+typedef struct
+{
+   mmal_worker_port_param_set msg;
+   mmal_worker_reply reply;
+   uint32_t request;
+} MMAL_VC_PARAMETER_REQUEST_T;
+
+/** Collect the replies to parameter set requests. Returns the status of the
+ * first one which failed with something else than MMAL_ENOSYS. */
+static MMAL_STATUS_T mmal_vc_port_parameters_wait(MMAL_VC_PARAMETER_REQUEST_T *requests,
+                                                  MMAL_STATUS_T *results, unsigned int num)
+{
+   MMAL_STATUS_T status = MMAL_SUCCESS, ret;
+   unsigned int i;
+
+   for (i = 0; i < num; i++)
+   {
+      size_t replylen = sizeof(requests[i].reply);
+
+      ret = mmal_vc_wait_reply(mmal_vc_get_client(), requests[i].request, &replylen);
+      if (ret == MMAL_SUCCESS)
+      {
+         vcos_assert(replylen == sizeof(requests[i].reply));
+         ret = requests[i].reply.status;
+      }
+      if (ret != MMAL_SUCCESS)
+      {
+         LOG_WARN("failed to set port parameter %u:%u %u:%u %s", requests[i].msg.component_handle,
+               requests[i].msg.port_handle, requests[i].msg.param.id, requests[i].msg.param.size,
+               mmal_status_to_string(ret));
+         if (status == MMAL_SUCCESS && ret != MMAL_ENOSYS)
+            status = ret;
+      }
+      results[i] = ret;
+   }
+
+   return status;
+}
+
+/** Set several parameters on a port, sending the requests before waiting
+ * for the replies. Called by the core with the port locked. */
+static MMAL_STATUS_T mmal_vc_port_parameters_set_batch(MMAL_PORT_T *port,
+                                                       const MMAL_PARAMETER_HEADER_T *const *params,
+                                                       MMAL_STATUS_T *results, unsigned int *count)
+{
+   MMAL_VC_PARAMETER_REQUEST_T *requests;
+   MMAL_STATUS_T status = MMAL_SUCCESS, ret;
+   unsigned int i, num = *count, first = 0, pending = 0;
+
+   *count = 0;
+   requests = vcos_calloc(MMAL_VC_PARAMETERS_IN_FLIGHT, sizeof(*requests), "mmal vc params");
+   if (!requests)
+      return MMAL_ENOMEM;
+
+   for (i = 0; status == MMAL_SUCCESS && i < num; i++)
+   {
+      const MMAL_PARAMETER_HEADER_T *param = params[i];
+      MMAL_VC_PARAMETER_REQUEST_T *request;
+
+      /* These change the state of the port on the host side, so the
+       * previous requests must have completed before sending them */
+      if (param->id == MMAL_PARAMETER_ZERO_COPY ||
+          param->id == MMAL_PARAMETER_BUFFER_REQUIREMENTS ||
+          param->size > MMAL_WORKER_PORT_PARAMETER_SET_MAX)
+      {
+         status = mmal_vc_port_parameters_wait(requests, results + first, pending);
+         pending = 0;
+         if (status != MMAL_SUCCESS)
+            break;
+         results[i] = mmal_vc_port_parameter_set(port, param);
+         if (results[i] != MMAL_ENOSYS)
+            status = results[i];
+         continue;
+      }
+
+      if (pending == MMAL_VC_PARAMETERS_IN_FLIGHT)
+      {
+         status = mmal_vc_port_parameters_wait(requests, results + first, pending);
+         pending = 0;
+         if (status != MMAL_SUCCESS)
+            break;
+      }
+
+      request = &requests[pending];
+      request->msg.component_handle = port->priv->module->component_handle;
+      request->msg.port_handle = port->priv->module->port_handle;
+      /* coverity[overrun-buffer-arg] */
+      memcpy(&request->msg.param, param, param->size);
+
+      /* No deadline, like mmal_vc_port_parameter_set */
+      results[i] = mmal_vc_send_message_async(mmal_vc_get_client(), &request->msg.header,
+                                              MMAL_OFFSET(mmal_worker_port_param_set, param) + param->size,
+                                              MMAL_WORKER_PORT_PARAMETER_SET,
+                                              &request->reply, sizeof(request->reply),
+                                              0, NULL, NULL, &request->request);
+      if (results[i] == MMAL_SUCCESS && !pending++)
+         first = i;
+      else
+         status = results[i];
+   }
+
+   ret = mmal_vc_port_parameters_wait(requests, results + first, pending);
+   if (status == MMAL_SUCCESS)
+      status = ret;
+
+   vcos_free(requests);
+   *count = i;
+   return status;
+}
+
+MMAL_STATUS_T mmal_vc_port_parameters_set(MMAL_PORT_T *port,
+                                          const MMAL_PARAMETER_HEADER_T *const *params,
+                                          unsigned int num)
+{
+   return mmal_port_parameters_set(port, params, num);
+}
+
 /** Get parameter on a port */
 static MMAL_STATUS_T mmal_vc_port_parameter_get(MMAL_PORT_T *port, MMAL_PARAMETER_HEADER_T *param)
 {
@@ -1481,6 +1600,7 @@ static MMAL_STATUS_T mmal_vc_component_create(const char *name, MMAL_COMPONENT_T
       port->priv->pf_flush = mmal_vc_port_flush;
       port->priv->pf_connect = mmal_vc_port_connect;
       port->priv->pf_parameter_set = mmal_vc_port_parameter_set;
+      port->priv->pf_parameters_set = mmal_vc_port_parameters_set_batch;
       port->priv->pf_parameter_get = mmal_vc_port_parameter_get;
       port->priv->pf_payload_alloc = mmal_vc_port_payload_alloc;
       port->priv->pf_payload_free = mmal_vc_port_payload_free;
@@ -179,6 +179,23 @@ MMAL_STATUS_T mmal_vc_get_core_stats(MMAL_CORE_STATISTICS_T *stats,
                                      unsigned port,
                                      MMAL_CORE_STATS_DIR dir,
                                      MMAL_BOOL_T reset);
+/** Set several parameters on a port of a VideoCore component.
+ *
+ * Same as \ref mmal_port_parameters_set. On VideoCore ports the requests are
+ * all sent before waiting for the replies, which saves a round trip to
+ * VideoCore per parameter compared to calling \ref mmal_port_parameter_set
+ * repeatedly. The parameters are applied in order. When one fails, no more
+ * are sent but those already in flight may still be applied.
+ *
+ * @param port    Port to set the parameters on
+ * @param params  Parameters to set
+ * @param num     Number of parameters
+ * @return        MMAL_SUCCESS or the status of the first parameter which failed
+ */
+MMAL_STATUS_T mmal_vc_port_parameters_set(MMAL_PORT_T *port,
+                                          const MMAL_PARAMETER_HEADER_T *const *params,
+                                          unsigned int num);
+
 /**
  * Stores an arbitrary text message in a circular buffer inside the MMAL VC server.
  * The purpose of this message is to log high level events from the host in order
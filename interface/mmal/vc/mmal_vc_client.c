@@ -43,31 +43,55 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <stdio.h>
 
-#define MAX_WAITERS 16
+#define MAX_WAITERS 256
 static VCOS_ONCE_T once = VCOS_ONCE_INIT;
 static VCHIQ_INSTANCE_T mmal_vchiq_instance;
 static VCOS_LOG_CAT_T mmal_ipc_log_category;
 
+typedef enum
+{
+   MMAL_WAITER_FREE,             /**< In the free list */
+   MMAL_WAITER_PENDING,          /**< Waiting for the reply */
+   MMAL_WAITER_DONE,             /**< Reply received, waiting to be collected */
+   MMAL_WAITER_ABANDONED,        /**< Timed out or cancelled, recycled when the reply arrives */
+} MMAL_WAITER_STATE_T;
+
 /** Client threads use one of these to wait for
  * a reply from VideoCore.
  */
 typedef struct MMAL_WAITER_T
 {
    VCOS_SEMAPHORE_T sem;
-   unsigned inuse;
+   MMAL_WAITER_STATE_T state;
+   uint32_t id;                  /**< Request currently using the waiter */
    void *dest;                   /**< Where to write reply */
-   size_t destlen;               /**< Max length for reply */
+   size_t destlen;               /**< Max length for reply, then actual length */
+   uint64_t deadline;            /**< Time (us) at which the request expires, 0 for never */
+   MMAL_VC_REPLY_CB_T cb;        /**< Completion callback, NULL if the reply is waited for */
+   void *cb_data;
+   struct MMAL_WAITER_T *next;   /**< Next waiter in the free list */
+   struct MMAL_WAITER_T *next_all; /**< Next waiter allocated by the pool */
 } MMAL_WAITER_T;
 
-/** We have an array of waiters and allocate them to waiting
-  * threads. They can be released back to the pool in any order.
-  * If there are none free, the calling thread will block until
+/** Waiters are allocated on demand, up to MAX_WAITERS, and recycled
+  * through a free list. They are only freed with the pool since
+  * VideoCore holds a reference to a waiter until it replies.
+  * If the limit is reached, the calling thread will block until
   * one becomes available.
   */
 typedef struct 
 {
-   MMAL_WAITER_T waiters[MAX_WAITERS];
-   VCOS_SEMAPHORE_T sem;
+   VCOS_MUTEX_T lock;
+   VCOS_SEMAPHORE_T sem;         /**< Counts the waiters which can still be handed out */
+   MMAL_WAITER_T *free;          /**< Waiters ready for reuse */
+   MMAL_WAITER_T *all;           /**< All the waiters allocated */
+   uint32_t id;                  /**< Last request id handed out */
+   VCOS_TIMER_T timer;           /**< Expires the requests which have a completion callback */
+   MMAL_BOOL_T timer_created;
+   uint64_t timer_deadline;      /**< Earliest deadline of those requests, 0 if none */
+   unsigned int waiting;         /**< Threads blocked on one of the semaphores of the pool */
+   MMAL_BOOL_T closing;          /**< The pool is being or has been destroyed */
+   VCOS_SEMAPHORE_T drained;     /**< Posted by the last thread to leave a pool being destroyed */
 } MMAL_WAITPOOL_T;
 
 struct MMAL_CLIENT_T
@@ -90,86 +114,255 @@ static MMAL_CLIENT_T client;
 static void init_once(void)
 {
    vcos_mutex_create(&client.lock, VCOS_FUNCTION);
+   vcos_mutex_create(&client.waitpool.lock, "mmal waitpool");
+   vcos_semaphore_create(&client.waitpool.drained, "mmal waitpool drained", 0);
 }
 
+static void waitpool_timer_cb(void *context);
+
 /** Create a pool of wait-structures.
+  * The lock, the drained semaphore and the timer of the pool are kept for
+  * the lifetime of the process. The timer routine takes the client lock, so deleting the timer
+  * with that lock held could deadlock.
   */
 static MMAL_STATUS_T create_waitpool(MMAL_WAITPOOL_T *waitpool)
 {
-   VCOS_STATUS_T status;
-   int i;
+   if (!waitpool->timer_created)
+   {
+      if (vcos_timer_create(&waitpool->timer, "mmal waitpool", waitpool_timer_cb, waitpool) != VCOS_SUCCESS)
+         return MMAL_ENOSPC;
+      waitpool->timer_created = MMAL_TRUE;
+   }
+
+   if (vcos_semaphore_create(&waitpool->sem, VCOS_FUNCTION, MAX_WAITERS) != VCOS_SUCCESS)
+      return MMAL_ENOSPC;
+
+   vcos_mutex_lock(&waitpool->lock);
+   waitpool->closing = MMAL_FALSE;
+   vcos_mutex_unlock(&waitpool->lock);
+   return MMAL_SUCCESS;
+}
+
+/** Register a thread about to block on one of the semaphores of the pool.
+  * Returns MMAL_FALSE if the pool is being destroyed.
+  */
+static MMAL_BOOL_T waitpool_enter(MMAL_WAITPOOL_T *waitpool)
+{
+   MMAL_BOOL_T closing;
+
+   vcos_mutex_lock(&waitpool->lock);
+   closing = waitpool->closing;
+   if (!closing)
+      waitpool->waiting++;
+   vcos_mutex_unlock(&waitpool->lock);
+   return !closing;
+}
+
+/** Called with the pool locked by a thread which was blocked on one of the
+  * semaphores of the pool. Returns MMAL_TRUE if the pool is being destroyed,
+  * in which case the thread must not touch the pool or its waiters once
+  * it has unlocked it.
+  */
+static MMAL_BOOL_T waitpool_leave_locked(MMAL_WAITPOOL_T *waitpool)
+{
+   waitpool->waiting--;
+   if (!waitpool->closing)
+      return MMAL_FALSE;
 
-   status = vcos_semaphore_create(&waitpool->sem, VCOS_FUNCTION,
-                                  MAX_WAITERS);
-   if (status != VCOS_SUCCESS)
-      return status==VCOS_SUCCESS ? MMAL_SUCCESS : MMAL_ENOSPC;
+   if (!waitpool->waiting)
+      vcos_semaphore_post(&waitpool->drained);
+   return MMAL_TRUE;
+}
+
+/** Destroy a pool of wait-structures.
+  * Requests still in flight fail with MMAL_EIO. The threads blocked on the
+  * pool are woken up and the waiters are only freed once they are all gone.
+  * This is called with the client lock held, so the requests don't give back
+  * their use of the service, which is about to be closed anyway.
+  */
+static void destroy_waitpool(MMAL_WAITPOOL_T *waitpool)
+{
+   MMAL_WAITER_T *waiter;
+   MMAL_BOOL_T drain;
+   unsigned int i;
 
-   for (i=0; i<MAX_WAITERS; i++)
+   /* Fail the requests with a completion callback one at a time, as the
+    * timer routine does, since the callbacks can't run with the pool locked */
+   for (;;)
    {
-      waitpool->waiters[i].inuse = 0;
-      status = vcos_semaphore_create(&waitpool->waiters[i].sem,
-                                     "mmal waiter", 0);
-      if (status != VCOS_SUCCESS)
+      MMAL_VC_REPLY_CB_T cb = NULL;
+      void *cb_data = NULL;
+      uint32_t id = 0;
+
+      vcos_mutex_lock(&waitpool->lock);
+      waitpool->closing = MMAL_TRUE;
+      for (waiter = waitpool->all; waiter; waiter = waiter->next_all)
+      {
+         if (waiter->state == MMAL_WAITER_PENDING && waiter->cb)
+         {
+            waiter->state = MMAL_WAITER_ABANDONED;
+            cb = waiter->cb;
+            cb_data = waiter->cb_data;
+            id = waiter->id;
+            break;
+         }
+      }
+      vcos_mutex_unlock(&waitpool->lock);
+
+      if (!cb)
          break;
+      LOG_ERROR("request %u still waiting for a reply", id);
+      cb(cb_data, id, MMAL_EIO, 0);
    }
 
-   if (status != VCOS_SUCCESS)
+   /* Wake up the threads waiting for a reply or for a free waiter */
+   vcos_mutex_lock(&waitpool->lock);
+   for (waiter = waitpool->all; waiter; waiter = waiter->next_all)
    {
-      /* clean up */
-      i--;
-      while (i>=0)
-      {
-         vcos_semaphore_delete(&waitpool->waiters[i].sem);
-         i--;
-      }
-      vcos_semaphore_delete(&waitpool->sem);
+      if (waiter->state != MMAL_WAITER_PENDING)
+         continue;
+      LOG_ERROR("request %u still waiting for a reply", waiter->id);
+      waiter->state = MMAL_WAITER_ABANDONED;
+      vcos_semaphore_post(&waiter->sem);
    }
-   return status==VCOS_SUCCESS ? MMAL_SUCCESS : MMAL_ENOSPC;
-}
+   for (i = 0; i < waitpool->waiting; i++)
+      vcos_semaphore_post(&waitpool->sem);
+   drain = waitpool->waiting != 0;
+   vcos_mutex_unlock(&waitpool->lock);
 
-static void destroy_waitpool(MMAL_WAITPOOL_T *waitpool)
-{
-   int i;
-   for (i=0; i<MAX_WAITERS; i++)
-      vcos_semaphore_delete(&waitpool->waiters[i].sem);
+   if (drain)
+      vcos_semaphore_wait(&waitpool->drained);
+
+   vcos_mutex_lock(&waitpool->lock);
+   while ((waiter = waitpool->all) != NULL)
+   {
+      waitpool->all = waiter->next_all;
+      vcos_semaphore_delete(&waiter->sem);
+      vcos_free(waiter);
+   }
+   waitpool->free = NULL;
+   waitpool->timer_deadline = 0;
+   vcos_mutex_unlock(&waitpool->lock);
 
    vcos_semaphore_delete(&waitpool->sem);
 }
 
-/** Grab a waiter from the pool. Return immediately if one already
-  * available, or wait for one to become available.
+/** Grab a waiter from the pool. Return immediately if one is
+  * available or can be allocated, otherwise wait for one to be
+  * released until the deadline (0 for never).
   */
-static MMAL_WAITER_T *get_waiter(MMAL_CLIENT_T *client)
+static MMAL_STATUS_T get_waiter(MMAL_WAITPOOL_T *waitpool, uint64_t deadline,
+                                MMAL_WAITER_T **waiter_out)
 {
-   int i;
-   MMAL_WAITER_T *waiter = NULL;
-   vcos_semaphore_wait(&client->waitpool.sem);
-   vcos_mutex_lock(&client->lock);
-   for (i=0; i<MAX_WAITERS; i++)
+   MMAL_WAITER_T *waiter;
+   MMAL_BOOL_T acquired = MMAL_TRUE;
+
+   if (!waitpool_enter(waitpool))
+      return MMAL_EIO;
+
+   if (!deadline)
    {
-      if (client->waitpool.waiters[i].inuse == 0)
-         break;
+      vcos_semaphore_wait(&waitpool->sem);
    }
-   /* If this fails, the semaphore is not working */
-   if (vcos_verify(i != MAX_WAITERS))
+   else
    {
-      waiter = client->waitpool.waiters+i;
-      waiter->inuse = 1;
+      uint64_t now = vcos_getmicrosecs64();
+      if (vcos_semaphore_trywait(&waitpool->sem) != VCOS_SUCCESS &&
+          (deadline <= now ||
+           vcos_semaphore_wait_timeout(&waitpool->sem,
+              (VCOS_UNSIGNED)((deadline - now + 999) / 1000)) != VCOS_SUCCESS))
+         acquired = MMAL_FALSE;
    }
-   vcos_mutex_unlock(&client->lock);
 
-   return waiter;
+   vcos_mutex_lock(&waitpool->lock);
+   if (waitpool_leave_locked(waitpool))
+   {
+      vcos_mutex_unlock(&waitpool->lock);
+      return MMAL_EIO;
+   }
+   if (!acquired)
+   {
+      vcos_mutex_unlock(&waitpool->lock);
+      LOG_ERROR("no waiter available");
+      return MMAL_EAGAIN;
+   }
+
+   waiter = waitpool->free;
+   if (waiter)
+   {
+      waitpool->free = waiter->next;
+   }
+   else
+   {
+      waiter = vcos_calloc(1, sizeof(*waiter), "mmal waiter");
+      if (waiter && vcos_semaphore_create(&waiter->sem, "mmal waiter", 0) != VCOS_SUCCESS)
+      {
+         vcos_free(waiter);
+         waiter = NULL;
+      }
+      if (waiter)
+      {
+         waiter->next_all = waitpool->all;
+         waitpool->all = waiter;
+      }
+   }
+   if (waiter)
+   {
+      /* Request ids are never 0 */
+      if (!++waitpool->id)
+         ++waitpool->id;
+      waiter->id = waitpool->id;
+      waiter->state = MMAL_WAITER_PENDING;
+      waiter->next = NULL;
+   }
+   else
+   {
+      vcos_semaphore_post(&waitpool->sem);
+   }
+   vcos_mutex_unlock(&waitpool->lock);
+
+   if (!waiter)
+   {
+      LOG_ERROR("failed to allocate waiter");
+      return MMAL_ENOMEM;
+   }
+
+   *waiter_out = waiter;
+   return MMAL_SUCCESS;
 }
 
-/** Return a waiter to the pool.
+/** Return a waiter to the pool. The pool must be locked.
   */
-static void release_waiter(MMAL_CLIENT_T *client, MMAL_WAITER_T *waiter)
+static void release_waiter_locked(MMAL_WAITPOOL_T *waitpool, MMAL_WAITER_T *waiter)
 {
    LOG_TRACE("at %p", waiter);
    vcos_assert(waiter);
-   vcos_assert(waiter->inuse);
-   waiter->inuse = 0;
-   vcos_semaphore_post(&client->waitpool.sem);
+   vcos_assert(waiter->state != MMAL_WAITER_FREE);
+   waiter->state = MMAL_WAITER_FREE;
+   waiter->cb = NULL;
+   waiter->next = waitpool->free;
+   waitpool->free = waiter;
+   vcos_semaphore_post(&waitpool->sem);
+}
+
+/** Return a waiter to the pool.
+  */
+static void release_waiter(MMAL_WAITPOOL_T *waitpool, MMAL_WAITER_T *waiter)
+{
+   vcos_mutex_lock(&waitpool->lock);
+   release_waiter_locked(waitpool, waiter);
+   vcos_mutex_unlock(&waitpool->lock);
+}
+
+/** Find the waiter used by a request. The pool must be locked.
+  */
+static MMAL_WAITER_T *find_waiter_locked(MMAL_WAITPOOL_T *waitpool, uint32_t id)
+{
+   MMAL_WAITER_T *waiter;
+   for (waiter = waitpool->all; waiter; waiter = waiter->next_all)
+      if (waiter->id == id && waiter->state != MMAL_WAITER_FREE)
+         return waiter;
+   return NULL;
 }
 
 static MMAL_PORT_T *mmal_vc_port_by_number(MMAL_COMPONENT_T *component, uint32_t type, uint32_t number)
@@ -423,14 +616,50 @@ static VCHIQ_STATUS_T mmal_vc_vchiq_callback(VCHIQ_REASON_T reason,
          else
          {
             MMAL_WAITER_T *waiter = msg->u.waiter;
+            MMAL_WAITPOOL_T *waitpool = &client.waitpool;
+            MMAL_VC_REPLY_CB_T cb = NULL;
+            void *cb_data = NULL;
+            uint32_t id = 0;
+            size_t len = 0;
+
             LOG_TRACE("waking up waiter at %p", waiter);
-            vcos_assert(waiter->inuse);
-            int len = vcos_min(waiter->destlen, vchiq_header->size);
-            waiter->destlen = len;
-            LOG_TRACE("copying payload @%p to %p len %d", waiter->dest, msg, len);
-            memcpy(waiter->dest, msg, len);
+            vcos_mutex_lock(&waitpool->lock);
+            if (waiter->state == MMAL_WAITER_PENDING)
+            {
+               len = vcos_min(waiter->destlen, vchiq_header->size);
+               waiter->destlen = len;
+               LOG_TRACE("copying payload @%p to %p len %d", waiter->dest, msg, (int)len);
+               memcpy(waiter->dest, msg, len);
+               if (waiter->cb)
+               {
+                  cb = waiter->cb;
+                  cb_data = waiter->cb_data;
+                  id = waiter->id;
+                  release_waiter_locked(waitpool, waiter);
+               }
+               else
+               {
+                  /* Posted with the pool locked so that the waiter can't
+                   * be freed under our feet by the pool being destroyed */
+                  waiter->state = MMAL_WAITER_DONE;
+                  vcos_semaphore_post(&waiter->sem);
+               }
+            }
+            else
+            {
+               /* Nobody wants the reply anymore, only recycle the waiter */
+               vcos_assert(waiter->state == MMAL_WAITER_ABANDONED);
+               LOG_TRACE("dropping reply to request %u", waiter->id);
+               release_waiter_locked(waitpool, waiter);
+            }
+            vcos_mutex_unlock(&waitpool->lock);
             vchiq_release_message(service, vchiq_header);
-            vcos_semaphore_post(&waiter->sem);
+
+            if (cb)
+            {
+               mmal_vc_release_internal(&client);
+               cb(cb_data, id, MMAL_SUCCESS, len);
+            }
          }
       }
       break;
@@ -511,26 +740,107 @@ static VCHIQ_STATUS_T mmal_vc_vchiq_callback(VCHIQ_REASON_T reason,
    return VCHIQ_SUCCESS;
 }
 
-/** Send a message and wait for a reply.
-  *
-  * @param client       client to send message for
-  * @param msg_header   message vchiq_header to send
-  * @param size         length of message, including header
-  * @param msgid        message id
-  * @param dest         destination for reply
-  * @param destlen      size of destination, updated with actual length
-  * @param send_dummy_bulk whether to send a dummy bulk transfer
+/** Make sure the timer fires at the earliest deadline of the requests
+  * which have a completion callback.
+  * The timer can't be set with the pool locked since the timer routine
+  * locks the pool itself, so check afterwards that the deadline wasn't
+  * changed meanwhile by another thread.
   */
-MMAL_STATUS_T mmal_vc_sendwait_message(struct MMAL_CLIENT_T *client,
-                                       mmal_worker_msg_header *msg_header,
-                                       size_t size,
-                                       uint32_t msgid,
-                                       void *dest,
-                                       size_t *destlen,
-                                       MMAL_BOOL_T send_dummy_bulk)
+static void waitpool_timer_update(MMAL_WAITPOOL_T *waitpool)
 {
-   MMAL_STATUS_T ret;
+   uint64_t deadline, now;
+   MMAL_BOOL_T changed;
+
+   do
+   {
+      vcos_mutex_lock(&waitpool->lock);
+      deadline = waitpool->timer_deadline;
+      vcos_mutex_unlock(&waitpool->lock);
+      if (!deadline)
+         return;
+
+      now = vcos_getmicrosecs64();
+      vcos_timer_set(&waitpool->timer, deadline > now ?
+                     (VCOS_UNSIGNED)((deadline - now + 999) / 1000) : 1);
+
+      vcos_mutex_lock(&waitpool->lock);
+      changed = waitpool->timer_deadline != deadline;
+      vcos_mutex_unlock(&waitpool->lock);
+   } while (changed);
+}
+
+/** Timer routine failing the requests with a completion callback
+  * which have reached their deadline.
+  */
+static void waitpool_timer_cb(void *context)
+{
+   MMAL_WAITPOOL_T *waitpool = (MMAL_WAITPOOL_T *)context;
+   MMAL_WAITER_T *waiter;
+   uint64_t next;
+
+   /* Expire the requests one at a time as an abandoned waiter can be
+    * recycled by a late reply as soon as the pool is unlocked */
+   for (;;)
+   {
+      uint64_t now = vcos_getmicrosecs64();
+      MMAL_VC_REPLY_CB_T cb = NULL;
+      void *cb_data = NULL;
+      uint32_t id = 0;
+
+      next = 0;
+      vcos_mutex_lock(&waitpool->lock);
+      for (waiter = waitpool->all; waiter; waiter = waiter->next_all)
+      {
+         if (waiter->state != MMAL_WAITER_PENDING || !waiter->cb || !waiter->deadline)
+            continue;
+
+         if (waiter->deadline <= now)
+         {
+            waiter->state = MMAL_WAITER_ABANDONED;
+            cb = waiter->cb;
+            cb_data = waiter->cb_data;
+            id = waiter->id;
+            break;
+         }
+         if (!next || waiter->deadline < next)
+            next = waiter->deadline;
+      }
+      if (!cb)
+         waitpool->timer_deadline = next;
+      vcos_mutex_unlock(&waitpool->lock);
+
+      if (!cb)
+         break;
+
+      LOG_ERROR("request %u timed out", id);
+      mmal_vc_release_internal(&client);
+      cb(cb_data, id, MMAL_EAGAIN, 0);
+   }
+
+   waitpool_timer_update(waitpool);
+}
+
+/** Send a message which expects a reply, without waiting for it.
+  */
+static MMAL_STATUS_T mmal_vc_queue_request(MMAL_CLIENT_T *client,
+                                           mmal_worker_msg_header *msg_header,
+                                           size_t size,
+                                           uint32_t msgid,
+                                           void *dest,
+                                           size_t destlen,
+                                           uint32_t timeout_ms,
+                                           MMAL_VC_REPLY_CB_T cb,
+                                           void *cb_data,
+                                           MMAL_BOOL_T send_dummy_bulk,
+                                           MMAL_WAITER_T **waiter_out,
+                                           uint32_t *id_out)
+{
+   MMAL_WAITPOOL_T *waitpool = &client->waitpool;
+   uint64_t deadline = timeout_ms ? vcos_getmicrosecs64() + timeout_ms * (uint64_t)1000 : 0;
+   MMAL_BOOL_T update_timer = MMAL_FALSE;
+   MMAL_STATUS_T status;
    MMAL_WAITER_T *waiter;
+   uint32_t id;
    VCHIQ_STATUS_T vst;
    VCHIQ_ELEMENT_T elems[] = {{msg_header, size}};
 
@@ -543,27 +853,40 @@ MMAL_STATUS_T mmal_vc_sendwait_message(struct MMAL_CLIENT_T *client,
       return MMAL_EINVAL;
    }
 
-   if (send_dummy_bulk)
-      vcos_mutex_lock(&client->bulk_lock);
+   status = get_waiter(waitpool, deadline, &waiter);
+   if (status != MMAL_SUCCESS)
+      return status;
 
-   waiter = get_waiter(client);
    msg_header->msgid  = msgid;
    msg_header->u.waiter = waiter;
    msg_header->magic  = MMAL_MAGIC;
 
-   waiter->dest    = dest;
-   waiter->destlen = *destlen;
+   waiter->dest     = dest;
+   waiter->destlen  = destlen;
+   waiter->deadline = deadline;
+   waiter->cb       = cb;
+   waiter->cb_data  = cb_data;
+   /* A request with a callback may complete before the message is even
+    * queued, after which the waiter can be reused */
+   id = waiter->id;
+   *waiter_out = waiter;
+   if (id_out)
+      *id_out = id;
    LOG_TRACE("wait %p, reply to %p", waiter, dest);
    mmal_vc_use_internal(client);
 
+   if (send_dummy_bulk)
+      vcos_mutex_lock(&client->bulk_lock);
+
    vst = vchiq_queue_message(client->service, elems, 1);
 
    if (vst != VCHIQ_SUCCESS)
    {
-      ret = MMAL_EIO;
       if (send_dummy_bulk)
         vcos_mutex_unlock(&client->bulk_lock);
-      goto fail_msg;
+      mmal_vc_release_internal(client);
+      release_waiter(waitpool, waiter);
+      return MMAL_EIO;
    }
 
    if (send_dummy_bulk)
@@ -579,33 +902,190 @@ MMAL_STATUS_T mmal_vc_sendwait_message(struct MMAL_CLIENT_T *client,
       {
          LOG_ERROR("failed bulk transmit");
          /* This really should not happen and if it does, things will go wrong as
-          * we've already queued the vchiq message above. */
+          * we've already queued the vchiq message above. The waiter is left for
+          * the reply to recycle. */
          vcos_assert(0);
-         ret = MMAL_EIO;
-         goto fail_msg;
+         mmal_vc_cancel_reply(client, id);
+         return MMAL_EIO;
       }
    }
 
-   /* now wait for the reply...
-    *
-    * FIXME: we could do with a timeout here. Need to be careful to cancel
-    * the semaphore on a timeout.
-    */
-   /* coverity[lock] This semaphore isn't being used as a mutex */
-   vcos_semaphore_wait(&waiter->sem);
-
-   mmal_vc_release_internal(client);
-   LOG_TRACE("got reply (len %i/%i)", (int)*destlen, (int)waiter->destlen);
-   *destlen = waiter->destlen;
+   if (cb && deadline)
+   {
+      vcos_mutex_lock(&waitpool->lock);
+      if (!waitpool->timer_deadline || deadline < waitpool->timer_deadline)
+      {
+         waitpool->timer_deadline = deadline;
+         update_timer = MMAL_TRUE;
+      }
+      vcos_mutex_unlock(&waitpool->lock);
+      if (update_timer)
+         waitpool_timer_update(waitpool);
+   }
 
-   release_waiter(client, waiter);
    return MMAL_SUCCESS;
+}
+
+/** Wait for the reply to a request sent without a completion callback
+  * and recycle its waiter.
+  */
+static MMAL_STATUS_T mmal_vc_wait_waiter(MMAL_CLIENT_T *client, MMAL_WAITER_T *waiter,
+                                         size_t *destlen)
+{
+   MMAL_WAITPOOL_T *waitpool = &client->waitpool;
+   MMAL_BOOL_T timed_out = MMAL_FALSE;
+   uint32_t id = waiter->id;
+   uint64_t now;
+
+   if (!waitpool_enter(waitpool))
+      return MMAL_EIO;
+
+   if (!waiter->deadline)
+   {
+      /* coverity[lock] This semaphore isn't being used as a mutex */
+      vcos_semaphore_wait(&waiter->sem);
+   }
+   else if (vcos_semaphore_trywait(&waiter->sem) != VCOS_SUCCESS &&
+            ((now = vcos_getmicrosecs64()) >= waiter->deadline ||
+             vcos_semaphore_wait_timeout(&waiter->sem,
+                (VCOS_UNSIGNED)((waiter->deadline - now + 999) / 1000)) != VCOS_SUCCESS))
+   {
+      timed_out = MMAL_TRUE;
+   }
+
+   vcos_mutex_lock(&waitpool->lock);
+   if (waitpool_leave_locked(waitpool))
+   {
+      vcos_mutex_unlock(&waitpool->lock);
+      LOG_ERROR("request %u failed, client shut down", id);
+      return MMAL_EIO;
+   }
+
+   if (timed_out)
+   {
+      if (waiter->state == MMAL_WAITER_PENDING)
+      {
+         /* Leave the waiter for the reply to recycle, if it ever comes */
+         waiter->state = MMAL_WAITER_ABANDONED;
+         vcos_mutex_unlock(&waitpool->lock);
+         LOG_ERROR("request %u timed out", id);
+         mmal_vc_release_internal(client);
+         return MMAL_EAGAIN;
+      }
+
+      /* The reply arrived just in time and the semaphore was posted
+       * before the pool was unlocked */
+      vcos_semaphore_wait(&waiter->sem);
+   }
+
+   LOG_TRACE("got reply (len %i)", (int)waiter->destlen);
+   if (destlen)
+      *destlen = waiter->destlen;
+   release_waiter_locked(waitpool, waiter);
+   vcos_mutex_unlock(&waitpool->lock);
 
-fail_msg:
    mmal_vc_release_internal(client);
+   return MMAL_SUCCESS;
+}
+
+MMAL_STATUS_T mmal_vc_send_message_async(MMAL_CLIENT_T *client,
+                                         mmal_worker_msg_header *msg_header,
+                                         size_t size,
+                                         uint32_t msgid,
+                                         void *dest,
+                                         size_t destlen,
+                                         uint32_t timeout_ms,
+                                         MMAL_VC_REPLY_CB_T cb,
+                                         void *cb_data,
+                                         uint32_t *request)
+{
+   MMAL_WAITER_T *waiter;
+
+   if (!cb && !request)
+      return MMAL_EINVAL;
+
+   return mmal_vc_queue_request(client, msg_header, size, msgid, dest, destlen,
+                                timeout_ms, cb, cb_data, MMAL_FALSE, &waiter, request);
+}
+
+MMAL_STATUS_T mmal_vc_wait_reply(MMAL_CLIENT_T *client, uint32_t request, size_t *destlen)
+{
+   MMAL_WAITER_T *waiter;
+
+   vcos_mutex_lock(&client->waitpool.lock);
+   waiter = find_waiter_locked(&client->waitpool, request);
+   if (waiter && (waiter->cb || waiter->state == MMAL_WAITER_ABANDONED))
+      waiter = NULL;
+   vcos_mutex_unlock(&client->waitpool.lock);
+
+   if (!waiter)
+   {
+      LOG_ERROR("no request %u to wait for", request);
+      return MMAL_EINVAL;
+   }
+
+   return mmal_vc_wait_waiter(client, waiter, destlen);
+}
+
+MMAL_STATUS_T mmal_vc_cancel_reply(MMAL_CLIENT_T *client, uint32_t request)
+{
+   MMAL_WAITPOOL_T *waitpool = &client->waitpool;
+   MMAL_WAITER_STATE_T state = MMAL_WAITER_FREE;
+   MMAL_WAITER_T *waiter;
+
+   vcos_mutex_lock(&waitpool->lock);
+   waiter = find_waiter_locked(waitpool, request);
+   if (waiter)
+   {
+      state = waiter->state;
+      if (state == MMAL_WAITER_PENDING)
+         waiter->state = MMAL_WAITER_ABANDONED;
+   }
+   vcos_mutex_unlock(&waitpool->lock);
+
+   switch (state)
+   {
+   case MMAL_WAITER_PENDING:
+      /* The reply will recycle the waiter */
+      mmal_vc_release_internal(client);
+      return MMAL_SUCCESS;
+   case MMAL_WAITER_DONE:
+      /* Nobody collected the reply yet, drop it */
+      return mmal_vc_wait_waiter(client, waiter, NULL);
+   default:
+      return MMAL_EINVAL;
+   }
+}
+
+/** Send a message and wait for a reply.
+  * There is no deadline: like all the synchronous calls built on this, it
+  * blocks until VideoCore replies or the client is shut down.
+  *
+  * @param client       client to send message for
+  * @param msg_header   message vchiq_header to send
+  * @param size         length of message, including header
+  * @param msgid        message id
+  * @param dest         destination for reply
+  * @param destlen      size of destination, updated with actual length
+  * @param send_dummy_bulk whether to send a dummy bulk transfer
+  */
+MMAL_STATUS_T mmal_vc_sendwait_message(struct MMAL_CLIENT_T *client,
+                                       mmal_worker_msg_header *msg_header,
+                                       size_t size,
+                                       uint32_t msgid,
+                                       void *dest,
+                                       size_t *destlen,
+                                       MMAL_BOOL_T send_dummy_bulk)
+{
+   MMAL_STATUS_T status;
+   MMAL_WAITER_T *waiter;
+
+   status = mmal_vc_queue_request(client, msg_header, size, msgid, dest, *destlen,
+                                  0, NULL, NULL, send_dummy_bulk, &waiter, NULL);
+   if (status != MMAL_SUCCESS)
+      return status;
 
-   release_waiter(client, waiter);
-   return ret;
+   return mmal_vc_wait_waiter(client, waiter, destlen);
 }
 
 /** Send a message and do not wait for a reply.
@@ -71,6 +71,70 @@ MMAL_STATUS_T mmal_vc_sendwait_message(MMAL_CLIENT_T *client,
                                        size_t *destlen,
                                        MMAL_BOOL_T send_dummy_bulk);
 
+/** Called when the reply to a message sent with \ref mmal_vc_send_message_async
+ * arrives or when its deadline is reached.
+ * This runs in the VCHIQ or timer thread, so it must not block and must
+ * not wait for replies itself.
+ *
+ * @param cb_data      userdata given when sending the message
+ * @param request      request the reply is for
+ * @param status       MMAL_SUCCESS with the reply stored in the destination buffer,
+ *                     MMAL_EAGAIN if the deadline was reached first, or
+ *                     MMAL_EIO if the client was shut down
+ * @param replylen     length of the reply
+ */
+typedef void (*MMAL_VC_REPLY_CB_T)(void *cb_data, uint32_t request,
+                                   MMAL_STATUS_T status, size_t replylen);
+
+/** Send a message and return without waiting for the reply.
+ *
+ * With a completion callback, the callback is called exactly once unless the
+ * request is cancelled. Without one, the caller must either collect the reply
+ * with \ref mmal_vc_wait_reply or give up on it with \ref mmal_vc_cancel_reply.
+ * The destination buffer must remain valid until then.
+ *
+ * @param client       client to send message for
+ * @param header       message header to send
+ * @param size         length of message, including header
+ * @param msgid        message id
+ * @param dest         destination for reply
+ * @param destlen      size of destination
+ * @param timeout_ms   time after which the request fails with MMAL_EAGAIN,
+ *                     0 to wait forever. This includes the time spent waiting
+ *                     for a free slot when too many requests are in flight.
+ * @param cb           completion callback, or NULL to wait for the reply
+ * @param cb_data      userdata passed to the callback
+ * @param request      set to the id of the request, can be NULL with a callback
+ */
+MMAL_STATUS_T mmal_vc_send_message_async(MMAL_CLIENT_T *client,
+                                         mmal_worker_msg_header *header,
+                                         size_t size,
+                                         uint32_t msgid,
+                                         void *dest,
+                                         size_t destlen,
+                                         uint32_t timeout_ms,
+                                         MMAL_VC_REPLY_CB_T cb,
+                                         void *cb_data,
+                                         uint32_t *request);
+
+/** Wait for the reply to a message sent without a completion callback.
+ *
+ * @param client       client the message was sent with
+ * @param request      id of the request
+ * @param destlen      updated with the length of the reply, can be NULL
+ *
+ * @return MMAL_SUCCESS, MMAL_EAGAIN if the deadline of the request was reached,
+ * MMAL_EIO if the client was shut down or MMAL_EINVAL if there is no such request
+ */
+MMAL_STATUS_T mmal_vc_wait_reply(MMAL_CLIENT_T *client, uint32_t request, size_t *destlen);
+
+/** Give up on the reply to a message. The destination buffer is no longer
+ * accessed once this returns and the completion callback, if any, is not called.
+ *
+ * @return MMAL_SUCCESS, or MMAL_EINVAL if the request already completed
+ */
+MMAL_STATUS_T mmal_vc_cancel_reply(MMAL_CLIENT_T *client, uint32_t request);
+
 MMAL_STATUS_T mmal_vc_send_message(MMAL_CLIENT_T *client,
                                    mmal_worker_msg_header *header, size_t size,
                                    uint8_t *data, size_t data_size,